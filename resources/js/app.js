@@ -81,6 +81,53 @@ window.GoAccess = window.GoAccess || {
 		return panel ? this.AppData[panel] : this.AppData;
 	},
 
+	// Merge the given panels data. Panels that weren't there yet, e.g.,
+	// lazily loaded ones, get rendered along with the rest.
+	setPanelData: function (data) {
+		var ui = this.getPanelUI(), added = false;
+		for (var panel in data) {
+			if (!data.hasOwnProperty(panel))
+				continue;
+			if (!this.AppData.hasOwnProperty(panel) && ui.hasOwnProperty(panel)) {
+				GoAccess.Util.setProp(this.AppState, panel + '.sort', ui[panel].sort);
+				added = true;
+			}
+			this.AppData[panel] = data[panel];
+		}
+		this.AppState['updated'] = true;
+		if (!added)
+			return this.App.renderData();
+
+		GoAccess.OverallStats.initialize();
+		GoAccess.Panels.initialize();
+		GoAccess.Charts.initialize();
+		GoAccess.Tables.initialize();
+	},
+
+	// Fetch the data of each panel from its own file, gzip-compressed or
+	// not, rendering panels as their data comes in.
+	loadPanels: function (files) {
+		Object.keys(files).forEach(function (panel) {
+			fetch(files[panel]).then(function (res) {
+				if (!res.ok)
+					throw new Error(res.status + ' ' + res.statusText);
+				return res.arrayBuffer();
+			}).then(function (buf) {
+				var bytes = new Uint8Array(buf);
+				// served as is, i.e., not decoded through Content-Encoding
+				if (bytes[0] == 0x1f && bytes[1] == 0x8b) {
+					var gz = new Blob([buf]).stream().pipeThrough(new DecompressionStream('gzip'));
+					return new Response(gz).text();
+				}
+				return new TextDecoder().decode(bytes);
+			}).then(function (text) {
+				this.setPanelData(JSON.parse(text));
+			}.bind(this)).catch(function (err) {
+				console.error('Unable to load ' + files[panel] + ': ' + err);
+			});
+		}, this);
+	},
+
 	setWebSocket: function (wsConn) {
 		var host = null;
 		host = wsConn.url ? wsConn.url : window.location.hostname ? window.location.hostname : "localhost";
@@ -93,9 +140,8 @@ window.GoAccess = window.GoAccess || {
 		}.bind(this);
 
 		socket.onmessage = function (event) {
-			this.AppState['updated'] = true;
-			this.AppData = JSON.parse(event.data);
-			this.App.renderData();
+			// updates carry only the panels that changed
+			this.setPanelData(JSON.parse(event.data));
 		}.bind(this);
 
 		socket.onclose = function (event) {
@@ -1789,5 +1835,6 @@ window.onload = function () {
 		'prefs': window.html_prefs || {},
 	});
 	GoAccess.App.initialize();
+	GoAccess.loadPanels(window.json_panels || {});
 };
 }());
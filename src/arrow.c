@@ -0,0 +1,725 @@
+/**
+ * arrow.c -- output an Apache Arrow IPC file
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arrow.h"
+
+#include "error.h"
+#include "settings.h"
+#include "ui.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* Columns of a panel's table, in the order of GArrowColId */
+static const GArrowField arrow_fields[ARROW_COLS] = {
+  {"module", ARROW_DICT, ARROW_DICT_MODULE},
+  {"data", ARROW_STR, -1},
+  {"root", ARROW_DICT, ARROW_DICT_ROOT},
+  {"hits", ARROW_INT64, -1},
+  {"visitors", ARROW_INT64, -1},
+  {"bw", ARROW_UINT64, -1},
+  {"avgts", ARROW_UINT64, -1},
+  {"cumts", ARROW_UINT64, -1},
+  {"maxts", ARROW_UINT64, -1},
+  {"method", ARROW_DICT, ARROW_DICT_METHOD},
+  {"protocol", ARROW_DICT, ARROW_DICT_PROTOCOL},
+};
+
+/* Append the given bytes to the buffer, or zeros if data is NULL. */
+static void
+buf_put (GArrowBuf * b, const void *data, size_t len)
+{
+  if (len == 0)
+    return;
+
+  if (b->len + len > b->size) {
+    b->size = (b->len + len) * 2;
+    b->data = xrealloc (b->data, b->size);
+  }
+  if (data)
+    memcpy (b->data + b->len, data, len);
+  else
+    memset (b->data + b->len, 0, len);
+  b->len += len;
+}
+
+/* Set the given integer at the given position of the buffer, as a
+ * little-endian integer of the given num of bytes. */
+static void
+buf_set_int (GArrowBuf * b, size_t pos, uint64_t value, int bytes)
+{
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    b->data[pos + i] = (char) ((value >> (8 * i)) & 0xFF);
+}
+
+/* Append the given integer to the buffer, as a little-endian integer of
+ * the given num of bytes. */
+static void
+buf_put_int (GArrowBuf * b, uint64_t value, int bytes)
+{
+  buf_put (b, NULL, bytes);
+  buf_set_int (b, b->len - bytes, value, bytes);
+}
+
+/* Pad the buffer with zeros up to a multiple of the given alignment. */
+static void
+buf_align (GArrowBuf * b, size_t align)
+{
+  buf_put (b, NULL, (align - b->len % align) % align);
+}
+
+/* Write a flatbuffers table right after its vtable. The given inline
+ * size of each field is either 1, 2, 4 or 8 bytes, or 0 if the field is
+ * absent. Fields pointing to strings, vectors or other tables are then
+ * set through fb_set_offset(), to objects written after the table.
+ *
+ * On success, the position of each field is set into pos and the
+ * position of the table is returned. */
+static size_t
+fb_table (GArrowBuf * b, const int *sizes, int nfields, size_t * pos)
+{
+  size_t vtable, table, off = 4;
+  int i, vtsize = 4 + 2 * nfields;
+
+  /* the table starts on an 8-byte boundary, right after its vtable */
+  buf_put (b, NULL, (ARROW_ALIGN - (b->len + vtsize) % ARROW_ALIGN) %
+           ARROW_ALIGN);
+  vtable = b->len;
+  buf_put (b, NULL, vtsize);
+  table = b->len;
+
+  for (i = 0; i < nfields; i++) {
+    pos[i] = 0;
+    if (sizes[i] == 0)
+      continue;
+    off += (sizes[i] - off % sizes[i]) % sizes[i];
+    pos[i] = table + off;
+    buf_set_int (b, vtable + 4 + 2 * i, off, 2);
+    off += sizes[i];
+  }
+  buf_set_int (b, vtable, vtsize, 2);
+  buf_set_int (b, vtable + 2, off, 2);
+
+  buf_put (b, NULL, off);
+  /* signed offset from the table back to its vtable */
+  buf_set_int (b, table, table - vtable, 4);
+
+  return table;
+}
+
+/* Point the offset field at the given position to the given object,
+ * which always follows it. */
+static void
+fb_set_offset (GArrowBuf * b, size_t pos, size_t target)
+{
+  buf_set_int (b, pos, target - pos, 4);
+}
+
+/* Write a flatbuffers string.
+ *
+ * On success, the position of the string is returned. */
+static size_t
+fb_string (GArrowBuf * b, const char *str)
+{
+  size_t pos, len = strlen (str);
+
+  buf_align (b, 4);
+  pos = b->len;
+  buf_put_int (b, len, 4);
+  buf_put (b, str, len);
+  buf_put (b, NULL, 1);
+
+  return pos;
+}
+
+/* Write the length of a flatbuffers vector, so that its elements,
+ * appended next by the caller, are aligned to the given boundary.
+ *
+ * On success, the position of the vector is returned. */
+static size_t
+fb_vector (GArrowBuf * b, int count, size_t align)
+{
+  size_t pos;
+
+  buf_put (b, NULL, (align - (b->len + 4) % align) % align);
+  pos = b->len;
+  buf_put_int (b, count, 4);
+
+  return pos;
+}
+
+/* Write an Int type table.
+ *
+ * On success, the position of the table is returned. */
+static size_t
+fb_int_type (GArrowBuf * b, int bits, int is_signed)
+{
+  int sizes[2] = { 4, 1 };
+  size_t pos[2], table;
+
+  table = fb_table (b, sizes, 2, pos);
+  buf_set_int (b, pos[0], bits, 4);
+  buf_set_int (b, pos[1], is_signed, 1);
+
+  return table;
+}
+
+/* Write a Field table describing the given column.
+ *
+ * On success, the position of the table is returned. */
+static size_t
+fb_field (GArrowBuf * b, const GArrowField * field)
+{
+  /* name, nullable, type_type, type, dictionary, children */
+  int sizes[6] = { 4, 1, 1, 4, 0, 4 };
+  int dsizes[2] = { 8, 4 };
+  size_t pos[6], dpos[2], table, dict;
+
+  if (field->kind == ARROW_DICT)
+    sizes[4] = 4;
+  table = fb_table (b, sizes, 6, pos);
+  buf_set_int (b, pos[1], 1, 1);
+
+  fb_set_offset (b, pos[0], fb_string (b, field->name));
+
+  /* dictionary-encoded columns are typed after their values */
+  switch (field->kind) {
+  case ARROW_INT64:
+    buf_set_int (b, pos[2], ARROW_TYPE_INT, 1);
+    fb_set_offset (b, pos[3], fb_int_type (b, 64, 1));
+    break;
+  case ARROW_UINT64:
+    buf_set_int (b, pos[2], ARROW_TYPE_INT, 1);
+    fb_set_offset (b, pos[3], fb_int_type (b, 64, 0));
+    break;
+  default:
+    buf_set_int (b, pos[2], ARROW_TYPE_UTF8, 1);
+    fb_set_offset (b, pos[3], fb_table (b, NULL, 0, NULL));
+  }
+
+  if (field->kind == ARROW_DICT) {
+    dict = fb_table (b, dsizes, 2, dpos);
+    fb_set_offset (b, pos[4], dict);
+    buf_set_int (b, dpos[0], field->dict, 8);
+    fb_set_offset (b, dpos[1], fb_int_type (b, 32, 1));
+  }
+
+  fb_set_offset (b, pos[5], fb_vector (b, 0, 4));
+
+  return table;
+}
+
+/* Write a Schema table with all the columns.
+ *
+ * On success, the position of the table is returned. */
+static size_t
+fb_schema (GArrowBuf * b)
+{
+  /* endianness (little, the default), fields */
+  int sizes[2] = { 0, 4 };
+  size_t pos[2], table, vec;
+  int i;
+
+  table = fb_table (b, sizes, 2, pos);
+  vec = fb_vector (b, ARROW_COLS, 4);
+  fb_set_offset (b, pos[1], vec);
+  buf_put (b, NULL, 4 * ARROW_COLS);
+
+  for (i = 0; i < ARROW_COLS; i++)
+    fb_set_offset (b, vec + 4 + 4 * i, fb_field (b, &arrow_fields[i]));
+
+  return table;
+}
+
+/* Get the buffers of a column within a message body.
+ *
+ * On success, the buffers are set and their num is returned. */
+static int
+col_buffers (GArrowCol * col, GArrowBuf ** bufs)
+{
+  int n = 0;
+
+  bufs[n++] = &col->validity;
+  if (col->str)
+    bufs[n++] = &col->offsets;
+  bufs[n++] = &col->values;
+
+  return n;
+}
+
+/* Get the num of bytes a buffer takes within a message body. A column
+ * without nulls has an empty validity bitmap.
+ *
+ * On success, the num of bytes is returned. */
+static size_t
+col_buffer_len (GArrowCol * col, GArrowBuf * buf)
+{
+  size_t len = buf->len;
+
+  if (buf == &col->validity && col->nulls == 0)
+    return 0;
+
+  return len + (ARROW_ALIGN - len % ARROW_ALIGN) % ARROW_ALIGN;
+}
+
+/* Get the length of the body holding the given columns.
+ *
+ * On success, the length is returned. */
+static int64_t
+body_length (GArrowCol * cols, int ncols)
+{
+  GArrowBuf *bufs[3];
+  int64_t len = 0;
+  int i, j, n;
+
+  for (i = 0; i < ncols; i++) {
+    n = col_buffers (&cols[i], bufs);
+    for (j = 0; j < n; j++)
+      len += col_buffer_len (&cols[i], bufs[j]);
+  }
+
+  return len;
+}
+
+/* Write a RecordBatch table locating the given columns in the body.
+ *
+ * On success, the position of the table is returned. */
+static size_t
+fb_record_batch (GArrowBuf * b, GArrowCol * cols, int ncols, int len)
+{
+  /* length, nodes, buffers */
+  int sizes[3] = { 8, 4, 4 };
+  GArrowBuf *bufs[3];
+  size_t pos[3], table, vec, blen;
+  int64_t off = 0;
+  int i, j, n, nbufs = 0;
+
+  table = fb_table (b, sizes, 3, pos);
+  buf_set_int (b, pos[0], len, 8);
+
+  /* a FieldNode struct per column */
+  vec = fb_vector (b, ncols, 8);
+  fb_set_offset (b, pos[1], vec);
+  for (i = 0; i < ncols; i++) {
+    buf_put_int (b, cols[i].len, 8);
+    buf_put_int (b, cols[i].nulls, 8);
+    nbufs += col_buffers (&cols[i], bufs);
+  }
+
+  /* a Buffer struct per buffer of each column */
+  vec = fb_vector (b, nbufs, 8);
+  fb_set_offset (b, pos[2], vec);
+  for (i = 0; i < ncols; i++) {
+    n = col_buffers (&cols[i], bufs);
+    for (j = 0; j < n; j++) {
+      blen = col_buffer_len (&cols[i], bufs[j]);
+      buf_put_int (b, off, 8);
+      buf_put_int (b, blen ? bufs[j]->len : 0, 8);
+      off += blen;
+    }
+  }
+
+  return table;
+}
+
+/* Write a Message table of the given type.
+ *
+ * On success, the position of its header field is returned. */
+static size_t
+fb_message (GArrowBuf * b, int type, int64_t body_len)
+{
+  /* version, header_type, header, bodyLength */
+  int sizes[4] = { 2, 1, 4, 8 };
+  size_t pos[4], table;
+
+  buf_put (b, NULL, 4);
+  table = fb_table (b, sizes, 4, pos);
+  fb_set_offset (b, 0, table);
+
+  buf_set_int (b, pos[0], ARROW_V5, 2);
+  buf_set_int (b, pos[1], type, 1);
+  buf_set_int (b, pos[3], body_len, 8);
+
+  return pos[2];
+}
+
+/* Write the given bytes into the file.
+ *
+ * On error, it aborts.
+ * On success, the bytes are written. */
+static void
+arrow_write (GArrow * a, const void *data, size_t len)
+{
+  if (len > 0 && fwrite (data, 1, len, a->fp) != len)
+    FATAL ("Unable to write Arrow file: %s.", strerror (errno));
+  a->offset += len;
+}
+
+/* Write an encapsulated message, its metadata padded to an 8-byte
+ * boundary and followed by the buffers of the given columns. */
+static void
+write_message (GArrow * a, GArrowBuf * meta, GArrowCol * cols, int ncols,
+               GArrowBlock * block)
+{
+  static const char zeros[ARROW_ALIGN] = { 0 };
+  GArrowBuf prefix = { 0 }, *bufs[3];
+  size_t len;
+  int i, j, n;
+
+  buf_align (meta, ARROW_ALIGN);
+  buf_put_int (&prefix, ARROW_CONT, 4);
+  buf_put_int (&prefix, meta->len, 4);
+
+  if (block) {
+    block->offset = a->offset;
+    block->meta_len = prefix.len + meta->len;
+    block->body_len = body_length (cols, ncols);
+  }
+
+  arrow_write (a, prefix.data, prefix.len);
+  arrow_write (a, meta->data, meta->len);
+  for (i = 0; i < ncols; i++) {
+    n = col_buffers (&cols[i], bufs);
+    for (j = 0; j < n; j++) {
+      if ((len = col_buffer_len (&cols[i], bufs[j])) == 0)
+        continue;
+      arrow_write (a, bufs[j]->data, bufs[j]->len);
+      arrow_write (a, zeros, len - bufs[j]->len);
+    }
+  }
+  free (prefix.data);
+}
+
+/* Initialize a column, a string one if str is set. */
+static void
+init_col (GArrowCol * col, int str)
+{
+  memset (col, 0, sizeof (GArrowCol));
+  col->str = str;
+  if (str)
+    buf_put_int (&col->offsets, 0, 4);
+}
+
+/* Free the buffers of a column. */
+static void
+free_col (GArrowCol * col)
+{
+  free (col->validity.data);
+  free (col->offsets.data);
+  free (col->values.data);
+}
+
+/* Account for a value appended to the column, setting its bit within
+ * the validity bitmap. */
+static void
+col_put_valid (GArrowCol * col, int valid)
+{
+  if (col->len % 8 == 0)
+    buf_put (&col->validity, NULL, 1);
+  if (valid)
+    col->validity.data[col->len / 8] |= (char) (1 << (col->len % 8));
+  else
+    col->nulls++;
+  col->len++;
+}
+
+/* Append a string to a string column. */
+static void
+col_put_str (GArrowCol * col, const char *str)
+{
+  col_put_valid (col, 1);
+  buf_put (&col->values, str, strlen (str));
+  if (col->values.len > INT32_MAX)
+    FATAL ("Unable to write Arrow file: column too large.");
+  buf_put_int (&col->offsets, col->values.len, 4);
+}
+
+/* Append an integer to an int64 or uint64 column. */
+static void
+col_put_int (GArrowCol * col, uint64_t value)
+{
+  col_put_valid (col, 1);
+  buf_put_int (&col->values, value, 8);
+}
+
+/* Append a dictionary index to a column, a null one if negative. */
+static void
+col_put_idx (GArrowCol * col, int idx)
+{
+  col_put_valid (col, idx >= 0);
+  buf_put_int (&col->values, idx < 0 ? 0 : idx, 4);
+}
+
+/* Get the index of the given string within a dictionary, adding it if
+ * it's not there yet.
+ *
+ * If the string is NULL, -1 is returned.
+ * On success, the index of the string is returned. */
+static int
+dict_idx (GArrowDict * dict, const char *str)
+{
+  khiter_t k;
+  int ret;
+
+  if (str == NULL)
+    return -1;
+
+  k = kh_get (sarrow, dict->ht, str);
+  if (k != kh_end (dict->ht))
+    return kh_val (dict->ht, k);
+
+  k = kh_put (sarrow, dict->ht, xstrdup (str), &ret);
+  kh_val (dict->ht, k) = dict->values.len;
+  col_put_str (&dict->values, str);
+
+  return kh_val (dict->ht, k);
+}
+
+/* Append a row with the given metrics to the batch of a panel. Items
+ * under a root get it set on their row. */
+static void
+put_arrow_row (GArrow * a, GArrowBatch * batch, GModule module,
+               GMetrics * metrics, const char *root)
+{
+  GArrowCol *cols = batch->cols;
+  GArrowDict *dicts = a->dicts;
+
+  col_put_idx (&cols[ARROW_COL_MODULE],
+               dict_idx (&dicts[ARROW_DICT_MODULE], module_to_id (module)));
+  col_put_str (&cols[ARROW_COL_DATA], metrics->data ? metrics->data : "");
+  col_put_idx (&cols[ARROW_COL_ROOT],
+               dict_idx (&dicts[ARROW_DICT_ROOT], root));
+  col_put_int (&cols[ARROW_COL_HITS], metrics->hits);
+  col_put_int (&cols[ARROW_COL_VISITORS], metrics->visitors);
+  col_put_int (&cols[ARROW_COL_BW], metrics->bw.nbw);
+  col_put_int (&cols[ARROW_COL_AVGTS], metrics->avgts.nts);
+  col_put_int (&cols[ARROW_COL_CUMTS], metrics->cumts.nts);
+  col_put_int (&cols[ARROW_COL_MAXTS], metrics->maxts.nts);
+  col_put_idx (&cols[ARROW_COL_METHOD],
+               dict_idx (&dicts[ARROW_DICT_METHOD], metrics->method));
+  col_put_idx (&cols[ARROW_COL_PROTOCOL],
+               dict_idx (&dicts[ARROW_DICT_PROTOCOL], metrics->protocol));
+  batch->len++;
+}
+
+/* Load the items of a panel's holder into its batch. Panels with a
+ * root, e.g., OS, get a row per item under each root, while the sub
+ * items of a host only decorate it and are left out. */
+static void
+load_arrow_batch (GArrow * a, GArrowBatch * batch, GHolder * h)
+{
+  GSubItem *iter;
+  int i;
+
+  for (i = 0; i < ARROW_COLS; i++)
+    init_col (&batch->cols[i], arrow_fields[i].kind == ARROW_STR);
+
+  for (i = 0; i < h->idx; i++) {
+    if (h->items[i].sub_list == NULL || h->module == HOSTS) {
+      put_arrow_row (a, batch, h->module, h->items[i].metrics, NULL);
+      continue;
+    }
+    for (iter = h->items[i].sub_list->head; iter; iter = iter->next)
+      put_arrow_row (a, batch, h->module, iter->metrics,
+                     h->items[i].metrics->data);
+  }
+}
+
+/* Write the schema message. */
+static void
+write_arrow_schema (GArrow * a)
+{
+  GArrowBuf meta = { 0 };
+  size_t header;
+
+  header = fb_message (&meta, ARROW_MSG_SCHEMA, 0);
+  fb_set_offset (&meta, header, fb_schema (&meta));
+  write_message (a, &meta, NULL, 0, NULL);
+  free (meta.data);
+}
+
+/* Write the given dictionary as a DictionaryBatch message. */
+static void
+write_arrow_dict (GArrow * a, int id)
+{
+  GArrowCol *values = &a->dicts[id].values;
+  GArrowBuf meta = { 0 };
+  int sizes[2] = { 8, 4 };
+  size_t header, pos[2], table;
+
+  header = fb_message (&meta, ARROW_MSG_DICT, body_length (values, 1));
+  table = fb_table (&meta, sizes, 2, pos);
+  fb_set_offset (&meta, header, table);
+  buf_set_int (&meta, pos[0], id, 8);
+  fb_set_offset (&meta, pos[1], fb_record_batch (&meta, values, 1,
+                                                 values->len));
+
+  write_message (a, &meta, values, 1, &a->dict_blocks[id]);
+  free (meta.data);
+}
+
+/* Write the batch of a panel as a RecordBatch message. */
+static void
+write_arrow_batch (GArrow * a, int idx)
+{
+  GArrowBatch *batch = &a->batches[idx];
+  GArrowBuf meta = { 0 };
+  size_t header;
+
+  header = fb_message (&meta, ARROW_MSG_BATCH,
+                       body_length (batch->cols, ARROW_COLS));
+  fb_set_offset (&meta, header, fb_record_batch (&meta, batch->cols,
+                                                 ARROW_COLS, batch->len));
+  write_message (a, &meta, batch->cols, ARROW_COLS, &a->batch_blocks[idx]);
+  free (meta.data);
+}
+
+/* Append a vector of Block structs locating the given messages. */
+static size_t
+fb_blocks (GArrowBuf * b, const GArrowBlock * blocks, int len)
+{
+  size_t vec;
+  int i;
+
+  vec = fb_vector (b, len, 8);
+  for (i = 0; i < len; i++) {
+    buf_put_int (b, blocks[i].offset, 8);
+    buf_put_int (b, blocks[i].meta_len, 4);
+    buf_put (b, NULL, 4);
+    buf_put_int (b, blocks[i].body_len, 8);
+  }
+
+  return vec;
+}
+
+/* Write the end-of-stream marker and the file footer, followed by its
+ * length and the magic. */
+static void
+write_arrow_footer (GArrow * a)
+{
+  /* version, schema, dictionaries, recordBatches */
+  int sizes[4] = { 2, 4, 4, 4 };
+  GArrowBuf meta = { 0 }, tail = { 0 };
+  size_t pos[4], table;
+
+  buf_put_int (&tail, ARROW_CONT, 4);
+  buf_put_int (&tail, 0, 4);
+  arrow_write (a, tail.data, tail.len);
+  tail.len = 0;
+
+  buf_put (&meta, NULL, 4);
+  table = fb_table (&meta, sizes, 4, pos);
+  fb_set_offset (&meta, 0, table);
+  buf_set_int (&meta, pos[0], ARROW_V5, 2);
+  fb_set_offset (&meta, pos[1], fb_schema (&meta));
+  fb_set_offset (&meta, pos[2], fb_blocks (&meta, a->dict_blocks,
+                                           ARROW_DICTS));
+  fb_set_offset (&meta, pos[3], fb_blocks (&meta, a->batch_blocks,
+                                           a->nbatches));
+  arrow_write (a, meta.data, meta.len);
+
+  buf_put_int (&tail, meta.len, 4);
+  buf_put (&tail, ARROW_MAGIC, strlen (ARROW_MAGIC));
+  arrow_write (a, tail.data, tail.len);
+
+  free (meta.data);
+  free (tail.data);
+}
+
+/* Free the dictionaries and batches of the file. */
+static void
+free_arrow (GArrow * a)
+{
+  khiter_t k;
+  int i, j;
+
+  for (i = 0; i < ARROW_DICTS; i++) {
+    for (k = kh_begin (a->dicts[i].ht); k != kh_end (a->dicts[i].ht); ++k) {
+      if (kh_exist (a->dicts[i].ht, k))
+        free ((char *) kh_key (a->dicts[i].ht, k));
+    }
+    kh_destroy (sarrow, a->dicts[i].ht);
+    free_col (&a->dicts[i].values);
+  }
+  for (i = 0; i < a->nbatches; i++) {
+    for (j = 0; j < ARROW_COLS; j++)
+      free_col (&a->batches[i].cols[j]);
+  }
+  free (a->batches);
+  free (a->batch_blocks);
+}
+
+/* Entry point to generate an Arrow IPC file. Each panel is written as
+ * a record batch of a single table, its strings dictionary-encoded. As
+ * the dictionaries come first, all batches are built before any of them
+ * is written. */
+void
+output_arrow (GHolder * holder, const char *filename)
+{
+  GArrow a;
+  size_t idx = 0;
+  int i;
+
+  memset (&a, 0, sizeof (GArrow));
+  for (i = 0; i < ARROW_DICTS; i++) {
+    a.dicts[i].ht = kh_init (sarrow);
+    init_col (&a.dicts[i].values, 1);
+  }
+
+  a.batches = xcalloc (TOTAL_MODULES, sizeof (GArrowBatch));
+  FOREACH_MODULE (idx, module_list) {
+    if (holder[module_list[idx]].idx == 0)
+      continue;
+    load_arrow_batch (&a, &a.batches[a.nbatches++],
+                      holder + module_list[idx]);
+  }
+  a.batch_blocks = xcalloc (a.nbatches + 1, sizeof (GArrowBlock));
+
+  a.fp = (filename != NULL) ? fopen (filename, "wb") : stdout;
+  if (!a.fp)
+    FATAL ("Unable to open Arrow file: %s.", strerror (errno));
+
+  arrow_write (&a, ARROW_MAGIC "\0\0", ARROW_ALIGN);
+  write_arrow_schema (&a);
+  for (i = 0; i < ARROW_DICTS; i++)
+    write_arrow_dict (&a, i);
+  for (i = 0; i < a.nbatches; i++)
+    write_arrow_batch (&a, i);
+  write_arrow_footer (&a);
+
+  fclose (a.fp);
+  free_arrow (&a);
+}
@@ -0,0 +1,158 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef ARROW_H_INCLUDED
+#define ARROW_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "commons.h"
+#include "khash.h"
+
+#define ARROW_MAGIC     "ARROW1"        /* 6 bytes, padded to 8 */
+#define ARROW_ALIGN     8       /* buffers start on 8-byte boundaries */
+#define ARROW_CONT      0xFFFFFFFF      /* continuation marker */
+#define ARROW_V5        4       /* MetadataVersion.V5 */
+
+/* Message header types */
+#define ARROW_MSG_SCHEMA 1
+#define ARROW_MSG_DICT   2
+#define ARROW_MSG_BATCH  3
+
+/* Field types */
+#define ARROW_TYPE_INT  2
+#define ARROW_TYPE_UTF8 5
+
+/* Dictionaries of the dictionary-encoded columns */
+typedef enum GArrowDictId_
+{
+  ARROW_DICT_MODULE,
+  ARROW_DICT_ROOT,
+  ARROW_DICT_METHOD,
+  ARROW_DICT_PROTOCOL,
+  ARROW_DICTS,
+} GArrowDictId;
+
+/* Columns of the table a panel is written as */
+typedef enum GArrowColId_
+{
+  ARROW_COL_MODULE,
+  ARROW_COL_DATA,
+  ARROW_COL_ROOT,
+  ARROW_COL_HITS,
+  ARROW_COL_VISITORS,
+  ARROW_COL_BW,
+  ARROW_COL_AVGTS,
+  ARROW_COL_CUMTS,
+  ARROW_COL_MAXTS,
+  ARROW_COL_METHOD,
+  ARROW_COL_PROTOCOL,
+  ARROW_COLS,
+} GArrowColId;
+
+/* Kind of values of a column */
+typedef enum GArrowKind_
+{
+  ARROW_STR,                    /* utf8 */
+  ARROW_DICT,                   /* int32 indices into a dictionary */
+  ARROW_INT64,
+  ARROW_UINT64,
+} GArrowKind;
+
+/* A column of the schema */
+typedef struct GArrowField_
+{
+  const char *name;
+  GArrowKind kind;
+  int dict;                     /* GArrowDictId of ARROW_DICT columns */
+} GArrowField;
+
+/* A growable buffer of bytes */
+typedef struct GArrowBuf_
+{
+  char *data;
+  size_t len;
+  size_t size;
+} GArrowBuf;
+
+/* The buffers of a column of a record batch */
+typedef struct GArrowCol_
+{
+  GArrowBuf validity;           /* bitmap, written only if there are nulls */
+  GArrowBuf offsets;            /* int32 offsets of string columns */
+  GArrowBuf values;
+  int len;                      /* num of values */
+  int nulls;                    /* num of null values */
+  int str;                      /* is a string column */
+} GArrowCol;
+
+KHASH_MAP_INIT_STR (sarrow, int);
+
+/* A dictionary, mapping each string to its index */
+typedef struct GArrowDict_
+{
+  khash_t (sarrow) * ht;
+  GArrowCol values;
+} GArrowDict;
+
+/* The record batch of a panel */
+typedef struct GArrowBatch_
+{
+  GArrowCol cols[ARROW_COLS];
+  int len;
+} GArrowBatch;
+
+/* Location of a message within the file, see the file footer */
+typedef struct GArrowBlock_
+{
+  int64_t offset;
+  int32_t meta_len;             /* including the 8-byte prefix */
+  int64_t body_len;
+} GArrowBlock;
+
+/* An Arrow IPC file being written */
+typedef struct GArrow_
+{
+  FILE *fp;
+  int64_t offset;               /* bytes written so far */
+  GArrowDict dicts[ARROW_DICTS];
+  GArrowBatch *batches;
+  int nbatches;
+  GArrowBlock dict_blocks[ARROW_DICTS];
+  GArrowBlock *batch_blocks;
+} GArrow;
+
+void output_arrow (GHolder * holder, const char *filename);
+
+#endif
@@ -37,14 +37,36 @@
 #include "browsers.h"
 
 #include "error.h"
+#include "gmatch.h"
 #include "settings.h"
 #include "util.h"
 #include "xmalloc.h"
 
-/* ###NOTE: The size of the list is proportional to the run time,
- * which makes this pretty slow */
-
 static char ***browsers_hash = NULL;
+/* user's browsers followed by the default ones, in priority order, and
+ * the crawler markers as a group of their own */
+static GMatch *browsers_match = NULL;
+
+/* groups of patterns of the browsers matcher */
+#define MATCH_BROWSERS 0
+#define MATCH_CRAWLERS 1
+#define MATCH_GROUPS   2
+
+/* If any of the following strings is found within a user agent, it's
+ * highly likely a crawler linking to its own page, in priority order.
+ * Note that this could certainly return false positives. */
+static const char *crawler_markers[] = {
+  /* e.g., compatible; bingbot/2.0; +http://www.bing.com/bingbot.htm */
+  "; +http",
+  /* compatible; UptimeRobot/2.0; http://www.uptimerobot.com/ */
+  "; http",
+  /* Slack-ImgProxy (+https://api.slack.com/robots) */
+  " (+http",
+  /* TurnitinBot/3.0 (http://www.turnitin.com/robot/crawlerinfo.html) */
+  " (http",
+  /* w3c e.g., (compatible;+Googlebot/2.1;++http://www.google.com/bot.html) */
+  ";++http",
+};
 
 /* {"search string", "belongs to"} */
 static const char *browsers[][2] = {
@@ -238,6 +260,9 @@ free_browsers_hash (void)
   if (conf.browsers_file) {
     free (conf.user_browsers_hash);
   }
+
+  free_gmatch (browsers_match);
+  browsers_match = NULL;
 }
 
 static int
@@ -295,6 +320,26 @@ parse_browser_token (char ***list, char *line, int n)
   conf.browsers_hash_idx++;
 }
 
+/* Build a single matcher out of the user's browsers list followed by
+ * our default array of browsers, so a user agent can be matched
+ * against all of them in one pass while preserving their order. The
+ * same pass looks for the crawler markers. */
+static void
+build_browsers_match (void)
+{
+  size_t i;
+  int j;
+
+  browsers_match = new_gmatch ();
+  for (j = 0; j < conf.browsers_hash_idx; ++j)
+    gmatch_add (browsers_match, conf.user_browsers_hash[j][0]);
+  for (i = 0; i < ARRAY_SIZE (browsers); ++i)
+    gmatch_add (browsers_match, browsers_hash[i][0]);
+  for (i = 0; i < ARRAY_SIZE (crawler_markers); ++i)
+    gmatch_add_group (browsers_match, crawler_markers[i], MATCH_CRAWLERS);
+  gmatch_build (browsers_match);
+}
+
 /* Parse our default array of browsers and put them on our hash including those
  * from the custom parsed browsers file.
  *
@@ -314,8 +359,10 @@ parse_browsers_file (void)
     set_browser (browsers_hash, i, browsers[i][0], browsers[i][1]);
   }
 
-  if (!conf.browsers_file)
+  if (!conf.browsers_file) {
+    build_browsers_match ();
     return;
+  }
 
   /* could not open browsers file */
   if ((file = fopen (conf.browsers_file, "r")) == NULL)
@@ -335,6 +382,8 @@ parse_browsers_file (void)
     parse_browser_token (conf.user_browsers_hash, line, n);
   }
   fclose (file);
+
+  build_browsers_match ();
 }
 
 /* Determine if the user-agent is a crawler.
@@ -407,35 +456,6 @@ parse_crawler (char *str, char *match, char *type)
   return xstrdup (match);
 }
 
-/* If the following string matches are found within user agent, then it's
- * highly likely it's a possible crawler.
- * Note that this could certainly return false positives.
- *
- * If no occurrences are found, NULL is returned.
- * If an occurrence is found, a pointer to the match is returned . */
-static char *
-check_http_crawler (const char *str)
-{
-  char *match = NULL;
-
-  /* e.g., compatible; bingbot/2.0; +http://www.bing.com/bingbot.htm */
-  if ((match = strstr (str, "; +http")))
-    return match;
-  /* compatible; UptimeRobot/2.0; http://www.uptimerobot.com/ */
-  if ((match = strstr (str, "; http")))
-    return match;
-  /* Slack-ImgProxy (+https://api.slack.com/robots) */
-  if ((match = strstr (str, " (+http")))
-    return match;
-  /*  TurnitinBot/3.0 (http://www.turnitin.com/robot/crawlerinfo.html) */
-  if ((match = strstr (str, " (http")))
-    return match;
-  /* w3c e.g., (compatible;+Googlebot/2.1;++http://www.google.com/bot.html) */
-  if ((match = strstr (str, ";++http")))
-    return match;
-  return NULL;
-}
-
 /* Parse the given user agent match and extract the browser string.
  *
  * If no match, the original match is returned.
@@ -483,38 +503,44 @@ parse_browser (char *match, char *type, int i, char ***hash)
 
 /* Given a user agent, determine the browser used.
  *
- * ###NOTE: The size of the list is proportional to the run time,
- * which makes this pretty slow
+ * The user's list, the default list and the crawler markers are matched
+ * in a single pass, the user's list taking precedence over crawlers,
+ * and these over the default list.
  *
  * On error, NULL is returned.
  * On success, a malloc'd  string containing the browser is returned. */
 char *
 verify_browser (char *str, char *type)
 {
+  const char *found[MATCH_GROUPS] = { NULL, NULL };
   char *match = NULL, *token = NULL;
-  int i = 0;
-  size_t j = 0;
+  int idx = -1, groups[MATCH_GROUPS] = { -1, -1 };
 
   if (str == NULL || *str == '\0')
     return NULL;
 
+  gmatch_find_groups (browsers_match, str, groups, found);
+  if ((idx = groups[MATCH_BROWSERS]) != -1)
+    match = str + (found[MATCH_BROWSERS] - str);
+
   /* check user's list */
-  for (i = 0; i < conf.browsers_hash_idx; ++i) {
-    if ((match = strstr (str, conf.user_browsers_hash[i][0])) == NULL)
-      continue;
-    return parse_browser (match, type, i, conf.user_browsers_hash);
+  if (idx != -1 && idx < conf.browsers_hash_idx)
+    return parse_browser (match, type, idx, conf.user_browsers_hash);
+
+  if (groups[MATCH_CRAWLERS] != -1) {
+    token = str + (found[MATCH_CRAWLERS] - str);
+    if ((token = parse_crawler (str, token, type)))
+      return token;
+    /* the user agent may have been truncated while parsing it */
+    idx = gmatch_find (browsers_match, str, &found[MATCH_BROWSERS]);
+    if (idx != -1)
+      match = str + (found[MATCH_BROWSERS] - str);
   }
 
-  if ((match = check_http_crawler (str)) &&
-      (token = parse_crawler (str, match, type)))
-    return token;
-
   /* fallback to default browser list */
-  for (j = 0; j < ARRAY_SIZE (browsers); ++j) {
-    if ((match = strstr (str, browsers_hash[j][0])) == NULL)
-      continue;
-    return parse_browser (match, type, j, browsers_hash);
-  }
+  if (idx != -1)
+    return parse_browser (match, type, idx - conf.browsers_hash_idx,
+                          browsers_hash);
 
   xstrncpy (type, "Unknown", BROWSER_TYPE_LEN);
 
@@ -105,19 +105,28 @@ get_percentage (unsigned long long total, unsigned long long hit)
   return (total == 0 ? 0 : (((float) hit) / total) * 100);
 }
 
-/* Display the storage being used. */
-void
-display_storage (void)
+/* Get the storage being used.
+ *
+ * The description of the storage is returned. */
+const char *
+get_storage_str (void)
 {
 #ifdef TCB_BTREE
-  fprintf (stdout, "%s\n", BUILT_WITH_TCBTREE);
+  return BUILT_WITH_TCBTREE;
 #elif TCB_MEMHASH
-  fprintf (stdout, "%s\n", BUILT_WITH_TCMEMHASH);
+  return BUILT_WITH_TCMEMHASH;
 #else
-  fprintf (stdout, "%s\n", BUILT_WITH_DEFHASH);
+  return BUILT_WITH_DEFHASH;
 #endif
 }
 
+/* Display the storage being used. */
+void
+display_storage (void)
+{
+  fprintf (stdout, "%s\n", get_storage_str ());
+}
+
 /* Display the path of the default configuration file when `-p` is not used */
 void
 display_default_config_file (void)
@@ -296,6 +305,34 @@ enable_panel (GModule mod)
   return 0;
 }
 
+/* Get the max num of data keys of the given module if it's set to keep
+ * only its heavy hitters, i.e., --heavy-hitters=PANEL[,NUM].
+ *
+ * If the module keeps all of its data keys, 0 is returned.
+ * On success the max num of data keys is returned. */
+int
+get_heavy_hitters (GModule mod)
+{
+  char panel[16];
+  int i, module, max = 0, n;
+
+#ifdef HAVE_LIBTOKYOCABINET
+  /* all data keys are kept on disk */
+  return 0;
+#endif
+
+  for (i = 0; i < conf.hitter_panel_idx; ++i) {
+    if ((n = sscanf (conf.hitter_panels[i], "%15[^','],%d", panel, &max)) < 1)
+      continue;
+    if ((module = get_module_enum (panel)) == -1)
+      continue;
+    if (mod == (unsigned int) module)
+      return n == 2 && max > 0 ? max : MAX_HITTERS;
+  }
+
+  return 0;
+}
+
 /* Determine if the given module is set to be ignored.
  *
  * If ignored, 1 is returned, else 0 is returned. */
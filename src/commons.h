@@ -60,6 +60,9 @@ struct tm *now_tm;
 #define MAX_CHOICES      366
 /* real-time */
 #define MAX_CHOICES_RT    50
+/* num of data keys kept by default on panels keeping only their heavy
+ * hitters, see --heavy-hitters */
+#define MAX_HITTERS    10000
 
 /* date and time length - e.g., 2016/12/12 12:12:12 -0600 */
 #define DATE_TIME     25 + 1
@@ -191,8 +194,21 @@ typedef struct GHolderItem_
 {
   GSubList *sub_list;
   GMetrics *metrics;
+  int key;                      /* data key on the store, if not a root */
 } GHolderItem;
 
+/* Search index of a holder. The data of its items, each followed by
+ * its sub items, as NUL separated strings within a single blob */
+typedef struct GHolderIndex_
+{
+  char *text;                   /* NUL-led blob of the data of all rows */
+  char **data;                  /* holder's data of each row */
+  int *offs;                    /* offset of each row within the blob */
+  int *first;                   /* row of each holder item */
+  int len;                      /* number of rows */
+  int icase;                    /* blob is lowercased */
+} GHolderIndex;
+
 /* Holder of GRawData */
 typedef struct GHolder_
 {
@@ -202,6 +218,12 @@ typedef struct GHolder_
   int holder_size;              /* number of allocated items */
   int ht_size;                  /* size of the hash table/store */
   int sub_items_size;           /* number of sub items  */
+  GHolderIndex *index;          /* search index, built on demand */
+  int *roots;                   /* item + 1 of each root key, on load */
+  int roots_size;               /* number of allocated root keys */
+  struct GPool_ *metrics_pool;  /* GMetrics nodes of the items */
+  struct GPool_ *sub_items_pool;        /* GSubItem nodes of the items */
+  struct GPool_ *sub_lists_pool;        /* GSubList nodes of the items */
 } GHolder;
 
 /* Enum-to-string */
@@ -252,6 +274,7 @@ int has_timestamp (const char *fmt);
 int str2enum (const GEnum map[], int len, const char *str);
 
 int enable_panel (GModule mod);
+int get_heavy_hitters (GModule mod);
 int get_module_index (int module);
 int get_next_module (GModule module);
 int get_prev_module (GModule module);
@@ -265,6 +288,7 @@ char *get_log_source_str (int max_len);
 intmax_t get_log_sizes (void);
 
 void display_default_config_file (void);
+const char *get_storage_str (void);
 void display_storage (void);
 void display_version (void);
 /* *INDENT-ON* */
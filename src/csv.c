@@ -35,6 +35,7 @@
 #include <ctype.h>
 
 #include <errno.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,6 +55,12 @@
 #include "error.h"
 #include "ui.h"
 #include "util.h"
+#include "xmalloc.h"
+
+/* size of the buffer rows are streamed through */
+#define CSV_STREAM_BUF  (1 << 20)
+/* room for a streamed number */
+#define CSV_NUM_LEN     32
 
 /* Panel output */
 typedef struct GPanel_
@@ -62,6 +69,23 @@ typedef struct GPanel_
   void (*render) (FILE * fp, GHolder * h, GPercTotals totals);
 } GPanel;
 
+/* CSV/TSV output streamed straight from the storage */
+typedef struct GCSVStream_
+{
+  FILE *fp;
+  char *buf;                    /* rows not written out yet */
+  size_t len;                   /* bytes used in buf */
+  int fields;                   /* fields on the current row so far */
+  int tsv;                      /* tab-separated values */
+} GCSVStream;
+
+/* A root item of a streamed panel, e.g., an OS family */
+typedef struct GCSVRoot_
+{
+  GMetrics metrics;             /* sum of the metrics of its items */
+  int items;                    /* items streamed so far */
+} GCSVRoot;
+
 static void print_csv_data (FILE * fp, GHolder * h, GPercTotals totals);
 
 /* *INDENT-OFF* */
@@ -255,7 +279,7 @@ print_csv_summary (FILE * fp, GLog * glog)
 
   /* visitors */
   fmt = "\"%d\",,\"%s\",,,,,,,,\"%d\",\"%s\"\r\n";
-  total = ht_get_size_uniqmap (VISITORS);
+  total = get_overall_visitors ();
   fprintf (fp, fmt, i++, GENER_ID, total, OVERALL_VISITORS);
 
   /* files */
@@ -285,7 +309,8 @@ print_csv_summary (FILE * fp, GLog * glog)
 
   /* bandwidth */
   fmt = "\"%d\",,\"%s\",,,,,,,,\"%llu\",\"%s\"\r\n";
-  fprintf (fp, fmt, i++, GENER_ID, glog->resp_size, OVERALL_BANDWIDTH);
+  fprintf (fp, fmt, i++, GENER_ID, (long long) glog->resp_size,
+                          OVERALL_BANDWIDTH);
 
   /* log path */
   source = get_log_source_str (0);
@@ -296,6 +321,415 @@ print_csv_summary (FILE * fp, GLog * glog)
 
 #pragma GCC diagnostic warning "-Wformat-nonliteral"
 
+/* Write out the rows buffered so far. */
+static void
+stream_flush (GCSVStream * s)
+{
+  if (s->len > 0 && fwrite (s->buf, 1, s->len, s->fp) != s->len)
+    FATAL ("Unable to write CSV file: %s.", strerror (errno));
+  s->len = 0;
+}
+
+/* Append the given bytes to the stream buffer, writing it out once
+ * full. */
+static void
+stream_put (GCSVStream * s, const char *str, size_t len)
+{
+  if (s->len + len > CSV_STREAM_BUF)
+    stream_flush (s);
+  if (len > CSV_STREAM_BUF) {
+    if (fwrite (str, 1, len, s->fp) != len)
+      FATAL ("Unable to write CSV file: %s.", strerror (errno));
+    return;
+  }
+  memcpy (s->buf + s->len, str, len);
+  s->len += len;
+}
+
+/* Start a new field on the current row. */
+static void
+stream_empty_field (GCSVStream * s)
+{
+  if (s->fields++ > 0)
+    stream_put (s, s->tsv ? "\t" : ",", 1);
+}
+
+/* Stream the given string as a field. CSV fields are quoted, doubling
+ * inner quotes. TSV fields escape backslashes, tabs and newlines. Runs
+ * of bytes that need no escaping are copied as a whole. */
+static void
+stream_field (GCSVStream * s, const char *str)
+{
+  const char *esc = s->tsv ? "\\\t\r\n" : "\"";
+  size_t n;
+
+  stream_empty_field (s);
+  if (!s->tsv)
+    stream_put (s, "\"", 1);
+  while (*str != '\0') {
+    n = strcspn (str, esc);
+    stream_put (s, str, n);
+    str += n;
+    if (*str == '\0')
+      break;
+
+    switch (*str) {
+    case '"':
+      stream_put (s, "\"\"", 2);
+      break;
+    case '\t':
+      stream_put (s, "\\t", 2);
+      break;
+    case '\r':
+      stream_put (s, "\\r", 2);
+      break;
+    case '\n':
+      stream_put (s, "\\n", 2);
+      break;
+    default:
+      stream_put (s, "\\\\", 2);
+    }
+    str++;
+  }
+  if (!s->tsv)
+    stream_put (s, "\"", 1);
+}
+
+/* Stream the given integer as a field. */
+static void
+stream_int_field (GCSVStream * s, long long value)
+{
+  char buf[CSV_NUM_LEN];
+
+  snprintf (buf, sizeof (buf), "%lld", value);
+  stream_field (s, buf);
+}
+
+/* Stream the given percentage as a field. */
+static void
+stream_perc_field (GCSVStream * s, float perc)
+{
+  char buf[CSV_NUM_LEN];
+
+  snprintf (buf, sizeof (buf), "%4.2f%%", perc < 0 ? 0 : perc);
+  stream_field (s, buf);
+}
+
+/* End the current row. */
+static void
+stream_end_row (GCSVStream * s)
+{
+  if (s->tsv)
+    stream_put (s, "\n", 1);
+  else
+    stream_put (s, "\r\n", 2);
+  s->fields = 0;
+}
+
+/* Stream a row of general statistics. */
+static void
+stream_summary_row (GCSVStream * s, int idx, const char *value,
+                    const char *label)
+{
+  int i;
+
+  stream_int_field (s, idx);
+  stream_empty_field (s);
+  stream_field (s, GENER_ID);
+  for (i = 0; i < 7; i++)
+    stream_empty_field (s);
+  stream_field (s, value);
+  stream_field (s, label);
+  stream_end_row (s);
+}
+
+/* Stream a row of general statistics holding an integer. */
+static void
+stream_summary_int_row (GCSVStream * s, int idx, long long value,
+                        const char *label)
+{
+  char buf[CSV_NUM_LEN];
+
+  snprintf (buf, sizeof (buf), "%lld", value);
+  stream_summary_row (s, idx, buf, label);
+}
+
+/* Stream general statistics, as print_csv_summary() does. */
+static void
+stream_csv_summary (GCSVStream * s, GLog * glog)
+{
+  char now[DATE_TIME];
+  char *source = NULL;
+  int i = 0;
+
+  generate_time ();
+  strftime (now, DATE_TIME, "%Y-%m-%d %H:%M:%S %z", now_tm);
+
+  stream_summary_row (s, i++, now, OVERALL_DATETIME);
+  stream_summary_int_row (s, i++, glog->processed, OVERALL_REQ);
+  stream_summary_int_row (s, i++, glog->valid, OVERALL_VALID);
+  stream_summary_int_row (s, i++, glog->invalid, OVERALL_FAILED);
+  stream_summary_int_row (s, i++, (long long) end_proc - start_proc,
+                          OVERALL_GENTIME);
+  stream_summary_int_row (s, i++, get_overall_visitors (), OVERALL_VISITORS);
+  stream_summary_int_row (s, i++, ht_get_size_datamap (REQUESTS),
+                          OVERALL_FILES);
+  stream_summary_int_row (s, i++, glog->excluded_ip, OVERALL_EXCL_HITS);
+  stream_summary_int_row (s, i++, ht_get_size_datamap (REFERRERS),
+                          OVERALL_REF);
+  stream_summary_int_row (s, i++, ht_get_size_datamap (NOT_FOUND),
+                          OVERALL_NOTFOUND);
+  stream_summary_int_row (s, i++, ht_get_size_datamap (REQUESTS_STATIC),
+                          OVERALL_STATIC);
+  stream_summary_int_row (s, i++, (long long) get_log_sizes (),
+                          OVERALL_LOGSIZE);
+  stream_summary_int_row (s, i++, (long long) glog->resp_size,
+                          OVERALL_BANDWIDTH);
+
+  source = get_log_source_str (0);
+  stream_summary_row (s, i++, source, OVERALL_LOG);
+  free (source);
+}
+
+/* Stream a row of metrics, with print_csv_metric_block() columns. */
+static void
+stream_metrics_row (GCSVStream * s, GModule module, int idx, int parent,
+                    GMetrics * metrics, GPercTotals totals)
+{
+  stream_int_field (s, idx);
+  if (parent < 0)
+    stream_empty_field (s);
+  else
+    stream_int_field (s, parent);
+  stream_field (s, module_to_id (module));
+
+  /* basic metrics */
+  stream_int_field (s, metrics->hits);
+  stream_perc_field (s, get_percentage (totals.hits, metrics->hits));
+  stream_int_field (s, metrics->visitors);
+  stream_perc_field (s, get_percentage (totals.visitors, metrics->visitors));
+
+  /* bandwidth */
+  if (conf.bandwidth) {
+    stream_int_field (s, metrics->bw.nbw);
+    stream_perc_field (s, get_percentage (totals.bw, metrics->bw.nbw));
+  }
+
+  /* time served metrics */
+  if (conf.serve_usecs) {
+    stream_int_field (s, metrics->avgts.nts);
+    stream_int_field (s, metrics->cumts.nts);
+    stream_int_field (s, metrics->maxts.nts);
+  }
+
+  /* request method and protocol */
+  if (conf.append_method && metrics->method)
+    stream_field (s, metrics->method);
+  else
+    stream_empty_field (s);
+  if (conf.append_protocol && metrics->protocol)
+    stream_field (s, metrics->protocol);
+  else
+    stream_empty_field (s);
+
+  stream_field (s, metrics->data ? metrics->data : "");
+  stream_end_row (s);
+}
+
+/* Free the strings of the given streamed metrics. */
+static void
+free_stream_metrics (GMetrics * metrics)
+{
+  free (metrics->data);
+  free (metrics->method);
+  free (metrics->protocol);
+}
+
+/* Get the metrics of the given raw data item from the storage, the way
+ * the holder does. Items under a root carry no method nor protocol.
+ *
+ * On error, or if the item is not in use, 1 is returned.
+ * On success, the metrics are set and 0 is returned. */
+static int
+load_stream_metrics (GModule module, GRawDataItem item, GRawDataType type,
+                     int has_root, GMetrics * metrics)
+{
+  char buf[INET6_ADDRSTRLEN];
+
+  memset (metrics, 0, sizeof (GMetrics));
+  if (type == INTEGER) {
+    if (!(metrics->data = ht_get_datamap (module, item.key)))
+      return 1;
+    metrics->hits = item.value.ivalue;
+  } else {
+    if (!(metrics->hits = ht_get_hits (module, item.key)))
+      return 1;
+    metrics->data = xstrdup (item.value.svalue);
+  }
+
+  if (module == HOSTS && conf.anonymize_ip) {
+    if (anonymize_ip (metrics->data, buf) != 0) {
+      free (metrics->data);
+      return 1;
+    }
+    free (metrics->data);
+    metrics->data = xstrdup (buf);
+  }
+
+  metrics->bw.nbw = ht_get_bw (module, item.key);
+  metrics->cumts.nts = ht_get_cumts (module, item.key);
+  metrics->maxts.nts = ht_get_maxts (module, item.key);
+  metrics->avgts.nts = metrics->cumts.nts / metrics->hits;
+  metrics->visitors = ht_get_visitors (module, item.key);
+
+  if (conf.append_method && !has_root)
+    metrics->method = ht_get_method (module, item.key);
+  if (conf.append_protocol && !has_root)
+    metrics->protocol = ht_get_protocol (module, item.key);
+
+  return 0;
+}
+
+/* Get the root of the given item within the given roots, adding it if
+ * it's not there yet.
+ *
+ * On success, the index of the root is returned. */
+static int
+get_stream_root (GCSVRoot ** roots, int *len, char *root)
+{
+  int i;
+
+  for (i = 0; i < (*len); i++) {
+    if (strcmp ((*roots)[i].metrics.data, root) == 0) {
+      free (root);
+      return i;
+    }
+  }
+
+  (*roots) = xrealloc ((*roots), ((*len) + 1) * sizeof (GCSVRoot));
+  memset (&(*roots)[(*len)], 0, sizeof (GCSVRoot));
+  (*roots)[(*len)].metrics.data = root;
+
+  return (*len)++;
+}
+
+/* Stream the items of a panel whose items are grouped under a root,
+ * e.g., OS versions under their family. Roots come first, with the sum
+ * of the metrics of their items, then the items themselves. */
+static void
+stream_csv_root_panel (GCSVStream * s, GRawData * raw_data, int len,
+                       GPercTotals totals)
+{
+  GCSVRoot *roots = NULL;
+  GMetrics metrics, *rm;
+  GModule module = raw_data->module;
+  char *root = NULL;
+  int i, r, nroots = 0, *parent = xcalloc (len, sizeof (int));
+
+  for (i = 0; i < len; i++) {
+    parent[i] = -1;
+    if (load_stream_metrics (module, raw_data->items[i], raw_data->type,
+                             1, &metrics) == 1)
+      continue;
+    if ((root = ht_get_root (module, raw_data->items[i].key)) != NULL) {
+      parent[i] = r = get_stream_root (&roots, &nroots, root);
+      rm = &roots[r].metrics;
+      rm->hits += metrics.hits;
+      rm->visitors += metrics.visitors;
+      rm->bw.nbw += metrics.bw.nbw;
+      rm->cumts.nts += metrics.cumts.nts;
+      rm->avgts.nts = rm->cumts.nts / rm->hits;
+      if (metrics.maxts.nts > rm->maxts.nts)
+        rm->maxts.nts = metrics.maxts.nts;
+    }
+    free_stream_metrics (&metrics);
+  }
+
+  for (r = 0; r < nroots; r++)
+    stream_metrics_row (s, module, r, -1, &roots[r].metrics, totals);
+
+  for (i = 0; i < len; i++) {
+    if (parent[i] < 0 || load_stream_metrics (module, raw_data->items[i],
+                                              raw_data->type, 1,
+                                              &metrics) == 1)
+      continue;
+    stream_metrics_row (s, module, roots[parent[i]].items++, parent[i],
+                        &metrics, totals);
+    free_stream_metrics (&metrics);
+  }
+
+  for (r = 0; r < nroots; r++)
+    free (roots[r].metrics.data);
+  free (roots);
+  free (parent);
+}
+
+/* Stream all the items of a panel, in storage order. If a maximum
+ * number of items is given, the top ones are streamed instead, in the
+ * panel's default order. */
+static void
+stream_csv_panel (GCSVStream * s, GModule module)
+{
+  GRawData *raw_data;
+  GPercTotals totals;
+  GMetrics metrics;
+  char *root = NULL;
+  int i, idx = 0, len;
+
+  if (conf.max_items > 0)
+    raw_data = parse_raw_data (module);
+  else
+    raw_data = parse_raw_data_unsorted (module);
+  if (raw_data == NULL)
+    return;
+
+  set_module_totals (module, &totals);
+  len = raw_data->idx;
+  if (conf.max_items > 0 && len > conf.max_items)
+    len = conf.max_items;
+
+  /* panels whose items have a root, e.g., OS */
+  if (len > 0 && (root = ht_get_root (module, raw_data->items[0].key))) {
+    free (root);
+    stream_csv_root_panel (s, raw_data, len, totals);
+    free_raw_data (raw_data);
+    return;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (load_stream_metrics (module, raw_data->items[i], raw_data->type,
+                             0, &metrics) == 1)
+      continue;
+    stream_metrics_row (s, module, idx++, -1, &metrics, totals);
+    free_stream_metrics (&metrics);
+  }
+  free_raw_data (raw_data);
+}
+
+/* Stream a csv report straight from the storage, see --csv-stream. */
+static void
+stream_csv (FILE * fp, GLog * glog)
+{
+  GCSVStream s;
+  size_t idx = 0;
+
+  memset (&s, 0, sizeof (s));
+  s.fp = fp;
+  s.buf = xmalloc (CSV_STREAM_BUF);
+  s.tsv = conf.csv_stream == TSV_STREAM;
+
+  if (!conf.no_csv_summary)
+    stream_csv_summary (&s, glog);
+
+  FOREACH_MODULE (idx, module_list) {
+    if (panel_lookup (module_list[idx]))
+      stream_csv_panel (&s, module_list[idx]);
+  }
+
+  stream_flush (&s);
+  free (s.buf);
+}
+
 /* Entry point to generate a a csv report writing it to the fp */
 void
 output_csv (GLog * glog, GHolder * holder, const char *filename)
@@ -310,6 +744,12 @@ output_csv (GLog * glog, GHolder * holder, const char *filename)
   if (!fp)
     FATAL ("Unable to open CSV file: %s.", strerror (errno));
 
+  if (conf.csv_stream) {
+    stream_csv (fp, glog);
+    fclose (fp);
+    return;
+  }
+
   if (!conf.no_csv_summary)
     print_csv_summary (fp, glog);
 
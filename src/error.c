@@ -69,6 +69,13 @@ dbg_log_close (void)
     fclose (log_file);
 }
 
+/* Get the debug file, NULL if none was opened. */
+FILE *
+dbg_log_file (void)
+{
+  return log_file;
+}
+
 /* Open the invalid requests log file whose name is specified in the
  * given path. */
 void
@@ -84,6 +84,7 @@ void dbg_printf (const char *fmt, ...);
 
 void dbg_fprintf (const char *fmt, ...);
 void dbg_log_close (void);
+FILE *dbg_log_file (void);
 void dbg_log_open (const char *file);
 void invalid_fprintf (const char *fmt, ...);
 void invalid_log_close (void);
@@ -0,0 +1,284 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "garena.h"
+
+#include "error.h"
+#include "gspill.h"
+#include "xmalloc.h"
+
+/* Allocate a new block with at least the given usable size. Blocks
+ * come from the storage allocator, so they can spill to files past
+ * --memory-limit.
+ *
+ * On success, the newly allocated GArenaBlock is returned. */
+static GArenaBlock *
+new_arena_block (size_t size)
+{
+  GArenaBlock *block = NULL;
+  size_t hdr = (sizeof (GArenaBlock) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if (size < ARENA_BLOCK_SIZE)
+    size = ARENA_BLOCK_SIZE;
+
+  if ((block = spill_malloc (hdr + size)) == NULL)
+    FATAL ("Unable to allocate memory - failed.");
+  block->data = (char *) block + hdr;
+  block->size = size;
+  block->used = 0;
+  block->next = NULL;
+
+  return block;
+}
+
+/* Allocate memory for a new arena instance.
+ *
+ * On success, the newly allocated GArena is returned. */
+GArena *
+new_arena (void)
+{
+  GArena *arena = xmalloc (sizeof (GArena));
+
+  arena->head = arena->cur = new_arena_block (ARENA_BLOCK_SIZE);
+
+  return arena;
+}
+
+/* Hand out the given number of bytes from the arena, rounded up to the
+ * given alignment.
+ *
+ * On success, a pointer to the allocated memory is returned. */
+static void *
+arena_alloc_align (GArena * arena, size_t size, size_t align)
+{
+  GArenaBlock *block = arena->cur;
+  void *ptr = NULL;
+
+  size = (size + align - 1) & ~(align - 1);
+  while (block->size - block->used < size) {
+    if (block->next == NULL)
+      block->next = new_arena_block (size);
+    block = block->next;
+  }
+
+  ptr = block->data + block->used;
+  block->used += size;
+  arena->cur = block;
+
+  return ptr;
+}
+
+/* Hand out the given number of bytes from the arena. Note that the
+ * memory can't be released individually, see reset_arena().
+ *
+ * On success, a pointer to the allocated memory is returned. */
+void *
+arena_alloc (GArena * arena, size_t size)
+{
+  return arena_alloc_align (arena, size, ARENA_ALIGN);
+}
+
+/* Hand out the given number of bytes from the arena, zeroed.
+ *
+ * On success, a pointer to the allocated memory is returned. */
+void *
+arena_calloc (GArena * arena, size_t size)
+{
+  return memset (arena_alloc (arena, size), 0, size);
+}
+
+/* Duplicate len bytes of the given string into the arena, the copy is
+ * always nul-terminated.
+ *
+ * On success, the copy is returned. */
+char *
+arena_strndup (GArena * arena, const char *s, size_t len)
+{
+  char *ptr = arena_alloc (arena, len + 1);
+
+  memcpy (ptr, s, len);
+  ptr[len] = '\0';
+
+  return ptr;
+}
+
+/* Duplicate len bytes of the given string into the arena, right after
+ * the previous one, i.e., unaligned. The copy is always nul-terminated.
+ *
+ * On success, the copy is returned. */
+char *
+arena_strpack (GArena * arena, const char *s, size_t len)
+{
+  char *ptr = arena_alloc_align (arena, len + 1, 1);
+
+  memcpy (ptr, s, len);
+  ptr[len] = '\0';
+
+  return ptr;
+}
+
+/* Duplicate the given string into the arena.
+ *
+ * On success, the copy is returned. */
+char *
+arena_strdup (GArena * arena, const char *s)
+{
+  return arena_strndup (arena, s, strlen (s));
+}
+
+/* Release all the memory handed out by the arena at once. Blocks are
+ * kept so following allocations don't hit malloc(3). */
+void
+reset_arena (GArena * arena)
+{
+  GArenaBlock *block = NULL;
+
+  for (block = arena->head; block; block = block->next)
+    block->used = 0;
+  arena->cur = arena->head;
+}
+
+/* Free the arena and all its blocks. */
+void
+free_arena (GArena * arena)
+{
+  GArenaBlock *block = NULL, *next = NULL;
+
+  if (arena == NULL)
+    return;
+
+  for (block = arena->head; block; block = next) {
+    next = block->next;
+    spill_free (block);
+  }
+  free (arena);
+}
+
+/* Allocate memory for a new pool of nodes of the given size.
+ *
+ * On success, the newly allocated GPool is returned. */
+GPool *
+new_pool (size_t size)
+{
+  GPool *pool = xcalloc (1, sizeof (GPool));
+
+  /* released nodes are linked through their first bytes */
+  if (size < sizeof (void *))
+    size = sizeof (void *);
+  pool->size = (size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+
+  return pool;
+}
+
+/* Hand out a node from the pool, reusing released nodes first. Note
+ * that the memory isn't zeroed, see pool_calloc().
+ *
+ * On success, a pointer to the node is returned. */
+void *
+pool_alloc (GPool * pool)
+{
+  GPoolSlab *slab = NULL;
+  size_t hdr = (sizeof (GPoolSlab) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  void *ptr = NULL;
+
+  if (pool->free != NULL) {
+    ptr = pool->free;
+    pool->free = *(void **) ptr;
+    return ptr;
+  }
+
+  if (pool->next == pool->end) {
+    slab = xmalloc (hdr + pool->size * POOL_SLAB_NODES);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->next = (char *) slab + hdr;
+    pool->end = pool->next + pool->size * POOL_SLAB_NODES;
+  }
+
+  ptr = pool->next;
+  pool->next += pool->size;
+
+  return ptr;
+}
+
+/* Hand out a zeroed node from the pool.
+ *
+ * On success, a pointer to the node is returned. */
+void *
+pool_calloc (GPool * pool)
+{
+  return memset (pool_alloc (pool), 0, pool->size);
+}
+
+/* Give the given node back to the pool. */
+void
+pool_free (GPool * pool, void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  *(void **) ptr = pool->free;
+  pool->free = ptr;
+}
+
+/* Release all the nodes handed out by the pool at once. Only the most
+ * recent slab is kept so following allocations don't hit malloc(3). */
+void
+reset_pool (GPool * pool)
+{
+  GPoolSlab *slab = NULL, *next = NULL;
+  size_t hdr = (sizeof (GPoolSlab) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  pool->free = NULL;
+  if (pool->slabs == NULL)
+    return;
+
+  for (slab = pool->slabs->next; slab; slab = next) {
+    next = slab->next;
+    free (slab);
+  }
+  pool->slabs->next = NULL;
+  pool->next = (char *) pool->slabs + hdr;
+}
+
+/* Free the pool and all its slabs. */
+void
+free_pool (GPool * pool)
+{
+  if (pool == NULL)
+    return;
+
+  reset_pool (pool);
+  free (pool->slabs);
+  free (pool);
+}
@@ -0,0 +1,90 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GARENA_H_INCLUDED
+#define GARENA_H_INCLUDED
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE  (64 * 1024)   /* default size of each block */
+#define ARENA_ALIGN       16    /* alignment of each allocation */
+#define POOL_ALIGN        8     /* alignment of each pool node */
+#define POOL_SLAB_NODES   128   /* number of nodes in each pool slab */
+
+/* A block of memory within an arena */
+typedef struct GArenaBlock_
+{
+  char *data;                   /* usable memory */
+  size_t size;                  /* size of the usable memory */
+  size_t used;                  /* bytes already handed out */
+  struct GArenaBlock_ *next;
+} GArenaBlock;
+
+/* Bump allocator. Memory is handed out sequentially from a list of blocks
+ * and released all at once, blocks are kept around for reuse. */
+typedef struct GArena_
+{
+  GArenaBlock *head;            /* first block */
+  GArenaBlock *cur;             /* block currently handing out memory */
+} GArena;
+
+/* A slab of nodes within a pool */
+typedef struct GPoolSlab_
+{
+  struct GPoolSlab_ *next;
+} GPoolSlab;
+
+/* Fixed-size node allocator. Nodes are carved out of slabs and released
+ * nodes are kept in a free list, all of them can be released at once. */
+typedef struct GPool_
+{
+  size_t size;                  /* size of each node */
+  GPoolSlab *slabs;             /* slabs, most recent first */
+  char *next;                   /* next unused node of the first slab */
+  char *end;                    /* end of the first slab */
+  void *free;                   /* released nodes */
+} GPool;
+
+GArena *new_arena (void);
+char *arena_strdup (GArena * arena, const char *s);
+char *arena_strndup (GArena * arena, const char *s, size_t len);
+char *arena_strpack (GArena * arena, const char *s, size_t len);
+void *arena_alloc (GArena * arena, size_t size);
+void *arena_calloc (GArena * arena, size_t size);
+void free_arena (GArena * arena);
+void reset_arena (GArena * arena);
+
+GPool *new_pool (size_t size);
+void *pool_alloc (GPool * pool);
+void *pool_calloc (GPool * pool);
+void free_pool (GPool * pool);
+void pool_free (GPool * pool, void *ptr);
+void reset_pool (GPool * pool);
+
+#endif // for #ifndef GARENA_H
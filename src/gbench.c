@@ -0,0 +1,858 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gbench.h"
+
+#ifdef HAVE_LIBTOKYOCABINET
+#include "tcabdb.h"
+#else
+#include "gkhash.h"
+#endif
+
+#include "browsers.h"
+#include "error.h"
+#include "gstats.h"
+#include "gstorage.h"
+#include "json.h"
+#include "labels.h"
+#include "opesys.h"
+#include "settings.h"
+#include "sort.h"
+#include "ui.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* size of the buffer the synthetic log is written through */
+#define BENCH_WRITE_BUF  (1 << 20)
+/* room for a synthetic URL or referer */
+#define BENCH_URL_LEN    128
+
+static GBench bench;
+static uint64_t bench_seed = BENCH_SEED;
+
+/* *INDENT-OFF* */
+/* Predefined log formats a synthetic log can be generated for */
+static const GEnum BENCH_FORMATS[] = {
+  {"COMBINED"   , COMBINED}   ,
+  {"VCOMBINED"  , VCOMBINED}  ,
+  {"W3C"        , W3C}        ,
+  {"CLOUDFRONT" , CLOUDFRONT} ,
+};
+
+/* Each agent gets a distinct version number in between */
+static const char *BENCH_AGENT_PARTS[][2] = {
+  {"Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+   "(KHTML, like Gecko) Chrome/", ".0 Safari/537.36"},
+  {"Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 "
+   "(KHTML, like Gecko) Version/", " Safari/605.1.15"},
+  {"Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/", ""},
+  {"Mozilla/5.0 (iPhone; CPU iPhone OS 17_0 like Mac OS X) "
+   "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/",
+   " Mobile/15E148 Safari/604.1"},
+  {"Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 "
+   "(KHTML, like Gecko) Chrome/", ".0 Mobile Safari/537.36"},
+  {"Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+   "(KHTML, like Gecko) Chrome/", ".0 Safari/537.36 Edg/120.0"},
+  {"Mozilla/5.0 (compatible; Googlebot/2.1; "
+   "+http://www.google.com/bot.html) ", ""},
+  {"curl/", ".0"},
+};
+
+static const char *BENCH_SECTIONS[] = {
+  "blog", "products", "docs", "api", "search", "news", "account",
+};
+
+static const char *BENCH_STATICS[] = {
+  "css", "js", "png", "jpg", "svg", "woff2",
+};
+
+static const char *BENCH_MONTHS[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+static const char *BENCH_STAGE_STR[] = {
+  "Generate", "Parse", "Holder",
+};
+
+/* Strings escaped by the JSON micro-benchmark, besides agents */
+static const char *BENCH_JSON_STRS[] = {
+  "/search?q=\"quoted\"&lang=en",
+  "C:\\Windows\\System32\\cmd.exe",
+  "line one\nline two\ttabbed",
+  "<script>alert('x')</script>",
+};
+/* *INDENT-ON* */
+
+/* A line of the synthetic log */
+typedef struct GBenchLine_
+{
+  time_t ts;
+  uint32_t host;
+  uint32_t vhost;
+  const char *method;
+  const char *protocol;
+  char path[BENCH_URL_LEN];
+  char query[BENCH_URL_LEN];
+  char referer[BENCH_URL_LEN];
+  const char *agent;
+  int status;
+  uint32_t bytes;
+  uint32_t msecs;
+} GBenchLine;
+
+/* A micro-benchmark being timed, see --benchmark-micro */
+typedef struct GBenchMicro_
+{
+  uint64_t begin;               /* when it began, in ns */
+  uint64_t allocs;              /* allocations counted so far */
+} GBenchMicro;
+
+/* Get the current time of a monotonic clock in nanoseconds. */
+static uint64_t
+bench_nsecs (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Start timing the given stage of a benchmark run. */
+void
+bench_begin (GBenchStage stage)
+{
+  if (conf.bench_lines)
+    bench.begin[stage] = bench_nsecs ();
+}
+
+/* Stop timing the given stage of a benchmark run. */
+void
+bench_end (GBenchStage stage)
+{
+  if (conf.bench_lines)
+    bench.ns[stage] += bench_nsecs () - bench.begin[stage];
+}
+
+/* Get the next number of a xorshift64* generator, seeded the same on
+ * each run so the synthetic log is the same as well. */
+static uint64_t
+bench_rand (void)
+{
+  bench_seed ^= bench_seed >> 12;
+  bench_seed ^= bench_seed << 25;
+  bench_seed ^= bench_seed >> 27;
+
+  return bench_seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* Pick one of the given number of items, lower ones more often than
+ * the others, much as a few hosts, URLs or agents make most of the
+ * hits of an actual log. */
+static uint32_t
+bench_pick (uint32_t n)
+{
+  double u = (bench_rand () >> 11) * (1.0 / 9007199254740992.0);
+
+  return (uint32_t) (u * u * n);
+}
+
+/* Determine which of the predefined log formats the synthetic log is
+ * generated for, COMBINED if no log format was given.
+ *
+ * On error, -1 is returned.
+ * On success, the enumerated log format is returned. */
+static int
+get_bench_format (void)
+{
+  char *fmt = NULL, *log_fmt = NULL;
+  size_t i;
+  int type = -1;
+
+  if (conf.log_format == NULL)
+    set_log_format_str ("COMBINED");
+
+  for (i = 0; i < ARRAY_SIZE (BENCH_FORMATS) && type == -1; ++i) {
+    if ((fmt = get_selected_format_str (BENCH_FORMATS[i].idx)) == NULL)
+      continue;
+    /* log formats are stored unescaped, e.g., CloudFront's tabs */
+    log_fmt = unescape_str (fmt);
+    if (strcmp (log_fmt, conf.log_format) == 0) {
+      bench.format = BENCH_FORMATS[i].str;
+      type = BENCH_FORMATS[i].idx;
+    }
+    free (log_fmt);
+    free (fmt);
+  }
+
+  return type;
+}
+
+/* Replace the spaces of an agent the way the given log format logs
+ * them, i.e., as a plus sign on W3C and %20 on CloudFront. */
+static char *
+escape_bench_agent (const char *agent, int type)
+{
+  const char *sp = type == W3C ? "+" : "%20";
+  char *buf = NULL, *p = NULL;
+
+  if (type != W3C && type != CLOUDFRONT)
+    return xstrdup (agent);
+
+  p = buf = xmalloc (strlen (agent) * 3 + 1);
+  for (; *agent; ++agent) {
+    if (*agent != ' ') {
+      *p++ = *agent;
+      continue;
+    }
+    strcpy (p, sp);
+    p += strlen (sp);
+  }
+  *p = '\0';
+
+  return buf;
+}
+
+/* Build the given number of distinct agents for the given log format.
+ *
+ * On success, the newly allocated array of agents is returned. */
+static char **
+new_bench_agents (uint32_t n, int type)
+{
+  char **agents = xcalloc (n, sizeof (char *));
+  char buf[256];
+  uint32_t i, v;
+  size_t len = ARRAY_SIZE (BENCH_AGENT_PARTS);
+
+  for (i = 0; i < n; ++i) {
+    v = i / len;
+    snprintf (buf, sizeof (buf), "%s%u.%u%s", BENCH_AGENT_PARTS[i % len][0],
+              100 + v % 32, v / 32, BENCH_AGENT_PARTS[i % len][1]);
+    agents[i] = escape_bench_agent (buf, type);
+  }
+
+  return agents;
+}
+
+/* Free the given number of agents. */
+static void
+free_bench_agents (char **agents, uint32_t n)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; ++i)
+    free (agents[i]);
+  free (agents);
+}
+
+/* Set the path and the query string of the given URL. One in five is
+ * a static file, and a few carry a query string. */
+static void
+set_bench_url (GBenchLine * line, uint32_t url)
+{
+  size_t nsec = ARRAY_SIZE (BENCH_SECTIONS);
+  size_t nstat = ARRAY_SIZE (BENCH_STATICS);
+
+  line->query[0] = '\0';
+  if (url % 5 == 0) {
+    snprintf (line->path, BENCH_URL_LEN, "/assets/%u.%s", url,
+              BENCH_STATICS[url / 5 % nstat]);
+    return;
+  }
+
+  snprintf (line->path, BENCH_URL_LEN, "/%s/%u", BENCH_SECTIONS[url % nsec],
+            url);
+  if (url % 11 == 1)
+    snprintf (line->query, BENCH_URL_LEN, "page=%u", url / 11 % 20 + 1);
+}
+
+/* Set the referer of the given line, either none, a page of the site,
+ * another site or a search. */
+static void
+set_bench_referer (GBenchLine * line, uint32_t urls)
+{
+  switch (bench_rand () % 4) {
+  case 0:
+    strcpy (line->referer, "-");
+    break;
+  case 1:
+    snprintf (line->referer, BENCH_URL_LEN, "https://www.example.com/%s/%u",
+              BENCH_SECTIONS[bench_rand () % ARRAY_SIZE (BENCH_SECTIONS)],
+              bench_pick (urls));
+    break;
+  case 2:
+    snprintf (line->referer, BENCH_URL_LEN, "https://site%u.example.org/",
+              bench_pick (250));
+    break;
+  default:
+    snprintf (line->referer, BENCH_URL_LEN,
+              "https://www.google.com/search?q=term+%u", bench_pick (1000));
+  }
+}
+
+/* Set the fields of the given line of the synthetic log. */
+static void
+set_bench_line (GBenchLine * line, char **agents, uint32_t hosts,
+                uint32_t urls, uint32_t nagents)
+{
+  uint32_t r = bench_rand () % 100;
+
+  line->host = bench_pick (hosts);
+  line->vhost = bench_pick (8);
+  line->agent = agents[bench_pick (nagents)];
+  set_bench_url (line, bench_pick (urls));
+  set_bench_referer (line, urls);
+
+  line->status = r < 80 ? 200 : r < 88 ? 304 : r < 94 ? 404 :
+    r < 97 ? 301 : r < 99 ? 302 : 500;
+  r = bench_rand () % 100;
+  line->method = r < 90 ? "GET" : r < 98 ? "POST" : "HEAD";
+  line->protocol = bench_rand () % 4 ? "HTTP/1.1" : "HTTP/2.0";
+  line->bytes = line->status == 304 ? 0 : 200 + bench_rand () % 50000;
+  line->msecs = bench_rand () % 1000;
+}
+
+/* Write the given line into the synthetic log, as the given log format
+ * would have it. */
+static void
+write_bench_line (FILE * fp, const GBenchLine * line, int type)
+{
+  struct tm tm;
+  uint32_t h = line->host;
+  const char *q = line->query;
+
+  gmtime_r (&line->ts, &tm);
+
+  switch (type) {
+  case W3C:
+    fprintf (fp, "%04d-%02d-%02d %02d:%02d:%02d 10.0.0.1 %s %s %s 443 - "
+             "%u.%u.%u.%u %s %s %d 0 0 %u\n", tm.tm_year + 1900,
+             tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+             line->method, line->path, *q ? q : "-", 11 + (h >> 24),
+             (h >> 16) & 0xff, (h >> 8) & 0xff, h & 0xff, line->agent,
+             line->referer, line->status, line->msecs);
+    break;
+  case CLOUDFRONT:
+    fprintf (fp, "%04d-%02d-%02d\t%02d:%02d:%02d\tLAX1\t%u\t%u.%u.%u.%u\t%s\t"
+             "d111111abcdef8.cloudfront.net\t%s\t%d\t%s\t%s\t%s\n",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+             tm.tm_min, tm.tm_sec, line->bytes, 11 + (h >> 24),
+             (h >> 16) & 0xff, (h >> 8) & 0xff, h & 0xff, line->method,
+             line->path, line->status, line->referer, line->agent,
+             *q ? q : "-");
+    break;
+  default:
+    if (type == VCOMBINED)
+      fprintf (fp, "www%u.example.com:443 ", line->vhost);
+    fprintf (fp, "%u.%u.%u.%u - - [%02d/%s/%04d:%02d:%02d:%02d +0000] "
+             "\"%s %s%s%s %s\" %d %u \"%s\" \"%s\"\n", 11 + (h >> 24),
+             (h >> 16) & 0xff, (h >> 8) & 0xff, h & 0xff, tm.tm_mday,
+             BENCH_MONTHS[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour,
+             tm.tm_min, tm.tm_sec, line->method, line->path, *q ? "?" : "",
+             q, line->protocol, line->status, line->bytes, line->referer,
+             line->agent);
+  }
+}
+
+/* Generate a synthetic log of the selected log format and set it as
+ * the only log to parse. Lines are spread over BENCH_DAYS, and hosts,
+ * URLs and agents are picked out of as many distinct ones as given. */
+void
+bench_generate (void)
+{
+  GBenchLine line;
+  FILE *fp = NULL;
+  char **agents = NULL, *buf = NULL;
+  /* 2024-01-01 00:00:00 UTC */
+  time_t start = 1704067200;
+  uint64_t i, span = (uint64_t) BENCH_DAYS * 86400;
+  uint32_t hosts, urls, nagents;
+  int type;
+
+  if ((type = get_bench_format ()) == -1)
+    FATAL ("A benchmark requires a COMBINED, VCOMBINED, W3C or CLOUDFRONT "
+           "log format.");
+
+  hosts = conf.bench_hosts ? conf.bench_hosts : BENCH_HOSTS;
+  urls = conf.bench_urls ? conf.bench_urls : BENCH_URLS;
+  nagents = conf.bench_agents ? conf.bench_agents : BENCH_AGENTS;
+
+  bench_begin (BENCH_GENERATE);
+  if ((bench.path = new_tmp_path ("bench")) == NULL ||
+      (fp = fopen (bench.path, "w")) == NULL)
+    FATAL ("Unable to create the benchmark log: %s", strerror (errno));
+
+  buf = xmalloc (BENCH_WRITE_BUF);
+  setvbuf (fp, buf, _IOFBF, BENCH_WRITE_BUF);
+
+  agents = new_bench_agents (nagents, type);
+  memset (&line, 0, sizeof (line));
+  for (i = 0; i < conf.bench_lines; ++i) {
+    line.ts = start + (time_t) (i * span / conf.bench_lines);
+    set_bench_line (&line, agents, hosts, urls, nagents);
+    write_bench_line (fp, &line, type);
+  }
+  free_bench_agents (agents, nagents);
+
+  bench.size = ftello (fp);
+  if (fclose (fp) != 0)
+    FATAL ("Unable to write the benchmark log: %s", strerror (errno));
+  free (buf);
+  bench_end (BENCH_GENERATE);
+
+  conf.filenames[0] = bench.path;
+  conf.filenames_idx = 1;
+}
+
+/* Get the peak resident set size of the process in KiB. */
+static long
+get_peak_rss (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+/* Output a stage of the benchmark run, along with its throughput. */
+static void
+print_bench_stage (FILE * fp, GBenchStage stage, uint64_t lines)
+{
+  uint64_t ns = bench.ns[stage];
+  double secs = ns / 1e9;
+
+  fprintf (fp, "  %-10s %10.3f %12.0f %14.0f\n", BENCH_STAGE_STR[stage], secs,
+           lines ? (double) ns / lines : 0, secs > 0 ? lines / secs : 0);
+}
+
+/* Output the given processing stats timer, per line and per call. */
+static void
+print_bench_timer (FILE * fp, const char *name, const GStatsTimer * t,
+                   uint64_t lines)
+{
+  fprintf (fp, "  %-22s %10.3f %12.0f %12.0f %12" PRIu64 "\n", name,
+           t->ns / 1e9, lines ? (double) t->ns / lines : 0,
+           t->count ? (double) t->ns / t->count : 0, t->count);
+}
+
+/* Output the processing stats of each stage and of storing each
+ * module, if they were enabled. */
+static void
+print_bench_proc_stats (FILE * fp, uint64_t lines)
+{
+  char name[64];
+  size_t idx = 0;
+  int i;
+
+  fprintf (fp, "  %-22s %10s %12s %12s %12s\n", "Processing", "Seconds",
+           "ns/line", "ns/call", "calls");
+  for (i = 0; i < STATS_STAGES; ++i)
+    print_bench_timer (fp, stats_stage_str (i), get_stats_stage (i), lines);
+  FOREACH_MODULE (idx, module_list) {
+    snprintf (name, sizeof (name), "store %s", module_to_id (module_list[idx]));
+    print_bench_timer (fp, name, get_stats_module (module_list[idx]), lines);
+  }
+  fprintf (fp, "\n");
+}
+
+/* Output the results of the benchmark run, i.e., each stage's time
+ * and throughput, the peak RSS and the size of each panel's tables. */
+void
+bench_report (GLog * glog)
+{
+  FILE *fp = stdout;
+  uint64_t ns = 0, lines = glog->processed;
+  double secs = bench.ns[BENCH_PARSE] / 1e9;
+  char *size = filesize_str (bench.size);
+  size_t idx = 0;
+  int i;
+
+  fprintf (fp, "Log format  %s\n", bench.format);
+  fprintf (fp, "Storage     %s\n", get_storage_str ());
+  fprintf (fp, "Lines       %" PRIu64 " (%u valid, %u invalid), %s, %.1f "
+           "MiB/s parsed\n", lines, glog->valid, glog->invalid, size,
+           secs > 0 ? bench.size / secs / 1048576 : 0);
+  fprintf (fp, "Distinct    up to %d hosts, %d URLs, %d agents\n",
+           conf.bench_hosts ? conf.bench_hosts : BENCH_HOSTS,
+           conf.bench_urls ? conf.bench_urls : BENCH_URLS,
+           conf.bench_agents ? conf.bench_agents : BENCH_AGENTS);
+  fprintf (fp, "Peak RSS    %ld KiB\n\n", get_peak_rss ());
+  free (size);
+
+  fprintf (fp, "  %-10s %10s %12s %14s\n", "Stage", "Seconds", "ns/line",
+           "lines/s");
+  for (i = 0; i < BENCH_STAGES; ++i) {
+    print_bench_stage (fp, i, lines);
+    if (i != BENCH_GENERATE)
+      ns += bench.ns[i];
+  }
+  fprintf (fp, "  %-10s %10.3f %12.0f %14.0f\n\n", "Total", ns / 1e9,
+           lines ? (double) ns / lines : 0, ns ? lines / (ns / 1e9) : 0);
+  if (conf.processing_stats)
+    print_bench_proc_stats (fp, lines);
+
+  fprintf (fp, "  %-18s %12s %14s\n", "Panel", "Items", "Visitor keys");
+  FOREACH_MODULE (idx, module_list) {
+    GModule module = module_list[idx];
+    fprintf (fp, "  %-18s %12u %14u\n", module_to_id (module),
+             ht_get_size_datamap (module), ht_get_size_uniqmap (module));
+  }
+}
+
+/* Remove the synthetic log. */
+void
+bench_free (void)
+{
+  if (bench.path == NULL)
+    return;
+
+  unlink (bench.path);
+  free (bench.path);
+  bench.path = NULL;
+}
+
+/* Start timing a micro-benchmark, counting its allocations as well. */
+static void
+micro_begin (GBenchMicro * micro)
+{
+  micro->allocs = xalloc_count ();
+  micro->begin = bench_nsecs ();
+}
+
+/* Stop timing a micro-benchmark of the given number of ops and output
+ * its time and allocations per op. */
+static void
+micro_end (GBenchMicro * micro, const char *name, uint64_t ops)
+{
+  uint64_t ns = bench_nsecs () - micro->begin;
+  uint64_t allocs = xalloc_count () - micro->allocs;
+
+  fprintf (stdout, "  %-26s %10" PRIu64 " %10.1f %10.3f\n", name, ops,
+           ops ? (double) ns / ops : 0, ops ? (double) allocs / ops : 0);
+}
+
+/* Time the storage wrappers a line goes through the most, i.e.,
+ * interning a unique visitor key, mapping a data key, counting its
+ * hits and adding an agent to a host, out of as many distinct keys as
+ * BENCH_MICRO_KEYS. */
+static void
+bench_micro_storage (uint32_t ops)
+{
+  GBenchMicro micro;
+  GModule module = HOSTS;
+  char **keys = NULL;
+  int *ids = NULL;
+  uint32_t i, nkeys = ops < BENCH_MICRO_KEYS ? ops : BENCH_MICRO_KEYS;
+
+  keys = xcalloc (nkeys, sizeof (char *));
+  ids = xcalloc (nkeys, sizeof (int));
+  for (i = 0; i < nkeys; ++i) {
+    char buf[64];
+    snprintf (buf, sizeof (buf), "10.%u.%u.%u|01/Jan/2024|%u", i >> 16,
+              (i >> 8) & 0xff, i & 0xff, i % 97);
+    keys[i] = xstrdup (buf);
+  }
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i)
+    ht_insert_unique_key (keys[i % nkeys]);
+  micro_end (&micro, "insert unique key", ops);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i)
+    ids[i % nkeys] = ht_insert_keymap (module, keys[i % nkeys]);
+  micro_end (&micro, "insert keymap", ops);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i)
+    ht_insert_hits (module, ids[i % nkeys], 1);
+  micro_end (&micro, "insert hits", ops);
+
+  /* up to 16 agents a host, past the linear search of small sets */
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i)
+    ht_insert_agent (module, ids[i % nkeys], (i / nkeys) % 16 + 1);
+  micro_end (&micro, "insert agent", ops);
+
+  for (i = 0; i < nkeys; ++i)
+    free (keys[i]);
+  free (keys);
+  free (ids);
+}
+
+/* Set the metrics of the given number of panel items to sort. */
+static GHolderItem *
+new_bench_items (uint32_t n)
+{
+  GHolderItem *items = xcalloc (n, sizeof (GHolderItem));
+  GMetrics *m = NULL;
+  char buf[BENCH_URL_LEN];
+  uint32_t i;
+
+  for (i = 0; i < n; ++i) {
+    snprintf (buf, sizeof (buf), "/%s/%u",
+              BENCH_SECTIONS[i % ARRAY_SIZE (BENCH_SECTIONS)],
+              (uint32_t) (bench_rand () % 100000));
+    m = items[i].metrics = new_gmetrics ();
+    m->data = xstrdup (buf);
+    m->method = xstrdup (bench_rand () % 10 ? "GET" : "POST");
+    m->protocol = xstrdup (bench_rand () % 4 ? "HTTP/1.1" : "HTTP/2.0");
+    m->hits = 1 + bench_pick (100000);
+    m->visitors = 1 + m->hits / 4;
+    m->bw.nbw = bench_rand () % 100000000;
+    m->avgts.nts = bench_rand () % 1000000;
+    m->cumts.nts = m->avgts.nts * m->hits;
+    m->maxts.nts = m->avgts.nts * 2;
+  }
+
+  return items;
+}
+
+/* Free the given number of panel items. */
+static void
+free_bench_items (GHolderItem * items, uint32_t n)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; ++i) {
+    free (items[i].metrics->data);
+    free (items[i].metrics->method);
+    free (items[i].metrics->protocol);
+    free (items[i].metrics);
+  }
+  free (items);
+}
+
+/* Time sorting BENCH_MICRO_SORT panel items by each field, the items
+ * being put back in their original order before each op. */
+static void
+bench_micro_sort (uint32_t ops)
+{
+  GBenchMicro micro;
+  GHolderItem *items = NULL, *sorted = NULL;
+  GSort sort = { HOSTS, SORT_BY_HITS, SORT_DESC };
+  char name[64];
+  size_t len = BENCH_MICRO_SORT * sizeof (GHolderItem);
+  uint32_t i, nops = ops / BENCH_MICRO_SORT ? ops / BENCH_MICRO_SORT : 1;
+  int field;
+
+  items = new_bench_items (BENCH_MICRO_SORT);
+  sorted = xmalloc (len);
+  for (field = SORT_BY_HITS; field <= SORT_BY_MTHD; ++field) {
+    sort.field = field;
+    snprintf (name, sizeof (name), "sort %s", get_sort_field_key (field));
+
+    micro_begin (&micro);
+    for (i = 0; i < nops; ++i) {
+      memcpy (sorted, items, len);
+      sort_holder_items (sorted, BENCH_MICRO_SORT, sort);
+    }
+    micro_end (&micro, name, nops);
+  }
+  free (sorted);
+  free_bench_items (items, BENCH_MICRO_SORT);
+}
+
+/* Time classifying the synthetic log's agents, browsers and crawlers
+ * in one pass, then operating systems. */
+static void
+bench_micro_agents (uint32_t ops)
+{
+  GBenchMicro micro;
+  char **agents = NULL, *str = NULL;
+  char buf[512], browser_type[BROWSER_TYPE_LEN], os_type[OPESYS_TYPE_LEN];
+  uint32_t i, nagents = conf.bench_agents ? conf.bench_agents : BENCH_AGENTS;
+
+  agents = new_bench_agents (nagents, COMBINED);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i) {
+    /* the agent is cut short on a match */
+    snprintf (buf, sizeof (buf), "%s", agents[i % nagents]);
+    free (verify_browser (buf, browser_type));
+  }
+  micro_end (&micro, "verify browser", ops);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i) {
+    str = verify_os (agents[i % nagents], os_type);
+    free (str);
+  }
+  micro_end (&micro, "verify os", ops);
+
+  free_bench_agents (agents, nagents);
+}
+
+/* Generate the given number of lines of the given log format type.
+ *
+ * On success, the newly allocated array of lines is returned. */
+static char **
+new_bench_lines (uint32_t n, int type)
+{
+  GBenchLine line;
+  FILE *fp = NULL;
+  char **lines = xcalloc (n, sizeof (char *)), **agents = NULL;
+  char buf[LINE_BUFFER];
+  uint32_t i, nagents = conf.bench_agents ? conf.bench_agents : BENCH_AGENTS;
+
+  if ((fp = tmpfile ()) == NULL)
+    FATAL ("Unable to create the benchmark lines: %s", strerror (errno));
+
+  agents = new_bench_agents (nagents, type);
+  memset (&line, 0, sizeof (line));
+  for (i = 0; i < n; ++i) {
+    line.ts = 1704067200 + (time_t) i;
+    set_bench_line (&line, agents, BENCH_HOSTS, BENCH_URLS, nagents);
+    write_bench_line (fp, &line, type);
+  }
+  free_bench_agents (agents, nagents);
+
+  rewind (fp);
+  for (i = 0; i < n && fgets (buf, sizeof (buf), fp); ++i) {
+    buf[strcspn (buf, "\n")] = '\0';
+    lines[i] = xstrdup (buf);
+  }
+  fclose (fp);
+
+  return lines;
+}
+
+/* Time parsing a line of each predefined log format the synthetic
+ * log can be generated for, out of BENCH_MICRO_KEYS distinct lines. */
+static void
+bench_micro_parse (uint32_t ops)
+{
+  GBenchMicro micro;
+  char **lines = NULL, buf[LINE_BUFFER], name[64];
+  uint32_t i, n = ops < BENCH_MICRO_KEYS ? ops : BENCH_MICRO_KEYS;
+  size_t j;
+
+  for (j = 0; j < ARRAY_SIZE (BENCH_FORMATS); ++j) {
+    set_log_format_str (BENCH_FORMATS[j].str);
+    set_spec_date_format ();
+    lines = new_bench_lines (n, BENCH_FORMATS[j].idx);
+    snprintf (name, sizeof (name), "parse %s", BENCH_FORMATS[j].str);
+
+    micro_begin (&micro);
+    for (i = 0; i < ops; ++i) {
+      /* a line may be written over as it's parsed */
+      snprintf (buf, sizeof (buf), "%s", lines[i % n]);
+      if (parse_format_line (buf))
+        FATAL ("Unable to parse the %s benchmark line: %s",
+               BENCH_FORMATS[j].str, lines[i % n]);
+    }
+    micro_end (&micro, name, ops);
+
+    for (i = 0; i < n; ++i)
+      free (lines[i]);
+    free (lines);
+  }
+}
+
+/* Time escaping the synthetic log's agents, along with a few strings
+ * that need to be escaped, into a JSON buffer, then formatting a key
+ * and a value into it. The buffer is reused by each op. */
+static void
+bench_micro_json (uint32_t ops)
+{
+  GBenchMicro micro;
+  GJSON *json = new_gjson ();
+  char **agents = NULL, *str = NULL;
+  uint32_t i, nagents = conf.bench_agents ? conf.bench_agents : BENCH_AGENTS;
+  size_t nstrs = ARRAY_SIZE (BENCH_JSON_STRS);
+
+  agents = new_bench_agents (nagents, COMBINED);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i) {
+    str = i % 4 ? agents[i % nagents] : (char *) BENCH_JSON_STRS[i / 4 % nstrs];
+    json->offset = 0;
+    escape_json_output (json, str);
+  }
+  micro_end (&micro, "escape json", ops);
+
+  micro_begin (&micro);
+  for (i = 0; i < ops; ++i) {
+    json->offset = 0;
+    pjson (json, "%.*s\"%s\": %d,%.*s", 3, TAB, "hits", (int) i, 1, NL);
+  }
+  micro_end (&micro, "pjson", ops);
+
+  free_bench_agents (agents, nagents);
+  free_json (json);
+}
+
+/* Time each of the storage, sort, agent classification, parsing and
+ * JSON primitives on their own, as many ops as --benchmark-micro each,
+ * and output the time and the allocations made through our allocators
+ * per op. */
+void
+bench_micro (void)
+{
+  uint32_t ops = conf.bench_ops;
+
+  init_storage ();
+  xalloc_count_enable (1);
+
+  fprintf (stdout, "Storage     %s\n\n", get_storage_str ());
+  fprintf (stdout, "  %-26s %10s %10s %10s\n", "Micro-benchmark", "ops",
+           "ns/op", "allocs/op");
+  bench_micro_storage (ops);
+  bench_micro_sort (ops);
+  bench_micro_agents (ops);
+  bench_micro_parse (ops);
+  bench_micro_json (ops);
+
+  xalloc_count_enable (0);
+}
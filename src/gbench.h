@@ -0,0 +1,72 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GBENCH_H_INCLUDED
+#define GBENCH_H_INCLUDED
+
+#include <stdint.h>
+
+#include "parser.h"
+
+#define BENCH_HOSTS  10000      /* distinct hosts by default */
+#define BENCH_URLS   5000       /* distinct URLs by default */
+#define BENCH_AGENTS 500        /* distinct agents by default */
+#define BENCH_DAYS   30         /* span of the synthetic log */
+#define BENCH_SEED   0x9e3779b97f4a7c15ULL      /* same lines on each run */
+
+#define BENCH_MICRO_KEYS  10000 /* distinct keys of a micro-benchmark */
+#define BENCH_MICRO_SORT  1000  /* items sorted by each op */
+
+/* Stages of a benchmark run, each timed on its own */
+typedef enum GBenchStage_
+{
+  BENCH_GENERATE,
+  BENCH_PARSE,
+  BENCH_HOLDER,
+  BENCH_STAGES,
+} GBenchStage;
+
+/* A benchmark run, parsing a synthetic log of the selected format */
+typedef struct GBench_
+{
+  char *path;                   /* synthetic log */
+  const char *format;           /* its predefined log format */
+  uint64_t size;                /* bytes written */
+  uint64_t begin[BENCH_STAGES]; /* when each stage began, in ns */
+  uint64_t ns[BENCH_STAGES];    /* time spent on each stage */
+} GBench;
+
+void bench_begin (GBenchStage stage);
+void bench_end (GBenchStage stage);
+void bench_free (void);
+void bench_generate (void);
+void bench_micro (void);
+void bench_report (GLog * glog);
+
+#endif // for #ifndef GBENCH_H
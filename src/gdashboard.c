@@ -48,10 +48,20 @@
 
 #include "color.h"
 #include "error.h"
+#include "gholder.h"
 #include "gstorage.h"
 #include "util.h"
 #include "xmalloc.h"
 
+/* chars to use based on encoding used */
+#ifdef HAVE_LIBNCURSESW
+#define CHILD_BEND "\xe2\x94\x9c"
+#define CHILD_HORZ "\xe2\x94\x80"
+#else
+#define CHILD_BEND "|"
+#define CHILD_HORZ "`-"
+#endif
+
 static GFind find_t;
 
 /* Reset find indices */
@@ -93,41 +103,17 @@ new_gdata (uint32_t size)
   return data;
 }
 
-/* Free memory allocated for a GDashData instance. Includes malloc'd
- * strings. */
-static void
-free_dashboard_data (GDashData item)
-{
-  if (item.metrics == NULL)
-    return;
-
-  if (item.metrics->data)
-    free (item.metrics->data);
-  if (item.metrics->bw.sbw)
-    free (item.metrics->bw.sbw);
-  if (conf.serve_usecs && item.metrics->avgts.sts)
-    free (item.metrics->avgts.sts);
-  if (conf.serve_usecs && item.metrics->cumts.sts)
-    free (item.metrics->cumts.sts);
-  if (conf.serve_usecs && item.metrics->maxts.sts)
-    free (item.metrics->maxts.sts);
-  free (item.metrics);
-}
-
 /* Free memory allocated for a GDash instance, and nested structure
- * data. */
+ * data. Rows only reference the holder's metrics, which are freed
+ * along with the holder. */
 void
 free_dashboard (GDash * dash)
 {
   GModule module;
-  int j;
   size_t idx = 0;
 
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
-    for (j = 0; j < dash->module[module].alloc_data; j++) {
-      free_dashboard_data (dash->module[module].data[j]);
-    }
     free (dash->module[module].data);
   }
   free (dash);
@@ -213,7 +199,7 @@ int
 set_module_from_mouse_event (GScroll * gscroll, GDash * dash, int y)
 {
   int module = 0;
-  int offset = y - MAX_HEIGHT_HEADER - MAX_HEIGHT_FOOTER + 1;
+  int offset = y - get_header_height () - MAX_HEIGHT_FOOTER + 1;
   if (gscroll->expanded) {
     module = get_find_current_module (dash, offset);
   } else {
@@ -243,25 +229,24 @@ render_child_node (const char *data)
   char *buf;
   int len = 0;
 
-  /* chars to use based on encoding used */
-#ifdef HAVE_LIBNCURSESW
-  const char *bend = "\xe2\x94\x9c";
-  const char *horz = "\xe2\x94\x80";
-#else
-  const char *bend = "|";
-  const char *horz = "`-";
-#endif
-
   if (data == NULL || *data == '\0')
     return NULL;
 
-  len = snprintf (NULL, 0, " %s%s %s", bend, horz, data);
+  len = snprintf (NULL, 0, " %s%s %s", CHILD_BEND, CHILD_HORZ, data);
   buf = xmalloc (len + 3);
-  sprintf (buf, " %s%s %s", bend, horz, data);
+  sprintf (buf, " %s%s %s", CHILD_BEND, CHILD_HORZ, data);
 
   return buf;
 }
 
+/* Get the length of the string render_child_node() allocates for the
+ * given sub item, without allocating it. */
+static int
+child_node_len (const char *data)
+{
+  return snprintf (NULL, 0, " %s%s %s", CHILD_BEND, CHILD_HORZ, data);
+}
+
 /* Get a string of bars given current hits, maximum hit & xpos.
  *
  * On success, the newly allocated string representing the chart is
@@ -302,7 +287,7 @@ set_max_hit_len (GDashMeta * meta, GDashData * idata)
 static void
 set_max_hit_perc_len (GDashMeta * meta, GDashData * idata)
 {
-  int vlen = intlen (idata->metrics->hits_perc);
+  int vlen = intlen (idata->hits_perc);
   int llen = strlen (MTRC_HITS_PERC_LBL);
 
   if (vlen > meta->hits_perc_len)
@@ -334,7 +319,7 @@ set_max_visitors_len (GDashMeta * meta, GDashData * idata)
 static void
 set_max_visitors_perc_len (GDashMeta * meta, GDashData * idata)
 {
-  int vlen = intlen (idata->metrics->visitors_perc);
+  int vlen = intlen (idata->visitors_perc);
   int llen = strlen (MTRC_VISITORS_PERC_LBL);
 
   if (vlen > meta->visitors_perc_len)
@@ -350,7 +335,8 @@ set_max_visitors_perc_len (GDashMeta * meta, GDashData * idata)
 static void
 set_max_bw_len (GDashMeta * meta, GDashData * idata)
 {
-  int vlen = strlen (idata->metrics->bw.sbw);
+  char bw[FILESIZE_LEN];
+  int vlen = filesize_fmt (bw, idata->metrics->bw.nbw);
   int llen = strlen (MTRC_BW_LBL);
 
   if (vlen > meta->bw_len)
@@ -362,69 +348,6 @@ set_max_bw_len (GDashMeta * meta, GDashData * idata)
     meta->bw_len = llen;
 }
 
-/* Get the percent integer length. */
-static void
-set_max_avgts_len (GDashMeta * meta, GDashData * idata)
-{
-  int vlen = 0, llen = 0;
-
-  if (!conf.serve_usecs || !idata->metrics->avgts.sts)
-    return;
-
-  vlen = strlen (idata->metrics->avgts.sts);
-  llen = strlen (MTRC_AVGTS_LBL);
-
-  if (vlen > meta->avgts_len)
-    meta->avgts_len = vlen;
-
-  /* if outputting with column names, then determine if the value is
-   * longer than the length of the column name */
-  if (llen > meta->avgts_len)
-    meta->avgts_len = llen;
-}
-
-/* Get the percent integer length. */
-static void
-set_max_cumts_len (GDashMeta * meta, GDashData * idata)
-{
-  int vlen = 0, llen = 0;
-
-  if (!conf.serve_usecs || !idata->metrics->cumts.sts)
-    return;
-
-  vlen = strlen (idata->metrics->cumts.sts);
-  llen = strlen (MTRC_AVGTS_LBL);
-
-  if (vlen > meta->cumts_len)
-    meta->cumts_len = vlen;
-
-  /* if outputting with column names, then determine if the value is
-   * longer than the length of the column name */
-  if (llen > meta->cumts_len)
-    meta->cumts_len = llen;
-}
-
-/* Get the percent integer length. */
-static void
-set_max_maxts_len (GDashMeta * meta, GDashData * idata)
-{
-  int vlen = 0, llen = 0;
-
-  if (!conf.serve_usecs || !idata->metrics->maxts.sts)
-    return;
-
-  vlen = strlen (idata->metrics->maxts.sts);
-  llen = strlen (MTRC_AVGTS_LBL);
-
-  if (vlen > meta->maxts_len)
-    meta->maxts_len = vlen;
-
-  /* if outputting with column names, then determine if the value is
-   * longer than the length of the column name */
-  if (llen > meta->maxts_len)
-    meta->maxts_len = llen;
-}
-
 /* Get the percent integer length. */
 static void
 set_max_method_len (GDashMeta * meta, GDashData * idata)
@@ -473,7 +396,10 @@ set_max_data_len (GDashMeta * meta, GDashData * idata)
 {
   int vlen = 0, llen = 0;
 
-  vlen = strlen (idata->metrics->data);
+  if (idata->is_subitem)
+    vlen = child_node_len (idata->metrics->data);
+  else
+    vlen = strlen (idata->metrics->data);
   llen = strlen (MTRC_DATA_LBL);
 
   if (vlen > meta->data_len)
@@ -505,9 +431,6 @@ set_metrics_len (GDashMeta * meta, GDashData * idata)
 
   /* string-based length */
   set_max_bw_len (meta, idata);
-  set_max_avgts_len (meta, idata);
-  set_max_cumts_len (meta, idata);
-  set_max_maxts_len (meta, idata);
 
   set_max_method_len (meta, idata);
   set_max_protocol_len (meta, idata);
@@ -592,11 +515,14 @@ render_data (GDashModule * data, GDashRender render, int *x)
   GColors *color = get_color_by_item_module (COLOR_MTRC_DATA, data->module);
   WINDOW *win = render.win;
 
-  char *date = NULL, *value = NULL, *buf = NULL;
+  char *date = NULL, *value = NULL, *buf = NULL, *child = NULL;
   int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
   int date_len = 0;
 
-  value = substring (data->data[idx].metrics->data, 0, w - *x);
+  /* sub items get their tree node prefix only once visible */
+  if (data->data[idx].is_subitem)
+    child = render_child_node (data->data[idx].metrics->data);
+  value = substring (child ? child : data->data[idx].metrics->data, 0, w - *x);
   if (data->module == VISITORS) {
     date = set_visitors_date (value);
     date_len = strlen (date);
@@ -615,6 +541,7 @@ render_data (GDashModule * data, GDashRender render, int *x)
 
   *x += data->module == VISITORS ? date_len : data->meta.data_len;
   *x += DASH_SPACE;
+  free (child);
   free (value);
   free (date);
 }
@@ -685,11 +612,13 @@ render_avgts (GDashModule * data, GDashRender render, int *x)
   WINDOW *win = render.win;
 
   int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
-  char *avgts = data->data[idx].metrics->avgts.sts;
+  char *avgts = NULL;
 
   if (data->module == HOSTS && data->data[idx].is_subitem)
     goto out;
 
+  avgts = usecs_to_str (data->data[idx].metrics->avgts.nts);
+
   if (sel) {
     /* selected state */
     draw_header (win, avgts, "%9s", y, *x, w, color_selected);
@@ -699,6 +628,7 @@ render_avgts (GDashModule * data, GDashRender render, int *x)
     mvwprintw (win, y, *x, "%9s", avgts);
     wattroff (win, color->attr | COLOR_PAIR (color->pair->idx));
   }
+  free (avgts);
 
 out:
   *x += DASH_SRV_TM_LEN + DASH_SPACE;
@@ -712,11 +642,13 @@ render_cumts (GDashModule * data, GDashRender render, int *x)
   WINDOW *win = render.win;
 
   int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
-  char *cumts = data->data[idx].metrics->cumts.sts;
+  char *cumts = NULL;
 
   if (data->module == HOSTS && data->data[idx].is_subitem)
     goto out;
 
+  cumts = usecs_to_str (data->data[idx].metrics->cumts.nts);
+
   if (sel) {
     /* selected state */
     draw_header (win, cumts, "%9s", y, *x, w, color_selected);
@@ -726,6 +658,7 @@ render_cumts (GDashModule * data, GDashRender render, int *x)
     mvwprintw (win, y, *x, "%9s", cumts);
     wattroff (win, color->attr | COLOR_PAIR (color->pair->idx));
   }
+  free (cumts);
 
 out:
   *x += DASH_SRV_TM_LEN + DASH_SPACE;
@@ -739,11 +672,13 @@ render_maxts (GDashModule * data, GDashRender render, int *x)
   WINDOW *win = render.win;
 
   int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
-  char *maxts = data->data[idx].metrics->maxts.sts;
+  char *maxts = NULL;
 
   if (data->module == HOSTS && data->data[idx].is_subitem)
     goto out;
 
+  maxts = usecs_to_str (data->data[idx].metrics->maxts.nts);
+
   if (sel) {
     /* selected state */
     draw_header (win, maxts, "%9s", y, *x, w, color_selected);
@@ -753,6 +688,7 @@ render_maxts (GDashModule * data, GDashRender render, int *x)
     mvwprintw (win, y, *x, "%9s", maxts);
     wattroff (win, color->attr | COLOR_PAIR (color->pair->idx));
   }
+  free (maxts);
 
 out:
   *x += DASH_SRV_TM_LEN + DASH_SPACE;
@@ -766,11 +702,13 @@ render_bw (GDashModule * data, GDashRender render, int *x)
   WINDOW *win = render.win;
 
   int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
-  char *bw = data->data[idx].metrics->bw.sbw;
+  char bw[FILESIZE_LEN];
 
   if (data->module == HOSTS && data->data[idx].is_subitem)
     goto out;
 
+  filesize_fmt (bw, data->data[idx].metrics->bw.nbw);
+
   if (sel) {
     char *fw = get_fixed_fmt_width (data->meta.bw_len, 's');
     /* selected state */
@@ -823,7 +761,7 @@ render_hits_percent (GDashModule * data, GDashRender render, int *x)
     item = COLOR_MTRC_HITS_PERC_MAX;
 
   color = get_color_by_item_module (item, data->module);
-  render_percent (render, color, data->data[idx].metrics->hits_perc, l, *x);
+  render_percent (render, color, data->data[idx].hits_perc, l, *x);
 
 out:
   *x += l + 1 + DASH_SPACE;
@@ -844,7 +782,7 @@ render_visitors_percent (GDashModule * data, GDashRender render, int *x)
     item = COLOR_MTRC_VISITORS_PERC_MAX;
 
   color = get_color_by_item_module (item, data->module);
-  render_percent (render, color, data->data[idx].metrics->visitors_perc, l, *x);
+  render_percent (render, color, data->data[idx].visitors_perc, l, *x);
 
 out:
   *x += l + 1 + DASH_SPACE;
@@ -1254,37 +1192,235 @@ perform_find_dash_scroll (GScroll * gscroll, GModule module)
   find_t.module = module;
 }
 
-/* Find the searched item within the given sub list.
+/* Skip the bracket expression the given pattern points to.
  *
- * If not found, the GFind structure is reset and 1 is returned.
- * If found, a GFind structure is set and 0 is returned. */
-static int
-find_next_sub_item (GSubList * sub_list, regex_t * regex)
+ * If the bracket expression is not terminated, NULL is returned.
+ * On success, a pointer to its closing bracket is returned. */
+static const char *
+skip_bracket (const char *p)
 {
-  GSubItem *iter;
-  int i = 0, rc;
+  char close;
+
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+  for (; *p != '\0' && *p != ']'; p++) {
+    /* character classes, collating symbols and equivalence classes */
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+      close = p[1];
+      for (p += 2; *p != '\0' && !(*p == close && p[1] == ']'); p++);
+      if (*p == '\0')
+        return NULL;
+      p++;
+    }
+  }
 
-  if (sub_list == NULL)
-    goto out;
+  return *p == ']' ? p : NULL;
+}
+
+/* Skip the group the given pattern points to.
+ *
+ * If the group is not terminated, NULL is returned.
+ * On success, a pointer to its closing parenthesis is returned. */
+static const char *
+skip_group (const char *p)
+{
+  int depth = 0;
+
+  for (; *p != '\0'; p++) {
+    if (*p == '\\' && *(++p) == '\0')
+      return NULL;
+    else if (*p == '[' && (p = skip_bracket (p)) == NULL)
+      return NULL;
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      return p;
+  }
+
+  return NULL;
+}
 
-  for (iter = sub_list->head; iter; iter = iter->next) {
-    if (i >= find_t.next_sub_idx) {
-      rc = regexec (regex, iter->metrics->data, 0, NULL, 0);
-      if (rc == 0) {
-        find_t.next_idx++;
-        find_t.next_sub_idx = (1 + i);
-        return 0;
+/* Drop the last character of the given literal run, along with all the
+ * bytes of a multibyte character. */
+static void
+drop_literal_char (const char *run, int *len)
+{
+  if (*len > 0 && (unsigned char) run[*len - 1] < 0x80) {
+    (*len)--;
+    return;
+  }
+  while (*len > 0 && ((unsigned char) run[*len - 1] & 0xC0) == 0x80)
+    (*len)--;
+  if (*len > 0)
+    (*len)--;
+}
+
+/* Keep the given literal run if it's the longest one so far. */
+static void
+end_literal_run (const char *run, int *len, char *lit, int *max)
+{
+  if (*len > *max) {
+    memcpy (lit, run, *len);
+    *max = *len;
+  }
+  *len = 0;
+}
+
+/* Extract the longest literal any string matching the given extended
+ * regular expression contains, as it would appear in a search index:
+ * lowercased for a case insensitive search, and led or trailed by a
+ * NUL if anchored to the beginning or the end of the string.
+ *
+ * If no literal is found, 0 is returned.
+ * On success, the literal is set into lit and its length returned. */
+static int
+get_find_literal (const char *pattern, int icase, char *lit)
+{
+  const char *p = pattern;
+  char *run = NULL;
+  int len = 0, max = 0;
+
+  /* any literal may be left out by an alternation */
+  if (strchr (pattern, '|'))
+    return 0;
+
+  run = xmalloc (strlen (pattern) + 2);
+  if (*p == '^') {
+    run[len++] = '\0';
+    p++;
+  }
+
+  for (; *p != '\0'; p++) {
+    switch (*p) {
+    case '\\':
+      /* escaped special characters are literals, others are classes */
+      if (p[1] == '\0' || isalnum ((unsigned char) p[1])) {
+        end_literal_run (run, &len, lit, &max);
+        p += p[1] != '\0';
+        break;
       }
-      find_t.next_idx++;
+      run[len++] = icase ? tolower ((unsigned char) p[1]) : p[1];
+      p++;
+      break;
+    case '[':
+      end_literal_run (run, &len, lit, &max);
+      if ((p = skip_bracket (p)) == NULL)
+        goto fail;
+      break;
+    case '(':
+      end_literal_run (run, &len, lit, &max);
+      if ((p = skip_group (p)) == NULL)
+        goto fail;
+      break;
+    case ')':
+      goto fail;
+    case '{':
+      if ((p = strchr (p, '}')) == NULL)
+        goto fail;
+      /* fall through */
+    case '?':
+    case '*':
+      drop_literal_char (run, &len);
+      end_literal_run (run, &len, lit, &max);
+      break;
+    case '$':
+      if (p[1] == '\0' && len > 0)
+        run[len++] = '\0';
+      end_literal_run (run, &len, lit, &max);
+      break;
+    case '+':
+    case '.':
+    case '^':
+      end_literal_run (run, &len, lit, &max);
+      break;
+    default:
+      /* non-ASCII case folding is left to regexec */
+      if (icase && (unsigned char) *p >= 0x80)
+        end_literal_run (run, &len, lit, &max);
+      else
+        run[len++] = icase ? tolower ((unsigned char) *p) : *p;
     }
-    i++;
   }
-out:
-  find_t.next_parent_idx++;
-  find_t.next_sub_idx = 0;
-  find_t.look_in_sub = 0;
+  end_literal_run (run, &len, lit, &max);
+  free (run);
 
-  return 1;
+  return max;
+
+fail:
+  free (run);
+  return 0;
+}
+
+/* Get the last of the given sorted offsets, between lo and hi, that is
+ * less than or equal to the given value. */
+static int
+get_index_pos (const int *offs, int lo, int hi, int val)
+{
+  int mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (offs[mid] <= val)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
+
+/* Find the given literal within the given blob.
+ *
+ * If not found, NULL is returned.
+ * On success, a pointer to its first occurrence is returned. */
+static const char *
+find_literal (const char *s, const char *end, const char *lit, int len)
+{
+  while (end - s >= len) {
+    if ((s = memchr (s, *lit, end - s - len + 1)) == NULL)
+      return NULL;
+    if (memcmp (s, lit, len) == 0)
+      return s;
+    s++;
+  }
+
+  return NULL;
+}
+
+/* Find the next row of the given search index, from the given row on,
+ * matching the given regular expression. If a literal is given, only
+ * the rows containing it are matched against the expression.
+ *
+ * On error, -1 is returned and the regexec() error is set into rc.
+ * If not found, the number of rows in the index is returned.
+ * On success, the matching row is returned. */
+static int
+find_index_row (GHolderIndex * index, int row, regex_t * regex,
+                const char *lit, int len, int *rc)
+{
+  const char *p = NULL, *end = index->text + index->offs[index->len];
+
+  for (; row < index->len; row++) {
+    if (len > 0) {
+      /* start at the NUL leading the row, for anchored literals */
+      p = find_literal (index->text + index->offs[row] - 1, end, lit, len);
+      if (p == NULL)
+        return index->len;
+      row = get_index_pos (index->offs, row, index->len - 1,
+                           p - index->text + 1);
+    }
+
+    (*rc) = regexec (regex, index->data[row], 0, NULL, 0);
+    if ((*rc) == 0)
+      return row;
+    if ((*rc) != REG_NOMATCH)
+      return -1;
+  }
+
+  return index->len;
 }
 
 /* Perform a forward search across all modules.
@@ -1295,10 +1431,10 @@ int
 perform_next_find (GHolder * h, GScroll * gscroll)
 {
   GModule module;
-  GSubList *sub_list;
+  GHolderIndex *index;
   regex_t regex;
-  char buf[REGEX_ERROR], *data;
-  int y, x, j, n, rc;
+  char buf[REGEX_ERROR], *lit = NULL;
+  int y, x, j, row, len, rc = 0;
   size_t idx = 0;
 
   getmaxyx (stdscr, y, x);
@@ -1310,44 +1446,50 @@ perform_next_find (GHolder * h, GScroll * gscroll)
   if (regexp_init (&regex, find_t.pattern))
     return 1;
 
+  /* rows not containing a literal of the pattern are skipped */
+  lit = xmalloc (strlen (find_t.pattern) + 2);
+  len = get_find_literal (find_t.pattern, find_t.icase, lit);
+
   /* use last find_t.module and start search */
   idx = find_t.module;
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
 
-    n = h[module].idx;
-    for (j = find_t.next_parent_idx; j < n; j++, find_t.next_idx++) {
-      data = h[module].items[j].metrics->data;
+    if (find_t.next_parent_idx < h[module].idx) {
+      index = load_holder_index (&h[module], find_t.icase);
+
+      /* resume right after the last match, if any */
+      row = index->first[find_t.next_parent_idx];
+      if (find_t.look_in_sub || find_t.next_sub_idx)
+        row += 1 + find_t.next_sub_idx;
 
-      rc = regexec (&regex, data, 0, NULL, 0);
+      row = find_index_row (index, row, &regex, lit, len, &rc);
       /* error matching against the precompiled pattern buffer */
-      if (rc != 0 && rc != REG_NOMATCH) {
+      if (row < 0) {
         regerror (rc, &regex, buf, sizeof (buf));
         draw_header (stdscr, buf, "%s", y - 1, 0, x, color_error);
         refresh ();
         regfree (&regex);
+        free (lit);
         return 1;
       }
-      /* a match was found (data level) */
-      else if (rc == 0 && !find_t.look_in_sub) {
+      /* a match was found, either an item or one of its sub items */
+      if (row < index->len) {
+        j = get_index_pos (index->first, 0, h[module].idx - 1, row);
+        find_t.next_idx = row;
+        find_t.next_parent_idx = j;
+        find_t.next_sub_idx = row - index->first[j];
         find_t.look_in_sub = 1;
         perform_find_dash_scroll (gscroll, module);
         goto out;
       }
-      /* look at sub list nodes */
-      else {
-        sub_list = h[module].items[j].sub_list;
-        if (find_next_sub_item (sub_list, &regex) == 0) {
-          perform_find_dash_scroll (gscroll, module);
-          goto out;
-        }
-      }
     }
 
     /* reset find */
     find_t.next_idx = 0;
     find_t.next_parent_idx = 0;
     find_t.next_sub_idx = 0;
+    find_t.look_in_sub = 0;
 
     if (find_t.module != module) {
       reset_scroll_offsets (gscroll);
@@ -1361,6 +1503,7 @@ perform_next_find (GHolder * h, GScroll * gscroll)
 
 out:
   regfree (&regex);
+  free (lit);
   return 0;
 }
 
@@ -1408,7 +1551,6 @@ set_dash_metrics (GDash ** dash, GMetrics * metrics, GModule module,
 {
   GDashData *idata = NULL;
   GDashMeta *meta = NULL;
-  char *data = NULL;
   int *idx;
 
   if (!metrics->data)
@@ -1418,37 +1560,15 @@ set_dash_metrics (GDash ** dash, GMetrics * metrics, GModule module,
   idata = &(*dash)->module[module].data[(*idx)];
   meta = &(*dash)->module[module].meta;
 
-  idata->metrics = new_gmetrics ();
+  idata->metrics = metrics;
   idata->is_subitem = is_subitem;
 
-  data = is_subitem ? render_child_node (metrics->data) : metrics->data;
-
   /* set maximum values so far for hits/visitors */
   set_max_values (meta, metrics);
 
-  idata->metrics->hits = metrics->hits;
-  idata->metrics->hits_perc = get_percentage (meta->max_hits, metrics->hits);
-  idata->metrics->visitors = metrics->visitors;
-  idata->metrics->visitors_perc =
+  idata->hits_perc = get_percentage (meta->max_hits, metrics->hits);
+  idata->visitors_perc =
     get_percentage (meta->max_visitors, metrics->visitors);
-  idata->metrics->bw.sbw = filesize_str (metrics->bw.nbw);
-  idata->metrics->data = xstrdup (data);
-
-  if (conf.append_method && metrics->method)
-    idata->metrics->method = metrics->method;
-  if (conf.append_protocol && metrics->protocol)
-    idata->metrics->protocol = metrics->protocol;
-
-  if (!conf.serve_usecs)
-    goto out;
-
-  idata->metrics->avgts.sts = usecs_to_str (metrics->avgts.nts);
-  idata->metrics->cumts.sts = usecs_to_str (metrics->cumts.nts);
-  idata->metrics->maxts.sts = usecs_to_str (metrics->maxts.nts);
-
-out:
-  if (is_subitem)
-    free (data);
 
   set_metrics_len (meta, idata);
 
@@ -1496,7 +1616,7 @@ load_data_to_dash (GHolder * h, GDash * dash, GModule module, GScroll * gscroll)
   dash->module[module].alloc_data = alloc_size;
   dash->module[module].data = new_gdata (alloc_size);
   dash->module[module].holder_size = h->holder_size;
-  memset (&dash->module[module].meta, 0, sizeof (GDashData));
+  memset (&dash->module[module].meta, 0, sizeof (GDashMeta));
 
   for (i = 0, j = 0; i < alloc_size; i++) {
     if (h->items[j].metrics->data == NULL)
@@ -67,10 +67,13 @@ typedef struct GDashRender_
   int sel;
 } GDashRender;
 
-/* Dashboard panel item */
+/* Dashboard panel item, a row referencing the holder's metrics.
+ * Its strings are only formatted once the row is rendered. */
 typedef struct GDashData_
 {
-  GMetrics *metrics;
+  GMetrics *metrics;     /* holder item or sub item metrics, not owned */
+  float hits_perc;       /* hits percent from the max value so far */
+  float visitors_perc;   /* visitors percent from the max value so far */
   short is_subitem;
 } GDashData;
 
@@ -87,9 +90,6 @@ typedef struct GDashMeta_
   int visitors_len;
   int visitors_perc_len;
   int bw_len;
-  int avgts_len;
-  int cumts_len;
-  int maxts_len;
   int method_len;
   int protocol_len;
   int data_len;
@@ -0,0 +1,522 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(HAVE_LIBZ) || defined(HAVE_ZLIB)
+#define GDECOMP_GZIP 1
+#include <zlib.h>
+#endif
+#if defined(HAVE_LIBBZ2) || defined(HAVE_BZ2)
+#define GDECOMP_BZIP2 1
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#define GDECOMP_ZSTD 1
+#include <zstd.h>
+#endif
+
+#include "gdecomp.h"
+
+#include "xmalloc.h"
+
+/* Determine the compression format of the given file out of its first
+ * bytes, regardless of its current offset.
+ *
+ * If the file is not compressed (or can't be read), GCODEC_NONE is
+ * returned.
+ * On success, the compression format is returned. */
+GCodec
+gdecomp_detect (int fd)
+{
+  unsigned char magic[4];
+  ssize_t bytes = pread (fd, magic, sizeof (magic), 0);
+
+  if (bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return GCODEC_GZIP;
+  if (bytes >= 3 && !memcmp (magic, "BZh", 3))
+    return GCODEC_BZIP2;
+  if (bytes == 4 && !memcmp (magic, "\x28\xb5\x2f\xfd", 4))
+    return GCODEC_ZSTD;
+
+  return GCODEC_NONE;
+}
+
+/* Get the name of the given compression format. */
+const char *
+gdecomp_name (GCodec codec)
+{
+  switch (codec) {
+  case GCODEC_GZIP:
+    return "gzip";
+  case GCODEC_BZIP2:
+    return "bzip2";
+  case GCODEC_ZSTD:
+    return "zstd";
+  default:
+    return "none";
+  }
+}
+
+/* Determine if GoAccess was built with support for the given format.
+ *
+ * If not supported, 0 is returned.
+ * If supported, 1 is returned. */
+int
+gdecomp_supported (GCodec codec)
+{
+  switch (codec) {
+#ifdef GDECOMP_GZIP
+  case GCODEC_GZIP:
+    return 1;
+#endif
+#ifdef GDECOMP_BZIP2
+  case GCODEC_BZIP2:
+    return 1;
+#endif
+#ifdef GDECOMP_ZSTD
+  case GCODEC_ZSTD:
+    return 1;
+#endif
+  default:
+    return 0;
+  }
+}
+
+/* Set up the stream state of the codec.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+codec_init (GDecomp * decomp)
+{
+  switch (decomp->codec) {
+#ifdef GDECOMP_GZIP
+  case GCODEC_GZIP:
+    decomp->state = xcalloc (1, sizeof (z_stream));
+    /* 32 lets zlib detect the gzip header */
+    return inflateInit2 ((z_stream *) decomp->state, 15 + 32) != Z_OK;
+#endif
+#ifdef GDECOMP_BZIP2
+  case GCODEC_BZIP2:
+    decomp->state = xcalloc (1, sizeof (bz_stream));
+    return BZ2_bzDecompressInit ((bz_stream *) decomp->state, 0, 0) != BZ_OK;
+#endif
+#ifdef GDECOMP_ZSTD
+  case GCODEC_ZSTD:
+    return (decomp->state = ZSTD_createDCtx ()) == NULL;
+#endif
+  default:
+    return 1;
+  }
+}
+
+/* Release the stream state of the codec. */
+static void
+codec_end (GDecomp * decomp)
+{
+  if (decomp->state == NULL)
+    return;
+
+  switch (decomp->codec) {
+#ifdef GDECOMP_GZIP
+  case GCODEC_GZIP:
+    inflateEnd ((z_stream *) decomp->state);
+    free (decomp->state);
+    break;
+#endif
+#ifdef GDECOMP_BZIP2
+  case GCODEC_BZIP2:
+    BZ2_bzDecompressEnd ((bz_stream *) decomp->state);
+    free (decomp->state);
+    break;
+#endif
+#ifdef GDECOMP_ZSTD
+  case GCODEC_ZSTD:
+    ZSTD_freeDCtx ((ZSTD_DCtx *) decomp->state);
+    break;
+#endif
+  default:
+    break;
+  }
+  decomp->state = NULL;
+}
+
+/* Get ready to decompress the next stream once one ended, e.g., a gzip
+ * file made out of several members. Zstd frames follow each other
+ * within the same stream state.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+codec_reset (GDecomp * decomp)
+{
+  switch (decomp->codec) {
+#ifdef GDECOMP_GZIP
+  case GCODEC_GZIP:
+    return inflateReset ((z_stream *) decomp->state) != Z_OK;
+#endif
+#ifdef GDECOMP_BZIP2
+  case GCODEC_BZIP2:
+    BZ2_bzDecompressEnd ((bz_stream *) decomp->state);
+    memset (decomp->state, 0, sizeof (bz_stream));
+    return BZ2_bzDecompressInit ((bz_stream *) decomp->state, 0, 0) != BZ_OK;
+#endif
+  default:
+    return 0;
+  }
+}
+
+/* Decompress the pending input into the given output buffer. The num of
+ * bytes written into it is stored into n.
+ *
+ * On error, -1 is returned.
+ * If the end of a stream was reached, 1 is returned.
+ * On success, 0 is returned. */
+static int
+codec_step (GDecomp * decomp, char *out, size_t size, size_t * n)
+{
+  size_t avail = decomp->in_len - decomp->in_pos;
+  int ret = 0;
+
+  *n = 0;
+  switch (decomp->codec) {
+#ifdef GDECOMP_GZIP
+  case GCODEC_GZIP:{
+      z_stream *z = decomp->state;
+      z->next_in = (Bytef *) decomp->in + decomp->in_pos;
+      z->avail_in = avail;
+      z->next_out = (Bytef *) out;
+      z->avail_out = size;
+      ret = inflate (z, Z_NO_FLUSH);
+      decomp->in_pos += avail - z->avail_in;
+      *n = size - z->avail_out;
+      if (ret == Z_STREAM_END)
+        return 1;
+      return ret == Z_OK || ret == Z_BUF_ERROR ? 0 : -1;
+    }
+#endif
+#ifdef GDECOMP_BZIP2
+  case GCODEC_BZIP2:{
+      bz_stream *bz = decomp->state;
+      bz->next_in = decomp->in + decomp->in_pos;
+      bz->avail_in = avail;
+      bz->next_out = out;
+      bz->avail_out = size;
+      ret = BZ2_bzDecompress (bz);
+      decomp->in_pos += avail - bz->avail_in;
+      *n = size - bz->avail_out;
+      if (ret == BZ_STREAM_END)
+        return 1;
+      return ret == BZ_OK ? 0 : -1;
+    }
+#endif
+#ifdef GDECOMP_ZSTD
+  case GCODEC_ZSTD:{
+      ZSTD_inBuffer zin;
+      ZSTD_outBuffer zout;
+      size_t zret = 0;
+      zin.src = decomp->in;
+      zin.size = decomp->in_len;
+      zin.pos = decomp->in_pos;
+      zout.dst = out;
+      zout.size = size;
+      zout.pos = 0;
+      zret = ZSTD_decompressStream (decomp->state, &zout, &zin);
+      if (ZSTD_isError (zret))
+        return -1;
+      decomp->in_pos = zin.pos;
+      *n = zout.pos;
+      /* a frame was fully decoded and flushed */
+      return zret == 0 ? 1 : 0;
+    }
+#endif
+  default:
+    (void) avail;
+    (void) ret;
+    (void) out;
+    (void) size;
+    return -1;
+  }
+}
+
+/* Read the next block of compressed data.
+ *
+ * On error, 1 is returned and errno is set.
+ * On success, 0 is returned. */
+static int
+read_input (GDecomp * decomp)
+{
+  ssize_t bytes = 0;
+
+  while ((bytes = read (decomp->fd, decomp->in, GDECOMP_IN_SIZE)) == -1) {
+    if (errno != EINTR)
+      return 1;
+  }
+  decomp->in_len = bytes;
+  decomp->in_pos = 0;
+  decomp->in_eof = bytes == 0;
+
+  return 0;
+}
+
+/* Decompress data into the given chunk until it's full or all the
+ * compressed data was decompressed. Anything following the last
+ * complete stream that is not a stream itself is ignored, as gzip(1)
+ * does.
+ *
+ * On error, -1 is returned and errno is set.
+ * If no more data is left to decompress, 1 is returned.
+ * On success, 0 is returned. */
+static int
+fill_chunk (GDecomp * decomp, GDecompChunk * chunk)
+{
+  size_t n = 0, pos = 0;
+  int ret = 0;
+
+  if (chunk->data == NULL)
+    chunk->data = xmalloc (GDECOMP_CHUNK_SIZE);
+  chunk->len = 0;
+
+  while (chunk->len < GDECOMP_CHUNK_SIZE) {
+    if (decomp->in_pos == decomp->in_len && !decomp->in_eof) {
+      if (read_input (decomp))
+        return -1;
+      continue;
+    }
+    /* all read, the last stream must have been completed */
+    if (decomp->in_pos == decomp->in_len) {
+      if (!decomp->in_stream)
+        return 1;
+      errno = EIO;
+      return -1;
+    }
+
+    pos = decomp->in_pos;
+    ret = codec_step (decomp, chunk->data + chunk->len,
+                      GDECOMP_CHUNK_SIZE - chunk->len, &n);
+    chunk->len += n;
+
+    if (ret == -1 && decomp->members > 0 && !decomp->in_stream) {
+      decomp->in_pos = decomp->in_len;
+      decomp->in_eof = 1;
+      return 1;
+    }
+    if (ret == -1 || (ret == 0 && n == 0 && decomp->in_pos == pos)) {
+      errno = EIO;
+      return -1;
+    }
+
+    if (ret == 1) {
+      decomp->members++;
+      decomp->in_stream = 0;
+      if (codec_reset (decomp)) {
+        errno = ENOMEM;
+        return -1;
+      }
+    } else {
+      decomp->in_stream = 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Decompress the whole file ahead of the reader, as long as there's a
+ * free chunk to decompress into. */
+static void *
+decomp_thread (void *ptr_data)
+{
+  GDecomp *decomp = (GDecomp *) ptr_data;
+  GDecompChunk *chunk = NULL;
+  int ret = 0;
+
+  while (ret == 0) {
+    pthread_mutex_lock (&decomp->mutex);
+    while (decomp->count == GDECOMP_CHUNKS && !decomp->stop)
+      pthread_cond_wait (&decomp->cond, &decomp->mutex);
+    if (decomp->stop) {
+      pthread_mutex_unlock (&decomp->mutex);
+      break;
+    }
+    /* the reader never touches the chunk right after the filled ones */
+    chunk = &decomp->chunks[(decomp->head + decomp->count) % GDECOMP_CHUNKS];
+    pthread_mutex_unlock (&decomp->mutex);
+
+    ret = fill_chunk (decomp, chunk);
+
+    pthread_mutex_lock (&decomp->mutex);
+    if (chunk->len > 0)
+      decomp->count++;
+    if (ret == -1)
+      decomp->err = errno ? errno : EIO;
+    if (ret != 0)
+      decomp->done = 1;
+    pthread_cond_broadcast (&decomp->cond);
+    pthread_mutex_unlock (&decomp->mutex);
+  }
+
+  return NULL;
+}
+
+/* Start decompressing the given file from its current offset, in the
+ * given format, through a new thread.
+ *
+ * On error, NULL is returned and errno is set to ENOTSUP if the format
+ * is not supported by this build.
+ * On success, the newly allocated GDecomp is returned. */
+GDecomp *
+new_gdecomp (int fd, GCodec codec)
+{
+  GDecomp *decomp = NULL;
+
+  if (!gdecomp_supported (codec)) {
+    errno = ENOTSUP;
+    return NULL;
+  }
+
+  decomp = xcalloc (1, sizeof (GDecomp));
+  decomp->fd = fd;
+  decomp->codec = codec;
+  decomp->in = xmalloc (GDECOMP_IN_SIZE);
+  if (codec_init (decomp)) {
+    codec_end (decomp);
+    free (decomp->in);
+    free (decomp);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  pthread_mutex_init (&decomp->mutex, NULL);
+  pthread_cond_init (&decomp->cond, NULL);
+  if (pthread_create (&decomp->thread, NULL, decomp_thread, decomp) != 0) {
+    pthread_mutex_destroy (&decomp->mutex);
+    pthread_cond_destroy (&decomp->cond);
+    codec_end (decomp);
+    free (decomp->in);
+    free (decomp);
+    errno = EAGAIN;
+    return NULL;
+  }
+
+  return decomp;
+}
+
+/* Read up to len bytes of decompressed data, blocking until some data
+ * is decompressed.
+ *
+ * On error, -1 is returned and errno is set.
+ * On end of file, 0 is returned.
+ * On success, the num of bytes read is returned. */
+ssize_t
+gdecomp_read (GDecomp * decomp, char *buf, size_t len)
+{
+  GDecompChunk *chunk = NULL;
+  size_t n = 0;
+
+  pthread_mutex_lock (&decomp->mutex);
+  while (decomp->count == 0 && !decomp->done)
+    pthread_cond_wait (&decomp->cond, &decomp->mutex);
+  if (decomp->count == 0) {
+    pthread_mutex_unlock (&decomp->mutex);
+    if (decomp->err) {
+      errno = decomp->err;
+      return -1;
+    }
+    return 0;
+  }
+  chunk = &decomp->chunks[decomp->head];
+  pthread_mutex_unlock (&decomp->mutex);
+
+  n = chunk->len - decomp->pos;
+  if (n > len)
+    n = len;
+  memcpy (buf, chunk->data + decomp->pos, n);
+  decomp->pos += n;
+
+  /* hand the chunk back to the decompressing thread */
+  if (decomp->pos == chunk->len) {
+    pthread_mutex_lock (&decomp->mutex);
+    decomp->head = (decomp->head + 1) % GDECOMP_CHUNKS;
+    decomp->count--;
+    decomp->pos = 0;
+    pthread_cond_broadcast (&decomp->cond);
+    pthread_mutex_unlock (&decomp->mutex);
+  }
+
+  return n;
+}
+
+/* Get the error that stopped the decompression, if any.
+ *
+ * If no error occurred so far, 0 is returned.
+ * Otherwise the errno of the error is returned. */
+int
+gdecomp_error (GDecomp * decomp)
+{
+  int err = 0;
+
+  pthread_mutex_lock (&decomp->mutex);
+  err = decomp->err;
+  pthread_mutex_unlock (&decomp->mutex);
+
+  return err;
+}
+
+/* Stop the decompressing thread and free the decompressor. The file
+ * descriptor is left open. */
+void
+free_gdecomp (GDecomp * decomp)
+{
+  int i;
+
+  if (decomp == NULL)
+    return;
+
+  pthread_mutex_lock (&decomp->mutex);
+  decomp->stop = 1;
+  pthread_cond_broadcast (&decomp->cond);
+  pthread_mutex_unlock (&decomp->mutex);
+  pthread_join (decomp->thread, NULL);
+
+  pthread_mutex_destroy (&decomp->mutex);
+  pthread_cond_destroy (&decomp->cond);
+  codec_end (decomp);
+  for (i = 0; i < GDECOMP_CHUNKS; ++i)
+    free (decomp->chunks[i].data);
+  free (decomp->in);
+  free (decomp);
+}
@@ -0,0 +1,94 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GDECOMP_H_INCLUDED
+#define GDECOMP_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define GDECOMP_IN_SIZE    (128 * 1024) /* compressed bytes read at once */
+#define GDECOMP_CHUNK_SIZE (256 * 1024) /* size of a decompressed chunk */
+#define GDECOMP_CHUNKS     4    /* chunks decompressed ahead of the reader */
+
+/* Compression formats recognized out of the first bytes of a log */
+typedef enum GCodec_
+{
+  GCODEC_NONE,
+  GCODEC_GZIP,
+  GCODEC_BZIP2,
+  GCODEC_ZSTD,
+} GCodec;
+
+/* A chunk of decompressed data */
+typedef struct GDecompChunk_
+{
+  char *data;
+  size_t len;
+} GDecompChunk;
+
+/* A compressed log decompressed by its own thread into a ring of chunks,
+ * ahead of the thread reading it */
+typedef struct GDecomp_
+{
+  int fd;                       /* compressed file */
+  GCodec codec;
+  void *state;                  /* stream state of the codec */
+  int members;                  /* num of streams fully decompressed */
+  int in_stream;                /* a stream was started but not ended */
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;          /* signaled as chunks are filled/released */
+
+  GDecompChunk chunks[GDECOMP_CHUNKS];
+  int head;                     /* current chunk of the reader */
+  int count;                    /* num of filled chunks */
+  size_t pos;                   /* offset within the current chunk */
+  int done;                     /* all the data was decompressed */
+  int err;                      /* errno of a failed decompression */
+  int stop;                     /* the reader is gone */
+
+  /* compressed input, only accessed by the decompressing thread */
+  char *in;
+  size_t in_len;
+  size_t in_pos;
+  int in_eof;
+} GDecomp;
+
+GCodec gdecomp_detect (int fd);
+GDecomp *new_gdecomp (int fd, GCodec codec);
+const char *gdecomp_name (GCodec codec);
+int gdecomp_error (GDecomp * decomp);
+int gdecomp_supported (GCodec codec);
+ssize_t gdecomp_read (GDecomp * decomp, char *buf, size_t len);
+void free_gdecomp (GDecomp * decomp);
+
+#endif // for #ifndef GDECOMP_H
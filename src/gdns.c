@@ -52,6 +52,11 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_LIBCARES
+#include <ares.h>
+#include <sys/select.h>
+#endif
+
 #include "gdns.h"
 
 #ifdef HAVE_LIBTOKYOCABINET
@@ -62,113 +67,115 @@
 
 #include "error.h"
 #include "goaccess.h"
+#include "khash.h"
+#include "settings.h"
 #include "util.h"
 #include "xmalloc.h"
 
+/* IPs queued, being resolved (0), or that failed to resolve and are
+ * not retried before the given time */
+KHASH_MAP_INIT_STR (pending, time_t)
+
 GDnsThread gdns_thread;
 static GDnsQueue *gdns_queue;
+static khash_t (pending) * gdns_pending = NULL;
 
 /* Initialize the queue. */
 void
-gqueue_init (GDnsQueue * q, int capacity)
-{
-  q->head = 0;
-  q->tail = -1;
-  q->size = 0;
-  q->capacity = capacity;
-}
-
-/* Get the current size of queue.
- *
- * Returns the size of the queue. */
-int
-gqueue_size (GDnsQueue * q)
-{
-  return q->size;
-}
-
-/* Determine if the queue is empty.
- *
- * Returns true if empty, otherwise false. */
-int
-gqueue_empty (GDnsQueue * q)
-{
-  return q->size == 0;
-}
-
-/* Determine if the queue is full.
- *
- * Returns true if full, otherwise false. */
-int
-gqueue_full (GDnsQueue * q)
+gqueue_init (GDnsQueue * q)
 {
-  return q->size == q->capacity;
-}
+  size_t i;
 
-/* Free the queue. */
-void
-gqueue_destroy (GDnsQueue * q)
-{
-  free (q);
+  for (i = 0; i < QUEUE_SIZE; ++i) {
+    q->buffer[i].seq = i;
+    q->buffer[i].data = NULL;
+  }
+  q->head = 0;
+  q->tail = 0;
 }
 
-/* Add at the end of the queue a string item.
+/* Add at the end of the queue a string item. This may be called by
+ * multiple threads without holding a lock.
  *
  * If the queue is full, -1 is returned.
  * If added to the queue, 0 is returned. */
 int
 gqueue_enqueue (GDnsQueue * q, char *item)
 {
-  if (gqueue_full (q))
-    return -1;
-
-  q->tail = (q->tail + 1) % q->capacity;
-  strcpy (q->buffer[q->tail], item);
-  q->size++;
-  return 0;
-}
+  GDnsCell *cell = NULL;
+  size_t pos, seq;
+  intptr_t diff;
+
+  pos = __atomic_load_n (&q->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &q->buffer[pos & (QUEUE_SIZE - 1)];
+    seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+    diff = (intptr_t) seq - (intptr_t) pos;
+    /* slot is free, try to claim it */
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n (&q->tail, &pos, pos + 1, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    /* slot hasn't been consumed yet */
+    else if (diff < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n (&q->tail, __ATOMIC_RELAXED);
+    }
+  }
 
-/* Find a string item in the queue.
- *
- * If the queue is empty, or the item is not in the queue, 0 is returned.
- * If found, 1 is returned. */
-int
-gqueue_find (GDnsQueue * q, const char *item)
-{
-  int i;
-  if (gqueue_empty (q))
-    return 0;
+  cell->data = item;
+  __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
 
-  for (i = 0; i < q->size; i++) {
-    if (strcmp (item, q->buffer[i]) == 0)
-      return 1;
-  }
   return 0;
 }
 
-/* Remove a string item from the head of the queue.
+/* Remove a string item from the head of the queue. This may be called
+ * by multiple threads without holding a lock.
  *
  * If the queue is empty, NULL is returned.
  * If removed, the string item is returned. */
 char *
 gqueue_dequeue (GDnsQueue * q)
 {
-  char *item;
-  if (gqueue_empty (q))
-    return NULL;
+  GDnsCell *cell = NULL;
+  size_t pos, seq;
+  intptr_t diff;
+  char *item = NULL;
+
+  pos = __atomic_load_n (&q->head, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &q->buffer[pos & (QUEUE_SIZE - 1)];
+    seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+    diff = (intptr_t) seq - (intptr_t) (pos + 1);
+    /* slot has been written, try to claim it */
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n (&q->head, &pos, pos + 1, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    /* slot hasn't been written yet */
+    else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = __atomic_load_n (&q->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  item = cell->data;
+  __atomic_store_n (&cell->seq, pos + QUEUE_SIZE, __ATOMIC_RELEASE);
 
-  item = q->buffer[q->head];
-  q->head = (q->head + 1) % q->capacity;
-  q->size--;
   return item;
 }
 
 /* Get the corresponding hostname given an IP address.
  *
- * On error, a string error message is returned.
+ * On error, a string error message is returned and again is set if
+ * the lookup may succeed later on.
  * On success, a malloc'd hostname is returned. */
 static char *
-reverse_host (const struct sockaddr *a, socklen_t length)
+reverse_host (const struct sockaddr *a, socklen_t length, int *again)
 {
   char h[H_SIZE];
   int flags, st;
@@ -177,6 +184,7 @@ reverse_host (const struct sockaddr *a, socklen_t length)
   st = getnameinfo (a, length, h, H_SIZE, NULL, 0, flags);
   if (!st)
     return alloc_string (h);
+  *again = st == EAI_AGAIN;
   return alloc_string (gai_strerror (st));
 }
 
@@ -184,8 +192,8 @@ reverse_host (const struct sockaddr *a, socklen_t length)
  *
  * On error, NULL is returned.
  * On success, a malloc'd hostname is returned. */
-char *
-reverse_ip (char *str)
+static char *
+resolve_ip (const char *str, int *again)
 {
   union
   {
@@ -194,103 +202,388 @@ reverse_ip (char *str)
     struct sockaddr_in addr4;
   } a;
 
+  *again = 0;
   if (str == NULL || *str == '\0')
     return NULL;
 
   memset (&a, 0, sizeof (a));
   if (1 == inet_pton (AF_INET, str, &a.addr4.sin_addr)) {
     a.addr4.sin_family = AF_INET;
-    return reverse_host (&a.addr, sizeof (a.addr4));
+    return reverse_host (&a.addr, sizeof (a.addr4), again);
   } else if (1 == inet_pton (AF_INET6, str, &a.addr6.sin6_addr)) {
     a.addr6.sin6_family = AF_INET6;
-    return reverse_host (&a.addr, sizeof (a.addr6));
+    return reverse_host (&a.addr, sizeof (a.addr6), again);
   }
   return NULL;
 }
 
+/* Determine if IPv4 or IPv6 and resolve.
+ *
+ * On error, NULL is returned.
+ * On success, a malloc'd hostname is returned. */
+char *
+reverse_ip (char *str)
+{
+  int again = 0;
+  return resolve_ip (str, &again);
+}
+
+/* Get the resolved hostname of the given IP address.
+ *
+ * If not resolved yet, NULL is returned.
+ * On success, a malloc'd hostname is returned. */
+char *
+gdns_get_hostname (const char *ip)
+{
+  char *hostname = NULL;
+
+  pthread_mutex_lock (&gdns_thread.hmutex);
+  hostname = ht_get_hostname (ip);
+  pthread_mutex_unlock (&gdns_thread.hmutex);
+
+  return hostname;
+}
+
+/* Wake up a resolver if any of them is waiting for an item. */
+static void
+wake_resolver (void)
+{
+  /* pairs with the fence in wait_for_item () */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&gdns_thread.idle, __ATOMIC_RELAXED) == 0)
+    return;
+
+  pthread_mutex_lock (&gdns_thread.qmutex);
+  pthread_cond_signal (&gdns_thread.not_empty);
+  pthread_mutex_unlock (&gdns_thread.qmutex);
+}
+
 /* Producer - Resolve an IP address and add it to the queue. */
 void
 dns_resolver (char *addr)
 {
-  pthread_mutex_lock (&gdns_thread.mutex);
-  /* queue is not full and the IP address is not in the queue */
-  if (!gqueue_full (gdns_queue) && !gqueue_find (gdns_queue, addr)) {
-    /* add the IP to the queue */
-    gqueue_enqueue (gdns_queue, addr);
-    pthread_cond_broadcast (&gdns_thread.not_empty);
+  char *ip = NULL;
+  khint_t k;
+  int ret = 0, queued = 0;
+
+  pthread_mutex_lock (&gdns_thread.hmutex);
+  if (gdns_pending == NULL)
+    goto out;
+
+  k = kh_get (pending, gdns_pending, addr);
+  /* new IP address, the pending map owns its key */
+  if (k == kh_end (gdns_pending)) {
+    ip = xstrdup (addr);
+    k = kh_put (pending, gdns_pending, ip, &ret);
+    if (ret == -1) {
+      free (ip);
+      goto out;
+    }
+  }
+  /* already queued, being resolved, or failed recently */
+  else if (kh_val (gdns_pending, k) == 0 ||
+           kh_val (gdns_pending, k) > time (NULL)) {
+    goto out;
+  }
+
+  kh_val (gdns_pending, k) = 0;
+  /* queue is full, will be requested again on the next refresh */
+  if (gqueue_enqueue (gdns_queue, (char *) kh_key (gdns_pending, k)) == -1) {
+    ip = (char *) kh_key (gdns_pending, k);
+    kh_del (pending, gdns_pending, k);
+    free (ip);
+  } else {
+    queued = 1;
+  }
+
+out:
+  pthread_mutex_unlock (&gdns_thread.hmutex);
+
+  if (queued)
+    wake_resolver ();
+}
+
+/* Wait until an item has been added to the queue, or until the
+ * resolvers are stopped.
+ *
+ * If the resolvers are stopped, NULL is returned.
+ * On success, the dequeued item is returned. */
+static char *
+wait_for_item (void)
+{
+  char *ip = NULL;
+
+  while ((ip = gqueue_dequeue (gdns_queue)) == NULL) {
+    pthread_mutex_lock (&gdns_thread.qmutex);
+    if (!active_gdns) {
+      pthread_mutex_unlock (&gdns_thread.qmutex);
+      return NULL;
+    }
+    __atomic_add_fetch (&gdns_thread.idle, 1, __ATOMIC_RELAXED);
+    /* pairs with the fence in wake_resolver () */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if ((ip = gqueue_dequeue (gdns_queue)) == NULL)
+      pthread_cond_wait (&gdns_thread.not_empty, &gdns_thread.qmutex);
+    __atomic_sub_fetch (&gdns_thread.idle, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&gdns_thread.qmutex);
+
+    if (ip != NULL)
+      break;
   }
-  pthread_mutex_unlock (&gdns_thread.mutex);
+
+  return ip;
 }
 
-/* Consumer - Once an IP has been resolved, add it to dwithe hostnames
- * hash structure. */
+/* Add the resolved IP -> hostname map. If the lookup failed and may
+ * succeed later on, i.e., host is NULL, don't retry it until
+ * DNS_NEG_TTL seconds have passed. */
 static void
-dns_worker (void GO_UNUSED (*ptr_data))
+publish_host (char *ip, const char *host)
 {
-  char *ip = NULL, *host = NULL;
+  khint_t k;
+
+  pthread_mutex_lock (&gdns_thread.hmutex);
+  /* storage may be gone already */
+  if (!active_gdns) {
+    pthread_mutex_unlock (&gdns_thread.hmutex);
+    free (ip);
+    return;
+  }
+
+  k = kh_get (pending, gdns_pending, ip);
+  if (host == NULL && k != kh_end (gdns_pending)) {
+    kh_val (gdns_pending, k) = time (NULL) + DNS_NEG_TTL;
+    pthread_mutex_unlock (&gdns_thread.hmutex);
+    return;
+  }
 
-  while (1) {
-    pthread_mutex_lock (&gdns_thread.mutex);
-    /* wait until an item has been added to the queue */
-    while (gqueue_empty (gdns_queue))
-      pthread_cond_wait (&gdns_thread.not_empty, &gdns_thread.mutex);
+  /* insert the corresponding IP -> hostname map */
+  if (host != NULL) {
+    ht_insert_hostname (ip, host);
+    set_module_dirty (HOSTS);
+  }
+  if (k != kh_end (gdns_pending))
+    kh_del (pending, gdns_pending, k);
+  pthread_mutex_unlock (&gdns_thread.hmutex);
 
-    ip = gqueue_dequeue (gdns_queue);
+  free (ip);
+}
 
-    pthread_mutex_unlock (&gdns_thread.mutex);
-    host = reverse_ip (ip);
-    pthread_mutex_lock (&gdns_thread.mutex);
+#ifdef HAVE_LIBCARES
+/* Called by c-ares once a query has completed or failed. */
+static void
+dns_callback (void *arg, int status, int GO_UNUSED (timeouts),
+              struct hostent *hostent)
+{
+  GDnsQuery *query = arg;
+
+  switch (status) {
+  case ARES_SUCCESS:
+    publish_host (query->ip, hostent->h_name);
+    break;
+    /* transient errors, retry later on */
+  case ARES_ETIMEOUT:
+  case ARES_ESERVFAIL:
+  case ARES_ECONNREFUSED:
+  case ARES_EREFUSED:
+    publish_host (query->ip, NULL);
+    break;
+    /* channel destroyed, resolvers are stopped */
+  case ARES_EDESTRUCTION:
+  case ARES_ECANCELLED:
+    free (query->ip);
+    break;
+  default:
+    publish_host (query->ip, ares_strerror (status));
+  }
 
-    if (!active_gdns) {
-      if (host)
-        free (host);
-      break;
-    }
+  (*query->inflight)--;
+  free (query);
+}
+
+/* Send a PTR query for the given IP address. */
+static void
+send_ptr_query (ares_channel channel, char *ip, int *inflight)
+{
+  GDnsQuery *query = NULL;
+  struct in6_addr addr6;
+  struct in_addr addr4;
+
+  /* not an IP address */
+  if (1 != inet_pton (AF_INET, ip, &addr4) &&
+      1 != inet_pton (AF_INET6, ip, &addr6)) {
+    publish_host (ip, NULL);
+    return;
+  }
+
+  query = xmalloc (sizeof (GDnsQuery));
+  query->ip = ip;
+  query->inflight = inflight;
+  (*inflight)++;
+
+  if (1 == inet_pton (AF_INET, ip, &addr4))
+    ares_gethostbyaddr (channel, &addr4, sizeof (addr4), AF_INET,
+                        dns_callback, query);
+  else
+    ares_gethostbyaddr (channel, &addr6, sizeof (addr6), AF_INET6,
+                        dns_callback, query);
+}
+
+/* Wait for any of the in-flight queries to make progress, at most
+ * for DNS_POLL_MS so new items are picked up from the queue. */
+static void
+process_queries (ares_channel channel)
+{
+  struct timeval tv, maxtv, *tvp;
+  fd_set readers, writers;
+  int nfds;
+
+  FD_ZERO (&readers);
+  FD_ZERO (&writers);
+  nfds = ares_fds (channel, &readers, &writers);
+
+  maxtv.tv_sec = 0;
+  maxtv.tv_usec = DNS_POLL_MS * 1000;
+  tvp = ares_timeout (channel, &maxtv, &tv);
+
+  if (select (nfds, &readers, &writers, NULL, tvp) == -1 && errno != EINTR)
+    return;
+  ares_process (channel, &readers, &writers);
+}
 
-    /* insert the corresponding IP -> hostname map */
-    if (host != NULL && active_gdns) {
-      ht_insert_hostname (ip, host);
-      free (host);
+/* Consumer - Keep up to DNS_MAX_INFLIGHT PTR queries in flight and
+ * add the resolved IPs to the hostnames hash structure. Multiple
+ * resolvers may run at once, each with its own channel. */
+static void
+dns_worker (void GO_UNUSED (*ptr_data))
+{
+  struct ares_options opts;
+  ares_channel channel;
+  char *ip = NULL;
+  int inflight = 0, st;
+
+  memset (&opts, 0, sizeof (opts));
+  opts.timeout = DNS_TIMEOUT_MS;
+  opts.tries = DNS_TRIES;
+  if ((st = ares_init_options (&channel, &opts,
+                               ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES))) {
+    LOG_DEBUG (("Unable to init c-ares channel: %s\n", ares_strerror (st)));
+    return;
+  }
+
+  while (__atomic_load_n (&active_gdns, __ATOMIC_RELAXED)) {
+    /* nothing in flight, block until there's something to resolve */
+    if (inflight == 0) {
+      if ((ip = wait_for_item ()) == NULL)
+        break;
+      send_ptr_query (channel, ip, &inflight);
     }
 
-    pthread_cond_signal (&gdns_thread.not_full);
-    pthread_mutex_unlock (&gdns_thread.mutex);
+    while (inflight < DNS_MAX_INFLIGHT &&
+           (ip = gqueue_dequeue (gdns_queue)) != NULL)
+      send_ptr_query (channel, ip, &inflight);
+
+    if (inflight)
+      process_queries (channel);
+  }
+
+  ares_destroy (channel);
+}
+#else
+/* Consumer - Once an IP has been resolved, add it to the hostnames
+ * hash structure. Multiple resolvers may run at once. */
+static void
+dns_worker (void GO_UNUSED (*ptr_data))
+{
+  char *ip = NULL, *host = NULL;
+  int again = 0;
+
+  while ((ip = wait_for_item ()) != NULL) {
+    host = resolve_ip (ip, &again);
+    publish_host (ip, again ? NULL : host);
+    free (host);
   }
 }
+#endif
 
 /* Initialize queue and dns thread */
 void
 gdns_init (void)
 {
   gdns_queue = xmalloc (sizeof (GDnsQueue));
-  gqueue_init (gdns_queue, QUEUE_SIZE);
+  gqueue_init (gdns_queue);
+  gdns_pending = kh_init (pending);
 
-  if (pthread_cond_init (&(gdns_thread.not_empty), NULL))
-    FATAL ("Failed init thread condition");
+#ifdef HAVE_LIBCARES
+  if (ares_library_init (ARES_LIB_INIT_ALL))
+    FATAL ("Failed init c-ares library");
+#endif
 
-  if (pthread_cond_init (&(gdns_thread.not_full), NULL))
+  if (pthread_cond_init (&(gdns_thread.not_empty), NULL))
     FATAL ("Failed init thread condition");
 
   if (pthread_mutex_init (&(gdns_thread.mutex), NULL))
     FATAL ("Failed init thread mutex");
+
+  if (pthread_mutex_init (&(gdns_thread.qmutex), NULL))
+    FATAL ("Failed init thread mutex");
+
+  if (pthread_mutex_init (&(gdns_thread.hmutex), NULL))
+    FATAL ("Failed init thread mutex");
 }
 
-/* Destroy (free) queue */
+/* Stop the resolvers and free whatever is left in the queue. Note that
+ * resolvers that are busy resolving an IP exit on their own, so the
+ * queue itself is kept around. */
 void
 gdns_free_queue (void)
 {
-  gqueue_destroy (gdns_queue);
+  char *ip = NULL;
+  khint_t k;
+
+  if (gdns_queue == NULL)
+    return;
+
+  pthread_mutex_lock (&gdns_thread.qmutex);
+  pthread_mutex_lock (&gdns_thread.hmutex);
+  /* kill dns pthreads */
+  __atomic_store_n (&active_gdns, 0, __ATOMIC_RELAXED);
+  pthread_cond_broadcast (&gdns_thread.not_empty);
+
+  /* IPs being resolved are freed by their resolver */
+  while ((ip = gqueue_dequeue (gdns_queue)) != NULL)
+    free (ip);
+  if (gdns_pending) {
+    /* IPs that failed to resolve */
+    for (k = kh_begin (gdns_pending); k != kh_end (gdns_pending); ++k) {
+      if (kh_exist (gdns_pending, k) && kh_val (gdns_pending, k) != 0)
+        free ((char *) kh_key (gdns_pending, k));
+    }
+    kh_destroy (pending, gdns_pending);
+    gdns_pending = NULL;
+  }
+  pthread_mutex_unlock (&gdns_thread.hmutex);
+  pthread_mutex_unlock (&gdns_thread.qmutex);
+
+  free (gdns_thread.threads);
+  gdns_thread.threads = NULL;
 }
 
-/* Create a DNS thread and make it active */
+/* Create the pool of DNS threads and make it active */
 void
 gdns_thread_create (void)
 {
-  int th;
+  int th, i;
+
+  gdns_thread.nthreads = conf.resolver_threads < 1 ? 1 : conf.resolver_threads;
+  gdns_thread.threads = xcalloc (gdns_thread.nthreads, sizeof (pthread_t));
 
   active_gdns = 1;
-  th = pthread_create (&(gdns_thread.thread), NULL, (void *) &dns_worker, NULL);
-  if (th)
-    FATAL ("Return code from pthread_create(): %d", th);
-  pthread_detach (gdns_thread.thread);
+  for (i = 0; i < gdns_thread.nthreads; ++i) {
+    th = pthread_create (&gdns_thread.threads[i], NULL, (void *) &dns_worker,
+                         NULL);
+    if (th)
+      FATAL ("Return code from pthread_create(): %d", th);
+    pthread_detach (gdns_thread.threads[i]);
+  }
 }
@@ -31,40 +31,57 @@
 #define GDNS_H_INCLUDED
 
 #define H_SIZE     1025
-#define QUEUE_SIZE 400
+#define QUEUE_SIZE 4096         /* must be a power of two */
+
+#define DNS_NEG_TTL      300    /* secs before retrying a failed lookup */
+#define DNS_TIMEOUT_MS   3000   /* timeout of a single PTR query */
+#define DNS_TRIES        2      /* attempts per PTR query */
+#define DNS_MAX_INFLIGHT 256    /* PTR queries in flight per resolver */
+#define DNS_POLL_MS      100    /* max wait for in-flight queries */
 
 typedef struct GDnsThread_
 {
   pthread_cond_t not_empty;     /* not empty queue condition */
-  pthread_cond_t not_full;      /* not full queue condition */
-  pthread_mutex_t mutex;
-  pthread_t thread;
+  pthread_mutex_t mutex;        /* guards the storage and the holder */
+  pthread_mutex_t qmutex;       /* guards not_empty and idle */
+  pthread_mutex_t hmutex;       /* guards resolved and in-flight hosts */
+  pthread_t *threads;           /* pool of resolver threads */
+  int nthreads;
+  int idle;                     /* resolvers waiting for an item */
 } GDnsThread;
 
+/* A PTR query in flight, see --with-cares */
+typedef struct GDnsQuery_
+{
+  char *ip;
+  int *inflight;                /* queries in flight of its resolver */
+} GDnsQuery;
+
+/* A slot of the queue, seq tells whether it can be read or written */
+typedef struct GDnsCell_
+{
+  size_t seq;
+  char *data;
+} GDnsCell;
+
+/* Bounded, lock-free, multi-producer multi-consumer queue */
 typedef struct GDnsQueue_
 {
-  int head;                     /* index to head of queue */
-  int tail;                     /* index to tail of queue */
-  int size;                     /* queue size */
-  int capacity;                 /* length at most */
-  char buffer[QUEUE_SIZE][H_SIZE];      /* data item */
+  GDnsCell buffer[QUEUE_SIZE];  /* data items */
+  size_t head;                  /* next position to dequeue */
+  size_t tail;                  /* next position to enqueue */
 } GDnsQueue;
 
 extern GDnsThread gdns_thread;
 
+char *gdns_get_hostname (const char *ip);
 char *gqueue_dequeue (GDnsQueue * q);
 char *reverse_ip (char *str);
-int gqueue_empty (GDnsQueue * q);
 int gqueue_enqueue (GDnsQueue * q, char *item);
-int gqueue_find (GDnsQueue * q, const char *item);
-int gqueue_full (GDnsQueue * q);
-int gqueue_size (GDnsQueue * q);
 void dns_resolver (char *addr);
 void gdns_free_queue (void);
 void gdns_init (void);
-void gdns_queue_free (void);
 void gdns_thread_create (void);
-void gqueue_destroy (GDnsQueue * q);
-void gqueue_init (GDnsQueue * q, int capacity);
+void gqueue_init (GDnsQueue * q);
 
 #endif
@@ -0,0 +1,166 @@
+/**
+ * geocache.c -- Cache of geolocation lookups per IP address
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geocache.h"
+
+#include "khash.h"
+#include "xmalloc.h"
+
+/* IPv4 or IPv6 address in binary form. IPv4 addresses are stored as
+ * IPv4-mapped IPv6 addresses, i.e., ::ffff:a.b.c.d */
+typedef struct GGeoKey_
+{
+  uint64_t hi;
+  uint64_t lo;
+} GGeoKey;
+
+#define kh_geo_hash_func(key) kh_int64_hash_func((key).lo ^ (key).hi)
+#define kh_geo_hash_equal(a, b) ((a).lo == (b).lo && (a).hi == (b).hi)
+/* binary IP keys, geolocation payload */
+KHASH_INIT (geo, GGeoKey, GGeoCacheItem *, 1, kh_geo_hash_func,
+            kh_geo_hash_equal);
+
+static khash_t (geo) * geo_cache = NULL;
+/* guards the cache and the GeoIP lookups, neither are thread-safe */
+static pthread_mutex_t geo_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free all the cached lookups. */
+void
+free_geo_cache (void)
+{
+  khint_t k;
+
+  pthread_mutex_lock (&geo_mutex);
+  if (geo_cache) {
+    for (k = 0; k < kh_end (geo_cache); ++k) {
+      if (kh_exist (geo_cache, k))
+        free (kh_val (geo_cache, k));
+    }
+    kh_destroy (geo, geo_cache);
+    geo_cache = NULL;
+  }
+  pthread_mutex_unlock (&geo_mutex);
+}
+
+/* Pack the given IPv4 or IPv6 address into its binary form.
+ *
+ * On error, 1 is returned.
+ * On success, the key is set and 0 is returned. */
+static int
+pack_ip (const char *host, GGeoKey * key)
+{
+  unsigned char buf[sizeof (struct in6_addr)];
+
+  memset (buf, 0, sizeof (buf));
+  if (inet_pton (AF_INET, host, buf + 12) == 1) {
+    buf[10] = buf[11] = 0xff;
+  } else if (inet_pton (AF_INET6, host, buf) != 1) {
+    return 1;
+  }
+
+  memcpy (&key->hi, buf, sizeof (uint64_t));
+  memcpy (&key->lo, buf + 8, sizeof (uint64_t));
+
+  return 0;
+}
+
+/* Copy a cached lookup into the given buffers. */
+static int
+copy_geo_item (const GGeoCacheItem * item, char *continent, char *country,
+               char *city)
+{
+  memcpy (continent, item->continent, CONTINENT_LEN);
+  memcpy (country, item->country, COUNTRY_LEN);
+  memcpy (city, item->city, CITY_LEN);
+
+  return item->ret;
+}
+
+/* Entry point to set GeoIP location into the corresponding buffers,
+ * (continent, country, city). Lookups are cached per IP address so a
+ * returning visitor costs a single lookup. This may be called from
+ * multiple parsing threads.
+ *
+ * On error, 1 is returned
+ * On success, buffers are set and 0 is returned */
+int
+set_geolocation (char *host, char *continent, char *country, char *city)
+{
+  GGeoCacheItem *item = NULL;
+  GGeoKey key;
+  khint_t k;
+  int ret = 0, absent = 0;
+
+  if (!is_geoip_resource ())
+    return 1;
+
+  pthread_mutex_lock (&geo_mutex);
+  /* not an IP, e.g., --no-ip-validation, just look it up */
+  if (pack_ip (host, &key)) {
+    ret = geoip_get_location (host, continent, country, city);
+    pthread_mutex_unlock (&geo_mutex);
+    return ret;
+  }
+
+  if (geo_cache == NULL)
+    geo_cache = kh_init (geo);
+
+  k = kh_get (geo, geo_cache, key);
+  if (k != kh_end (geo_cache)) {
+    ret = copy_geo_item (kh_val (geo_cache, k), continent, country, city);
+    pthread_mutex_unlock (&geo_mutex);
+    return ret;
+  }
+
+  item = xcalloc (1, sizeof (GGeoCacheItem));
+  item->ret = geoip_get_location (host, item->continent, item->country,
+                                  item->city);
+
+  ret = copy_geo_item (item, continent, country, city);
+
+  k = kh_put (geo, geo_cache, key, &absent);
+  if (absent == -1)
+    free (item);
+  else
+    kh_val (geo_cache, k) = item;
+  pthread_mutex_unlock (&geo_mutex);
+
+  return ret;
+}
@@ -414,13 +414,15 @@ geoip_get_city (const char *ip, char *location, GTypeIP type_ip)
   }
 }
 
-/* Entry point to set GeoIP location into the corresponding buffers,
- * (continent, country, city).
+/* Look up the GeoIP location and set it into the corresponding buffers,
+ * (continent, country, city). Note that this is not cached, see
+ * set_geolocation() in geocache.c.
  *
  * On error, 1 is returned
  * On success, buffers are set and 0 is returned */
 int
-set_geolocation (char *host, char *continent, char *country, char *city)
+geoip_get_location (char *host, char *continent, char *country,
+                    char *city)
 {
   int type_ip = 0;
 
@@ -47,6 +47,8 @@ typedef struct GLocation_
   int hits;
 } GLocation;
 
+int geoip_get_location (char *host, char *continent, char *country,
+                        char *city);
 int is_geoip_resource (void);
 int set_geolocation (char *host, char *continent, char *country, char *city);
 void geoip_free (void);
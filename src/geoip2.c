@@ -274,13 +274,15 @@ geoip_get_continent (const char *ip, char *location, GO_UNUSED GTypeIP type_ip)
   geoip_query_continent (res, location);
 }
 
-/* Entry point to set GeoIP location into the corresponding buffers,
- * (continent, country, city).
+/* Look up the GeoIP location and set it into the corresponding buffers,
+ * (continent, country, city). Note that this is not cached, see
+ * set_geolocation() in geocache.c.
  *
  * On error, 1 is returned
  * On success, buffers are set and 0 is returned */
 int
-set_geolocation (char *host, char *continent, char *country, char *city)
+geoip_get_location (char *host, char *continent, char *country,
+                    char *city)
 {
   MMDB_lookup_result_s res;
 
@@ -0,0 +1,602 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "gfile.h"
+
+#include "error.h"
+#include "xmalloc.h"
+
+/* Allocate memory for a new reader instance.
+ *
+ * On success, the newly allocated GFile is returned. */
+static GFile *
+new_gfile (int fd, int owned)
+{
+  GFile *file = xcalloc (1, sizeof (GFile));
+  file->fd = fd;
+  file->owned = owned;
+
+  return file;
+}
+
+/* Attempt to memory-map the whole file into the reader.
+ *
+ * If unable to map it, 1 is returned.
+ * On success, 0 is returned. */
+static int
+map_file (GFile * file)
+{
+  struct stat st;
+  void *map = NULL;
+
+  if (fstat (file->fd, &st) == -1 || !S_ISREG (st.st_mode))
+    return 1;
+  /* empty or too large to be mapped */
+  if (st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX)
+    return 1;
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+  if (map == MAP_FAILED)
+    return 1;
+
+#ifdef MADV_SEQUENTIAL
+  madvise (map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  file->map = map;
+  file->map_len = st.st_size;
+
+  return 0;
+}
+
+/* Create a reader for the given file descriptor. The descriptor is left
+ * open when closing the reader, e.g., stdin.
+ *
+ * On success, the newly allocated GFile is returned. */
+GFile *
+gfile_fdopen (int fd)
+{
+  GFile *file = new_gfile (fd, 0);
+
+  if (map_file (file)) {
+    file->buf_size = GFILE_BUF_SIZE;
+    file->buf = xmalloc (file->buf_size);
+  }
+
+  return file;
+}
+
+/* Drain the file descriptor of the given ring as long as there's room
+ * left into it, waking up the reader as bytes are drained. */
+static void *
+ring_thread (void *ptr_data)
+{
+  GFileRing *ring = (GFileRing *) ptr_data;
+  struct pollfd pfd;
+  uint64_t head = 0, used = 0;
+  size_t off = 0, room = 0;
+  ssize_t bytes = 0;
+  int full = 0;
+
+  while (!__atomic_load_n (&ring->stop, __ATOMIC_ACQUIRE)) {
+    used = head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    /* let the reader catch up, data is left within the pipe meanwhile */
+    if (used == GFILE_RING_SIZE) {
+      ring->full += !full;
+      full = 1;
+      poll (NULL, 0, 1);
+      continue;
+    }
+    full = 0;
+
+    pfd.fd = ring->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll (&pfd, 1, GFILE_RING_WAIT) <= 0)
+      continue;
+
+    off = head & (GFILE_RING_SIZE - 1);
+    room = GFILE_RING_SIZE - off;
+    if (room > GFILE_RING_SIZE - used)
+      room = GFILE_RING_SIZE - used;
+    bytes = read (ring->fd, ring->data + off, room);
+    if (bytes == -1 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    if (bytes > 0) {
+      head += bytes;
+      if (used + bytes > ring->high_water)
+        ring->high_water = used + bytes;
+      __atomic_store_n (&ring->head, head, __ATOMIC_RELEASE);
+    } else {
+      ring->err = bytes == -1 ? errno : 0;
+      __atomic_store_n (&ring->done, 1, __ATOMIC_RELEASE);
+    }
+    /* if the notification pipe is full, it's readable anyway */
+    while (write (ring->notify[1], "x", 1) == -1 && errno == EINTR);
+
+    if (bytes <= 0)
+      break;
+  }
+  /* no more notifications, the reader gets a hang up */
+  close (ring->notify[1]);
+
+  return NULL;
+}
+
+/* Start draining the given file descriptor into a new ring, through a
+ * new thread.
+ *
+ * On error, NULL is returned.
+ * On success, the newly allocated GFileRing is returned. */
+static GFileRing *
+new_ring (int fd)
+{
+  GFileRing *ring = xcalloc (1, sizeof (GFileRing));
+  int flags = fcntl (fd, F_GETFL, 0);
+
+  if (pipe (ring->notify) == -1) {
+    free (ring);
+    return NULL;
+  }
+  fcntl (ring->notify[0], F_SETFL, O_NONBLOCK);
+  fcntl (ring->notify[1], F_SETFL, O_NONBLOCK);
+
+  ring->fd = fd;
+  ring->nonblock = flags != -1 && (flags & O_NONBLOCK);
+  ring->data = xmalloc (GFILE_RING_SIZE);
+  if (pthread_create (&ring->thread, NULL, ring_thread, ring) != 0) {
+    close (ring->notify[0]);
+    close (ring->notify[1]);
+    free (ring->data);
+    free (ring);
+    return NULL;
+  }
+
+  return ring;
+}
+
+/* Read up to len bytes drained into the given ring, blocking until some
+ * bytes are drained, unless the drained descriptor is non-blocking.
+ *
+ * On error, -1 is returned and errno is set, e.g., EAGAIN.
+ * On end of file, 0 is returned.
+ * On success, the num of bytes read is returned. */
+static ssize_t
+ring_read (GFileRing * ring, char *buf, size_t len)
+{
+  struct pollfd pfd;
+  uint64_t head = 0, tail = ring->tail;
+  size_t off = 0;
+  char wakeups[64];
+  int done = 0;
+
+  while ((head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)) == tail) {
+    /* consume the pending wake ups before checking for data again */
+    while (read (ring->notify[0], wakeups, sizeof (wakeups)) > 0);
+
+    done = __atomic_load_n (&ring->done, __ATOMIC_ACQUIRE);
+    if ((head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)) != tail)
+      break;
+    if (done && ring->err) {
+      errno = ring->err;
+      return -1;
+    }
+    if (done)
+      return 0;
+    if (ring->nonblock) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    pfd.fd = ring->notify[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll (&pfd, 1, -1);
+  }
+
+  off = tail & (GFILE_RING_SIZE - 1);
+  if (len > head - tail)
+    len = head - tail;
+  if (len > GFILE_RING_SIZE - off)
+    len = GFILE_RING_SIZE - off;
+  memcpy (buf, ring->data + off, len);
+  __atomic_store_n (&ring->tail, tail + len, __ATOMIC_RELEASE);
+
+  return len;
+}
+
+/* Stop draining into the given ring and free it. */
+static void
+free_ring (GFileRing * ring)
+{
+  if (ring == NULL)
+    return;
+
+  __atomic_store_n (&ring->stop, 1, __ATOMIC_RELEASE);
+  pthread_join (ring->thread, NULL);
+  LOG_DEBUG (("Pipe ring high-water mark: %llu bytes, full %llu times\n",
+              (unsigned long long) ring->high_water,
+              (unsigned long long) ring->full));
+
+  close (ring->notify[0]);
+  free (ring->data);
+  free (ring);
+}
+
+/* Create a reader for the given pipe, e.g., stdin, drained by a thread
+ * of its own into a large ring, ahead of the reader. The descriptor is
+ * left open when closing the reader. If it's a regular file, or the
+ * thread can't be started, it's read as gfile_fdopen() does.
+ *
+ * On success, the newly allocated GFile is returned. */
+GFile *
+gfile_drain (int fd)
+{
+  GFile *file = gfile_fdopen (fd);
+
+  if (!file->map)
+    file->ring = new_ring (fd);
+
+  return file;
+}
+
+/* Open the given file for reading, memory-mapped if map is set and
+ * it's a regular file. A file that may be truncated while it's read,
+ * e.g., a live log rotated by logrotate's copytruncate, should not be
+ * mapped, as touching the pages past its new end raises SIGBUS.
+ *
+ * On error, NULL is returned and errno is set.
+ * On success, the newly allocated GFile is returned. */
+GFile *
+gfile_open (const char *fn, int map)
+{
+  GFile *file = NULL;
+  GDecomp *decomp = NULL;
+  GCodec codec;
+  int fd, err;
+
+  if ((fd = open (fn, O_RDONLY)) == -1)
+    return NULL;
+
+  /* compressed logs are decompressed as they're read */
+  if ((codec = gdecomp_detect (fd)) != GCODEC_NONE) {
+    if ((decomp = new_gdecomp (fd, codec)) == NULL) {
+      err = errno;
+      close (fd);
+      errno = err;
+      return NULL;
+    }
+    file = new_gfile (fd, 1);
+    file->decomp = decomp;
+    file->buf_size = GFILE_BUF_SIZE;
+    file->buf = xmalloc (file->buf_size);
+    return file;
+  }
+
+  /* read(2) just hits the end of a truncated file */
+  if (!map) {
+    file = new_gfile (fd, 1);
+    file->buf_size = GFILE_BUF_SIZE;
+    file->buf = xmalloc (file->buf_size);
+    return file;
+  }
+
+  file = gfile_fdopen (fd);
+  file->owned = 1;
+
+  return file;
+}
+
+/* Determine if the given file is compressed.
+ *
+ * If not compressed or unable to open it, 0 is returned.
+ * If compressed, 1 is returned. */
+int
+gfile_compressed (const char *fn)
+{
+  GCodec codec;
+  int fd;
+
+  if ((fd = open (fn, O_RDONLY)) == -1)
+    return 0;
+  codec = gdecomp_detect (fd);
+  close (fd);
+
+  return codec != GCODEC_NONE;
+}
+
+/* Open the given file to follow it as it grows. The file is read through
+ * read(2), from its current end, and an incomplete last line is only
+ * returned once it is complete.
+ *
+ * On error, NULL is returned and errno is set.
+ * On success, the newly allocated GFile is returned. */
+GFile *
+gfile_follow (const char *fn)
+{
+  GFile *file = NULL;
+  off_t end;
+  int fd;
+
+  if ((fd = open (fn, O_RDONLY)) == -1)
+    return NULL;
+  if ((end = lseek (fd, 0, SEEK_END)) == (off_t) - 1) {
+    close (fd);
+    return NULL;
+  }
+
+  file = new_gfile (fd, 1);
+  file->follow = 1;
+  file->offset = file->mark = end;
+  file->buf_size = GFILE_BUF_SIZE;
+  file->buf = xmalloc (file->buf_size);
+
+  return file;
+}
+
+/* Copy the given chunk as the current line, nul-terminated. */
+static char *
+set_line (GFile * file, const char *data, size_t len)
+{
+  size_t size = file->line_size ? file->line_size : 1024;
+
+  if (len + 1 > file->line_size) {
+    while (size < len + 1)
+      size *= 2;
+    file->line = xrealloc (file->line, size);
+    file->line_size = size;
+  }
+  memcpy (file->line, data, len);
+  file->line[len] = '\0';
+
+  return file->line;
+}
+
+/* Get the next line from the mapped region. */
+static char *
+map_getline (GFile * file, size_t * len)
+{
+  const char *start = file->map + file->pos, *nl = NULL;
+  size_t avail = file->map_len - file->pos, n = 0;
+
+  if (avail == 0) {
+    errno = 0;
+    return NULL;
+  }
+
+  nl = memchr (start, '\n', avail);
+  n = nl ? (size_t) (nl - start) + 1 : avail;
+  file->pos += n;
+  file->offset += n;
+  if (nl)
+    file->mark = file->offset;
+  *len = n;
+
+  return set_line (file, start, n);
+}
+
+/* Get the next line from the read(2) buffer, reading more data from the
+ * file descriptor as needed. Note that an incomplete line is kept within
+ * the buffer if no more data is available to read, e.g., EAGAIN. */
+static char *
+buf_getline (GFile * file, size_t * len)
+{
+  const char *start = NULL, *nl = NULL;
+  size_t avail = 0, n = 0;
+  ssize_t bytes = 0;
+
+  while (1) {
+    start = file->buf + file->pos;
+    avail = file->buf_len - file->pos;
+    if ((nl = memchr (start, '\n', avail)) != NULL) {
+      n = (size_t) (nl - start) + 1;
+      break;
+    }
+
+    /* move the incomplete line to the beginning of the buffer */
+    if (file->pos > 0) {
+      memmove (file->buf, start, avail);
+      file->buf_len = avail;
+      file->pos = 0;
+    }
+    /* make room for lines larger than the buffer */
+    if (file->buf_len == file->buf_size) {
+      file->buf_size *= 2;
+      file->buf = xrealloc (file->buf, file->buf_size);
+    }
+
+    if (file->decomp)
+      bytes = gdecomp_read (file->decomp, file->buf + file->buf_len,
+                            file->buf_size - file->buf_len);
+    else if (file->ring)
+      bytes = ring_read (file->ring, file->buf + file->buf_len,
+                         file->buf_size - file->buf_len);
+    else
+      bytes = read (file->fd, file->buf + file->buf_len,
+                    file->buf_size - file->buf_len);
+    if (bytes > 0) {
+      file->buf_len += bytes;
+      continue;
+    }
+    if (bytes == -1 && errno == EINTR)
+      continue;
+    if (bytes == -1)
+      return NULL;
+
+    /* end of file, return whatever is left unless it may still grow */
+    if (file->buf_len == 0 || file->follow) {
+      errno = 0;
+      return NULL;
+    }
+    n = file->buf_len;
+    break;
+  }
+
+  start = file->buf + file->pos;
+  file->pos += n;
+  file->offset += n;
+  if (nl)
+    file->mark = file->offset;
+  *len = n;
+
+  return set_line (file, start, n);
+}
+
+/* Get the next line from the file, including its trailing newline, if
+ * any. The returned line is owned by the reader and it is valid until the
+ * next call.
+ *
+ * On error or end of file, NULL is returned. On error, errno is set.
+ * On success, the nul-terminated line is returned and its length is
+ * stored into len. */
+char *
+gfile_getline (GFile * file, size_t * len)
+{
+  size_t n = 0;
+
+  if (len == NULL)
+    len = &n;
+  if (file->map)
+    return map_getline (file, len);
+  return buf_getline (file, len);
+}
+
+/* Set the offset from where the next line will be read.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+int
+gfile_seek (GFile * file, uint64_t offset)
+{
+  if (file->map) {
+    if (offset > file->map_len)
+      return 1;
+    file->pos = offset;
+    file->offset = file->mark = offset;
+    return 0;
+  }
+
+  /* decompressed or drained data can't be seeked into */
+  if (file->decomp || file->ring ||
+      lseek (file->fd, (off_t) offset, SEEK_SET) == (off_t) - 1)
+    return 1;
+  file->pos = file->buf_len = 0;
+  file->offset = file->mark = offset;
+
+  return 0;
+}
+
+/* Get the file descriptor to poll for data to read from the file. For a
+ * drained pipe, it's readable as bytes are drained into its ring.
+ *
+ * On success, the file descriptor is returned. */
+int
+gfile_poll_fd (GFile * file)
+{
+  return file->ring ? file->ring->notify[0] : file->fd;
+}
+
+/* Wait up to timeout milliseconds for data to read from the file.
+ *
+ * If no data is available to read, 0 is returned.
+ * If data (or the end of file) is available to read, 1 is returned. */
+int
+gfile_wait (GFile * file, int timeout)
+{
+  struct pollfd pfd;
+
+  pfd.fd = gfile_poll_fd (file);
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll (&pfd, 1, timeout) > 0;
+}
+
+/* Hash (FNV-1a) up to len bytes of the file starting at the given
+ * offset, regardless of what has been read so far. Bytes beyond the end
+ * of the file are ignored.
+ *
+ * On success, the 32-bit hash is returned. */
+uint32_t
+gfile_hash (GFile * file, uint64_t offset, size_t len)
+{
+  unsigned char data[GFILE_HASH_LEN];
+  uint32_t hash = 2166136261U;
+  ssize_t bytes = 0, i;
+
+  if (len > sizeof (data))
+    len = sizeof (data);
+  if (file->map) {
+    if (offset > file->map_len)
+      return hash;
+    if (len > file->map_len - offset)
+      len = file->map_len - offset;
+    memcpy (data, file->map + offset, len);
+    bytes = len;
+  } else if ((bytes = pread (file->fd, data, len, (off_t) offset)) < 0) {
+    return hash;
+  }
+
+  for (i = 0; i < bytes; ++i) {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/* Unmap/free the reader and close its file descriptor if owned. */
+void
+gfile_close (GFile * file)
+{
+  if (file == NULL)
+    return;
+
+  if (file->map)
+    munmap (file->map, file->map_len);
+  free_gdecomp (file->decomp);
+  free_ring (file->ring);
+  if (file->owned)
+    close (file->fd);
+  free (file->buf);
+  free (file->line);
+  free (file);
+}
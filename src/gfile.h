@@ -0,0 +1,103 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GFILE_H_INCLUDED
+#define GFILE_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gdecomp.h"
+
+#define GFILE_BUF_SIZE  (256 * 1024)    /* initial size of the read buffer */
+#define GFILE_HASH_LEN  64      /* max num of bytes hashed by gfile_hash */
+#define GFILE_RING_SIZE (64 * 1024 * 1024)      /* pipe ring, power of two */
+#define GFILE_RING_WAIT 100     /* ms the draining thread polls at once */
+
+/* A large ring of bytes a pipe is drained into by a thread of its own,
+ * so the writer on the other end never stalls on a busy parser. It has
+ * a single producer and a single consumer, and it's lock-free. */
+typedef struct GFileRing_
+{
+  int fd;                       /* drained file descriptor */
+  int nonblock;                 /* reading it would not block */
+  char *data;                   /* GFILE_RING_SIZE bytes */
+  uint64_t head;                /* bytes drained, written by the thread */
+  uint64_t tail;                /* bytes consumed, written by the reader */
+  int done;                     /* end of file or error, see err */
+  int err;                      /* errno of a failed read */
+  int stop;                     /* the reader is gone */
+  int notify[2];                /* readable as bytes are drained */
+
+  uint64_t high_water;          /* max num of bytes ever buffered */
+  uint64_t full;                /* times the ring was full */
+
+  pthread_t thread;
+} GFileRing;
+
+/* Log file reader. Regular files are memory-mapped, anything else
+ * (pipes, FIFOs, etc) is read in large chunks through read(2), and
+ * compressed files through a decompressing thread. */
+typedef struct GFile_
+{
+  int fd;                       /* file descriptor */
+  int owned;                    /* close fd along the reader */
+  int follow;                   /* keep an incomplete last line at EOF */
+  GDecomp *decomp;              /* decompressor, if compressed */
+  GFileRing *ring;              /* drained into by a thread, if a pipe */
+
+  char *map;                    /* mapped region, if memory-mapped */
+  size_t map_len;               /* length of the mapped region */
+
+  char *buf;                    /* read(2) buffer, if not memory-mapped */
+  size_t buf_size;              /* allocated size of the read buffer */
+  size_t buf_len;               /* bytes within the read buffer */
+
+  size_t pos;                   /* offset of the next line */
+  uint64_t offset;              /* file offset of the next line */
+  uint64_t mark;                /* file offset past the last full line */
+
+  char *line;                   /* current line, nul-terminated */
+  size_t line_size;             /* allocated size of the current line */
+} GFile;
+
+GFile *gfile_drain (int fd);
+GFile *gfile_fdopen (int fd);
+GFile *gfile_open (const char *fn, int map);
+int gfile_compressed (const char *fn);
+GFile *gfile_follow (const char *fn);
+char *gfile_getline (GFile * file, size_t * len);
+int gfile_poll_fd (GFile * file);
+int gfile_seek (GFile * file, uint64_t offset);
+int gfile_wait (GFile * file, int timeout);
+uint32_t gfile_hash (GFile * file, uint64_t offset, size_t len);
+void gfile_close (GFile * file);
+
+#endif // for #ifndef GFILE_H
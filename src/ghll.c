@@ -0,0 +1,322 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ghll.h"
+
+#include "xmalloc.h"
+
+/* Get the term a register contributes to the sum of the registers,
+ * i.e., 2^-rank scaled by 2^HLL_SUM_BITS.
+ *
+ * On success, the term of the given rank is returned. */
+static uint64_t
+hll_term (uint8_t rank)
+{
+  return rank > HLL_SUM_BITS ? 0 : (uint64_t) 1 << (HLL_SUM_BITS - rank);
+}
+
+/* Get the rank of a hash, i.e., the position of the first set bit after
+ * the bits indexing the register. Only the upper bits of the hash are
+ * set, i.e., the rest are zeroed as on a sparse hash.
+ *
+ * On success, the rank of the given hash is returned. */
+static uint8_t
+hll_rank (uint64_t hash, int bits)
+{
+  uint64_t w = hash << HLL_PRECISION;
+  uint8_t rank = 1, max = bits - HLL_PRECISION + 1;
+
+  while (rank < max && !(w & ((uint64_t) 1 << 63))) {
+    w <<= 1;
+    rank++;
+  }
+
+  return rank;
+}
+
+/* Raise the given register to the given rank, keeping the sum of the
+ * registers and the num of unset registers up to date.
+ *
+ * If the register was not raised, 0 is returned.
+ * On success, 1 is returned. */
+static int
+set_register (GHLL * hll, uint32_t idx, uint8_t rank)
+{
+  uint8_t cur = hll->regs[idx];
+
+  if (rank <= cur)
+    return 0;
+
+  if (cur == 0)
+    hll->zeros--;
+  hll->sum = hll->sum - hll_term (cur) + hll_term (rank);
+  hll->regs[idx] = rank;
+
+  return 1;
+}
+
+/* Allocate the registers of a sketch, all of them unset. */
+static void
+alloc_registers (GHLL * hll)
+{
+  hll->regs = xcalloc (HLL_REGISTERS, sizeof (uint8_t));
+  hll->zeros = HLL_REGISTERS;
+  hll->sum = (uint64_t) HLL_REGISTERS << HLL_SUM_BITS;
+}
+
+/* Raise the register of the given hash. Only its upper bits are
+ * set. */
+static int
+hll_insert_dense (GHLL * hll, uint64_t hash, int bits)
+{
+  uint32_t idx = (uint32_t) (hash >> (64 - HLL_PRECISION));
+
+  return set_register (hll, idx, hll_rank (hash, bits));
+}
+
+/* Turn a sparse sketch into a dense one. The upper 32 bits of each
+ * hash set its register. */
+static void
+hll_to_dense (GHLL * hll)
+{
+  uint32_t i;
+
+  alloc_registers (hll);
+  for (i = 0; i < hll->len; i++)
+    hll_insert_dense (hll, (uint64_t) hll->sparse[i] << 32, 32);
+
+  free (hll->sparse);
+  hll->sparse = NULL;
+  hll->len = hll->size = 0;
+}
+
+/* Insert the upper 32 bits of a hash into a sparse sketch, turning it
+ * into a dense one if it gets too large.
+ *
+ * If the hash was already on the sketch, 0 is returned.
+ * On success, 1 is returned. */
+static int
+hll_insert_sparse (GHLL * hll, uint64_t hash, int bits)
+{
+  uint32_t h = (uint32_t) (hash >> 32), lo = 0, hi = hll->len, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (hll->sparse[mid] < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < hll->len && hll->sparse[lo] == h)
+    return 0;
+
+  if (hll->len == HLL_SPARSE_MAX) {
+    hll_to_dense (hll);
+    return hll_insert_dense (hll, hash, bits);
+  }
+
+  if (hll->len == hll->size) {
+    hll->size = hll->size ? hll->size * 2 : 4;
+    hll->sparse = xrealloc (hll->sparse, hll->size * sizeof (uint32_t));
+  }
+  memmove (hll->sparse + lo + 1, hll->sparse + lo,
+           (hll->len - lo) * sizeof (uint32_t));
+  hll->sparse[lo] = h;
+  hll->len++;
+
+  return 1;
+}
+
+/* Insert a hash, only its upper bits are set, into a sketch.
+ *
+ * If the sketch did not change, 0 is returned.
+ * On success, 1 is returned. */
+static int
+hll_insert (GHLL * hll, uint64_t hash, int bits)
+{
+  if (hll->regs)
+    return hll_insert_dense (hll, hash, bits);
+  return hll_insert_sparse (hll, hash, bits);
+}
+
+/* Estimate the num of distinct hashes added to a sketch. Sparse
+ * sketches are counted exactly, barring collisions on 32-bit hashes,
+ * small dense ones through linear counting.
+ *
+ * On success, the estimate is returned. */
+uint32_t
+hll_estimate (const GHLL * hll)
+{
+  double m = HLL_REGISTERS, alpha = 0.7213 / (1.0 + 1.079 / m), est = 0;
+
+  if (!hll->regs)
+    return hll->len;
+
+  est = alpha * m * m * ldexp (1.0, HLL_SUM_BITS) / (double) hll->sum;
+  if (est <= 2.5 * m && hll->zeros != 0)
+    est = m * log (m / hll->zeros);
+
+  return est >= UINT32_MAX ? UINT32_MAX : (uint32_t) (est + 0.5);
+}
+
+/* Report the estimate of a sketch. Since estimates may go down
+ * slightly as a sketch grows, e.g., once it becomes dense, only the
+ * growth past the highest estimate reported so far is returned, so it
+ * can be added up to a counter.
+ *
+ * On success, the growth of the estimate is returned. */
+uint32_t
+hll_report (GHLL * hll)
+{
+  uint32_t est = hll_estimate (hll), inc = 0;
+
+  if (est <= hll->count)
+    return 0;
+
+  inc = est - hll->count;
+  hll->count = est;
+
+  return inc;
+}
+
+/* Add a 64-bit hash to a sketch.
+ *
+ * If the sketch did not change, 0 is returned.
+ * On success, 1 is returned. */
+int
+hll_add (GHLL * hll, uint64_t hash)
+{
+  return hll_insert (hll, hash, 64);
+}
+
+/* Merge the src sketch into the dst sketch, i.e., dst ends up
+ * estimating the union of both.
+ *
+ * If the dst sketch did not change, 0 is returned.
+ * On success, 1 is returned. */
+int
+hll_merge (GHLL * dst, const GHLL * src)
+{
+  uint32_t i;
+  int changed = 0;
+
+  if (!src->regs) {
+    for (i = 0; i < src->len; i++)
+      changed |= hll_insert (dst, (uint64_t) src->sparse[i] << 32, 32);
+    return changed;
+  }
+
+  if (!dst->regs) {
+    hll_to_dense (dst);
+    changed = 1;
+  }
+  for (i = 0; i < HLL_REGISTERS; i++)
+    changed |= set_register (dst, i, src->regs[i]);
+
+  return changed;
+}
+
+/* Serialize a sketch into a buffer made out of the highest estimate
+ * reported, the num of sparse hashes or HLL_DENSE, and the sparse
+ * hashes or the registers.
+ *
+ * On success, the newly allocated buffer is returned and its size is
+ * set. */
+void *
+hll_pack (const GHLL * hll, size_t * size)
+{
+  uint32_t hdr[2];
+  size_t len = hll->regs ? HLL_REGISTERS : hll->len * sizeof (uint32_t);
+  char *buf = NULL;
+
+  hdr[0] = hll->count;
+  hdr[1] = hll->regs ? HLL_DENSE : hll->len;
+
+  buf = xmalloc (sizeof (hdr) + len);
+  memcpy (buf, hdr, sizeof (hdr));
+  if (len)
+    memcpy (buf + sizeof (hdr), hll->regs ? (void *) hll->regs :
+            (void *) hll->sparse, len);
+  *size = sizeof (hdr) + len;
+
+  return buf;
+}
+
+/* Deserialize a sketch packed through hll_pack() into the given,
+ * unused, sketch.
+ *
+ * On error, the sketch is left empty and -1 is returned.
+ * On success, 0 is returned. */
+int
+hll_unpack (GHLL * hll, const void *buf, size_t size)
+{
+  const char *data = buf;
+  uint32_t hdr[2], i;
+
+  memset (hll, 0, sizeof (GHLL));
+  if (size < sizeof (hdr))
+    return -1;
+
+  memcpy (hdr, data, sizeof (hdr));
+  data += sizeof (hdr);
+  size -= sizeof (hdr);
+
+  if (hdr[1] == HLL_DENSE) {
+    if (size != HLL_REGISTERS)
+      return -1;
+    alloc_registers (hll);
+    for (i = 0; i < HLL_REGISTERS; i++)
+      set_register (hll, i, (uint8_t) data[i]);
+  } else {
+    if (hdr[1] > HLL_SPARSE_MAX || size != hdr[1] * sizeof (uint32_t))
+      return -1;
+    hll->len = hll->size = hdr[1];
+    if (hll->len) {
+      hll->sparse = xmalloc (size);
+      memcpy (hll->sparse, data, size);
+    }
+  }
+  hll->count = hdr[0];
+
+  return 0;
+}
+
+/* Free the hashes or the registers of a sketch, leaving it empty. */
+void
+free_hll (GHLL * hll)
+{
+  free (hll->sparse);
+  free (hll->regs);
+  memset (hll, 0, sizeof (GHLL));
+}
@@ -0,0 +1,68 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GHLL_H_INCLUDED
+#define GHLL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HLL_PRECISION  12       /* bits of the hash indexing a register */
+#define HLL_REGISTERS  (1 << HLL_PRECISION)     /* std error ~1.6% */
+/* a sparse sketch holding more hashes than this becomes dense, i.e.,
+ * once it would take more memory than the registers */
+#define HLL_SPARSE_MAX (HLL_REGISTERS / sizeof (uint32_t))
+/* registers are summed as 2^(HLL_SUM_BITS - rank) */
+#define HLL_SUM_BITS   50
+/* sparse length of a packed dense sketch */
+#define HLL_DENSE      UINT32_MAX
+
+/* HyperLogLog sketch estimating the number of distinct hashes added to
+ * it. Small sets keep a sorted array of the upper 32 bits of each hash,
+ * counted exactly, until they take as much memory as the registers. */
+typedef struct GHLL_
+{
+  uint32_t *sparse;             /* sorted hashes, NULL once dense */
+  uint8_t *regs;                /* registers, NULL while sparse */
+  uint64_t sum;                 /* sum of the registers, once dense */
+  uint32_t len;                 /* num of sparse hashes */
+  uint32_t size;                /* num of allocated sparse hashes */
+  uint32_t zeros;               /* num of unset registers, once dense */
+  uint32_t count;               /* highest estimate reported so far */
+} GHLL;
+
+int hll_add (GHLL * hll, uint64_t hash);
+int hll_merge (GHLL * dst, const GHLL * src);
+int hll_unpack (GHLL * hll, const void *buf, size_t size);
+uint32_t hll_estimate (const GHLL * hll);
+uint32_t hll_report (GHLL * hll);
+void free_hll (GHLL * hll);
+void *hll_pack (const GHLL * hll, size_t * size);
+
+#endif // for #ifndef GHLL_H
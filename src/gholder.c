@@ -28,6 +28,7 @@
  * SOFTWARE.
  */
 
+#include <ctype.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,7 +50,9 @@
 #include "gholder.h"
 
 #include "error.h"
+#include "garena.h"
 #include "gdns.h"
+#include "gstats.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -131,13 +134,36 @@ new_gholder_item (uint32_t size)
   return item;
 }
 
+/* Get the given node pool of a holder, creating it on first use. Nodes
+ * live as long as the holder of the module, they are released at once
+ * when it's freed, see free_holder_items().
+ *
+ * On success, the pool is returned. */
+static GPool *
+get_holder_pool (GPool ** pool, size_t size)
+{
+  if (*pool == NULL)
+    *pool = new_pool (size);
+  return *pool;
+}
+
+/* Allocate a zeroed GMetrics node out of the holder's pool.
+ *
+ * On success, the newly allocated GMetrics is returned. */
+static GMetrics *
+new_holder_metrics (GHolder * h)
+{
+  return pool_calloc (get_holder_pool (&h->metrics_pool, sizeof (GMetrics)));
+}
+
 /* Allocate memory for a new double linked-list GSubList instance.
  *
  * On success, the newly allocated GSubList is returned . */
 static GSubList *
-new_gsublist (void)
+new_gsublist (GHolder * h)
 {
-  GSubList *sub_list = xmalloc (sizeof (GSubList));
+  GSubList *sub_list =
+    pool_alloc (get_holder_pool (&h->sub_lists_pool, sizeof (GSubList)));
   sub_list->head = NULL;
   sub_list->tail = NULL;
   sub_list->size = 0;
@@ -149,12 +175,13 @@ new_gsublist (void)
  *
  * On success, the newly allocated GSubItem is returned . */
 static GSubItem *
-new_gsubitem (GModule module, GMetrics * nmetrics)
+new_gsubitem (GHolder * h, GMetrics * nmetrics)
 {
-  GSubItem *sub_item = xmalloc (sizeof (GSubItem));
+  GSubItem *sub_item =
+    pool_alloc (get_holder_pool (&h->sub_items_pool, sizeof (GSubItem)));
 
   sub_item->metrics = nmetrics;
-  sub_item->module = module;
+  sub_item->module = h->module;
   sub_item->prev = NULL;
   sub_item->next = NULL;
 
@@ -163,9 +190,9 @@ new_gsubitem (GModule module, GMetrics * nmetrics)
 
 /* Add an item to the end of a given sub list. */
 static void
-add_sub_item_back (GSubList * sub_list, GModule module, GMetrics * nmetrics)
+add_sub_item_back (GHolder * h, GSubList * sub_list, GMetrics * nmetrics)
 {
-  GSubItem *sub_item = new_gsubitem (module, nmetrics);
+  GSubItem *sub_item = new_gsubitem (h, nmetrics);
   if (sub_list->tail) {
     sub_list->tail->next = sub_item;
     sub_item->prev = sub_list->tail;
@@ -177,9 +204,10 @@ add_sub_item_back (GSubList * sub_list, GModule module, GMetrics * nmetrics)
   sub_list->size++;
 }
 
-/* Delete the entire given sub list. */
+/* Delete the entire given sub list, giving its nodes back to the
+ * holder's pools. */
 static void
-delete_sub_list (GSubList * sub_list)
+delete_sub_list (GHolder * h, GSubList * sub_list)
 {
   GSubItem *item = NULL;
   GSubItem *next = NULL;
@@ -192,46 +220,89 @@ delete_sub_list (GSubList * sub_list)
   for (item = sub_list->head; item; item = next) {
     next = item->next;
     free (item->metrics->data);
-    free (item->metrics);
-    free (item);
+    pool_free (h->metrics_pool, item->metrics);
+    pool_free (h->sub_items_pool, item);
   }
 clear:
   sub_list->head = NULL;
   sub_list->size = 0;
-  free (sub_list);
+  pool_free (h->sub_lists_pool, sub_list);
 }
 
 /* Free malloc'd holder fields. */
 static void
-free_holder_data (GHolderItem item)
+free_holder_strings (GHolderItem item)
+{
+  GSubItem *iter = NULL;
+
+  if (item.sub_list != NULL) {
+    for (iter = item.sub_list->head; iter; iter = iter->next)
+      free (iter->metrics->data);
+  }
+  free (item.metrics->data);
+  free (item.metrics->method);
+  free (item.metrics->protocol);
+}
+
+/* Free malloc'd holder fields and give the item nodes back to the
+ * holder's pools. */
+static void
+free_holder_data (GHolder * h, GHolderItem item)
 {
   if (item.sub_list != NULL)
-    delete_sub_list (item.sub_list);
-  if (item.metrics->data != NULL)
-    free (item.metrics->data);
-  if (item.metrics->method != NULL)
-    free (item.metrics->method);
-  if (item.metrics->protocol != NULL)
-    free (item.metrics->protocol);
-  if (item.metrics != NULL)
-    free (item.metrics);
+    delete_sub_list (h, item.sub_list);
+  free_holder_strings (item);
+  pool_free (h->metrics_pool, item.metrics);
+}
+
+/* Free all the items of the given holder. Nodes are released in bulk
+ * by resetting the pools, only the strings are freed one by one. */
+static void
+free_holder_items (GHolder * h)
+{
+  int j;
+
+  for (j = 0; j < h->idx; j++)
+    free_holder_strings (h->items[j]);
+  free (h->items);
+  h->items = NULL;
+
+  if (h->metrics_pool)
+    reset_pool (h->metrics_pool);
+  if (h->sub_items_pool)
+    reset_pool (h->sub_items_pool);
+  if (h->sub_lists_pool)
+    reset_pool (h->sub_lists_pool);
+}
+
+/* Free the search index of the given holder, if any. It has to be
+ * dropped whenever the holder items change. */
+static void
+free_holder_index (GHolder * h)
+{
+  if (h->index == NULL)
+    return;
+
+  free (h->index->text);
+  free (h->index->data);
+  free (h->index->offs);
+  free (h->index->first);
+  free (h->index);
+  h->index = NULL;
 }
 
 /* Free all memory allocated in holder for a given module. */
 void
 free_holder_by_module (GHolder ** holder, GModule module)
 {
-  int j;
-
   if ((*holder) == NULL)
     return;
 
-  for (j = 0; j < (*holder)[module].idx; j++) {
-    free_holder_data ((*holder)[module].items[j]);
-  }
-  free ((*holder)[module].items);
+  free_holder_index (&(*holder)[module]);
+  free_holder_items (&(*holder)[module]);
 
   (*holder)[module].holder_size = 0;
+  (*holder)[module].ht_size = 0;
   (*holder)[module].idx = 0;
   (*holder)[module].sub_items_size = 0;
 }
@@ -241,7 +312,6 @@ void
 free_holder (GHolder ** holder)
 {
   GModule module;
-  int j;
   size_t idx = 0;
 
   if ((*holder) == NULL)
@@ -250,36 +320,46 @@ free_holder (GHolder ** holder)
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
 
-    for (j = 0; j < (*holder)[module].idx; j++) {
-      free_holder_data ((*holder)[module].items[j]);
-    }
-    free ((*holder)[module].items);
+    free_holder_items (&(*holder)[module]);
+    free_holder_index (&(*holder)[module]);
+    free_pool ((*holder)[module].metrics_pool);
+    free_pool ((*holder)[module].sub_items_pool);
+    free_pool ((*holder)[module].sub_lists_pool);
   }
   free (*holder);
   (*holder) = NULL;
 }
 
-/* Iterate over holder and get the key index.
+/* Get the holder item of the given root key, see add_root_to_holder().
  *
- * If the key does not exist, -1 is returned.
- * On success, the key in holder is returned . */
+ * If the root key has no item yet, -1 is returned.
+ * On success, the index of the item in the holder is returned. */
 static int
-get_item_idx_in_holder (GHolder * holder, const char *k)
+get_root_idx_in_holder (GHolder * h, int root_key)
 {
-  int i;
-  if (holder == NULL)
-    return KEY_NOT_FOUND;
-  if (holder->idx == 0)
-    return KEY_NOT_FOUND;
-  if (k == NULL || *k == '\0')
+  if (root_key >= h->roots_size)
     return KEY_NOT_FOUND;
+  return h->roots[root_key] - 1;
+}
 
-  for (i = 0; i < holder->idx; i++) {
-    if (strcmp (k, holder->items[i].metrics->data) == 0)
-      return i;
-  }
+/* Set the holder item of the given root key. Root keys come from the
+ * keymap, so they are dense and indexed by an array, grown as needed. */
+static void
+set_root_idx_in_holder (GHolder * h, int root_key, int idx)
+{
+  int size = 0;
+
+  if (root_key >= h->roots_size) {
+    size = h->roots_size > 0 ? h->roots_size : 64;
+    while (size <= root_key)
+      size *= 2;
 
-  return KEY_NOT_FOUND;
+    h->roots = xrealloc (h->roots, size * sizeof (int));
+    memset (h->roots + h->roots_size, 0,
+            (size - h->roots_size) * sizeof (int));
+    h->roots_size = size;
+  }
+  h->roots[root_key] = idx + 1;
 }
 
 /* Copy linked-list items to an array, sort, and move them back to the
@@ -302,7 +382,7 @@ sort_sub_list (GHolder * h, GSort sort)
 
     /* copy items from the linked-list into an array */
     for (j = 0, iter = sub_list->head; iter; iter = iter->next, j++) {
-      arr[j].metrics = new_gmetrics ();
+      arr[j].metrics = new_holder_metrics (h);
 
       arr[j].metrics->bw.nbw = iter->metrics->bw.nbw;
       arr[j].metrics->data = xstrdup (iter->metrics->data);
@@ -316,14 +396,14 @@ sort_sub_list (GHolder * h, GSort sort)
       }
     }
     sort_holder_items (arr, j, sort);
-    delete_sub_list (sub_list);
+    delete_sub_list (h, sub_list);
 
-    sub_list = new_gsublist ();
+    sub_list = new_gsublist (h);
     for (k = 0; k < j; k++) {
       if (k > 0)
         sub_list = h->items[i].sub_list;
 
-      add_sub_item_back (sub_list, h->module, arr[k].metrics);
+      add_sub_item_back (h, sub_list, arr[k].metrics);
       h->items[i].sub_list = sub_list;
     }
     free (arr);
@@ -334,11 +414,12 @@ sort_sub_list (GHolder * h, GSort sort)
  *
  * On success, the data field/metric is set. */
 static int
-set_host_child_metrics (char *data, uint8_t id, GMetrics ** nmetrics)
+set_host_child_metrics (GHolder * h, char *data, uint8_t id,
+                        GMetrics ** nmetrics)
 {
   GMetrics *metrics;
 
-  metrics = new_gmetrics ();
+  metrics = new_holder_metrics (h);
   metrics->data = xstrdup (data);
   metrics->id = id;
   *nmetrics = metrics;
@@ -366,8 +447,8 @@ set_host_sub_list (GHolder * h, GSubList * sub_list)
 
   /* country */
   if (country[0] != '\0') {
-    set_host_child_metrics (country, MTRC_ID_COUNTRY, &nmetrics);
-    add_sub_item_back (sub_list, h->module, nmetrics);
+    set_host_child_metrics (h, country, MTRC_ID_COUNTRY, &nmetrics);
+    add_sub_item_back (h, sub_list, nmetrics);
     h->items[h->idx].sub_list = sub_list;
     h->sub_items_size++;
 
@@ -377,8 +458,8 @@ set_host_sub_list (GHolder * h, GSubList * sub_list)
 
   /* city */
   if (city[0] != '\0') {
-    set_host_child_metrics (city, MTRC_ID_CITY, &nmetrics);
-    add_sub_item_back (sub_list, h->module, nmetrics);
+    set_host_child_metrics (h, city, MTRC_ID_CITY, &nmetrics);
+    add_sub_item_back (h, sub_list, nmetrics);
     h->items[h->idx].sub_list = sub_list;
     h->sub_items_size++;
 
@@ -390,8 +471,8 @@ set_host_sub_list (GHolder * h, GSubList * sub_list)
   /* hostname */
   if (conf.enable_html_resolver && conf.output_stdout) {
     hostname = reverse_ip (host);
-    set_host_child_metrics (hostname, MTRC_ID_HOSTNAME, &nmetrics);
-    add_sub_item_back (sub_list, h->module, nmetrics);
+    set_host_child_metrics (h, hostname, MTRC_ID_HOSTNAME, &nmetrics);
+    add_sub_item_back (h, sub_list, nmetrics);
     h->items[h->idx].sub_list = sub_list;
     h->sub_items_size++;
     free (hostname);
@@ -405,7 +486,7 @@ static void
 add_host_child_to_holder (GHolder * h)
 {
   GMetrics *nmetrics;
-  GSubList *sub_list = new_gsublist ();
+  GSubList *sub_list = new_gsublist (h);
 
   char *ip = h->items[h->idx].metrics->data;
   char *hostname = NULL;
@@ -414,16 +495,14 @@ add_host_child_to_holder (GHolder * h)
   /* add child nodes */
   set_host_sub_list (h, sub_list);
 
-  pthread_mutex_lock (&gdns_thread.mutex);
-  hostname = ht_get_hostname (ip);
-  pthread_mutex_unlock (&gdns_thread.mutex);
+  hostname = gdns_get_hostname (ip);
 
   /* determine if we have the IP's hostname */
   if (!hostname) {
     dns_resolver (ip);
   } else if (hostname) {
-    set_host_child_metrics (hostname, MTRC_ID_HOSTNAME, &nmetrics);
-    add_sub_item_back (sub_list, h->module, nmetrics);
+    set_host_child_metrics (h, hostname, MTRC_ID_HOSTNAME, &nmetrics);
+    add_sub_item_back (h, sub_list, nmetrics);
     h->items[h->idx].sub_list = sub_list;
     h->sub_items_size++;
     free (hostname);
@@ -431,7 +510,7 @@ add_host_child_to_holder (GHolder * h)
 
   /* did not add any items */
   if (n == h->sub_items_size)
-    free (sub_list);
+    pool_free (h->sub_lists_pool, sub_list);
 }
 
 /* Given a GRawDataType, set the data and hits value.
@@ -467,7 +546,8 @@ set_data_holder_metrics (GRawDataItem item, GHolder * h, char *data, int hits)
   maxts = ht_get_maxts (h->module, item.key);
   visitors = ht_get_visitors (h->module, item.key);
 
-  h->items[h->idx].metrics = new_gmetrics ();
+  h->items[h->idx].key = item.key;
+  h->items[h->idx].metrics = new_holder_metrics (h);
   h->items[h->idx].metrics->hits = hits;
   h->items[h->idx].metrics->data = data;
   h->items[h->idx].metrics->visitors = visitors;
@@ -523,17 +603,9 @@ static void
 add_host_to_holder (GRawDataItem item, GHolder * h, GRawDataType type,
                     const GPanel * panel)
 {
-  char buf4[INET_ADDRSTRLEN];
-  char buf6[INET6_ADDRSTRLEN];
+  char buf[INET6_ADDRSTRLEN];
   char *data = NULL;
   int hits = 0;
-  unsigned i;
-
-  struct in6_addr addr6, mask6, nwork6;
-  struct in_addr addr4, mask4, nwork4;
-
-  const char *m4 = "255.255.255.0";
-  const char *m6 = "ffff:ffff:ffff:ffff:0000:0000:0000:0000";
 
   if (set_data_hits_keys (h->module, item, type, &data, &hits) == 1)
     return;
@@ -544,36 +616,17 @@ add_host_to_holder (GRawDataItem item, GHolder * h, GRawDataType type,
     return;
   }
 
-  if (1 == inet_pton (AF_INET, data, &addr4)) {
-    if (1 == inet_pton (AF_INET, m4, &mask4)) {
-      memset (buf4, 0, sizeof *buf4);
-      nwork4.s_addr = addr4.s_addr & mask4.s_addr;
-
-      if (inet_ntop (AF_INET, &nwork4, buf4, INET_ADDRSTRLEN) != NULL) {
-        set_host (item, h, panel, buf4, hits);
-        free (data);
-      }
-    }
-  } else if (1 == inet_pton (AF_INET6, data, &addr6)) {
-    if (1 == inet_pton (AF_INET6, m6, &mask6)) {
-      memset (buf6, 0, sizeof *buf6);
-      for (i = 0; i < 16; i++) {
-        nwork6.s6_addr[i] = addr6.s6_addr[i] & mask6.s6_addr[i];
-      }
-
-      if (inet_ntop (AF_INET6, &nwork6, buf6, INET6_ADDRSTRLEN) != NULL) {
-        set_host (item, h, panel, buf6, hits);
-        free (data);
-      }
-    }
-  }
+  if (anonymize_ip (data, buf) == 0)
+    set_host (item, h, panel, buf, hits);
+  free (data);
 }
 
 /* Set all root panel data. This will set the root nodes. */
 static int
-set_root_metrics (GRawDataItem item, GRawDataType type, GModule module,
+set_root_metrics (GRawDataItem item, GRawDataType type, GHolder * h,
                   GMetrics ** nmetrics)
 {
+  GModule module = h->module;
   GMetrics *metrics;
   char *data = NULL;
   uint64_t bw = 0, cumts = 0, maxts = 0;
@@ -587,7 +640,7 @@ set_root_metrics (GRawDataItem item, GRawDataType type, GModule module,
   maxts = ht_get_maxts (module, item.key);
   visitors = ht_get_visitors (module, item.key);
 
-  metrics = new_gmetrics ();
+  metrics = new_holder_metrics (h);
   metrics->avgts.nts = cumts / hits;
   metrics->cumts.nts = cumts;
   metrics->maxts.nts = maxts;
@@ -608,32 +661,40 @@ add_root_to_holder (GRawDataItem item, GHolder * h, GRawDataType type,
   GSubList *sub_list;
   GMetrics *metrics, *nmetrics;
   char *root = NULL;
-  int root_idx = KEY_NOT_FOUND, idx = 0;
+  int root_idx = KEY_NOT_FOUND, root_key = 0, idx = 0;
 
-  if (set_root_metrics (item, type, h->module, &nmetrics) == 1)
+  if ((root_key = ht_get_root_key (h->module, item.key)) <= 0)
     return;
 
-  if (!(root = (ht_get_root (h->module, item.key))))
+  /* the root string is only needed by the first child of a root */
+  if (KEY_NOT_FOUND == (root_idx = get_root_idx_in_holder (h, root_key))) {
+    if (!(root = ht_get_root (h->module, item.key)))
+      return;
+  }
+
+  if (set_root_metrics (item, type, h, &nmetrics) == 1) {
+    free (root);
     return;
+  }
 
   /* add data as a child node into holder */
-  if (KEY_NOT_FOUND == (root_idx = get_item_idx_in_holder (h, root))) {
+  if (KEY_NOT_FOUND == root_idx) {
     idx = h->idx;
-    sub_list = new_gsublist ();
-    metrics = new_gmetrics ();
+    sub_list = new_gsublist (h);
+    metrics = new_holder_metrics (h);
 
     h->items[idx].metrics = metrics;
     h->items[idx].metrics->data = root;
     h->idx++;
+    set_root_idx_in_holder (h, root_key, idx);
   } else {
     sub_list = h->items[root_idx].sub_list;
     metrics = h->items[root_idx].metrics;
 
     idx = root_idx;
-    free (root);
   }
 
-  add_sub_item_back (sub_list, h->module, nmetrics);
+  add_sub_item_back (h, sub_list, nmetrics);
   h->items[idx].sub_list = sub_list;
 
   h->items[idx].metrics = metrics;
@@ -649,6 +710,258 @@ add_root_to_holder (GRawDataItem item, GHolder * h, GRawDataType type,
   h->sub_items_size++;
 }
 
+/* Determine if the holder of the given module can be updated from the
+ * keys that changed, see update_holder_data(). That's the case of the
+ * panels that map a data key to a single item. Root panels and
+ * anonymized hosts merge several keys into one item.
+ *
+ * If it can't, 0 is returned.
+ * If it can, 1 is returned. */
+int
+can_update_holder (GModule module)
+{
+  const GPanel *panel = panel_lookup (module);
+
+  if (panel == NULL)
+    return 0;
+  if (panel->insert == add_host_to_holder)
+    return !conf.anonymize_ip;
+  return panel->insert == add_data_to_holder;
+}
+
+/* Sort raw data items by key ascending. */
+static int
+cmp_raw_key (const void *a, const void *b)
+{
+  const GRawDataItem *ia = a;
+  const GRawDataItem *ib = b;
+
+  return (ia->key > ib->key) - (ia->key < ib->key);
+}
+
+/* Sort holder items by key ascending. */
+static int
+cmp_item_key (const void *a, const void *b)
+{
+  const GHolderItem *ia = a;
+  const GHolderItem *ib = b;
+
+  return (ia->key > ib->key) - (ia->key < ib->key);
+}
+
+/* Update the holder of the given module from the raw data of the keys
+ * that changed since it was loaded, see parse_raw_keys_data(), instead
+ * of loading the whole store again.
+ *
+ * Since metrics never decrease, the top items can only come from the
+ * items already in the holder or the keys that changed. Items that
+ * didn't change are kept as they are, so the holder ends up as if it
+ * was loaded from scratch by load_holder_data(). */
+void
+update_holder_data (GRawData * raw_data, GHolder * h, GModule module,
+                    GSort sort)
+{
+  GRawData *cand = NULL;
+  GHolderItem *old = h->items, *found = NULL, tkey;
+  const GPanel *panel = panel_lookup (module);
+  int i, j, max_choices = get_max_choices (), n = h->idx;
+
+  memset (&tkey, 0, sizeof (tkey));
+  free_holder_index (h);
+
+  /* the keys that changed, without repeated ones */
+  qsort (raw_data->items, raw_data->idx, sizeof (GRawDataItem), cmp_raw_key);
+  for (i = 0, j = 0; i < raw_data->idx; i++) {
+    if (j > 0 && raw_data->items[j - 1].key == raw_data->items[i].key)
+      continue;
+    raw_data->items[j++] = raw_data->items[i];
+  }
+  raw_data->idx = j;
+
+  /* candidates are the changed keys and the unchanged holder items */
+  cand = new_grawdata ();
+  cand->module = module;
+  cand->type = raw_data->type;
+  cand->items = new_grawdata_item (raw_data->idx + n);
+  memcpy (cand->items, raw_data->items, raw_data->idx * sizeof (GRawDataItem));
+  cand->idx = raw_data->idx;
+
+  qsort (old, n, sizeof (GHolderItem), cmp_item_key);
+  for (i = 0; i < n; i++) {
+    cand->items[cand->idx].key = old[i].key;
+    if (bsearch (&cand->items[cand->idx], raw_data->items, raw_data->idx,
+                 sizeof (GRawDataItem), cmp_raw_key) != NULL) {
+      if (old[i].sub_list != NULL)
+        h->sub_items_size -= old[i].sub_list->size;
+      free_holder_data (h, old[i]);
+      old[i].metrics = NULL;
+      continue;
+    }
+    if (cand->type == STRING)
+      cand->items[cand->idx].value.svalue = old[i].metrics->data;
+    else
+      cand->items[cand->idx].value.ivalue = old[i].metrics->hits;
+    cand->idx++;
+  }
+  if (cand->type == STRING)
+    sort_raw_str_data (cand, cand->idx);
+  else
+    sort_raw_num_data (cand, cand->idx);
+
+  h->ht_size = raw_data->size;
+  h->holder_size = h->ht_size > max_choices ? max_choices : h->ht_size;
+  h->idx = 0;
+  h->items = new_gholder_item (h->holder_size);
+  for (i = 0; i < cand->idx && h->idx < h->holder_size; i++) {
+    tkey.key = cand->items[i].key;
+    found = bsearch (&tkey, old, n, sizeof (GHolderItem), cmp_item_key);
+    /* unchanged, move it over */
+    if (found != NULL && found->metrics != NULL) {
+      h->items[h->idx++] = *found;
+      found->metrics = NULL;
+      continue;
+    }
+    panel->insert (cand->items[i], h, cand->type, panel);
+  }
+
+  /* drop the items that didn't make it to the top */
+  for (i = 0; i < n; i++) {
+    if (old[i].metrics == NULL)
+      continue;
+    if (old[i].sub_list != NULL)
+      h->sub_items_size -= old[i].sub_list->size;
+    free_holder_data (h, old[i]);
+  }
+  free (old);
+
+  sort_holder_items (h->items, h->idx, sort);
+  if (h->sub_items_size)
+    sort_sub_list (h, sort);
+
+  free (cand->items);
+  free (cand);
+  free_raw_data (raw_data);
+}
+
+/* Append the given row data to the search index blob. */
+static void
+add_index_row (GHolderIndex * index, char *data, int *size)
+{
+  char *p = index->text + (*size);
+
+  if (data == NULL)
+    data = (char *) "";
+
+  index->data[index->len] = data;
+  index->offs[index->len++] = (*size);
+  for (; *data != '\0'; data++, p++)
+    *p = index->icase ? tolower ((unsigned char) *data) : *data;
+  *p = '\0';
+  (*size) = p - index->text + 1;
+}
+
+/* Get the search index of the given holder, building it if it's not
+ * there yet or if it was built for a different case sensitivity.
+ *
+ * On success, the holder's index is returned. */
+GHolderIndex *
+load_holder_index (GHolder * h, int icase)
+{
+  GHolderIndex *index = h->index;
+  GSubItem *iter;
+  int j, rows = 0, size = 1;
+
+  if (index != NULL && index->icase == icase)
+    return index;
+  free_holder_index (h);
+
+  for (j = 0; j < h->idx; j++) {
+    rows++;
+    if (h->items[j].metrics->data)
+      size += strlen (h->items[j].metrics->data);
+    size++;
+    if (h->items[j].sub_list == NULL)
+      continue;
+    for (iter = h->items[j].sub_list->head; iter; iter = iter->next) {
+      rows++;
+      if (iter->metrics->data)
+        size += strlen (iter->metrics->data);
+      size++;
+    }
+  }
+
+  index = xcalloc (1, sizeof (GHolderIndex));
+  index->icase = icase;
+  index->text = xmalloc (size);
+  index->data = xcalloc (rows + 1, sizeof (char *));
+  index->offs = xcalloc (rows + 1, sizeof (int));
+  index->first = xcalloc (h->idx + 1, sizeof (int));
+
+  /* a leading NUL, so that every row is enclosed by two of them */
+  index->text[0] = '\0';
+  size = 1;
+  for (j = 0; j < h->idx; j++) {
+    index->first[j] = index->len;
+    add_index_row (index, h->items[j].metrics->data, &size);
+    if (h->items[j].sub_list == NULL)
+      continue;
+    for (iter = h->items[j].sub_list->head; iter; iter = iter->next)
+      add_index_row (index, iter->metrics->data, &size);
+  }
+  /* one past the last row, to map blob offsets back to rows */
+  index->offs[index->len] = size;
+  index->first[h->idx] = index->len;
+
+  h->index = index;
+
+  return index;
+}
+
+/* Build the holders of the remaining modules, one at a time. */
+static void *
+holder_job (void *ptr_data)
+{
+  GHolderJobs *jobs = ptr_data;
+  int i;
+
+  while ((i = __atomic_fetch_add (&jobs->next, 1, __ATOMIC_RELAXED)) <
+         jobs->len)
+    jobs->build (jobs->modules[i]);
+
+  return NULL;
+}
+
+/* Build the holders of the given modules using up to the given number
+ * of threads, including the current one. Each module is only read from
+ * its own store and written to its own holder.
+ *
+ * Tokyo Cabinet's storage may write pending updates when read, so it's
+ * always built from the current thread. */
+void
+run_holder_jobs (GHolderJobs * jobs, int threads)
+{
+  pthread_t thread[MAX_JOBS];
+  uint64_t ts = stats_begin ();
+  int i, spawned = 0;
+
+#ifdef HAVE_LIBTOKYOCABINET
+  threads = 1;
+#endif
+  if (threads > jobs->len)
+    threads = jobs->len;
+
+  /* fall back to the current thread if unable to spawn a new one */
+  for (i = 1; i < threads; ++i) {
+    if (pthread_create (&thread[spawned], NULL, holder_job, jobs) == 0)
+      spawned++;
+  }
+  holder_job (jobs);
+
+  for (i = 0; i < spawned; ++i)
+    pthread_join (thread[i], NULL);
+  stats_end (STATS_HOLDER, ts);
+}
+
 /* Load raw data into our holder structure */
 void
 load_holder_data (GRawData * raw_data, GHolder * h, GModule module, GSort sort)
@@ -667,6 +980,10 @@ load_holder_data (GRawData * raw_data, GHolder * h, GModule module, GSort sort)
   for (i = 0; i < h->holder_size; i++) {
     panel->insert (raw_data->items[i], h, raw_data->type, panel);
   }
+  /* only needed while loading root panels */
+  free (h->roots);
+  h->roots = NULL;
+  h->roots_size = 0;
   sort_holder_items (h->items, h->idx, sort);
   if (h->sub_items_size)
     sort_sub_list (h, sort);
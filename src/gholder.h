@@ -37,13 +37,28 @@
 #include "commons.h"
 #include "sort.h"
 
+/* Modules whose holders are built by a pool of threads, see
+ * run_holder_jobs() */
+typedef struct GHolderJobs_
+{
+  GModule modules[TOTAL_MODULES];
+  int len;                      /* number of modules */
+  int next;                     /* next module to be built */
+  void (*build) (GModule module);
+} GHolderJobs;
+
 /* Function Prototypes */
 GHolder *new_gholder (uint32_t size);
+GHolderIndex *load_holder_index (GHolder * h, int icase);
+int can_update_holder (GModule module);
 void *add_hostname_node (void *ptr_holder);
 void free_holder_by_module (GHolder ** holder, GModule module);
 void free_holder (GHolder ** holder);
 void load_holder_data (GRawData * raw_data, GHolder * h, GModule module,
                        GSort sort);
 void load_host_to_holder (GHolder * h, char *ip);
+void run_holder_jobs (GHolderJobs * jobs, int threads);
+void update_holder_data (GRawData * raw_data, GHolder * h, GModule module,
+                         GSort sort);
 
 #endif // for #ifndef GHOLDER_H
@@ -33,6 +33,7 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,20 +41,33 @@
 #include "gkhash.h"
 
 #include "error.h"
+#include "settings.h"
 #include "sort.h"
 #include "util.h"
 #include "xmalloc.h"
 
 /* Hash tables storage */
 static GKHashStorage *gkh_storage;
+/* Strings interned across all modules */
+static GKHashStrings gkh_strings;
+/* Snapshot restored, if any, interned strings point into it */
+static GSnapshot *gkh_snapshot = NULL;
 
 /* *INDENT-OFF* */
 /* Hash tables used across the whole app */
 static khash_t (is32) *ht_agent_vals  = NULL;
 static khash_t (si32) *ht_agent_keys  = NULL;
 static khash_t (si32) *ht_unique_keys = NULL;
+static khash_t (h128i32) *ht_unique_hkeys = NULL;
 static khash_t (ss32) *ht_hostnames   = NULL;
+static khash_t (slp) *ht_last_parse   = NULL;
+/* methods and protocols, shared by all the modules records */
+static khash_t (si32) *ht_attr_keys   = NULL;
+static khash_t (is32) *ht_attr_vals   = NULL;
 /* *INDENT-ON* */
+/* num of buckets the global tables were presized to, 0 if they weren't */
+static khint_t presize_unique_keys = 0;
+static khint_t presize_strings = 0;
 static GKHashStorage *
 new_gkhstorage (uint32_t size)
 {
@@ -79,15 +93,6 @@ new_is32_ht (void)
   return h;
 }
 
-/* Initialize a new int key - uint64_t value hash table */
-static
-khash_t (iu64) *
-new_iu64_ht (void)
-{
-  khash_t (iu64) * h = kh_init (iu64);
-  return h;
-}
-
 /* Initialize a new string key - int value hash table */
 static
 khash_t (si32) *
@@ -106,12 +111,30 @@ new_ss32_ht (void)
   return h;
 }
 
-/* Initialize a new int key - int value hash table */
+/* Initialize a new string key - GLastParse value hash table */
+static
+khash_t (slp) *
+new_slp_ht (void)
+{
+  khash_t (slp) * h = kh_init (slp);
+  return h;
+}
+
+/* Initialize a new int key - GAgentSet value hash table */
+static
+khash_t (iags) *
+new_iags_ht (void)
+{
+  khash_t (iags) * h = kh_init (iags);
+  return h;
+}
+
+/* Initialize a new int key - GHLL value hash table */
 static
-khash_t (igsl) *
-new_igsl_ht (void)
+khash_t (ihll) *
+new_ihll_ht (void)
 {
-  khash_t (igsl) * h = kh_init (igsl);
+  khash_t (ihll) * h = kh_init (ihll);
   return h;
 }
 
@@ -124,6 +147,24 @@ new_su64_ht (void)
   return h;
 }
 
+/* Initialize a new 128-bit hashed key - int value hash table */
+static
+khash_t (h128i32) *
+new_h128i32_ht (void)
+{
+  khash_t (h128i32) * h = kh_init (h128i32);
+  return h;
+}
+
+/* Initialize a new uint64_t key - int value hash table */
+static
+khash_t (u64i32) *
+new_u64i32_ht (void)
+{
+  khash_t (u64i32) * h = kh_init (u64i32);
+  return h;
+}
+
 /* Destroys both the hash structure and the keys for a
  * string key - int value hash */
 static void
@@ -178,6 +219,22 @@ des_ss32_free (khash_t (ss32) * hash)
   kh_destroy (ss32, hash);
 }
 
+/* Destroys both the hash structure and its string keys */
+static void
+des_slp_free (khash_t (slp) * hash)
+{
+  khint_t k;
+  if (!hash)
+    return;
+
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (kh_exist (hash, k))
+      free ((char *) kh_key (hash, k));
+  }
+
+  kh_destroy (slp, hash);
+}
+
 /* Destroys the hash structure */
 static void
 des_ii32 (khash_t (ii32) * hash)
@@ -187,23 +244,43 @@ des_ii32 (khash_t (ii32) * hash)
   kh_destroy (ii32, hash);
 }
 
-/* Destroys both the hash structure and its GSLList
+/* Destroys both the hash structure and its GAgentSet
  * values */
 static void
-des_igsl_free (khash_t (igsl) * hash)
+des_iags_free (khash_t (iags) * hash)
 {
   khint_t k;
-  void *list = NULL;
+  GAgentSet *set = NULL;
   if (!hash)
     return;
 
   for (k = 0; k < kh_end (hash); ++k) {
-    if (kh_exist (hash, k) && (list = kh_value (hash, k))) {
-      list_remove_nodes (list);
-    }
+    if (!kh_exist (hash, k))
+      continue;
+    set = &kh_value (hash, k);
+    if (set->index)
+      kh_destroy (iset, set->index);
+    free (set->keys);
+  }
+
+  kh_destroy (iags, hash);
+}
+
+/* Destroys both the hash structure and its GHLL values */
+static void
+des_ihll_free (khash_t (ihll) * hash)
+{
+  khint_t k;
+  if (!hash)
+    return;
+
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    free_hll (&kh_value (hash, k));
   }
 
-  kh_destroy (igsl, hash);
+  kh_destroy (ihll, hash);
 }
 
 /* Destroys both the hash structure and the keys for a
@@ -226,6 +303,55 @@ des_iu64 (khash_t (iu64) * hash)
   kh_destroy (iu64, hash);
 }
 
+/* Destroys the hash structure */
+static void
+des_h128i32 (khash_t (h128i32) * hash)
+{
+  if (!hash)
+    return;
+  kh_destroy (h128i32, hash);
+}
+
+/* Destroys the hash structure */
+static void
+des_u64i32 (khash_t (u64i32) * hash)
+{
+  if (!hash)
+    return;
+  kh_destroy (u64i32, hash);
+}
+
+/* Get the num of times a hash table grew to reach the given num of
+ * buckets out of the num of buckets it was presized to. Note that khash
+ * doubles its buckets, starting at 4.
+ *
+ * On success the num of resizes is returned. */
+static int
+get_resizes (khint_t n_buckets, khint_t presize)
+{
+  khint_t size = presize ? presize : 4;
+  int n = presize ? 0 : 1;
+
+  if (n_buckets == 0)
+    return 0;
+  for (; size < n_buckets; size <<= 1)
+    n++;
+
+  return n;
+}
+
+/* Log the size of the given hash table and how many times it was
+ * resized as it grew. The module is -1 for tables used across the
+ * whole app. */
+static void
+log_resizes (const char *table, int module, khint_t size, khint_t n_buckets,
+             khint_t presize)
+{
+  LOG_DEBUG (("%s (module %d): %u keys, %u buckets, %u presized, "
+              "%d resizes\n", table, module, size, n_buckets, presize,
+              get_resizes (n_buckets, presize)));
+}
+
 /* Initialize map & metric hashes */
 static void
 init_tables (GModule module)
@@ -233,19 +359,11 @@ init_tables (GModule module)
   int n = 0, i;
   /* *INDENT-OFF* */
   GKHashMetric metrics[] = {
-    {MTRC_KEYMAP    , MTRC_TYPE_SI32 , {.si32 = new_si32_ht ()}} ,
-    {MTRC_ROOTMAP   , MTRC_TYPE_IS32 , {.is32 = new_is32_ht ()}} ,
-    {MTRC_DATAMAP   , MTRC_TYPE_IS32 , {.is32 = new_is32_ht ()}} ,
-    {MTRC_UNIQMAP   , MTRC_TYPE_SI32 , {.si32 = new_si32_ht ()}} ,
-    {MTRC_ROOT      , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}} ,
-    {MTRC_HITS      , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}} ,
-    {MTRC_VISITORS  , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}} ,
-    {MTRC_BW        , MTRC_TYPE_IU64 , {.iu64 = new_iu64_ht ()}} ,
-    {MTRC_CUMTS     , MTRC_TYPE_IU64 , {.iu64 = new_iu64_ht ()}} ,
-    {MTRC_MAXTS     , MTRC_TYPE_IU64 , {.iu64 = new_iu64_ht ()}} ,
-    {MTRC_METHODS   , MTRC_TYPE_IS32 , {.is32 = new_is32_ht ()}} ,
-    {MTRC_PROTOCOLS , MTRC_TYPE_IS32 , {.is32 = new_is32_ht ()}} ,
-    {MTRC_AGENTS    , MTRC_TYPE_IGSL , {.igsl = new_igsl_ht ()}} ,
+    {MTRC_KEYMAP    , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}} ,
+    {MTRC_ROOTMAP   , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}} ,
+    {MTRC_UNIQMAP   , MTRC_TYPE_U64I32 , {.u64i32 = new_u64i32_ht ()}} ,
+    {MTRC_UNIQHLL   , MTRC_TYPE_IHLL , {.ihll = new_ihll_ht ()}} ,
+    {MTRC_AGENTS    , MTRC_TYPE_IAGS , {.iags = new_iags_ht ()}} ,
     {MTRC_METADATA  , MTRC_TYPE_SU64 , {.su64 = new_su64_ht ()}} ,
   };
   /* *INDENT-ON* */
@@ -254,11 +372,45 @@ init_tables (GModule module)
   for (i = 0; i < n; i++) {
     gkh_storage[module].metrics[i] = metrics[i];
   }
+  gkh_storage[module].nmetrics = n;
 }
 
-/* Initialize hash tables */
-void
-init_storage (void)
+/* Initialize the strings interned across all modules */
+static void
+init_strings (void)
+{
+  memset (&gkh_strings, 0, sizeof (GKHashStrings));
+  gkh_strings.arena = new_arena ();
+  gkh_strings.ids = new_si32_ht ();
+  gkh_strings.cap = GKH_STRINGS_INIT;
+  gkh_strings.strs = xcalloc (gkh_strings.cap, sizeof (char *));
+}
+
+/* Free the strings interned across all modules. Note that the keys of
+ * the ids hash live on the arena. */
+static void
+free_strings (void)
+{
+  LOG_DEBUG (("Interned strings: %u, %llu bytes, %llu bytes saved\n",
+              gkh_strings.size, (unsigned long long) gkh_strings.bytes,
+              (unsigned long long) gkh_strings.saved));
+  if (gkh_strings.ids)
+    log_resizes ("Interned strings", -1, kh_size (gkh_strings.ids),
+                 kh_n_buckets (gkh_strings.ids), presize_strings);
+
+  if (gkh_strings.ids)
+    kh_destroy (si32, gkh_strings.ids);
+  free (gkh_strings.strs);
+  free_arena (gkh_strings.arena);
+  snap_close (gkh_snapshot);
+  gkh_snapshot = NULL;
+  memset (&gkh_strings, 0, sizeof (GKHashStrings));
+}
+
+/* Initialize the hash tables of a state of the storage, i.e., all of
+ * them but the ones shared by every state, see ht_swap_state() */
+static void
+init_state (void)
 {
   GModule module;
   size_t idx = 0;
@@ -266,8 +418,11 @@ init_storage (void)
   /* Hashes used across the whole app (not per module) */
   ht_agent_keys = (khash_t (si32) *) new_si32_ht ();
   ht_agent_vals = (khash_t (is32) *) new_is32_ht ();
-  ht_hostnames = (khash_t (ss32) *) new_ss32_ht ();
   ht_unique_keys = (khash_t (si32) *) new_si32_ht ();
+  ht_unique_hkeys = (khash_t (h128i32) *) new_h128i32_ht ();
+  ht_attr_keys = (khash_t (si32) *) new_si32_ht ();
+  ht_attr_vals = (khash_t (is32) *) new_is32_ht ();
+  init_strings ();
 
   gkh_storage = new_gkhstorage (TOTAL_MODULES);
   FOREACH_MODULE (idx, module_list) {
@@ -275,9 +430,34 @@ init_storage (void)
 
     gkh_storage[module].module = module;
     init_tables (module);
+
+    /* real-time modes load the top hits over and over */
+    if (conf.real_time_html || !conf.output_stdout) {
+      gkh_storage[module].topk_max = get_max_choices ();
+      gkh_storage[module].topk =
+        xcalloc (gkh_storage[module].topk_max, sizeof (int));
+    }
+
+    /* panels keeping only their heavy hitters */
+    if ((gkh_storage[module].hh_max = get_heavy_hitters (module)) > 0) {
+      gkh_storage[module].hh_keys = new_si32_ht ();
+      gkh_storage[module].hh =
+        xcalloc (gkh_storage[module].hh_max, sizeof (int));
+    }
   }
 }
 
+/* Initialize hash tables */
+void
+init_storage (void)
+{
+  /* shared by every state */
+  ht_hostnames = (khash_t (ss32) *) new_ss32_ht ();
+  ht_last_parse = (khash_t (slp) *) new_slp_ht ();
+
+  init_state ();
+}
+
 static void
 free_metric_type (GKHashMetric mtrc)
 {
@@ -298,13 +478,37 @@ free_metric_type (GKHashMetric mtrc)
   case MTRC_TYPE_SS32:
     des_ss32_free (mtrc.ss32);
     break;
-  case MTRC_TYPE_IGSL:
-    des_igsl_free (mtrc.igsl);
+  case MTRC_TYPE_IAGS:
+    des_iags_free (mtrc.iags);
     break;
   case MTRC_TYPE_SU64:
     des_su64_free (mtrc.su64);
     break;
+  case MTRC_TYPE_U64I32:
+    des_u64i32 (mtrc.u64i32);
+    break;
+  case MTRC_TYPE_IHLL:
+    des_ihll_free (mtrc.ihll);
+    break;
+  }
+}
+
+/* Free the hitters of a panel keeping only its heavy hitters. Note
+ * that the keys of the hh_keys hash are the ones of the hitters. */
+static void
+free_hitters (GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  uint32_t i;
+
+  for (i = 0; i < store->hh_size; i++) {
+    free (store->hitters[i].key);
+    free (store->hitters[i].data);
   }
+  if (store->hh_keys)
+    kh_destroy (si32, store->hh_keys);
+  free (store->hitters);
+  free (store->hh);
 }
 
 /* Destroys the hash structure allocated metrics */
@@ -314,22 +518,44 @@ free_metrics (GModule module)
   int i;
   GKHashMetric mtrc;
 
-  for (i = 0; i < GSMTRC_TOTAL; i++) {
+  for (i = 0; i < gkh_storage[module].nmetrics; i++) {
     mtrc = gkh_storage[module].metrics[i];
+    if (mtrc.metric == MTRC_KEYMAP)
+      log_resizes ("Keymap", module, kh_size (mtrc.ii32),
+                   kh_n_buckets (mtrc.ii32),
+                   gkh_storage[module].keymap_presize);
+    else if (mtrc.metric == MTRC_UNIQMAP)
+      log_resizes ("Uniqmap", module, kh_size (mtrc.u64i32),
+                   kh_n_buckets (mtrc.u64i32),
+                   gkh_storage[module].uniqmap_presize);
     free_metric_type (mtrc);
   }
+  spill_free (gkh_storage[module].records);
+  free (gkh_storage[module].topk);
+  free (gkh_storage[module].codes);
+  free_hitters (module);
 }
 
-/* Destroys the hash structure and its content */
-void
-free_storage (void)
+/* Destroys the hash tables of the state of the storage in use, i.e.,
+ * all of them but the ones shared by every state */
+static void
+free_state (void)
 {
   size_t idx = 0;
 
+  if (conf.hash_visitor_keys && ht_unique_hkeys)
+    log_resizes ("Unique keys", -1, kh_size (ht_unique_hkeys),
+                 kh_n_buckets (ht_unique_hkeys), presize_unique_keys);
+  else if (ht_unique_keys)
+    log_resizes ("Unique keys", -1, kh_size (ht_unique_keys),
+                 kh_n_buckets (ht_unique_keys), presize_unique_keys);
+
   des_is32_free (ht_agent_vals);
   des_si32_free (ht_agent_keys);
   des_si32_free (ht_unique_keys);
-  des_ss32_free (ht_hostnames);
+  des_h128i32 (ht_unique_hkeys);
+  des_si32_free (ht_attr_keys);
+  des_is32_free (ht_attr_vals);
 
   if (!gkh_storage)
     return;
@@ -338,6 +564,77 @@ free_storage (void)
     free_metrics (module_list[idx]);
   }
   free (gkh_storage);
+  free_strings ();
+}
+
+/* Destroys the hash structure and its content */
+void
+free_storage (void)
+{
+  des_ss32_free (ht_hostnames);
+  des_slp_free (ht_last_parse);
+  free_state ();
+}
+
+/* Swap the hash tables of the storage in use with the ones of the
+ * given state, e.g., the segment of a time window being filled on the
+ * side. Swapping them again brings back the ones in use. Resolved
+ * hostnames and the high-water marks of the logs are shared by every
+ * state, as the resolver may be inserting hostnames meanwhile. */
+void
+ht_swap_state (GKHashState * state)
+{
+  GKHashState cur;
+
+  cur.storage = gkh_storage;
+  cur.strings = gkh_strings;
+  cur.snapshot = gkh_snapshot;
+  cur.agent_vals = ht_agent_vals;
+  cur.agent_keys = ht_agent_keys;
+  cur.unique_keys = ht_unique_keys;
+  cur.unique_hkeys = ht_unique_hkeys;
+  cur.attr_keys = ht_attr_keys;
+  cur.attr_vals = ht_attr_vals;
+
+  gkh_storage = state->storage;
+  gkh_strings = state->strings;
+  gkh_snapshot = state->snapshot;
+  ht_agent_vals = state->agent_vals;
+  ht_agent_keys = state->agent_keys;
+  ht_unique_keys = state->unique_keys;
+  ht_unique_hkeys = state->unique_hkeys;
+  ht_attr_keys = state->attr_keys;
+  ht_attr_vals = state->attr_vals;
+
+  *state = cur;
+}
+
+/* Allocate a new empty state of the storage, not in use.
+ *
+ * On success the newly allocated state is returned. */
+GKHashState *
+ht_new_state (void)
+{
+  GKHashState *state = xcalloc (1, sizeof (GKHashState));
+
+  ht_swap_state (state);
+  init_state ();
+  ht_swap_state (state);
+
+  return state;
+}
+
+/* Destroys a state of the storage not in use, and its content. */
+void
+ht_free_state (GKHashState * state)
+{
+  if (!state)
+    return;
+
+  ht_swap_state (state);
+  free_state ();
+  ht_swap_state (state);
+  free (state);
 }
 
 /* Given a module and a metric, get the hash table
@@ -351,7 +648,7 @@ get_hash (GModule module, GSMetric metric)
   int i;
   GKHashMetric mtrc;
 
-  for (i = 0; i < GSMTRC_TOTAL; i++) {
+  for (i = 0; i < gkh_storage[module].nmetrics; i++) {
     if (hash != NULL)
       break;
 
@@ -376,12 +673,18 @@ get_hash (GModule module, GSMetric metric)
     case MTRC_TYPE_SS32:
       hash = mtrc.ss32;
       break;
-    case MTRC_TYPE_IGSL:
-      hash = mtrc.igsl;
+    case MTRC_TYPE_IAGS:
+      hash = mtrc.iags;
       break;
     case MTRC_TYPE_SU64:
       hash = mtrc.su64;
       break;
+    case MTRC_TYPE_U64I32:
+      hash = mtrc.u64i32;
+      break;
+    case MTRC_TYPE_IHLL:
+      hash = mtrc.ihll;
+      break;
     }
   }
 
@@ -467,80 +770,6 @@ ins_ss32 (khash_t (ss32) * hash, const char *key, const char *value)
   return 0;
 }
 
-/* Insert an int key and an int value
- * Note: If the key exists, its value is replaced by the given value.
- *
- * On error, -1 is returned.
- * On success 0 is returned */
-static int
-ins_ii32 (khash_t (ii32) * hash, int key, int value)
-{
-  khint_t k;
-  int ret;
-
-  if (!hash)
-    return -1;
-
-  k = kh_put (ii32, hash, key, &ret);
-  if (ret == -1)
-    return -1;
-
-  kh_val (hash, k) = value;
-
-  return 0;
-}
-
-/* Insert an int key and a uint64_t value
- * Note: If the key exists, its value is replaced by the given value.
- *
- * On error, -1 is returned.
- * On success 0 is returned */
-static int
-ins_iu64 (khash_t (iu64) * hash, int key, uint64_t value)
-{
-  khint_t k;
-  int ret;
-
-  if (!hash)
-    return -1;
-
-  k = kh_put (iu64, hash, key, &ret);
-  if (ret == -1)
-    return -1;
-
-  kh_val (hash, k) = value;
-
-  return 0;
-}
-
-/* Increase an int value given an int key.
- * Note: If the key exists, its value is increased by the given inc.
- *
- * On error, -1 is returned.
- * On success the inserted value is returned */
-static int
-inc_ii32 (khash_t (ii32) * hash, int key, int inc)
-{
-  khint_t k;
-  int ret, value = inc;
-
-  if (!hash)
-    return -1;
-
-  k = kh_get (ii32, hash, key);
-  /* key found, increment current value by the given `inc` */
-  if (k != kh_end (hash))
-    value = kh_val (hash, k) + inc;
-
-  k = kh_put (ii32, hash, key, &ret);
-  if (ret == -1)
-    return -1;
-
-  kh_val (hash, k) = value;
-
-  return value;
-}
-
 /* Increase a uint64_t value given a string key.
  *
  * On error, -1 is returned.
@@ -571,96 +800,117 @@ inc_su64 (khash_t (su64) * hash, const char *key, uint64_t inc)
   return 0;
 }
 
-/* Increase a uint64_t value given an int key.
- * Note: If the key exists, its value is increased by the given inc.
+/* Insert a string key and auto increment int value.
  *
  * On error, -1 is returned.
- * On success 0 is returned */
+ * On success the value of the key inserted is returned */
 static int
-inc_iu64 (khash_t (iu64) * hash, int key, uint64_t inc)
+ins_si32_ai (khash_t (si32) * hash, const char *key)
 {
-  khint_t k;
-  int ret;
-  uint64_t value = inc;
+  int size = 0, value = 0;
 
   if (!hash)
     return -1;
 
-  k = kh_get (iu64, hash, key);
-  /* key found, increment current value by the given `inc` */
-  if (k != kh_end (hash))
-    value = (uint64_t) kh_val (hash, k) + inc;
+  size = kh_size (hash);
+  /* the auto increment value starts at SIZE (hash table) + 1 */
+  value = size > 0 ? size + 1 : 1;
 
-  k = kh_put (iu64, hash, key, &ret);
-  if (ret == -1)
+  if (ins_si32 (hash, key, value) == -1)
     return -1;
 
-  kh_val (hash, k) = value;
-
-  return 0;
+  return value;
 }
 
-/* Insert a string key and auto increment int value.
+/* Insert a uint64_t key and auto increment int value.
  *
+ * If the given key exists, 0 is returned.
  * On error, -1 is returned.
  * On success the value of the key inserted is returned */
 static int
-ins_si32_ai (khash_t (si32) * hash, const char *key)
+ins_u64i32_ai (khash_t (u64i32) * hash, uint64_t key)
 {
-  int size = 0, value = 0;
+  khint_t k;
+  int ret, value = 0;
 
   if (!hash)
     return -1;
 
-  size = kh_size (hash);
   /* the auto increment value starts at SIZE (hash table) + 1 */
-  value = size > 0 ? size + 1 : 1;
+  value = kh_size (hash) + 1;
 
-  if (ins_si32 (hash, key, value) == -1)
+  k = kh_put (u64i32, hash, key, &ret);
+  if (ret == -1)
     return -1;
+  /* key exists */
+  if (ret == 0)
+    return 0;
+
+  kh_val (hash, k) = value;
 
   return value;
 }
 
-/* Compare if the given needle is in the haystack
+/* Determine if the given value is in the given agent set, and add it
+ * to the set's index if it wasn't.
  *
- * if equal, 1 is returned, else 0 */
+ * If found, 1 is returned, else 0 is returned. */
 static int
-find_int_key_in_list (void *data, void *needle)
+find_in_agent_set (GAgentSet * set, int value)
 {
-  return (*(int *) data) == (*(int *) needle) ? 1 : 0;
+  int i, ret;
+
+  if (set->index != NULL) {
+    kh_put (iset, set->index, value, &ret);
+    return ret == 0;
+  }
+
+  for (i = 0; i < set->len; ++i) {
+    if (set->keys[i] == value)
+      return 1;
+  }
+
+  /* too large to be searched linearly, index it */
+  if (set->len == GKH_AGENTS_LINEAR) {
+    set->index = kh_init (iset);
+    for (i = 0; i < set->len; ++i)
+      kh_put (iset, set->index, set->keys[i], &ret);
+    kh_put (iset, set->index, value, &ret);
+  }
+
+  return 0;
 }
 
-/* Insert an int key and the corresponding GSLList (Single linked-list) value.
- * Note: If the key exists within the list, the value is not appended.
+/* Insert an int key and the corresponding GAgentSet value.
+ * Note: If the value exists within the set, the value is not appended.
  *
  * On error, -1 is returned.
  * On success 0 is returned */
 static int
-ins_igsl (khash_t (igsl) * hash, int key, int value)
+ins_iags (khash_t (iags) * hash, int key, int value)
 {
+  GAgentSet *set;
   khint_t k;
-  GSLList *list, *match;
   int ret;
 
   if (!hash)
     return -1;
 
-  k = kh_get (igsl, hash, key);
-  /* key found, check if key exists within the list */
-  if (k != kh_end (hash) && (list = kh_val (hash, k))) {
-    if ((match = list_find (list, find_int_key_in_list, &value)))
-      return 0;
-    list = list_insert_prepend (list, int2ptr (value));
-  } else {
-    list = list_create (int2ptr (value));
-  }
-
-  k = kh_put (igsl, hash, key, &ret);
+  k = kh_put (iags, hash, key, &ret);
   if (ret == -1)
     return -1;
 
-  kh_val (hash, k) = list;
+  set = &kh_val (hash, k);
+  if (ret != 0)
+    memset (set, 0, sizeof (GAgentSet));
+  else if (find_in_agent_set (set, value))
+    return 0;
+
+  if (set->len == set->size) {
+    set->size = set->size ? set->size * 2 : 4;
+    set->keys = xrealloc (set->keys, set->size * sizeof (int));
+  }
+  set->keys[set->len++] = value;
 
   return 0;
 }
@@ -685,33 +935,32 @@ get_si32 (khash_t (si32) * hash, const char *key)
   return -1;
 }
 
-/* Get the string value of a given int key.
+/* Get the int value of a given uint64_t key.
  *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-static char *
-get_is32 (khash_t (is32) * hash, int key)
+ * On error, or if key is not found, -1 is returned.
+ * On success the int value for the given key is returned */
+static int
+get_u64i32 (khash_t (u64i32) * hash, uint64_t key)
 {
   khint_t k;
-  char *value = NULL;
 
   if (!hash)
-    return NULL;
+    return -1;
 
-  k = kh_get (is32, hash, key);
+  k = kh_get (u64i32, hash, key);
   /* key found, return current value */
-  if (k != kh_end (hash) && (value = kh_val (hash, k)))
-    return xstrdup (value);
+  if (k != kh_end (hash))
+    return kh_val (hash, k);
 
-  return NULL;
+  return -1;
 }
 
-/* Get the string value of a given string key.
+/* Get the string value of a given int key.
  *
  * On error, NULL is returned.
  * On success the string value for the given key is returned */
 static char *
-get_ss32 (khash_t (ss32) * hash, const char *key)
+get_is32 (khash_t (is32) * hash, int key)
 {
   khint_t k;
   char *value = NULL;
@@ -719,7 +968,7 @@ get_ss32 (khash_t (ss32) * hash, const char *key)
   if (!hash)
     return NULL;
 
-  k = kh_get (ss32, hash, key);
+  k = kh_get (is32, hash, key);
   /* key found, return current value */
   if (k != kh_end (hash) && (value = kh_val (hash, k)))
     return xstrdup (value);
@@ -727,68 +976,53 @@ get_ss32 (khash_t (ss32) * hash, const char *key)
   return NULL;
 }
 
-/* Get the int value of a given int key.
- *
- * If key is not found, 0 is returned.
- * On error, -1 is returned.
- * On success the int value for the given key is returned */
-static int
-get_ii32 (khash_t (ii32) * hash, int key)
-{
-  khint_t k;
-  int value = 0;
-
-  if (!hash)
-    return -1;
-
-  k = kh_get (ii32, hash, key);
-  /* key found, return current value */
-  if (k != kh_end (hash) && (value = kh_val (hash, k)))
-    return value;
-
-  return 0;
-}
-
-/* Get the uint64_t value of a given int key.
+/* Get the string value of a given string key.
  *
- * On error, or if key is not found, 0 is returned.
- * On success the uint64_t value for the given key is returned */
-static uint64_t
-get_iu64 (khash_t (iu64) * hash, int key)
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+static char *
+get_ss32 (khash_t (ss32) * hash, const char *key)
 {
   khint_t k;
-  uint64_t value = 0;
+  char *value = NULL;
 
   if (!hash)
-    return 0;
+    return NULL;
 
-  k = kh_get (iu64, hash, key);
+  k = kh_get (ss32, hash, key);
   /* key found, return current value */
   if (k != kh_end (hash) && (value = kh_val (hash, k)))
-    return value;
+    return xstrdup (value);
 
-  return 0;
+  return NULL;
 }
 
-/* Get the GSLList value of a given int key.
+/* Get a copy of the GAgentSet values of a given int key, the last
+ * one inserted first.
  *
  * On error, or if key is not found, NULL is returned.
- * On success the GSLList value for the given key is returned */
-static GSLList *
-get_igsl (khash_t (igsl) * hash, int key)
+ * On success the values for the given key are returned and len is set
+ * to their number */
+static int *
+get_iags (khash_t (iags) * hash, int key, int *len)
 {
+  GAgentSet *set;
   khint_t k;
-  GSLList *list = NULL;
+  int i, *keys = NULL;
 
   if (!hash)
     return NULL;
 
-  k = kh_get (igsl, hash, key);
-  /* key found, return current value */
-  if (k != kh_end (hash) && (list = kh_val (hash, k)))
-    return list;
+  k = kh_get (iags, hash, key);
+  if (k == kh_end (hash) || (set = &kh_val (hash, k))->len == 0)
+    return NULL;
 
-  return NULL;
+  keys = xmalloc (set->len * sizeof (int));
+  for (i = 0; i < set->len; ++i)
+    keys[i] = set->keys[set->len - i - 1];
+  *len = set->len;
+
+  return keys;
 }
 
 /* Get the uint64_t value of a given string key.
@@ -812,799 +1046,3444 @@ get_su64 (khash_t (su64) * hash, const char *key)
   return 0;
 }
 
-/* Iterate over all the key/value pairs for the given hash structure
- * and set the maximum and minimum values found on an integer key and
- * integer value.
- *
- * Note: This are expensive calls since it has to iterate over all
- * key-value pairs
+/* Get the id of an interned string.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-static void
-get_ii32_min_max (khash_t (ii32) * hash, int *min, int *max)
+ * If the string is not interned, 0 is returned.
+ * On success the string id is returned */
+static uint32_t
+get_string_id (const char *str)
 {
   khint_t k;
-  int curvalue = 0, i;
 
-  for (i = 0, k = kh_begin (hash); k != kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
+  k = kh_get (si32, gkh_strings.ids, str);
+  if (k == kh_end (gkh_strings.ids))
+    return 0;
 
-    curvalue = kh_value (hash, k);
-    if (i++ == 0)
-      *min = curvalue;
-    if (curvalue > *max)
-      *max = curvalue;
-    if (curvalue < *min)
-      *min = curvalue;
-  }
+  return kh_val (gkh_strings.ids, k);
 }
 
-/* Iterate over all the key/value pairs for the given hash structure
- * and set the maximum and minimum values found on an integer key and
- * a uint64_t value.
+/* Intern the given string, unless it's already there. The string is
+ * packed into the strings arena right after the previous one.
  *
- * Note: This are expensive calls since it has to iterate over all
- * key-value pairs
- *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-static void
-get_iu64_min_max (khash_t (iu64) * hash, uint64_t * min, uint64_t * max)
+ * On error, 0 is returned.
+ * On success the string id is returned */
+static uint32_t
+ins_string (const char *str)
 {
+  size_t len = 0;
   khint_t k;
-  uint64_t curvalue = 0;
-  int i;
+  int ret;
+  char *dup = NULL;
 
-  for (i = 0, k = kh_begin (hash); k != kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
+  if ((k = kh_get (si32, gkh_strings.ids, str)) != kh_end (gkh_strings.ids))
+    return kh_val (gkh_strings.ids, k);
 
-    curvalue = kh_value (hash, k);
-    if (i++ == 0)
-      *min = curvalue;
-    if (curvalue > *max)
-      *max = curvalue;
-    if (curvalue < *min)
-      *min = curvalue;
+  if (gkh_strings.size + 1 >= gkh_strings.cap) {
+    gkh_strings.strs = xrealloc (gkh_strings.strs,
+                                 gkh_strings.cap * 2 * sizeof (char *));
+    gkh_strings.cap *= 2;
   }
-}
-
-/* Insert a unique visitor key string (IP/DATE/UA), mapped to an auto
- * incremented value.
- *
- * If the given key exists, its value is returned.
- * On error, -1 is returned.
- * On success the value of the key inserted is returned */
-int
-ht_insert_unique_key (const char *key)
-{
-  int value = -1;
-  khash_t (si32) * hash = ht_unique_keys;
 
-  if (!hash)
-    return -1;
+  len = strlen (str);
+  dup = arena_strpack (gkh_strings.arena, str, len);
+  k = kh_put (si32, gkh_strings.ids, dup, &ret);
+  if (ret == -1)
+    return 0;
 
-  if ((value = get_si32 (hash, key)) != -1)
-    return value;
+  kh_val (gkh_strings.ids, k) = ++gkh_strings.size;
+  gkh_strings.strs[gkh_strings.size] = dup;
+  gkh_strings.bytes += len + 1;
 
-  return ins_si32_ai (hash, key);
+  return gkh_strings.size;
 }
 
-/* Insert a user agent key string, mapped to an auto incremented value.
+/* Intern the given string for a new entry of a store. If it was
+ * already interned, it counts as saved, as the store would have kept
+ * its own copy otherwise.
  *
- * If the given key exists, its value is returned.
- * On error, -1 is returned.
- * On success the value of the key inserted is returned */
-int
-ht_insert_agent_key (const char *key)
+ * On error, 0 is returned.
+ * On success the string id is returned */
+static uint32_t
+ref_string (const char *str)
 {
-  int value = -1;
-  khash_t (si32) * hash = ht_agent_keys;
-
-  if (!hash)
-    return -1;
+  uint32_t id = 0;
 
-  if ((value = get_si32 (hash, key)) != -1)
-    return value;
+  if ((id = get_string_id (str)) != 0) {
+    gkh_strings.saved += strlen (str) + 1;
+    return id;
+  }
 
-  return ins_si32_ai (hash, key);
+  return ins_string (str);
 }
 
-/* Insert a user agent int key, mapped to a user agent string value.
+/* Get an interned string given its id.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_agent_value (int key, const char *value)
+ * If the id is not valid, NULL is returned.
+ * On success the string is returned */
+static const char *
+get_string (uint32_t id)
 {
-  khash_t (is32) * hash = ht_agent_vals;
-
-  if (!hash)
-    return -1;
+  if (id == 0 || id > gkh_strings.size)
+    return NULL;
 
-  return ins_is32 (hash, key, value);
+  return gkh_strings.strs[id];
 }
 
-/* Insert a keymap string key.
+/* Given a module and a data key, get its metrics record, growing the
+ * records of the module if needed.
  *
- * If the given key exists, its value is returned.
- * On error, -1 is returned.
- * On success the value of the key inserted is returned */
-int
-ht_insert_keymap (GModule module, const char *key)
+ * On error, NULL is returned.
+ * On success the record pointer is returned. */
+static GKHashRecord *
+get_record (GModule module, int key)
 {
-  int value = -1;
-  khash_t (si32) * hash = get_hash (module, MTRC_KEYMAP);
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashRecord *recs = NULL;
+  uint32_t size = 0;
 
-  if (!hash)
-    return -1;
+  if (key <= 0)
+    return NULL;
 
-  if ((value = get_si32 (hash, key)) != -1)
-    return value;
+  if ((uint32_t) key >= store->rec_size) {
+    size = store->rec_size > 0 ? store->rec_size : GKH_RECORDS_INIT;
+    while (size <= (uint32_t) key)
+      size *= 2;
+
+    recs = spill_realloc (store->records, size * sizeof (GKHashRecord));
+    if (recs == NULL)
+      FATAL ("Unable to reallocate memory - failed");
+    store->records = recs;
+    memset (store->records + store->rec_size, 0,
+            (size - store->rec_size) * sizeof (GKHashRecord));
+    store->rec_size = size;
+  }
 
-  return ins_si32_ai (hash, key);
+  return &store->records[key];
 }
 
-/* Insert a datamap int key and string value.
+/* Given a module and a data key, find its metrics record.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_datamap (GModule module, int key, const char *value)
+ * If the key has no record, NULL is returned.
+ * On success the record pointer is returned. */
+static GKHashRecord *
+find_record (GModule module, int key)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
+  GKHashStorage *store = &gkh_storage[module];
 
-  if (!hash)
-    return -1;
+  if (key <= 0 || (uint32_t) key >= store->rec_size)
+    return NULL;
 
-  return ins_is32 (hash, key, value);
+  return &store->records[key];
 }
 
-/* Insert a rootmap int key from the keymap store mapped to its string value.
+/* Get the num of buckets a hash table needs to hold the given num of
+ * keys without growing, i.e., keeping it under its upper bound.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_rootmap (GModule module, int key, const char *value)
+ * On success the num of buckets is returned. */
+static khint_t
+get_presize_buckets (uint32_t size)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_ROOTMAP);
-
-  if (!hash)
-    return -1;
-
-  return ins_is32 (hash, key, value);
+  return (khint_t) (size / __ac_HASH_UPPER) + 1;
 }
 
-/* Insert a uniqmap string key.
- *
- * If the given key exists, 0 is returned.
- * On error, -1 is returned.
- * On success the value of the key inserted is returned */
-int
-ht_insert_uniqmap (GModule module, const char *key)
+/* Presize the tables of the given module to hold the estimated num of
+ * data keys and unique visitor keys, i.e., the pairs of a visitor and
+ * a data key, so they don't have to grow while parsing. Panels keeping
+ * only their heavy hitters are bounded already. */
+void
+ht_presize_module (GModule module, uint32_t keys, uint32_t uniq)
 {
-  int value = -1;
-  khash_t (si32) * hash = get_hash (module, MTRC_UNIQMAP);
+  GKHashStorage *store = &gkh_storage[module];
+  khash_t (ii32) * keymap = get_hash (module, MTRC_KEYMAP);
+  khash_t (u64i32) * uniqmap = get_hash (module, MTRC_UNIQMAP);
 
-  if (!hash)
-    return -1;
+  if (store->hh_max > 0)
+    return;
 
-  if ((value = get_si32 (hash, key)) != -1)
-    return 0;
+  if (keymap && keys > 0 &&
+      kh_resize (ii32, keymap, get_presize_buckets (keys)) == 0) {
+    store->keymap_presize = kh_n_buckets (keymap);
+    get_record (module, keys);
+  }
 
-  return ins_si32_ai (hash, key);
+  /* sketches are used instead */
+  if (conf.approx_visitors)
+    return;
+  if (uniqmap && uniq > 0 &&
+      kh_resize (u64i32, uniqmap, get_presize_buckets (uniq)) == 0)
+    store->uniqmap_presize = kh_n_buckets (uniqmap);
 }
 
-/* Insert a data int key mapped to the corresponding int root key.
- *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_root (GModule module, int key, int value)
+/* Presize the tables used across the whole app to hold the estimated
+ * num of unique visitors and interned strings, so they don't have to
+ * grow while parsing. */
+void
+ht_presize_storage (uint32_t visitors, uint32_t strings)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_ROOT);
+  if (strings > 0 && gkh_strings.ids &&
+      kh_resize (si32, gkh_strings.ids, get_presize_buckets (strings)) == 0) {
+    presize_strings = kh_n_buckets (gkh_strings.ids);
+    if (gkh_strings.cap <= strings) {
+      gkh_strings.strs = xrealloc (gkh_strings.strs,
+                                   (strings + 1) * sizeof (char *));
+      gkh_strings.cap = strings + 1;
+    }
+  }
 
-  if (!hash)
-    return -1;
+  if (visitors == 0 || conf.approx_visitors)
+    return;
+  if (conf.hash_visitor_keys && ht_unique_hkeys &&
+      kh_resize (h128i32, ht_unique_hkeys,
+                 get_presize_buckets (visitors)) == 0)
+    presize_unique_keys = kh_n_buckets (ht_unique_hkeys);
+  else if (!conf.hash_visitor_keys && ht_unique_keys &&
+           kh_resize (si32, ht_unique_keys,
+                      get_presize_buckets (visitors)) == 0)
+    presize_unique_keys = kh_n_buckets (ht_unique_keys);
+}
 
-  return ins_ii32 (hash, key, value);
+/* Get the data string of the given data key, heavy hitters keep their
+ * own.
+ *
+ * If the key has no data string, NULL is returned.
+ * On success the string is returned. */
+static const char *
+get_record_data (const GKHashStorage * store, uint32_t key)
+{
+  if (store->hh_keys)
+    return key < store->hh_size ? store->hitters[key].data : NULL;
+  return get_string (store->records[key].data);
 }
 
-/* Insert meta data counters from a string key.
+/* Get the int key of a method or protocol string, inserting it if
+ * it's not there yet.
  *
  * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_meta_data (GModule module, const char *key, uint64_t value)
+ * On success the int key is returned. */
+static int
+ins_attr (const char *value)
 {
-  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+  int key = 0;
 
-  if (!hash)
+  if ((key = get_si32 (ht_attr_keys, value)) != -1)
+    return key;
+
+  if ((key = ins_si32_ai (ht_attr_keys, value)) == -1)
     return -1;
+  ins_is32 (ht_attr_vals, key, value);
 
-  return inc_su64 (hash, key, value);
+  return key;
 }
 
-/* Increases hits counter from an int key.
+/* Get the value of the given metric from a record.
  *
- * On error, -1 is returned.
- * On success the inserted value is returned */
-int
-ht_insert_hits (GModule module, int key, int inc)
+ * On success the value is returned. */
+static uint64_t
+get_record_metric (const GKHashRecord * rec, GSMetric metric)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
-
-  if (!hash)
-    return -1;
-
-  return inc_ii32 (hash, key, inc);
+  switch (metric) {
+  case MTRC_HITS:
+    return rec->hits;
+  case MTRC_VISITORS:
+    return rec->visitors;
+  case MTRC_BW:
+    return rec->bw;
+  case MTRC_CUMTS:
+    return rec->cumts;
+  case MTRC_MAXTS:
+    return rec->maxts;
+  default:
+    return 0;
+  }
 }
 
-/* Increases visitors counter from an int key.
+/* Iterate over all the records in use of a module and set the maximum
+ * and minimum values found on the given metric.
  *
- * On error, -1 is returned.
- * On success the inserted value is returned */
-int
-ht_insert_visitor (GModule module, int key, int inc)
+ * Note: This are expensive calls since it has to iterate over all
+ * records
+ *
+ * If there are no records, no values are set and 0 is returned.
+ * On success the minimum and maximum values are set and the number of
+ * records is returned. */
+static int
+get_records_min_max (GModule module, GSMetric metric, uint64_t * min,
+                     uint64_t * max)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_VISITORS);
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashRecord *rec = NULL;
+  uint64_t curvalue = 0;
+  uint32_t k;
+  int i = 0;
 
-  if (!hash)
-    return -1;
+  for (k = 1; k < store->rec_size; ++k) {
+    rec = &store->records[k];
+    /* not in use, or no visitors counted for it */
+    if (rec->hits == 0 || (metric == MTRC_VISITORS && rec->visitors == 0))
+      continue;
+
+    curvalue = get_record_metric (rec, metric);
+    if (i++ == 0)
+      *min = curvalue;
+    if (curvalue > *max)
+      *max = curvalue;
+    if (curvalue < *min)
+      *min = curvalue;
+  }
 
-  return inc_ii32 (hash, key, inc);
+  return i;
 }
 
-/* Increases bandwidth counter from an int key.
+/* Set the maximum and minimum int values found on the given metric.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_bw (GModule module, int key, uint64_t inc)
+ * If there are no records, no values are set. */
+static void
+get_records_int_min_max (GModule module, GSMetric metric, int *min, int *max)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_BW);
+  uint64_t lmin = *min, lmax = *max;
 
-  if (!hash)
-    return -1;
+  if (get_records_min_max (module, metric, &lmin, &lmax) == 0)
+    return;
 
-  return inc_iu64 (hash, key, inc);
+  *min = (int) lmin;
+  *max = (int) lmax;
 }
 
-/* Increases cumulative time served counter from an int key.
+/* Determine if the record of key a ranks below the record of key b on
+ * the top hits, ties rank by key, i.e., as first seen.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_cumts (GModule module, int key, uint64_t inc)
+ * If it ranks below, 1 is returned, else 0. */
+static int
+topk_below (const GKHashStorage * store, int a, int b)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_CUMTS);
+  int ha = store->records[a].hits, hb = store->records[b].hits;
 
-  if (!hash)
-    return -1;
+  return ha < hb || (ha == hb && a > b);
+}
 
-  return inc_iu64 (hash, key, inc);
+/* Set the given key at the given position of the top hits heap. */
+static void
+topk_set (GKHashStorage * store, int idx, int key)
+{
+  store->topk[idx] = key;
+  store->records[key].topk = idx + 1;
 }
 
-/* Insert the maximum time served counter from an int key.
- * Note: it compares the current value with the given value.
- *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_maxts (GModule module, int key, uint64_t value)
+/* Move the key at the given position of the top hits heap up until its
+ * parent ranks below it. */
+static void
+topk_sift_up (GKHashStorage * store, int idx)
 {
-  uint64_t curvalue = 0;
-  khash_t (iu64) * hash = get_hash (module, MTRC_MAXTS);
+  int key = store->topk[idx], parent;
 
-  if (!hash)
-    return -1;
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (!topk_below (store, key, store->topk[parent]))
+      break;
+    topk_set (store, idx, store->topk[parent]);
+    idx = parent;
+  }
+  topk_set (store, idx, key);
+}
 
-  if ((curvalue = get_iu64 (hash, key)) < value)
-    ins_iu64 (hash, key, value);
+/* Move the key at the given position of the top hits heap down until
+ * it ranks below its children. */
+static void
+topk_sift_down (GKHashStorage * store, int idx)
+{
+  int key = store->topk[idx], child;
 
-  return 0;
+  while ((child = 2 * idx + 1) < store->topk_len) {
+    if (child + 1 < store->topk_len &&
+        topk_below (store, store->topk[child + 1], store->topk[child]))
+      child++;
+    if (!topk_below (store, store->topk[child], key))
+      break;
+    topk_set (store, idx, store->topk[child]);
+    idx = child;
+  }
+  topk_set (store, idx, key);
 }
 
-/* Insert a method given an int key and string value.
- *
- * On error, or if key exists, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_method (GModule module, int key, const char *value)
+/* Keep the top hits heap up to date after the hits of the given key
+ * went up. Hits only go up, so the key either stays on the heap or
+ * replaces the one that ranks last. */
+static void
+topk_update (GModule module, int key)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_METHODS);
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashRecord *rec = &store->records[key];
 
-  if (!hash)
-    return -1;
+  if (store->topk_max <= 0)
+    return;
 
-  return ins_is32 (hash, key, value);
-}
+  /* already there, ranks higher now */
+  if (rec->topk != 0) {
+    topk_sift_down (store, rec->topk - 1);
+    return;
+  }
 
-/* Insert a protocol given an int key and string value.
- *
- * On error, or if key exists, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_protocol (GModule module, int key, const char *value)
-{
-  khash_t (is32) * hash = get_hash (module, MTRC_PROTOCOLS);
+  if (store->topk_len < store->topk_max) {
+    topk_set (store, store->topk_len++, key);
+    topk_sift_up (store, store->topk_len - 1);
+    return;
+  }
 
-  if (!hash)
-    return -1;
+  if (!topk_below (store, store->topk[0], key))
+    return;
 
-  return ins_is32 (hash, key, value);
+  store->records[store->topk[0]].topk = 0;
+  topk_set (store, 0, key);
+  topk_sift_down (store, 0);
 }
 
-/* Insert an agent for a hostname given an int key and int value.
+/* Given a panel keeping only its heavy hitters and a data key, get its
+ * hitter, growing the hitters of the module if needed.
  *
- * On error, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_agent (GModule module, int key, int value)
+ * On success the hitter pointer is returned. */
+static GKHashHitter *
+get_hitter (GKHashStorage * store, int key)
 {
-  khash_t (igsl) * hash = get_hash (module, MTRC_AGENTS);
+  uint32_t size = 0;
 
-  if (!hash)
-    return -1;
+  if ((uint32_t) key >= store->hh_size) {
+    size = store->hh_size > 0 ? store->hh_size : GKH_RECORDS_INIT;
+    while (size <= (uint32_t) key)
+      size *= 2;
+
+    store->hitters = xrealloc (store->hitters, size * sizeof (GKHashHitter));
+    memset (store->hitters + store->hh_size, 0,
+            (size - store->hh_size) * sizeof (GKHashHitter));
+    store->hh_size = size;
+  }
 
-  return ins_igsl (hash, key, value);
+  return &store->hitters[key];
 }
 
-/* Insert an IP hostname mapped to the corresponding hostname.
- *
- * On error, or if key exists, -1 is returned.
- * On success 0 is returned */
-int
-ht_insert_hostname (const char *ip, const char *host)
+/* Set the given key at the given position of the hitters heap. */
+static void
+hh_set (GKHashStorage * store, int idx, int key)
 {
-  khash_t (ss32) * hash = ht_hostnames;
+  store->hh[idx] = key;
+  store->hitters[key].heap = idx + 1;
+}
 
-  if (!hash)
-    return -1;
+/* Move the key at the given position of the hitters heap up until its
+ * parent has no more hits than it. */
+static void
+hh_sift_up (GKHashStorage * store, int idx)
+{
+  int key = store->hh[idx], parent;
 
-  return ins_ss32 (hash, ip, host);
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (store->records[store->hh[parent]].hits <= store->records[key].hits)
+      break;
+    hh_set (store, idx, store->hh[parent]);
+    idx = parent;
+  }
+  hh_set (store, idx, key);
 }
 
-/* Get the number of elements in a datamap.
- *
- * Return -1 if the operation fails, else number of elements. */
-uint32_t
-ht_get_size_datamap (GModule module)
+/* Move the key at the given position of the hitters heap down until
+ * it has no more hits than its children. */
+static void
+hh_sift_down (GKHashStorage * store, int idx)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
+  int key = store->hh[idx], child;
+  int hits = store->records[key].hits;
+
+  while ((child = 2 * idx + 1) < store->hh_len) {
+    if (child + 1 < store->hh_len &&
+        store->records[store->hh[child + 1]].hits <
+        store->records[store->hh[child]].hits)
+      child++;
+    if (store->records[store->hh[child]].hits >= hits)
+      break;
+    hh_set (store, idx, store->hh[child]);
+    idx = child;
+  }
+  hh_set (store, idx, key);
+}
 
-  if (!hash)
-    return 0;
+/* Keep the hitters heap up to date after the hits of the given key
+ * went up, i.e., it moves away from the top of the min-heap. */
+static void
+hh_update (GModule module, int key)
+{
+  GKHashStorage *store = &gkh_storage[module];
 
-  return kh_size (hash);
+  if (!store->hh_keys || (uint32_t) key >= store->hh_size)
+    return;
+
+  if (store->hitters[key].heap != 0)
+    hh_sift_down (store, store->hitters[key].heap - 1);
 }
 
-/* Get the number of elements in a uniqmap.
- *
- * On error, 0 is returned.
- * On success the number of elements in MTRC_UNIQMAP is returned */
-uint32_t
-ht_get_size_uniqmap (GModule module)
+/* Drop the user agents of a host, e.g., once a new host takes over its
+ * data key. */
+static void
+del_agents (GModule module, int key)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_UNIQMAP);
+  khash_t (iags) * hash = get_hash (module, MTRC_AGENTS);
+  GAgentSet *set = NULL;
+  khint_t k;
 
-  if (!hash)
-    return 0;
+  if (!hash || (k = kh_get (iags, hash, key)) == kh_end (hash))
+    return;
 
-  return kh_size (hash);
+  set = &kh_value (hash, k);
+  if (set->index)
+    kh_destroy (iset, set->index);
+  free (set->keys);
+  kh_del (iags, hash, k);
 }
 
-/* Get the string data value of a given int key.
+/* Let a new key take over the data key with the fewest hits on a full
+ * hitters heap. As on Space-Saving, its metrics are kept, so they are
+ * overestimated by at most the hits of the one it replaces, while its
+ * strings and attributes are dropped.
  *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-char *
-ht_get_datamap (GModule module, int key)
+ * On success the data key taken over is returned. */
+static int
+evict_hitter (GModule module)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
+  GKHashStorage *store = &gkh_storage[module];
+  int key = store->hh[0];
+  GKHashHitter *hitter = &store->hitters[key];
+  GKHashRecord *rec = &store->records[key];
+  khint_t k;
 
-  if (!hash)
-    return NULL;
+  k = kh_get (si32, store->hh_keys, hitter->key);
+  if (k != kh_end (store->hh_keys))
+    kh_del (si32, store->hh_keys, k);
+  free (hitter->key);
+  hitter->key = NULL;
 
-  return get_is32 (hash, key);
+  if (hitter->data) {
+    free (hitter->data);
+    hitter->data = NULL;
+    store->data_count--;
+  }
+  rec->root = rec->method = rec->protocol = 0;
+  del_agents (module, key);
+
+  return key;
 }
 
-/* Get the int value from MTRC_KEYMAP given a string key.
+/* Insert a unique visitor key string (IP/DATE/UA), mapped to an auto
+ * incremented value.
  *
+ * If the given key exists, its value is returned.
  * On error, -1 is returned.
- * On success the int value for the given key is returned */
+ * On success the value of the key inserted is returned */
 int
-ht_get_keymap (GModule module, const char *key)
+ht_insert_unique_key (const char *key)
 {
-  khash_t (si32) * hash = get_hash (module, MTRC_KEYMAP);
+  int value = -1;
+  khash_t (si32) * hash = ht_unique_keys;
 
   if (!hash)
     return -1;
 
-  return get_si32 (hash, key);
+  if ((value = get_si32 (hash, key)) != -1)
+    return value;
+
+  return ins_si32_ai (hash, key);
 }
 
-/* Get the int value from MTRC_UNIQMAP given a string key.
+/* Insert a hashed unique visitor key (IP/DATE/UA), mapped to an auto
+ * incremented value.
  *
+ * If the given key exists, its value is returned.
  * On error, -1 is returned.
- * On success the int value for the given key is returned */
+ * On success the value of the key inserted is returned */
 int
-ht_get_uniqmap (GModule module, const char *key)
+ht_insert_unique_hkey (const uint64_t hkey[2])
 {
-  khash_t (si32) * hash = get_hash (module, MTRC_UNIQMAP);
+  khash_t (h128i32) * hash = ht_unique_hkeys;
+  GHashKey128 key;
+  khint_t k;
+  int ret, value = 0;
 
   if (!hash)
     return -1;
 
-  return get_si32 (hash, key);
-}
-
-/* Get the string root from MTRC_ROOTMAP given an int data key.
- *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-char *
-ht_get_root (GModule module, int key)
-{
-  int root_key = 0;
-  khash_t (ii32) * hashroot = get_hash (module, MTRC_ROOT);
-  khash_t (is32) * hashrootmap = get_hash (module, MTRC_ROOTMAP);
+  key.lo = hkey[0];
+  key.hi = hkey[1];
+  /* the auto increment value starts at SIZE (hash table) + 1 */
+  value = kh_size (hash) + 1;
 
-  if (!hashroot || !hashrootmap)
-    return NULL;
+  k = kh_put (h128i32, hash, key, &ret);
+  if (ret == -1)
+    return -1;
+  /* key exists, return current value */
+  if (ret == 0)
+    return kh_val (hash, k);
 
-  /* not found */
-  if ((root_key = get_ii32 (hashroot, key)) == 0)
-    return NULL;
+  kh_val (hash, k) = value;
 
-  return get_is32 (hashrootmap, root_key);
+  return value;
 }
 
-/* Get the int visitors value from MTRC_VISITORS given an int key.
+/* Insert a user agent key string, mapped to an auto incremented value.
  *
- * If key is not found, 0 is returned.
+ * If the given key exists, its value is returned.
  * On error, -1 is returned.
- * On success the int value for the given key is returned */
+ * On success the value of the key inserted is returned */
 int
-ht_get_visitors (GModule module, int key)
+ht_insert_agent_key (const char *key)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_VISITORS);
+  int value = -1;
+  khash_t (si32) * hash = ht_agent_keys;
 
   if (!hash)
     return -1;
 
-  return get_ii32 (hash, key);
+  if ((value = get_si32 (hash, key)) != -1)
+    return value;
+
+  return ins_si32_ai (hash, key);
 }
 
-/* Get the int visitors value from MTRC_VISITORS given an int key.
+/* Insert a user agent int key, mapped to a user agent string value.
  *
- * If key is not found, 0 is returned.
  * On error, -1 is returned.
- * On success the int value for the given key is returned */
+ * On success 0 is returned */
 int
-ht_get_hits (GModule module, int key)
+ht_insert_agent_value (int key, const char *value)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
+  khash_t (is32) * hash = ht_agent_vals;
 
   if (!hash)
     return -1;
 
-  return get_ii32 (hash, key);
+  return ins_is32 (hash, key, value);
 }
 
-/* Get the uint64_t value from MTRC_BW given an int key.
+/* Insert a keymap string key.
  *
- * On error, or if key is not found, 0 is returned.
- * On success the uint64_t value for the given key is returned */
-uint64_t
-ht_get_bw (GModule module, int key)
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_keymap (GModule module, const char *key)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_BW);
+  khash_t (ii32) * hash = get_hash (module, MTRC_KEYMAP);
+  uint32_t id = 0;
+  khint_t k;
+  int ret, value = 0;
 
   if (!hash)
-    return 0;
+    return -1;
 
-  return get_iu64 (hash, key);
-}
+  if ((id = get_string_id (key)) != 0) {
+    k = kh_get (ii32, hash, id);
+    if (k != kh_end (hash))
+      return kh_val (hash, k);
+    gkh_strings.saved += strlen (key) + 1;
+  } else if ((id = ins_string (key)) == 0) {
+    return -1;
+  }
 
-/* Get the uint64_t value from MTRC_CUMTS given an int key.
- *
- * On error, or if key is not found, 0 is returned.
- * On success the uint64_t value for the given key is returned */
-uint64_t
-ht_get_cumts (GModule module, int key)
-{
-  khash_t (iu64) * hash = get_hash (module, MTRC_CUMTS);
+  /* the auto increment value starts at SIZE (hash table) + 1, data keys
+   * kept apart as heavy hitters share the same values */
+  value = kh_size (hash) + 1;
+  if (gkh_storage[module].hh_keys)
+    value += kh_size (gkh_storage[module].hh_keys);
 
-  if (!hash)
-    return 0;
+  k = kh_put (ii32, hash, id, &ret);
+  if (ret == -1)
+    return -1;
+  kh_val (hash, k) = value;
 
-  return get_iu64 (hash, key);
+  return value;
 }
 
-/* Get the uint64_t value from MTRC_MAXTS given an int key.
+/* Insert a data keymap string key. Panels keeping only their heavy
+ * hitters keep up to hh_max keys, past it a new key takes over the one
+ * with the fewest hits.
  *
- * On error, or if key is not found, 0 is returned.
- * On success the uint64_t value for the given key is returned */
-uint64_t
-ht_get_maxts (GModule module, int key)
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_data_keymap (GModule module, const char *key)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_MAXTS);
+  GKHashStorage *store = &gkh_storage[module];
+  khash_t (ii32) * keymap = get_hash (module, MTRC_KEYMAP);
+  khash_t (si32) * hash = store->hh_keys;
+  GKHashHitter *hitter = NULL;
+  khint_t k;
+  int ret, value = 0;
 
   if (!hash)
-    return 0;
+    return ht_insert_keymap (module, key);
 
-  return get_iu64 (hash, key);
-}
+  if ((k = kh_get (si32, hash, key)) != kh_end (hash))
+    return kh_val (hash, k);
 
-/* Get the string value from MTRC_METHODS given an int key.
- *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-char *
-ht_get_method (GModule module, int key)
-{
-  khash_t (is32) * hash = get_hash (module, MTRC_METHODS);
+  if (store->hh_len < store->hh_max) {
+    /* the auto increment value, shared with the keymap */
+    value = kh_size (hash) + kh_size (keymap) + 1;
+    if (!get_record (module, value))
+      return -1;
+    hitter = get_hitter (store, value);
+    hh_set (store, store->hh_len++, value);
+    hh_sift_up (store, store->hh_len - 1);
+  } else {
+    value = evict_hitter (module);
+    hitter = &store->hitters[value];
+  }
 
-  if (!hash)
-    return NULL;
+  hitter->key = xstrdup (key);
+  k = kh_put (si32, hash, hitter->key, &ret);
+  if (ret == -1)
+    return -1;
+  kh_val (hash, k) = value;
 
-  return get_is32 (hash, key);
+  return value;
 }
 
-/* Get the string value from MTRC_PROTOCOLS given an int key.
+/* Insert a keymap string key out of a bounded domain, e.g., status
+ * codes, given its code below GKH_CODES, and whether it's a data key.
+ * The values are kept by code, and thus the string is only hashed the
+ * first time. Data keys of panels keeping only their heavy hitters may
+ * be taken over, so they are never kept.
  *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-char *
-ht_get_protocol (GModule module, int key)
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_code_keymap (GModule module, int code, const char *key, int data)
 {
-  khash_t (is32) * hash = get_hash (module, MTRC_PROTOCOLS);
+  GKHashStorage *store = &gkh_storage[module];
+  int value = 0;
 
-  if (!hash)
-    return NULL;
+  if (data && store->hh_keys)
+    return ht_insert_data_keymap (module, key);
+  if (code <= 0 || code >= GKH_CODES)
+    return ht_insert_keymap (module, key);
 
-  return get_is32 (hash, key);
+  if (store->codes == NULL)
+    store->codes = xcalloc (GKH_CODES, sizeof (int));
+  if (store->codes[code] > 0)
+    return store->codes[code];
+
+  if ((value = ht_insert_keymap (module, key)) > 0)
+    store->codes[code] = value;
+
+  return value;
 }
 
-/* Get the string value from ht_hostnames given a string key (IP).
+/* Insert a datamap int key and string value.
  *
- * On error, NULL is returned.
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_datamap (GModule module, int key, const char *value)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashRecord *rec = get_record (module, key);
+  GKHashHitter *hitter = NULL;
+
+  if (rec && store->hh_keys) {
+    /* only the first one is kept */
+    hitter = get_hitter (store, key);
+    if (hitter->data)
+      return -1;
+    hitter->data = xstrdup (value);
+    store->data_count++;
+    return 0;
+  }
+
+  /* only the first one is kept */
+  if (!rec || rec->data != 0)
+    return -1;
+
+  if ((rec->data = ref_string (value)) == 0)
+    return -1;
+  store->data_count++;
+
+  return 0;
+}
+
+/* Insert a rootmap int key from the keymap store mapped to its string value.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_rootmap (GModule module, int key, const char *value)
+{
+  khash_t (ii32) * hash = get_hash (module, MTRC_ROOTMAP);
+  uint32_t id = 0;
+  khint_t k;
+  int ret;
+
+  if (!hash)
+    return -1;
+
+  /* only the first one is kept */
+  if (kh_get (ii32, hash, key) != kh_end (hash))
+    return -1;
+
+  if ((id = ref_string (value)) == 0)
+    return -1;
+
+  k = kh_put (ii32, hash, key, &ret);
+  if (ret == -1)
+    return -1;
+  kh_val (hash, k) = id;
+
+  return 0;
+}
+
+/* Insert a uniqmap uint64_t key.
+ *
+ * If the given key exists, 0 is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_uniqmap (GModule module, uint64_t key)
+{
+  khash_t (u64i32) * hash = get_hash (module, MTRC_UNIQMAP);
+
+  if (!hash)
+    return -1;
+
+  return ins_u64i32_ai (hash, key);
+}
+
+/* Add the hash of a unique visitor to the sketch of an int key.
+ *
+ * On error, -1 is returned.
+ * On success the growth of the estimated unique visitors is returned */
+int
+ht_insert_uniq_hll (GModule module, int key, uint64_t hash)
+{
+  khash_t (ihll) * ht = get_hash (module, MTRC_UNIQHLL);
+  khint_t k;
+  int ret;
+
+  if (!ht)
+    return -1;
+
+  k = kh_put (ihll, ht, key, &ret);
+  if (ret == -1)
+    return -1;
+  if (ret != 0)
+    memset (&kh_val (ht, k), 0, sizeof (GHLL));
+
+  if (!hll_add (&kh_val (ht, k), hash))
+    return 0;
+
+  return hll_report (&kh_val (ht, k));
+}
+
+/* Insert a data int key mapped to the corresponding int root key.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_root (GModule module, int key, int value)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  rec->root = value;
+
+  return 0;
+}
+
+/* Insert meta data counters from a string key.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_meta_data (GModule module, const char *key, uint64_t value)
+{
+  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+
+  if (!hash)
+    return -1;
+
+  return inc_su64 (hash, key, value);
+}
+
+/* Increases hits counter from an int key.
+ *
+ * On error, -1 is returned.
+ * On success the inserted value is returned */
+int
+ht_insert_hits (GModule module, int key, int inc)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  /* first hit, the record is now in use */
+  if (rec->hits == 0)
+    gkh_storage[module].rec_count++;
+  rec->hits += inc;
+  topk_update (module, key);
+  hh_update (module, key);
+
+  return rec->hits;
+}
+
+/* Increases visitors counter from an int key.
+ *
+ * On error, -1 is returned.
+ * On success the inserted value is returned */
+int
+ht_insert_visitor (GModule module, int key, int inc)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  rec->visitors += inc;
+
+  return rec->visitors;
+}
+
+/* Increases bandwidth counter from an int key.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_bw (GModule module, int key, uint64_t inc)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  rec->bw += inc;
+
+  return 0;
+}
+
+/* Increases cumulative time served counter from an int key.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_cumts (GModule module, int key, uint64_t inc)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  rec->cumts += inc;
+
+  return 0;
+}
+
+/* Insert the maximum time served counter from an int key.
+ * Note: it compares the current value with the given value.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_maxts (GModule module, int key, uint64_t value)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  if (!rec)
+    return -1;
+
+  if (rec->maxts < value)
+    rec->maxts = value;
+
+  return 0;
+}
+
+/* Increase at once the hits, visitors, bandwidth and time served
+ * metrics a log line adds to the given data key, along with the totals
+ * of the module. Visitors are only counted if visitor is set.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_metrics (GModule module, int key, int visitor, uint64_t bw,
+                   uint64_t ts)
+{
+  khash_t (su64) * meta = get_hash (module, MTRC_METADATA);
+  GKHashRecord *rec = get_record (module, key);
+
+  if (meta) {
+    inc_su64 (meta, "hits", 1);
+    if (visitor)
+      inc_su64 (meta, "visitors", 1);
+    inc_su64 (meta, "bytes", bw);
+    inc_su64 (meta, "cumts", ts);
+    inc_su64 (meta, "maxts", ts);
+  }
+
+  if (!rec)
+    return -1;
+
+  /* first hit, the record is now in use */
+  if (rec->hits == 0)
+    gkh_storage[module].rec_count++;
+  rec->hits++;
+  topk_update (module, key);
+  hh_update (module, key);
+
+  if (visitor)
+    rec->visitors++;
+  rec->bw += bw;
+  rec->cumts += ts;
+  if (rec->maxts < ts)
+    rec->maxts = ts;
+
+  return 0;
+}
+
+/* Insert a method given an int key and string value.
+ *
+ * On error, or if key exists, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_method (GModule module, int key, const char *value)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  /* only the first one is kept */
+  if (!rec || rec->method != 0)
+    return -1;
+
+  if ((rec->method = ins_attr (value)) == -1) {
+    rec->method = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Insert a protocol given an int key and string value.
+ *
+ * On error, or if key exists, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_protocol (GModule module, int key, const char *value)
+{
+  GKHashRecord *rec = get_record (module, key);
+
+  /* only the first one is kept */
+  if (!rec || rec->protocol != 0)
+    return -1;
+
+  if ((rec->protocol = ins_attr (value)) == -1) {
+    rec->protocol = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Insert an agent for a hostname given an int key and int value.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_agent (GModule module, int key, int value)
+{
+  khash_t (iags) * hash = get_hash (module, MTRC_AGENTS);
+
+  if (!hash)
+    return -1;
+
+  return ins_iags (hash, key, value);
+}
+
+/* Insert an IP hostname mapped to the corresponding hostname.
+ *
+ * On error, or if key exists, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_hostname (const char *ip, const char *host)
+{
+  khash_t (ss32) * hash = ht_hostnames;
+
+  if (!hash)
+    return -1;
+
+  return ins_ss32 (hash, ip, host);
+}
+
+/* Insert or replace the high-water mark of the log file identified by
+ * the given key.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_last_parse (const char *key, const GLastParse * lp)
+{
+  khash_t (slp) * hash = ht_last_parse;
+  khint_t k;
+  int ret;
+  char *dupkey = NULL;
+
+  if (!hash)
+    return -1;
+
+  if ((k = kh_get (slp, hash, key)) == kh_end (hash)) {
+    dupkey = xstrdup (key);
+    k = kh_put (slp, hash, dupkey, &ret);
+    if (ret == -1) {
+      free (dupkey);
+      return -1;
+    }
+  }
+  kh_val (hash, k) = *lp;
+
+  return 0;
+}
+
+/* Get the number of elements in a datamap.
+ *
+ * Return -1 if the operation fails, else number of elements. */
+uint32_t
+ht_get_size_datamap (GModule module)
+{
+  return gkh_storage[module].data_count;
+}
+
+/* Get the number of elements in a uniqmap.
+ *
+ * On error, 0 is returned.
+ * On success the number of elements in MTRC_UNIQMAP is returned */
+uint32_t
+ht_get_size_uniqmap (GModule module)
+{
+  khash_t (u64i32) * hash = get_hash (module, MTRC_UNIQMAP);
+
+  if (!hash)
+    return 0;
+
+  return kh_size (hash);
+}
+
+/* Get the string data value of a given int key.
+ *
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+char *
+ht_get_datamap (GModule module, int key)
+{
+  const char *value = NULL;
+
+  if (!find_record (module, key))
+    return NULL;
+  if (!(value = get_record_data (&gkh_storage[module], key)))
+    return NULL;
+
+  return xstrdup (value);
+}
+
+/* Get the int value from MTRC_KEYMAP given a string key.
+ *
+ * On error, -1 is returned.
+ * On success the int value for the given key is returned */
+int
+ht_get_keymap (GModule module, const char *key)
+{
+  khash_t (ii32) * hash = get_hash (module, MTRC_KEYMAP);
+  khash_t (si32) * hh_keys = gkh_storage[module].hh_keys;
+  uint32_t id = 0;
+  khint_t k;
+
+  /* data keys kept apart as heavy hitters */
+  if (hh_keys && (k = kh_get (si32, hh_keys, key)) != kh_end (hh_keys))
+    return kh_val (hh_keys, k);
+
+  if (!hash || (id = get_string_id (key)) == 0)
+    return -1;
+
+  k = kh_get (ii32, hash, id);
+  if (k == kh_end (hash))
+    return -1;
+
+  return kh_val (hash, k);
+}
+
+/* Get the int value from MTRC_UNIQMAP given a uint64_t key.
+ *
+ * On error, -1 is returned.
+ * On success the int value for the given key is returned */
+int
+ht_get_uniqmap (GModule module, uint64_t key)
+{
+  khash_t (u64i32) * hash = get_hash (module, MTRC_UNIQMAP);
+
+  if (!hash)
+    return -1;
+
+  return get_u64i32 (hash, key);
+}
+
+/* Get the string root from MTRC_ROOTMAP given an int data key.
+ *
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+char *
+ht_get_root (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+  khash_t (ii32) * hashrootmap = get_hash (module, MTRC_ROOTMAP);
+  const char *value = NULL;
+  khint_t k;
+
+  if (!hashrootmap)
+    return NULL;
+
+  /* not found */
+  if (!rec || rec->root == 0)
+    return NULL;
+
+  k = kh_get (ii32, hashrootmap, rec->root);
+  if (k == kh_end (hashrootmap))
+    return NULL;
+
+  if (!(value = get_string (kh_val (hashrootmap, k))))
+    return NULL;
+
+  return xstrdup (value);
+}
+
+/* Get the root key from MTRC_ROOT given an int data key, i.e., the key
+ * of its root on the keymap.
+ *
+ * If the key has no root, 0 is returned.
+ * On success the root key is returned. */
+int
+ht_get_root_key (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  return rec ? rec->root : 0;
+}
+
+/* Get the int visitors value from MTRC_VISITORS given an int key.
+ *
+ * If key is not found, 0 is returned.
+ * On error, -1 is returned.
+ * On success the int value for the given key is returned */
+int
+ht_get_visitors (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec)
+    return 0;
+
+  return rec->visitors;
+}
+
+/* Get the max overestimation of the hits of any data key of a panel
+ * keeping only its heavy hitters, i.e., the hits of the one ranking
+ * last once keys are taken over.
+ *
+ * If all keys are kept, or there's still room for new ones, 0 is
+ * returned.
+ * On success the max overestimation is returned */
+int
+ht_get_hitters_error (GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+
+  if (!store->hh_keys || store->hh_len < store->hh_max)
+    return 0;
+
+  return store->records[store->hh[0]].hits;
+}
+
+/* Get the int visitors value from MTRC_VISITORS given an int key.
+ *
+ * If key is not found, 0 is returned.
+ * On error, -1 is returned.
+ * On success the int value for the given key is returned */
+int
+ht_get_hits (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec)
+    return 0;
+
+  return rec->hits;
+}
+
+/* Get the uint64_t value from MTRC_BW given an int key.
+ *
+ * On error, or if key is not found, 0 is returned.
+ * On success the uint64_t value for the given key is returned */
+uint64_t
+ht_get_bw (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec)
+    return 0;
+
+  return rec->bw;
+}
+
+/* Get the uint64_t value from MTRC_CUMTS given an int key.
+ *
+ * On error, or if key is not found, 0 is returned.
+ * On success the uint64_t value for the given key is returned */
+uint64_t
+ht_get_cumts (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec)
+    return 0;
+
+  return rec->cumts;
+}
+
+/* Get the uint64_t value from MTRC_MAXTS given an int key.
+ *
+ * On error, or if key is not found, 0 is returned.
+ * On success the uint64_t value for the given key is returned */
+uint64_t
+ht_get_maxts (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec)
+    return 0;
+
+  return rec->maxts;
+}
+
+/* Get the string value from MTRC_METHODS given an int key.
+ *
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+char *
+ht_get_method (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec || rec->method == 0)
+    return NULL;
+
+  return get_is32 (ht_attr_vals, rec->method);
+}
+
+/* Get the string value from MTRC_PROTOCOLS given an int key.
+ *
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+char *
+ht_get_protocol (GModule module, int key)
+{
+  GKHashRecord *rec = find_record (module, key);
+
+  if (!rec || rec->protocol == 0)
+    return NULL;
+
+  return get_is32 (ht_attr_vals, rec->protocol);
+}
+
+/* Get the string value from ht_hostnames given a string key (IP).
+ *
+ * On error, NULL is returned.
  * On success the string value for the given key is returned */
 char *
 ht_get_hostname (const char *host)
 {
-  khash_t (ss32) * hash = ht_hostnames;
+  khash_t (ss32) * hash = ht_hostnames;
+
+  if (!hash)
+    return NULL;
+
+  return get_ss32 (hash, host);
+}
+
+/* Get the high-water mark of the log file identified by the given key.
+ *
+ * On error, or if key is not found, 1 is returned.
+ * On success, 0 is returned and the mark is copied into lp. */
+int
+ht_get_last_parse (const char *key, GLastParse * lp)
+{
+  khash_t (slp) * hash = ht_last_parse;
+  khint_t k;
+
+  if (!hash)
+    return 1;
+
+  if ((k = kh_get (slp, hash, key)) == kh_end (hash))
+    return 1;
+  *lp = kh_val (hash, k);
+
+  return 0;
+}
+
+/* Get the string value from ht_agent_vals (user agent) given an int key.
+ *
+ * On error, NULL is returned.
+ * On success the string value for the given key is returned */
+char *
+ht_get_host_agent_val (int key)
+{
+  khash_t (is32) * hash = ht_agent_vals;
+
+  if (!hash)
+    return NULL;
+
+  return get_is32 (hash, key);
+}
+
+/* Get the user agent keys from MTRC_AGENTS given an int key, the last
+ * one seen first.
+ *
+ * On error, or if key is not found, NULL is returned.
+ * On success the agent keys are returned and len is set to their
+ * number. The caller is responsible for freeing them. */
+int *
+ht_get_host_agents (GModule module, int key, int *len)
+{
+  khash_t (iags) * hash = get_hash (module, MTRC_AGENTS);
+
+  return get_iags (hash, key, len);
+}
+
+/* Get the meta data uint64_t from MTRC_METADATA given a string key.
+ *
+ * On error, or if key is not found, 0 is returned.
+ * On success the uint64_t value for the given key is returned */
+uint64_t
+ht_get_meta_data (GModule module, const char *key)
+{
+  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+
+  return get_su64 (hash, key);
+}
+
+/* Set the maximum and minimum values found on an integer key and
+ * integer value found on the MTRC_VISITORS hash structure.
+ *
+ * If the hash structure is empty, no values are set.
+ * On success the minimum and maximum values are set. */
+void
+ht_get_hits_min_max (GModule module, int *min, int *max)
+{
+  get_records_int_min_max (module, MTRC_HITS, min, max);
+}
+
+/* Set the maximum and minimum values found on an integer key and
+ * integer value found on the MTRC_VISITORS hash structure.
+ *
+ * If the hash structure is empty, no values are set.
+ * On success the minimum and maximum values are set. */
+void
+ht_get_visitors_min_max (GModule module, int *min, int *max)
+{
+  get_records_int_min_max (module, MTRC_VISITORS, min, max);
+}
+
+/* Set the maximum and minimum values found on an integer key and
+ * a uint64_t value found on the MTRC_BW hash structure.
+ *
+ * If the hash structure is empty, no values are set.
+ * On success the minimum and maximum values are set. */
+void
+ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max)
+{
+  get_records_min_max (module, MTRC_BW, min, max);
+}
+
+/* Set the maximum and minimum values found on an integer key and
+ * a uint64_t value found on the MTRC_CUMTS hash structure.
+ *
+ * If the hash structure is empty, no values are set.
+ * On success the minimum and maximum values are set. */
+void
+ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max)
+{
+  get_records_min_max (module, MTRC_CUMTS, min, max);
+}
+
+/* Set the maximum and minimum values found on an integer key and
+ * a uint64_t value found on the MTRC_MAXTS hash structure.
+ *
+ * If the hash structure is empty, no values are set.
+ * On success the minimum and maximum values are set. */
+void
+ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max)
+{
+  get_records_min_max (module, MTRC_MAXTS, min, max);
+}
+
+/* Get the bytes taken by the given num of buckets of a hash, i.e., its
+ * keys, values and flags.
+ *
+ * The num of bytes is returned. */
+static uint64_t
+get_bucket_bytes (khint_t n_buckets, size_t key, size_t val)
+{
+  if (n_buckets == 0)
+    return 0;
+  return (uint64_t) n_buckets * (key + val) +
+    (uint64_t) __ac_fsize (n_buckets) * sizeof (khint32_t);
+}
+
+/* Get the bytes taken by the string keys of a string key hash. */
+static uint64_t
+get_si32_key_bytes (khash_t (si32) * hash)
+{
+  uint64_t bytes = 0;
+  khint_t k;
+
+  if (!hash)
+    return 0;
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (kh_exist (hash, k))
+      bytes += strlen (kh_key (hash, k)) + 1;
+  }
+
+  return bytes;
+}
+
+/* Get the bytes taken by the string values of an int key hash. */
+static uint64_t
+get_is32_val_bytes (khash_t (is32) * hash)
+{
+  uint64_t bytes = 0;
+  khint_t k;
+
+  if (!hash)
+    return 0;
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (kh_exist (hash, k))
+      bytes += strlen (kh_val (hash, k)) + 1;
+  }
+
+  return bytes;
+}
+
+/* Add the memory taken by the agent sets of a module to the given
+ * usage. */
+static void
+add_iags_mem_usage (khash_t (iags) * hash, GSMemUsage * mem)
+{
+  GAgentSet *set = NULL;
+  khint_t k;
+
+  mem->buckets += get_bucket_bytes (kh_n_buckets (hash),
+                                    sizeof (*hash->keys), sizeof (*hash->vals));
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    set = &kh_val (hash, k);
+    mem->owned += (uint64_t) set->size * sizeof (int);
+    if (set->index)
+      mem->owned += get_bucket_bytes (kh_n_buckets (set->index),
+                                      sizeof (*set->index->keys), 0);
+  }
+}
+
+/* Add the memory taken by the unique visitors sketches of a module to
+ * the given usage. */
+static void
+add_ihll_mem_usage (khash_t (ihll) * hash, GSMemUsage * mem)
+{
+  GHLL *hll = NULL;
+  khint_t k;
+
+  mem->buckets += get_bucket_bytes (kh_n_buckets (hash),
+                                    sizeof (*hash->keys), sizeof (*hash->vals));
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    hll = &kh_val (hash, k);
+    mem->owned += (uint64_t) hll->size * sizeof (uint32_t);
+    if (hll->regs)
+      mem->owned += HLL_REGISTERS;
+  }
+}
+
+/* Add the memory taken by the keys a panel keeping only its heavy
+ * hitters owns to the given usage, i.e., their keymap or datamap
+ * strings. */
+static void
+add_hitters_mem_usage (const GKHashStorage * store, GSMetric metric,
+                       GSMemUsage * mem)
+{
+  const char *str = NULL;
+  uint32_t i;
+
+  if (!store->hh_keys)
+    return;
+
+  if (metric == MTRC_KEYMAP) {
+    mem->buckets += get_bucket_bytes (kh_n_buckets (store->hh_keys),
+                                      sizeof (*store->hh_keys->keys),
+                                      sizeof (*store->hh_keys->vals));
+    mem->buckets += (uint64_t) store->hh_size * sizeof (GKHashHitter);
+    mem->buckets += (uint64_t) store->hh_max * sizeof (int);
+  }
+  for (i = 0; i < store->hh_size; i++) {
+    str = metric == MTRC_KEYMAP ? store->hitters[i].key :
+      store->hitters[i].data;
+    if (str)
+      mem->owned += strlen (str) + 1;
+  }
+}
+
+/* Get the num of bytes each record takes for the given metric.
+ *
+ * If the metric is not kept on the records, 0 is returned.
+ * On success, the num of bytes is returned. */
+static size_t
+get_record_metric_size (GSMetric metric)
+{
+  switch (metric) {
+  case MTRC_DATAMAP:
+    return sizeof (uint32_t);
+  case MTRC_HITS:
+    /* along with its position on the top hits heap */
+    return sizeof (int) * 2;
+  case MTRC_ROOT:
+  case MTRC_VISITORS:
+  case MTRC_METHODS:
+  case MTRC_PROTOCOLS:
+    return sizeof (int);
+  case MTRC_BW:
+  case MTRC_CUMTS:
+  case MTRC_MAXTS:
+    return sizeof (uint64_t);
+  default:
+    return 0;
+  }
+}
+
+/* Set the memory taken by the given metric of a module, i.e., the
+ * buckets of its hash table or its share of the records, and the bytes
+ * owned by its entries, e.g., strings, agent sets or sketches. Strings
+ * interned across all modules are accounted by ht_get_mem_shared().
+ *
+ * On success the memory usage is set. */
+void
+ht_get_mem_usage (GModule module, GSMetric metric, GSMemUsage * mem)
+{
+  GKHashStorage *store = NULL;
+  khash_t (ii32) * ii32 = NULL;
+  khash_t (u64i32) * u64i32 = NULL;
+  khash_t (su64) * su64 = NULL;
+  void *hash = NULL;
+
+  memset (mem, 0, sizeof (GSMemUsage));
+  if (!gkh_storage)
+    return;
+
+  store = &gkh_storage[module];
+  mem->buckets = (uint64_t) store->rec_size * get_record_metric_size (metric);
+  if (metric == MTRC_HITS)
+    mem->buckets += (uint64_t) store->topk_max * sizeof (int);
+  if (metric == MTRC_KEYMAP || metric == MTRC_DATAMAP)
+    add_hitters_mem_usage (store, metric, mem);
+
+  if (!(hash = get_hash (module, metric)))
+    return;
+
+  switch (metric) {
+  case MTRC_KEYMAP:
+  case MTRC_ROOTMAP:
+    ii32 = hash;
+    mem->buckets += get_bucket_bytes (kh_n_buckets (ii32),
+                                      sizeof (*ii32->keys),
+                                      sizeof (*ii32->vals));
+    break;
+  case MTRC_UNIQMAP:
+    u64i32 = hash;
+    mem->buckets += get_bucket_bytes (kh_n_buckets (u64i32),
+                                      sizeof (*u64i32->keys),
+                                      sizeof (*u64i32->vals));
+    break;
+  case MTRC_UNIQHLL:
+    add_ihll_mem_usage (hash, mem);
+    break;
+  case MTRC_AGENTS:
+    add_iags_mem_usage (hash, mem);
+    break;
+  case MTRC_METADATA:
+    su64 = hash;
+    mem->buckets += get_bucket_bytes (kh_n_buckets (su64),
+                                      sizeof (*su64->keys),
+                                      sizeof (*su64->vals));
+    break;
+  default:
+    break;
+  }
+}
+
+/* Add the bytes taken by the buckets of the given hash, if any, to the
+ * memory usage in scope */
+#define HT_MEM_BUCKETS(h)                                                    \
+  do {                                                                       \
+    if (h)                                                                   \
+      mem->buckets += get_bucket_bytes (kh_n_buckets (h),                    \
+                                        sizeof (*(h)->keys),                 \
+                                        sizeof (*(h)->vals));                \
+  } while (0)
+
+/* Set the memory taken by the tables used across the whole app, i.e.,
+ * the interned strings, unique visitor keys, user agents, methods,
+ * protocols, hostnames and the last parsed lines. Note that resolved
+ * hostnames are inserted under the resolver's lock.
+ *
+ * On success the memory usage is set. */
+void
+ht_get_mem_shared (GSMemUsage * mem)
+{
+  khint_t k;
+
+  memset (mem, 0, sizeof (GSMemUsage));
+
+  HT_MEM_BUCKETS (gkh_strings.ids);
+  HT_MEM_BUCKETS (ht_agent_keys);
+  HT_MEM_BUCKETS (ht_agent_vals);
+  HT_MEM_BUCKETS (ht_unique_keys);
+  HT_MEM_BUCKETS (ht_unique_hkeys);
+  HT_MEM_BUCKETS (ht_attr_keys);
+  HT_MEM_BUCKETS (ht_attr_vals);
+  HT_MEM_BUCKETS (ht_hostnames);
+  HT_MEM_BUCKETS (ht_last_parse);
+#undef HT_MEM_BUCKETS
+
+  mem->buckets += (uint64_t) gkh_strings.cap * sizeof (char *);
+  mem->owned += gkh_strings.bytes;
+  mem->owned += get_si32_key_bytes (ht_agent_keys);
+  mem->owned += get_is32_val_bytes (ht_agent_vals);
+  mem->owned += get_si32_key_bytes (ht_unique_keys);
+  mem->owned += get_si32_key_bytes (ht_attr_keys);
+  mem->owned += get_is32_val_bytes (ht_attr_vals);
+
+  for (k = 0; ht_hostnames && k < kh_end (ht_hostnames); ++k) {
+    if (!kh_exist (ht_hostnames, k))
+      continue;
+    mem->owned += strlen (kh_key (ht_hostnames, k)) + 1;
+    mem->owned += strlen (kh_val (ht_hostnames, k)) + 1;
+  }
+  for (k = 0; ht_last_parse && k < kh_end (ht_last_parse); ++k) {
+    if (kh_exist (ht_last_parse, k))
+      mem->owned += strlen (kh_key (ht_last_parse, k)) + 1;
+  }
+}
+
+/* A wrapper to initialize a raw data structure.
+ *
+ * On success a GRawData structure is returned. */
+static GRawData *
+init_new_raw_data (GModule module, uint32_t ht_size)
+{
+  GRawData *raw_data;
+
+  raw_data = new_grawdata ();
+  raw_data->idx = 0;
+  raw_data->module = module;
+  raw_data->size = ht_size;
+  raw_data->items = new_grawdata_item (ht_size);
+
+  return raw_data;
+}
+
+/* Store the data keys and hits of the records in use into raw_data and
+ * sorts the hits (numeric) value, if requested.
+ *
+ * On error, NULL is returned.
+ * On success the GRawData is returned */
+static GRawData *
+parse_raw_num_data (GModule module, int sort)
+{
+  GRawData *raw_data;
+  GKHashStorage *store = &gkh_storage[module];
+  uint32_t key;
+  int i;
+
+  /* real-time modes, only the top hits are loaded */
+  if (sort && store->topk_max > 0) {
+    raw_data = init_new_raw_data (module, store->topk_len);
+    raw_data->size = store->rec_count;
+    raw_data->type = INTEGER;
+    for (i = 0; i < store->topk_len; ++i) {
+      key = store->topk[i];
+      raw_data->items[i].key = key;
+      raw_data->items[i].value.ivalue = store->records[key].hits;
+    }
+    raw_data->idx = store->topk_len;
+    sort_raw_num_data (raw_data, raw_data->idx);
+
+    return raw_data;
+  }
+
+  raw_data = init_new_raw_data (module, store->rec_count);
+  raw_data->type = INTEGER;
+  for (key = 1; key < store->rec_size; ++key) {
+    if (store->records[key].hits == 0)
+      continue;
+
+    raw_data->items[raw_data->idx].key = key;
+    raw_data->items[raw_data->idx].value.ivalue = store->records[key].hits;
+    raw_data->idx++;
+  }
+
+  if (sort)
+    sort_raw_num_data (raw_data, raw_data->idx);
+
+  return raw_data;
+}
+
+/* Store the data keys and strings of the records into raw_data and
+ * sorts the data (string) value, if requested.
+ *
+ * On error, NULL is returned.
+ * On success the GRawData is returned */
+static GRawData *
+parse_raw_str_data (GModule module, int sort)
+{
+  GRawData *raw_data;
+  GKHashStorage *store = &gkh_storage[module];
+  const char *data = NULL;
+  uint32_t key;
+
+  raw_data = init_new_raw_data (module, store->data_count);
+  raw_data->type = STRING;
+  for (key = 1; key < store->rec_size; ++key) {
+    if ((data = get_record_data (store, key)) == NULL)
+      continue;
+
+    raw_data->items[raw_data->idx].key = key;
+    raw_data->items[raw_data->idx].value.svalue = (char *) data;
+    raw_data->idx++;
+  }
+
+  if (sort)
+    sort_raw_str_data (raw_data, raw_data->idx);
+
+  return raw_data;
+}
+
+/* Load the raw data of the given data keys only, e.g., the ones that
+ * changed since the holder was loaded, into our GRawData structure.
+ * Unused keys are skipped, items are left unsorted.
+ *
+ * On success the GRawData is returned, its size is the one of the
+ * whole store, as given by parse_raw_data(). */
+GRawData *
+parse_raw_keys_data (GModule module, const int *keys, int len)
+{
+  GRawData *raw_data;
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashRecord *rec = NULL;
+  const char *data = NULL;
+  uint32_t key;
+  int i;
+
+  raw_data = init_new_raw_data (module, len);
+  raw_data->type = module == VISITORS ? STRING : INTEGER;
+  raw_data->size = module == VISITORS ? store->data_count : store->rec_count;
+  for (i = 0; i < len; ++i) {
+    key = keys[i];
+    if (key == 0 || key >= store->rec_size)
+      continue;
+
+    rec = &store->records[key];
+    data = raw_data->type == STRING ? get_record_data (store, key) : NULL;
+    if (data != NULL)
+      raw_data->items[raw_data->idx].value.svalue = (char *) data;
+    else if (raw_data->type == INTEGER && rec->hits != 0)
+      raw_data->items[raw_data->idx].value.ivalue = rec->hits;
+    else
+      continue;
+    raw_data->items[raw_data->idx++].key = key;
+  }
+
+  return raw_data;
+}
+
+/* Entry point to load the raw data from the data store into our
+ * GRawData structure.
+ *
+ * On error, NULL is returned.
+ * On success the GRawData sorted is returned */
+GRawData *
+parse_raw_data (GModule module)
+{
+  GRawData *raw_data;
+
+  switch (module) {
+  case VISITORS:
+    raw_data = parse_raw_str_data (module, 1);
+    break;
+  default:
+    raw_data = parse_raw_num_data (module, 1);
+  }
+  return raw_data;
+}
+
+/* Load all the raw data from the data store into our GRawData
+ * structure in storage order, e.g., to stream it out as it is.
+ *
+ * On error, NULL is returned.
+ * On success the unsorted GRawData is returned */
+GRawData *
+parse_raw_data_unsorted (GModule module)
+{
+  if (module == VISITORS)
+    return parse_raw_str_data (module, 0);
+  return parse_raw_num_data (module, 0);
+}
+
+/* Get the options the storage depends on, as stored on a snapshot.
+ *
+ * On success the snapshot flags are returned. */
+static uint32_t
+get_snapshot_flags (void)
+{
+  uint32_t flags = 0;
+
+  if (conf.approx_visitors)
+    flags |= SNAP_FLAG_APPROX_VISITORS;
+  if (conf.hash_visitor_keys)
+    flags |= SNAP_FLAG_HASH_VISITOR_KEYS;
+
+  return flags;
+}
+
+/* Write a string key - int value hash table as a snapshot section. */
+static void
+persist_si32 (GSnapWriter * w, uint32_t type, khash_t (si32) * hash)
+{
+  khint_t k;
+
+  snap_begin (w, type, 0);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_u32 (w, kh_val (hash, k));
+    snap_write_str (w, kh_key (hash, k));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write an int key - string value hash table as a snapshot section. */
+static void
+persist_is32 (GSnapWriter * w, uint32_t type, khash_t (is32) * hash)
+{
+  khint_t k;
+
+  snap_begin (w, type, 0);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_u32 (w, kh_key (hash, k));
+    snap_write_str (w, kh_val (hash, k) ? kh_val (hash, k) : "");
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write a string key - string value hash table as a snapshot section. */
+static void
+persist_ss32 (GSnapWriter * w, uint32_t type, khash_t (ss32) * hash)
+{
+  khint_t k;
+
+  snap_begin (w, type, 0);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_str (w, kh_key (hash, k));
+    snap_write_str (w, kh_val (hash, k) ? kh_val (hash, k) : "");
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write a string key - GLastParse value hash table as a snapshot
+ * section. */
+static void
+persist_slp (GSnapWriter * w, uint32_t type, khash_t (slp) * hash)
+{
+  khint_t k;
+
+  snap_begin (w, type, 0);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_str (w, kh_key (hash, k));
+    snap_write_u64 (w, kh_val (hash, k).offset);
+    snap_write_u32 (w, kh_val (hash, k).head);
+    snap_write_u32 (w, kh_val (hash, k).tail);
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write a 128-bit key - int value hash table as a snapshot section. */
+static void
+persist_h128i32 (GSnapWriter * w, uint32_t type, khash_t (h128i32) * hash)
+{
+  khint_t k;
+
+  snap_begin (w, type, 0);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_u64 (w, kh_key (hash, k).lo);
+    snap_write_u64 (w, kh_key (hash, k).hi);
+    snap_write_u32 (w, kh_val (hash, k));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the interned strings as a snapshot section, in id order, i.e.,
+ * as a single blob of nul-terminated strings. */
+static void
+persist_strings (GSnapWriter * w)
+{
+  uint32_t id;
+
+  snap_begin (w, SNAP_STRINGS, 0);
+  snap_write_u64 (w, gkh_strings.saved);
+  for (id = 1; id <= gkh_strings.size; id++)
+    snap_write_str (w, gkh_strings.strs[id]);
+  snap_end (w, gkh_strings.size);
+}
+
+/* Write the overall counters of the log as a snapshot section. */
+static void
+persist_general (GSnapWriter * w, GLog * glog)
+{
+  snap_begin (w, SNAP_GENERAL, 0);
+  snap_write_u64 (w, glog->processed);
+  snap_write_u64 (w, glog->invalid);
+  snap_write_u64 (w, glog->valid);
+  snap_write_u64 (w, glog->excluded_ip);
+  snap_write_u64 (w, glog->resp_size);
+  snap_write_u32 (w, conf.bandwidth);
+  snap_write_u32 (w, conf.serve_usecs);
+  snap_end (w, 1);
+}
+
+/* Write the int key - int value hash table of the given module and
+ * metric as a snapshot section. */
+static void
+persist_ii32 (GSnapWriter * w, uint32_t type, GModule module,
+              GSMetric metric)
+{
+  khash_t (ii32) * hash = get_hash (module, metric);
+  khint_t k;
+
+  snap_begin (w, type, module);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_u32 (w, kh_key (hash, k));
+    snap_write_u32 (w, kh_val (hash, k));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the uniqmap of the given module as a snapshot section. */
+static void
+persist_uniqmap (GSnapWriter * w, GModule module)
+{
+  khash_t (u64i32) * hash = get_hash (module, MTRC_UNIQMAP);
+  khint_t k;
+
+  snap_begin (w, SNAP_UNIQMAP, module);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_u64 (w, kh_key (hash, k));
+    snap_write_u32 (w, kh_val (hash, k));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the unique visitors sketches of the given module as a snapshot
+ * section, packed as by hll_pack(). */
+static void
+persist_uniqhll (GSnapWriter * w, GModule module)
+{
+  khash_t (ihll) * hash = get_hash (module, MTRC_UNIQHLL);
+  khint_t k;
+  size_t size = 0;
+  void *buf = NULL;
+
+  snap_begin (w, SNAP_UNIQHLL, module);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    buf = hll_pack (&kh_val (hash, k), &size);
+    snap_write_u32 (w, kh_key (hash, k));
+    snap_write_u32 (w, size);
+    snap_write (w, buf, size);
+    free (buf);
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the user agents of each host of the given module as a snapshot
+ * section, in the order they were first seen. */
+static void
+persist_agents (GSnapWriter * w, GModule module)
+{
+  khash_t (iags) * hash = get_hash (module, MTRC_AGENTS);
+  GAgentSet *set = NULL;
+  khint_t k;
+
+  snap_begin (w, SNAP_AGENTS, module);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    set = &kh_val (hash, k);
+    snap_write_u32 (w, kh_key (hash, k));
+    snap_write_u32 (w, set->len);
+    snap_write (w, set->keys, set->len * sizeof (int));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the meta data of the given module as a snapshot section. */
+static void
+persist_metadata (GSnapWriter * w, GModule module)
+{
+  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+  khint_t k;
+
+  snap_begin (w, SNAP_METADATA, module);
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    snap_write_str (w, kh_key (hash, k));
+    snap_write_u64 (w, kh_val (hash, k));
+  }
+  snap_end (w, kh_size (hash));
+}
+
+/* Write the records of the given module as a snapshot section, i.e.,
+ * the flat array of records up to the last data key. The position of
+ * each record on the top hits heap is rebuilt on restore. */
+static void
+persist_records (GSnapWriter * w, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  khash_t (ii32) * keymap = get_hash (module, MTRC_KEYMAP);
+  GKHashRecord rec;
+  uint32_t i, n = kh_size (keymap) + 1;
+
+  if (store->hh_keys)
+    n += kh_size (store->hh_keys);
+  if (n > store->rec_size)
+    n = store->rec_size;
+
+  snap_begin (w, SNAP_RECORDS, module);
+  for (i = 0; i < n; i++) {
+    rec = store->records[i];
+    rec.topk = 0;
+    snap_write (w, &rec, sizeof (rec));
+  }
+  snap_end (w, n);
+}
+
+/* Write the heavy hitters of the given module as a snapshot section,
+ * i.e., the data key, position on the heap and strings of each. */
+static void
+persist_hitters (GSnapWriter * w, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashHitter *hitter = NULL;
+  uint32_t i, n = 0;
+
+  snap_begin (w, SNAP_HITTERS, module);
+  for (i = 0; i < store->hh_size; i++) {
+    hitter = &store->hitters[i];
+    if (!hitter->key)
+      continue;
+    snap_write_u32 (w, i);
+    snap_write_u32 (w, hitter->heap);
+    snap_write_str (w, hitter->key);
+    snap_write_u32 (w, hitter->data != NULL);
+    if (hitter->data)
+      snap_write_str (w, hitter->data);
+    n++;
+  }
+  snap_end (w, n);
+}
+
+/* Write the tables of the given module as snapshot sections. */
+static void
+persist_module (GSnapWriter * w, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+
+  snap_begin (w, SNAP_MODULE, module);
+  snap_write_u32 (w, store->hh_max);
+  snap_write_u32 (w, store->rec_count);
+  snap_write_u32 (w, store->data_count);
+  snap_write_u32 (w, sizeof (GKHashRecord));
+  snap_end (w, 1);
+
+  persist_ii32 (w, SNAP_KEYMAP, module, MTRC_KEYMAP);
+  persist_ii32 (w, SNAP_ROOTMAP, module, MTRC_ROOTMAP);
+  persist_uniqmap (w, module);
+  persist_uniqhll (w, module);
+  persist_agents (w, module);
+  persist_metadata (w, module);
+  persist_records (w, module);
+  if (store->hh_keys)
+    persist_hitters (w, module);
+}
+
+/* Persist the whole storage and the overall counters of the given log
+ * into a snapshot at the given path (--persist-snapshot), replacing
+ * the previous one only once it's complete.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+int
+ht_persist_snapshot (const char *path, GLog * glog)
+{
+  GSnapWriter *w = NULL;
+  size_t idx = 0;
+
+  if (!gkh_storage || !(w = snap_create (path, get_snapshot_flags ())))
+    return 1;
+
+  persist_general (w, glog);
+  persist_strings (w);
+  persist_si32 (w, SNAP_AGENT_KEYS, ht_agent_keys);
+  persist_is32 (w, SNAP_AGENT_VALS, ht_agent_vals);
+  persist_si32 (w, SNAP_UNIQUE_KEYS, ht_unique_keys);
+  persist_h128i32 (w, SNAP_UNIQUE_HKEYS, ht_unique_hkeys);
+  persist_ss32 (w, SNAP_HOSTNAMES, ht_hostnames);
+  persist_si32 (w, SNAP_ATTR_KEYS, ht_attr_keys);
+  persist_is32 (w, SNAP_ATTR_VALS, ht_attr_vals);
+  persist_slp (w, SNAP_LAST_PARSE, ht_last_parse);
+
+  FOREACH_MODULE (idx, module_list) {
+    persist_module (w, module_list[idx]);
+  }
+
+  return snap_commit (w);
+}
+
+/* Restore a string key - int value hash table from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_si32 (GSnapReader * rd, uint64_t count, khash_t (si32) * hash)
+{
+  const char *key = NULL;
+  uint64_t i;
+  int value;
+
+  kh_resize (si32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    value = snap_read_u32 (rd);
+    if (!(key = snap_read_str (rd)) || ins_si32 (hash, key, value) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore an int key - string value hash table from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_is32 (GSnapReader * rd, uint64_t count, khash_t (is32) * hash)
+{
+  const char *value = NULL;
+  uint64_t i;
+  int key;
+
+  kh_resize (is32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_u32 (rd);
+    if (!(value = snap_read_str (rd)) || ins_is32 (hash, key, value) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore a string key - string value hash table from a snapshot
+ * section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_ss32 (GSnapReader * rd, uint64_t count, khash_t (ss32) * hash)
+{
+  const char *key = NULL, *value = NULL;
+  uint64_t i;
+
+  kh_resize (ss32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_str (rd);
+    value = snap_read_str (rd);
+    if (!key || !value || ins_ss32 (hash, key, value) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore the high-water marks of the logs from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_last_parse (GSnapReader * rd, uint64_t count)
+{
+  GLastParse lp;
+  const char *key = NULL;
+  uint64_t i;
+
+  for (i = 0; i < count; i++) {
+    key = snap_read_str (rd);
+    lp.offset = snap_read_u64 (rd);
+    lp.head = snap_read_u32 (rd);
+    lp.tail = snap_read_u32 (rd);
+    if (!key || ht_insert_last_parse (key, &lp) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore a 128-bit key - int value hash table from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_h128i32 (GSnapReader * rd, uint64_t count, khash_t (h128i32) * hash)
+{
+  GHashKey128 key;
+  uint64_t i;
+  khint_t k;
+  int ret;
+
+  kh_resize (h128i32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key.lo = snap_read_u64 (rd);
+    key.hi = snap_read_u64 (rd);
+    k = kh_put (h128i32, hash, key, &ret);
+    if (ret == -1)
+      return 1;
+    kh_val (hash, k) = snap_read_u32 (rd);
+  }
+
+  return rd->err;
+}
+
+/* Restore the interned strings from a snapshot section. Strings are not
+ * copied, they point into the snapshot, which is kept mapped.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_strings (GSnapReader * rd, uint64_t count)
+{
+  const char *str = NULL;
+  uint32_t id;
+  khint_t k;
+  int ret;
+
+  /* strings are restored once, before anything is interned */
+  if (gkh_strings.size != 0 || count >= UINT32_MAX)
+    return 1;
+
+  if (gkh_strings.cap <= count) {
+    gkh_strings.strs = xrealloc (gkh_strings.strs,
+                                 (count + 1) * sizeof (char *));
+    gkh_strings.cap = count + 1;
+  }
+  kh_resize (si32, gkh_strings.ids, get_presize_buckets (count));
+
+  gkh_strings.saved = snap_read_u64 (rd);
+  for (id = 1; id <= count; id++) {
+    if (!(str = snap_read_str (rd)))
+      return 1;
+    k = kh_put (si32, gkh_strings.ids, str, &ret);
+    if (ret != 1)
+      return 1;
+    kh_val (gkh_strings.ids, k) = id;
+    gkh_strings.strs[id] = str;
+    gkh_strings.bytes += strlen (str) + 1;
+  }
+  gkh_strings.size = count;
+
+  return rd->err;
+}
+
+/* Restore the overall counters of the given log from a snapshot
+ * section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_general (GSnapReader * rd, GLog * glog)
+{
+  glog->processed = snap_read_u64 (rd);
+  glog->invalid = snap_read_u64 (rd);
+  glog->valid = snap_read_u64 (rd);
+  glog->excluded_ip = snap_read_u64 (rd);
+  glog->resp_size = snap_read_u64 (rd);
+  if (snap_read_u32 (rd))
+    conf.bandwidth = 1;
+  if (snap_read_u32 (rd))
+    conf.serve_usecs = 1;
+
+  return rd->err;
+}
+
+/* Restore the counters of the given module from a snapshot section.
+ * Panels must keep the same num of heavy hitters as when it was taken.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_module (GSnapReader * rd, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+
+  if ((int) snap_read_u32 (rd) != store->hh_max)
+    return 1;
+  store->rec_count = snap_read_u32 (rd);
+  store->data_count = snap_read_u32 (rd);
+  if (snap_read_u32 (rd) != sizeof (GKHashRecord))
+    return 1;
+
+  return rd->err;
+}
+
+/* Restore an int key - int value hash table of the given module and
+ * metric from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_ii32 (GSnapReader * rd, uint64_t count, GModule module,
+              GSMetric metric)
+{
+  khash_t (ii32) * hash = get_hash (module, metric);
+  uint64_t i;
+  khint_t k;
+  int ret, key;
+
+  kh_resize (ii32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_u32 (rd);
+    k = kh_put (ii32, hash, key, &ret);
+    if (ret == -1)
+      return 1;
+    kh_val (hash, k) = snap_read_u32 (rd);
+  }
+
+  return rd->err;
+}
+
+/* Restore the uniqmap of the given module from a snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_uniqmap (GSnapReader * rd, uint64_t count, GModule module)
+{
+  khash_t (u64i32) * hash = get_hash (module, MTRC_UNIQMAP);
+  uint64_t i, key;
+  khint_t k;
+  int ret;
+
+  kh_resize (u64i32, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_u64 (rd);
+    k = kh_put (u64i32, hash, key, &ret);
+    if (ret == -1)
+      return 1;
+    kh_val (hash, k) = snap_read_u32 (rd);
+  }
+
+  return rd->err;
+}
+
+/* Restore the unique visitors sketches of the given module from a
+ * snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_uniqhll (GSnapReader * rd, uint64_t count, GModule module)
+{
+  khash_t (ihll) * hash = get_hash (module, MTRC_UNIQHLL);
+  const void *buf = NULL;
+  uint64_t i;
+  uint32_t size;
+  khint_t k;
+  int ret, key;
+
+  kh_resize (ihll, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_u32 (rd);
+    size = snap_read_u32 (rd);
+    if (!(buf = snap_read (rd, size)))
+      return 1;
+    k = kh_put (ihll, hash, key, &ret);
+    if (ret != 1)
+      return 1;
+    if (hll_unpack (&kh_val (hash, k), buf, size) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore the user agents of each host of the given module from a
+ * snapshot section.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_agents (GSnapReader * rd, uint64_t count, GModule module)
+{
+  khash_t (iags) * hash = get_hash (module, MTRC_AGENTS);
+  const char *keys = NULL;
+  uint64_t i;
+  uint32_t j, len;
+  int key, value;
+
+  kh_resize (iags, hash, get_presize_buckets (count));
+  for (i = 0; i < count; i++) {
+    key = snap_read_u32 (rd);
+    len = snap_read_u32 (rd);
+    if (len > rd->len || !(keys = snap_read (rd, len * sizeof (int))))
+      return 1;
+    for (j = 0; j < len; j++) {
+      memcpy (&value, keys + j * sizeof (int), sizeof (int));
+      if (ins_iags (hash, key, value) == -1)
+        return 1;
+    }
+  }
+
+  return rd->err;
+}
+
+/* Restore the meta data of the given module from a snapshot section.
+ * As when counted, keys are not copied, they point into the snapshot.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_metadata (GSnapReader * rd, uint64_t count, GModule module)
+{
+  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+  const char *key = NULL;
+  uint64_t i, value;
+
+  for (i = 0; i < count; i++) {
+    key = snap_read_str (rd);
+    value = snap_read_u64 (rd);
+    if (!key || inc_su64 (hash, key, value) == -1)
+      return 1;
+  }
+
+  return rd->err;
+}
+
+/* Restore the records of the given module from a snapshot section, and
+ * rebuild the top hits heap out of them.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_records (GSnapReader * rd, uint64_t count, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  const void *recs = NULL;
+  uint32_t key;
+
+  if (count >= INT_MAX)
+    return 1;
+  if (!(recs = snap_read (rd, count * sizeof (GKHashRecord))))
+    return 1;
+  /* the first one is never used, keys start at 1 */
+  if (count <= 1)
+    return 0;
+
+  get_record (module, count - 1);
+  if (store->rec_size < count)
+    return 1;
+  memcpy (store->records, recs, count * sizeof (GKHashRecord));
+
+  for (key = 1; key < count; key++) {
+    store->records[key].topk = 0;
+    if (store->records[key].hits > 0)
+      topk_update (module, key);
+  }
+
+  return rd->err;
+}
+
+/* Restore the heavy hitters of the given module from a snapshot
+ * section, along with their heap.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_hitters (GSnapReader * rd, uint64_t count, GModule module)
+{
+  GKHashStorage *store = &gkh_storage[module];
+  GKHashHitter *hitter = NULL;
+  const char *key = NULL, *data = NULL;
+  uint64_t i;
+  uint32_t value, heap;
+  khint_t k;
+  int ret;
 
-  if (!hash)
-    return NULL;
+  if (!store->hh_keys)
+    return 1;
+
+  for (i = 0; i < count; i++) {
+    value = snap_read_u32 (rd);
+    heap = snap_read_u32 (rd);
+    key = snap_read_str (rd);
+    data = snap_read_u32 (rd) ? snap_read_str (rd) : NULL;
+    if (!key || rd->err || value == 0 || value >= store->rec_size ||
+        heap > (uint32_t) store->hh_max)
+      return 1;
+
+    hitter = get_hitter (store, value);
+    if (hitter->key)
+      return 1;
+    hitter->key = xstrdup (key);
+    hitter->data = data ? xstrdup (data) : NULL;
+    k = kh_put (si32, store->hh_keys, hitter->key, &ret);
+    if (ret != 1)
+      return 1;
+    kh_val (store->hh_keys, k) = value;
+
+    if (heap > 0) {
+      hh_set (store, heap - 1, value);
+      if ((int) heap > store->hh_len)
+        store->hh_len = heap;
+    }
+  }
 
-  return get_ss32 (hash, host);
+  return rd->err;
 }
 
-/* Get the string value from ht_agent_vals (user agent) given an int key.
+/* Restore a section of a snapshot that applies to the given module,
+ * unless the module is not enabled anymore.
  *
- * On error, NULL is returned.
- * On success the string value for the given key is returned */
-char *
-ht_get_host_agent_val (int key)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_module_section (const GSnapSection * sect, GSnapReader * rd)
 {
-  khash_t (is32) * hash = ht_agent_vals;
+  GModule module = sect->module;
+  uint64_t count = sect->count;
 
-  if (!hash)
-    return NULL;
+  if (sect->module >= TOTAL_MODULES)
+    return 1;
+  if (gkh_storage[module].nmetrics == 0)
+    return 0;
 
-  return get_is32 (hash, key);
+  switch (sect->type) {
+  case SNAP_MODULE:
+    return restore_module (rd, module);
+  case SNAP_KEYMAP:
+    return restore_ii32 (rd, count, module, MTRC_KEYMAP);
+  case SNAP_ROOTMAP:
+    return restore_ii32 (rd, count, module, MTRC_ROOTMAP);
+  case SNAP_UNIQMAP:
+    return restore_uniqmap (rd, count, module);
+  case SNAP_UNIQHLL:
+    return restore_uniqhll (rd, count, module);
+  case SNAP_AGENTS:
+    return restore_agents (rd, count, module);
+  case SNAP_METADATA:
+    return restore_metadata (rd, count, module);
+  case SNAP_RECORDS:
+    return restore_records (rd, count, module);
+  case SNAP_HITTERS:
+    return restore_hitters (rd, count, module);
+  }
+
+  return 0;
 }
 
-/* Get the list value from MTRC_AGENTS given an int key.
+/* Restore a section of a snapshot. Unknown sections are skipped.
  *
- * On error, or if key is not found, NULL is returned.
- * On success the GSLList value for the given key is returned */
-GSLList *
-ht_get_host_agent_list (GModule module, int key)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+restore_section (const GSnapSection * sect, GSnapReader * rd, GLog * glog)
 {
-  khash_t (igsl) * hash = get_hash (module, MTRC_AGENTS);
-  GSLList *list;
+  switch (sect->type) {
+  case SNAP_GENERAL:
+    return restore_general (rd, glog);
+  case SNAP_STRINGS:
+    return restore_strings (rd, sect->count);
+  case SNAP_AGENT_KEYS:
+    return restore_si32 (rd, sect->count, ht_agent_keys);
+  case SNAP_AGENT_VALS:
+    return restore_is32 (rd, sect->count, ht_agent_vals);
+  case SNAP_UNIQUE_KEYS:
+    return restore_si32 (rd, sect->count, ht_unique_keys);
+  case SNAP_UNIQUE_HKEYS:
+    return restore_h128i32 (rd, sect->count, ht_unique_hkeys);
+  case SNAP_HOSTNAMES:
+    return restore_ss32 (rd, sect->count, ht_hostnames);
+  case SNAP_ATTR_KEYS:
+    return restore_si32 (rd, sect->count, ht_attr_keys);
+  case SNAP_ATTR_VALS:
+    return restore_is32 (rd, sect->count, ht_attr_vals);
+  case SNAP_LAST_PARSE:
+    return restore_last_parse (rd, sect->count);
+  }
 
-  if ((list = get_igsl (hash, key)))
-    return list;
-  return NULL;
+  return restore_module_section (sect, rd);
 }
 
-/* Get the meta data uint64_t from MTRC_METADATA given a string key.
+/* Restore the whole storage and the overall counters of the given log
+ * from the snapshot at the given path (--restore-snapshot). This is
+ * done right after the storage is initialized, before any log is
+ * parsed. The snapshot is kept mapped, as interned strings point into
+ * it.
  *
- * On error, or if key is not found, 0 is returned.
- * On success the uint64_t value for the given key is returned */
-uint64_t
-ht_get_meta_data (GModule module, const char *key)
+ * On error, 1 is returned and err is set to the reason.
+ * On success, 0 is returned. */
+int
+ht_restore_snapshot (const char *path, GLog * glog, const char **err)
 {
-  khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+  GSnapSection sect;
+  GSnapReader rd;
+  GSnapshot *snap = NULL;
 
-  return get_su64 (hash, key);
+  if (!gkh_storage || gkh_snapshot) {
+    *err = "storage not initialized";
+    return 1;
+  }
+  if (!(snap = snap_open (path, err)))
+    return 1;
+
+  if (snap->hdr.flags != get_snapshot_flags ()) {
+    *err = "taken with different --approx-visitors/--hash-visitor-keys";
+    snap_close (snap);
+    return 1;
+  }
+
+  /* strings may point into it from now on */
+  gkh_snapshot = snap;
+  while (snap_next (snap, &sect, &rd)) {
+    if (restore_section (&sect, &rd, glog) || rd.pos != rd.len) {
+      *err = "invalid snapshot data, or different --heavy-hitters";
+      return 1;
+    }
+  }
+
+  return 0;
 }
 
-/* Set the maximum and minimum values found on an integer key and
- * integer value found on the MTRC_VISITORS hash structure.
+/* Map a key of the snapshot being merged to the given key of the
+ * storage, growing the map as needed.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-void
-ht_get_hits_min_max (GModule module, int *min, int *max)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+set_merge_key (int **map, uint32_t * size, uint32_t key, int value)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
+  uint32_t n = *size;
+
+  if (key >= INT_MAX)
+    return 1;
+
+  if (key >= n) {
+    n = n > 0 ? n : GKH_RECORDS_INIT;
+    while (n <= key)
+      n *= 2;
+    *map = xrealloc (*map, n * sizeof (int));
+    memset (*map + *size, 0, (n - *size) * sizeof (int));
+    *size = n;
+  }
+  (*map)[key] = value;
 
-  if (!hash)
-    return;
+  return 0;
+}
 
-  get_ii32_min_max (hash, min, max);
+/* Get the key of the storage a key of the snapshot being merged maps
+ * to.
+ *
+ * If the key is not mapped, 0 is returned.
+ * On success the key is returned. */
+static int
+get_merge_key (const int *map, uint32_t size, uint32_t key)
+{
+  return key < size ? map[key] : 0;
 }
 
-/* Set the maximum and minimum values found on an integer key and
- * integer value found on the MTRC_VISITORS hash structure.
+/* Get a string of the snapshot being merged given its id.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-void
-ht_get_visitors_min_max (GModule module, int *min, int *max)
+ * If the id is not valid, NULL is returned.
+ * On success the string is returned */
+static const char *
+get_merge_str (const char **strs, uint32_t size, uint32_t id)
 {
-  khash_t (ii32) * hash = get_hash (module, MTRC_VISITORS);
+  return id > 0 && id < size ? strs[id] : NULL;
+}
 
-  if (!hash)
-    return;
+/* Add the overall counters of a snapshot section to the ones of the
+ * given log.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_general (GSnapReader * rd, GLog * glog)
+{
+  glog->processed += snap_read_u64 (rd);
+  glog->invalid += snap_read_u64 (rd);
+  glog->valid += snap_read_u64 (rd);
+  glog->excluded_ip += snap_read_u64 (rd);
+  glog->resp_size += snap_read_u64 (rd);
+  if (snap_read_u32 (rd))
+    conf.bandwidth = 1;
+  if (snap_read_u32 (rd))
+    conf.serve_usecs = 1;
+
+  return rd->err;
+}
+
+/* Index the interned strings of a snapshot section by id. As they are
+ * interned again once merged, these point into the snapshot.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_strings (GKMerge * m, GSnapReader * rd, uint64_t count)
+{
+  uint32_t id;
+
+  if (m->strs || count >= UINT32_MAX)
+    return 1;
+
+  m->strs = xcalloc (count + 1, sizeof (char *));
+  m->nstrs = count + 1;
 
-  get_ii32_min_max (hash, min, max);
+  /* bytes saved, they are counted again as merged */
+  snap_read_u64 (rd);
+  for (id = 1; id <= count; id++) {
+    if (!(m->strs[id] = snap_read_str (rd)))
+      return 1;
+  }
+
+  return rd->err;
 }
 
-/* Set the maximum and minimum values found on an integer key and
- * a uint64_t value found on the MTRC_BW hash structure.
+/* Merge the unique visitor or user agent keys of a snapshot section,
+ * in the order they were inserted, i.e., by their value, and map them
+ * to the ones of the storage.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-void
-ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_keys (GKMerge * m, GSnapReader * rd, uint64_t count, int agents)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_BW);
+  const char **keys = NULL;
+  uint32_t i, value;
+  int ret = 1, nkey;
+
+  if (count >= INT_MAX)
+    return 1;
+
+  keys = xcalloc (count + 1, sizeof (char *));
+  for (i = 0; i < count; i++) {
+    value = snap_read_u32 (rd);
+    if (value == 0 || value > count || keys[value])
+      goto out;
+    if (!(keys[value] = snap_read_str (rd)))
+      goto out;
+  }
 
-  if (!hash)
-    return;
+  for (value = 1; value <= count; value++) {
+    if (!keys[value])
+      goto out;
+    if (agents) {
+      if ((nkey = ht_insert_agent_key (keys[value])) == -1)
+        goto out;
+      ht_insert_agent_value (nkey, keys[value]);
+      if (set_merge_key (&m->agents, &m->nagents, value, nkey))
+        goto out;
+    } else {
+      if ((nkey = ht_insert_unique_key (keys[value])) == -1)
+        goto out;
+      if (set_merge_key (&m->visitors, &m->nvisitors, value, nkey))
+        goto out;
+    }
+  }
+  ret = rd->err;
 
-  get_iu64_min_max (hash, min, max);
+out:
+  free (keys);
+
+  return ret;
 }
 
-/* Set the maximum and minimum values found on an integer key and
- * a uint64_t value found on the MTRC_CUMTS hash structure.
+/* Merge the hashed unique visitor keys of a snapshot section, in the
+ * order they were inserted, and map them to the ones of the storage.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-void
-ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_hkeys (GKMerge * m, GSnapReader * rd, uint64_t count)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_CUMTS);
+  uint64_t *keys = NULL, lo, hi;
+  uint32_t i, value;
+  int ret = 1, nkey;
+
+  if (count >= INT_MAX)
+    return 1;
+
+  keys = xcalloc (2 * (count + 1), sizeof (uint64_t));
+  for (i = 0; i < count; i++) {
+    lo = snap_read_u64 (rd);
+    hi = snap_read_u64 (rd);
+    value = snap_read_u32 (rd);
+    if (value == 0 || value > count)
+      goto out;
+    keys[2 * value] = lo;
+    keys[2 * value + 1] = hi;
+  }
+  if (rd->err)
+    goto out;
+
+  for (value = 1; value <= count; value++) {
+    if ((nkey = ht_insert_unique_hkey (keys + 2 * value)) == -1)
+      goto out;
+    if (set_merge_key (&m->visitors, &m->nvisitors, value, nkey))
+      goto out;
+  }
+  ret = 0;
 
-  if (!hash)
-    return;
+out:
+  free (keys);
 
-  get_iu64_min_max (hash, min, max);
+  return ret;
 }
 
-/* Set the maximum and minimum values found on an integer key and
- * a uint64_t value found on the MTRC_MAXTS hash structure.
+/* Merge the resolved hostnames of a snapshot section. Hostnames
+ * already resolved are kept.
  *
- * If the hash structure is empty, no values are set.
- * On success the minimum and maximum values are set. */
-void
-ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_hostnames (GSnapReader * rd, uint64_t count)
 {
-  khash_t (iu64) * hash = get_hash (module, MTRC_MAXTS);
+  const char *key = NULL, *value = NULL;
+  uint64_t i;
+
+  for (i = 0; i < count; i++) {
+    key = snap_read_str (rd);
+    value = snap_read_str (rd);
+    if (!key || !value)
+      return 1;
+    ht_insert_hostname (key, value);
+  }
 
-  if (!hash)
-    return;
+  return rd->err;
+}
+
+/* Index the methods and protocols of a snapshot section by key. They
+ * are inserted again as the records referring to them are merged.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_attrs (GKMerge * m, GSnapReader * rd, uint64_t count)
+{
+  const char *value = NULL;
+  uint64_t i;
+  uint32_t key, n;
+
+  for (i = 0; i < count; i++) {
+    key = snap_read_u32 (rd);
+    if (!(value = snap_read_str (rd)) || key >= INT_MAX)
+      return 1;
+    if (key >= m->nattrs) {
+      n = m->nattrs > 0 ? m->nattrs : 16;
+      while (n <= key)
+        n *= 2;
+      m->attrs = xrealloc (m->attrs, n * sizeof (char *));
+      memset (m->attrs + m->nattrs, 0, (n - m->nattrs) * sizeof (char *));
+      m->nattrs = n;
+    }
+    m->attrs[key] = value;
+  }
 
-  get_iu64_min_max (hash, min, max);
+  return rd->err;
 }
 
-/* A wrapper to initialize a raw data structure.
+/* Start merging the given module out of its snapshot section. Its
+ * other sections are merged along, once all of them are read. Unlike
+ * on restore, panels may keep a different num of heavy hitters.
  *
- * On success a GRawData structure is returned. */
-static GRawData *
-init_new_raw_data (GModule module, uint32_t ht_size)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_module_begin (GKMerge * m, GSnapReader * rd, GModule module)
 {
-  GRawData *raw_data;
+  memset (m->sects, 0, sizeof (m->sects));
+  m->module = module;
+  m->skip = gkh_storage[module].nmetrics == 0;
 
-  raw_data = new_grawdata ();
-  raw_data->idx = 0;
-  raw_data->module = module;
-  raw_data->size = ht_size;
-  raw_data->items = new_grawdata_item (ht_size);
+  snap_read_u32 (rd);
+  snap_read_u32 (rd);
+  snap_read_u32 (rd);
+  if (snap_read_u32 (rd) != sizeof (GKHashRecord))
+    return 1;
 
-  return raw_data;
+  return rd->err;
 }
 
-/* Store the key/value pairs from a hash table into raw_data and sorts
- * the hits (numeric) value.
+/* Index what refers to each data key of the module being merged across
+ * its sections, i.e., its keymap, rootmap, unique visitors sketch,
+ * user agents and heavy hitter strings.
  *
- * On error, NULL is returned.
- * On success the GRawData sorted is returned */
-static GRawData *
-parse_raw_num_data (GModule module)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+index_merge_keys (GKMerge * m, GKMergeKey * keys, uint32_t n)
 {
-  GRawData *raw_data;
-  khiter_t key;
-  uint32_t ht_size = 0;
+  GSnapReader *rd = NULL;
+  const char *buf = NULL, *hkey = NULL, *hdata = NULL;
+  uint64_t i;
+  uint32_t key, value, len;
+
+  rd = &m->sects[SNAP_KEYMAP].rd;
+  for (i = 0; i < m->sects[SNAP_KEYMAP].count; i++) {
+    value = snap_read_u32 (rd);
+    key = snap_read_u32 (rd);
+    if (key < n)
+      keys[key].id = value;
+  }
 
-  khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
-  if (!hash)
-    return NULL;
+  rd = &m->sects[SNAP_ROOTMAP].rd;
+  for (i = 0; i < m->sects[SNAP_ROOTMAP].count; i++) {
+    key = snap_read_u32 (rd);
+    value = snap_read_u32 (rd);
+    if (key < n)
+      keys[key].root = get_merge_str (m->strs, m->nstrs, value);
+  }
 
-  ht_size = kh_size (hash);
-  raw_data = init_new_raw_data (module, ht_size);
-  raw_data->type = INTEGER;
-  for (key = kh_begin (hash); key != kh_end (hash); ++key) {
-    if (!kh_exist (hash, key))
-      continue;
+  rd = &m->sects[SNAP_UNIQHLL].rd;
+  for (i = 0; i < m->sects[SNAP_UNIQHLL].count; i++) {
+    key = snap_read_u32 (rd);
+    len = snap_read_u32 (rd);
+    if (!(buf = snap_read (rd, len)))
+      return 1;
+    if (key < n) {
+      keys[key].hll = buf;
+      keys[key].hll_size = len;
+    }
+  }
 
-    raw_data->items[raw_data->idx].key = kh_key (hash, key);
-    raw_data->items[raw_data->idx].value.ivalue = kh_value (hash, key);
-    raw_data->idx++;
+  rd = &m->sects[SNAP_AGENTS].rd;
+  for (i = 0; i < m->sects[SNAP_AGENTS].count; i++) {
+    key = snap_read_u32 (rd);
+    len = snap_read_u32 (rd);
+    if (len > rd->len || !(buf = snap_read (rd, len * sizeof (int))))
+      return 1;
+    if (key < n) {
+      keys[key].agents = buf;
+      keys[key].nagents = len;
+    }
+  }
+
+  rd = &m->sects[SNAP_HITTERS].rd;
+  for (i = 0; i < m->sects[SNAP_HITTERS].count; i++) {
+    key = snap_read_u32 (rd);
+    snap_read_u32 (rd);
+    hkey = snap_read_str (rd);
+    hdata = snap_read_u32 (rd) ? snap_read_str (rd) : NULL;
+    if (!hkey)
+      return 1;
+    if (key < n) {
+      keys[key].hkey = hkey;
+      keys[key].hdata = hdata;
+    }
   }
 
-  sort_raw_num_data (raw_data, raw_data->idx);
+  for (key = SNAP_KEYMAP; key <= SNAP_HITTERS; key++) {
+    if (m->sects[key].rd.err)
+      return 1;
+  }
 
-  return raw_data;
+  return 0;
+}
+
+/* Compare the unique visitors of the module being merged by data key
+ * then by visitor key. */
+static int
+cmp_merge_uniq (const void *a, const void *b)
+{
+  const GKMergeUniq *ua = a, *ub = b;
+
+  if (ua->data != ub->data)
+    return ua->data < ub->data ? -1 : 1;
+  if (ua->visitor != ub->visitor)
+    return ua->visitor < ub->visitor ? -1 : 1;
+  return 0;
 }
 
-/* Store the key/value pairs from a hash table into raw_data and sorts
- * the data (string) value.
+/* Get the unique visitors of the module being merged out of its
+ * uniqmap, sorted by data key.
  *
- * On error, NULL is returned.
- * On success the GRawData sorted is returned */
-static GRawData *
-parse_raw_str_data (GModule module)
+ * On error, or if there are none, NULL is returned.
+ * On success the newly allocated array is returned. */
+static GKMergeUniq *
+get_merge_uniqs (GKMerge * m, uint64_t * len)
 {
-  GRawData *raw_data;
-  khiter_t key;
-  uint32_t ht_size = 0;
+  GKMergeSect *sect = &m->sects[SNAP_UNIQMAP];
+  GKMergeUniq *uniqs = NULL;
+  uint64_t i, key;
 
-  khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
-  if (!hash)
+  *len = 0;
+  if (sect->count == 0 || sect->count > sect->rd.len)
     return NULL;
 
-  ht_size = kh_size (hash);
-  raw_data = init_new_raw_data (module, ht_size);
-  raw_data->type = STRING;
-  for (key = kh_begin (hash); key != kh_end (hash); ++key) {
-    if (!kh_exist (hash, key))
+  uniqs = xmalloc (sect->count * sizeof (GKMergeUniq));
+  for (i = 0; i < sect->count; i++) {
+    key = snap_read_u64 (&sect->rd);
+    snap_read_u32 (&sect->rd);
+    uniqs[i].visitor = key >> 32;
+    uniqs[i].data = key & 0xffffffff;
+  }
+  if (sect->rd.err) {
+    free (uniqs);
+    return NULL;
+  }
+
+  qsort (uniqs, sect->count, sizeof (GKMergeUniq), cmp_merge_uniq);
+  *len = sect->count;
+
+  return uniqs;
+}
+
+/* Merge a packed unique visitors sketch into the one of the given data
+ * key.
+ *
+ * On error, -1 is returned.
+ * On success the growth of the estimated unique visitors is returned */
+static int
+merge_uniq_hll (GModule module, int key, const void *buf, uint32_t size)
+{
+  khash_t (ihll) * ht = get_hash (module, MTRC_UNIQHLL);
+  GHLL hll;
+  khint_t k;
+  int ret;
+
+  if (!ht || hll_unpack (&hll, buf, size) == -1)
+    return -1;
+
+  k = kh_put (ihll, ht, key, &ret);
+  if (ret == -1) {
+    free_hll (&hll);
+    return -1;
+  }
+  if (ret != 0)
+    memset (&kh_val (ht, k), 0, sizeof (GHLL));
+
+  hll_merge (&kh_val (ht, k), &hll);
+  free_hll (&hll);
+
+  return hll_report (&kh_val (ht, k));
+}
+
+/* Merge the root key of a data key of the module being merged, mapping
+ * it to a root key of the storage the first time it's seen.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_root (GKMerge * m, GKMergeKey * rkey, int nkey)
+{
+  const char *key = NULL;
+
+  if (rkey->root_nkey == 0) {
+    if (!(key = get_merge_str (m->strs, m->nstrs, rkey->id)))
+      return 0;
+    if ((rkey->root_nkey = ht_insert_keymap (m->module, key)) == -1) {
+      rkey->root_nkey = 0;
+      return 1;
+    }
+    ht_insert_rootmap (m->module, rkey->root_nkey, rkey->root);
+  }
+  ht_insert_root (m->module, nkey, rkey->root_nkey);
+
+  return 0;
+}
+
+/* Merge a data key of the module being merged along with its metrics,
+ * root key, attributes, unique visitors and user agents. Unique
+ * visitors already seen on the storage are not counted again.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_key (GKMerge * m, GKMergeKey * keys, uint32_t n,
+           const GKHashRecord * rec, GKMergeKey * mkey,
+           const GKMergeUniq * uniqs, uint64_t nuniqs)
+{
+  GModule module = m->module;
+  const char *key = NULL, *data = NULL;
+  uint64_t i, key64;
+  uint32_t root = rec->root;
+  int nkey, visitor, agent, inc = 0, ret;
+
+  key = mkey->hkey ? mkey->hkey : get_merge_str (m->strs, m->nstrs, mkey->id);
+  if (!key)
+    return 0;
+  if ((nkey = ht_insert_data_keymap (module, key)) == -1)
+    return 1;
+
+  data = mkey->hkey ? mkey->hdata : get_merge_str (m->strs, m->nstrs,
+                                                    rec->data);
+  if (data)
+    ht_insert_datamap (module, nkey, data);
+  if (root > 0 && root < n && keys[root].root &&
+      merge_root (m, &keys[root], nkey))
+    return 1;
+
+  ht_insert_hits (module, nkey, rec->hits);
+  ht_insert_bw (module, nkey, rec->bw);
+  ht_insert_cumts (module, nkey, rec->cumts);
+  ht_insert_maxts (module, nkey, rec->maxts);
+  if ((data = get_merge_str (m->attrs, m->nattrs, rec->method)))
+    ht_insert_method (module, nkey, data);
+  if ((data = get_merge_str (m->attrs, m->nattrs, rec->protocol)))
+    ht_insert_protocol (module, nkey, data);
+
+  for (i = 0; i < nuniqs; i++) {
+    visitor = get_merge_key (m->visitors, m->nvisitors, uniqs[i].visitor);
+    if (visitor <= 0)
       continue;
+    key64 = ((uint64_t) (uint32_t) visitor << 32) | (uint32_t) nkey;
+    if (ht_insert_uniqmap (module, key64) > 0)
+      inc++;
+  }
+  if (mkey->hll) {
+    if ((ret = merge_uniq_hll (module, nkey, mkey->hll, mkey->hll_size)) < 0)
+      return 1;
+    inc += ret;
+  }
+  if (inc > 0) {
+    ht_insert_visitor (module, nkey, inc);
+    ht_insert_meta_data (module, "visitors", inc);
+  }
 
-    raw_data->items[raw_data->idx].key = kh_key (hash, key);
-    raw_data->items[raw_data->idx].value.svalue = kh_value (hash, key);
-    raw_data->idx++;
+  for (i = 0; i < mkey->nagents; i++) {
+    memcpy (&agent, mkey->agents + i * sizeof (int), sizeof (int));
+    if ((agent = get_merge_key (m->agents, m->nagents, agent)) > 0)
+      ht_insert_agent (module, nkey, agent);
   }
 
-  sort_raw_str_data (raw_data, raw_data->idx);
+  return 0;
+}
 
-  return raw_data;
+/* Add the meta data of the module being merged to the one of the
+ * storage. Unique visitors are counted as their data keys are merged.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_metadata (GKMerge * m)
+{
+  static const char *const names[] = { "hits", "bytes", "cumts", "maxts" };
+  GKMergeSect *sect = &m->sects[SNAP_METADATA];
+  const char *key = NULL;
+  uint64_t i, value;
+  size_t idx;
+
+  for (i = 0; i < sect->count; i++) {
+    key = snap_read_str (&sect->rd);
+    value = snap_read_u64 (&sect->rd);
+    if (!key)
+      return 1;
+    /* keys are not copied, see ht_insert_meta_data() */
+    for (idx = 0; idx < ARRAY_SIZE (names); idx++) {
+      if (strcmp (key, names[idx]) == 0)
+        ht_insert_meta_data (m->module, names[idx], value);
+    }
+  }
+
+  return sect->rd.err;
 }
 
-/* Entry point to load the raw data from the data store into our
- * GRawData structure.
+/* Merge the module being merged, once all of its sections are read.
+ * Data keys are merged in the order they were inserted, so the keys of
+ * the storage end up as if the log of the snapshot was parsed right
+ * after the ones merged so far.
  *
- * On error, NULL is returned.
- * On success the GRawData sorted is returned */
-GRawData *
-parse_raw_data (GModule module)
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_module (GKMerge * m)
 {
-  GRawData *raw_data;
+  GKMergeSect *sect = &m->sects[SNAP_RECORDS];
+  GKMergeKey *keys = NULL;
+  GKMergeUniq *uniqs = NULL;
+  GKHashRecord rec;
+  const char *recs = NULL;
+  uint64_t nuniqs = 0, u = 0, end = 0;
+  uint32_t n = 0, key;
+  int ret = 1;
+
+  if (m->module < 0)
+    return 0;
+  if (m->skip) {
+    m->module = -1;
+    return 0;
+  }
 
-  switch (module) {
-  case VISITORS:
-    raw_data = parse_raw_str_data (module);
-    break;
-  default:
-    raw_data = parse_raw_num_data (module);
+  if (sect->count >= INT_MAX)
+    return 1;
+  n = sect->count;
+  if (n > 0 && !(recs = snap_read (&sect->rd, n * sizeof (GKHashRecord))))
+    return 1;
+
+  keys = xcalloc (n + 1, sizeof (GKMergeKey));
+  if (index_merge_keys (m, keys, n))
+    goto out;
+  uniqs = get_merge_uniqs (m, &nuniqs);
+
+  /* the first one is never used, keys start at 1 */
+  for (key = 1; key < n; key++) {
+    memcpy (&rec, recs + key * sizeof (GKHashRecord), sizeof (rec));
+    while (u < nuniqs && uniqs[u].data < key)
+      u++;
+    for (end = u; end < nuniqs && uniqs[end].data == key; end++);
+
+    /* unused, or a root key */
+    if (rec.hits <= 0)
+      continue;
+    if (merge_key (m, keys, n, &rec, &keys[key], uniqs + u, end - u))
+      goto out;
   }
-  return raw_data;
+  ret = merge_metadata (m);
+
+out:
+  m->module = -1;
+  free (keys);
+  free (uniqs);
+
+  return ret;
+}
+
+/* Merge a section of a snapshot. The sections of a module are kept
+ * until the next module starts. Unknown sections are skipped.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_section (GKMerge * m, const GSnapSection * sect, GSnapReader * rd,
+               GLog * glog, int resume)
+{
+  switch (sect->type) {
+  case SNAP_GENERAL:
+    return merge_general (rd, glog);
+  case SNAP_STRINGS:
+    return merge_strings (m, rd, sect->count);
+  case SNAP_AGENT_KEYS:
+    return merge_keys (m, rd, sect->count, 1);
+  case SNAP_UNIQUE_KEYS:
+    return merge_keys (m, rd, sect->count, 0);
+  case SNAP_UNIQUE_HKEYS:
+    return merge_hkeys (m, rd, sect->count);
+  case SNAP_HOSTNAMES:
+    return merge_hostnames (rd, sect->count);
+  case SNAP_ATTR_VALS:
+    return merge_attrs (m, rd, sect->count);
+  case SNAP_LAST_PARSE:
+    return resume ? restore_last_parse (rd, sect->count) : 0;
+  case SNAP_MODULE:
+    if (merge_module (m) || sect->module >= TOTAL_MODULES)
+      return 1;
+    return merge_module_begin (m, rd, sect->module);
+  }
+
+  if (sect->type > SNAP_MODULE && sect->type <= SNAP_HITTERS &&
+      m->module >= 0 && sect->module == (uint32_t) m->module) {
+    m->sects[sect->type].rd = *rd;
+    m->sects[sect->type].count = sect->count;
+  }
+
+  return 0;
+}
+
+/* Merge the snapshot at the given path into the storage and the overall
+ * counters of the given log, e.g., the one of a log parsed on its own
+ * (--shards), or the one of another host (--merge). Metrics are added
+ * up, unique visitors are counted once across both, and the keys of
+ * the snapshot are mapped to the ones of the storage. Unlike on
+ * restore, the snapshot is not kept mapped. The high-water marks of
+ * the logs are only kept if resuming them, as they refer to the files
+ * of the host that took the snapshot.
+ *
+ * On error, 1 is returned and err is set to the reason.
+ * On success, 0 is returned. */
+int
+ht_merge_snapshot (const char *path, GLog * glog, int resume,
+                   const char **err)
+{
+  GKMerge m;
+  GSnapSection sect;
+  GSnapReader rd;
+  GSnapshot *snap = NULL;
+  int ret = 0;
+
+  if (!gkh_storage) {
+    *err = "storage not initialized";
+    return 1;
+  }
+  if (!(snap = snap_open (path, err)))
+    return 1;
+
+  if (snap->hdr.flags != get_snapshot_flags ()) {
+    *err = "taken with different --approx-visitors/--hash-visitor-keys";
+    snap_close (snap);
+    return 1;
+  }
+
+  memset (&m, 0, sizeof (m));
+  m.module = -1;
+  while (!ret && snap_next (snap, &sect, &rd))
+    ret = merge_section (&m, &sect, &rd, glog, resume);
+  if (!ret)
+    ret = merge_module (&m);
+  if (ret)
+    *err = "invalid snapshot data";
+
+  free (m.strs);
+  free (m.attrs);
+  free (m.agents);
+  free (m.visitors);
+  snap_close (snap);
+
+  return ret;
 }
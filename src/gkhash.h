@@ -30,13 +30,32 @@
 #ifndef GKHASH_H_INCLUDED
 #define GKHASH_H_INCLUDED
 
+#define GKH_RECORDS_INIT 64     /* initial num of records per module */
+#define GKH_STRINGS_INIT 1024   /* initial num of interned strings */
+#define GKH_AGENTS_LINEAR 16    /* agent sets searched linearly up to it */
+#define GKH_CODES        1000   /* slots of keys out of bounded domains */
+
 #include <stdint.h>
 
-#include "gslist.h"
+#include "ghll.h"
+#include "gsnapshot.h"
+#include "gspill.h"
 #include "gstorage.h"
 #include "khash.h"
 #include "parser.h"
 
+/* The tables of the storage are allocated through the storage
+ * allocator, so they can spill to files past --memory-limit. Tables
+ * declared elsewhere keep the default one, see below. */
+#undef kcalloc
+#undef kmalloc
+#undef krealloc
+#undef kfree
+#define kcalloc(N,Z) spill_calloc(N,Z)
+#define kmalloc(Z) spill_malloc(Z)
+#define krealloc(P,Z) spill_realloc(P,Z)
+#define kfree(P) spill_free(P)
+
 /* int keys, int payload */
 KHASH_MAP_INIT_INT (ii32, int);
 /* int keys, string payload */
@@ -47,114 +66,146 @@ KHASH_MAP_INIT_INT (iu64, uint64_t);
 KHASH_MAP_INIT_STR (si32, int);
 /* string keys, string payload */
 KHASH_MAP_INIT_STR (ss32, char *);
-/* int keys, GSLList payload */
-KHASH_MAP_INIT_INT (igsl, GSLList *);
+/* int keys, no payload */
+KHASH_SET_INIT_INT (iset);
 /* string keys, uint64_t payload */
 KHASH_MAP_INIT_STR (su64, uint64_t);
+/* uint64_t keys, int payload */
+KHASH_MAP_INIT_INT64 (u64i32, int);
+
+/* User agent keys of a host, in the order they were first seen. Small
+ * sets are searched linearly, larger ones are also indexed by a hash
+ * set. */
+typedef struct GAgentSet_
+{
+  int *keys;
+  int len;                      /* num of keys */
+  int size;                     /* num of allocated keys */
+  khash_t (iset) * index;       /* NULL up to GKH_AGENTS_LINEAR keys */
+} GAgentSet;
+
+/* int keys, GAgentSet payload */
+KHASH_MAP_INIT_INT (iags, GAgentSet);
+/* int keys, GHLL payload */
+KHASH_MAP_INIT_INT (ihll, GHLL);
+
+/* string keys, GLastParse payload */
+KHASH_MAP_INIT_STR (slp, GLastParse);
+
+/* 128-bit hashed key */
+typedef struct GHashKey128_
+{
+  uint64_t lo;
+  uint64_t hi;
+} GHashKey128;
+
+#define kh_h128_hash_func(key) kh_int64_hash_func((key).lo)
+#define kh_h128_hash_equal(a, b) ((a).lo == (b).lo && (a).hi == (b).hi)
+/* 128-bit hashed keys, int payload */
+KHASH_INIT (h128i32, GHashKey128, int, 1, kh_h128_hash_func,
+            kh_h128_hash_equal);
+
+#undef kcalloc
+#undef kmalloc
+#undef krealloc
+#undef kfree
+#define kcalloc(N,Z) calloc(N,Z)
+#define kmalloc(Z) malloc(Z)
+#define krealloc(P,Z) realloc(P,Z)
+#define kfree(P) free(P)
 
 /* Metrics Storage */
 
-/* Maps keys (string) to numeric values (integer).
+/* Strings are interned once for all the modules, within a single
+ * arena, and referred to by a dense integer id. e.g., the same date is
+ * used by the VISITORS keymap and datamap, or the same referrer by
+ * multiple modules.
+ *
+ * /index.php       -> 1
+ * HEAD|/index.php  -> 2
+ * POST|/index.php  -> 3
+ * Windows XP       -> 4
+ * Linux            -> 5
+ * 26/Dec/2014      -> 6
+ */
+/* GKHashStrings */
+
+/* Maps interned keys (string id) to numeric values (integer).
  * This mitigates the issue of having multiple stores
  * with the same string key, and therefore, avoids unnecessary
  * memory usage (in most cases).
  *
- * HEAD|/index.php  -> 1
- * POST|/index.php  -> 2
- * Windows XP       -> 3
- * Ubuntu 10.10     -> 4
- * GET|Ubuntu 10.10 -> 5
- * Linux            -> 6
- * 26/Dec/2014      -> 7
- * Windows          -> 8
+ * HEAD|/index.php  (2) -> 1
+ * POST|/index.php  (3) -> 2
+ * Windows XP       (4) -> 3
+ * Linux            (5) -> 4
+ * 26/Dec/2014      (6) -> 5
  */
-/*khash_t(si32) MTRC_KEYMAP */
+/*khash_t(ii32) MTRC_KEYMAP */
 
 /* Maps integer keys of root elements from the keymap hash
- * to actual string values.
+ * to interned string ids.
  *
- * 6 -> Linux
- * 8 -> Windows
+ * 4 -> 5 (Linux)
  */
-/*khash_t(is32) MTRC_ROOTMAP */
+/*khash_t(ii32) MTRC_ROOTMAP */
 
-/* Maps integer keys of data elements from the keymap hash
- * to actual string values.
+/* Integer keys of data elements from the keymap hash map to interned
+ * string ids on the record of each key (see GKHashRecord).
  *
- * 1 -> /index.php
- * 2 -> /index.php
- * 3 -> Windows XP
- * 4 -> Ubuntu 10.10
- * 5 -> Ubuntu 10.10
- * 7 -> 26/Dec/2014
+ * 1 -> 1 (/index.php)
+ * 2 -> 1 (/index.php)
+ * 3 -> 4 (Windows XP)
+ * 5 -> 6 (26/Dec/2014)
  */
-/*khash_t(is32) MTRC_DATAMAP */
+/* MTRC_DATAMAP */
 
-/* Maps a string key made from the integer key of the
- * IP/date/UA and the integer key from the data field of
- * each module to numeric autoincremented values. e.g., "1|4"
- * => 1 -> unique visitor key (concatenated) with 4 -> data
- * key.
+/* Maps a 64-bit key made from the integer key of the
+ * IP/date/UA (upper 32 bits) and the integer key from the data
+ * field of each module (lower 32 bits) to numeric autoincremented
+ * values. e.g., (1 << 32 | 4) => 1 -> unique visitor key
+ * (concatenated) with 4 -> data key.
  *
- * "1|4" -> 1
- * "1|5" -> 2
+ * (1 << 32 | 4) -> 1
+ * (1 << 32 | 5) -> 2
  */
-/*khash_t(si32) MTRC_UNIQMAP */
+/*khash_t(u64i32) MTRC_UNIQMAP */
 
-/* Maps integer key from the keymap hash to the number of
- * hits.
- *
- * 1 -> 10934
- * 2 -> 3231
- * 3 -> 500
- * 4 -> 201
- * 5 -> 206
- */
-/*khash_t(ii32) MTRC_HITS */
-
-/* Maps numeric keys made from the uniqmap store to autoincremented values
- * (counter).
- * 10 -> 100
- * 40 -> 56
- */
-/*khash_t(ii32) MTRC_VISITORS */
-
-/* Maps numeric data keys to bandwidth (in bytes).
- * 1 -> 1024
- * 2 -> 2048
- */
-/*khash_t(iu64) MTRC_BW */
-
-/* Maps numeric data keys to cumulative time served (in usecs/msecs).
- * 1 -> 187
- * 2 -> 208
+/* Maps numeric data keys to a sketch of the unique visitors seen for
+ * them when approximating unique visitors (--approx-visitors), i.e.,
+ * instead of one uniqmap entry per visitor.
+ * 4 -> HLL {hashes or registers}
+ * 5 -> HLL {hashes or registers}
  */
-/*khash_t(iu64) MTRC_CUMTS */
+/*khash_t(ihll) MTRC_UNIQHLL */
 
-/* Maps numeric data keys to max time served (in usecs/msecs).
- * 1 -> 1287
- * 2 -> 2308
- */
-/*khash_t(iu64) MTRC_MAXTS */
+/* The metrics of each data key are not kept on a hash table of their
+ * own, but all together on a record (GKHashRecord) of a dense array of
+ * records per module, indexed by the integer key from the keymap hash.
+ * Keys are auto incremented, so there are hardly any holes, and a line
+ * needs a single lookup per module to update all of them.
+ *
+ * [1] -> {hits: 10934, visitors: 100, bw: 1024, cumts: 187, maxts: 1287,
+ *         method: 1, protocol: 2, root: 6}
+ * [2] -> {hits: 3231, visitors: 56, bw: 2048, cumts: 208, maxts: 2308,
+ *         method: 3, protocol: 2, root: 6}
+ *
+ * MTRC_ROOT, MTRC_HITS, MTRC_VISITORS, MTRC_BW, MTRC_CUMTS, MTRC_MAXTS,
+ * MTRC_METHODS, MTRC_PROTOCOLS */
 
-/* Maps numeric data keys to string values.
+/* Methods and protocols are kept once for all the records, and each
+ * record refers to them by their integer key.
  * 1 -> GET
- * 2 -> POST
- */
-/*khash_t(is32) MTRC_METHODS */
-
-/* Maps numeric data keys to string values.
- * 1 -> HTTP/1.1
- * 2 -> HTTP/1.0
+ * 2 -> HTTP/1.1
+ * 3 -> POST
  */
-/*khash_t(is32) MTRC_PROTOCOLS */
 
-/* Maps numeric unique user-agent keys to the
- * corresponding numeric value.
- * 1 -> 3
- * 2 -> 4
+/* Maps numeric host keys to the set of numeric user-agent keys seen
+ * from them.
+ * 1 -> {3, 4}
+ * 2 -> {4}
  */
-/*khash_t(igsl) MTRC_AGENTS */
+/*khash_t(iags) MTRC_AGENTS */
 
 /* Enumerated Storage Metrics */
 typedef enum GSMetricType_
@@ -169,10 +220,14 @@ typedef enum GSMetricType_
   MTRC_TYPE_SI32,
   /* string key - string val */
   MTRC_TYPE_SS32,
-  /* int key - GSLList val */
-  MTRC_TYPE_IGSL,
+  /* int key - GAgentSet val */
+  MTRC_TYPE_IAGS,
   /* string key - uint64_t val */
   MTRC_TYPE_SU64,
+  /* uint64_t key - int val */
+  MTRC_TYPE_U64I32,
+  /* int key - GHLL val */
+  MTRC_TYPE_IHLL,
 } GSMetricType;
 
 typedef struct GKHashMetric_
@@ -186,39 +241,220 @@ typedef struct GKHashMetric_
     khash_t (iu64) * iu64;
     khash_t (si32) * si32;
     khash_t (ss32) * ss32;
-    khash_t (igsl) * igsl;
+    khash_t (iags) * iags;
     khash_t (su64) * su64;
+    khash_t (u64i32) * u64i32;
+    khash_t (ihll) * ihll;
   };
 } GKHashMetric;
 
+/* Metrics of a single data key */
+typedef struct GKHashRecord_
+{
+  uint64_t bw;
+  uint64_t cumts;
+  uint64_t maxts;
+  int hits;                     /* 0 if the record is not in use */
+  int visitors;
+  int root;                     /* root key from the keymap hash */
+  int method;                   /* method key, 0 if not set */
+  int protocol;                 /* protocol key, 0 if not set */
+  uint32_t data;                /* data string id, 0 if not set */
+  int topk;                     /* position on the top hits heap + 1 */
+} GKHashRecord;
+
+/* Strings interned across all modules */
+typedef struct GKHashStrings_
+{
+  GArena *arena;                /* strings, stored contiguously */
+  khash_t (si32) * ids;         /* string -> id, keys live on the arena */
+  const char **strs;            /* id -> string */
+  uint32_t size;                /* num of strings, ids start at 1 */
+  uint32_t cap;                 /* num of slots allocated in strs */
+  uint64_t bytes;               /* bytes taken by the strings */
+  uint64_t saved;               /* bytes not duplicated across stores */
+} GKHashStrings;
+
+/* Data key of a panel keeping only its heavy hitters (--heavy-hitters).
+ * Its strings are not interned, so they can be freed once the key is
+ * taken over by a new one. */
+typedef struct GKHashHitter_
+{
+  char *key;                    /* keymap string, NULL if not in use */
+  char *data;                   /* datamap string, NULL if not set */
+  int heap;                     /* position on the hitters heap + 1 */
+} GKHashHitter;
+
+/* Sections of a snapshot of the storage (--persist-snapshot). Tables
+ * used across the whole app come first, then the ones of each module,
+ * starting with its SNAP_MODULE section */
+typedef enum GKSnapSection_
+{
+  SNAP_GENERAL = 1,             /* overall counters of the log */
+  SNAP_STRINGS,                 /* interned strings, in id order */
+  SNAP_AGENT_KEYS,
+  SNAP_AGENT_VALS,
+  SNAP_UNIQUE_KEYS,
+  SNAP_UNIQUE_HKEYS,
+  SNAP_HOSTNAMES,
+  SNAP_ATTR_KEYS,
+  SNAP_ATTR_VALS,
+  SNAP_MODULE,                  /* counters of a module */
+  SNAP_KEYMAP,
+  SNAP_ROOTMAP,
+  SNAP_UNIQMAP,
+  SNAP_UNIQHLL,
+  SNAP_AGENTS,
+  SNAP_METADATA,
+  SNAP_RECORDS,                 /* flat array of GKHashRecord */
+  SNAP_HITTERS,
+  SNAP_LAST_PARSE,              /* high-water marks of the logs */
+} GKSnapSection;
+
+/* A section of a module of a snapshot being merged into the storage.
+ * Sections are merged once all the ones of the module are read, unset
+ * ones are empty */
+typedef struct GKMergeSect_
+{
+  GSnapReader rd;
+  uint64_t count;
+} GKMergeSect;
+
+/* A data key of a module of a snapshot being merged, along with what
+ * refers to it on the other sections of the module */
+typedef struct GKMergeKey_
+{
+  uint32_t id;                  /* keymap string id */
+  const char *root;             /* rootmap string, if a root key */
+  int root_nkey;                /* key on the storage, if a root key */
+  const char *hkey;             /* keymap string, if a heavy hitter */
+  const char *hdata;            /* datamap string, if a heavy hitter */
+  const void *hll;              /* packed unique visitors sketch */
+  uint32_t hll_size;
+  const char *agents;           /* user agent keys, not aligned */
+  uint32_t nagents;
+} GKMergeKey;
+
+/* A unique visitor of a data key of a snapshot being merged */
+typedef struct GKMergeUniq_
+{
+  uint32_t visitor;             /* unique visitor key on the snapshot */
+  uint32_t data;                /* data key on the snapshot */
+} GKMergeUniq;
+
+/* A snapshot being merged into the storage. Keys used across the whole
+ * app are remapped to the ones of the storage through arrays indexed by
+ * their key on the snapshot */
+typedef struct GKMerge_
+{
+  const char **strs;            /* interned strings, by id */
+  uint32_t nstrs;
+  const char **attrs;           /* methods/protocols, by key */
+  uint32_t nattrs;
+  int *agents;                  /* user agent keys */
+  uint32_t nagents;
+  int *visitors;                /* unique visitor keys */
+  uint32_t nvisitors;
+
+  int module;                   /* module being read, -1 if none */
+  int skip;                     /* module not enabled on the storage */
+  GKMergeSect sects[SNAP_HITTERS + 1];
+} GKMerge;
+
+/* Options a snapshot depends on, as they change what is stored */
+#define SNAP_FLAG_APPROX_VISITORS    0x1
+#define SNAP_FLAG_HASH_VISITOR_KEYS  0x2
+
 /* Data Storage per module */
 typedef struct GKHashStorage_
 {
   GModule module;
   GKHashMetric metrics[GSMTRC_TOTAL];
+  int nmetrics;                 /* num of hash tables in metrics */
+
+  GKHashRecord *records;        /* indexed by data key */
+  uint32_t rec_size;            /* num of records allocated */
+  uint32_t rec_count;           /* num of records in use */
+  uint32_t data_count;          /* num of records with a data string */
+
+  /* keys with the most hits, kept up to date as hits are counted on
+   * real-time modes. Min-heap, i.e., the first one ranks last */
+  int *topk;
+  int topk_len;                 /* num of keys on the heap */
+  int topk_max;                 /* max num of keys, 0 if not kept */
+
+  /* keys of panels keeping only their heavy hitters (Space-Saving).
+   * Min-heap of the data keys by hits, the first one is taken over by
+   * new keys once full */
+  khash_t (si32) * hh_keys;     /* keymap string -> data key */
+  GKHashHitter *hitters;        /* indexed by data key */
+  uint32_t hh_size;             /* num of hitters allocated */
+  int *hh;
+  int hh_len;                   /* num of keys on the heap */
+  int hh_max;                   /* max num of keys, 0 if all are kept */
+
+  /* keymap values of keys out of bounded domains, e.g., status codes,
+   * indexed by their code, see ht_insert_code_keymap() */
+  int *codes;
+
+  /* num of buckets the tables were presized to, 0 if they weren't */
+  khint_t keymap_presize;
+  khint_t uniqmap_presize;
 } GKHashStorage;
 
+/* The hash tables of a state of the storage, swapped in and out as a
+ * whole, see ht_swap_state() */
+typedef struct GKHashState_
+{
+  GKHashStorage *storage;
+  GKHashStrings strings;
+  GSnapshot *snapshot;
+  khash_t (is32) * agent_vals;
+  khash_t (si32) * agent_keys;
+  khash_t (si32) * unique_keys;
+  khash_t (h128i32) * unique_hkeys;
+  khash_t (si32) * attr_keys;
+  khash_t (is32) * attr_vals;
+} GKHashState;
+
 void free_storage (void);
 void init_storage (void);
+GKHashState *ht_new_state (void);
+void ht_free_state (GKHashState * state);
+void ht_swap_state (GKHashState * state);
+void ht_presize_module (GModule module, uint32_t keys, uint32_t uniq);
+int ht_persist_snapshot (const char *path, GLog * glog);
+int ht_restore_snapshot (const char *path, GLog * glog, const char **err);
+int ht_merge_snapshot (const char *path, GLog * glog, int resume,
+                       const char **err);
+void ht_presize_storage (uint32_t visitors, uint32_t strings);
 
 int ht_insert_agent_key (const char *key);
 int ht_insert_agent_value (int key, const char *value);
+int ht_insert_unique_hkey (const uint64_t hkey[2]);
 int ht_insert_unique_key (const char *key);
 
 int ht_insert_agent (GModule module, int key, int value);
 int ht_insert_bw (GModule module, int key, uint64_t inc);
+int ht_insert_data_keymap (GModule module, const char *key);
+int ht_insert_code_keymap (GModule module, int code, const char *key,
+                           int data);
 int ht_insert_cumts (GModule module, int key, uint64_t inc);
 int ht_insert_datamap (GModule module, int key, const char *value);
 int ht_insert_hits (GModule module, int key, int inc);
 int ht_insert_hostname (const char *ip, const char *host);
 int ht_insert_keymap (GModule module, const char *key);
+int ht_insert_last_parse (const char *key, const GLastParse * lp);
 int ht_insert_maxts (GModule module, int key, uint64_t value);
 int ht_insert_meta_data (GModule module, const char *key, uint64_t value);
+int ht_insert_metrics (GModule module, int key, int visitor, uint64_t bw,
+                       uint64_t ts);
 int ht_insert_method (GModule module, int key, const char *value);
 int ht_insert_protocol (GModule module, int key, const char *value);
 int ht_insert_root (GModule module, int key, int value);
 int ht_insert_rootmap (GModule module, int key, const char *value);
-int ht_insert_uniqmap (GModule module, const char *key);
+int ht_insert_uniq_hll (GModule module, int key, uint64_t hash);
+int ht_insert_uniqmap (GModule module, uint64_t key);
 int ht_insert_visitor (GModule module, int key, int inc);
 
 uint32_t ht_get_size_datamap (GModule module);
@@ -230,10 +466,13 @@ char *ht_get_hostname (const char *host);
 char *ht_get_method (GModule module, int key);
 char *ht_get_protocol (GModule module, int key);
 char *ht_get_root (GModule module, int key);
-GSLList *ht_get_host_agent_list (GModule module, int key);
+int *ht_get_host_agents (GModule module, int key, int *len);
 int ht_get_hits (GModule module, int key);
+int ht_get_last_parse (const char *key, GLastParse * lp);
+int ht_get_hitters_error (GModule module);
 int ht_get_keymap (GModule module, const char *key);
-int ht_get_uniqmap (GModule module, const char *key);
+int ht_get_root_key (GModule module, int key);
+int ht_get_uniqmap (GModule module, uint64_t key);
 int ht_get_visitors (GModule module, int key);
 uint64_t ht_get_bw (GModule module, int key);
 uint64_t ht_get_cumts (GModule module, int key);
@@ -243,8 +482,12 @@ void ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max);
 void ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max);
 void ht_get_hits_min_max (GModule module, int *min, int *max);
 void ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max);
+void ht_get_mem_shared (GSMemUsage * mem);
+void ht_get_mem_usage (GModule module, GSMetric metric, GSMemUsage * mem);
 void ht_get_visitors_min_max (GModule module, int *min, int *max);
 
 GRawData *parse_raw_data (GModule module);
+GRawData *parse_raw_data_unsorted (GModule module);
+GRawData *parse_raw_keys_data (GModule module, const int *keys, int len);
 
 #endif // for #ifndef GKHASH_H
@@ -0,0 +1,288 @@
+/**
+ * gmatch.c -- Multi-pattern string matching (Aho-Corasick)
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gmatch.h"
+
+#include "xmalloc.h"
+
+/* Allocate memory for a new matcher instance.
+ *
+ * On success, the newly allocated GMatch is returned. */
+GMatch *
+new_gmatch (void)
+{
+  GMatch *gm = xcalloc (1, sizeof (GMatch));
+
+  return gm;
+}
+
+/* Release all the memory used by the given matcher. */
+void
+free_gmatch (GMatch * gm)
+{
+  int i;
+
+  if (gm == NULL)
+    return;
+
+  for (i = 0; i < gm->npatterns; ++i)
+    free (gm->patterns[i]);
+  free (gm->patterns);
+  free (gm->plen);
+  free (gm->group);
+  free (gm->delta);
+  free (gm->out);
+  free (gm);
+}
+
+/* Add a pattern to the given group of the matcher. Patterns added
+ * first take precedence over the ones added after them. The matcher
+ * needs to be (re)built before searching.
+ *
+ * On success, the index (priority) of the pattern is returned. */
+int
+gmatch_add_group (GMatch * gm, const char *pattern, int group)
+{
+  if (gm->npatterns == gm->size) {
+    gm->size = gm->size ? gm->size * 2 : 64;
+    gm->patterns = xrealloc (gm->patterns, gm->size * sizeof (char *));
+    gm->plen = xrealloc (gm->plen, gm->size * sizeof (int));
+    gm->group = xrealloc (gm->group, gm->size * sizeof (int));
+  }
+
+  gm->patterns[gm->npatterns] = xstrdup (pattern);
+  gm->plen[gm->npatterns] = strlen (pattern);
+  gm->group[gm->npatterns] = group;
+  if (group >= gm->ngroups)
+    gm->ngroups = group + 1;
+
+  return gm->npatterns++;
+}
+
+/* Add a pattern to the first group of the matcher.
+ *
+ * On success, the index (priority) of the pattern is returned. */
+int
+gmatch_add (GMatch * gm, const char *pattern)
+{
+  return gmatch_add_group (gm, pattern, 0);
+}
+
+/* Map each byte found within the patterns to its own character class.
+ * Any other byte maps to class 0, so the transition table is only as
+ * wide as the set of distinct bytes used by the patterns. */
+static void
+set_classes (GMatch * gm)
+{
+  const unsigned char *p;
+  int i;
+
+  memset (gm->cls, 0, sizeof (gm->cls));
+  gm->nclasses = 1;
+  for (i = 0; i < gm->npatterns; ++i) {
+    for (p = (const unsigned char *) gm->patterns[i]; *p; ++p) {
+      if (gm->cls[*p] == 0)
+        gm->cls[*p] = gm->nclasses++;
+    }
+  }
+}
+
+/* Build the trie out of all the patterns. The highest priority pattern
+ * of each group ending at each state is kept.
+ *
+ * On success, the number of states is returned. */
+static int
+build_trie (GMatch * gm)
+{
+  const unsigned char *p;
+  int i, s, nc = gm->nclasses, ng = gm->ngroups, nstates = 1, max = 1;
+  int *next = NULL;
+
+  for (i = 0; i < gm->npatterns; ++i)
+    max += gm->plen[i];
+
+  gm->delta = xmalloc (max * nc * sizeof (int));
+  gm->out = xmalloc (max * ng * sizeof (int));
+  memset (gm->delta, -1, max * nc * sizeof (int));
+  memset (gm->out, -1, max * ng * sizeof (int));
+
+  for (i = 0; i < gm->npatterns; ++i) {
+    s = 0;
+    for (p = (const unsigned char *) gm->patterns[i]; *p; ++p) {
+      next = &gm->delta[s * nc + gm->cls[*p]];
+      if (*next == -1)
+        *next = nstates++;
+      s = *next;
+    }
+    /* patterns are added in priority order */
+    if (gm->out[s * ng + gm->group[i]] == -1)
+      gm->out[s * ng + gm->group[i]] = i;
+  }
+
+  return nstates;
+}
+
+/* Compute the failure links in breadth-first order and turn the trie
+ * into a deterministic automaton, i.e., a single transition per
+ * input byte. Each state inherits the highest priority pattern of each
+ * group ending at its failure state. */
+static void
+build_automaton (GMatch * gm)
+{
+  int *fail = NULL, *queue = NULL, *of = NULL, *ot = NULL;
+  int c, g, s, t, f, head = 0, tail = 0, nc = gm->nclasses;
+
+  fail = xcalloc (gm->nstates, sizeof (int));
+  queue = xmalloc (gm->nstates * sizeof (int));
+
+  for (c = 0; c < nc; ++c) {
+    if ((t = gm->delta[c]) == -1) {
+      gm->delta[c] = 0;
+      continue;
+    }
+    fail[t] = 0;
+    queue[tail++] = t;
+  }
+
+  while (head < tail) {
+    s = queue[head++];
+    for (c = 0; c < nc; ++c) {
+      f = gm->delta[fail[s] * nc + c];
+      if ((t = gm->delta[s * nc + c]) == -1) {
+        gm->delta[s * nc + c] = f;
+        continue;
+      }
+      fail[t] = f;
+      of = &gm->out[f * gm->ngroups];
+      ot = &gm->out[t * gm->ngroups];
+      for (g = 0; g < gm->ngroups; ++g) {
+        if (of[g] != -1 && (ot[g] == -1 || of[g] < ot[g]))
+          ot[g] = of[g];
+      }
+      queue[tail++] = t;
+    }
+  }
+
+  free (fail);
+  free (queue);
+}
+
+/* Build the matcher once all patterns have been added. */
+void
+gmatch_build (GMatch * gm)
+{
+  free (gm->delta);
+  free (gm->out);
+
+  if (gm->ngroups == 0)
+    gm->ngroups = 1;
+
+  set_classes (gm);
+  gm->nstates = build_trie (gm);
+  build_automaton (gm);
+}
+
+/* Find, in a single pass over the given string, the highest priority
+ * pattern contained in it. This is equivalent to calling strstr(3) for
+ * each pattern in priority order and stopping at the first one found.
+ *
+ * If no pattern is found, -1 is returned.
+ * On success, the index of the pattern is returned and match is set to
+ * its first occurrence within the string. */
+int
+gmatch_find (const GMatch * gm, const char *str, const char **match)
+{
+  const unsigned char *p = (const unsigned char *) str;
+  int s = 0, best = -1, nc = gm->nclasses, ng = gm->ngroups, o;
+
+  if (gm->delta == NULL)
+    return -1;
+
+  /* an empty pattern matches right away */
+  if ((best = gm->out[0]) != -1)
+    *match = str;
+
+  for (; *p != '\0' && best != 0; ++p) {
+    s = gm->delta[s * nc + gm->cls[*p]];
+    if ((o = gm->out[s * ng]) == -1 || (best != -1 && o >= best))
+      continue;
+    best = o;
+    *match = (const char *) p - gm->plen[best] + 1;
+  }
+
+  return best;
+}
+
+/* Find, in a single pass over the given string, the highest priority
+ * pattern of each group contained in it, see gmatch_find(). Both idx
+ * and match hold one entry per group.
+ *
+ * On success, the number of groups a pattern was found for is
+ * returned. idx is set to the index of the pattern of each group, -1
+ * if none, and match to its first occurrence within the string. */
+int
+gmatch_find_groups (const GMatch * gm, const char *str, int *idx,
+                    const char **match)
+{
+  const unsigned char *p = (const unsigned char *) str;
+  const int *out = NULL;
+  int g, s = 0, found = 0, nc = gm->nclasses, ng = gm->ngroups;
+
+  for (g = 0; g < ng; ++g)
+    idx[g] = -1;
+  if (gm->delta == NULL)
+    return 0;
+
+  /* an empty pattern matches right away */
+  for (g = 0; g < ng; ++g) {
+    if ((idx[g] = gm->out[g]) != -1) {
+      match[g] = str;
+      found++;
+    }
+  }
+
+  for (; *p != '\0'; ++p) {
+    s = gm->delta[s * nc + gm->cls[*p]];
+    out = &gm->out[s * ng];
+    for (g = 0; g < ng; ++g) {
+      if (out[g] == -1 || (idx[g] != -1 && out[g] >= idx[g]))
+        continue;
+      if (idx[g] == -1)
+        found++;
+      idx[g] = out[g];
+      match[g] = (const char *) p - gm->plen[idx[g]] + 1;
+    }
+  }
+
+  return found;
+}
@@ -0,0 +1,64 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GMATCH_H_INCLUDED
+#define GMATCH_H_INCLUDED
+
+/* Multi-pattern string matcher (Aho-Corasick). Patterns are given a
+ * priority in the order they are added, the lower the index the higher
+ * the priority. They may be split into groups, each one yielding its
+ * own match out of the same pass. Once built, it's read-only and can
+ * be shared across threads. */
+typedef struct GMatch_
+{
+  char **patterns;              /* patterns added, in priority order */
+  int *plen;                    /* length of each pattern */
+  int *group;                   /* group of each pattern */
+  int npatterns;
+  int ngroups;
+  int size;                     /* allocated pattern slots */
+
+  unsigned char cls[256];       /* byte to character class */
+  int nclasses;                 /* 0 is for bytes not in any pattern */
+  int nstates;
+  int *delta;                   /* transitions, nstates * nclasses */
+  int *out;                     /* highest priority pattern of each group
+                                 * ending at state, nstates * ngroups */
+} GMatch;
+
+GMatch *new_gmatch (void);
+int gmatch_add (GMatch * gm, const char *pattern);
+int gmatch_add_group (GMatch * gm, const char *pattern, int group);
+int gmatch_find (const GMatch * gm, const char *str, const char **match);
+int gmatch_find_groups (const GMatch * gm, const char *str, int *idx,
+                        const char **match);
+void free_gmatch (GMatch * gm);
+void gmatch_build (GMatch * gm);
+
+#endif // for #ifndef GMATCH_H
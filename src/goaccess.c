@@ -50,7 +50,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #ifdef HAVE_LIBTOKYOCABINET
@@ -60,18 +62,25 @@
 #endif
 
 #ifdef HAVE_GEOLOCATION
+#include "geocache.h"
 #include "geoip1.h"
 #endif
 
+#include "arrow.h"
 #include "browsers.h"
 #include "csv.h"
 #include "error.h"
+#include "gbench.h"
 #include "gdashboard.h"
 #include "gdns.h"
 #include "gholder.h"
 #include "goaccess.h"
+#include "gstats.h"
+#include "gwatch.h"
 #include "gwsocket.h"
 #include "json.h"
+#include "opesys.h"
+#include "uacache.h"
 #include "options.h"
 #include "output.h"
 #include "util.h"
@@ -101,6 +110,8 @@ static GHolder *holder;
 static GLog *glog;
 /* Old signal mask */
 static sigset_t oldset;
+/* memory usage dump requested through SIGUSR1 */
+static volatile sig_atomic_t mem_dump = 0;
 /* Curses windows */
 static WINDOW *header_win, *main_win;
 
@@ -135,17 +146,16 @@ static GScroll gscroll = {
 static void
 house_keeping_holder (void)
 {
-  /* REVERSE DNS THREAD */
-  pthread_mutex_lock (&gdns_thread.mutex);
+  /* REVERSE DNS THREADS */
+  /* kill dns pthreads and clear reverse dns queue */
+  gdns_free_queue ();
 
-  /* kill dns pthread */
-  active_gdns = 0;
+  pthread_mutex_lock (&gdns_thread.mutex);
   /* clear holder structure */
   free_holder (&holder);
-  /* clear reverse dns queue */
-  gdns_free_queue ();
   /* clear the whole storage */
   free_storage ();
+  free_dirty_keys ();
 
   pthread_mutex_unlock (&gdns_thread.mutex);
 }
@@ -154,12 +164,6 @@ house_keeping_holder (void)
 static void
 house_keeping (void)
 {
-#ifdef TCB_MEMHASH
-  /* free malloc'd int values on the agent list */
-  if (conf.list_agents)
-    free_agent_list ();
-#endif
-
   house_keeping_holder ();
 
   /* DASHBOARD */
@@ -170,10 +174,12 @@ house_keeping (void)
 
   /* GEOLOCATION */
 #ifdef HAVE_GEOLOCATION
+  free_geo_cache ();
   geoip_free ();
 #endif
 
   /* LOGGER */
+  gfile_close (glog->pipe_file);
   if (glog->pipe)
     fclose (glog->pipe);
   free_logerrors (glog);
@@ -186,8 +192,18 @@ house_keeping (void)
   }
 
   /* CONFIGURATION */
+  free_log_format_prog ();
+  free_static_files ();
+  free_parse_arena ();
+#ifndef HAVE_LIBTOKYOCABINET
+  free_time_window ();
+  free_vhost_splits ();
+#endif
   free_formats ();
+  free_ua_cache ();
   free_browsers_hash ();
+  free_opesys ();
+  free_ip_ranges ();
   if (conf.debug_log) {
     LOG_DEBUG (("Bye.\n"));
     dbg_log_close ();
@@ -200,6 +216,8 @@ house_keeping (void)
   /* free cmd arguments */
   free_cmd_args ();
   /* WebSocket writer */
+  if (gwswriter)
+    ws_fifo_clear (&gwswriter->queue);
   free (gwswriter);
   /* WebSocket reader */
   free (gwsreader);
@@ -288,17 +306,64 @@ allocate_holder_by_module (GModule module)
   load_holder_data (raw_data, holder + module, module, module_sort[module]);
 }
 
+/* Bring the holder of the given module up to date. If possible, only
+ * the keys that changed since it was last loaded are extracted from the
+ * hash structures and merged into it, otherwise it's loaded again. */
+static void
+refresh_holder_by_module (GModule module)
+{
+  GRawData *raw_data = NULL;
+  int *keys = NULL, len = 0;
+
+  keys = pop_dirty_keys (module, &len);
+  if (keys != NULL && can_update_holder (module) &&
+      (raw_data = parse_raw_keys_data (module, keys, len)) != NULL) {
+    update_holder_data (raw_data, holder + module, module, module_sort[module]);
+    free (keys);
+    return;
+  }
+  free (keys);
+
+  free_holder_by_module (&holder, module);
+  allocate_holder_by_module (module);
+}
+
+/* Bring the holders of the modules that changed since they were last
+ * loaded up to date.
+ *
+ * On success, a bit mask of the modules that changed is returned. */
+static uint32_t
+refresh_holder (void)
+{
+  GHolderJobs jobs = {.build = refresh_holder_by_module };
+  uint32_t dirty = 0;
+  size_t idx = 0;
+  GModule module;
+
+  dirty = pop_dirty_modules ();
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    if (dirty & (UINT32_C (1) << module))
+      jobs.modules[jobs.len++] = module;
+  }
+  run_holder_jobs (&jobs, conf.jobs);
+
+  return dirty;
+}
+
 /* Iterate over all modules/panels and extract data from hash
  * structures and load it into an instance of GHolder */
 static void
 allocate_holder (void)
 {
+  GHolderJobs jobs = {.build = allocate_holder_by_module };
   size_t idx = 0;
 
   holder = new_gholder (TOTAL_MODULES);
   FOREACH_MODULE (idx, module_list) {
-    allocate_holder_by_module (module_list[idx]);
+    jobs.modules[jobs.len++] = module_list[idx];
   }
+  run_holder_jobs (&jobs, conf.jobs);
 }
 
 /* Extract data from the modules GHolder structure and load it into
@@ -468,7 +533,7 @@ load_ip_agent_list (void)
   int sel = gscroll.module[gscroll.current].scroll;
   GDashData item = dash->module[HOSTS].data[sel];
 
-  if (!invalid_ipaddr (item.metrics->data, &type_ip))
+  if (!item.is_subitem && !invalid_ipaddr (item.metrics->data, &type_ip))
     load_agent_list (main_win, item.metrics->data);
 }
 
@@ -499,7 +564,7 @@ static void
 expand_module_from_ypos (int y)
 {
   /* ignore header/footer clicks */
-  if (y < MAX_HEIGHT_HEADER || y == LINES - 1)
+  if (y < get_header_height () || y == LINES - 1)
     return;
 
   if (set_module_from_mouse_event (&gscroll, dash, y))
@@ -661,39 +726,71 @@ static void
 tail_term (void)
 {
   pthread_mutex_lock (&gdns_thread.mutex);
-  free_holder (&holder);
-  pthread_cond_broadcast (&gdns_thread.not_empty);
+  refresh_holder ();
   pthread_mutex_unlock (&gdns_thread.mutex);
 
   free_dashboard (dash);
-  allocate_holder ();
   allocate_data ();
 
   term_size (main_win, &main_win_height);
   render_screens ();
 }
 
-static void
+/* Reload the panels that changed since the last update and broadcast
+ * only those (plus the overall data) to every client. A full report is
+ * sent to a client upon connecting, see fast_forward_client().
+ *
+ * If the update is left pending as the pipe is still busy, 1 is
+ * returned. Otherwise 0 is returned. */
+static int
 tail_html (void)
 {
   char *json = NULL;
+  uint32_t dirty = 0;
 
-  pthread_mutex_lock (&gdns_thread.mutex);
-  free_holder (&holder);
-  pthread_cond_broadcast (&gdns_thread.not_empty);
-  pthread_mutex_unlock (&gdns_thread.mutex);
-
-  allocate_holder ();
+  /* the pipe is still busy, changes keep piling up on the dirty panels
+   * until it drains, so a single update covers all of them */
+  if (flush_holder (gwswriter) > 0)
+    return 1;
 
   pthread_mutex_lock (&gdns_thread.mutex);
-  json = get_json (glog, holder, 0);
+  if ((dirty = refresh_holder ()) == 0) {
+    pthread_mutex_unlock (&gdns_thread.mutex);
+    return 0;
+  }
+  json = get_json_panels (glog, holder, dirty, 0);
   pthread_mutex_unlock (&gdns_thread.mutex);
 
   if (json == NULL)
-    return;
+    return 0;
 
-  broadcast_holder (gwswriter->fd, json, strlen (json));
+  broadcast_holder (gwswriter, json, strlen (json));
   free (json);
+
+  return 0;
+}
+
+/* Send the latest JSON data of each panel on its own to a client whose
+ * connection was just opened, see --html-lazy-panels. The client
+ * renders panels as they come, instead of parsing them all at once. */
+static void
+fast_forward_panels (int listener)
+{
+  char *json = NULL;
+  uint32_t panel = 0;
+  size_t idx = 0;
+
+  FOREACH_MODULE (idx, module_list) {
+    panel = UINT32_C (1) << module_list[idx];
+    pthread_mutex_lock (&gdns_thread.mutex);
+    json = get_json_panels (glog, holder, panel, 0);
+    pthread_mutex_unlock (&gdns_thread.mutex);
+
+    if (json == NULL)
+      continue;
+    send_panel_to_client (gwswriter, listener, json, strlen (json));
+    free (json);
+  }
 }
 
 /* Fast-forward latest JSON data when client connection is opened. */
@@ -702,6 +799,11 @@ fast_forward_client (int listener)
 {
   char *json = NULL;
 
+  if (conf.html_lazy_panels) {
+    fast_forward_panels (listener);
+    return;
+  }
+
   pthread_mutex_lock (&gdns_thread.mutex);
   json = get_json (glog, holder, 0);
   pthread_mutex_unlock (&gdns_thread.mutex);
@@ -709,9 +811,7 @@ fast_forward_client (int listener)
   if (json == NULL)
     return;
 
-  pthread_mutex_lock (&gwswriter->mutex);
-  send_holder_to_client (gwswriter->fd, listener, json, strlen (json));
-  pthread_mutex_unlock (&gwswriter->mutex);
+  send_holder_to_client (gwswriter, listener, json, strlen (json));
   free (json);
 }
 
@@ -742,79 +842,117 @@ read_client (void *ptr_data)
   close (reader->fd);
 }
 
-/* Parse tailed lines */
+/* Parse tailed lines, taking the lock once per batch of lines */
 static void
-parse_tail_follow (FILE * fp)
+parse_tail_follow (GFile * file)
 {
-#ifdef WITH_GETLINE
-  char *buf = NULL;
-#else
-  char buf[LINE_BUFFER] = { 0 };
-#endif
+  parse_tail (&glog, file, &gdns_thread.mutex);
+}
 
-#ifdef WITH_GETLINE
-  while ((buf = fgetline (fp)) != NULL) {
-#else
-  while (fgets (buf, LINE_BUFFER, fp) != NULL) {
-#endif
-    pthread_mutex_lock (&gdns_thread.mutex);
-    parse_log (&glog, buf, 0);
-    pthread_mutex_unlock (&gdns_thread.mutex);
-#ifdef WITH_GETLINE
-    free (buf);
-#endif
+/* Follow the logs (and the piped data) given on the command line from
+ * their current end.
+ *
+ * On success, the newly allocated GWatch is returned. */
+static GWatch *
+new_tail_watch (void)
+{
+  GWatch *watch = new_gwatch ();
+  int i;
+
+  for (i = 0; i < conf.filenames_idx; ++i) {
+    if (conf.filenames[i][0] == '-' && conf.filenames[i][1] == '\0') {
+      if (glog->pipe && !glog->pipe_file)
+        glog->pipe_file = gfile_drain (fileno (glog->pipe));
+      if (glog->pipe_file)
+        gwatch_add_pipe (watch, gfile_poll_fd (glog->pipe_file));
+      continue;
+    }
+    /* compressed logs are not expected to grow */
+    if (gfile_compressed (conf.filenames[i]))
+      continue;
+    if (gwatch_add (watch, conf.filenames[i]))
+      FATAL ("Unable to read log file %s.", strerror (errno));
   }
+
+  return watch;
 }
 
-/* Process appended log data */
-static void
-perform_tail_follow (uint64_t * size1, const char *fn)
+/* Process the log data appended (or piped) since the last wake up of
+ * the given watch.
+ *
+ * If no log changed, 0 is returned.
+ * Otherwise 1 is returned. */
+static int
+perform_tail_follow (GWatch * watch)
 {
-  FILE *fp = NULL;
-  uint64_t size2 = 0;
-
-  if (fn[0] == '-' && fn[1] == '\0') {
-    parse_tail_follow (glog->pipe);
-    goto out;
+  GWatchFile *wf = NULL;
+  int i, ret = 0;
+
+  if (watch->pipe_ready) {
+    if (glog->pipe && !glog->pipe_file)
+      glog->pipe_file = gfile_drain (fileno (glog->pipe));
+    if (glog->pipe_file)
+      parse_tail_follow (glog->pipe_file);
+    ret = 1;
   }
-  if (glog->load_from_disk_only)
-    return;
 
-  size2 = file_size (fn);
+  for (i = 0; i < watch->len; ++i) {
+    wf = &watch->files[i];
+    if (!wf->changed)
+      continue;
+    wf->changed = 0;
 
-  /* file hasn't changed */
-  if (size2 == *size1)
-    return;
+    parse_tail_follow (wf->file);
+    /* truncated or rotated, the new data is read from its beginning */
+    if (gwatch_rotate (watch, wf))
+      parse_tail_follow (wf->file);
 
-  if (!(fp = fopen (fn, "r")))
-    FATAL ("Unable to read log file %s.", strerror (errno));
+    /* appended data is accounted for a later run as well */
+    pthread_mutex_lock (&gdns_thread.mutex);
+    set_last_parse (wf->file);
+    pthread_mutex_unlock (&gdns_thread.mutex);
+    ret = 1;
+  }
+
+  return ret;
+}
 
-  if (!fseeko (fp, *size1, SEEK_SET))
-    parse_tail_follow (fp);
-  fclose (fp);
+/* Dump the memory taken by the storage if it was requested through
+ * SIGUSR1 since the last check. */
+static void
+check_mem_dump (void)
+{
+  if (!mem_dump)
+    return;
 
-  *size1 = size2;
+  mem_dump = 0;
+  dump_mem_usage ();
+}
 
-out:
+/* Get the current time in milliseconds. */
+static uint64_t
+get_msecs (void)
+{
+  struct timeval tv;
 
-  if (!conf.output_stdout)
-    tail_term ();
-  else
-    tail_html ();
+  gettimeofday (&tv, NULL);
 
-  usleep (200000);      /* 0.2 seconds */
+  return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
 /* Entry point to start processing the HTML output */
 static void
 process_html (const char *filename)
 {
-  uint64_t *size1 = NULL;
-  int i = 0;
+  GWatch *watch = NULL;
+  uint64_t last = 0, elapsed = 0;
+  int pending = 0, timeout = -1;
 
   /* render report */
   pthread_mutex_lock (&gdns_thread.mutex);
   output_html (glog, holder, filename);
+  /* the holder is up to date, only later changes need to be pushed */
+  pop_dirty_modules ();
   pthread_mutex_unlock (&gdns_thread.mutex);
   /* not real time? */
   if (!conf.real_time_html)
@@ -831,25 +969,34 @@ process_html (const char *filename)
   if (gwswriter->fd == -1)
     return;
 
-  size1 = xcalloc (conf.filenames_idx, sizeof (uint64_t));
-  for (i = 0; i < conf.filenames_idx; ++i) {
-    if (conf.filenames[i][0] == '-' && conf.filenames[i][1] == '\0')
-      size1[i] = 0;
-    else
-      size1[i] = file_size (conf.filenames[i]);
-  }
+  watch = new_tail_watch ();
 
   set_ready_state ();
-  while (1) {
-    if (conf.stop_processing)
-      break;
-
-    for (i = 0; i < conf.filenames_idx; ++i)
-      perform_tail_follow (&size1[i], conf.filenames[i]);       /* 0.2 secs */
-    usleep (800000);    /* 0.8 secs */
+  while (!conf.stop_processing) {
+    check_mem_dump ();
+    /* wakes up on writes only, or once in a while if idle */
+    if (gwatch_wait (watch, timeout) > 0 && perform_tail_follow (watch))
+      pending = 1;
+
+    /* coalesce bursts of writes into a bounded refresh rate */
+    elapsed = get_msecs () - last;
+    if (pending && elapsed < GWATCH_REFRESH_MS) {
+      timeout = GWATCH_REFRESH_MS - (int) elapsed;
+      continue;
+    }
+    if (pending) {
+      pending = tail_html ();
+      last = get_msecs ();
+    }
+    /* keep flushing what's left of an update or of a snapshot sent to a
+     * client until the pipe drains */
+    if (!pending && flush_holder (gwswriter) > 0)
+      timeout = GWATCH_REFRESH_MS;
+    else
+      timeout = pending ? GWATCH_REFRESH_MS : -1;
   }
   close (gwswriter->fd);
-  free (size1);
+  free_gwatch (watch);
 }
 
 /* Iterate over available panels and advance the panel pointer. */
@@ -907,7 +1054,6 @@ render_sort_dialog (void)
 
   pthread_mutex_lock (&gdns_thread.mutex);
   free_holder (&holder);
-  pthread_cond_broadcast (&gdns_thread.not_empty);
   pthread_mutex_unlock (&gdns_thread.mutex);
 
   free_dashboard (dash);
@@ -921,22 +1067,16 @@ static void
 get_keys (void)
 {
   int search = 0;
-  int c, quit = 1, i;
-  uint64_t *size1 = NULL;
-
-  if (!glog->load_from_disk_only && conf.filenames_idx) {
-    size1 = xcalloc (conf.filenames_idx, sizeof (uint64_t));
-    for (i = 0; i < conf.filenames_idx; ++i) {
-      if (conf.filenames[i][0] == '-' && conf.filenames[i][1] == '\0')
-        size1[i] = 0;
-      else
-        size1[i] = file_size (conf.filenames[i]);
-    }
-  }
+  int c, quit = 1;
+  GWatch *watch = NULL;
+
+  if (!glog->load_from_disk_only && conf.filenames_idx)
+    watch = new_tail_watch ();
 
   while (quit) {
     if (conf.stop_processing)
       break;
+    check_mem_dump ();
     c = wgetch (stdscr);
     switch (c) {
     case 'q':  /* quit */
@@ -1102,12 +1242,13 @@ get_keys (void)
       window_resize ();
       break;
     default:
-      for (i = 0; i < conf.filenames_idx; ++i)
-        perform_tail_follow (&size1[i], conf.filenames[i]);
+      /* check for changes without blocking, keys are waited for */
+      if (watch && gwatch_wait (watch, 0) > 0 && perform_tail_follow (watch))
+        tail_term ();
       break;
     }
   }
-  free (size1);
+  free_gwatch (watch);
 }
 
 /* Set general/overall statistics when loading data from the on-disk
@@ -1147,6 +1288,52 @@ set_accumulated_time (void)
 }
 #endif
 
+#ifndef HAVE_LIBTOKYOCABINET
+/* Restore the in-memory storage and the overall counters from a
+ * snapshot. i.e., --restore-snapshot */
+static void
+restore_snapshot (void)
+{
+  const char *err = NULL;
+
+  if (ht_restore_snapshot (conf.restore_snapshot, glog, &err))
+    FATAL ("Unable to restore snapshot %s: %s", conf.restore_snapshot, err);
+}
+
+/* Merge the snapshots of other hosts into the in-memory storage and
+ * the overall counters, in the order they were given. i.e., --merge */
+static void
+merge_snapshots (void)
+{
+  const char *err = NULL;
+  int i;
+
+  for (i = 0; i < conf.merge_snapshot_idx; ++i) {
+    if (ht_merge_snapshot (conf.merge_snapshots[i], glog, 0, &err))
+      FATAL ("Unable to merge snapshot %s: %s", conf.merge_snapshots[i],
+             err);
+  }
+}
+
+/* Persist the in-memory storage and the overall counters into a
+ * snapshot. i.e., --persist-snapshot */
+static void
+persist_snapshot (void)
+{
+  int ret = 0;
+
+  /* the resolver may be updating the hostnames */
+  pthread_mutex_lock (&gdns_thread.mutex);
+  ret = ht_persist_snapshot (conf.persist_snapshot, glog);
+  pthread_mutex_unlock (&gdns_thread.mutex);
+
+  if (ret)
+    fprintf (stderr, "Unable to persist snapshot %s: %s\n",
+             conf.persist_snapshot, strerror (errno));
+}
+
+#endif
+
 /* Execute the following calls right before we start the main
  * processing/parsing loop */
 static void
@@ -1158,6 +1345,17 @@ init_processing (void)
   init_storage ();
   if (conf.load_from_disk)
     set_general_stats ();
+#ifndef HAVE_LIBTOKYOCABINET
+  if (conf.restore_snapshot)
+    restore_snapshot ();
+  if (conf.merge_snapshot_idx)
+    merge_snapshots ();
+  /* reports per virtual host are only output along with reports to
+   * files, and they are not kept within a time window */
+  if (!conf.output_stdout || conf.process_and_exit || conf.real_time_html ||
+      conf.time_window)
+    conf.split_vhost_dir = NULL;
+#endif
   set_spec_date_format ();
 }
 
@@ -1165,7 +1363,7 @@ init_processing (void)
 static void
 standard_output (void)
 {
-  char *csv = NULL, *json = NULL, *html = NULL;
+  char *csv = NULL, *json = NULL, *html = NULL, *arrow = NULL;
 
   /* CSV */
   if (find_output_type (&csv, "csv", 1) == 0)
@@ -1173,15 +1371,138 @@ standard_output (void)
   /* JSON */
   if (find_output_type (&json, "json", 1) == 0)
     output_json (glog, holder, json);
+  /* Arrow */
+  if (find_output_type (&arrow, "arrow", 1) == 0)
+    output_arrow (holder, arrow);
   /* HTML */
   if (find_output_type (&html, "html", 1) == 0 || conf.output_format_idx == 0)
     process_html (html);
 
+  free (arrow);
   free (csv);
   free (html);
   free (json);
 }
 
+/* Determine if the only report to output is a CSV one streamed
+ * straight from the storage, in which case no holder is needed.
+ *
+ * If so, 1 is returned, else 0. */
+static int
+streams_csv_only (void)
+{
+  if (!conf.output_stdout || !conf.csv_stream || conf.output_format_idx == 0)
+    return 0;
+  if (conf.process_and_exit || conf.real_time_html)
+    return 0;
+
+  return find_output_type (NULL, "json", 0) != 0 &&
+    find_output_type (NULL, "html", 0) != 0;
+}
+
+#ifndef HAVE_LIBTOKYOCABINET
+/* Build the path of the given output file of the report of the given
+ * virtual host, i.e., named after the virtual host within
+ * --split-by-vhost, with the extension of the output. Characters that
+ * don't belong in a file name are replaced.
+ *
+ * On success the newly malloc'd path is returned. */
+static char *
+get_vhost_report_path (const char *vhost, const char *output)
+{
+  const char *ext = strrchr (output, '.');
+  char *path = NULL, *p = NULL;
+
+  /* e.g., -o json */
+  ext = ext ? ext + 1 : output;
+  path = xmalloc (strlen (conf.split_vhost_dir) + strlen (vhost) +
+                  strlen (ext) + 4);
+  p = path + sprintf (path, "%s/", conf.split_vhost_dir);
+
+  /* no hidden file, nor one out of the directory */
+  if (*vhost == '.')
+    *p++ = '_';
+  for (; *vhost; vhost++)
+    *p++ = isalnum ((unsigned char) *vhost) || strchr ("._-", *vhost) ?
+      *vhost : '_';
+  sprintf (p, ".%s", ext);
+
+  return path;
+}
+
+/* Output the report of the given virtual host, out of its storage and
+ * its overall counters. This is run from a child process, so whatever
+ * is in use can be replaced. */
+static void
+output_vhost_report (GVhostSplit * split)
+{
+  int i;
+
+  ht_swap_state (split->state);
+  glog->processed = split->counters.processed;
+  glog->valid = split->counters.valid;
+  glog->resp_size = split->counters.resp_size;
+  glog->invalid = glog->excluded_ip = 0;
+
+  free_holder (&holder);
+  if (!streams_csv_only ())
+    allocate_holder ();
+
+  /* HTML through stdout otherwise */
+  if (conf.output_format_idx == 0)
+    conf.output_formats[conf.output_format_idx++] = "html";
+  for (i = 0; i < conf.output_format_idx; ++i)
+    conf.output_formats[i] =
+      get_vhost_report_path (split->vhost, conf.output_formats[i]);
+
+  standard_output ();
+}
+
+/* Output the reports of the virtual hosts, i.e., --split-by-vhost.
+ * Each report is output by a child process, up to --jobs at once, as
+ * the storage in use is swapped for the one of its virtual host. */
+static void
+output_vhost_reports (void)
+{
+  GVhostSplit *splits = NULL;
+  int i, len = 0, running = 0, status = 0, failed = 0;
+  pid_t pid;
+
+  if ((splits = get_vhost_splits (&len)) == NULL)
+    return;
+  if (mkdir (conf.split_vhost_dir, 0755) == -1 && errno != EEXIST)
+    FATAL ("Unable to create %s: %s", conf.split_vhost_dir, strerror (errno));
+
+  /* nothing buffered is written twice */
+  fflush (stdout);
+  fflush (stderr);
+  for (i = 0; i < len; i++) {
+    if (running == conf.jobs) {
+      if (wait (&status) > 0 && (!WIFEXITED (status) || WEXITSTATUS (status)))
+        failed++;
+      running--;
+    }
+
+    if ((pid = fork ()) == -1)
+      FATAL ("Unable to fork: %s", strerror (errno));
+    if (pid == 0) {
+      output_vhost_report (&splits[i]);
+      fflush (stdout);
+      _exit (EXIT_SUCCESS);
+    }
+    running++;
+  }
+
+  while (running-- > 0) {
+    if (wait (&status) > 0 && (!WIFEXITED (status) || WEXITSTATUS (status)))
+      failed++;
+  }
+  if (failed)
+    fprintf (stderr, "Unable to output %d of the reports per virtual host\n",
+             failed);
+}
+#endif
+
 /* Output to a terminal */
 static void
 curses_output (void)
@@ -1287,11 +1608,12 @@ set_io (void)
    * terminal or if an output format was supplied */
   if (!isatty (STDOUT_FILENO) || conf.output_format_idx > 0)
     conf.output_stdout = 1;
-  /* dup fd if data piped */
-  if (!isatty (STDIN_FILENO))
+  /* dup fd if data piped, unless benchmarking */
+  if (!isatty (STDIN_FILENO) && !conf.bench_lines && !conf.bench_ops)
     set_pipe_stdin ();
   /* No data piped, no file was used and not loading from disk */
-  if (!conf.filenames_idx && !conf.read_stdin && !conf.load_from_disk)
+  if (!conf.filenames_idx && !conf.read_stdin && !conf.load_from_disk &&
+      !conf.restore_snapshot && !conf.merge_snapshot_idx && !conf.bench_ops)
     cmd_help ();
 }
 
@@ -1301,6 +1623,7 @@ parse_cmd_line (int argc, char **argv)
 {
   read_option_args (argc, argv);
   set_default_static_files ();
+  init_static_files ();
 }
 
 /* Set up signal handlers. */
@@ -1332,6 +1655,10 @@ handle_signal_action (int sig_number)
     fprintf (stderr, "SIGPIPE caught!\n");
     /* ignore it */
     break;
+  case SIGUSR1:
+    /* dumped from the main loop, see check_mem_dump() */
+    mem_dump = 1;
+    break;
   }
 }
 
@@ -1347,6 +1674,7 @@ setup_thread_signals (void)
   sigaction (SIGINT, &act, NULL);
   sigaction (SIGPIPE, &act, NULL);
   sigaction (SIGTERM, &act, NULL);
+  sigaction (SIGUSR1, &act, NULL);
 
   /* Restore old signal mask for the main thread */
   pthread_sigmask (SIG_SETMASK, &oldset, NULL);
@@ -1355,13 +1683,14 @@ setup_thread_signals (void)
 static void
 block_thread_signals (void)
 {
-  /* Avoid threads catching SIGINT/SIGPIPE/SIGTERM and handle them in
-   * main thread */
+  /* Avoid threads catching SIGINT/SIGPIPE/SIGTERM/SIGUSR1 and handle
+   * them in main thread */
   sigset_t sigset;
   sigemptyset (&sigset);
   sigaddset (&sigset, SIGINT);
   sigaddset (&sigset, SIGPIPE);
   sigaddset (&sigset, SIGTERM);
+  sigaddset (&sigset, SIGUSR1);
   pthread_sigmask (SIG_BLOCK, &sigset, &oldset);
 }
 
@@ -1375,6 +1704,12 @@ initializer (void)
   set_locale ();
 
   parse_browsers_file ();
+  init_opesys ();
+  init_ua_cache ();
+  init_ip_ranges ();
+  init_referer_matchers ();
+  init_needed_fields ();
+  init_datamap_kernels ();
 
 #ifdef HAVE_GEOLOCATION
   init_geoip ();
@@ -1459,6 +1794,9 @@ int
 main (int argc, char **argv)
 {
   int quit = 0, ret = 0;
+#ifndef HAVE_LIBTOKYOCABINET
+  int persist = 0;
+#endif
 
   block_thread_signals ();
   setup_signal_handlers ();
@@ -1467,9 +1805,18 @@ main (int argc, char **argv)
   verify_global_config (argc, argv);
   parse_conf_file (&argc, &argv);
   parse_cmd_line (argc, argv);
+  /* synthesize the log to benchmark */
+  if (conf.bench_lines)
+    bench_generate ();
 
   initializer ();
 
+  /* time each primitive on its own, nothing is parsed */
+  if (conf.bench_ops) {
+    bench_micro ();
+    goto clean;
+  }
+
   /* ignore outputting, process only */
   if (conf.process_and_exit) {
   }
@@ -1489,7 +1836,10 @@ main (int argc, char **argv)
   init_processing ();
   /* main processing event */
   time (&start_proc);
-  if ((ret = parse_log (&glog, NULL, 0))) {
+  bench_begin (BENCH_PARSE);
+  ret = parse_log (&glog, NULL, 0);
+  bench_end (BENCH_PARSE);
+  if (ret) {
     end_spinner ();
     goto clean;
   }
@@ -1500,7 +1850,10 @@ main (int argc, char **argv)
   /* init reverse lookup thread */
   gdns_init ();
   parse_initial_sort ();
-  allocate_holder ();
+  bench_begin (BENCH_HOLDER);
+  if (!streams_csv_only ())
+    allocate_holder ();
+  bench_end (BENCH_HOLDER);
 
   end_spinner ();
   time (&end_proc);
@@ -1510,15 +1863,25 @@ main (int argc, char **argv)
 #ifdef TCB_BTREE
     set_accumulated_time ();
 #endif
+    if (conf.bench_lines)
+      bench_report (glog);
   }
   /* stdout */
   else if (conf.output_stdout) {
     standard_output ();
+#ifndef HAVE_LIBTOKYOCABINET
+    if (conf.split_vhost_dir)
+      output_vhost_reports ();
+#endif
   }
   /* curses */
   else {
     curses_output ();
   }
+#ifndef HAVE_LIBTOKYOCABINET
+  /* all the data was parsed, so it can be persisted */
+  persist = conf.persist_snapshot != NULL;
+#endif
 
   /* clean */
 clean:
@@ -1527,10 +1890,17 @@ clean:
   if (!conf.output_stdout)
     endwin ();
 
+#ifndef HAVE_LIBTOKYOCABINET
+  if (persist)
+    persist_snapshot ();
+#endif
+
   /* unable to process valid data */
   if (ret)
     output_logerrors (glog);
 
+  dump_stats ();
+  bench_free ();
   house_keeping ();
 
   return ret ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -0,0 +1,440 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gsnapshot.h"
+
+#include "xmalloc.h"
+
+/* Fold the given bytes into a checksum, FNV-1a style, a 64-bit word at
+ * a time and then byte by byte. Writers fold whole buffers, a multiple
+ * of 8, and then the rest, which matches folding the payload at once.
+ *
+ * On success, the updated checksum is returned. */
+static uint64_t
+snap_checksum (uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint64_t w = 0;
+  size_t i;
+
+  for (i = 0; i + sizeof (w) <= len; i += sizeof (w)) {
+    memcpy (&w, p + i, sizeof (w));
+    h = (h ^ w) * SNAP_FNV_PRIME;
+  }
+  for (; i < len; i++)
+    h = (h ^ p[i]) * SNAP_FNV_PRIME;
+
+  return h;
+}
+
+/* Get the num of padding bytes following a payload of the given length.
+ *
+ * On success, the num of padding bytes is returned. */
+static size_t
+snap_padding (uint64_t len)
+{
+  return (SNAP_ALIGN - (len % SNAP_ALIGN)) % SNAP_ALIGN;
+}
+
+/* Free a snapshot writer, removing the file being written unless it
+ * was already renamed. */
+static void
+free_snap_writer (GSnapWriter * w, int unlink_tmp)
+{
+  if (w->fp)
+    fclose (w->fp);
+  if (unlink_tmp)
+    unlink (w->tmp);
+  free (w->path);
+  free (w->tmp);
+  free (w);
+}
+
+/* Create a new snapshot to be written to the given path. It's written
+ * to a temporary file first, and renamed once committed, so a previous
+ * snapshot is never left half written.
+ *
+ * On error, NULL is returned and errno is set.
+ * On success, the new snapshot writer is returned. */
+GSnapWriter *
+snap_create (const char *path, uint32_t flags)
+{
+  GSnapWriter *w = xcalloc (1, sizeof (GSnapWriter));
+
+  w->path = xstrdup (path);
+  w->tmp = xmalloc (strlen (path) + 5);
+  sprintf (w->tmp, "%s.tmp", path);
+
+  if ((w->fp = fopen (w->tmp, "wb")) == NULL) {
+    free_snap_writer (w, 0);
+    return NULL;
+  }
+
+  memcpy (w->hdr.magic, SNAP_MAGIC, sizeof (w->hdr.magic));
+  w->hdr.version = SNAP_VERSION;
+  w->hdr.byte_order = SNAP_BYTE_ORDER;
+  w->hdr.flags = flags;
+
+  /* the header is written again once complete */
+  if (fwrite (&w->hdr, sizeof (w->hdr), 1, w->fp) != 1)
+    w->err = 1;
+
+  return w;
+}
+
+/* Write out the buffered bytes of the section being written. */
+static void
+snap_flush (GSnapWriter * w)
+{
+  if (w->len == 0)
+    return;
+
+  w->sect.checksum = snap_checksum (w->sect.checksum, w->buf, w->len);
+  w->sect.len += w->len;
+  if (fwrite (w->buf, 1, w->len, w->fp) != w->len)
+    w->err = 1;
+  w->len = 0;
+}
+
+/* Start a new section of the given type and module. */
+void
+snap_begin (GSnapWriter * w, uint32_t type, uint32_t module)
+{
+  memset (&w->sect, 0, sizeof (w->sect));
+  w->sect.type = type;
+  w->sect.module = module;
+  w->sect.checksum = SNAP_FNV_OFFSET;
+
+  /* the section header is written again once complete */
+  if ((w->offset = ftello (w->fp)) == -1 ||
+      fwrite (&w->sect, sizeof (w->sect), 1, w->fp) != 1)
+    w->err = 1;
+}
+
+/* End the section being written, made out of the given num of
+ * entries. Its payload is padded, so the next one is aligned. */
+void
+snap_end (GSnapWriter * w, uint64_t count)
+{
+  static const char zeros[SNAP_ALIGN] = { 0 };
+  size_t pad = 0;
+
+  snap_flush (w);
+  w->sect.count = count;
+
+  pad = snap_padding (w->sect.len);
+  if (pad && fwrite (zeros, 1, pad, w->fp) != pad)
+    w->err = 1;
+
+  if (fseeko (w->fp, w->offset, SEEK_SET) != 0 ||
+      fwrite (&w->sect, sizeof (w->sect), 1, w->fp) != 1 ||
+      fseeko (w->fp, 0, SEEK_END) != 0)
+    w->err = 1;
+  w->hdr.nsections++;
+}
+
+/* Append the given bytes to the section being written. */
+void
+snap_write (GSnapWriter * w, const void *data, size_t len)
+{
+  const char *p = data;
+  size_t n = 0;
+
+  while (len > 0) {
+    n = SNAP_BUF_SIZE - w->len;
+    n = n < len ? n : len;
+    memcpy (w->buf + w->len, p, n);
+    w->len += n;
+    p += n;
+    len -= n;
+    if (w->len == SNAP_BUF_SIZE)
+      snap_flush (w);
+  }
+}
+
+/* Append a nul-terminated string to the section being written. */
+void
+snap_write_str (GSnapWriter * w, const char *str)
+{
+  snap_write (w, str, strlen (str) + 1);
+}
+
+/* Append a 32-bit integer to the section being written. */
+void
+snap_write_u32 (GSnapWriter * w, uint32_t value)
+{
+  snap_write (w, &value, sizeof (value));
+}
+
+/* Append a 64-bit integer to the section being written. */
+void
+snap_write_u64 (GSnapWriter * w, uint64_t value)
+{
+  snap_write (w, &value, sizeof (value));
+}
+
+/* Complete the snapshot, i.e., write its header, sync it to disk and
+ * rename it to its path. The writer is freed either way.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+int
+snap_commit (GSnapWriter * w)
+{
+  off_t size = 0;
+
+  if (w->err || (size = ftello (w->fp)) == -1)
+    goto fail;
+
+  w->hdr.size = size;
+  if (fseeko (w->fp, 0, SEEK_SET) != 0 ||
+      fwrite (&w->hdr, sizeof (w->hdr), 1, w->fp) != 1 ||
+      fflush (w->fp) != 0 || fsync (fileno (w->fp)) != 0)
+    goto fail;
+
+  if (fclose (w->fp) != 0) {
+    w->fp = NULL;
+    goto fail;
+  }
+  w->fp = NULL;
+
+  if (rename (w->tmp, w->path) != 0)
+    goto fail;
+  free_snap_writer (w, 0);
+
+  return 0;
+
+fail:
+  free_snap_writer (w, 1);
+  return 1;
+}
+
+/* Verify the header and the sections of a snapshot mapped into memory,
+ * i.e., their bounds and their checksums.
+ *
+ * On error, the reason is returned.
+ * On success, NULL is returned. */
+static const char *
+verify_snapshot (GSnapshot * snap)
+{
+  GSnapSection sect;
+  size_t pos = sizeof (GSnapHeader);
+  uint32_t n = 0;
+
+  if (snap->size < sizeof (GSnapHeader))
+    return "not a snapshot";
+  memcpy (&snap->hdr, snap->data, sizeof (GSnapHeader));
+  if (memcmp (snap->hdr.magic, SNAP_MAGIC, sizeof (snap->hdr.magic)) != 0)
+    return "not a snapshot";
+  if (snap->hdr.version != SNAP_VERSION)
+    return "unsupported snapshot version";
+  if (snap->hdr.byte_order != SNAP_BYTE_ORDER)
+    return "snapshot written on a host of a different byte order";
+  if (snap->hdr.size != snap->size)
+    return "truncated snapshot";
+
+  while (pos < snap->size) {
+    if (snap->size - pos < sizeof (sect))
+      return "corrupted snapshot";
+    memcpy (&sect, snap->data + pos, sizeof (sect));
+    pos += sizeof (sect);
+
+    if (sect.len > snap->size - pos ||
+        snap_padding (sect.len) > snap->size - pos - sect.len)
+      return "corrupted snapshot";
+    if (snap_checksum (SNAP_FNV_OFFSET, snap->data + pos, sect.len) !=
+        sect.checksum)
+      return "snapshot checksum mismatch";
+
+    pos += sect.len + snap_padding (sect.len);
+    n++;
+  }
+  if (n != snap->hdr.nsections)
+    return "corrupted snapshot";
+
+  return NULL;
+}
+
+/* Map the snapshot at the given path into memory, read only, and verify
+ * it. Its sections are then read through snap_next().
+ *
+ * On error, NULL is returned and err is set to the reason.
+ * On success, the snapshot is returned. */
+GSnapshot *
+snap_open (const char *path, const char **err)
+{
+  GSnapshot *snap = NULL;
+  struct stat st;
+  void *data = NULL;
+  int fd = -1;
+
+  if ((fd = open (path, O_RDONLY)) == -1 || fstat (fd, &st) != 0) {
+    *err = strerror (errno);
+    goto fail;
+  }
+  if (st.st_size < (off_t) sizeof (GSnapHeader)) {
+    *err = "not a snapshot";
+    goto fail;
+  }
+
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    *err = strerror (errno);
+    goto fail;
+  }
+  close (fd);
+
+  snap = xcalloc (1, sizeof (GSnapshot));
+  snap->data = data;
+  snap->size = st.st_size;
+  snap->pos = sizeof (GSnapHeader);
+  if ((*err = verify_snapshot (snap)) != NULL) {
+    snap_close (snap);
+    return NULL;
+  }
+
+  return snap;
+
+fail:
+  if (fd != -1)
+    close (fd);
+  return NULL;
+}
+
+/* Get the next section of a snapshot, and set a reader over its
+ * payload.
+ *
+ * If there are no more sections, 0 is returned.
+ * On success, 1 is returned. */
+int
+snap_next (GSnapshot * snap, GSnapSection * sect, GSnapReader * rd)
+{
+  if (snap->pos >= snap->size)
+    return 0;
+
+  memcpy (sect, snap->data + snap->pos, sizeof (GSnapSection));
+  snap->pos += sizeof (GSnapSection);
+
+  memset (rd, 0, sizeof (GSnapReader));
+  rd->data = snap->data + snap->pos;
+  rd->len = sect->len;
+  snap->pos += sect->len + snap_padding (sect->len);
+
+  return 1;
+}
+
+/* Unmap a snapshot from memory. Note that strings read from it are no
+ * longer valid. */
+void
+snap_close (GSnapshot * snap)
+{
+  if (!snap)
+    return;
+  munmap ((void *) snap->data, snap->size);
+  free (snap);
+}
+
+/* Read the given num of bytes from a section payload. Note that they
+ * may not be aligned.
+ *
+ * On error, NULL is returned and the reader error is set.
+ * On success, a pointer to the bytes within the snapshot is returned. */
+const void *
+snap_read (GSnapReader * rd, size_t len)
+{
+  const char *p = NULL;
+
+  if (rd->err || len > rd->len - rd->pos) {
+    rd->err = 1;
+    return NULL;
+  }
+  p = rd->data + rd->pos;
+  rd->pos += len;
+
+  return p;
+}
+
+/* Read a nul-terminated string from a section payload.
+ *
+ * On error, NULL is returned and the reader error is set.
+ * On success, the string within the snapshot is returned. */
+const char *
+snap_read_str (GSnapReader * rd)
+{
+  const char *p = NULL, *end = NULL;
+
+  if (rd->err || rd->pos >= rd->len ||
+      !(end = memchr (rd->data + rd->pos, '\0', rd->len - rd->pos))) {
+    rd->err = 1;
+    return NULL;
+  }
+  p = rd->data + rd->pos;
+  rd->pos += end - p + 1;
+
+  return p;
+}
+
+/* Read a 32-bit integer from a section payload.
+ *
+ * On error, 0 is returned and the reader error is set.
+ * On success, the integer is returned. */
+uint32_t
+snap_read_u32 (GSnapReader * rd)
+{
+  const void *p = snap_read (rd, sizeof (uint32_t));
+  uint32_t value = 0;
+
+  if (p)
+    memcpy (&value, p, sizeof (value));
+  return value;
+}
+
+/* Read a 64-bit integer from a section payload.
+ *
+ * On error, 0 is returned and the reader error is set.
+ * On success, the integer is returned. */
+uint64_t
+snap_read_u64 (GSnapReader * rd)
+{
+  const void *p = snap_read (rd, sizeof (uint64_t));
+  uint64_t value = 0;
+
+  if (p)
+    memcpy (&value, p, sizeof (value));
+  return value;
+}
@@ -0,0 +1,118 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GSNAPSHOT_H_INCLUDED
+#define GSNAPSHOT_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SNAP_MAGIC      "GOASNAP"       /* 8 bytes, including the nul */
+#define SNAP_VERSION    1
+#define SNAP_BYTE_ORDER 0x01020304      /* as read on the host writing it */
+#define SNAP_ALIGN      8       /* payloads start on 8-byte boundaries */
+#define SNAP_BUF_SIZE   (1 << 16)       /* multiple of 8, see snap_checksum */
+/* FNV-1a parameters of the section checksums */
+#define SNAP_FNV_OFFSET 0xcbf29ce484222325ULL
+#define SNAP_FNV_PRIME  0x100000001b3ULL
+
+/* Header of a snapshot file, followed by its sections */
+typedef struct GSnapHeader_
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;          /* SNAP_BYTE_ORDER on the writing host */
+  uint32_t flags;               /* options the stored data depends on */
+  uint32_t nsections;
+  uint64_t size;                /* size of the whole file */
+} GSnapHeader;
+
+/* Header of a section, followed by its payload, padded to SNAP_ALIGN */
+typedef struct GSnapSection_
+{
+  uint32_t type;                /* what is stored, up to the caller */
+  uint32_t module;
+  uint64_t count;               /* num of entries */
+  uint64_t len;                 /* num of bytes of the payload */
+  uint64_t checksum;            /* of the payload */
+} GSnapSection;
+
+/* A snapshot being written. Sections are written one after another,
+ * each through a buffer so its checksum is computed as it goes */
+typedef struct GSnapWriter_
+{
+  FILE *fp;
+  char *path;
+  char *tmp;                    /* written here, renamed once complete */
+  GSnapHeader hdr;
+  GSnapSection sect;            /* section being written */
+  off_t offset;                 /* offset of the section being written */
+  unsigned char buf[SNAP_BUF_SIZE];
+  size_t len;                   /* num of bytes buffered */
+  int err;
+} GSnapWriter;
+
+/* A snapshot mapped into memory, read only. Its sections are verified
+ * as it is opened */
+typedef struct GSnapshot_
+{
+  const char *data;
+  size_t size;
+  size_t pos;                   /* offset of the next section */
+  GSnapHeader hdr;
+} GSnapshot;
+
+/* Cursor over the payload of a section of a snapshot */
+typedef struct GSnapReader_
+{
+  const char *data;
+  size_t len;
+  size_t pos;
+  int err;                      /* set once reading past the payload */
+} GSnapReader;
+
+GSnapWriter *snap_create (const char *path, uint32_t flags);
+int snap_commit (GSnapWriter * w);
+void snap_begin (GSnapWriter * w, uint32_t type, uint32_t module);
+void snap_end (GSnapWriter * w, uint64_t count);
+void snap_write (GSnapWriter * w, const void *data, size_t len);
+void snap_write_str (GSnapWriter * w, const char *str);
+void snap_write_u32 (GSnapWriter * w, uint32_t value);
+void snap_write_u64 (GSnapWriter * w, uint64_t value);
+
+GSnapshot *snap_open (const char *path, const char **err);
+int snap_next (GSnapshot * snap, GSnapSection * sect, GSnapReader * rd);
+void snap_close (GSnapshot * snap);
+const char *snap_read_str (GSnapReader * rd);
+const void *snap_read (GSnapReader * rd, size_t len);
+uint32_t snap_read_u32 (GSnapReader * rd);
+uint64_t snap_read_u64 (GSnapReader * rd);
+
+#endif // for #ifndef GSNAPSHOT_H
@@ -0,0 +1,242 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gspill.h"
+
+#include "error.h"
+#include "settings.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* Header right before the memory handed out */
+typedef struct GSpillHdr_
+{
+  uint64_t size;                /* usable bytes */
+  uint64_t mapped;              /* on a file mapping, else on the heap */
+} GSpillHdr;
+
+static uint64_t spill_heap = 0;
+static uint64_t spill_mapped = 0;
+static uint64_t spill_maps = 0;
+
+/* Get the header of the given memory handed out. */
+static GSpillHdr *
+get_hdr (void *ptr)
+{
+  return (GSpillHdr *) ptr - 1;
+}
+
+/* Determine if an allocation of the given size goes past the memory
+ * budget, if any, and should be spilled to a file.
+ *
+ * If it stays on the heap, 0 is returned.
+ * If it's spilled, 1 is returned. */
+static int
+is_spilled (size_t size)
+{
+  if (!conf.memory_limit || size < SPILL_MIN_SIZE)
+    return 0;
+  return __atomic_load_n (&spill_heap, __ATOMIC_RELAXED) + size >
+    conf.memory_limit;
+}
+
+/* Map the given size of an unlinked temporary file, already zeroed.
+ * The kernel writes its pages back to the file under memory pressure,
+ * instead of having them count against the process, so the coldest
+ * ones are the first to go.
+ *
+ * On error, NULL is returned.
+ * On success, the memory past the header is returned. */
+static void *
+map_alloc (size_t size)
+{
+  GSpillHdr *hdr = NULL;
+  size_t len = sizeof (GSpillHdr) + size;
+  char *path = NULL;
+  void *map = NULL;
+  int fd = -1;
+
+  if (!(path = new_tmp_path ("spill")))
+    return NULL;
+  fd = open (path, O_RDWR);
+  unlink (path);
+  free (path);
+  if (fd == -1)
+    return NULL;
+
+  if (ftruncate (fd, len) == 0)
+    map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == NULL || map == MAP_FAILED) {
+    LOG_DEBUG (("Unable to spill %zu bytes: %s\n", size, strerror (errno)));
+    return NULL;
+  }
+
+  hdr = map;
+  hdr->size = size;
+  hdr->mapped = 1;
+  __atomic_add_fetch (&spill_mapped, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&spill_maps, 1, __ATOMIC_RELAXED);
+  xalloc_count_inc ();
+
+  return hdr + 1;
+}
+
+/* Allocate the given size on the heap, zeroed if requested.
+ *
+ * On error, NULL is returned.
+ * On success, the memory past the header is returned. */
+static void *
+heap_alloc (size_t size, int zero)
+{
+  GSpillHdr *hdr = NULL;
+  size_t len = sizeof (GSpillHdr) + size;
+
+  if (!(hdr = zero ? calloc (1, len) : malloc (len)))
+    return NULL;
+
+  hdr->size = size;
+  hdr->mapped = 0;
+  __atomic_add_fetch (&spill_heap, size, __ATOMIC_RELAXED);
+  xalloc_count_inc ();
+
+  return hdr + 1;
+}
+
+/* Allocate the given size, on a file mapping if it goes past the
+ * memory budget, see --memory-limit.
+ *
+ * On error, NULL is returned.
+ * On success, a pointer to the allocated memory is returned. */
+void *
+spill_malloc (size_t size)
+{
+  void *ptr = NULL;
+
+  if (is_spilled (size) && (ptr = map_alloc (size)))
+    return ptr;
+  return heap_alloc (size, 0);
+}
+
+/* Allocate an array of nmemb elements of the given size, zeroed, on a
+ * file mapping if it goes past the memory budget.
+ *
+ * On error, NULL is returned.
+ * On success, a pointer to the allocated memory is returned. */
+void *
+spill_calloc (size_t nmemb, size_t size)
+{
+  void *ptr = NULL;
+
+  if (size && nmemb > SIZE_MAX / size)
+    return NULL;
+
+  /* mappings of a new file are already zeroed */
+  if (is_spilled (nmemb * size) && (ptr = map_alloc (nmemb * size)))
+    return ptr;
+  return heap_alloc (nmemb * size, 1);
+}
+
+/* Free memory allocated by the storage allocator. */
+void
+spill_free (void *ptr)
+{
+  GSpillHdr *hdr = NULL;
+
+  if (ptr == NULL)
+    return;
+
+  hdr = get_hdr (ptr);
+  if (hdr->mapped) {
+    __atomic_sub_fetch (&spill_mapped, hdr->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&spill_maps, 1, __ATOMIC_RELAXED);
+    munmap (hdr, sizeof (GSpillHdr) + hdr->size);
+    return;
+  }
+
+  __atomic_sub_fetch (&spill_heap, hdr->size, __ATOMIC_RELAXED);
+  free (hdr);
+}
+
+/* Resize memory allocated by the storage allocator. A table growing
+ * past the memory budget moves to a file mapping, i.e., the largest
+ * ones are the first to be spilled.
+ *
+ * On error, NULL is returned and the given memory is left untouched.
+ * On success, a pointer to the resized memory is returned. */
+void *
+spill_realloc (void *ptr, size_t size)
+{
+  GSpillHdr *hdr = NULL, *tmp = NULL;
+  uint64_t old = 0;
+  void *newptr = NULL;
+
+  if (ptr == NULL)
+    return spill_malloc (size);
+
+  hdr = get_hdr (ptr);
+  old = hdr->size;
+  /* shrinking a mapping keeps it as is */
+  if (hdr->mapped && size <= old)
+    return ptr;
+
+  if (!hdr->mapped && !is_spilled (size)) {
+    if (!(tmp = realloc (hdr, sizeof (GSpillHdr) + size)))
+      return NULL;
+    tmp->size = size;
+    __atomic_add_fetch (&spill_heap, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&spill_heap, old, __ATOMIC_RELAXED);
+    xalloc_count_inc ();
+    return tmp + 1;
+  }
+
+  if (!(newptr = spill_malloc (size)))
+    return NULL;
+  memcpy (newptr, ptr, old < size ? old : size);
+  spill_free (ptr);
+
+  return newptr;
+}
+
+/* Get the bytes handed out by the storage allocator so far. */
+void
+get_spill_stats (GSpillStats * stats)
+{
+  stats->heap = __atomic_load_n (&spill_heap, __ATOMIC_RELAXED);
+  stats->mapped = __atomic_load_n (&spill_mapped, __ATOMIC_RELAXED);
+  stats->maps = __atomic_load_n (&spill_maps, __ATOMIC_RELAXED);
+}
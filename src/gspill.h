@@ -0,0 +1,53 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GSPILL_H_INCLUDED
+#define GSPILL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* smaller allocations always stay on the heap */
+#define SPILL_MIN_SIZE (64 * 1024)
+
+/* Bytes handed out by the storage allocator */
+typedef struct GSpillStats_
+{
+  uint64_t heap;                /* on the heap */
+  uint64_t mapped;              /* on files past --memory-limit */
+  uint64_t maps;                /* num of file mappings */
+} GSpillStats;
+
+void *spill_calloc (size_t nmemb, size_t size);
+void *spill_malloc (size_t size);
+void *spill_realloc (void *ptr, size_t size);
+void get_spill_stats (GSpillStats * stats);
+void spill_free (void *ptr);
+
+#endif // for #ifndef GSPILL_H
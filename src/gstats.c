@@ -0,0 +1,265 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstats.h"
+
+#ifdef HAVE_LIBTOKYOCABINET
+#include "tcabdb.h"
+#else
+#include "gkhash.h"
+#endif
+
+#include "error.h"
+#include "gdns.h"
+#include "gspill.h"
+#include "settings.h"
+#include "ui.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static GStats stats;
+
+/* *INDENT-OFF* */
+static const char *STATS_STAGE_STR[] = {
+  "read", "parse", "browsers", "os", "geolocation", "store", "holder",
+  "sort", "json",
+};
+
+static const char *MEM_METRIC_STR[] = {
+  "keymap", "rootmap", "datamap", "uniqmap", "uniqhll", "root", "hits",
+  "visitors", "bw", "cumts", "maxts", "methods", "protocols", "agents",
+  "metadata",
+};
+/* *INDENT-ON* */
+
+/* Get the name of the given stage.
+ *
+ * The name of the stage is returned. */
+const char *
+stats_stage_str (GStatsStage stage)
+{
+  return STATS_STAGE_STR[stage];
+}
+
+/* Start timing a stage, if processing stats are enabled.
+ *
+ * If they are not, 0 is returned.
+ * Otherwise, the current time of a monotonic clock in ns is returned. */
+uint64_t
+stats_begin (void)
+{
+  struct timespec ts;
+
+  if (!conf.processing_stats)
+    return 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Add the time elapsed since it began to the given timer. Timers are
+ * updated from the parsing threads as well, so it's done atomically. */
+static void
+stats_add (GStatsTimer * timer, uint64_t begin)
+{
+  struct timespec ts;
+  uint64_t now;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  now = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+  __atomic_fetch_add (&timer->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&timer->ns, now - begin, __ATOMIC_RELAXED);
+}
+
+/* Stop timing the given stage, begun through stats_begin(). */
+void
+stats_end (GStatsStage stage, uint64_t begin)
+{
+  if (begin)
+    stats_add (&stats.stages[stage], begin);
+}
+
+/* Stop timing the storing of the given module, begun through
+ * stats_begin(). */
+void
+stats_end_module (GModule module, uint64_t begin)
+{
+  if (begin)
+    stats_add (&stats.modules[module], begin);
+}
+
+/* Get the timer of the given stage.
+ *
+ * The timer of the stage is returned. */
+const GStatsTimer *
+get_stats_stage (GStatsStage stage)
+{
+  return &stats.stages[stage];
+}
+
+/* Get the timer of the storing of the given module.
+ *
+ * The timer of the module is returned. */
+const GStatsTimer *
+get_stats_module (GModule module)
+{
+  return &stats.modules[module];
+}
+
+/* Get a one-line summary of the time spent on each stage, in ms.
+ *
+ * On success, the newly allocated summary is returned. */
+char *
+get_str_proc_stats (void)
+{
+  char *str = xcalloc (1, STATS_STAGES * 32 + 1);
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < STATS_STAGES; ++i)
+    len += sprintf (str + len, "%s%s %.0fms", i ? ", " : "",
+                    STATS_STAGE_STR[i], stats.stages[i].ns / 1e6);
+
+  return str;
+}
+
+/* Write the processing stats of each stage and the storing of each
+ * module to the debug file. */
+void
+dump_stats (void)
+{
+  const GStatsTimer *t = NULL;
+  size_t idx = 0;
+  int i;
+
+  if (!conf.processing_stats)
+    return;
+
+  LOG_DEBUG (("Processing stats (count, ms, ns/op)\n"));
+  for (i = 0; i < STATS_STAGES; ++i) {
+    t = &stats.stages[i];
+    LOG_DEBUG (("  %-22s %12llu %12.3f %10.0f\n", STATS_STAGE_STR[i],
+                (unsigned long long) t->count, t->ns / 1e6,
+                t->count ? (double) t->ns / t->count : 0));
+  }
+  FOREACH_MODULE (idx, module_list) {
+    t = &stats.modules[module_list[idx]];
+    LOG_DEBUG (("  store %-16s %12llu %12.3f %10.0f\n",
+                module_to_id (module_list[idx]), (unsigned long long) t->count,
+                t->ns / 1e6, t->count ? (double) t->ns / t->count : 0));
+  }
+}
+
+/* Get the name of the given storage metric.
+ *
+ * The name of the metric is returned. */
+const char *
+mem_metric_str (GSMetric metric)
+{
+  return MEM_METRIC_STR[metric];
+}
+
+/* Set the memory taken by the tables used across the whole app. The
+ * resolver inserts hostnames meanwhile, so it's done under its lock.
+ *
+ * On success the memory usage is set. */
+void
+get_mem_shared (GSMemUsage * mem)
+{
+  pthread_mutex_lock (&gdns_thread.hmutex);
+  ht_get_mem_shared (mem);
+  pthread_mutex_unlock (&gdns_thread.hmutex);
+}
+
+/* Write the memory taken by each metric of each module, and by the
+ * tables used across the whole app, to the debug file, or to stderr if
+ * there's none. */
+void
+dump_mem_usage (void)
+{
+  FILE *fp = dbg_log_file () ? dbg_log_file () : stderr;
+  GSMemUsage mem, sum = { 0, 0 }, all = { 0, 0 };
+  GSpillStats spill;
+  GModule module;
+  size_t idx = 0;
+  int i;
+
+  fprintf (fp, "Memory usage (buckets, owned, total bytes)\n");
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    memset (&sum, 0, sizeof (sum));
+    for (i = 0; i < GSMTRC_TOTAL; ++i) {
+      ht_get_mem_usage (module, i, &mem);
+      if (mem.buckets + mem.owned == 0)
+        continue;
+      fprintf (fp, "  %-16s %-10s %14llu %14llu %14llu\n",
+               module_to_id (module), MEM_METRIC_STR[i],
+               (unsigned long long) mem.buckets,
+               (unsigned long long) mem.owned,
+               (unsigned long long) (mem.buckets + mem.owned));
+      sum.buckets += mem.buckets;
+      sum.owned += mem.owned;
+    }
+    fprintf (fp, "  %-16s %-10s %14llu %14llu %14llu\n", module_to_id (module),
+             "total", (unsigned long long) sum.buckets,
+             (unsigned long long) sum.owned,
+             (unsigned long long) (sum.buckets + sum.owned));
+    all.buckets += sum.buckets;
+    all.owned += sum.owned;
+  }
+
+  get_mem_shared (&mem);
+  fprintf (fp, "  %-27s %14llu %14llu %14llu\n", "shared",
+           (unsigned long long) mem.buckets, (unsigned long long) mem.owned,
+           (unsigned long long) (mem.buckets + mem.owned));
+  fprintf (fp, "  %-27s %14llu %14llu %14llu\n", "total",
+           (unsigned long long) (all.buckets + mem.buckets),
+           (unsigned long long) (all.owned + mem.owned),
+           (unsigned long long) (all.buckets + mem.buckets + all.owned +
+                                 mem.owned));
+
+  get_spill_stats (&spill);
+  fprintf (fp, "Storage allocator: %llu bytes on the heap, %llu bytes spilled "
+           "to %llu files\n", (unsigned long long) spill.heap,
+           (unsigned long long) spill.mapped, (unsigned long long) spill.maps);
+  fflush (fp);
+}
@@ -0,0 +1,80 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GSTATS_H_INCLUDED
+#define GSTATS_H_INCLUDED
+
+#include <stdint.h>
+
+#include "commons.h"
+#include "gstorage.h"
+
+/* Stages of the processing, timed along the hot path */
+typedef enum GStatsStage_
+{
+  STATS_READ,                   /* reading a line from the log */
+  STATS_PARSE,                  /* parse_format() */
+  STATS_BROWSER,                /* verify_browser(), on agent cache misses */
+  STATS_OS,                     /* verify_os(), on agent cache misses */
+  STATS_GEO,                    /* geolocation lookups */
+  STATS_STORE,                  /* process_log(), all modules */
+  STATS_HOLDER,                 /* building the holder */
+  STATS_SORT,                   /* sort_holder_items() */
+  STATS_JSON,                   /* JSON serialization */
+  STATS_STAGES,
+} GStatsStage;
+
+/* Number of times a stage ran and how long it took overall */
+typedef struct GStatsTimer_
+{
+  uint64_t count;
+  uint64_t ns;
+} GStatsTimer;
+
+/* Processing stats, i.e., the timers of each stage, plus the ones of
+ * each module being stored by process_log() */
+typedef struct GStats_
+{
+  GStatsTimer stages[STATS_STAGES];
+  GStatsTimer modules[TOTAL_MODULES];
+} GStats;
+
+char *get_str_proc_stats (void);
+const char *mem_metric_str (GSMetric metric);
+const char *stats_stage_str (GStatsStage stage);
+const GStatsTimer *get_stats_module (GModule module);
+const GStatsTimer *get_stats_stage (GStatsStage stage);
+uint64_t stats_begin (void);
+void dump_mem_usage (void);
+void dump_stats (void);
+void get_mem_shared (GSMemUsage * mem);
+void stats_end (GStatsStage stage, uint64_t begin);
+void stats_end_module (GModule module, uint64_t begin);
+
+#endif // for #ifndef GSTATS_H
@@ -46,6 +46,15 @@
 #include "error.h"
 #include "xmalloc.h"
 
+/* Modules whose data has changed since they were last popped, one bit
+ * per module. Set by the parser and the DNS resolver threads. */
+static uint32_t dirty_modules = 0;
+/* Modules that have changed as a whole, e.g., a hostname was resolved,
+ * and thus their changed keys don't tell what to reload. */
+static uint32_t reload_modules = 0;
+/* Changed data keys of each module. Set by the parser thread only. */
+static GDirtyKeys dirty_keys[TOTAL_MODULES];
+
 /* Allocate memory for a new GMetrics instance.
  *
  * On success, the newly allocated GMetrics is returned . */
@@ -90,6 +99,109 @@ set_module_totals (GModule module, GPercTotals * totals)
   totals->visitors = ht_get_meta_data (module, "visitors");
 }
 
+/* Get the overall num of unique visitors, i.e., each visitor counted
+ * once per date on the visitors panel.
+ *
+ * On success the num of unique visitors is returned. */
+uint32_t
+get_overall_visitors (void)
+{
+  if (conf.approx_visitors)
+    return ht_get_meta_data (VISITORS, "visitors");
+  return ht_get_size_uniqmap (VISITORS);
+}
+
+/* Flag the given module as changed as a whole, e.g., the hostname of
+ * a host was resolved. */
+void
+set_module_dirty (GModule module)
+{
+  __atomic_fetch_or (&reload_modules, UINT32_C (1) << module,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_or (&dirty_modules, UINT32_C (1) << module, __ATOMIC_RELAXED);
+}
+
+/* Flag the given data key of the given module as changed, e.g., a new
+ * hit was added to it. */
+void
+set_key_dirty (GModule module, int key)
+{
+  GDirtyKeys *dk = &dirty_keys[module];
+
+  __atomic_fetch_or (&dirty_modules, UINT32_C (1) << module, __ATOMIC_RELAXED);
+  if (dk->overflow)
+    return;
+
+  /* consecutive lines tend to hit the same keys */
+  if (dk->len > 0 && dk->keys[dk->len - 1] == key)
+    return;
+
+  if (dk->len == DIRTY_KEYS_MAX) {
+    dk->overflow = 1;
+    return;
+  }
+
+  if (dk->len == dk->size) {
+    dk->size = dk->size ? dk->size * 2 : 64;
+    dk->keys = xrealloc (dk->keys, dk->size * sizeof (*dk->keys));
+  }
+  dk->keys[dk->len++] = key;
+}
+
+/* Get the data keys of the given module that have changed since the
+ * last call and clear them. Keys may be repeated.
+ *
+ * If the module has to be reloaded as a whole, NULL is returned.
+ * On success, the changed keys are returned and len is set to their
+ * number. The caller is responsible for freeing the returned keys. */
+int *
+pop_dirty_keys (GModule module, int *len)
+{
+  GDirtyKeys *dk = &dirty_keys[module];
+  uint32_t bit = UINT32_C (1) << module;
+  int *keys = NULL, reload = 0;
+
+  reload = (__atomic_fetch_and (&reload_modules, ~bit, __ATOMIC_ACQ_REL) & bit)
+    || dk->overflow;
+
+  keys = dk->keys;
+  *len = dk->len;
+  memset (dk, 0, sizeof (*dk));
+
+  if (reload) {
+    free (keys);
+    return NULL;
+  }
+
+  /* nothing changed */
+  if (keys == NULL)
+    keys = xmalloc (sizeof (*keys));
+
+  return keys;
+}
+
+/* Free the changed data keys of every module. */
+void
+free_dirty_keys (void)
+{
+  int i;
+
+  for (i = 0; i < TOTAL_MODULES; i++) {
+    free (dirty_keys[i].keys);
+    memset (&dirty_keys[i], 0, sizeof (dirty_keys[i]));
+  }
+}
+
+/* Get the modules that have changed since the last call and clear
+ * them.
+ *
+ * On success, a bit mask of modules (1 << module) is returned. */
+uint32_t
+pop_dirty_modules (void)
+{
+  return __atomic_exchange_n (&dirty_modules, 0, __ATOMIC_ACQ_REL);
+}
+
 /* Set numeric metrics for each request given raw data.
  *
  * On success, numeric metrics are set into the given structure. */
@@ -33,7 +33,11 @@
 #include "commons.h"
 
 /* Total number of storage metrics (GSMetric) */
-#define GSMTRC_TOTAL 14
+#define GSMTRC_TOTAL 15
+
+/* keep track of at most this num of changed keys per module, past it
+ * the module is reloaded as a whole */
+#define DIRTY_KEYS_MAX 16384
 
 /* Enumerated Storage Metrics */
 typedef enum GSMetric_
@@ -42,6 +46,7 @@ typedef enum GSMetric_
   MTRC_ROOTMAP,
   MTRC_DATAMAP,
   MTRC_UNIQMAP,
+  MTRC_UNIQHLL,
   MTRC_ROOT,
   MTRC_HITS,
   MTRC_VISITORS,
@@ -54,6 +59,23 @@ typedef enum GSMetric_
   MTRC_METADATA,
 } GSMetric;
 
+/* Memory taken by a metric of a module, or by the tables used across
+ * the whole app */
+typedef struct GSMemUsage_
+{
+  uint64_t buckets;             /* hash buckets and records */
+  uint64_t owned;               /* owned by the entries, e.g., strings */
+} GSMemUsage;
+
+/* Data keys of a module that have changed since it was last popped */
+typedef struct GDirtyKeys_
+{
+  int *keys;
+  int len;                      /* number of keys */
+  int size;                     /* number of allocated keys */
+  int overflow;                 /* more than DIRTY_KEYS_MAX keys changed */
+} GDirtyKeys;
+
 GMetrics *new_gmetrics (void);
 
 int *int2ptr (int val);
@@ -64,5 +86,12 @@ void *get_storage_metric (GModule module, GSMetric metric);
 void set_data_metrics (GMetrics * ometrics, GMetrics ** nmetrics,
                        GPercTotals totals);
 void set_module_totals (GModule module, GPercTotals * totals);
+uint32_t get_overall_visitors (void);
+
+int *pop_dirty_keys (GModule module, int *len);
+uint32_t pop_dirty_modules (void);
+void free_dirty_keys (void);
+void set_key_dirty (GModule module, int key);
+void set_module_dirty (GModule module);
 
 #endif // for #ifndef GSTORAGE_H
@@ -0,0 +1,458 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(HAVE_INOTIFY_INIT1)
+#include <sys/inotify.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
+#include <time.h>
+#endif
+
+#include "gwatch.h"
+
+#include "error.h"
+#include "xmalloc.h"
+
+#define GWATCH_EVENTS 64        /* max num of events read at once */
+
+#if defined(HAVE_INOTIFY_INIT1)
+#define GWATCH_LOG_MASK (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define GWATCH_DIR_MASK (IN_CREATE | IN_MOVED_TO)
+#endif
+
+/* Allocate memory for a new set of followed logs. If unable to watch
+ * them for changes, they are polled instead.
+ *
+ * On success, the newly allocated GWatch is returned. */
+GWatch *
+new_gwatch (void)
+{
+  GWatch *watch = xcalloc (1, sizeof (GWatch));
+
+  watch->pipe_fd = -1;
+#if defined(HAVE_INOTIFY_INIT1)
+  if ((watch->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) == -1)
+    LOG_DEBUG (("Unable to inotify_init1, polling: %s\n", strerror (errno)));
+#elif defined(HAVE_KQUEUE)
+  if ((watch->fd = kqueue ()) == -1)
+    LOG_DEBUG (("Unable to kqueue, polling: %s\n", strerror (errno)));
+#else
+  watch->fd = -1;
+#endif
+
+  return watch;
+}
+
+#if defined(HAVE_INOTIFY_INIT1)
+/* Get the last component of the given path. */
+static const char *
+get_base_name (const char *fn)
+{
+  const char *slash = strrchr (fn, '/');
+  return slash ? slash + 1 : fn;
+}
+
+/* Copy the directory of the given path into dir. */
+static void
+get_dir_name (const char *fn, char *dir, size_t len)
+{
+  const char *slash = strrchr (fn, '/');
+  size_t n = slash ? (size_t) (slash - fn) : 0;
+
+  if (slash == NULL) {
+    snprintf (dir, len, ".");
+    return;
+  }
+  /* root directory */
+  if (n == 0)
+    n = 1;
+  if (n >= len)
+    n = len - 1;
+  memcpy (dir, fn, n);
+  dir[n] = '\0';
+}
+#endif
+
+/* Start watching the open log for writes, renames and deletions. With
+ * inotify, its directory is watched as well, to know when a rotated log
+ * is created back. */
+static void
+watch_log (GWatch * watch, GWatchFile * wf)
+{
+#if defined(HAVE_INOTIFY_INIT1)
+  char dir[PATH_MAX];
+#elif defined(HAVE_KQUEUE)
+  struct kevent kev;
+#endif
+
+  if (watch->fd == -1)
+    return;
+
+#if defined(HAVE_INOTIFY_INIT1)
+  if ((wf->wd = inotify_add_watch (watch->fd, wf->fn, GWATCH_LOG_MASK)) == -1)
+    LOG_DEBUG (("Unable to watch %s: %s\n", wf->fn, strerror (errno)));
+  if (wf->dwd == -1) {
+    get_dir_name (wf->fn, dir, sizeof (dir));
+    wf->dwd = inotify_add_watch (watch->fd, dir, GWATCH_DIR_MASK);
+  }
+#elif defined(HAVE_KQUEUE)
+  EV_SET (&kev, wf->file->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+          NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME | NOTE_DELETE,
+          0, 0);
+  if (kevent (watch->fd, &kev, 1, NULL, 0, NULL) == -1)
+    LOG_DEBUG (("Unable to watch %s: %s\n", wf->fn, strerror (errno)));
+#else
+  (void) wf;
+#endif
+}
+
+/* Stop watching the given log, before it's closed. */
+static void
+unwatch_log (GWatch * watch, GWatchFile * wf)
+{
+#if defined(HAVE_INOTIFY_INIT1)
+  if (watch->fd != -1 && wf->wd != -1)
+    inotify_rm_watch (watch->fd, wf->wd);
+#else
+  /* kqueue drops the events of a descriptor once it's closed */
+  (void) watch;
+#endif
+  wf->wd = -1;
+}
+
+/* Follow the given log from its current end.
+ *
+ * On error, 1 is returned and errno is set.
+ * On success, 0 is returned. */
+int
+gwatch_add (GWatch * watch, const char *fn)
+{
+  GWatchFile *wf = NULL;
+  GFile *file = NULL;
+  struct stat st;
+
+  if ((file = gfile_follow (fn)) == NULL)
+    return 1;
+  if (fstat (file->fd, &st) == -1) {
+    gfile_close (file);
+    return 1;
+  }
+
+  watch->files = xrealloc (watch->files, (watch->len + 1) * sizeof (*wf));
+  wf = &watch->files[watch->len++];
+  memset (wf, 0, sizeof (*wf));
+  wf->fn = xstrdup (fn);
+  wf->file = file;
+  wf->dev = st.st_dev;
+  wf->ino = st.st_ino;
+  wf->wd = wf->dwd = -1;
+  watch_log (watch, wf);
+
+  return 0;
+}
+
+/* Watch the given pipe for data to read, e.g., stdin. */
+void
+gwatch_add_pipe (GWatch * watch, int fd)
+{
+#if defined(HAVE_KQUEUE) && !defined(HAVE_INOTIFY_INIT1)
+  struct kevent kev;
+
+  if (watch->fd != -1) {
+    EV_SET (&kev, fd, EVFILT_READ, EV_ADD, 0, 0, 0);
+    kevent (watch->fd, &kev, 1, NULL, 0, NULL);
+  }
+#endif
+  watch->pipe_fd = fd;
+}
+
+/* Check whether the given log was truncated, or replaced by a new one,
+ * e.g., rotated, once all of its data was read. If so, the log is
+ * reopened if needed and then it's read from its beginning.
+ *
+ * If the log is to be read from its beginning, 1 is returned.
+ * Otherwise 0 is returned. */
+int
+gwatch_rotate (GWatch * watch, GWatchFile * wf)
+{
+  GFile *file = NULL;
+  struct stat st;
+
+  /* truncated in place, e.g., copytruncate */
+  if (fstat (wf->file->fd, &st) == 0 &&
+      (uint64_t) st.st_size < wf->file->offset) {
+    gfile_seek (wf->file, 0);
+    return 1;
+  }
+
+  /* nothing tells it moved, unless polling */
+  if (!wf->moved && watch->fd != -1)
+    return 0;
+  /* not created back yet, or still the same log */
+  if (stat (wf->fn, &st) == -1)
+    return 0;
+  if (st.st_dev == wf->dev && st.st_ino == wf->ino) {
+    wf->moved = 0;
+    return 0;
+  }
+
+  if ((file = gfile_follow (wf->fn)) == NULL || fstat (file->fd, &st) == -1) {
+    gfile_close (file);
+    return 0;
+  }
+  gfile_seek (file, 0);
+
+  unwatch_log (watch, wf);
+  gfile_close (wf->file);
+  wf->file = file;
+  wf->dev = st.st_dev;
+  wf->ino = st.st_ino;
+  wf->moved = 0;
+  watch_log (watch, wf);
+
+  return 1;
+}
+
+/* Sleep up to timeout milliseconds, unless data is available on the
+ * pipe. All logs are then checked for changes. */
+static void
+poll_logs (GWatch * watch, int timeout)
+{
+  struct pollfd pfd;
+  int i;
+
+  pfd.fd = watch->pipe_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll (&pfd, watch->pipe_fd != -1, timeout) > 0)
+    watch->pipe_ready = 1;
+  /* writer is gone, read whatever is left one last time */
+  if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN))
+    watch->pipe_fd = -1;
+
+  for (i = 0; i < watch->len; ++i)
+    watch->files[i].changed = 1;
+}
+
+#if defined(HAVE_INOTIFY_INIT1)
+/* Flag the logs the given inotify event is about. */
+static void
+flag_inotify_event (GWatch * watch, const struct inotify_event *ev)
+{
+  GWatchFile *wf = NULL;
+  int i;
+
+  for (i = 0; i < watch->len; ++i) {
+    wf = &watch->files[i];
+    if (ev->wd == wf->wd) {
+      wf->changed = 1;
+      if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+        wf->moved = 1;
+      if (ev->mask & IN_IGNORED)
+        wf->wd = -1;
+    }
+    /* a log was created, or moved, under a followed path */
+    else if (ev->wd == wf->dwd && ev->len &&
+             !strcmp (ev->name, get_base_name (wf->fn))) {
+      wf->changed = wf->moved = 1;
+    }
+  }
+}
+
+/* Wait up to timeout milliseconds for inotify events, or for data on
+ * the pipe.
+ *
+ * On error, -1 is returned.
+ * On success, 0 is returned. */
+static int
+wait_events (GWatch * watch, int timeout)
+{
+  /* aligned for the events read into it */
+  uint64_t buf[4096 / sizeof (uint64_t)];
+  const struct inotify_event *ev = NULL;
+  struct pollfd pfd[2];
+  char *ptr = NULL;
+  ssize_t len = 0;
+  int n = 1;
+
+  pfd[0].fd = watch->fd;
+  pfd[0].events = POLLIN;
+  pfd[0].revents = pfd[1].revents = 0;
+  if (watch->pipe_fd != -1) {
+    pfd[1].fd = watch->pipe_fd;
+    pfd[1].events = POLLIN;
+    n = 2;
+  }
+
+  if (poll (pfd, n, timeout) == -1)
+    return errno == EINTR ? 0 : -1;
+
+  if (n == 2 && (pfd[1].revents & (POLLIN | POLLHUP)))
+    watch->pipe_ready = 1;
+  /* writer is gone, read whatever is left one last time */
+  if (n == 2 && (pfd[1].revents & POLLHUP) && !(pfd[1].revents & POLLIN))
+    watch->pipe_fd = -1;
+
+  if (!(pfd[0].revents & POLLIN))
+    return 0;
+  while ((len = read (watch->fd, buf, sizeof (buf))) > 0) {
+    for (ptr = (char *) buf; ptr < (char *) buf + len;
+         ptr += sizeof (struct inotify_event) + ev->len) {
+      ev = (const struct inotify_event *) ptr;
+      flag_inotify_event (watch, ev);
+    }
+  }
+
+  return 0;
+}
+#elif defined(HAVE_KQUEUE)
+/* Flag the log the given kqueue event is about. */
+static void
+flag_kqueue_event (GWatch * watch, const struct kevent *kev)
+{
+  GWatchFile *wf = NULL;
+  struct kevent del;
+  int i;
+
+  if (kev->filter == EVFILT_READ) {
+    watch->pipe_ready = 1;
+    /* writer is gone, read whatever is left one last time */
+    if ((kev->flags & EV_EOF) && kev->data == 0) {
+      EV_SET (&del, watch->pipe_fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+      kevent (watch->fd, &del, 1, NULL, 0, NULL);
+      watch->pipe_fd = -1;
+    }
+    return;
+  }
+
+  for (i = 0; i < watch->len; ++i) {
+    wf = &watch->files[i];
+    if ((uintptr_t) wf->file->fd != kev->ident)
+      continue;
+    wf->changed = 1;
+    if (kev->fflags & (NOTE_RENAME | NOTE_DELETE))
+      wf->moved = 1;
+  }
+}
+
+/* Wait up to timeout milliseconds for kqueue events, on the logs or on
+ * the pipe.
+ *
+ * On error, -1 is returned.
+ * On success, 0 is returned. */
+static int
+wait_events (GWatch * watch, int timeout)
+{
+  struct kevent evs[GWATCH_EVENTS];
+  struct timespec ts;
+  int i, n = 0;
+
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (timeout % 1000) * 1000000L;
+  if ((n = kevent (watch->fd, NULL, 0, evs, GWATCH_EVENTS, &ts)) == -1)
+    return errno == EINTR ? 0 : -1;
+
+  for (i = 0; i < n; ++i)
+    flag_kqueue_event (watch, &evs[i]);
+
+  return 0;
+}
+#else
+/* No events to wait for, logs are polled. */
+static int
+wait_events (GWatch * watch, int timeout)
+{
+  poll_logs (watch, timeout);
+  return 0;
+}
+#endif
+
+/* Wait up to timeout milliseconds (GWATCH_IDLE_MS at most, or if
+ * negative) for any of the followed logs to change, or for data to be
+ * available on the pipe. Changed logs are flagged as such.
+ *
+ * On error, -1 is returned.
+ * On success, the num of changed logs (plus the pipe) is returned. */
+int
+gwatch_wait (GWatch * watch, int timeout)
+{
+  int i, ready = 0;
+
+  if (timeout < 0 || timeout > GWATCH_IDLE_MS)
+    timeout = GWATCH_IDLE_MS;
+
+  watch->pipe_ready = 0;
+  if (watch->fd == -1)
+    poll_logs (watch, timeout);
+  else if (wait_events (watch, timeout) == -1)
+    return -1;
+
+  for (i = 0; i < watch->len; ++i) {
+    /* checked on every wake up until it's created back */
+    if (watch->files[i].moved)
+      watch->files[i].changed = 1;
+    ready += watch->files[i].changed;
+  }
+
+  return ready + watch->pipe_ready;
+}
+
+/* Close all the followed logs and free the watch. */
+void
+free_gwatch (GWatch * watch)
+{
+  int i;
+
+  if (watch == NULL)
+    return;
+
+  for (i = 0; i < watch->len; ++i) {
+    gfile_close (watch->files[i].file);
+    free (watch->files[i].fn);
+  }
+  if (watch->fd != -1)
+    close (watch->fd);
+  free (watch->files);
+  free (watch);
+}
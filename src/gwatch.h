@@ -0,0 +1,71 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GWATCH_H_INCLUDED
+#define GWATCH_H_INCLUDED
+
+#include <sys/types.h>
+
+#include "gfile.h"
+
+#define GWATCH_IDLE_MS    1000  /* max time blocked waiting for events */
+#define GWATCH_REFRESH_MS 250   /* min time between two report refreshes */
+
+/* A log followed as it grows */
+typedef struct GWatchFile_
+{
+  char *fn;                     /* path of the log */
+  GFile *file;                  /* reader, kept open while following */
+  dev_t dev;                    /* device of the open log */
+  ino_t ino;                    /* inode of the open log */
+  int wd;                       /* watch of the log, inotify only */
+  int dwd;                      /* watch of its directory, inotify only */
+  int changed;                  /* data may have been appended */
+  int moved;                    /* renamed or deleted, to be reopened */
+} GWatchFile;
+
+/* Logs followed through inotify (Linux) or kqueue (BSD/macOS). If none
+ * is available, every log is checked on each wake up, as in polling. */
+typedef struct GWatch_
+{
+  GWatchFile *files;
+  int len;                      /* num of followed logs */
+  int fd;                       /* inotify/kqueue instance, -1 if polling */
+  int pipe_fd;                  /* piped data, -1 if none */
+  int pipe_ready;               /* data available on the pipe */
+} GWatch;
+
+GWatch *new_gwatch (void);
+int gwatch_add (GWatch * watch, const char *fn);
+int gwatch_rotate (GWatch * watch, GWatchFile * wf);
+int gwatch_wait (GWatch * watch, int timeout);
+void free_gwatch (GWatch * watch);
+void gwatch_add_pipe (GWatch * watch, int fd);
+
+#endif // for #ifndef GWATCH_H
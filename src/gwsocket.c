@@ -72,29 +72,6 @@ new_gwswriter (void)
   return writer;
 }
 
-/* Write the JSON data to a pipe.
- *
- * If unable to write bytes, -1 is returned.
- * On success, the number of written bytes is returned . */
-static int
-write_holder (int fd, const char *buf, int len)
-{
-  int i, ret = 0;
-
-  for (i = 0; i < len;) {
-    ret = write (fd, buf + i, len - i);
-    if (ret < 0) {
-      if (errno == EINTR || errno == EAGAIN)
-        continue;
-      return -1;
-    } else {
-      i += ret;
-    }
-  }
-
-  return i;
-}
-
 /* Clear an incoming FIFO packet and header data. */
 static void
 clear_fifo_packet (GWSReader * gwserver)
@@ -111,50 +88,94 @@ clear_fifo_packet (GWSReader * gwserver)
   gwserver->packet = NULL;
 }
 
-/* Pack the JSON data into a network byte order and writes it to a
- * pipe.
+/* Attempt to write the queued up JSON data to the pipe, the caller
+ * must hold the writer's mutex.
+ *
+ * On success, the number of bytes still queued up is returned. */
+static int
+flush_fifo_queue (GWSWriter * gwswriter)
+{
+  int ret = 0;
+
+  if ((ret = ws_fifo_flush (&gwswriter->queue, gwswriter->fd)) == -1) {
+    LOG (("Unable to write to fifo: %s.\n", strerror (errno)));
+    ws_fifo_clear (&gwswriter->queue);
+    ret = 0;
+  }
+
+  return ret;
+}
+
+/* Attempt to write the queued up JSON data to the pipe. It never
+ * blocks, whatever can't be written stays queued up.
  *
- * On success, 0 is returned . */
+ * On success, the number of bytes still queued up is returned. */
 int
-broadcast_holder (int fd, const char *buf, int len)
+flush_holder (GWSWriter * gwswriter)
 {
-  char *p = NULL, *ptr = NULL;
+  int ret = 0;
 
-  p = calloc (sizeof (uint32_t) * 3, sizeof (char));
+  pthread_mutex_lock (&gwswriter->mutex);
+  ret = flush_fifo_queue (gwswriter);
+  pthread_mutex_unlock (&gwswriter->mutex);
+
+  return ret;
+}
 
-  ptr = p;
-  ptr += pack_uint32 (ptr, 0);
-  ptr += pack_uint32 (ptr, 0x01);
-  ptr += pack_uint32 (ptr, len);
+/* Pack the JSON data into a network byte order and queue it up to be
+ * written to a pipe and broadcast to all clients.
+ *
+ * On success, the number of bytes still queued up is returned. */
+int
+broadcast_holder (GWSWriter * gwswriter, const char *buf, int len)
+{
+  int ret = 0;
 
-  write_holder (fd, p, sizeof (uint32_t) * 3);
-  write_holder (fd, buf, len);
-  free (p);
+  pthread_mutex_lock (&gwswriter->mutex);
+  ws_fifo_push (&gwswriter->queue, 0, WS_OPCODE_TEXT, 0, buf, len);
+  ret = flush_fifo_queue (gwswriter);
+  pthread_mutex_unlock (&gwswriter->mutex);
 
-  return 0;
+  return ret;
 }
 
-/* Pack the JSON data into a network byte order and write it to a
- * pipe.
+/* Pack the JSON data into a network byte order and queue it up to be
+ * written to a pipe and sent to the given client. It's a full snapshot,
+ * so it replaces any older one still queued up for the same client.
  *
- * On success, 0 is returned . */
+ * On success, the number of bytes still queued up is returned. */
 int
-send_holder_to_client (int fd, int listener, const char *buf, int len)
+send_holder_to_client (GWSWriter * gwswriter, int listener, const char *buf,
+                       int len)
 {
-  char *p = NULL, *ptr = NULL;
+  int ret = 0;
 
-  p = calloc (sizeof (uint32_t) * 3, sizeof (char));
+  pthread_mutex_lock (&gwswriter->mutex);
+  ws_fifo_push (&gwswriter->queue, listener, WS_OPCODE_TEXT, WS_FIFO_SNAPSHOT,
+                buf, len);
+  ret = flush_fifo_queue (gwswriter);
+  pthread_mutex_unlock (&gwswriter->mutex);
+
+  return ret;
+}
 
-  ptr = p;
-  ptr += pack_uint32 (ptr, listener);
-  ptr += pack_uint32 (ptr, 0x01);
-  ptr += pack_uint32 (ptr, len);
+/* Pack the JSON data of one of the panels into a network byte order and
+ * queue it up to be written to a pipe and sent to the given client.
+ * Unlike a full snapshot, it's sent after anything else queued up.
+ *
+ * On success, the number of bytes still queued up is returned. */
+int
+send_panel_to_client (GWSWriter * gwswriter, int listener, const char *buf,
+                      int len)
+{
+  int ret = 0;
 
-  write_holder (fd, p, sizeof (uint32_t) * 3);
-  write_holder (fd, buf, len);
-  free (p);
+  pthread_mutex_lock (&gwswriter->mutex);
+  ws_fifo_push (&gwswriter->queue, listener, WS_OPCODE_TEXT, 0, buf, len);
+  ret = flush_fifo_queue (gwswriter);
+  pthread_mutex_unlock (&gwswriter->mutex);
 
-  return 0;
+  return ret;
 }
 
 /* Attempt to read data from the named pipe on strict mode.
@@ -166,9 +187,8 @@ int
 read_fifo (GWSReader * gwsreader, fd_set rfds, fd_set wfds, void (*f) (int))
 {
   WSPacket **pa = &gwsreader->packet;
-  char *ptr;
+  WSFifoHdr hdr;
   int bytes = 0, readh = 0, need = 0, fd = gwsreader->fd, max = 0;
-  uint32_t listener = 0, type = 0, size = 0;
 
   FD_ZERO (&rfds);
   FD_ZERO (&wfds);
@@ -204,17 +224,12 @@ read_fifo (GWSReader * gwsreader, fd_set rfds, fd_set wfds, void (*f) (int))
       return 0;
   }
 
-  /* unpack size, and type */
-  ptr = gwsreader->hdr;
-  ptr += unpack_uint32 (ptr, &listener);
-  ptr += unpack_uint32 (ptr, &type);
-  ptr += unpack_uint32 (ptr, &size);
-
+  ws_unpack_fifo_hdr (gwsreader->hdr, &hdr);
   if ((*pa) == NULL) {
     (*pa) = xcalloc (1, sizeof (WSPacket));
-    (*pa)->type = type;
-    (*pa)->size = size;
-    (*pa)->data = xcalloc (size, sizeof (char));
+    (*pa)->type = hdr.type;
+    (*pa)->size = hdr.size;
+    (*pa)->data = xcalloc (hdr.size, sizeof (char));
   }
 
   readh = (*pa)->len;   /* read from payload so far */
@@ -226,8 +241,11 @@ read_fifo (GWSReader * gwsreader, fd_set rfds, fd_set wfds, void (*f) (int))
       return 0;
   }
   clear_fifo_packet (gwsreader);
+  /* out of order or replayed */
+  if (ws_fifo_stale (&gwsreader->seq, hdr.seq))
+    return 0;
   /* fast forward JSON data to the given client */
-  (*f) (listener);
+  (*f) (hdr.listener);
 
   return 0;
 }
@@ -235,21 +253,14 @@ read_fifo (GWSReader * gwsreader, fd_set rfds, fd_set wfds, void (*f) (int))
 /* Callback once a new connection is established
  *
  * It writes to a named pipe a header containing the socket, the
- * message type, the payload's length and the actual payload */
+ * message type, its flags and sequence number, the payload's length and
+ * the actual payload. A request still queued up for a previous
+ * connection on the same socket is superseded. */
 static int
 onopen (WSPipeOut * pipeout, WSClient * client)
 {
-  uint32_t hsize = sizeof (uint32_t) * 3;
-  char *hdr = calloc (hsize, sizeof (char));
-  char *ptr = hdr;
-
-  ptr += pack_uint32 (ptr, client->listener);
-  ptr += pack_uint32 (ptr, WS_OPCODE_TEXT);
-  ptr += pack_uint32 (ptr, INET6_ADDRSTRLEN);
-
-  ws_write_fifo (pipeout, hdr, hsize);
-  ws_write_fifo (pipeout, client->remote_ip, INET6_ADDRSTRLEN);
-  free (hdr);
+  ws_write_fifo_packet (pipeout, client->listener, WS_OPCODE_TEXT,
+                        WS_FIFO_SNAPSHOT, client->remote_ip, INET6_ADDRSTRLEN);
 
   return 0;
 }
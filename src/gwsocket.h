@@ -46,6 +46,7 @@ typedef struct GWSReader_
   WSPacket *packet;             /* FIFO data's buffer */
   char hdr[HDR_SIZE];           /* FIFO header's buffer */
   int hlen;                     /* header length */
+  uint32_t seq;                 /* last packet sequence number read */
 } GWSReader;
 
 typedef struct GWSWriter_
@@ -56,16 +57,21 @@ typedef struct GWSWriter_
   pthread_t thread;             /* Thread fifo out */
 
   WSServer *server;             /* WebSocket server */
+  WSFifoQueue queue;            /* JSON data waiting for the pipe */
 } GWSWriter;
 
 GWSReader *new_gwsreader (void);
 GWSWriter *new_gwswriter (void);
-int broadcast_holder (int fd, const char *buf, int len);
+int broadcast_holder (GWSWriter * gwswriter, const char *buf, int len);
+int flush_holder (GWSWriter * gwswriter);
 int open_fifoin (void);
 int open_fifoout (void);
 int read_fifo (GWSReader * gwsreader, fd_set rfds, fd_set wfds,
                void (*f) (int));
-int send_holder_to_client (int fd, int listener, const char *buf, int len);
+int send_holder_to_client (GWSWriter * gwswriter, int listener,
+                           const char *buf, int len);
+int send_panel_to_client (GWSWriter * gwswriter, int listener,
+                          const char *buf, int len);
 int setup_ws_server (GWSWriter * gwswriter, GWSReader * gwsreader);
 void set_ready_state (void);
 void set_self_pipe (int *self_pipe);
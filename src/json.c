@@ -34,6 +34,7 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -51,6 +52,8 @@
 #endif
 
 #include "error.h"
+#include "gspill.h"
+#include "gstats.h"
 #include "settings.h"
 #include "ui.h"
 #include "util.h"
@@ -71,6 +74,12 @@ static int nlines = 0;
 /* escape HTML in JSON data values */
 static int escape_html_output = 0;
 
+/* characters that need to be escaped, see escape_json_output() */
+#define JSON_ESC      0x1       /* always */
+#define JSON_ESC_HTML 0x2       /* only when escaping HTML */
+static unsigned char json_esc[256] = { 0 };
+
+static void init_json_escapes (void);
 static void print_json_data (GJSON * json, GHolder * h, GPercTotals totals,
                              const struct GPanel_ *);
 static void print_json_host_items (GJSON * json, GHolderItem * item,
@@ -119,16 +128,17 @@ panel_lookup (GModule module)
 /* Allocate memory for a new GJSON instance.
  *
  * On success, the newly allocated GJSON is returned . */
-static GJSON *
+GJSON *
 new_gjson (void)
 {
   GJSON *json = xcalloc (1, sizeof (GJSON));
+  init_json_escapes ();
 
   return json;
 }
 
 /* Free malloc'd GJSON resources. */
-static void
+void
 free_json (GJSON * json)
 {
   if (!json)
@@ -145,8 +155,21 @@ set_json_nlines (int newline)
   nlines = newline;
 }
 
+/* Write the buffered data out to the stream, if streaming. */
+static void
+flush_json (GJSON * json)
+{
+  if (json->fp == NULL || json->offset == 0)
+    return;
+
+  if (fwrite (json->buf, 1, json->offset, json->fp) != json->offset)
+    FATAL ("Unable to write JSON data: %s.", strerror (errno));
+  json->offset = 0;
+}
+
 /* Make sure that we have enough storage to write "len" bytes at the
- * current offset. */
+ * current offset. When streaming, the buffer is written out once it
+ * reaches JSON_CHUNK_SIZE instead of growing. */
 static void
 set_json_buffer (GJSON * json, int len)
 {
@@ -154,11 +177,16 @@ set_json_buffer (GJSON * json, int len)
   /* Maintain a null byte at the end of the buffer */
   size_t need = json->offset + len + 1, newlen = 0;
 
+  if (json->fp && need > JSON_CHUNK_SIZE && json->offset > 0) {
+    flush_json (json);
+    need = len + 1;
+  }
+
   if (need <= json->size)
     return;
 
   if (json->size == 0) {
-    newlen = INIT_BUF_SIZE;
+    newlen = json->fp ? JSON_CHUNK_SIZE : INIT_BUF_SIZE;
   } else {
     newlen = json->size;
     newlen += newlen / 2;       /* resize by 3/2 */
@@ -176,28 +204,97 @@ set_json_buffer (GJSON * json, int len)
   json->size = newlen;
 }
 
+/* Write len bytes of the given string to the buffer. */
+static void
+pjson_nstr (GJSON * json, const char *str, size_t len)
+{
+  set_json_buffer (json, len);
+  memcpy (json->buf + json->offset, str, len);
+  json->offset += len;
+}
+
+/* Write the given string to the buffer. */
+static void
+pjson_str (GJSON * json, const char *str)
+{
+  pjson_nstr (json, str, strlen (str));
+}
+
+/* Write the given number of tabs (if pretty printing). */
+static void
+pjson_tabs (GJSON * json, int sp)
+{
+  if (sp > (int) sizeof (TAB) - 1)
+    sp = sizeof (TAB) - 1;
+  if (sp > 0)
+    pjson_nstr (json, TAB, sp);
+}
+
+/* Write a new line (if pretty printing). */
+static void
+pjson_nl (GJSON * json)
+{
+  if (nlines > 0)
+    pjson_nstr (json, NL, nlines);
+}
+
+/* Write the decimal representation of the given value to the buffer,
+ * without going through printf(3). */
+static void
+pjson_u64 (GJSON * json, uint64_t val)
+{
+  char buf[24], *ptr = buf + sizeof (buf);
+
+  do {
+    *--ptr = '0' + (val % 10);
+    val /= 10;
+  } while (val != 0);
+
+  pjson_nstr (json, ptr, buf + sizeof (buf) - ptr);
+}
+
+/* Write the decimal representation of the given value to the buffer. */
+static void
+pjson_int (GJSON * json, int val)
+{
+  if (val < 0) {
+    pjson_nstr (json, "-", 1);
+    pjson_u64 (json, (uint64_t) (-(int64_t) val));
+    return;
+  }
+  pjson_u64 (json, val);
+}
+
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
 /* A wrapper function to write a formatted string and expand the
- * buffer if necessary.
+ * buffer if necessary. The string is formatted in place, and only
+ * formatted again if it didn't fit.
  *
  * On success, data is outputted. */
-static void
+void
 pjson (GJSON * json, const char *fmt, ...)
 {
   int len = 0;
+  size_t avail = 0;
   va_list args;
 
+  set_json_buffer (json, 0);
+  avail = json->size - json->offset;
+
   va_start (args, fmt);
-  if ((len = vsnprintf (NULL, 0, fmt, args)) < 0)
-    FATAL (("Unable to write JSON formatted data.\n"));
+  len = vsnprintf (json->buf + json->offset, avail, fmt, args);
   va_end (args);
+  if (len < 0)
+    FATAL (("Unable to write JSON formatted data.\n"));
 
-  /* malloc/realloc buffer as needed */
-  set_json_buffer (json, len);
+  if ((size_t) len >= avail) {
+    /* malloc/realloc buffer as needed */
+    set_json_buffer (json, len);
 
-  va_start (args, fmt); /* restart args */
-  vsprintf (json->buf + json->offset, fmt, args);
-  va_end (args);
+    va_start (args, fmt);       /* restart args */
+    vsnprintf (json->buf + json->offset, json->size - json->offset, fmt, args);
+    va_end (args);
+  }
   json->offset += len;
 }
 
@@ -216,10 +313,88 @@ fpjson (FILE * fp, const char *fmt, ...)
 
 #pragma GCC diagnostic warning "-Wformat-nonliteral"
 
-/* Escape all other characters accordingly. */
+/* Write the given percentage as "%4.2f" would. The value times 100 is
+ * exact as a double, so rounding it half to even gives the same digits
+ * printf(3) does. Anything unusual goes through printf(3). */
 static void
-escape_json_other (GJSON * json, char **s)
+pjson_perc (GJSON * json, float val)
 {
+  double cents = (double) val * 100.0, frac = 0;
+  uint64_t n = 0;
+  char buf[32];
+
+  if (!(cents >= 0 && cents < 1e15)) {
+    snprintf (buf, sizeof (buf), "%4.2f", val);
+    pjson_str (json, buf);
+    return;
+  }
+
+  n = (uint64_t) cents;
+  frac = cents - (double) n;
+  if (frac > 0.5 || (frac == 0.5 && (n & 1)))
+    n++;
+
+  pjson_u64 (json, n / 100);
+  buf[0] = '.';
+  buf[1] = '0' + (n % 100) / 10;
+  buf[2] = '0' + n % 10;
+  pjson_nstr (json, buf, 3);
+}
+
+/* Build the table of characters to be escaped. */
+static void
+init_json_escapes (void)
+{
+  int c;
+
+  if (json_esc['"'])
+    return;
+
+  for (c = 0; c <= 0x1f; ++c)
+    json_esc[c] = JSON_ESC;
+  json_esc['"'] = json_esc['\\'] = json_esc['/'] = JSON_ESC;
+  /* possibly U+2028 or U+2029 */
+  json_esc[0xe2] = JSON_ESC;
+  json_esc['\''] = json_esc['&'] = JSON_ESC_HTML;
+  json_esc['<'] = json_esc['>'] = JSON_ESC_HTML;
+}
+
+/* Escape a single character accordingly.
+ *
+ * On success, the number of extra source bytes consumed is returned. */
+static int
+escape_json_char (GJSON * json, const char *s)
+{
+  char buf[8];
+
+  switch (*s) {
+    /* These are required JSON special characters that need to be escaped. */
+  case '"':
+    pjson_nstr (json, "\\\"", 2);
+    return 0;
+  case '\\':
+    pjson_nstr (json, "\\\\", 2);
+    return 0;
+  case '\b':
+    pjson_nstr (json, "\\b", 2);
+    return 0;
+  case '\f':
+    pjson_nstr (json, "\\f", 2);
+    return 0;
+  case '\n':
+    pjson_nstr (json, "\\n", 2);
+    return 0;
+  case '\r':
+    pjson_nstr (json, "\\r", 2);
+    return 0;
+  case '\t':
+    pjson_nstr (json, "\\t", 2);
+    return 0;
+  case '/':
+    pjson_nstr (json, "\\/", 2);
+    return 0;
+  }
+
   /* Since JSON data is bootstrapped into the HTML document of a report,
    * then we perform the following four translations in case weird stuff
    * is put into the document.
@@ -230,94 +405,93 @@ escape_json_other (GJSON * json, char **s)
    *
    * /index.html<?php eval(base_decode('iZWNobyAiPGgxPkhFTExPPC9oMT4iOw=='));?>
    */
-  if (escape_html_output) {
-    switch (**s) {
-    case '\'':
-      pjson (json, "&#39;");
-      return;
-    case '&':
-      pjson (json, "&amp;");
-      return;
-    case '<':
-      pjson (json, "&lt;");
-      return;
-    case '>':
-      pjson (json, "&gt;");
-      return;
-    }
+  switch (*s) {
+  case '\'':
+    pjson_str (json, "&#39;");
+    return 0;
+  case '&':
+    pjson_str (json, "&amp;");
+    return 0;
+  case '<':
+    pjson_str (json, "&lt;");
+    return 0;
+  case '>':
+    pjson_str (json, "&gt;");
+    return 0;
   }
 
-  if ((uint8_t) ** s <= 0x1f) {
+  if ((uint8_t) * s <= 0x1f) {
     /* Control characters (U+0000 through U+001F) */
-    char buf[8];
-    snprintf (buf, sizeof buf, "\\u%04x", **s);
-    pjson (json, "%s", buf);
-  } else if ((uint8_t) ** s == 0xe2 && (uint8_t) * (*s + 1) == 0x80 &&
-             (uint8_t) * (*s + 2) == 0xa8) {
+    snprintf (buf, sizeof buf, "\\u%04x", *s);
+    pjson_str (json, buf);
+  } else if ((uint8_t) * (s + 1) == 0x80 && (uint8_t) * (s + 2) == 0xa8) {
     /* Line separator (U+2028) - 0xE2 0x80 0xA8 */
-    pjson (json, "\\u2028");
-    *s += 2;
-  } else if ((uint8_t) ** s == 0xe2 && (uint8_t) * (*s + 1) == 0x80 &&
-             (uint8_t) * (*s + 2) == 0xa9) {
+    pjson_str (json, "\\u2028");
+    return 2;
+  } else if ((uint8_t) * (s + 1) == 0x80 && (uint8_t) * (s + 2) == 0xa9) {
     /* Paragraph separator (U+2019) - 0xE2 0x80 0xA9 */
-    pjson (json, "\\u2029");
-    *s += 2;
+    pjson_str (json, "\\u2029");
+    return 2;
   } else {
-    char buf[2];
-    snprintf (buf, sizeof buf, "%c", **s);
-    pjson (json, "%s", buf);
+    pjson_nstr (json, s, 1);
   }
+
+  return 0;
 }
 
-/* Escape and write to a valid JSON buffer.
+/* Escape and write to a valid JSON buffer. Runs of characters that
+ * don't need to be escaped are copied at once.
  *
  * On success, escaped JSON data is outputted. */
-static void
+void
 escape_json_output (GJSON * json, char *s)
 {
-  while (*s) {
-    switch (*s) {
-      /* These are required JSON special characters that need to be escaped. */
-    case '"':
-      pjson (json, "\\\"");
-      break;
-    case '\\':
-      pjson (json, "\\\\");
-      break;
-    case '\b':
-      pjson (json, "\\b");
-      break;
-    case '\f':
-      pjson (json, "\\f");
-      break;
-    case '\n':
-      pjson (json, "\\n");
-      break;
-    case '\r':
-      pjson (json, "\\r");
+  const unsigned char *p = (const unsigned char *) s;
+  unsigned char mask = JSON_ESC | (escape_html_output ? JSON_ESC_HTML : 0);
+  const char *run = NULL;
+
+  while (*p) {
+    run = (const char *) p;
+    while (*p && !(json_esc[*p] & mask))
+      p++;
+    if ((const char *) p != run)
+      pjson_nstr (json, run, (const char *) p - run);
+    if (*p == '\0')
       break;
-    case '\t':
-      pjson (json, "\\t");
-      break;
-    case '/':
-      pjson (json, "\\/");
-      break;
-    default:
-      escape_json_other (json, &s);
-      break;
-    }
-    s++;
+    p += escape_json_char (json, (const char *) p) + 1;
   }
 }
 
+/* Write to a buffer a JSON key. */
+static void
+pjson_key (GJSON * json, const char *key, int sp)
+{
+  pjson_tabs (json, sp);
+  pjson_nstr (json, "\"", 1);
+  pjson_str (json, key);
+  pjson_nstr (json, "\": ", 3);
+}
+
+/* Write to a buffer the separator after a value, unless it's the last
+ * one. */
+static void
+pjson_sep (GJSON * json, int last)
+{
+  if (last)
+    return;
+  pjson_nstr (json, ",", 1);
+  pjson_nl (json);
+}
+
 /* Write to a buffer a JSON a key/value pair. */
 static void
 pskeysval (GJSON * json, const char *key, const char *val, int sp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s\"%s\": \"%s\",%.*s", sp, TAB, key, val, nlines, NL);
-  else
-    pjson (json, "%.*s\"%s\": \"%s\"", sp, TAB, key, val);
+  pjson_key (json, key, sp);
+  pjson_nstr (json, "\"", 1);
+  pjson_str (json, val);
+  pjson_nstr (json, "\"", 1);
+  pjson_sep (json, last);
 }
 
 /* Output a JSON string key, array value pair. */
@@ -344,10 +518,9 @@ fpskeysval (FILE * fp, const char *key, const char *val, int sp, int last)
 static void
 pskeyival (GJSON * json, const char *key, int val, int sp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s\"%s\": %d,%.*s", sp, TAB, key, val, nlines, NL);
-  else
-    pjson (json, "%.*s\"%s\": %d", sp, TAB, key, val);
+  pjson_key (json, key, sp);
+  pjson_int (json, val);
+  pjson_sep (json, last);
 }
 
 /* Output a JSON string key, int value pair. */
@@ -364,20 +537,20 @@ fpskeyival (FILE * fp, const char *key, int val, int sp, int last)
 static void
 pskeyu64val (GJSON * json, const char *key, uint64_t val, int sp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s\"%s\": %" PRIu64 ",%.*s", sp, TAB, key, val, nlines, NL);
-  else
-    pjson (json, "%.*s\"%s\": %" PRIu64 "", sp, TAB, key, val);
+  pjson_key (json, key, sp);
+  pjson_u64 (json, val);
+  pjson_sep (json, last);
 }
 
 /* Write to a buffer a JSON string key, int value pair. */
 static void
 pskeyfval (GJSON * json, const char *key, float val, int sp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s\"%s\": \"%4.2f\",%.*s", sp, TAB, key, val, nlines, NL);
-  else
-    pjson (json, "%.*s\"%s\": \"%4.2f\"", sp, TAB, key, val);
+  pjson_key (json, key, sp);
+  pjson_nstr (json, "\"", 1);
+  pjson_perc (json, val);
+  pjson_nstr (json, "\"", 1);
+  pjson_sep (json, last);
 }
 
 /* Write to a buffer the open block item object. */
@@ -385,7 +558,9 @@ static void
 popen_obj (GJSON * json, int iisp)
 {
   /* open data metric block */
-  pjson (json, "%.*s{%.*s", iisp, TAB, nlines, NL);
+  pjson_tabs (json, iisp);
+  pjson_nstr (json, "{", 1);
+  pjson_nl (json);
 }
 
 /* Output the open block item object. */
@@ -401,7 +576,9 @@ static void
 popen_obj_attr (GJSON * json, const char *attr, int sp)
 {
   /* open object attribute */
-  pjson (json, "%.*s\"%s\": {%.*s", sp, TAB, attr, nlines, NL);
+  pjson_key (json, attr, sp);
+  pjson_nstr (json, "{", 1);
+  pjson_nl (json);
 }
 
 /* Output a JSON open object attribute. */
@@ -416,10 +593,10 @@ fpopen_obj_attr (FILE * fp, const char *attr, int sp)
 static void
 pclose_obj (GJSON * json, int iisp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s%.*s},%.*s", nlines, NL, iisp, TAB, nlines, NL);
-  else
-    pjson (json, "%.*s%.*s}", nlines, NL, iisp, TAB);
+  pjson_nl (json);
+  pjson_tabs (json, iisp);
+  pjson_nstr (json, "}", 1);
+  pjson_sep (json, last);
 }
 
 /* Close JSON object. */
@@ -437,7 +614,9 @@ static void
 popen_arr_attr (GJSON * json, const char *attr, int sp)
 {
   /* open object attribute */
-  pjson (json, "%.*s\"%s\": [%.*s", sp, TAB, attr, nlines, NL);
+  pjson_key (json, attr, sp);
+  pjson_nstr (json, "[", 1);
+  pjson_nl (json);
 }
 
 /* Output a JSON open array attribute. */
@@ -452,10 +631,10 @@ fpopen_arr_attr (FILE * fp, const char *attr, int sp)
 static void
 pclose_arr (GJSON * json, int sp, int last)
 {
-  if (!last)
-    pjson (json, "%.*s%.*s],%.*s", nlines, NL, sp, TAB, nlines, NL);
-  else
-    pjson (json, "%.*s%.*s]", nlines, NL, sp, TAB);
+  pjson_nl (json);
+  pjson_tabs (json, sp);
+  pjson_nstr (json, "]", 1);
+  pjson_sep (json, last);
 }
 
 /* Close the data array. */
@@ -539,7 +718,7 @@ poverall_processed_time (GJSON * json, int sp)
 static void
 poverall_visitors (GJSON * json, int sp)
 {
-  pskeyival (json, OVERALL_VISITORS, ht_get_size_uniqmap (VISITORS), sp, 0);
+  pskeyival (json, OVERALL_VISITORS, get_overall_visitors (), sp, 0);
 }
 
 /* Write to a buffer the total number of unique files under the
@@ -627,6 +806,110 @@ poverall_log (GJSON * json, int sp)
   pclose_arr (json, sp, 1);
 }
 
+/* Write to a buffer the timer of a processing stage. */
+static void
+pstats_timer (GJSON * json, const char *name, const GStatsTimer * t, int sp,
+              int last)
+{
+  int isp = 0;
+
+  /* use tabs to prettify output */
+  if (conf.json_pretty_print)
+    isp = sp + 1;
+
+  popen_obj_attr (json, name, sp);
+  pskeyu64val (json, "count", t->count, isp, 0);
+  pskeyu64val (json, "ns", t->ns, isp, 1);
+  pclose_obj (json, sp, last);
+}
+
+/* Write to a buffer the processing stats of each stage, and the ones of
+ * storing each module of the log, under "modules". */
+static void
+poverall_proc_stats (GJSON * json, int sp)
+{
+  GModule module;
+  size_t idx = 0, n = get_num_modules (), cnt = 0;
+  int i, isp = 0, iisp = 0;
+
+  /* use tabs to prettify output */
+  if (conf.json_pretty_print)
+    isp = sp + 1, iisp = sp + 2;
+
+  popen_obj_attr (json, OVERALL_PROCSTATS, sp);
+  for (i = 0; i < STATS_STAGES; ++i)
+    pstats_timer (json, stats_stage_str (i), get_stats_stage (i), isp, 0);
+
+  popen_obj_attr (json, "modules", isp);
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    pstats_timer (json, module_to_id (module), get_stats_module (module),
+                  iisp, ++cnt == n);
+  }
+  pclose_obj (json, isp, 1);
+  pclose_obj (json, sp, 0);
+}
+
+/* Write to a buffer the memory usage of a metric, or of the tables used
+ * across the whole app. */
+static void
+pmem_usage (GJSON * json, const char *name, const GSMemUsage * mem, int sp,
+            int last)
+{
+  int isp = 0;
+
+  /* use tabs to prettify output */
+  if (conf.json_pretty_print)
+    isp = sp + 1;
+
+  popen_obj_attr (json, name, sp);
+  pskeyu64val (json, "buckets", mem->buckets, isp, 0);
+  pskeyu64val (json, "owned", mem->owned, isp, 1);
+  pclose_obj (json, sp, last);
+}
+
+/* Write to a buffer the bytes handed out by the storage allocator, the
+ * memory taken by the tables used across the whole app, and the one
+ * taken by each metric of each module of the log, under "modules". */
+static void
+poverall_mem_usage (GJSON * json, int sp)
+{
+  GModule module;
+  GSMemUsage mem;
+  GSpillStats spill;
+  size_t idx = 0, n = get_num_modules (), cnt = 0;
+  int i, isp = 0, iisp = 0, iiisp = 0;
+
+  /* use tabs to prettify output */
+  if (conf.json_pretty_print)
+    isp = sp + 1, iisp = sp + 2, iiisp = sp + 3;
+
+  popen_obj_attr (json, OVERALL_MEMUSAGE, sp);
+  get_spill_stats (&spill);
+  popen_obj_attr (json, "allocator", isp);
+  pskeyu64val (json, "heap", spill.heap, iisp, 0);
+  pskeyu64val (json, "spilled", spill.mapped, iisp, 0);
+  pskeyu64val (json, "files", spill.maps, iisp, 1);
+  pclose_obj (json, isp, 0);
+
+  get_mem_shared (&mem);
+  pmem_usage (json, "shared", &mem, isp, 0);
+
+  popen_obj_attr (json, "modules", isp);
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    popen_obj_attr (json, module_to_id (module), iisp);
+    for (i = 0; i < GSMTRC_TOTAL; ++i) {
+      ht_get_mem_usage (module, i, &mem);
+      pmem_usage (json, mem_metric_str (i), &mem, iiisp,
+                  i == GSMTRC_TOTAL - 1);
+    }
+    pclose_obj (json, iisp, ++cnt == n);
+  }
+  pclose_obj (json, isp, 1);
+  pclose_obj (json, sp, 0);
+}
+
 /* Write to a buffer hits data. */
 static void
 phits (GJSON * json, GMetrics * nmetrics, int sp)
@@ -746,6 +1029,26 @@ pmeta_data_unique (GJSON * json, int ht_size, int sp)
   pclose_obj (json, sp, 1);
 }
 
+/* Write to a buffer the heavy hitters meta data object of a panel
+ * keeping only its heavy hitters. */
+static void
+pmeta_data_hitters (GJSON * json, GModule module, int sp)
+{
+  int isp = 0, max = 0;
+
+  if ((max = get_heavy_hitters (module)) == 0)
+    return;
+
+  /* use tabs to prettify output */
+  if (conf.json_pretty_print)
+    isp = sp + 1;
+
+  popen_obj_attr (json, "heavy_hitters", sp);
+  pskeyival (json, "max", max, isp, 0);
+  pskeyival (json, "error", ht_get_hitters_error (module), isp, 1);
+  pclose_obj (json, sp, 0);
+}
+
 /* Write to a buffer the hits meta data object. */
 static void
 pmeta_data_hits (GJSON * json, GModule module, int sp)
@@ -897,6 +1200,7 @@ print_meta_data (GJSON * json, GHolder * h, int sp)
   pmeta_data_bw (json, h->module, iisp);
   pmeta_data_visitors (json, h->module, iisp);
   pmeta_data_hits (json, h->module, iisp);
+  pmeta_data_hitters (json, h->module, iisp);
   pmeta_data_unique (json, h->ht_size, iisp);
 
   pclose_obj (json, isp, 0);
@@ -923,9 +1227,10 @@ print_json_block (GJSON * json, GMetrics * nmetrics, int sp)
   pprotocol (json, nmetrics, sp);
 
   /* data metric */
-  pjson (json, "%.*s\"data\": \"", sp, TAB);
+  pjson_key (json, "data", sp);
+  pjson_nstr (json, "\"", 1);
   escape_json_output (json, nmetrics->data);
-  pjson (json, "\"");
+  pjson_nstr (json, "\"", 1);
 }
 
 /* Add the given user agent value into our array of GAgents.
@@ -947,15 +1252,16 @@ fill_host_agents (void *val, void *user_data)
   return 0;
 }
 
-/* Iterate over the list of agents */
+/* Iterate over the user agent keys */
 static void
-load_host_agents (void *list, void *user_data, GO_UNUSED int count)
+load_host_agents (void *list, void *user_data, int count)
 {
-  GSLList *lst = list;
+  int *keys = list, i;
   GAgents *agents = user_data;
 
   agents->items = new_gagent_item (count);
-  list_foreach (lst, fill_host_agents, agents);
+  for (i = 0; i < count; ++i)
+    fill_host_agents (&keys[i], agents);
 }
 
 /* A wrapper function to ouput an array of user agents for each host. */
@@ -1039,7 +1345,8 @@ print_json_host_geo (GJSON * json, GSubList * sl, int iisp)
 
   /* Iterate over child properties (country, city, etc) and print them out */
   for (i = 0, iter = sl->head; iter; iter = iter->next, i++) {
-    pjson (json, "%.*s\"%s\": \"", iisp, TAB, key[iter->metrics->id]);
+    pjson_key (json, key[iter->metrics->id], iisp);
+    pjson_nstr (json, "\"", 1);
     escape_json_output (json, iter->metrics->data);
     pjson (json, (i != sl->size - 1) ? "\",%.*s" : "\"", nlines, NL);
   }
@@ -1112,23 +1419,26 @@ print_json_data (GJSON * json, GHolder * h, GPercTotals totals,
   pclose_obj (json, sp, 1);
 }
 
-/* Get the number of available panels.
+/* Get the number of available panels out of the given ones (a bit mask
+ * of 1 << module).
  *
  * On success, the total number of available panels is returned . */
 static int
-num_panels (void)
+num_panels (uint32_t panels)
 {
   size_t idx = 0, npanels = 0;
 
-  FOREACH_MODULE (idx, module_list)
-    npanels++;
+  FOREACH_MODULE (idx, module_list) {
+    if (panels & (UINT32_C (1) << module_list[idx]))
+      npanels++;
+  }
 
   return npanels;
 }
 
 /* Write to a buffer overall data. */
 static void
-print_json_summary (GJSON * json, GLog * glog, GHolder * holder)
+print_json_summary (GJSON * json, GLog * glog, GHolder * holder, int npanels)
 {
   int sp = 0, isp = 0;
 
@@ -1165,47 +1475,137 @@ print_json_summary (GJSON * json, GLog * glog, GHolder * holder)
   poverall_log_size (json, isp);
   /* bandwidth */
   poverall_bandwidth (json, glog, isp);
+  /* time spent on each processing stage */
+  if (conf.processing_stats)
+    poverall_proc_stats (json, isp);
+  /* memory taken by each metric */
+  if (conf.memory_stats)
+    poverall_mem_usage (json, isp);
   /* log path */
   poverall_log (json, isp);
-  pclose_obj (json, sp, num_panels () > 0 ? 0 : 1);
+  pclose_obj (json, sp, npanels > 0 ? 0 : 1);
+}
+
+/* Write to a buffer the JSON data of the given panel. */
+static void
+print_json_panel (GJSON * json, GHolder * holder, const GPanel * panel)
+{
+  GPercTotals totals;
+
+  set_module_totals (panel->module, &totals);
+  panel->render (json, holder + panel->module, totals, panel);
+}
+
+/* Serialize the remaining panels, one at a time. */
+static void *
+json_job (void *ptr_data)
+{
+  GJSONJobs *jobs = ptr_data;
+  int i;
+
+  while ((i = __atomic_fetch_add (&jobs->next, 1, __ATOMIC_RELAXED)) <
+         jobs->len) {
+    jobs->panels[i] = new_gjson ();
+    print_json_panel (jobs->panels[i], jobs->holder,
+                      panel_lookup (jobs->modules[i]));
+  }
+
+  return NULL;
+}
+
+/* Serialize the panels of the given modules using up to the given
+ * number of threads, including the current one. Panels only read from
+ * their own holder and store, which are not written to meanwhile.
+ *
+ * Tokyo Cabinet's storage may write pending updates when read, so it's
+ * always serialized from the current thread. */
+static void
+run_json_jobs (GJSONJobs * jobs, int threads)
+{
+  pthread_t thread[MAX_JOBS];
+  int i, spawned = 0;
+
+#ifdef HAVE_LIBTOKYOCABINET
+  threads = 1;
+#endif
+  if (threads > jobs->len)
+    threads = jobs->len;
+
+  /* fall back to the current thread if unable to spawn a new one */
+  for (i = 1; i < threads; ++i) {
+    if (pthread_create (&thread[spawned], NULL, json_job, jobs) == 0)
+      spawned++;
+  }
+  json_job (jobs);
+
+  for (i = 0; i < spawned; ++i)
+    pthread_join (thread[i], NULL);
 }
 
-/* Iterate over all panels and generate json output. */
+/* Iterate over the given panels (a bit mask of 1 << module) and
+ * generate json output. If a stream is given, the output is written to
+ * it in chunks as it's generated, else it's all kept in the buffer.
+ *
+ * When kept in the buffer, panels are serialized in parallel (see
+ * --jobs), each into its own buffer, and spliced together in order. */
 static GJSON *
-init_json_output (GLog * glog, GHolder * holder)
+init_json_output (GLog * glog, GHolder * holder, uint32_t panels, FILE * fp)
 {
   GJSON *json = NULL;
+  GJSONJobs jobs;
   GModule module;
-  GPercTotals totals;
   const GPanel *panel = NULL;
-  size_t idx = 0, npanels = num_panels (), cnt = 0;
+  size_t idx = 0, npanels = num_panels (panels), cnt = 0;
+  int i;
+  uint64_t ts = stats_begin ();
 
   json = new_gjson ();
+  json->fp = fp;
 
   popen_obj (json, 0);
-  print_json_summary (json, glog, holder);
+  print_json_summary (json, glog, holder, npanels);
 
+  memset (&jobs, 0, sizeof (jobs));
+  jobs.holder = holder;
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
 
+    if (!(panels & (UINT32_C (1) << module)))
+      continue;
     if (!(panel = panel_lookup (module)))
       continue;
+    jobs.modules[jobs.len++] = module;
+  }
 
-    set_module_totals (module, &totals);
-    panel->render (json, holder + module, totals, panel);
+  if (fp == NULL && conf.jobs > 1 && jobs.len > 1)
+    run_json_jobs (&jobs, conf.jobs);
+
+  for (i = 0; i < jobs.len; ++i) {
+    if (jobs.panels[i] != NULL) {
+      pjson_nstr (json, jobs.panels[i]->buf, jobs.panels[i]->offset);
+      free_json (jobs.panels[i]);
+    } else {
+      print_json_panel (json, holder, panel_lookup (jobs.modules[i]));
+    }
     pjson (json, (cnt++ != npanels - 1) ? ",%.*s" : "%.*s", nlines, NL);
   }
 
   pclose_obj (json, 0, 1);
+  flush_json (json);
+
+  stats_end (STATS_JSON, ts);
 
   return json;
 }
 
-/* Open and write to a dynamically sized output buffer.
+/* Open and write to a dynamically sized output buffer the overall
+ * data and only the given panels (a bit mask of 1 << module), e.g., the
+ * ones that changed since the last real-time update.
  *
  * On success, the newly allocated buffer is returned . */
 char *
-get_json (GLog * glog, GHolder * holder, int escape_html)
+get_json_panels (GLog * glog, GHolder * holder, uint32_t panels,
+                 int escape_html)
 {
   GJSON *json = NULL;
   char *buf = NULL;
@@ -1214,14 +1614,41 @@ get_json (GLog * glog, GHolder * holder, int escape_html)
     return NULL;
 
   escape_html_output = escape_html;
-  if ((json = init_json_output (glog, holder)) && json->size > 0) {
-    buf = xstrdup (json->buf);
-    free_json (json);
+  json = init_json_output (glog, holder, panels, NULL);
+  if (json->size > 0) {
+    /* hand the buffer over, null-terminated */
+    json->buf[json->offset] = '\0';
+    buf = json->buf;
+    json->buf = NULL;
   }
+  free_json (json);
 
   return buf;
 }
 
+/* Open and write to a dynamically sized output buffer.
+ *
+ * On success, the newly allocated buffer is returned . */
+char *
+get_json (GLog * glog, GHolder * holder, int escape_html)
+{
+  return get_json_panels (glog, holder, JSON_ALL_PANELS, escape_html);
+}
+
+/* Write the overall data and the JSON data of the given panels (a bit
+ * mask of 1 << module) to the given stream, in chunks as it's
+ * generated. */
+void
+fpjson_panels (FILE * fp, GLog * glog, GHolder * holder, uint32_t panels,
+               int escape_html)
+{
+  if (holder == NULL)
+    return;
+
+  escape_html_output = escape_html;
+  free_json (init_json_output (glog, holder, panels, fp));
+}
+
 /* Entry point to generate a json report writing it to the fp */
 void
 output_json (GLog * glog, GHolder * holder, const char *filename)
@@ -1241,11 +1668,9 @@ output_json (GLog * glog, GHolder * holder, const char *filename)
   if (conf.json_pretty_print)
     nlines = 1;
 
-  /* spit it out */
-  if ((json = init_json_output (glog, holder)) && json->size > 0) {
-    fprintf (fp, "%s", json->buf);
-    free_json (json);
-  }
+  /* spit it out as it's generated */
+  json = init_json_output (glog, holder, JSON_ALL_PANELS, fp);
+  free_json (json);
 
   fclose (fp);
 }
@@ -39,14 +39,36 @@
 
 #include "parser.h"
 
+#define JSON_ALL_PANELS  UINT32_MAX     /* bit mask of 1 << module */
+#define JSON_CHUNK_SIZE  65536  /* streamed out in chunks of this size */
+
 typedef struct GJSON_
 {
   char *buf;                    /* pointer to buffer */
   size_t size;                  /* size of malloc'd buffer */
   size_t offset;                /* current write offset */
+  FILE *fp;                     /* stream it's written to, if any */
 } GJSON;
 
+/* Panels serialized by a pool of threads, each into its own buffer,
+ * see run_json_jobs() */
+typedef struct GJSONJobs_
+{
+  GModule modules[TOTAL_MODULES];
+  GJSON *panels[TOTAL_MODULES]; /* serialized panel of each module */
+  GHolder *holder;
+  int len;                      /* number of modules */
+  int next;                     /* next module to be serialized */
+} GJSONJobs;
+
+GJSON *new_gjson (void);
+void escape_json_output (GJSON * json, char *s);
+void free_json (GJSON * json);
+void pjson (GJSON * json, const char *fmt, ...);
+
 char *get_json (GLog * glog, GHolder * holder, int escape_html);
+char *get_json_panels (GLog * glog, GHolder * holder, uint32_t panels,
+                       int escape_html);
 
 void output_json (GLog * glog, GHolder * holder, const char *filename);
 void set_json_nlines (int nl);
@@ -58,6 +80,8 @@ void fpskeyaval (FILE * fp, const char *key, const char *val, int sp, int last);
 void fpclose_arr (FILE * fp, int sp, int last);
 void fpclose_obj (FILE * fp, int iisp, int last);
 void fpjson (FILE * fp, const char *fmt, ...);
+void fpjson_panels (FILE * fp, GLog * glog, GHolder * holder, uint32_t panels,
+                    int escape_html);
 void fpopen_arr_attr (FILE * fp, const char *attr, int sp);
 void fpopen_obj_attr (FILE * fp, const char *attr, int sp);
 void fpopen_obj (FILE * fp, int iisp);
@@ -37,12 +37,13 @@
 
 #include "opesys.h"
 
+#include "gmatch.h"
 #include "settings.h"
 #include "util.h"
 #include "xmalloc.h"
 
-/* ###NOTE: The size of the list is proportional to the run time,
- * which makes this pretty slow */
+/* all OS search strings, in priority order */
+static GMatch *os_match = NULL;
 
 /* {"search string", "belongs to"} */
 static const char *os[][2] = {
@@ -372,26 +373,42 @@ parse_os (const char *str, char *tkn, char *os_type, int idx)
   return alloc_string (parse_others (tkn, spaces));
 }
 
+/* Build a single matcher out of our array of OSs, so a user agent can
+ * be matched against all of them in one pass. */
+void
+init_opesys (void)
+{
+  size_t i;
+
+  os_match = new_gmatch ();
+  for (i = 0; i < ARRAY_SIZE (os); i++)
+    gmatch_add (os_match, os[i][0]);
+  gmatch_build (os_match);
+}
+
+/* Free the OS matcher. */
+void
+free_opesys (void)
+{
+  free_gmatch (os_match);
+  os_match = NULL;
+}
+
 /* Given a user agent, determine the operating system used.
- *
- * ###NOTE: The size of the list is proportional to the run time,
- * which makes this pretty slow
  *
  * On error, NULL is returned.
  * On success, a malloc'd  string containing the OS is returned. */
 char *
 verify_os (const char *str, char *os_type)
 {
-  char *a;
-  size_t i;
+  const char *a = NULL;
+  int idx = -1;
 
   if (str == NULL || *str == '\0')
     return NULL;
 
-  for (i = 0; i < ARRAY_SIZE (os); i++) {
-    if ((a = strstr (str, os[i][0])) != NULL)
-      return parse_os (str, a, os_type, i);
-  }
+  if ((idx = gmatch_find (os_match, str, &a)) != -1)
+    return parse_os (str, (char *) a, os_type, idx);
   xstrncpy (os_type, "Unknown", OPESYS_TYPE_LEN);
 
   return alloc_string ("Unknown");
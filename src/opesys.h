@@ -40,5 +40,7 @@ typedef struct GOpeSys_
 } GOpeSys;
 
 char *verify_os (const char *str, char *os_type);
+void free_opesys (void);
+void init_opesys (void);
 
 #endif
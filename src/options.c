@@ -37,6 +37,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifdef HAVE_LIBTOKYOCABINET
 #include "tcabdb.h"
@@ -50,6 +51,7 @@
 #include "options.h"
 
 #include "error.h"
+#include "gbench.h"
 #include "labels.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -89,9 +91,16 @@ struct option long_opts[] = {
   {"anonymize-ip"         , no_argument       , 0 ,  0  } ,
   {"addr"                 , required_argument , 0 ,  0  } ,
   {"all-static-files"     , no_argument       , 0 ,  0  } ,
+  {"approx-visitors"      , no_argument       , 0 ,  0  } ,
+  {"benchmark"            , required_argument , 0 ,  0  } ,
+  {"benchmark-agents"     , required_argument , 0 ,  0  } ,
+  {"benchmark-hosts"      , required_argument , 0 ,  0  } ,
+  {"benchmark-micro"      , required_argument , 0 ,  0  } ,
+  {"benchmark-urls"       , required_argument , 0 ,  0  } ,
   {"color"                , required_argument , 0 ,  0  } ,
   {"color-scheme"         , required_argument , 0 ,  0  } ,
   {"crawlers-only"        , no_argument       , 0 ,  0  } ,
+  {"csv-stream"           , required_argument , 0 ,  0  } ,
   {"daemonize"            , no_argument       , 0 ,  0  } ,
   {"date-format"          , required_argument , 0 ,  0  } ,
   {"date-spec"            , required_argument , 0 ,  0  } ,
@@ -100,10 +109,15 @@ struct option long_opts[] = {
   {"enable-panel"         , required_argument , 0 ,  0  } ,
   {"fifo-in"              , required_argument , 0 ,  0  } ,
   {"fifo-out"             , required_argument , 0 ,  0  } ,
+  {"hash-visitor-keys"    , no_argument       , 0 ,  0  } ,
+  {"heavy-hitters"        , required_argument , 0 ,  0  } ,
   {"hide-referer"         , required_argument , 0 ,  0  } ,
   {"hour-spec"            , required_argument , 0 ,  0  } ,
+  {"html-assets-dir"      , required_argument , 0 ,  0  } ,
+  {"html-assets-url"      , required_argument , 0 ,  0  } ,
   {"html-custom-css"      , required_argument , 0 ,  0  } ,
   {"html-custom-js"       , required_argument , 0 ,  0  } ,
+  {"html-lazy-panels"     , required_argument , 0 ,  0  } ,
   {"html-prefs"           , required_argument , 0 ,  0  } ,
   {"html-report-title"    , required_argument , 0 ,  0  } ,
   {"ignore-crawlers"      , no_argument       , 0 ,  0  } ,
@@ -112,9 +126,11 @@ struct option long_opts[] = {
   {"ignore-referer"       , required_argument , 0 ,  0  } ,
   {"ignore-status"        , required_argument , 0 ,  0  } ,
   {"invalid-requests"     , required_argument , 0 ,  0  } ,
+  {"jobs"                 , required_argument , 0 ,  0  } ,
   {"json-pretty-print"    , no_argument       , 0 ,  0  } ,
   {"log-format"           , required_argument , 0 ,  0  } ,
   {"max-items"            , required_argument , 0 ,  0  } ,
+  {"memory-stats"         , no_argument       , 0 ,  0  } ,
   {"no-color"             , no_argument       , 0 ,  0  } ,
   {"no-column-names"      , no_argument       , 0 ,  0  } ,
   {"no-csv-summary"       , no_argument       , 0 ,  0  } ,
@@ -124,13 +140,16 @@ struct option long_opts[] = {
   {"no-progress"          , no_argument       , 0 ,  0  } ,
   {"no-tab-scroll"        , no_argument       , 0 ,  0  } ,
   {"num-tests"            , required_argument , 0 ,  0  } ,
+  {"presize-tables"       , no_argument       , 0 ,  0  } ,
   {"origin"               , required_argument , 0 ,  0  } ,
   {"output"               , required_argument , 0 ,  0  } ,
   {"pid-file"             , required_argument , 0 ,  0  } ,
   {"port"                 , required_argument , 0 ,  0  } ,
   {"process-and-exit"     , no_argument       , 0 ,  0  } ,
+  {"processing-stats"     , no_argument       , 0 ,  0  } ,
   {"real-os"              , no_argument       , 0 ,  0  } ,
   {"real-time-html"       , no_argument       , 0 ,  0  } ,
+  {"resolver-threads"     , required_argument , 0 ,  0  } ,
   {"sort-panel"           , required_argument , 0 ,  0  } ,
   {"static-file"          , required_argument , 0 ,  0  } ,
 #ifdef HAVE_LIBSSL
@@ -150,13 +169,24 @@ struct option long_opts[] = {
   {"cache-lcnum"          , required_argument , 0 ,  0  } ,
   {"cache-ncnum"          , required_argument , 0 ,  0  } ,
   {"compression"          , required_argument , 0 ,  0  } ,
+  {"db-flush-interval"    , required_argument , 0 ,  0  } ,
   {"db-path"              , required_argument , 0 ,  0  } ,
   {"keep-db-files"        , no_argument       , 0 ,  0  } ,
   {"load-from-disk"       , no_argument       , 0 ,  0  } ,
+  {"tune-auto"            , no_argument       , 0 ,  0  } ,
   {"tune-bnum"            , required_argument , 0 ,  0  } ,
   {"tune-lmemb"           , required_argument , 0 ,  0  } ,
   {"tune-nmemb"           , required_argument , 0 ,  0  } ,
   {"xmmap"                , required_argument , 0 ,  0  } ,
+#endif
+#ifndef HAVE_LIBTOKYOCABINET
+  {"persist-snapshot"     , required_argument , 0 ,  0  } ,
+  {"memory-limit"         , required_argument , 0 ,  0  } ,
+  {"merge"                , required_argument , 0 ,  0  } ,
+  {"restore-snapshot"     , required_argument , 0 ,  0  } ,
+  {"shards"               , required_argument , 0 ,  0  } ,
+  {"split-by-vhost"       , required_argument , 0 ,  0  } ,
+  {"time-window"          , required_argument , 0 ,  0  } ,
 #endif
   {0, 0, 0, 0}
 };
@@ -187,8 +217,15 @@ cmd_help (void)
   "  --color=<fg:bg[attrs, PANEL]>   - Specify custom colors. See manpage for more\n"
   "                                    details and options.\n"
   "  --color-scheme=<1|2|3>          - Schemes: 1 => Grey, 2 => Green, 3 => Monokai.\n"
+  "  --csv-stream=<csv|tsv>          - Stream every item of the CSV output from the\n"
+  "                                    storage, unsorted, as CSV or TSV.\n"
+  "  --html-assets-dir=<path>        - Write the CSS and JS of the HTML report once\n"
+  "                                    into the given directory and link them.\n"
+  "  --html-assets-url=<url>         - URL the HTML report links the assets from.\n"
   "  --html-custom-css=<path.css>    - Specify a custom CSS file in the HTML report.\n"
   "  --html-custom-js=<path.js>      - Specify a custom JS file in the HTML report.\n"
+  "  --html-lazy-panels=<json|gzip>  - Leave panel data out of the HTML report, in\n"
+  "                                    files of its own or sent over WebSocket.\n"
   "  --html-prefs=<json_obj>         - Set default HTML report preferences.\n"
   "  --html-report-title=<title>     - Set HTML report page title and header.\n"
   "  --json-pretty-print             - Format JSON output w/ tabs & newlines.\n"
@@ -238,9 +275,11 @@ cmd_help (void)
   "  -d --with-output-resolver       - Enable IP resolver on HTML|JSON output.\n"
   "  -e --exclude-ip=<IP>            - Exclude one or multiple IPv4/6. Allows IP\n"
   "                                    ranges e.g. 192.168.0.1-192.168.0.10\n"
+  "                                    and CIDR notation e.g. 10.0.0.0/8\n"
   "  -H --http-protocol=<yes|no>     - Set/unset HTTP request protocol if found.\n"
   "  -M --http-method=<yes|no>       - Set/unset HTTP request method if found.\n"
   "  -o --output=file.html|json|csv  - Output either an HTML, JSON or a CSV file.\n"
+  "                                    Also an Arrow IPC file, e.g., file.arrow.\n"
   "  -q --no-query-string            - Ignore request's query string. Removing the\n"
   "                                    query string can greatly decrease memory\n"
   "                                    consumption.\n"
@@ -253,11 +292,28 @@ cmd_help (void)
 #endif
   "  --anonymize-ip                  - Anonymize IP addresses before outputting to report.\n"
   "  --all-static-files              - Include static files with a query string.\n"
+  "  --approx-visitors               - Estimate unique visitors per item through\n"
+  "                                    HyperLogLog sketches (~1.6%% error).\n"
+  "  --benchmark=<lines>             - Parse as many lines of a synthetic log of\n"
+  "                                    the --log-format and report throughput.\n"
+  "  --benchmark-agents=<number>     - Distinct agents of the synthetic log. %d\n"
+  "                                    by default.\n"
+  "  --benchmark-hosts=<number>      - Distinct hosts of the synthetic log. %d\n"
+  "                                    by default.\n"
+  "  --benchmark-micro=<ops>         - Time the storage, sort, agent, parsing\n"
+  "                                    and JSON primitives on their own, as\n"
+  "                                    many ops each, in ns and allocs per op.\n"
+  "  --benchmark-urls=<number>       - Distinct URLs of the synthetic log. %d by\n"
+  "                                    default.\n"
   "  --crawlers-only                 - Parse and display only crawlers.\n"
   "  --date-spec=<date|hr>           - Date specificity. Possible values: `date`\n"
   "                                    (default), or `hr`.\n"
   "  --double-decode                 - Decode double-encoded values.\n"
   "  --enable-panel=<PANEL>          - Enable parsing/displaying the given panel.\n"
+  "  --hash-visitor-keys             - Store a 128-bit hash of the unique visitor\n"
+  "                                    keys (IP/date/UA) instead of the keys.\n"
+  "  --heavy-hitters=<PANEL[,NUM]>   - Keep only the NUM (default: %d) items of\n"
+  "                                    the given panel with the most hits.\n"
   "  --hide-referer=<NEEDLE>         - Hide a referer but still count it. Wild cards\n"
   "                                    are allowed. i.e., *.bing.com\n"
   "  --hour-spec=<hr|min>            - Hour specificity. Possible values: `hr`\n"
@@ -270,10 +326,20 @@ cmd_help (void)
   "                                    req => Ignore from valid requests.\n"
   "                                    panel => Ignore from valid requests and panels.\n"
   "  --ignore-status=<CODE>          - Ignore parsing the given status code.\n"
+  "  --jobs=<number>                 - Number of threads used to parse log lines\n"
+  "                                    and build panels. 1 by default, up to %d.\n"
   "  --num-tests=<number>            - Number of lines to test. >= 0 (10 default)\n"
+  "  --presize-tables                - Size the hash tables up front from a sample\n"
+  "                                    of the first lines of the log.\n"
   "  --process-and-exit              - Parse log and exit without outputting data.\n"
+  "  --processing-stats              - Time each processing stage, e.g., parsing,\n"
+  "                                    storing each panel or sorting.\n"
+  "  --memory-stats                  - Output the memory taken by each metric of\n"
+  "                                    each panel. Also dumped on SIGUSR1.\n"
   "  --real-os                       - Display real OS names. e.g, Windows XP, Snow\n"
   "                                    Leopard.\n"
+  "  --resolver-threads=<number>     - Number of threads used to resolve IPs on\n"
+  "                                    terminal output. 1 by default, up to %d.\n"
   "  --sort-panel=PANEL,METRIC,ORDER - Sort panel on initial load. For example:\n"
   "                                    --sort-panel=VISITORS,BY_HITS,ASC. See\n"
   "                                    manpage for a list of panels/fields.\n"
@@ -299,10 +365,14 @@ cmd_help (void)
   "  --keep-db-files                 - Persist parsed data into disk.\n"
   "  --load-from-disk                - Load previously stored data from disk.\n"
   "  --db-path=<path>                - Path of the database file. Default [%s]\n"
+  "  --db-flush-interval=<number>    - Number of buffered updates written to the\n"
+  "                                    database per transaction. Default [%d]\n"
   "  --cache-lcnum=<number>          - Max number of leaf nodes to be cached. Default\n"
   "                                    [%d]\n"
   "  --cache-ncnum=<number>          - Max number of non-leaf nodes to be cached.\n"
   "                                    Default [%d]\n"
+  "  --tune-auto                     - Tune each database out of a sample of the\n"
+  "                                    first lines of the log.\n"
   "  --tune-bnum=<number>            - Number of elements of the bucket array. Default\n"
   "                                    [%d]\n"
   "  --tune-lmemb=<number>           - Number of members in each leaf page. Default\n"
@@ -318,6 +388,27 @@ cmd_help (void)
 #endif
 #endif
 
+/* In-Memory Snapshot Options */
+#ifndef HAVE_LIBTOKYOCABINET
+  "In-Memory Snapshot Options\n\n"
+  "  --memory-limit=<num[K|M|G]>     - Keep at most this much of the storage on\n"
+  "                                    the heap, growing tables past it spill to\n"
+  "                                    temporary files, e.g., 4G.\n"
+  "  --merge=<file>                  - Merge a snapshot persisted by another\n"
+  "                                    run, e.g., on another host. Repeatable.\n"
+  "  --persist-snapshot=<file>       - Persist parsed data into a snapshot file\n"
+  "                                    when exiting.\n"
+  "  --restore-snapshot=<file>       - Restore previously persisted data from a\n"
+  "                                    snapshot file before parsing.\n"
+  "  --shards=<number>               - Number of logs parsed at once, each on a\n"
+  "                                    process of its own, then merged.\n"
+  "  --split-by-vhost=<dir>          - Output a report per virtual host into the\n"
+  "                                    given directory, besides the overall one.\n"
+  "  --time-window=<num[m|h|d]>      - Keep only the data of the latest minutes,\n"
+  "                                    hours or days parsed, e.g., 15m, 24h.\n"
+  "\n"
+#endif
+
 /* Other Options */
   "Other Options\n\n"
   "  -h --help                       - This help.\n"
@@ -332,8 +423,10 @@ cmd_help (void)
   "%s: http://goaccess.io\n"
   "GoAccess Copyright (C) 2009-2017 by Gerardo Orellana"
   "\n\n"
+  , BENCH_AGENTS, BENCH_HOSTS, BENCH_URLS, MAX_HITTERS, MAX_JOBS,
+  MAX_RESOLVER_THREADS
 #ifdef TCB_BTREE
-  , TC_DBPATH, TC_MMAP, TC_LCNUM, TC_NCNUM, TC_LMEMB, TC_NMEMB, TC_BNUM
+  , TC_DBPATH, TC_FLUSH, TC_MMAP, TC_LCNUM, TC_NCNUM, TC_LMEMB, TC_NMEMB, TC_BNUM
 #endif
   , INFO_HELP_EXAMPLES, INFO_MORE_INFO
   );
@@ -381,6 +474,22 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("color-scheme", name))
     conf.color_scheme = atoi (oarg);
 
+  /* stream the csv output off the storage */
+  if (!strcmp ("csv-stream", name)) {
+    if (!strcmp ("csv", oarg))
+      conf.csv_stream = CSV_STREAM;
+    else if (!strcmp ("tsv", oarg))
+      conf.csv_stream = TSV_STREAM;
+  }
+
+  /* html shared assets */
+  if (!strcmp ("html-assets-dir", name))
+    conf.html_assets_dir = oarg;
+
+  /* html shared assets URL */
+  if (!strcmp ("html-assets-url", name))
+    conf.html_assets_url = oarg;
+
   /* html custom CSS */
   if (!strcmp ("html-custom-css", name))
     conf.html_custom_css = oarg;
@@ -389,6 +498,14 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("html-custom-js", name))
     conf.html_custom_js = oarg;
 
+  /* html panel data loaded once the report is */
+  if (!strcmp ("html-lazy-panels", name)) {
+    if (!strcmp ("json", oarg))
+      conf.html_lazy_panels = LAZY_PANELS_JSON;
+    else if (!strcmp ("gzip", oarg))
+      conf.html_lazy_panels = LAZY_PANELS_GZIP;
+  }
+
   /* html JSON object containing default preferences */
   if (!strcmp ("html-prefs", name))
     conf.html_prefs = oarg;
@@ -525,6 +642,59 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("all-static-files", name))
     conf.all_static_files = 1;
 
+  /* approximate unique visitors */
+  if (!strcmp ("approx-visitors", name))
+    conf.approx_visitors = 1;
+
+  /* parse a synthetic log and report throughput */
+  if (!strcmp ("benchmark", name)) {
+    char *sEnd;
+    long lines = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || lines <= 0 || errno == ERANGE ||
+        lines > INT_MAX)
+      return;
+    conf.bench_lines = lines;
+    conf.process_and_exit = 1;
+  }
+
+  /* distinct agents of the synthetic log */
+  if (!strcmp ("benchmark-agents", name)) {
+    char *sEnd;
+    int num = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || num <= 0 || errno == ERANGE)
+      return;
+    conf.bench_agents = num;
+  }
+
+  /* distinct hosts of the synthetic log */
+  if (!strcmp ("benchmark-hosts", name)) {
+    char *sEnd;
+    int num = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || num <= 0 || errno == ERANGE)
+      return;
+    conf.bench_hosts = num;
+  }
+
+  /* time each primitive on its own */
+  if (!strcmp ("benchmark-micro", name)) {
+    char *sEnd;
+    long ops = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || ops <= 0 || errno == ERANGE ||
+        ops > INT_MAX)
+      return;
+    conf.bench_ops = ops;
+    conf.process_and_exit = 1;
+  }
+
+  /* distinct URLs of the synthetic log */
+  if (!strcmp ("benchmark-urls", name)) {
+    char *sEnd;
+    int num = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || num <= 0 || errno == ERANGE)
+      return;
+    conf.bench_urls = num;
+  }
+
   /* crawlers only */
   if (!strcmp ("crawlers-only", name))
     conf.crawlers_only = 1;
@@ -542,6 +712,15 @@ parse_long_opt (const char *name, const char *oarg)
     set_array_opt (oarg, conf.enable_panels, &conf.enable_panel_idx,
                    TOTAL_MODULES);
 
+  /* hashed unique visitor keys */
+  if (!strcmp ("hash-visitor-keys", name))
+    conf.hash_visitor_keys = 1;
+
+  /* keep only the heavy hitters of a panel */
+  if (!strcmp ("heavy-hitters", name))
+    set_array_opt (oarg, conf.hitter_panels, &conf.hitter_panel_idx,
+                   TOTAL_MODULES);
+
   /* hour specificity */
   if (!strcmp ("hour-spec", name) && !strcmp (oarg, "min"))
     conf.hour_spec_min = 1;
@@ -580,6 +759,15 @@ parse_long_opt (const char *name, const char *oarg)
       LOG_DEBUG (("Invalid statics ignore option."));
   }
 
+  /* number of parsing threads */
+  if (!strcmp ("jobs", name)) {
+    char *sEnd;
+    int jobs = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE)
+      return;
+    conf.jobs = jobs < 1 ? 1 : jobs > MAX_JOBS ? MAX_JOBS : jobs;
+  }
+
   /* number of line tests */
   if (!strcmp ("num-tests", name)) {
     char *sEnd;
@@ -589,14 +777,36 @@ parse_long_opt (const char *name, const char *oarg)
     conf.num_tests = tests >= 0 ? tests : 0;
   }
 
+  /* presize hash tables */
+  if (!strcmp ("presize-tables", name))
+    conf.presize_tables = 1;
+
   /* process and exit */
   if (!strcmp ("process-and-exit", name))
     conf.process_and_exit = 1;
 
+  /* time each processing stage */
+  if (!strcmp ("processing-stats", name))
+    conf.processing_stats = 1;
+
+  /* memory taken by each metric */
+  if (!strcmp ("memory-stats", name))
+    conf.memory_stats = 1;
+
   /* real os */
   if (!strcmp ("real-os", name))
     conf.real_os = 1;
 
+  /* number of reverse DNS threads */
+  if (!strcmp ("resolver-threads", name)) {
+    char *sEnd;
+    int threads = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE)
+      return;
+    conf.resolver_threads = threads < 1 ? 1 : threads > MAX_RESOLVER_THREADS ?
+      MAX_RESOLVER_THREADS : threads;
+  }
+
   /* sort view */
   if (!strcmp ("sort-panel", name))
     set_array_opt (oarg, conf.sort_panels, &conf.sort_panel_idx, TOTAL_MODULES);
@@ -615,6 +825,69 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("geoip-city-data", name) || !strcmp ("geoip-database", name))
     conf.geoip_database = oarg;
 
+  /* SNAPSHOT OPTIONS
+   * ========================= */
+  /* persist the in-memory storage into a snapshot when exiting */
+  if (!strcmp ("persist-snapshot", name))
+    conf.persist_snapshot = oarg;
+
+  /* merge the snapshot of another run into the in-memory storage */
+  if (!strcmp ("merge", name))
+    set_array_opt (oarg, conf.merge_snapshots, &conf.merge_snapshot_idx,
+                   MAX_FILENAMES);
+
+  /* restore the in-memory storage from a snapshot */
+  if (!strcmp ("restore-snapshot", name))
+    conf.restore_snapshot = oarg;
+
+  /* number of logs parsed at once, each into a shard of its own */
+  if (!strcmp ("shards", name)) {
+    char *sEnd;
+    int shards = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE)
+      return;
+    conf.shards = shards < 1 ? 1 : shards > MAX_JOBS ? MAX_JOBS : shards;
+  }
+
+  /* output a report per virtual host, out of the same parsing pass */
+  if (!strcmp ("split-by-vhost", name))
+    conf.split_vhost_dir = oarg;
+
+  /* bytes of the storage kept on the heap, tables past it spill */
+  if (!strcmp ("memory-limit", name)) {
+    char *sEnd;
+    unsigned long long limit = strtoull (oarg, &sEnd, 10);
+    int shift = 0;
+    if (oarg == sEnd || errno == ERANGE)
+      return;
+    if (*sEnd == 'K' || *sEnd == 'k')
+      shift = 10, sEnd++;
+    else if (*sEnd == 'M' || *sEnd == 'm')
+      shift = 20, sEnd++;
+    else if (*sEnd == 'G' || *sEnd == 'g')
+      shift = 30, sEnd++;
+    if (*sEnd != '\0' || limit > (UINT64_MAX >> shift))
+      return;
+    conf.memory_limit = (uint64_t) limit << shift;
+  }
+
+  /* keep only the data of the latest minutes/hours/days parsed */
+  if (!strcmp ("time-window", name)) {
+    char *sEnd;
+    long window = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || window <= 0 || errno == ERANGE)
+      return;
+    if (*sEnd == 'h')
+      window *= 60, sEnd++;
+    else if (*sEnd == 'd')
+      window *= 60 * 24, sEnd++;
+    else if (*sEnd == 'm')
+      sEnd++;
+    if (*sEnd != '\0' || window > INT_MAX)
+      return;
+    conf.time_window = window;
+  }
+
   /* BTREE OPTIONS
    * ========================= */
   /* keep database files */
@@ -629,6 +902,10 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("db-path", name))
     conf.db_path = oarg;
 
+  /* number of buffered updates written per transaction */
+  if (!strcmp ("db-flush-interval", name))
+    conf.db_flush_interval = atoi (oarg);
+
   /* specifies the maximum number of leaf nodes to be cached */
   if (!strcmp ("cache-lcnum", name))
     conf.cache_lcnum = atoi (oarg);
@@ -637,6 +914,10 @@ parse_long_opt (const char *name, const char *oarg)
   if (!strcmp ("cache-ncnum", name))
     conf.cache_ncnum = atoi (oarg);
 
+  /* tune each database out of a sample of the log */
+  if (!strcmp ("tune-auto", name))
+    conf.tune_auto = 1;
+
   /* number of elements of the bucket array */
   if (!strcmp ("tune-bnum", name))
     conf.tune_bnum = atoi (oarg);
@@ -775,7 +1056,7 @@ read_option_args (int argc, char **argv)
     case 'o':
       if (!valid_output_type (optarg)) {
         printf
-          ("[ERROR] Invalid filename extension used, must be any of .csv, .json, or .html\n");
+          ("[ERROR] Invalid filename extension used, must be any of .csv, .json, .arrow, or .html\n");
         exit (EXIT_FAILURE);
       }
       if (conf.output_format_idx < MAX_OUTFORMATS)
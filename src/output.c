@@ -37,6 +37,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include "output.h"
 
@@ -50,6 +60,7 @@
 #include "gwsocket.h"
 #include "json.h"
 #include "settings.h"
+#include "sha1.h"
 #include "ui.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -216,10 +227,78 @@ print_html_title (FILE * fp)
   fprintf (fp, "</title>");
 }
 
+/* Write the given parts as a single file into --html-assets-dir, named
+ * after a hash of its content, unless it's there already. The file is
+ * written to a temporary path first, so concurrent reports never link a
+ * partial one.
+ *
+ * On error, it aborts.
+ * On success, the URL of the file is returned. */
+static char *
+write_html_asset (const char *ext, const char *const *parts, int n)
+{
+  SHA1_CTX sha;
+  FILE *fp = NULL;
+  struct stat st;
+  unsigned char digest[20];
+  uint8_t buf[64];
+  size_t len, off, chunk;
+  char name[64], *path = NULL, *tmp = NULL, *url = NULL;
+  const char *dir = conf.html_assets_dir, *base = NULL;
+  int i, j, fd;
+
+  /* SHA1Update() scrambles the data it's given, so feed it copies */
+  SHA1Init (&sha);
+  for (i = 0; i < n; i++) {
+    for (len = strlen (parts[i]), off = 0; off < len; off += chunk) {
+      chunk = len - off < sizeof (buf) ? len - off : sizeof (buf);
+      memcpy (buf, parts[i] + off, chunk);
+      SHA1Update (&sha, buf, chunk);
+    }
+  }
+  SHA1Final (digest, &sha);
+
+  i = snprintf (name, sizeof (name), "goaccess-");
+  for (j = 0; j < 8; j++)
+    i += snprintf (name + i, sizeof (name) - i, "%02x", digest[j]);
+  snprintf (name + i, sizeof (name) - i, ".%s", ext);
+
+  if (mkdir (dir, 0755) != 0 && errno != EEXIST)
+    FATAL ("Unable to create assets dir %s: %s.", dir, strerror (errno));
+
+  path = xmalloc (snprintf (NULL, 0, "%s/%s", dir, name) + 1);
+  sprintf (path, "%s/%s", dir, name);
+
+  if (stat (path, &st) != 0) {
+    tmp = xmalloc (strlen (path) + 8);
+    sprintf (tmp, "%s.XXXXXX", path);
+    if ((fd = mkstemp (tmp)) == -1 || fchmod (fd, 0644) != 0 ||
+        (fp = fdopen (fd, "w")) == NULL)
+      FATAL ("Unable to write asset %s: %s.", path, strerror (errno));
+
+    for (i = 0; i < n; i++)
+      fputs (parts[i], fp);
+    if (fclose (fp) != 0 || rename (tmp, path) != 0)
+      FATAL ("Unable to write asset %s: %s.", path, strerror (errno));
+    free (tmp);
+  }
+  free (path);
+
+  base = conf.html_assets_url ? conf.html_assets_url : dir;
+  url = xmalloc (snprintf (NULL, 0, "%s/%s", base, name) + 1);
+  if (*base != '\0' && base[strlen (base) - 1] == '/')
+    sprintf (url, "%s%s", base, name);
+  else
+    sprintf (url, "%s/%s", base, name);
+
+  return url;
+}
+
 /* *INDENT-OFF* */
-/* Output all the document head elements. */
+/* Output all the document head elements. The stylesheets are either
+ * embedded or, if given, linked from the shared assets. */
 static void
-print_html_header (FILE * fp)
+print_html_header (FILE * fp, const char *css)
 {
   fprintf (fp,
   "<!DOCTYPE html>"
@@ -234,9 +313,13 @@ print_html_header (FILE * fp)
 
   print_html_title (fp);
 
-  fprintf (fp, "<style>%s</style>", fa_css);
-  fprintf (fp, "<style>%s</style>", bootstrap_css);
-  fprintf (fp, "<style>%s</style>", app_css);
+  if (css) {
+    fprintf (fp, "<link rel='stylesheet' href='%s'>", css);
+  } else {
+    fprintf (fp, "<style>%s</style>", fa_css);
+    fprintf (fp, "<style>%s</style>", bootstrap_css);
+    fprintf (fp, "<style>%s</style>", app_css);
+  }
   /* load custom CSS file, if any */
   if (conf.html_custom_css)
     fprintf (fp, "<link rel='stylesheet' href='%s'>", conf.html_custom_css);
@@ -292,14 +375,19 @@ print_html_body (FILE * fp, const char *now)
 }
 
 /* Output all the document footer elements such as script and closing
- * tags. */
+ * tags. The scripts are either embedded or, if given, linked from the
+ * shared assets. */
 static void
-print_html_footer (FILE * fp)
+print_html_footer (FILE * fp, const char *js)
 {
-  fprintf (fp, "<script>%s</script>", d3_js);
-  fprintf (fp, "<script>%s</script>", hogan_js);
-  fprintf (fp, "<script>%s</script>", app_js);
-  fprintf (fp, "<script>%s</script>", charts_js);
+  if (js) {
+    fprintf (fp, "<script src='%s'></script>", js);
+  } else {
+    fprintf (fp, "<script>%s</script>", d3_js);
+    fprintf (fp, "<script>%s</script>", hogan_js);
+    fprintf (fp, "<script>%s</script>", app_js);
+    fprintf (fp, "<script>%s</script>", charts_js);
+  }
 
   /* load custom JS file, if any */
   if (conf.html_custom_js)
@@ -470,20 +558,112 @@ hits_bw_req_plot (FILE * fp, GHTMLPlot plot, int sp)
   print_plot_def (fp, plot, def, ARRAY_SIZE (def), sp);
 }
 
-/* Output JSON data definitions. */
+/* Write the JSON data of a panel into the given file, compressed with
+ * gzip if requested.
+ *
+ * On error, it aborts.
+ * On success, the file is written. */
+static void
+write_panel_file (const char *path, const char *json)
+{
+  size_t len = strlen (json);
+  FILE *fp = NULL;
+#ifdef HAVE_LIBZ
+  gzFile gz;
+
+  if (conf.html_lazy_panels == LAZY_PANELS_GZIP) {
+    if ((gz = gzopen (path, "wb")) == NULL ||
+        gzwrite (gz, json, (unsigned) len) != (int) len ||
+        gzclose (gz) != Z_OK)
+      FATAL ("Unable to write panel data %s: %s.", path, strerror (errno));
+    return;
+  }
+#endif
+
+  if ((fp = fopen (path, "w")) == NULL || fwrite (json, 1, len, fp) != len ||
+      fclose (fp) != 0)
+    FATAL ("Unable to write panel data %s: %s.", path, strerror (errno));
+}
+
+/* Output the given string as a JSON string safe to be embedded into a
+ * script element. */
+static void
+print_json_str (FILE * fp, const char *s)
+{
+  fputc ('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\' || *s == '<' || *s == '>' || *s == '&' ||
+        (unsigned char) *s < 0x20)
+      fprintf (fp, "\\u%04x", (unsigned char) *s);
+    else
+      fputc (*s, fp);
+  }
+  fputc ('"', fp);
+}
+
+/* Write the data of each panel into its own file next to the report,
+ * e.g., report-visitors.json for report.html, and list the files within
+ * the report, which fetches them once loaded. */
+static void
+print_lazy_panels (FILE * fp, GLog * glog, GHolder * holder,
+                   const char *filename)
+{
+  const char *ext = ".json", *id = NULL, *dot = NULL, *base = NULL;
+  char *json = NULL, *path = NULL;
+  size_t idx = 0, len = 0;
+  uint32_t panel = 0;
+  int cnt = 0;
+
+#ifdef HAVE_LIBZ
+  if (conf.html_lazy_panels == LAZY_PANELS_GZIP)
+    ext = ".json.gz";
+#endif
+
+  /* the report's path without its extension */
+  base = (base = strrchr (filename, '/')) ? base + 1 : filename;
+  dot = strrchr (base, '.');
+  len = dot ? (size_t) (dot - filename) : strlen (filename);
+
+  fprintf (fp, "<script type='text/javascript'>");
+  fprintf (fp, "var json_panels={");
+  FOREACH_MODULE (idx, module_list) {
+    id = module_to_id (module_list[idx]);
+    panel = UINT32_C (1) << module_list[idx];
+    if ((json = get_json_panels (glog, holder, panel, 1)) == NULL)
+      continue;
+
+    path = xmalloc (len + strlen (id) + strlen (ext) + 2);
+    sprintf (path, "%.*s-%s%s", (int) len, filename, id, ext);
+    write_panel_file (path, json);
+
+    /* files are fetched relative to the report */
+    fprintf (fp, "%s\"%s\":", cnt++ ? "," : "", id);
+    print_json_str (fp, path + (base - filename));
+    free (path);
+    free (json);
+  }
+  fprintf (fp, "};</script>");
+}
+
+/* Output JSON data definitions. With --html-lazy-panels, only the
+ * overall data is embedded, panels are either fetched from their own
+ * files or, on real-time, sent over the WebSocket. */
 static void
-print_json_data (FILE * fp, GLog * glog, GHolder * holder)
+print_json_data (FILE * fp, GLog * glog, GHolder * holder,
+                 const char *filename)
 {
-  char *json = NULL;
+  int lazy = conf.html_lazy_panels && (conf.real_time_html || filename);
 
-  if ((json = get_json (glog, holder, 1)) == NULL)
+  if (holder == NULL)
     return;
 
   fprintf (fp, "<script type='text/javascript'>");
-  fprintf (fp, "var json_data=%s", json);
+  fprintf (fp, "var json_data=");
+  fpjson_panels (fp, glog, holder, lazy ? 0 : JSON_ALL_PANELS, 1);
   fprintf (fp, "</script>");
 
-  free (json);
+  if (lazy && !conf.real_time_html)
+    print_lazy_panels (fp, glog, holder, filename);
 }
 
 /* Output WebSocket connection definition. */
@@ -1209,7 +1389,9 @@ void
 output_html (GLog * glog, GHolder * holder, const char *filename)
 {
   FILE *fp;
-  char now[DATE_TIME];
+  char now[DATE_TIME], *css = NULL, *js = NULL;
+  const char *css_parts[] = { fa_css, bootstrap_css, app_css };
+  const char *js_parts[] = { d3_js, hogan_js, app_js, charts_js };
 
   if (filename != NULL)
     fp = fopen (filename, "w");
@@ -1227,14 +1409,22 @@ output_html (GLog * glog, GHolder * holder, const char *filename)
   generate_time ();
   strftime (now, DATE_TIME, "%Y-%m-%d %H:%M:%S %z", now_tm);
 
-  print_html_header (fp);
+  /* write the shared assets once, before linking them */
+  if (conf.html_assets_dir) {
+    css = write_html_asset ("css", css_parts, ARRAY_SIZE (css_parts));
+    js = write_html_asset ("js", js_parts, ARRAY_SIZE (js_parts));
+  }
+
+  print_html_header (fp, css);
 
   print_html_body (fp, now);
   print_json_defs (fp);
-  print_json_data (fp, glog, holder);
+  print_json_data (fp, glog, holder, filename);
   print_conn_def (fp);
 
-  print_html_footer (fp);
+  print_html_footer (fp, js);
 
   fclose (fp);
+  free (css);
+  free (js);
 }
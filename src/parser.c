@@ -40,12 +40,16 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 
 #if HAVE_CONFIG_H
 #include <config.h>
 #endif
 
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,6 +57,7 @@
 #include <strings.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #ifdef HAVE_LIBTOKYOCABINET
@@ -71,7 +76,9 @@
 #include "browsers.h"
 #include "goaccess.h"
 #include "error.h"
+#include "gstats.h"
 #include "opesys.h"
+#include "uacache.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -109,6 +116,35 @@ static void insert_method (int data_nkey, const char *method, GModule module);
 static void insert_protocol (int data_nkey, const char *proto, GModule module);
 static void insert_agent (int data_nkey, int agent_nkey, GModule module);
 
+/* compiled version of conf.log_format */
+static GLogFmtProg *logfmt_prog = NULL;
+static unsigned int logfmt_gen = 0;
+/* date/time cache used when parsing from the main thread */
+static GDateCache main_dcache;
+/* arena used for log items parsed from the main thread */
+static GArena *parse_arena = NULL;
+/* case folded static extensions, an open addressing set, see
+ * init_static_files() */
+static char *static_exts[STATIC_EXT_SLOTS];
+/* optional fields consumed by the enabled panels and filters */
+static unsigned int needed_fields = FIELD_ALL;
+/* datamap kernel of each module, see init_datamap_kernels() */
+static GDatamapKernel datamap_kernel[TOTAL_MODULES];
+/* distinct lengths of the static extensions */
+static size_t static_ext_lens[MAX_EXTENSIONS];
+static int static_ext_nlens = 0;
+#ifndef HAVE_LIBTOKYOCABINET
+/* segments of the time window, see --time-window */
+static GWindow window;
+/* lines are being added to a storage on the side, e.g., the segment
+ * being filled */
+static int side_pass = 0;
+/* virtual hosts parsed into reports of their own, see --split-by-vhost */
+static GVhostSplit *splits = NULL;
+static int splits_len = 0;
+static khash_t (si32) * split_keys = NULL;
+#endif
+
 /* *INDENT-OFF* */
 static GParse paneling[] = {
   {
@@ -322,9 +358,11 @@ new_modulekey (GKeyData * kdata)
     .data = NULL,
     .data_key = NULL,
     .data_nkey = 0,
+    .data_code = 0,
     .root = NULL,
     .root_key = NULL,
     .root_nkey = 0,
+    .root_code = 0,
     .uniq_key = NULL,
     .uniq_nkey = 0,
   };
@@ -378,7 +416,7 @@ free_raw_data_str_value (GRawData * raw_data)
   int i = 0;
   char *str = NULL;
 
-  for (i = 0; i < raw_data->size; ++i) {
+  for (i = 0; i < raw_data->idx; ++i) {
     str = raw_data->items[i].value.svalue;
     if (str)
       free (str);
@@ -420,140 +458,105 @@ init_log (void)
   return glog;
 }
 
-/* Initialize a new GLogItem instance.
+/* Allocate memory for a new GLogItem instance out of the given arena.
+ * All its strings are allocated from the same arena as well.
  *
  * On success, the new GLogItem instance is returned. */
-GLogItem *
-init_log_item (GLog * glog)
+static GLogItem *
+new_log_item (GArena * arena)
 {
-  GLogItem *logitem;
-  glog->items = xmalloc (sizeof (GLogItem));
-  logitem = glog->items;
-  memset (logitem, 0, sizeof *logitem);
-
-  logitem->agent = NULL;
-  logitem->browser = NULL;
-  logitem->browser_type = NULL;
-  logitem->continent = NULL;
-  logitem->country = NULL;
-  logitem->date = NULL;
-  logitem->errstr = NULL;
-  logitem->host = NULL;
-  logitem->keyphrase = NULL;
-  logitem->method = NULL;
-  logitem->os = NULL;
-  logitem->os_type = NULL;
-  logitem->protocol = NULL;
-  logitem->qstr = NULL;
-  logitem->ref = NULL;
-  logitem->req_key = NULL;
-  logitem->req = NULL;
-  logitem->resp_size = 0LL;
-  logitem->serve_time = 0;
-  logitem->status = NULL;
-  logitem->time = NULL;
-  logitem->uniq_key = NULL;
-  logitem->vhost = NULL;
-  logitem->userid = NULL;
-
-  memset (logitem->site, 0, sizeof (logitem->site));
+  GLogItem *logitem = arena_calloc (arena, sizeof (GLogItem));
+
+  logitem->arena = arena;
 
   return logitem;
 }
 
-/* Free all members of a GLogItem */
-static void
-free_glog (GLogItem * logitem)
-{
-  if (logitem->agent != NULL)
-    free (logitem->agent);
-  if (logitem->browser != NULL)
-    free (logitem->browser);
-  if (logitem->browser_type != NULL)
-    free (logitem->browser_type);
-  if (logitem->continent != NULL)
-    free (logitem->continent);
-  if (logitem->country != NULL)
-    free (logitem->country);
-  if (logitem->date != NULL)
-    free (logitem->date);
-  if (logitem->errstr != NULL)
-    free (logitem->errstr);
-  if (logitem->host != NULL)
-    free (logitem->host);
-  if (logitem->keyphrase != NULL)
-    free (logitem->keyphrase);
-  if (logitem->method != NULL)
-    free (logitem->method);
-  if (logitem->os != NULL)
-    free (logitem->os);
-  if (logitem->os_type != NULL)
-    free (logitem->os_type);
-  if (logitem->protocol != NULL)
-    free (logitem->protocol);
-  if (logitem->qstr != NULL)
-    free (logitem->qstr);
-  if (logitem->ref != NULL)
-    free (logitem->ref);
-  if (logitem->req_key != NULL)
-    free (logitem->req_key);
-  if (logitem->req != NULL)
-    free (logitem->req);
-  if (logitem->status != NULL)
-    free (logitem->status);
-  if (logitem->time != NULL)
-    free (logitem->time);
-  if (logitem->uniq_key != NULL)
-    free (logitem->uniq_key);
-  if (logitem->userid != NULL)
-    free (logitem->userid);
-  if (logitem->vhost != NULL)
-    free (logitem->vhost);
-
-  free (logitem);
-}
-
-/* Decodes the given URL-encoded string.
- *
- * On success, the decoded string is assigned to the output buffer. */
+/* Get the arena used for log items parsed from the main thread.
+ *
+ * On success, the arena is returned. */
+static GArena *
+get_parse_arena (void)
+{
+  if (parse_arena == NULL)
+    parse_arena = new_arena ();
+  return parse_arena;
+}
+
+/* Free the arena used for log items parsed from the main thread. */
+void
+free_parse_arena (void)
+{
+  free_arena (parse_arena);
+  parse_arena = NULL;
+}
+
+/* Initialize a new GLogItem instance and set it as the current item
+ * of the given log.
+ *
+ * On success, the new GLogItem instance is returned. */
+GLogItem *
+init_log_item (GLog * glog)
+{
+  glog->items = new_log_item (get_parse_arena ());
+  return glog->items;
+}
+
+/* Decodes the given URL-encoded string in place. New lines are
+ * dropped from the output if strip is set.
+ *
+ * On success, the given string is decoded. */
 #define B16210(x) (((x) >= '0' && (x) <= '9') ? ((x) - '0') : (toupper((x)) - 'A' + 10))
 static void
-decode_hex (char *url, char *out)
+decode_hex (char *url, int strip)
 {
   char *ptr;
   const char *c;
 
-  for (c = url, ptr = out; *c; c++) {
-    if (*c != '%' || !isxdigit (c[1]) || !isxdigit (c[2])) {
-      *ptr++ = *c;
+  /* the output never outgrows the input, thus it can be written over */
+  for (c = url, ptr = url; *c; c++) {
+    if (*c != '%' || !isxdigit ((unsigned char) c[1]) ||
+        !isxdigit ((unsigned char) c[2])) {
+      *ptr = *c;
     } else {
-      *ptr++ = (B16210 (c[1]) * 16) + (B16210 (c[2]));
+      *ptr = (B16210 (c[1]) * 16) + (B16210 (c[2]));
       c += 2;
     }
+    if (!strip || (*ptr != '\r' && *ptr != '\n'))
+      ptr++;
   }
   *ptr = 0;
 }
 
-/* Entry point to decode the given URL-encoded string.
+/* Entry point to decode the given URL-encoded string. The string is
+ * decoded in place, and left untouched if there's nothing to decode,
+ * strip or trim.
  *
- * On success, the decoded trimmed string is assigned to the output
- * buffer. */
+ * On success, the decoded trimmed string is returned. */
 static char *
 decode_url (char *url)
 {
-  char *out, *decoded;
+  char *out = url, *end = NULL;
 
   if ((url == NULL) || (*url == '\0'))
     return NULL;
 
-  out = decoded = xstrdup (url);
-  decode_hex (url, out);
-  /* double encoded URL? */
-  if (conf.double_decode)
-    decode_hex (decoded, out);
-  strip_newlines (out);
+  /* most URLs have nothing to decode */
+  if (strpbrk (url, "%\r\n") != NULL) {
+    /* double encoded URL? */
+    if (conf.double_decode)
+      decode_hex (url, 0);
+    decode_hex (url, 1);
+  }
+
+  while (isspace ((unsigned char) *out))
+    out++;
+  end = out + strlen (out);
+  while (end != out && isspace ((unsigned char) end[-1]))
+    end--;
+  *end = '\0';
 
-  return trim_str (out);
+  return out;
 }
 
 /* Process keyphrases from Google search, cache, and translate.
@@ -563,7 +566,7 @@ decode_url (char *url)
  * On error, 1 is returned.
  * On success, the extracted keyphrase is assigned and 0 is returned. */
 static int
-extract_keyphrase (char *ref, char **keyphrase)
+extract_keyphrase (GArena * arena, char *ref, char **keyphrase)
 {
   char *r, *ptr, *pch, *referer;
   int encoded = 0;
@@ -603,7 +606,11 @@ extract_keyphrase (char *ref, char **keyphrase)
   else if (encoded && (ptr = strstr (r, "%26")) != NULL)
     *ptr = '\0';
 
-  referer = decode_url (r);
+  /* only the referrer was needed, cut past the keyphrase */
+  if (!(needed_fields & FIELD_KEYPHRASE))
+    return 1;
+
+  referer = decode_url (arena_strdup (arena, r));
   if (referer == NULL || *referer == '\0')
     return 1;
 
@@ -622,13 +629,15 @@ extract_keyphrase (char *ref, char **keyphrase)
 static int
 extract_geolocation (GLogItem * logitem, char *continent, char *country)
 {
-  if (!is_geoip_resource ())
-    return 1;
+  char city[CITY_LEN] = "";
+  uint64_t ts = stats_begin ();
+  int ret = 0;
 
-  geoip_get_country (logitem->host, country, logitem->type_ip);
-  geoip_get_continent (logitem->host, continent, logitem->type_ip);
+  /* lookups are cached per IP, see geocache.c */
+  ret = set_geolocation (logitem->host, continent, country, city);
+  stats_end (STATS_GEO, ts);
 
-  return 0;
+  return ret;
 }
 #endif
 
@@ -641,68 +650,163 @@ extract_geolocation (GLogItem * logitem, char *continent, char *country)
 static int
 extract_referer_site (const char *referer, char *host)
 {
-  char *url, *begin, *end;
+  const char *begin, *end;
   int len = 0;
 
   if ((referer == NULL) || (*referer == '\0'))
     return 1;
 
-  url = strdup (referer);
-  if ((begin = strstr (url, "//")) == NULL)
-    goto clean;
+  if ((begin = strstr (referer, "//")) == NULL)
+    return 1;
 
   begin += 2;
   if ((len = strlen (begin)) == 0)
-    goto clean;
+    return 1;
 
   if ((end = strchr (begin, '/')) != NULL)
     len = end - begin;
 
   if (len == 0)
-    goto clean;
+    return 1;
 
   if (len >= REF_SITE_LEN)
     len = REF_SITE_LEN;
 
   memcpy (host, begin, len);
   host[len] = '\0';
-  free (url);
+
   return 0;
-clean:
-  free (url);
+}
 
-  return 1;
+/* Determine the optional fields that need to be extracted out of each
+ * log line given the enabled panels and filters. This needs to be
+ * called once the list of modules is set. */
+void
+init_needed_fields (void)
+{
+  needed_fields = 0;
+
+  if (get_module_index (KEYPHRASES) != -1)
+    needed_fields |= FIELD_KEYPHRASE;
+  if (get_module_index (REFERRERS) != -1)
+    needed_fields |= FIELD_REFERRER;
+  /* the site is also matched against the referrers to ignore or hide */
+  if (get_module_index (REFERRING_SITES) != -1 || conf.ignore_referer_idx ||
+      (get_module_index (REFERRERS) != -1 && conf.hide_referer_idx))
+    needed_fields |= FIELD_REF_SITE;
 }
 
-/* Determine if the given request is static (e.g., jpg, css, js, etc).
+/* Hash the first len bytes of the given extension, case folded.
  *
- * On error, or if not static, 0 is returned.
- * On success, the 1 is returned. */
-static int
-verify_static_content (const char *req)
+ * On success, the hash value is returned. */
+static uint32_t
+hash_static_ext (const char *ext, size_t len)
 {
-  const char *nul = req + strlen (req);
-  const char *ext = NULL, *pch = NULL;
-  int elen = 0, i;
+  uint32_t h = 2166136261u;
+  size_t i;
 
-  if (strlen (req) < conf.static_file_max_len)
-    return 0;
+  for (i = 0; i < len; ++i) {
+    h ^= (unsigned char) tolower ((unsigned char) ext[i]);
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+/* Find the slot of the first len bytes of the given extension within
+ * the static extensions set.
+ *
+ * If the extension is not in the set, the first empty slot is returned.
+ * If the extension is in the set, its slot is returned. */
+static uint32_t
+find_static_ext (const char *ext, size_t len)
+{
+  uint32_t i = hash_static_ext (ext, len) & (STATIC_EXT_SLOTS - 1);
+  const char *slot = NULL;
+
+  while ((slot = static_exts[i]) != NULL) {
+    if (!strncasecmp (slot, ext, len) && slot[len] == '\0')
+      break;
+    i = (i + 1) & (STATIC_EXT_SLOTS - 1);
+  }
+
+  return i;
+}
+
+/* Build the case folded set of static extensions out of
+ * conf.static_files, so the cost of classifying a request depends on
+ * the number of distinct extension lengths instead of the number of
+ * extensions. */
+void
+init_static_files (void)
+{
+  const char *ext = NULL;
+  char *p = NULL;
+  size_t elen = 0;
+  uint32_t slot = 0;
+  int i, j;
 
+  free_static_files ();
   for (i = 0; i < conf.static_file_idx; ++i) {
     ext = conf.static_files[i];
     if (ext == NULL || *ext == '\0')
       continue;
 
     elen = strlen (ext);
-    if (conf.all_static_files && (pch = strchr (req, '?')) != NULL &&
-        pch - req > elen) {
-      pch -= elen;
-      if (0 == strncasecmp (ext, pch, elen))
-        return 1;
+    slot = find_static_ext (ext, elen);
+    if (static_exts[slot] != NULL)
       continue;
-    }
 
-    if (!strncasecmp (nul - elen, ext, elen))
+    static_exts[slot] = xstrdup (ext);
+    for (p = static_exts[slot]; *p; ++p)
+      *p = tolower ((unsigned char) *p);
+
+    for (j = 0; j < static_ext_nlens && static_ext_lens[j] != elen; ++j);
+    if (j == static_ext_nlens)
+      static_ext_lens[static_ext_nlens++] = elen;
+  }
+}
+
+/* Free the set of static extensions. */
+void
+free_static_files (void)
+{
+  int i;
+
+  for (i = 0; i < STATIC_EXT_SLOTS; ++i) {
+    free (static_exts[i]);
+    static_exts[i] = NULL;
+  }
+  static_ext_nlens = 0;
+}
+
+/* Determine if the given request is static (e.g., jpg, css, js, etc).
+ *
+ * On error, or if not static, 0 is returned.
+ * On success, the 1 is returned. */
+static int
+verify_static_content (const char *req)
+{
+  size_t len = strlen (req), elen = 0;
+  const char *pch = NULL, *ext = NULL;
+  int i;
+
+  if (len < conf.static_file_max_len)
+    return 0;
+
+  if (conf.all_static_files)
+    pch = strchr (req, '?');
+
+  /* one lookup per distinct extension length, the extension is either
+   * right before the query string or at the end of the request */
+  for (i = 0; i < static_ext_nlens; ++i) {
+    elen = static_ext_lens[i];
+    if (pch != NULL && pch - req > (ptrdiff_t) elen)
+      ext = pch - elen;
+    else
+      ext = req + len - elen;
+
+    if (static_exts[find_static_ext (ext, elen)] != NULL)
       return 1;
   }
 
@@ -735,34 +839,35 @@ extract_method (const char *token)
   const int methods_count = sizeof (methods) / sizeof (*methods);
 
   int i;
-  /* Length of every string in list */
-  static int list_length[sizeof (methods) / sizeof (*methods)] = { -1 };
-  /* Only calculate length on first time */
-  if (list_length[0] == -1) {
-    for (i = 0; i < methods_count; i++) {
-      list_length[i] = strlen (methods[i]);
-    }
-  }
 
+  /* note: this may be called from multiple parsing threads, so the
+   * lengths are not cached into a static array */
   for (i = 0; i < methods_count; i++) {
-    if (strncmp (token, methods[i], list_length[i]) == 0) {
+    if (strncmp (token, methods[i], strlen (methods[i])) == 0) {
       return methods[i];
     }
   }
   return NULL;
 }
 
-/* Determine if time-served data was stored on-disk. */
+/* Determine if time-served data was stored on-disk.
+ * Note: this may be called from multiple parsing threads. */
 static void
 contains_usecs (void)
 {
+  static pthread_mutex_t usecs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
   if (conf.serve_usecs)
     return;
 
+  pthread_mutex_lock (&usecs_mutex);
+  if (!conf.serve_usecs) {
 #ifdef TCB_BTREE
-  ht_insert_genstats ("serve_usecs", 1);
+    ht_insert_genstats ("serve_usecs", 1);
 #endif
-  conf.serve_usecs = 1; /* flag */
+    conf.serve_usecs = 1;       /* flag */
+  }
+  pthread_mutex_unlock (&usecs_mutex);
 }
 
 /* Determine if the given token is a valid HTTP protocol.
@@ -787,7 +892,7 @@ extract_protocol (const char *token)
  * On success, the HTTP request is returned and the method and
  * protocol are assigned to the corresponding buffers. */
 static char *
-parse_req (char *line, char **method, char **protocol)
+parse_req (GArena * arena, char *line, char **method, char **protocol)
 {
   char *req = NULL, *request = NULL, *dreq = NULL, *ptr = NULL;
   const char *meth, *proto;
@@ -797,37 +902,33 @@ parse_req (char *line, char **method, char **protocol)
 
   /* couldn't find a method, so use the whole request line */
   if (meth == NULL) {
-    request = xstrdup (line);
+    request = arena_strdup (arena, line);
   }
   /* method found, attempt to parse request */
   else {
     req = line + strlen (meth);
     if (!(ptr = strrchr (req, ' ')) || !(proto = extract_protocol (++ptr)))
-      return alloc_string ("-");
+      return arena_strdup (arena, "-");
 
     req++;
     if ((rlen = ptr - req) <= 0)
-      return alloc_string ("-");
+      return arena_strdup (arena, "-");
 
-    request = xmalloc (rlen + 1);
-    strncpy (request, req, rlen);
-    request[rlen] = 0;
+    request = arena_strndup (arena, req, rlen);
 
+    /* the ones found are constants, only lowercase ones are copied */
     if (conf.append_method)
-      (*method) = strtoupper (xstrdup (meth));
+      (*method) = islower ((unsigned char) *meth) ?
+        strtoupper (arena_strdup (arena, meth)) : (char *) meth;
 
     if (conf.append_protocol)
-      (*protocol) = strtoupper (xstrdup (proto));
+      (*protocol) = (char *) proto;
   }
 
-  if (!(dreq = decode_url (request)))
-    return request;
-  else if (*dreq == '\0') {
-    free (dreq);
-    return request;
-  }
+  /* decoded in place, fall back to the request as found in the line */
+  if (!(dreq = decode_url (request)) || *dreq == '\0')
+    return meth ? arena_strndup (arena, req, rlen) : line;
 
-  free (request);
   return dreq;
 }
 
@@ -856,52 +957,52 @@ get_delim (char *dest, const char *p)
   return 0;
 }
 
-/* Extract and malloc a token given the parsed rule.
+/* Extract a token given the parsed rule.
  *
- * On success, the malloc'd token is returned. */
+ * On success, the token (allocated from the given arena) is returned. */
 static char *
-parsed_string (const char *pch, char **str, int move_ptr)
+parsed_string (GArena * arena, const char *pch, char **str, int move_ptr)
 {
   char *p;
-  size_t len = (pch - *str + 1);
+  size_t len = (pch - *str);
 
-  p = xmalloc (len);
-  memcpy (p, *str, (len - 1));
-  p[len - 1] = '\0';
+  p = arena_strndup (arena, *str, len);
   if (move_ptr)
-    *str += len - 1;
+    *str += len;
 
   return trim_str (p);
 }
 
-/* Find and extract a token given a log format rule.
+/* Find and extract a token given a log format rule. The chars in
+ * between delimiters and escapes are skipped through strcspn(3), which
+ * the C library scans a vector at a time on most platforms.
  *
  * On error, or unable to parse it, NULL is returned.
  * On success, the malloc'd token is returned. */
 static char *
-parse_string (char **str, const char *delims, int cnt)
+parse_string (GArena * arena, char **str, const char *delims, int cnt)
 {
   int idx = 0;
   char *pch = *str, *p = NULL;
-  char end;
+  char stop[3] = "\\";
 
   if ((*delims != 0x0) && (p = strpbrk (*str, delims)) == NULL)
     return NULL;
 
-  end = !*delims ? 0x0 : *p;
-  do {
-    /* match number of delims */
-    if (*pch == end)
-      idx++;
+  /* the delim found first, along with escapes */
+  stop[1] = !*delims ? 0x0 : *p;
+  while (1) {
+    pch += strcspn (pch, stop);
+    if (*pch == '\0')
+      return parsed_string (arena, pch, str, 1);
     /* delim found, parse string then */
-    if ((*pch == end && cnt == idx) || *pch == '\0')
-      return parsed_string (pch, str, 1);
+    if (*pch == stop[1] && cnt == ++idx)
+      return parsed_string (arena, pch, str, 1);
     /* advance to the first unescaped delim */
-    if (*pch == '\\')
-      pch++;
-  } while (*pch++);
-
-  return NULL;
+    if (*pch == '\\' && *++pch == '\0')
+      return NULL;
+    pch++;
+  }
 }
 
 /* Move forward through the log string until a non-space (!isspace)
@@ -925,14 +1026,14 @@ find_alpha (char **str)
  * On success, a malloc'd format is returned. */
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
 static int
-set_date (char **fdate, struct tm tm)
+set_date (GArena * arena, char **fdate, struct tm tm)
 {
   char buf[DATE_LEN] = "";      /* Ymd */
 
   memset (buf, 0, sizeof (buf));
   if (strftime (buf, DATE_LEN, conf.date_num_format, &tm) <= 0)
     return 1;
-  *fdate = xstrdup (buf);
+  *fdate = arena_strdup (arena, buf);
 
   return 0;
 }
@@ -942,14 +1043,14 @@ set_date (char **fdate, struct tm tm)
  * On error, or unable to format the given tm, 1 is returned.
  * On success, a malloc'd format is returned. */
 static int
-set_time (char **ftime, struct tm tm)
+set_time (GArena * arena, char **ftime, struct tm tm)
 {
   char buf[TIME_LEN] = "";
 
   memset (buf, 0, sizeof (buf));
   if (strftime (buf, TIME_LEN, "%H:%M:%S", &tm) <= 0)
     return 1;
-  *ftime = xstrdup (buf);
+  *ftime = arena_strdup (arena, buf);
 
   return 0;
 }
@@ -957,8 +1058,8 @@ set_time (char **ftime, struct tm tm)
 /* Determine the parsing specifier error and construct a message out
  * of it.
  *
- * On success, a malloc'd error message is assigned to the log
- * structure and 1 is returned. */
+ * On success, the error message is assigned to the log structure and 1
+ * is returned. */
 static int
 spec_err (GLogItem * logitem, int code, const char spec, const char *tkn)
 {
@@ -968,22 +1069,24 @@ spec_err (GLogItem * logitem, int code, const char spec, const char *tkn)
   switch (code) {
   case SPEC_TOKN_INV:
     fmt = "Token '%s' doesn't match specifier '%%%c'";
-    err = xmalloc (snprintf (NULL, 0, fmt, (tkn ? tkn : "-"), spec) + 1);
+    err = arena_alloc (logitem->arena,
+                       snprintf (NULL, 0, fmt, (tkn ? tkn : "-"), spec) + 1);
     sprintf (err, fmt, (tkn ? tkn : "-"), spec);
     break;
   case SPEC_TOKN_SET:
     fmt = "Token already set for '%%%c' specifier.";
-    err = xmalloc (snprintf (NULL, 0, fmt, spec) + 1);
+    err = arena_alloc (logitem->arena, snprintf (NULL, 0, fmt, spec) + 1);
     sprintf (err, fmt, spec);
     break;
   case SPEC_TOKN_NUL:
     fmt = "Token for '%%%c' specifier is NULL.";
-    err = xmalloc (snprintf (NULL, 0, fmt, spec) + 1);
+    err = arena_alloc (logitem->arena, snprintf (NULL, 0, fmt, spec) + 1);
     sprintf (err, fmt, spec);
     break;
   case SPEC_SFMT_MIS:
     fmt = "Missing braces '%s' and ignore chars for specifier '%%%c'";
-    err = xmalloc (snprintf (NULL, 0, fmt, (tkn ? tkn : "-"), spec) + 1);
+    err = arena_alloc (logitem->arena,
+                       snprintf (NULL, 0, fmt, (tkn ? tkn : "-"), spec) + 1);
     sprintf (err, fmt, (tkn ? tkn : "-"), spec);
     break;
   }
@@ -994,18 +1097,64 @@ spec_err (GLogItem * logitem, int code, const char spec, const char *tkn)
 
 #pragma GCC diagnostic warning "-Wformat-nonliteral"
 
+/* Determine if the given token matches the last decoded one.
+ *
+ * If it matches, 1 is returned, else 0 is returned. */
+static int
+hit_date_cache (const GDateCacheItem * item, const char *tkn)
+{
+  return *tkn != '\0' && strcmp (item->tkn, tkn) == 0;
+}
+
+/* Store the given decoded token so following lines can reuse its
+ * values. Tokens that don't fit within the cache are not cached. */
+static void
+set_date_cache (GDateCacheItem * item, const char *tkn, const char *date,
+                const char *time)
+{
+  item->tkn[0] = '\0';
+  if (strlen (tkn) >= sizeof (item->tkn))
+    return;
+
+  strcpy (item->tkn, tkn);
+  snprintf (item->date, sizeof (item->date), "%s", date ? date : "");
+  snprintf (item->time, sizeof (item->time), "%s", time ? time : "");
+}
+
+/* Get the cache key of the given timestamp. Microseconds are dropped so
+ * that requests within the same second share the same key.
+ *
+ * On success, the key is stored into the given buffer. */
+static void
+get_ts_cache_key (char *key, const char *tkn, const char *tfmt)
+{
+  size_t len = strlen (tkn);
+
+  key[0] = '\0';
+  if (len >= DATE_TKN_LEN)
+    return;
+
+  strcpy (key, tkn);
+  if (!strcmp ("%f", tfmt) && len > 6 && strspn (tkn, "0123456789") == len)
+    key[len - 6] = '\0';
+}
+
 /* Parse the log string given log format rule.
  *
  * On error, or unable to parse it, 1 is returned.
- * On success, the malloc'd token is assigned to a GLogItem member. */
+ * On success, the token is assigned to a GLogItem member. */
 static int
-parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
+parse_specifier (GLogItem * logitem, char **str, const GLogFmtOp * op,
+                 GDateCache * dcache)
 {
   struct tm tm;
   const char *dfmt = conf.date_format;
   const char *tfmt = conf.time_format;
+  const char *p = &op->spec, *end = op->end;
+  GArena *arena = logitem->arena;
 
   char *pch, *sEnd, *bEnd, *tkn = NULL;
+  char key[DATE_TKN_LEN] = "";
   double serve_secs = 0.0;
   uint64_t bandw = 0, serve_time = 0;
   long status = 0L;
@@ -1020,49 +1169,61 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
     /* parse date format including dates containing spaces,
      * i.e., syslog date format (Jul 15 20:10:56) */
-    if (!(tkn = parse_string (&(*str), end, count_matches (dfmt, ' ') + 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, op->cnt)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (str_to_time (tkn, dfmt, &tm) != 0 || set_date (&logitem->date, tm) != 0) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
+    /* same date as the previous line */
+    if (hit_date_cache (&dcache->date, tkn)) {
+      logitem->date = arena_strdup (arena, dcache->date.date);
+      break;
     }
-    free (tkn);
+    if (str_to_time (tkn, dfmt, &tm) != 0 ||
+        set_date (arena, &logitem->date, tm) != 0)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
+    set_date_cache (&dcache->date, tkn, logitem->date, NULL);
     break;
     /* time */
   case 't':
     if (logitem->time)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (str_to_time (tkn, tfmt, &tm) != 0 || set_time (&logitem->time, tm) != 0) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
+    /* same second as the previous line */
+    if (hit_date_cache (&dcache->time, tkn)) {
+      logitem->time = arena_strdup (arena, dcache->time.time);
+      break;
     }
-    free (tkn);
+    if (str_to_time (tkn, tfmt, &tm) != 0 ||
+        set_time (arena, &logitem->time, tm) != 0)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
+    set_date_cache (&dcache->time, tkn, NULL, logitem->time);
     break;
     /* date/time as decimal, i.e., timestamps, ms/us  */
   case 'x':
     if (logitem->time && logitem->date)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (str_to_time (tkn, tfmt, &tm) != 0 || set_date (&logitem->date, tm) != 0
-        || set_time (&logitem->time, tm) != 0) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
+    /* same second as the previous line */
+    get_ts_cache_key (key, tkn, tfmt);
+    if (hit_date_cache (&dcache->ts, key)) {
+      logitem->date = arena_strdup (arena, dcache->ts.date);
+      logitem->time = arena_strdup (arena, dcache->ts.time);
+      break;
     }
+    if (str_to_time (tkn, tfmt, &tm) != 0 ||
+        set_date (arena, &logitem->date, tm) != 0 ||
+        set_time (arena, &logitem->time, tm) != 0)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
+    set_date_cache (&dcache->ts, key, logitem->date, logitem->time);
     break;
     /* Virtual Host */
   case 'v':
     if (logitem->vhost)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    tkn = parse_string (&(*str), end, 1);
+    tkn = parse_string (arena, &(*str), end, 1);
     if (tkn == NULL)
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
     logitem->vhost = tkn;
@@ -1071,7 +1232,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
   case 'e':
     if (logitem->userid)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    tkn = parse_string (&(*str), end, 1);
+    tkn = parse_string (arena, &(*str), end, 1);
     if (tkn == NULL)
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
     logitem->userid = tkn;
@@ -1080,105 +1241,86 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
   case 'h':
     if (logitem->host)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (invalid_ipaddr (tkn, &logitem->type_ip)) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
+    if (invalid_ipaddr (tkn, &logitem->type_ip))
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     logitem->host = tkn;
     break;
     /* request method */
   case 'm':
     if (logitem->method)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (!extract_method (tkn)) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
+    if (!extract_method (tkn))
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     logitem->method = tkn;
     break;
     /* request not including method or protocol */
   case 'U':
     if (logitem->req)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    tkn = parse_string (&(*str), end, 1);
+    tkn = parse_string (arena, &(*str), end, 1);
     if (tkn == NULL || *tkn == '\0')
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if ((logitem->req = decode_url (tkn)) == NULL) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
-    free (tkn);
+    if ((logitem->req = decode_url (tkn)) == NULL)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     break;
     /* query string alone, e.g., ?param=goaccess&tbm=shop */
   case 'q':
     if (logitem->qstr)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    tkn = parse_string (&(*str), end, 1);
+    tkn = parse_string (arena, &(*str), end, 1);
     if (tkn == NULL || *tkn == '\0')
       return 0;
 
-    if ((logitem->qstr = decode_url (tkn)) == NULL) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
-    free (tkn);
+    if ((logitem->qstr = decode_url (tkn)) == NULL)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     break;
     /* request protocol */
   case 'H':
     if (logitem->protocol)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if (!extract_protocol (tkn)) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
+    if (!extract_protocol (tkn))
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     logitem->protocol = tkn;
     break;
     /* request, including method + protocol */
   case 'r':
     if (logitem->req)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    logitem->req = parse_req (tkn, &logitem->method, &logitem->protocol);
-    free (tkn);
+    logitem->req =
+      parse_req (arena, tkn, &logitem->method, &logitem->protocol);
     break;
     /* Status Code */
   case 's':
     if (logitem->status)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
     status = strtol (tkn, &sEnd, 10);
     if (tkn == sEnd || *sEnd != '\0' || errno == ERANGE || status < 100 ||
-        status > 599) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
+        status > 599)
+      return spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
     logitem->status = tkn;
+    logitem->status_code = status;
     break;
     /* size of response in bytes - excluding HTTP headers */
   case 'b':
     if (logitem->resp_size)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
     bandw = strtoull (tkn, &bEnd, 10);
@@ -1186,28 +1328,26 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
       bandw = 0;
     logitem->resp_size = bandw;
     conf.bandwidth = 1;
-    free (tkn);
     break;
     /* referrer */
   case 'R':
     if (logitem->ref)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
 
-    if (!(tkn = parse_string (&(*str), end, 1)))
-      tkn = alloc_string ("-");
-    if (*tkn == '\0') {
-      free (tkn);
-      tkn = alloc_string ("-");
-    }
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
+      tkn = arena_strdup (arena, "-");
+    if (*tkn == '\0')
+      tkn = arena_strdup (arena, "-");
     if (strcmp (tkn, "-") != 0) {
-      extract_keyphrase (tkn, &logitem->keyphrase);
-      extract_referer_site (tkn, logitem->site);
+      if (needed_fields & (FIELD_KEYPHRASE | FIELD_REFERRER))
+        extract_keyphrase (arena, tkn, &logitem->keyphrase);
+      if (needed_fields & FIELD_REF_SITE)
+        extract_referer_site (tkn, logitem->site);
 
       /* hide referrers from report */
-      if (hide_referer (logitem->site)) {
+      if (hide_referer (logitem->site))
         logitem->site[0] = '\0';
-        free (tkn);
-      } else
+      else
         logitem->ref = tkn;
       break;
     }
@@ -1219,29 +1359,22 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     if (logitem->agent)
       return spec_err (logitem, SPEC_TOKN_SET, *p, NULL);
 
-    tkn = parse_string (&(*str), end, 1);
+    tkn = parse_string (arena, &(*str), end, 1);
     if (tkn != NULL && *tkn != '\0') {
       /* Make sure the user agent is decoded (i.e.: CloudFront)
        * and replace all '+' with ' ' (i.e.: w3c) */
       logitem->agent = decode_url (tkn);
-      free (tkn);
       break;
-    } else if (tkn != NULL && *tkn == '\0') {
-      free (tkn);
-      tkn = alloc_string ("-");
-    }
-    /* must be null */
-    else {
-      tkn = alloc_string ("-");
     }
-    logitem->agent = tkn;
+    /* must be null or empty */
+    logitem->agent = arena_strdup (arena, "-");
     break;
     /* time taken to serve the request, in milliseconds as a decimal number */
   case 'L':
     /* ignore it if we already have served time */
     if (logitem->serve_time)
       return 0;
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
     serve_secs = strtoull (tkn, &bEnd, 10);
@@ -1251,7 +1384,6 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     logitem->serve_time = (serve_secs > 0) ? serve_secs * MILS : 0;
 
     contains_usecs ();  /* set flag */
-    free (tkn);
     break;
     /* time taken to serve the request, in seconds with a milliseconds
      * resolution */
@@ -1259,7 +1391,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     /* ignore it if we already have served time */
     if (logitem->serve_time)
       return 0;
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
     if (strchr (tkn, '.') != NULL)
@@ -1273,14 +1405,13 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     logitem->serve_time = (serve_secs > 0) ? serve_secs * SECS : 0;
 
     contains_usecs ();  /* set flag */
-    free (tkn);
     break;
     /* time taken to serve the request, in microseconds */
   case 'D':
     /* ignore it if we already have served time */
     if (logitem->serve_time)
       return 0;
-    if (!(tkn = parse_string (&(*str), end, 1)))
+    if (!(tkn = parse_string (arena, &(*str), end, 1)))
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
     serve_time = strtoull (tkn, &bEnd, 10);
@@ -1289,7 +1420,6 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     logitem->serve_time = serve_time;
 
     contains_usecs ();  /* set flag */
-    free (tkn);
     break;
     /* move forward through str until not a space */
   case '~':
@@ -1297,7 +1427,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     break;
     /* everything else skip it */
   default:
-    if ((pch = strchr (*str, p[1])) != NULL)
+    if ((pch = strchr (*str, end[0])) != NULL)
       *str += pch - *str;
   }
 
@@ -1350,13 +1480,13 @@ extract_braces (char **p)
  * On success, the malloc'd token is assigned to a GLogItem->host and
  * 0 is returned. */
 static int
-find_xff_host (GLogItem * logitem, char **str, char **p)
+find_xff_host (GLogItem * logitem, char **str, const char *skips)
 {
-  char *ptr = NULL, *tkn = NULL, *skips = NULL;
+  char *ptr = NULL, *tkn = NULL;
   int invalid_ip = 1, len = 0, type_ip = TYPE_IPINV;
 
-  if (!(skips = extract_braces (p)))
-    return spec_err (logitem, SPEC_SFMT_MIS, **p, "{}");
+  if (!skips)
+    return spec_err (logitem, SPEC_SFMT_MIS, 'h', "{}");
 
   ptr = *str;
   while (*ptr != '\0') {
@@ -1367,27 +1497,22 @@ find_xff_host (GLogItem * logitem, char **str, char **p)
 
     ptr += len;
     /* extract possible IP */
-    if (!(tkn = parsed_string (ptr, str, 0)))
+    if (!(tkn = parsed_string (logitem->arena, ptr, str, 0)))
       break;
 
     invalid_ip = invalid_ipaddr (tkn, &type_ip);
     /* done, already have IP and current token is not a host */
-    if (logitem->host && invalid_ip) {
-      free (tkn);
+    if (logitem->host && invalid_ip)
       break;
-    }
     if (!logitem->host && !invalid_ip) {
-      logitem->host = xstrdup (tkn);
+      logitem->host = tkn;
       logitem->type_ip = type_ip;
     }
-    free (tkn);
 
   move:
     *str += len;
   }
 
-  free (skips);
-
   return logitem->host == NULL;
 }
 
@@ -1397,14 +1522,14 @@ find_xff_host (GLogItem * logitem, char **str, char **p)
  * On success, the malloc'd token is assigned to a GLogItem member and
  * 0 is returned. */
 static int
-special_specifier (GLogItem * logitem, char **str, char **p)
+special_specifier (GLogItem * logitem, char **str, const GLogFmtOp * op)
 {
-  switch (**p) {
+  switch (op->spec) {
     /* XFF remote hostname (IP only) */
   case 'h':
     if (logitem->host)
-      return spec_err (logitem, SPEC_TOKN_SET, **p, NULL);
-    if (find_xff_host (logitem, str, p))
+      return spec_err (logitem, SPEC_TOKN_SET, op->spec, NULL);
+    if (find_xff_host (logitem, str, op->skips))
       return spec_err (logitem, SPEC_TOKN_NUL, 'h', NULL);
     break;
   }
@@ -1412,23 +1537,60 @@ special_specifier (GLogItem * logitem, char **str, char **p)
   return 0;
 }
 
-/* Iterate over the given log format.
+/* Append a new instruction to the given compiled log format.
  *
- * On error, or unable to parse it, 1 is returned.
- * On success, the malloc'd token is assigned to a GLogItem member and
- * 0 is returned. */
-static int
-parse_format (GLogItem * logitem, char *str)
+ * On success, the newly appended instruction is returned. */
+static GLogFmtOp *
+new_log_format_op (GLogFmtProg * prog, int op, char spec)
 {
-  char end[2 + 1] = { 0 };
-  char *lfmt = conf.log_format, *p = NULL;
-  int perc = 0, tilde = 0, optdelim = 0;
+  GLogFmtOp *fop = &prog->ops[prog->len++];
 
-  if (str == NULL || *str == '\0')
-    return 1;
+  memset (fop, 0, sizeof (*fop));
+  fop->op = op;
+  fop->spec = spec;
+  fop->cnt = 1;
 
-  /* iterate over the log format */
-  for (p = lfmt; *p; p++) {
+  return fop;
+}
+
+/* Free the given compiled log format. */
+static void
+free_log_format_ops (GLogFmtProg * prog)
+{
+  int i;
+
+  if (prog == NULL)
+    return;
+
+  for (i = 0; i < prog->len; ++i)
+    free (prog->ops[i].skips);
+  free (prog->ops);
+  free (prog->log_format);
+  free (prog->date_format);
+  free (prog);
+}
+
+/* Compile the given log format into a list of instructions. This walks
+ * the format the same way it was done per line, i.e., delimiters,
+ * escaped chars, the number of spaces within the date format and the XFF
+ * reject set are all resolved once.
+ *
+ * On success, the newly allocated GLogFmtProg is returned. */
+static GLogFmtProg *
+compile_log_format (const char *lfmt, const char *dfmt)
+{
+  GLogFmtProg *prog = xcalloc (1, sizeof (GLogFmtProg));
+  GLogFmtOp *fop = NULL;
+  char *fmt = NULL, *p = NULL;
+  int perc = 0, tilde = 0;
+
+  prog->log_format = xstrdup (lfmt);
+  prog->date_format = xstrdup (dfmt);
+  /* each instruction consumes at least one char from the format */
+  prog->ops = xcalloc (strlen (lfmt) + 1, sizeof (GLogFmtOp));
+
+  fmt = prog->log_format;
+  for (p = fmt; *p; p++) {
     /* advance to the first unescaped delim */
     if (*p == '\\')
       continue;
@@ -1441,37 +1603,125 @@ parse_format (GLogItem * logitem, char *str)
       continue;
     }
 
-    if (tilde && *p != '\0') {
-      if ((str == NULL) || (*str == '\0'))
-        return 0;
-      if (special_specifier (logitem, &str, &p) == 1)
-        return 1;
+    if (tilde) {
+      fop = new_log_format_op (prog, LFMT_OP_SPECIAL, *p);
       tilde = 0;
+      if (*p != 'h' || !(fop->skips = extract_braces (&p)))
+        continue;
+      /* the char following the closing brace is skipped */
+      if (*p == '\0')
+        break;
     }
     /* %h */
-    else if (perc && *p != '\0') {
-      if ((str == NULL) || (*str == '\0'))
-        return 0;
-
-      memset (end, 0, sizeof end);
-      optdelim = get_delim (end, p);
-      /* attempt to parse format specifiers */
-      if (parse_specifier (logitem, &str, p, end) == 1)
-        return 1;
+    else if (perc) {
+      fop = new_log_format_op (prog, LFMT_OP_SPEC, *p);
+      /* parse date format including dates containing spaces */
+      if (*p == 'd')
+        fop->cnt = count_matches (dfmt, ' ') + 1;
       /* account for the extra delimiter */
-      if (optdelim)
+      if (get_delim (fop->end, p))
         p++;
       perc = 0;
-    } else if (perc && isspace (p[0])) {
-      return 1;
+    } else if (prog->len && prog->ops[prog->len - 1].op == LFMT_OP_LITERAL) {
+      prog->ops[prog->len - 1].cnt++;
     } else {
-      str++;
+      new_log_format_op (prog, LFMT_OP_LITERAL, *p);
+    }
+  }
+
+  return prog;
+}
+
+/* Get the compiled version of the current log format, compiling it
+ * again if either the log or date format changed.
+ *
+ * On success, the compiled log format is returned. */
+static const GLogFmtProg *
+get_log_format_prog (void)
+{
+  const char *dfmt = conf.date_format ? conf.date_format : "";
+  GLogFmtProg *prog = logfmt_prog;
+
+  if (prog && !strcmp (prog->log_format, conf.log_format) &&
+      !strcmp (prog->date_format, dfmt))
+    return prog;
+
+  free_log_format_ops (prog);
+  logfmt_prog = compile_log_format (conf.log_format, dfmt);
+  logfmt_gen++;
+
+  return logfmt_prog;
+}
+
+/* Free the compiled log format. */
+void
+free_log_format_prog (void)
+{
+  free_log_format_ops (logfmt_prog);
+  logfmt_prog = NULL;
+}
+
+/* Run the compiled log format against the given log line.
+ *
+ * On error, or unable to parse it, 1 is returned.
+ * On success, the malloc'd token is assigned to a GLogItem member and
+ * 0 is returned. */
+static int
+parse_format (GLogItem * logitem, char *str, GDateCache * dcache)
+{
+  const GLogFmtOp *fop = NULL;
+  int i;
+
+  if (str == NULL || *str == '\0' || logfmt_prog == NULL)
+    return 1;
+
+  /* the log format changed, cached tokens are stale */
+  if (dcache->gen != logfmt_gen) {
+    memset (dcache, 0, sizeof (*dcache));
+    dcache->gen = logfmt_gen;
+  }
+
+  for (i = 0; i < logfmt_prog->len; ++i) {
+    fop = &logfmt_prog->ops[i];
+
+    if (fop->op == LFMT_OP_LITERAL) {
+      str += strnlen (str, fop->cnt);
+      continue;
     }
+
+    if (*str == '\0')
+      return 0;
+    if (fop->op == LFMT_OP_SPECIAL && special_specifier (logitem, &str, fop))
+      return 1;
+    /* attempt to parse format specifiers */
+    if (fop->op == LFMT_OP_SPEC && parse_specifier (logitem, &str, fop, dcache))
+      return 1;
   }
 
   return 0;
 }
 
+/* Run the current log format against the given log line, into a log
+ * item that is discarded right after, e.g., to time the parser on its
+ * own, see --benchmark-micro.
+ *
+ * On error, or unable to parse it, 1 is returned.
+ * On success, 0 is returned. */
+int
+parse_format_line (char *line)
+{
+  GArena *arena = get_parse_arena ();
+  int ret = 0;
+
+  if (conf.log_format == NULL || get_log_format_prog () == NULL)
+    return 1;
+
+  ret = parse_format (new_log_item (arena), line, &main_dcache);
+  reset_arena (arena);
+
+  return ret;
+}
+
 /* Determine if the log string is valid and if it's not a comment.
  *
  * On error, or invalid, 1 is returned.
@@ -1567,11 +1817,12 @@ verify_missing_fields (GLogItem * logitem)
 {
   /* must have the following fields */
   if (logitem->host == NULL)
-    logitem->errstr = xstrdup ("IPv4/6 is required.");
+    logitem->errstr = arena_strdup (logitem->arena, "IPv4/6 is required.");
   else if (logitem->date == NULL)
-    logitem->errstr = xstrdup ("A valid date is required.");
+    logitem->errstr =
+      arena_strdup (logitem->arena, "A valid date is required.");
   else if (logitem->req == NULL)
-    logitem->errstr = xstrdup ("A request is required.");
+    logitem->errstr = arena_strdup (logitem->arena, "A request is required.");
 
   return logitem->errstr != NULL;
 }
@@ -1647,23 +1898,30 @@ count_process (GLog * glog)
   unlock_spinner ();
 }
 
-/* Keep track of all excluded log strings (IPs).
+/* Determine if the log string needs to be excluded given its IP.
  *
  * If IP not range, 1 is returned.
  * If IP is excluded, 0 is returned. */
 static int
-excluded_ip (GLog * glog, GLogItem * logitem)
+excluded_ip (GLogItem * logitem)
 {
   if (conf.ignore_ip_idx && ip_in_range (logitem->host)) {
-    glog->excluded_ip++;
-#ifdef TCB_BTREE
-    ht_insert_genstats ("excluded_ip", 1);
-#endif
+    logitem->is_excluded = 1;
     return 0;
   }
   return 1;
 }
 
+/* Keep track of all excluded log strings (IPs). */
+static void
+count_excluded_ip (GLog * glog)
+{
+  glog->excluded_ip++;
+#ifdef TCB_BTREE
+  ht_insert_genstats ("excluded_ip", 1);
+#endif
+}
+
 /* Determine if the request is from a robot or spider and check if we
  * need to ignore or show crawlers only.
  *
@@ -1677,7 +1935,7 @@ handle_crawler (const char *agent)
   if (!conf.ignore_crawlers && !conf.crawlers_only)
     return 1;
 
-  bot = is_crawler (agent);
+  bot = ua_cache_crawler (agent);
   return (conf.ignore_crawlers && bot) || (conf.crawlers_only && !bot) ? 0 : 1;
 }
 
@@ -1727,11 +1985,10 @@ static int
 is_404 (GLogItem * logitem)
 {
   /* is this a 404? */
-  if (logitem->status && !memcmp (logitem->status, "404", 3))
+  if (logitem->status_code == 404)
     return 1;
   /* treat 444 as 404? */
-  else if (logitem->status && !memcmp (logitem->status, "444", 3) &&
-           conf.code444_as_404)
+  else if (logitem->status_code == 444 && conf.code444_as_404)
     return 1;
   return 0;
 }
@@ -1742,9 +1999,9 @@ is_404 (GLogItem * logitem)
  * If the request line is ignored, IGNORE_LEVEL_PANEL is returned.
  * If the request line is only not counted as valid, IGNORE_LEVEL_REQ is returned. */
 static int
-ignore_line (GLog * glog, GLogItem * logitem)
+ignore_line (GLogItem * logitem)
 {
-  if (excluded_ip (glog, logitem) == 0)
+  if (excluded_ip (logitem) == 0)
     return IGNORE_LEVEL_PANEL;
   if (handle_crawler (logitem->agent) == 0)
     return IGNORE_LEVEL_PANEL;
@@ -1773,6 +2030,30 @@ insert_keymap (char *key, GModule module)
   return ht_insert_keymap (module, key);
 }
 
+/* A wrapper function to insert a data keymap string key, which may
+ * take over another one on panels keeping only their heavy hitters.
+ *
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+static int
+insert_data_keymap (char *key, GModule module)
+{
+  return ht_insert_data_keymap (module, key);
+}
+
+/* A wrapper function to insert a keymap string key out of a bounded
+ * domain, e.g., status codes, given its code.
+ *
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+static int
+insert_code_keymap (int code, char *key, int data, GModule module)
+{
+  return ht_insert_code_keymap (module, code, key, data);
+}
+
 /* A wrapper function to insert a datamap int key and string value. */
 static void
 insert_data (int nkey, const char *data, GModule module)
@@ -1780,17 +2061,32 @@ insert_data (int nkey, const char *data, GModule module)
   ht_insert_datamap (module, nkey, data);
 }
 
-/* A wrapper function to insert a uniqmap string key.
+/* A wrapper function to insert a uniqmap key.
  *
  * If the given key exists, 0 is returned.
  * On error, -1 is returned.
  * On success the value of the key inserted is returned */
 static int
-insert_uniqmap (char *uniq_key, GModule module)
+insert_uniqmap (uint64_t uniq_key, GModule module)
 {
   return ht_insert_uniqmap (module, uniq_key);
 }
 
+/* A wrapper function to add the hash of a unique visitor to the
+ * sketch of a data int key. Visitors are counted as its estimate
+ * grows, see --approx-visitors. */
+static void
+insert_uniq_hll (uint64_t hash, int data_nkey, GModule module)
+{
+  int inc = 0;
+
+  if ((inc = ht_insert_uniq_hll (module, data_nkey, hash)) <= 0)
+    return;
+
+  ht_insert_visitor (module, data_nkey, inc);
+  ht_insert_meta_data (module, "visitors", inc);
+}
+
 /* A wrapper function to insert a rootmap int key from the keymap
  * store mapped to its string value. */
 static void
@@ -1885,14 +2181,14 @@ get_uniq_visitor_key (GLogItem * logitem)
   char *ua = NULL, *key = NULL;
   size_t s1, s2, s3;
 
-  ua = deblank (xstrdup (logitem->agent));
+  ua = deblank (arena_strdup (logitem->arena, logitem->agent));
 
   s1 = strlen (logitem->host);
   s2 = strlen (logitem->date);
   s3 = strlen (ua);
 
   /* includes terminating null */
-  key = xcalloc (s1 + s2 + s3 + 3, sizeof (char));
+  key = arena_alloc (logitem->arena, s1 + s2 + s3 + 3);
 
   memcpy (key, logitem->host, s1);
 
@@ -1902,7 +2198,10 @@ get_uniq_visitor_key (GLogItem * logitem)
   key[s1 + s2 + 1] = '|';
   memcpy (key + s1 + s2 + 2, ua, s3 + 1);
 
-  free (ua);
+  /* only its hash is stored, or added to the sketches */
+  if (conf.hash_visitor_keys || conf.approx_visitors)
+    hash128 (key, s1 + s2 + s3 + 2, logitem->uniq_hkey);
+
   return key;
 }
 
@@ -1921,10 +2220,10 @@ gen_unique_req_key (GLogItem * logitem)
 
   /* nothing to do */
   if (!conf.append_method && !conf.append_protocol)
-    return xstrdup (logitem->req);
+    return logitem->req;
   /* still nothing to do */
   if (!logitem->method && !logitem->protocol)
-    return xstrdup (logitem->req);
+    return logitem->req;
 
   s1 = strlen (logitem->req);
   if (logitem->method && conf.append_method) {
@@ -1937,7 +2236,7 @@ gen_unique_req_key (GLogItem * logitem)
   }
 
   /* includes terminating null */
-  key = xcalloc (s1 + s2 + s3 + nul, sizeof (char));
+  key = arena_calloc (logitem->arena, s1 + s2 + s3 + nul);
   /* append request */
   memcpy (key, logitem->req, s1);
 
@@ -1958,7 +2257,7 @@ gen_unique_req_key (GLogItem * logitem)
 /* Append the query string to the request, and therefore, it modifies
  * the original logitem->req */
 static void
-append_query_string (char **req, const char *qstr)
+append_query_string (GArena * arena, char **req, const char *qstr)
 {
   char *r;
   size_t s1, s2, qm = 0;
@@ -1970,13 +2269,12 @@ append_query_string (char **req, const char *qstr)
   if (*qstr != '?')
     qm = 1;
 
-  r = xmalloc (s1 + s2 + qm + 1);
+  r = arena_alloc (arena, s1 + s2 + qm + 1);
   memcpy (r, *req, s1);
   if (qm)
     r[s1] = '?';
   memcpy (r + s1 + qm, qstr, s2 + 1);
 
-  free (*req);
   *req = r;
 }
 
@@ -1995,24 +2293,23 @@ get_kdata (GKeyData * kdata, char *data_key, char *data)
  * if the specificity if set to hours, then a generated key would
  * look like: 03/Jan/2016:09 */
 static void
-set_spec_visitor_key (char **fdate, const char *ftime)
+set_spec_visitor_key (GArena * arena, char **fdate, const char *ftime)
 {
   size_t dlen = 0, tlen = 0;
-  char *key = NULL, *tkey = NULL, *pch = NULL;
+  char *key = NULL;
+  const char *pch = NULL;
 
-  tkey = xstrdup (ftime);
-  if (conf.date_spec_hr && (pch = strchr (tkey, ':')) && (pch - tkey) > 0)
-    *pch = '\0';
+  tlen = strlen (ftime);
+  if (conf.date_spec_hr && (pch = strchr (ftime, ':')) && (pch - ftime) > 0)
+    tlen = pch - ftime;
 
   dlen = strlen (*fdate);
-  tlen = strlen (tkey);
 
-  key = xmalloc (dlen + tlen + 1);
+  key = arena_alloc (arena, dlen + tlen + 1);
   memcpy (key, *fdate, dlen);
-  memcpy (key + dlen, tkey, tlen + 1);
+  memcpy (key + dlen, ftime, tlen);
+  key[dlen + tlen] = '\0';
 
-  free (*fdate);
-  free (tkey);
   *fdate = key;
 }
 
@@ -2030,7 +2327,7 @@ gen_visitor_key (GKeyData * kdata, GLogItem * logitem)
 
   /* Append time specificity to date */
   if (conf.date_spec_hr)
-    set_spec_visitor_key (&logitem->date, logitem->time);
+    set_spec_visitor_key (logitem->arena, &logitem->date, logitem->time);
 
   get_kdata (kdata, logitem->date, logitem->date);
 
@@ -2047,7 +2344,7 @@ static int
 gen_req_key (GKeyData * kdata, GLogItem * logitem)
 {
   if (logitem->req && logitem->qstr)
-    append_query_string (&logitem->req, logitem->qstr);
+    append_query_string (logitem->arena, &logitem->req, logitem->qstr);
   logitem->req_key = gen_unique_req_key (logitem);
 
   get_kdata (kdata, logitem->req_key, logitem->req);
@@ -2153,15 +2450,14 @@ gen_host_key (GKeyData * kdata, GLogItem * logitem)
 static int
 gen_browser_key (GKeyData * kdata, GLogItem * logitem)
 {
-  char *agent = NULL;
   char browser_type[BROWSER_TYPE_LEN] = "";
 
   if (logitem->agent == NULL || *logitem->agent == '\0')
     return 1;
 
-  agent = xstrdup (logitem->agent);
-  logitem->browser = verify_browser (agent, browser_type);
-  logitem->browser_type = xstrdup (browser_type);
+  logitem->browser =
+    ua_cache_browser (logitem->arena, logitem->agent, browser_type);
+  logitem->browser_type = arena_strdup (logitem->arena, browser_type);
 
   /* e.g., Firefox 11.12 */
   kdata->data = logitem->browser;
@@ -2171,8 +2467,6 @@ gen_browser_key (GKeyData * kdata, GLogItem * logitem)
   kdata->root = logitem->browser_type;
   kdata->root_key = logitem->browser_type;
 
-  free (agent);
-
   return 0;
 }
 
@@ -2185,15 +2479,13 @@ gen_browser_key (GKeyData * kdata, GLogItem * logitem)
 static int
 gen_os_key (GKeyData * kdata, GLogItem * logitem)
 {
-  char *agent = NULL;
   char os_type[OPESYS_TYPE_LEN] = "";
 
   if (logitem->agent == NULL || *logitem->agent == '\0')
     return 1;
 
-  agent = xstrdup (logitem->agent);
-  logitem->os = verify_os (agent, os_type);
-  logitem->os_type = xstrdup (os_type);
+  logitem->os = ua_cache_os (logitem->arena, logitem->agent, os_type);
+  logitem->os_type = arena_strdup (logitem->arena, os_type);
 
   /* e.g., Linux,Ubuntu 10.12 */
   kdata->data = logitem->os;
@@ -2203,8 +2495,6 @@ gen_os_key (GKeyData * kdata, GLogItem * logitem)
   kdata->root = logitem->os_type;
   kdata->root_key = logitem->os_type;
 
-  free (agent);
-
   return 0;
 }
 
@@ -2272,10 +2562,10 @@ gen_geolocation_key (GKeyData * kdata, GLogItem * logitem)
     return 1;
 
   if (country[0] != '\0')
-    logitem->country = xstrdup (country);
+    logitem->country = arena_strdup (logitem->arena, country);
 
   if (continent[0] != '\0')
-    logitem->continent = xstrdup (continent);
+    logitem->continent = arena_strdup (logitem->arena, continent);
 
   kdata->data_key = logitem->country;
   kdata->data = logitem->country;
@@ -2297,17 +2587,20 @@ gen_status_code_key (GKeyData * kdata, GLogItem * logitem)
 {
   const char *status = NULL, *type = NULL;
 
-  if (!logitem->status)
+  if (!logitem->status_code)
     return 1;
 
-  type = verify_status_code_type (logitem->status);
-  status = verify_status_code (logitem->status);
+  type = verify_status_code_type (logitem->status_code);
+  status = verify_status_code (logitem->status_code);
 
   kdata->data = (char *) status;
   kdata->data_key = (char *) status;
+  kdata->data_code = logitem->status_code;
 
   kdata->root = (char *) type;
   kdata->root_key = (char *) type;
+  /* a category takes the slot of the hundreds, below any code */
+  kdata->root_code = logitem->status_code / 100;
 
   return 0;
 }
@@ -2366,8 +2659,7 @@ gen_visit_time_key (GKeyData * kdata, GLogItem * logitem)
   if ((hmark = strchr (hour, ':')))
     parse_time_specificity_string (hmark, hour);
 
-  free (logitem->time);
-  logitem->time = xstrdup (hour);
+  logitem->time = arena_strdup (logitem->arena, hour);
   get_kdata (kdata, logitem->time, logitem->time);
 
   return 0;
@@ -2381,22 +2673,19 @@ include_uniq (GLogItem * logitem)
 {
   int u = conf.client_err_to_unique_count;
 
-  if (!logitem->status || logitem->status[0] != '4' ||
-      (u && logitem->status[0] == '4'))
+  if (logitem->status_code / 100 != 4 || u)
     return 1;
   return 0;
 }
 
-/* Convert two integers keys to to a string (concatenated).
+/* Pack two integers keys into a single 64-bit key, the first one
+ * taking the upper 32 bits.
  *
- * On success, the given numbers as a string are returned. */
-static char *
-intkeys2str (int a, int b)
+ * On success, the packed key is returned. */
+static uint64_t
+intkeys2u64 (int a, int b)
 {
-  char *s = xmalloc (snprintf (NULL, 0, "%d|%d", a, b) + 1);
-  sprintf (s, "%d|%d", a, b);
-
-  return s;
+  return ((uint64_t) (uint32_t) a << 32) | (uint32_t) b;
 }
 
 /* Determine which data metrics need to be set and set them. */
@@ -2440,50 +2729,188 @@ set_datamap (GLogItem * logitem, GKeyData * kdata, const GParse * parse)
     parse->agent (kdata->data_nkey, logitem->agent_nkey, module);
 }
 
-/* Set data mapping and metrics. */
-static void
-map_log (GLogItem * logitem, const GParse * parse, GModule module)
+/* Metrics a datamap kernel sets on top of the ones every panel has */
+#define KERNEL_ROOT     0x1
+#define KERNEL_METHOD   0x2
+#define KERNEL_PROTOCOL 0x4
+#define KERNEL_AGENT    0x8
+
+/* Define a datamap kernel setting the metrics of the given mask. The
+ * mask is a constant, thus the metrics that don't apply are compiled
+ * out, and so are the indirect calls set_datamap() goes through. */
+#define DEF_DATAMAP_KERNEL(mask)                                          \
+static void                                                               \
+set_datamap_##mask (const GLogItem * logitem, const GKeyData * kdata,     \
+                    GModule module)                                       \
+{                                                                         \
+  insert_data (kdata->data_nkey, kdata->data, module);                    \
+  if ((mask) & KERNEL_ROOT) {                                             \
+    insert_rootmap (kdata->root_nkey, kdata->root, module);               \
+    insert_root (kdata->data_nkey, kdata->root_nkey, module);             \
+  }                                                                       \
+  ht_insert_metrics (module, kdata->data_nkey, kdata->uniq_nkey != 0,     \
+                     logitem->resp_size, logitem->serve_time);            \
+  if ((mask) & KERNEL_METHOD)                                             \
+    insert_method (kdata->data_nkey, logitem->method, module);            \
+  if ((mask) & KERNEL_PROTOCOL)                                           \
+    insert_protocol (kdata->data_nkey, logitem->protocol, module);        \
+  if ((mask) & KERNEL_AGENT)                                              \
+    insert_agent (kdata->data_nkey, logitem->agent_nkey, module);         \
+}
+
+/* *INDENT-OFF* */
+DEF_DATAMAP_KERNEL (0)  DEF_DATAMAP_KERNEL (1)  DEF_DATAMAP_KERNEL (2)
+DEF_DATAMAP_KERNEL (3)  DEF_DATAMAP_KERNEL (4)  DEF_DATAMAP_KERNEL (5)
+DEF_DATAMAP_KERNEL (6)  DEF_DATAMAP_KERNEL (7)  DEF_DATAMAP_KERNEL (8)
+DEF_DATAMAP_KERNEL (9)  DEF_DATAMAP_KERNEL (10) DEF_DATAMAP_KERNEL (11)
+DEF_DATAMAP_KERNEL (12) DEF_DATAMAP_KERNEL (13) DEF_DATAMAP_KERNEL (14)
+DEF_DATAMAP_KERNEL (15)
+
+/* indexed by the mask of the metrics they set */
+static const GDatamapKernel datamap_kernels[] = {
+  set_datamap_0,  set_datamap_1,  set_datamap_2,  set_datamap_3,
+  set_datamap_4,  set_datamap_5,  set_datamap_6,  set_datamap_7,
+  set_datamap_8,  set_datamap_9,  set_datamap_10, set_datamap_11,
+  set_datamap_12, set_datamap_13, set_datamap_14, set_datamap_15,
+};
+/* *INDENT-ON* */
+
+/* Select for each panel the datamap kernel setting its metrics given
+ * its GParse entry and the enabled options. Panels not made of the
+ * regular insertion routines keep going through set_datamap(). This
+ * needs to be called once the options are set. */
+void
+init_datamap_kernels (void)
 {
-  GKeyData kdata;
-  char *uniq_key = NULL;
+  const GParse *parse = NULL;
+  int i, mask;
 
-  new_modulekey (&kdata);
-  if (parse->key_data (&kdata, logitem) == 1)
-    return;
+  for (i = 0; i < (int) ARRAY_SIZE (paneling); i++) {
+    parse = &paneling[i];
+    datamap_kernel[parse->module] = NULL;
+
+    if (parse->datamap != insert_data || parse->hits != insert_hit ||
+        parse->visitor != insert_visitor || parse->bw != insert_bw ||
+        parse->cumts != insert_cumts || parse->maxts != insert_maxts)
+      continue;
+    if ((parse->rootmap && parse->rootmap != insert_rootmap) ||
+        (parse->method && parse->method != insert_method) ||
+        (parse->protocol && parse->protocol != insert_protocol) ||
+        (parse->agent && parse->agent != insert_agent))
+      continue;
+
+    mask = 0;
+    if (parse->rootmap)
+      mask |= KERNEL_ROOT;
+    if (parse->method && conf.append_method)
+      mask |= KERNEL_METHOD;
+    if (parse->protocol && conf.append_protocol)
+      mask |= KERNEL_PROTOCOL;
+    if (parse->agent && conf.list_agents)
+      mask |= KERNEL_AGENT;
+    datamap_kernel[parse->module] = datamap_kernels[mask];
+  }
+}
+
+/* Generate the key data for the given module from the log item. Note
+ * that none of the key generators access the storage, and thus they
+ * can be run from a parsing thread. */
+static void
+gen_module_key (GJobLine * jline, const GParse * parse, GModule module)
+{
+  GKeyData *kdata = &jline->kdata[module];
+
+  new_modulekey (kdata);
+  if (parse->key_data (kdata, jline->logitem) == 1)
+    jline->kstate[module] = KEY_NOT_FOUND;
+  else
+    jline->kstate[module] = KEY_FOUND;
+}
+
+/* Generate the key data for every module. */
+static void
+gen_keys (GJobLine * jline)
+{
+  GModule module;
+  const GParse *parse = NULL;
+  size_t idx = 0;
+
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    if (!(parse = panel_lookup (module)))
+      continue;
+    gen_module_key (jline, parse, module);
+  }
+}
+
+/* Set data mapping and metrics. */
+static void
+map_log (GJobLine * jline, const GParse * parse, GModule module)
+{
+  GLogItem *logitem = jline->logitem;
+  GKeyData *kdata = &jline->kdata[module];
+  uint64_t uniq_key = 0;
+
+  if (jline->kstate[module] != KEY_FOUND)
+    return;
 
   /* each module requires a data key/value */
-  if (parse->datamap && kdata.data_key)
-    kdata.data_nkey = insert_keymap (kdata.data_key, module);
+  if (parse->datamap && kdata->data_key && kdata->data_code)
+    kdata->data_nkey = insert_code_keymap (kdata->data_code, kdata->data_key,
+                                           1, module);
+  else if (parse->datamap && kdata->data_key)
+    kdata->data_nkey = insert_data_keymap (kdata->data_key, module);
+#ifndef HAVE_LIBTOKYOCABINET
+  /* keys of the segment being filled are not the ones displayed */
+  if (!side_pass)
+#endif
+    set_key_dirty (module, kdata->data_nkey);
 
   /* each module contains a uniq visitor key/value */
   if (parse->visitor && logitem->uniq_key && include_uniq (logitem)) {
-    uniq_key = intkeys2str (logitem->uniq_nkey, kdata.data_nkey);
-    /* unique key already exists? */
-    kdata.uniq_nkey = insert_uniqmap (uniq_key, module);
-    free (uniq_key);
+    if (conf.approx_visitors) {
+      /* only its hash is added to the sketch of the data key */
+      insert_uniq_hll (logitem->uniq_hkey[0], kdata->data_nkey, module);
+    } else {
+      uniq_key = intkeys2u64 (logitem->uniq_nkey, kdata->data_nkey);
+      /* unique key already exists? */
+      kdata->uniq_nkey = insert_uniqmap (uniq_key, module);
+    }
   }
 
   /* root keys are optional */
-  if (parse->rootmap && kdata.root_key)
-    kdata.root_nkey = insert_keymap (kdata.root_key, module);
+  if (parse->rootmap && kdata->root_key && kdata->root_code)
+    kdata->root_nkey = insert_code_keymap (kdata->root_code, kdata->root_key,
+                                           0, module);
+  else if (parse->rootmap && kdata->root_key)
+    kdata->root_nkey = insert_keymap (kdata->root_key, module);
 
   /* each module requires a root key/value */
-  if (parse->datamap && kdata.data_key)
-    set_datamap (logitem, &kdata, parse);
+  if (parse->datamap && kdata->data_key && datamap_kernel[module])
+    datamap_kernel[module] (logitem, kdata, module);
+  else if (parse->datamap && kdata->data_key)
+    set_datamap (logitem, kdata, parse);
 }
 
 /* Process a log line and set the data into the corresponding data
  * structure. */
 static void
-process_log (GLogItem * logitem)
+process_log (GJobLine * jline)
 {
+  GLogItem *logitem = jline->logitem;
   GModule module;
   const GParse *parse = NULL;
   size_t idx = 0;
+  uint64_t ts = 0;
 
   /* Insert one unique visitor key per request to avoid the
-   * overhead of storing one key per module */
-  logitem->uniq_nkey = ht_insert_unique_key (logitem->uniq_key);
+   * overhead of storing one key per module. Sketches need no key */
+  if (conf.approx_visitors)
+    logitem->uniq_nkey = 0;
+  else if (conf.hash_visitor_keys)
+    logitem->uniq_nkey = ht_insert_unique_hkey (logitem->uniq_hkey);
+  else
+    logitem->uniq_nkey = ht_insert_unique_key (logitem->uniq_key);
 
   /* If we need to store user agents per IP, then we store them and retrieve
    * its numeric key.
@@ -2500,47 +2927,93 @@ process_log (GLogItem * logitem)
     module = module_list[idx];
     if (!(parse = panel_lookup (module)))
       continue;
-    map_log (logitem, parse, module);
+    ts = stats_begin ();
+    map_log (jline, parse, module);
+    stats_end_module (module, ts);
   }
 }
 
-/* Process a line from the log and store it accordingly taking into
- * account multiple parsing options prior to setting data into the
- * corresponding data structure.
+/* Get the minutes since the epoch, as UTC, of the numeric date (Ymd)
+ * and time (H:M:S) of the given log item.
+ *
+ * If unable to, -1 is returned.
+ * On success the minutes since the epoch are returned. */
+static int64_t
+get_item_minutes (const GLogItem * logitem)
+{
+  const char *d = logitem->date, *t = logitem->time;
+  int64_t y, m, day, era, yoe, days;
+  int i, hour = 0, min = 0;
+
+  for (i = 0; i < 8; i++)
+    if (!d || !isdigit ((unsigned char) d[i]))
+      return -1;
+  if (d[8] != '\0')
+    return -1;
+
+#define DIGITS2(s) (((s)[0] - '0') * 10 + (s)[1] - '0')
+  y = DIGITS2 (d) * 100 + DIGITS2 (d + 2);
+  m = DIGITS2 (d + 4);
+  day = DIGITS2 (d + 6);
+  if (m < 1 || m > 12)
+    return -1;
+
+  /* days since the epoch of the civil date, out of March-based years */
+  y -= m <= 2;
+  era = y / 400;
+  yoe = y - era * 400;
+  days = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + days - 719468;
+
+  if (t && isdigit ((unsigned char) t[0]) && isdigit ((unsigned char) t[1]) &&
+      t[2] == ':' && isdigit ((unsigned char) t[3]) &&
+      isdigit ((unsigned char) t[4])) {
+    hour = DIGITS2 (t);
+    min = DIGITS2 (t + 3);
+  }
+#undef DIGITS2
+
+  return days * 1440 + hour * 60 + min;
+}
+
+/* Parse a line from the log taking into account multiple parsing
+ * options and generate its keys. Note that this doesn't touch neither
+ * the storage nor the overall log counters, so it can be run from a
+ * parsing thread.
  *
+ * If the line is soft ignored, -1 is returned.
+ * If the line is invalid, 1 is returned.
  * On success, 0 is returned */
 static int
-pre_process_log (GLog * glog, char *line, int dry_run)
+parse_line (GJobLine * jline, GDateCache * dcache, int dry_run)
 {
-  GLogItem *logitem;
+  GLogItem *logitem = jline->logitem;
+  uint64_t ts = 0;
   int ret = 0;
-  int ignorelevel = 0;
 
   /* soft ignore these lines */
-  if (valid_line (line))
+  if (valid_line (jline->line))
     return -1;
 
-  count_process (glog);
-  logitem = init_log_item (glog);
   /* Parse a line of log, and fill structure with appropriate values */
-  if (parse_format (logitem, line) || verify_missing_fields (logitem)) {
-    ret = 1;
-    count_invalid (glog, line);
-    goto cleanup;
-  }
+  ts = stats_begin ();
+  ret = parse_format (logitem, jline->line, dcache);
+  stats_end (STATS_PARSE, ts);
+  if (ret || verify_missing_fields (logitem))
+    return 1;
 
   /* agent will be null in cases where %u is not specified */
   if (logitem->agent == NULL)
-    logitem->agent = alloc_string ("-");
+    logitem->agent = arena_strdup (logitem->arena, "-");
 
   /* testing log only */
   if (dry_run)
-    goto cleanup;
+    return 0;
 
-  ignorelevel = ignore_line (glog, logitem);
+  jline->ignorelevel = ignore_line (logitem);
   /* ignore line */
-  if (ignorelevel == IGNORE_LEVEL_PANEL)
-    goto cleanup;
+  if (jline->ignorelevel == IGNORE_LEVEL_PANEL)
+    return 0;
 
   if (is_404 (logitem))
     logitem->is_404 = 1;
@@ -2548,32 +3021,300 @@ pre_process_log (GLog * glog, char *line, int dry_run)
     logitem->is_static = 1;
 
   logitem->uniq_key = get_uniq_visitor_key (logitem);
+  /* before the time of the line is truncated by its key */
+  if (conf.time_window)
+    logitem->minutes = get_item_minutes (logitem);
+  gen_keys (jline);
+
+  return 0;
+}
+
+#ifndef HAVE_LIBTOKYOCABINET
+/* Persist the segment being filled, and keep it on the window. */
+static void
+close_segment (GLog * glog)
+{
+  GSegment *seg = &window.segs[window.len];
+  GLog counters;
+  int ret = 0;
+
+  /* the segment counts whatever was parsed since it began */
+  memset (&counters, 0, sizeof (counters));
+  counters.processed = glog->processed - window.base.processed;
+  counters.invalid = glog->invalid - window.base.invalid;
+  counters.valid = glog->valid - window.base.valid;
+  counters.excluded_ip = glog->excluded_ip - window.base.excluded_ip;
+  counters.resp_size = glog->resp_size - window.base.resp_size;
+
+  if (!(seg->path = new_tmp_path ("segment")))
+    FATAL ("Unable to create a segment of the time window: %s",
+           strerror (errno));
+
+  ht_swap_state (window.state);
+  ret = ht_persist_snapshot (seg->path, &counters);
+  ht_swap_state (window.state);
+  if (ret)
+    FATAL ("Unable to persist the segment %s", seg->path);
+
+  ht_free_state (window.state);
+  window.state = NULL;
+  seg->start = window.start;
+  window.len++;
+}
+
+/* Build the storage in use again out of the segments left on the
+ * window. Whatever was restored or merged before is dropped along. */
+static void
+rebuild_window (GLog * glog)
+{
+  GKHashState *state = ht_new_state ();
+  const char *err = NULL;
+  size_t idx = 0;
+  int i;
+
+  /* swap in an empty storage and drop the one in use */
+  ht_swap_state (state);
+  ht_free_state (state);
+
+  reset_struct (glog);
+  glog->excluded_ip = 0;
+  for (i = 0; i < window.len; i++) {
+    if (ht_merge_snapshot (window.segs[i].path, glog, 0, &err))
+      FATAL ("Unable to merge the segment %s: %s", window.segs[i].path, err);
+  }
+
+  FOREACH_MODULE (idx, module_list) {
+    set_module_dirty (module_list[idx]);
+  }
+}
+
+/* Begin a new segment of the time window if the given line is past
+ * the one being filled, and drop the segments falling out of it. */
+static void
+roll_window (GLog * glog, const GLogItem * logitem)
+{
+  int64_t start = 0;
+  int expired = 0;
+
+  if (logitem->minutes < 0)
+    return;
+
+  if (!window.seg_len) {
+    window.seg_len = (conf.time_window + WINDOW_SEGMENTS - 1) / WINDOW_SEGMENTS;
+  }
+  start = logitem->minutes - logitem->minutes % window.seg_len;
+
+  /* same segment, or a line out of order */
+  if (window.state && start <= window.start)
+    return;
+
+  if (window.state)
+    close_segment (glog);
+
+  /* along with the new one, the window spans WINDOW_SEGMENTS */
+  while (window.len > 0 &&
+         window.segs[0].start <= start - WINDOW_SEGMENTS * window.seg_len) {
+    unlink (window.segs[0].path);
+    free (window.segs[0].path);
+    memmove (window.segs, window.segs + 1, --window.len * sizeof (GSegment));
+    expired = 1;
+  }
+  if (expired)
+    rebuild_window (glog);
+
+  window.state = ht_new_state ();
+  window.start = start;
+  window.base = *glog;
+}
+
+/* Destroy the segments of the time window along with their
+ * snapshots. */
+void
+free_time_window (void)
+{
+  int i;
+
+  for (i = 0; i < window.len; i++) {
+    unlink (window.segs[i].path);
+    free (window.segs[i].path);
+  }
+  ht_free_state (window.state);
+  memset (&window, 0, sizeof (window));
+}
+
+/* Get the report of its own of the given virtual host, adding it if
+ * it's not there yet.
+ *
+ * On success the report of the virtual host is returned. */
+static GVhostSplit *
+get_vhost_split (const char *vhost)
+{
+  GVhostSplit *split = NULL;
+  khint_t k;
+  int ret = 0;
+
+  if (!split_keys)
+    split_keys = kh_init (si32);
+  if ((k = kh_get (si32, split_keys, vhost)) != kh_end (split_keys))
+    return &splits[kh_val (split_keys, k)];
+
+  splits = xrealloc (splits, (splits_len + 1) * sizeof (GVhostSplit));
+  split = &splits[splits_len];
+  memset (split, 0, sizeof (GVhostSplit));
+  split->vhost = xstrdup (vhost);
+  split->state = ht_new_state ();
+
+  k = kh_put (si32, split_keys, split->vhost, &ret);
+  kh_val (split_keys, k) = splits_len++;
+
+  return split;
+}
+
+/* Add a parsed line to the storage of its virtual host, and count it
+ * on its overall counters. */
+static void
+apply_vhost_split (GJobLine * jline)
+{
+  GVhostSplit *split = get_vhost_split (jline->logitem->vhost);
+
+  ht_swap_state (split->state);
+  side_pass = 1;
+  process_log (jline);
+  side_pass = 0;
+  ht_swap_state (split->state);
+
+  split->counters.processed++;
+  split->counters.resp_size += jline->logitem->resp_size;
+  if (jline->ignorelevel != IGNORE_LEVEL_REQ)
+    split->counters.valid++;
+}
+
+/* Get the virtual hosts parsed into reports of their own, in the order
+ * they were first found.
+ *
+ * On success the reports are returned and their number is set. */
+GVhostSplit *
+get_vhost_splits (int *len)
+{
+  *len = splits_len;
+  return splits;
+}
+
+/* Destroy the reports of the virtual hosts along with their storage. */
+void
+free_vhost_splits (void)
+{
+  int i;
+
+  for (i = 0; i < splits_len; i++) {
+    ht_free_state (splits[i].state);
+    free (splits[i].vhost);
+  }
+  free (splits);
+  if (split_keys)
+    kh_destroy (si32, split_keys);
+  splits = NULL;
+  split_keys = NULL;
+  splits_len = 0;
+}
+#endif
+
+/* Apply a parsed line to the storage and update the overall log
+ * counters. This is always run from the main thread.
+ *
+ * If the line is invalid, 1 is returned.
+ * On success, 0 is returned */
+static int
+apply_line (GLog * glog, GJobLine * jline, int dry_run)
+{
+  GLogItem *logitem = jline->logitem;
+  uint64_t ts = 0;
+
+#ifndef HAVE_LIBTOKYOCABINET
+  if (conf.time_window && !dry_run && jline->ret == 0)
+    roll_window (glog, logitem);
+#endif
+
+  count_process (glog);
+  glog->items = logitem;
+  if (jline->ret == 1) {
+    count_invalid (glog, jline->line);
+    return 1;
+  }
+
+  /* testing log only */
+  if (dry_run)
+    return 0;
+
+  if (logitem->is_excluded)
+    count_excluded_ip (glog);
+  /* ignore line */
+  if (jline->ignorelevel == IGNORE_LEVEL_PANEL)
+    return 0;
 
   inc_resp_size (glog, logitem->resp_size);
-  process_log (logitem);
+  ts = stats_begin ();
+  process_log (jline);
+  stats_end (STATS_STORE, ts);
+#ifndef HAVE_LIBTOKYOCABINET
+  /* and to the segment of the time window being filled */
+  if (window.state) {
+    ht_swap_state (window.state);
+    side_pass = 1;
+    process_log (jline);
+    side_pass = 0;
+    ht_swap_state (window.state);
+  }
+  /* and to the report of its virtual host */
+  if (conf.split_vhost_dir && logitem->vhost)
+    apply_vhost_split (jline);
+#endif
 
   /* don't ignore line but neither count as valid */
-  if (ignorelevel != IGNORE_LEVEL_REQ)
+  if (jline->ignorelevel != IGNORE_LEVEL_REQ)
     count_valid (glog);
 
-cleanup:
-  free_glog (logitem);
+  return 0;
+}
+
+/* Process a line from the log and store it accordingly taking into
+ * account multiple parsing options prior to setting data into the
+ * corresponding data structure.
+ *
+ * On success, 0 is returned */
+static int
+pre_process_log (GLog * glog, char *line, int dry_run)
+{
+  GJobLine jline;
+  int ret = 0;
+
+  memset (&jline, 0, sizeof (jline));
+  jline.line = line;
+  jline.logitem = new_log_item (get_parse_arena ());
+
+  /* soft ignore these lines */
+  if ((jline.ret = parse_line (&jline, &main_dcache, dry_run)) != -1)
+    ret = apply_line (glog, &jline, dry_run);
+  else
+    ret = -1;
+
+  glog->items = NULL;
+  reset_arena (parse_arena);
 
   return ret;
 }
 
-/* Entry point to process the given live from the log.
+/* Determine if the log format is likely not matching given the result
+ * of processing a line.
  *
  * On error, 1 is returned.
  * On success or soft ignores, 0 is returned. */
 static int
-read_line (GLog * glog, char *line, int *test, int *cnt, int dry_run)
+test_line (GLog * glog, int ret, int *test, int *cnt)
 {
-  int ret = 0;
   int tests = conf.num_tests;
 
-  /* start processing log line */
-  if ((ret = pre_process_log (glog, line, dry_run)) == 0 && *test)
+  if (ret == 0 && *test)
     *test = 0;
 
   /* soft ignores */
@@ -2595,70 +3336,58 @@ read_line (GLog * glog, char *line, int *test, int *cnt, int dry_run)
   return 0;
 }
 
-/* A replacement for GNU getline() to dynamically expand fgets buffer.
+/* Entry point to process the given live from the log.
  *
- * On error, NULL is returned.
- * On success, the malloc'd line is returned. */
-char *
-fgetline (FILE * fp)
+ * On error, 1 is returned.
+ * On success or soft ignores, 0 is returned. */
+static int
+read_line (GLog * glog, char *line, int *test, int *cnt, int dry_run)
 {
-  char buf[LINE_BUFFER] = { 0 };
-  char *line = NULL, *tmp = NULL;
-  size_t linelen = 0, len = 0;
-
-  while (1) {
-    if (!fgets (buf, sizeof (buf), fp)) {
-      if (conf.process_and_exit && errno == EAGAIN) {
-        nanosleep ((const struct timespec[]) { {
-                   0, 100000000L}}, NULL);
-        continue;
-      } else
-        break;
-    }
-
-    len = strlen (buf);
-
-    /* overflow check */
-    if (SIZE_MAX - len - 1 < linelen)
-      break;
-
-    if ((tmp = realloc (line, linelen + len + 1)) == NULL)
-      break;
+  return test_line (glog, pre_process_log (glog, line, dry_run), test, cnt);
+}
 
-    line = tmp;
-    /* append */
-    strcpy (line + linelen, buf);
-    linelen += len;
+/* Get the next line from the given log reader. If processing and
+ * exiting, it waits until data becomes available to read from a
+ * non-blocking pipe, or until its ring is drained into.
+ *
+ * On error or end of file, NULL is returned.
+ * On success, the nul-terminated line is returned. */
+static char *
+next_line (GFile * file, size_t * len)
+{
+  char *line = NULL;
+  uint64_t ts = stats_begin ();
 
-    if (feof (fp) || buf[len - 1] == '\n')
-      return line;
+  while ((line = gfile_getline (file, len)) == NULL) {
+    if (conf.process_and_exit && errno == EAGAIN) {
+      gfile_wait (file, 100);
+      continue;
+    }
+    break;
   }
-  free (line);
+  stats_end (STATS_READ, ts);
 
-  return NULL;
+  return line;
 }
 
-/* Iterate over the log and read line by line (use GNU get_line to parse the
- * whole line).
+/* Iterate over the log and read line by line.
  *
  * On error, 1 is returned.
  * On success, 0 is returned. */
-#ifdef WITH_GETLINE
 static int
-read_lines (FILE * fp, GLog ** glog, int dry_run)
+read_lines (GFile * file, GLog ** glog, int dry_run)
 {
   char *line = NULL;
   int ret = 0, cnt = 0, test = conf.num_tests > 0 ? 1 : 0;
 
-  while ((line = fgetline (fp)) != NULL) {
+  while ((line = next_line (file, NULL)) != NULL) {
     /* handle SIGINT */
     if (conf.stop_processing)
-      goto out;
+      break;
     if ((ret = read_line ((*glog), line, &test, &cnt, dry_run)))
-      goto out;
+      break;
     if (dry_run && NUM_TESTS == cnt)
-      goto out;
-    free (line);
+      break;
   }
 
   /* if no data was available to read from (probably from a pipe) and
@@ -2667,80 +3396,691 @@ read_lines (FILE * fp, GLog ** glog, int dry_run)
     return 0;
 
   return (line && test) || ret;
+}
+
+/* Parse a batch of log lines from a parsing thread. */
+static void *
+parse_job (void *ptr_data)
+{
+  GJob *job = (GJob *) ptr_data;
+  GJobLine *jline = NULL;
+  int i;
 
-out:
-  free (line);
-  return test || ret;
+  for (i = 0; i < job->cnt; ++i) {
+    jline = &job->lines[i];
+    jline->logitem = new_log_item (job->arena);
+    jline->ret = parse_line (jline, &job->dcache, job->dry_run);
+  }
+
+  return NULL;
 }
-#endif
 
-/* Iterate over the log and read line by line (uses a buffer of fixed size).
+/* Release all the lines within the given batch along with its arena. */
+static void
+reset_job (GJob * job)
+{
+  reset_arena (job->arena);
+  job->cnt = 0;
+  job->buf_len = 0;
+}
+
+/* Read up to JOB_LINES lines from the log into the given batch. Lines are
+ * copied one after another into the batch buffer.
+ *
+ * If no more lines are available to read, 1 is returned.
+ * Otherwise 0 is returned. */
+static int
+fill_job (GFile * file, GJob * job)
+{
+  GJobLine *jline = NULL;
+  char *line = NULL, *ptr = NULL;
+  size_t len = 0;
+  int i, eof = 0;
+
+  while (job->cnt < JOB_LINES) {
+    if ((line = next_line (file, &len)) == NULL) {
+      eof = 1;
+      break;
+    }
+
+    if (job->buf_len + len + 1 > job->buf_size) {
+      job->buf_size = job->buf_size * 2 + len + 1;
+      job->buf = xrealloc (job->buf, job->buf_size);
+    }
+    memcpy (job->buf + job->buf_len, line, len + 1);
+    job->buf_len += len + 1;
+
+    jline = &job->lines[job->cnt++];
+    memset (jline, 0, sizeof (*jline));
+    jline->len = len;
+  }
+
+  /* the buffer may have moved, so point lines to it once filled */
+  for (i = 0, ptr = job->buf; i < job->cnt; ptr += job->lines[i++].len + 1)
+    job->lines[i].line = ptr;
+
+  return eof;
+}
+
+/* Iterate over the log and read JOB_LINES lines per parsing thread.
+ * Each thread parses its own batch of lines concurrently, then the
+ * parsed lines are applied to the storage in the order they were read.
  *
  * On error, 1 is returned.
  * On success, 0 is returned. */
-#ifndef WITH_GETLINE
 static int
-read_lines (FILE * fp, GLog ** glog, int dry_run)
+read_lines_jobs (GFile * file, GLog ** glog, int dry_run)
 {
-  char *s = NULL;
-  char line[LINE_BUFFER] = { 0 };
+  GJob *jobs = NULL;
+  GJobLine *jline = NULL;
   int ret = 0, cnt = 0, test = conf.num_tests > 0 ? 1 : 0;
+  int i, j, eof = 0, stop = 0, res = 0;
 
-  while ((s = fgets (line, LINE_BUFFER, fp)) != NULL) {
-    /* handle SIGINT */
-    if (conf.stop_processing)
-      break;
-    if ((ret = read_line ((*glog), line, &test, &cnt, dry_run)))
-      break;
-    if (dry_run && NUM_TESTS == cnt)
-      break;
+  jobs = xcalloc (conf.jobs, sizeof (GJob));
+  for (i = 0; i < conf.jobs; ++i) {
+    jobs[i].lines = xcalloc (JOB_LINES, sizeof (GJobLine));
+    jobs[i].arena = new_arena ();
+    jobs[i].dry_run = dry_run;
   }
 
-  /* if no data was available to read from (probably from a pipe) and
-   * still in test mode, we simply return until data becomes available */
-  if (!s && (errno == EAGAIN || errno == EWOULDBLOCK) && test)
-    return 0;
+  while (!eof && !ret && !stop) {
+    for (i = 0; i < conf.jobs && !eof; ++i)
+      eof = fill_job (file, &jobs[i]);
+
+    /* parse all batches, fall back to the current thread if unable to
+     * spawn a new one */
+    for (i = 0; i < conf.jobs; ++i) {
+      if (jobs[i].cnt == 0)
+        continue;
+      if (pthread_create (&jobs[i].thread, NULL, parse_job, &jobs[i]) != 0) {
+        jobs[i].thread = pthread_self ();
+        parse_job (&jobs[i]);
+      }
+    }
+    for (i = 0; i < conf.jobs; ++i) {
+      if (jobs[i].cnt && !pthread_equal (jobs[i].thread, pthread_self ()))
+        pthread_join (jobs[i].thread, NULL);
+    }
+
+    /* merge stage, apply parsed lines in order */
+    for (i = 0; i < conf.jobs && !ret && !stop; ++i) {
+      for (j = 0; j < jobs[i].cnt; ++j) {
+        /* handle SIGINT */
+        if ((stop = conf.stop_processing))
+          break;
+
+        jline = &jobs[i].lines[j];
+        res = jline->ret == -1 ? -1 : apply_line ((*glog), jline, dry_run);
+        if ((ret = test_line ((*glog), res, &test, &cnt)))
+          break;
+      }
+    }
+    (*glog)->items = NULL;
 
-  return (s && test) || ret;
+    for (i = 0; i < conf.jobs; ++i)
+      reset_job (&jobs[i]);
+  }
+
+  for (i = 0; i < conf.jobs; ++i) {
+    free (jobs[i].lines);
+    free (jobs[i].buf);
+    free_arena (jobs[i].arena);
+  }
+  free (jobs);
+
+  return (stop && test) || ret;
+}
+
+/* Build the key identifying the given log across runs out of its device
+ * and inode, so a log is still recognized once rotated (renamed).
+ * Compressed logs are not tracked as they can't be seeked into.
+ *
+ * If it's not a regular (uncompressed) file, 1 is returned.
+ * On success, 0 is returned and st is filled. */
+static int
+get_last_parse_key (GFile * file, char *key, struct stat *st)
+{
+  if (file->decomp || fstat (file->fd, st) == -1 || !S_ISREG (st->st_mode))
+    return 1;
+
+  snprintf (key, LAST_PARSE_LEN, "%llu:%llu",
+            (unsigned long long) st->st_dev, (unsigned long long) st->st_ino);
+
+  return 0;
+}
+
+/* Hash the first bytes of the given log and the bytes right before the
+ * given offset. The same bytes are expected at both ends as long as the
+ * log was only appended to. */
+static void
+hash_last_parse (GFile * file, uint64_t offset, GLastParse * lp)
+{
+  size_t len = offset < GFILE_HASH_LEN ? offset : GFILE_HASH_LEN;
+
+  lp->offset = offset;
+  lp->head = gfile_hash (file, 0, len);
+  lp->tail = gfile_hash (file, offset - len, len);
+}
+
+/* Record how far the given log was read (up to its last full line), so
+ * a later run loading the storage only reads what was appended since. */
+void
+set_last_parse (GFile * file)
+{
+  GLastParse lp;
+  struct stat st;
+  char key[LAST_PARSE_LEN];
+
+  if (get_last_parse_key (file, key, &st))
+    return;
+
+  hash_last_parse (file, file->mark, &lp);
+  ht_insert_last_parse (key, &lp);
+}
+
+/* Resume reading the given log from where a previous run left off,
+ * unless it was truncated or replaced since then, in which case it is
+ * read from the beginning. */
+static void
+resume_last_parse (GFile * file)
+{
+  GLastParse lp, cur;
+  struct stat st;
+  char key[LAST_PARSE_LEN];
+
+  if (get_last_parse_key (file, key, &st) || ht_get_last_parse (key, &lp))
+    return;
+
+  /* truncated, e.g., copytruncate */
+  if (lp.offset > (uint64_t) st.st_size)
+    return;
+  /* same inode, different content */
+  hash_last_parse (file, lp.offset, &cur);
+  if (cur.head != lp.head || cur.tail != lp.tail)
+    return;
+
+  gfile_seek (file, lp.offset);
 }
-#endif
 
-/* Read the given log line by line and process its data.
+/* Determine if the logs can be memory-mapped as they're read. Logs
+ * followed once parsed, i.e., onto the terminal or a real-time HTML
+ * report, are live ones that may be truncated meanwhile, e.g., by
+ * logrotate's copytruncate, so they're read through read(2) instead.
+ *
+ * If they can be mapped, 1 is returned, else 0. */
+static int
+map_logs (void)
+{
+  return conf.process_and_exit || (conf.output_stdout && !conf.real_time_html);
+}
+
+/* Read the given log line by line and process its data. If the log was
+ * not opened ahead, it's opened here.
  *
  * On error, 1 is returned.
  * On success, 0 is returned. */
 static int
-read_log (GLog ** glog, const char *fn, int dry_run)
+read_log (GLog ** glog, const char *fn, GFile * file, int dry_run)
 {
-  FILE *fp = NULL;
-  int piping = 0;
+  int piping = 0, ret = 0, err = 0;
 
   /* Ensure we have a valid pipe to read from stdin. Only checking for
    * conf.read_stdin without verifying for a valid FILE pointer would certainly
    * lead to issues. */
   if (fn[0] == '-' && fn[1] == '\0' && (*glog)->pipe) {
-    fp = (*glog)->pipe;
+    /* the reader is kept around as it may hold an incomplete line */
+    if (!(*glog)->pipe_file)
+      (*glog)->pipe_file = gfile_drain (fileno ((*glog)->pipe));
+    file = (*glog)->pipe_file;
     (*glog)->piping = piping = 1;
   }
 
   /* make sure we can open the log (if not reading from stdin) */
-  if (!piping && (fp = fopen (fn, "r")) == NULL)
+  if (!piping && !file && (file = gfile_open (fn, map_logs ())) == NULL) {
+    if (errno == ENOTSUP)
+      FATAL ("Unable to read %s. Built without support for its compression.",
+             fn);
     FATAL ("Unable to open the specified log file. %s", strerror (errno));
-
-  /* read line by line */
-  if (read_lines (fp, glog, dry_run)) {
-    if (!piping)
-      fclose (fp);
-    return 1;
   }
 
+  /* skip what was parsed by a previous run, if the storage was loaded */
+  if (!piping && !dry_run && (conf.load_from_disk || conf.restore_snapshot))
+    resume_last_parse (file);
+
+  /* read line by line, or in batches when using multiple parsing threads */
+  if (conf.jobs > 1 && !dry_run)
+    ret = read_lines_jobs (file, glog, dry_run);
+  else
+    ret = read_lines (file, glog, dry_run);
+
+  /* a truncated or corrupted compressed log */
+  if (file->decomp && !conf.stop_processing && !dry_run)
+    err = gdecomp_error (file->decomp);
+
   /* close log file if not a pipe */
-  if (!piping)
-    fclose (fp);
+  if (!piping) {
+    if (!dry_run)
+      set_last_parse (file);
+    gfile_close (file);
+  }
+
+  if (err)
+    FATAL ("Unable to decompress the log file %s. %s", fn, strerror (err));
+
+  return ret ? 1 : 0;
+}
+
+/* Compare two sampled keys, by key and then by unique visitor key.
+ *
+ * On success, the comparison result is returned as in strcmp. */
+static int
+cmp_sample_key (const void *a, const void *b)
+{
+  const GSampleKey *ka = a, *kb = b;
+  int ret = strcmp (ka->key, kb->key);
+
+  if (ret != 0 || ka->uniq == kb->uniq)
+    return ret;
+  if (!ka->uniq || !kb->uniq)
+    return ka->uniq ? 1 : -1;
+  return strcmp (ka->uniq, kb->uniq);
+}
+
+/* Estimate the num of distinct keys of the whole log out of the given
+ * sampled keys (sorted in place), where scale is the ratio of the size
+ * of the log to the sample. Through the GEE estimator, keys seen once
+ * in the sample are scaled by its square root, while keys seen more
+ * than once are assumed to be all the keys of their kind.
+ *
+ * On success, the estimated num of distinct keys is returned. */
+static uint32_t
+estimate_distinct (GSampleKey * keys, uint32_t n, double scale)
+{
+  uint32_t i, j, distinct = 0, once = 0;
+  double est = 0;
+
+  if (n == 0)
+    return 0;
+
+  qsort (keys, n, sizeof (GSampleKey), cmp_sample_key);
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1; j < n && cmp_sample_key (&keys[i], &keys[j]) == 0; j++);
+    distinct++;
+    if (j - i == 1)
+      once++;
+  }
+
+  est = sqrt (scale) * once + (distinct - once);
+  if (est > n * scale)
+    est = n * scale;
+
+  return est >= UINT32_MAX ? UINT32_MAX : (uint32_t) est;
+}
+
+/* Add a key to the given array of sampled keys, allocating it first if
+ * needed. */
+static void
+sample_key (GSampleKey ** keys, uint32_t * len, uint32_t max,
+            const char *key, const char *uniq)
+{
+  if (*keys == NULL)
+    *keys = xcalloc (max, sizeof (GSampleKey));
+  (*keys)[*len].key = key;
+  (*keys)[*len].uniq = uniq;
+  (*len)++;
+}
+
+/* Add the keys generated for each module out of a parsed line to the
+ * sample. Unique visitor keys are added as process_log would. */
+static void
+sample_line (GSample * sample, GJobLine * jline)
+{
+  GLogItem *logitem = jline->logitem;
+  GKeyData *kdata = NULL;
+  GModule module;
+  const GParse *parse = NULL;
+  size_t idx = 0;
+  int uniq = 0;
+
+  if (logitem->uniq_key)
+    sample_key (&sample->visitors, &sample->nvisitors, sample->max,
+                logitem->uniq_key, NULL);
+  uniq = logitem->uniq_key && include_uniq (logitem);
+
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    kdata = &jline->kdata[module];
+    if (!(parse = panel_lookup (module)) || !parse->datamap)
+      continue;
+    if (jline->kstate[module] != KEY_FOUND || !kdata->data_key)
+      continue;
+
+    sample_key (&sample->keys[module], &sample->nkeys[module], sample->max,
+                kdata->data_key, NULL);
+    if (parse->visitor && uniq)
+      sample_key (&sample->uniqs[module], &sample->nuniqs[module],
+                  sample->max, kdata->data_key, logitem->uniq_key);
+  }
+}
+
+/* Parse the first lines of the given log into the given sample. Lines
+ * and their keys are allocated out of the given arena. */
+static void
+sample_log (GSample * sample, GArena * arena, const char *fn)
+{
+  GJobLine jline;
+  GFile *file = NULL;
+  char *line = NULL;
+  size_t len = 0;
+  uint32_t lines = 0;
+
+  /* the log is opened again, and reported if failing, once parsed */
+  if ((file = gfile_open (fn, map_logs ())) == NULL)
+    return;
+
+  while (lines++ < sample->max && (line = gfile_getline (file, &len))) {
+    sample->bytes += len + 1;
+
+    memset (&jline, 0, sizeof (jline));
+    jline.line = arena_strdup (arena, line);
+    jline.len = len;
+    jline.logitem = new_log_item (arena);
+
+    if (parse_line (&jline, &main_dcache, 0) != 0)
+      continue;
+    if (jline.ignorelevel == IGNORE_LEVEL_PANEL)
+      continue;
+    sample_line (sample, &jline);
+  }
+  gfile_close (file);
+}
+
+/* Presize the storage out of a sample of the first lines of the first
+ * regular file among the logs, given the size of all of them. This
+ * avoids growing and rehashing the hash tables while parsing. */
+static void
+presize_storage (void)
+{
+  GSample sample;
+  GArena *arena = NULL;
+  GModule module;
+  struct stat st;
+  const char *fn = NULL;
+  double scale = 0;
+  uint64_t size = 0, strings = 0;
+  uint32_t keys = 0, uniqs = 0;
+  size_t idx = 0;
+  int i;
+
+  for (i = 0; i < conf.filenames_idx; ++i) {
+    if (stat (conf.filenames[i], &st) != 0 || !S_ISREG (st.st_mode))
+      continue;
+    size += st.st_size;
+    if (fn == NULL)
+      fn = conf.filenames[i];
+  }
+  if (fn == NULL || size == 0)
+    return;
+
+  memset (&sample, 0, sizeof (sample));
+  sample.max = conf.num_tests > PRESIZE_LINES ? conf.num_tests : PRESIZE_LINES;
+  arena = new_arena ();
+  sample_log (&sample, arena, fn);
+  if (sample.bytes == 0)
+    goto clean;
+
+  if ((scale = (double) size / sample.bytes) < 1)
+    scale = 1;
+
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    keys = estimate_distinct (sample.keys[module], sample.nkeys[module],
+                              scale);
+    uniqs = estimate_distinct (sample.uniqs[module], sample.nuniqs[module],
+                               scale);
+    ht_presize_module (module, keys, uniqs);
+    strings += keys;
+    LOG_DEBUG (("Presized module %d: %u keys, %u unique keys\n", module,
+                keys, uniqs));
+  }
+  keys = estimate_distinct (sample.visitors, sample.nvisitors, scale);
+  ht_presize_storage (keys, strings >= UINT32_MAX ? UINT32_MAX : strings);
+  LOG_DEBUG (("Presized storage: %u visitors, %llu strings\n", keys,
+              (unsigned long long) strings));
+
+clean:
+  for (module = 0; module < TOTAL_MODULES; module++) {
+    free (sample.keys[module]);
+    free (sample.uniqs[module]);
+  }
+  free (sample.visitors);
+  free_arena (arena);
+}
+
+/* Parse the data appended to the given log (or piped) since it was last
+ * read. Lines are parsed in batches of JOB_LINES outside of the given
+ * lock, which is then held once per batch to apply them to the storage.
+ *
+ * If the log format is not compiled yet, it is done first. */
+void
+parse_tail (GLog ** glog, GFile * file, pthread_mutex_t * mutex)
+{
+  GJob job;
+  GJobLine *jline = NULL;
+  int i, eof = 0;
+
+  if (logfmt_prog == NULL && conf.log_format)
+    get_log_format_prog ();
+
+  memset (&job, 0, sizeof (job));
+  job.lines = xmalloc (JOB_LINES * sizeof (GJobLine));
+  job.arena = new_arena ();
+
+  while (!eof && !conf.stop_processing) {
+    if ((eof = fill_job (file, &job)) && job.cnt == 0)
+      break;
+    parse_job (&job);
+
+    pthread_mutex_lock (mutex);
+    for (i = 0; i < job.cnt; ++i) {
+      jline = &job.lines[i];
+      if (jline->ret != -1)
+        apply_line ((*glog), jline, 0);
+    }
+    (*glog)->items = NULL;
+    pthread_mutex_unlock (mutex);
+
+    reset_job (&job);
+  }
+
+  free (job.lines);
+  free (job.buf);
+  free_arena (job.arena);
+}
+
+/* Open the compressed logs following the given one on the command line,
+ * up to one per parsing thread, so each of them is decompressed by its
+ * own thread while the current one is parsed. */
+static void
+open_logs_ahead (GFile ** files, int idx)
+{
+  int i, ahead = conf.jobs > 1 ? conf.jobs : 1;
+  const char *fn = NULL;
+
+  for (i = idx + 1; i < conf.filenames_idx && i <= idx + ahead; ++i) {
+    fn = conf.filenames[i];
+    if (files[i] || (fn[0] == '-' && fn[1] == '\0') || !gfile_compressed (fn))
+      continue;
+    /* if unable to open it, it's reported once its turn comes */
+    files[i] = gfile_open (fn, map_logs ());
+  }
+}
+
+#ifndef HAVE_LIBTOKYOCABINET
+/* Drop the snapshot of the given shard. */
+static void
+free_shard (GShard * shard)
+{
+  if (!shard->path)
+    return;
+
+  unlink (shard->path);
+  free (shard->path);
+  shard->path = NULL;
+}
+
+/* Parse the given log on a child process, into a storage of its own,
+ * and persist it into the snapshot of the given shard. Logs parsed by a
+ * previous run are only read from where it left off. Errors are not
+ * reported by the child, the log is parsed again right away instead,
+ * see parse_shards(). */
+static void
+spawn_shard (GLog * glog, const char *fn, GShard * shard)
+{
+  GFile *file = NULL;
+  int devnull;
+
+  /* stdin is read right away, once its turn comes */
+  if ((fn[0] == '-' && fn[1] == '\0') ||
+      !(shard->path = new_tmp_path ("shard")))
+    return;
+
+  /* the spinner lock can't be left held by its thread, gone on the
+   * child, and nothing buffered is written twice, e.g., on exit */
+  fflush (stdout);
+  lock_spinner ();
+  shard->pid = fork ();
+  unlock_spinner ();
+
+  if (shard->pid == -1) {
+    shard->pid = 0;
+    free_shard (shard);
+    return;
+  }
+  if (shard->pid > 0)
+    return;
+
+  signal (SIGINT, SIG_DFL);
+  signal (SIGTERM, SIG_DFL);
+  if ((devnull = open ("/dev/null", O_WRONLY)) != -1)
+    dup2 (devnull, STDERR_FILENO);
+
+  if (!(file = gfile_open (fn, map_logs ())))
+    _exit (EXIT_FAILURE);
+  /* the storage loaded tells where a previous run left off */
+  if (conf.load_from_disk || conf.restore_snapshot)
+    resume_last_parse (file);
+
+  free_storage ();
+  init_storage ();
+  reset_struct (glog);
+  glog->excluded_ip = 0;
+
+  if (read_log (&glog, fn, file, 0) || conf.stop_processing ||
+      ht_persist_snapshot (shard->path, glog))
+    _exit (EXIT_FAILURE);
+  _exit (EXIT_SUCCESS);
+}
+
+/* Wait for the child parsing the given shard, if any.
+ *
+ * On error, i.e., if the child failed, 1 is returned.
+ * On success, 0 is returned. */
+static int
+reap_shard (GShard * shard)
+{
+  int status = 0;
+
+  if (shard->pid > 0) {
+    while (waitpid (shard->pid, &status, 0) == -1 && errno == EINTR) {
+      /* stopped while waiting for it */
+      if (conf.stop_processing)
+        kill (shard->pid, SIGTERM);
+    }
+    shard->pid = 0;
+  }
+
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0 ? 0 : 1;
+}
+
+/* Stop the children parsing the given range of shards, and drop their
+ * snapshots. */
+static void
+drop_shards (GShard * shards, int from, int to)
+{
+  int i;
+
+  for (i = from; i < to; ++i) {
+    if (shards[i].pid > 0)
+      kill (shards[i].pid, SIGTERM);
+    reap_shard (&shards[i]);
+    free_shard (&shards[i]);
+  }
+}
+
+/* Merge the given shard into the storage. If the log was not parsed on
+ * a shard, it's parsed right away instead.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+merge_shard (GLog ** glog, const char *fn, GShard * shard)
+{
+  const char *err = NULL;
+  int ret = 0;
+
+  if (!shard->path)
+    return read_log (glog, fn, NULL, 0);
+
+  lock_spinner ();
+  ret = ht_merge_snapshot (shard->path, *glog, 1, &err);
+  unlock_spinner ();
+  free_shard (shard);
+
+  if (ret)
+    FATAL ("Unable to merge the shard of %s. %s", fn, err);
 
   return 0;
 }
 
+/* Parse each log on a shard of its own, up to --shards of them at once,
+ * and merge them in the order they were given, as if they were parsed
+ * one after the other.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+parse_shards (GLog ** glog)
+{
+  GShard *shards = NULL;
+  int i, next = 0, ret = 0;
+
+  shards = xcalloc (conf.filenames_idx, sizeof (GShard));
+  for (i = 0; i < conf.filenames_idx && !ret; ++i) {
+    /* keep up to --shards logs being parsed, this one included */
+    for (; next < conf.filenames_idx && next - i < conf.shards; ++next)
+      spawn_shard (*glog, conf.filenames[next], &shards[next]);
+
+    /* a failed shard is parsed again right away to report its errors,
+     * which may be fatal, so the shards in flight are spawned again */
+    if (reap_shard (&shards[i])) {
+      drop_shards (shards, i, next);
+      next = i + 1;
+    }
+    if (conf.stop_processing)
+      break;
+    if ((ret = merge_shard (glog, conf.filenames[i], &shards[i])))
+      fprintf (stderr, "%s\n", conf.filenames[i]);
+  }
+
+  /* stopped, or failed, the shards in flight are dropped */
+  drop_shards (shards, i, next);
+  free (shards);
+
+  return ret;
+}
+#endif
+
 /* Entry point to parse the log line by line.
  *
  * On error, 1 is returned.
@@ -2748,11 +4088,14 @@ read_log (GLog ** glog, const char *fn, int dry_run)
 int
 parse_log (GLog ** glog, char *tail, int dry_run)
 {
+  GFile **files = NULL;
   const char *err_log = NULL;
-  int i;
+  int i, ret = 0;
 
   /* process tail data and return */
   if (tail != NULL) {
+    if (logfmt_prog == NULL && conf.log_format)
+      get_log_format_prog ();
     /* no line testing on tail */
     if (pre_process_log ((*glog), tail, dry_run))
       return 1;
@@ -2762,21 +4105,39 @@ parse_log (GLog ** glog, char *tail, int dry_run)
   /* verify that we have the required formats */
   if ((err_log = verify_formats ()))
     FATAL ("%s", err_log);
+  /* compile the log format once, before any line is parsed */
+  get_log_format_prog ();
 
   /* no data piped, no logs passed, load from disk only then */
-  if (conf.load_from_disk && !conf.filenames_idx && !conf.read_stdin) {
+  if ((conf.load_from_disk || conf.restore_snapshot ||
+       conf.merge_snapshot_idx) && !conf.filenames_idx && !conf.read_stdin) {
     (*glog)->load_from_disk_only = 1;
     return 0;
   }
 
-  for (i = 0; i < conf.filenames_idx; ++i) {
-    if (read_log (glog, conf.filenames[i], dry_run)) {
+  /* size the storage up front out of a sample of the logs */
+  if ((conf.presize_tables || conf.tune_auto) && !dry_run)
+    presize_storage ();
+
+#ifndef HAVE_LIBTOKYOCABINET
+  if (conf.shards > 1 && conf.filenames_idx > 1 && !conf.time_window &&
+      !conf.split_vhost_dir && !dry_run)
+    return parse_shards (glog);
+#endif
+
+  files = xcalloc (conf.filenames_idx, sizeof (GFile *));
+  for (i = 0; i < conf.filenames_idx && !ret; ++i) {
+    if (!dry_run)
+      open_logs_ahead (files, i);
+    if ((ret = read_log (glog, conf.filenames[i], files[i], dry_run)))
       fprintf (stderr, "%s\n", conf.filenames[i]);
-      return 1;
-    }
+    files[i] = NULL;
   }
+  for (; i < conf.filenames_idx; ++i)
+    gfile_close (files[i]);
+  free (files);
 
-  return 0;
+  return ret;
 }
 
 /* Ensure we have valid hits
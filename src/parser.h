@@ -35,17 +35,40 @@
 #define LINE_BUFFER     4096    /* read at most this num of chars */
 #define NUM_TESTS       20      /* test this many lines from the log */
 #define MAX_LOG_ERRORS  20
+#define JOB_LINES       1024    /* lines handed to each parsing thread */
+#define PRESIZE_LINES   10000   /* lines sampled to presize the storage */
+#define LAST_PARSE_LEN  64      /* max length of a log high-water mark key */
+#define WINDOW_SEGMENTS 12      /* segments a time window is split into */
+#define STATIC_EXT_SLOTS 256    /* slots of the static extensions set */
+
+/* optional fields extracted out of a log line, see init_needed_fields() */
+#define FIELD_KEYPHRASE 0x1     /* keyphrase out of the referrer */
+#define FIELD_REF_SITE  0x2     /* referring site out of the referrer */
+#define FIELD_REFERRER  0x4     /* referrer, cut past a search keyphrase */
+#define FIELD_ALL       (FIELD_KEYPHRASE | FIELD_REF_SITE | FIELD_REFERRER)
 
 #define LINE_LEN        23
 #define ERROR_LEN       255
 #define REF_SITE_LEN    511     /* maximum length of a referring site */
+#define DATE_TKN_LEN    64      /* max length of a cached date/time token */
 
 #define SPEC_TOKN_SET   0x1
 #define SPEC_TOKN_NUL   0x2
 #define SPEC_TOKN_INV   0x3
 #define SPEC_SFMT_MIS   0x4
 
+/* compiled log format instructions */
+#define LFMT_OP_LITERAL 0x1     /* skip cnt chars of the log line */
+#define LFMT_OP_SPEC    0x2     /* %x specifier */
+#define LFMT_OP_SPECIAL 0x3     /* ~x special specifier */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+
 #include "commons.h"
+#include "garena.h"
+#include "gfile.h"
 
 /* Log properties. Note: This is per line parsed */
 typedef struct GLogItem_
@@ -78,12 +101,17 @@ typedef struct GLogItem_
   uint64_t serve_time;
 
   int type_ip;
+  int status_code;              /* out of status, 0 if none */
   int is_404;
   int is_static;
+  int is_excluded;
   int uniq_nkey;
   int agent_nkey;
+  uint64_t uniq_hkey[2];        /* hash of uniq_key, see --hash-visitor-keys */
+  int64_t minutes;              /* since the epoch, see --time-window */
 
   char *errstr;
+  GArena *arena;                /* strings are allocated from it */
 } GLogItem;
 
 /* Overall parsed log properties */
@@ -103,6 +131,7 @@ typedef struct GLog_
   char **errors;
 
   FILE *pipe;
+  GFile *pipe_file;             /* reader on top of the pipe */
 } GLog;
 
 /* Raw data field type */
@@ -141,10 +170,12 @@ typedef struct GKeyData_
   void *data;
   void *data_key;
   int data_nkey;
+  int data_code;                /* bounded domain code, 0 if none */
 
   void *root;
   void *root_key;
   int root_nkey;
+  int root_code;                /* bounded domain code, 0 if none */
 
   void *uniq_key;
   int uniq_nkey;
@@ -170,16 +201,171 @@ typedef struct GParse_
   void (*agent) (int data_nkey, int agent_nkey, GModule module);
 } GParse;
 
-char *fgetline (FILE * fp);
+/* Sets the data metrics of a module out of a log line, see
+ * init_datamap_kernels() */
+typedef void (*GDatamapKernel) (const GLogItem * logitem,
+                                const GKeyData * kdata, GModule module);
+
+/* A single instruction of a compiled log format */
+typedef struct GLogFmtOp_
+{
+  int op;                       /* LFMT_OP_* */
+  char spec;                    /* specifier, e.g., 'h' */
+  char end[2 + 1];              /* delimiter(s) following the specifier */
+  int cnt;                      /* num of chars to skip, or delims to match */
+  char *skips;                  /* XFF reject set, e.g., ~h{, } */
+} GLogFmtOp;
+
+/* A log format compiled once into a list of instructions, so it doesn't
+ * need to be interpreted for every single line */
+typedef struct GLogFmtProg_
+{
+  char *log_format;             /* log format it was compiled from */
+  char *date_format;            /* date format it was compiled with */
+  GLogFmtOp *ops;
+  int len;                      /* number of instructions */
+} GLogFmtProg;
+
+/* Last decoded date/time token and its formatted values */
+typedef struct GDateCacheItem_
+{
+  char tkn[DATE_TKN_LEN];       /* token as found in the log */
+  char date[DATE_LEN];          /* numeric date, e.g., 20181001 */
+  char time[TIME_LEN];          /* time, e.g., 10:10:10 */
+} GDateCacheItem;
+
+/* Last decoded %d, %t and %x tokens, consecutive lines almost always
+ * share the same timestamp. There's one per parsing thread. */
+typedef struct GDateCache_
+{
+  unsigned int gen;             /* compiled log format it belongs to */
+  GDateCacheItem date;
+  GDateCacheItem time;
+  GDateCacheItem ts;
+} GDateCache;
+
+/* A log line read by the main thread, parsed by a worker thread and
+ * later applied to the storage (in order) by the main thread */
+typedef struct GJobLine_
+{
+  char *line;
+  size_t len;                   /* length of the line */
+  GLogItem *logitem;
+  int ret;                      /* result of parsing the line */
+  int ignorelevel;              /* IGNORE_LEVEL_PANEL or IGNORE_LEVEL_REQ */
+
+  /* keys generated for each module, KEY_FOUND if the module applies */
+  GKeyData kdata[TOTAL_MODULES];
+  int kstate[TOTAL_MODULES];
+} GJobLine;
+
+/* A key seen while sampling the log to presize the storage */
+typedef struct GSampleKey_
+{
+  const char *key;
+  const char *uniq;             /* unique visitor key, if any */
+} GSampleKey;
+
+/* Keys sampled from the first lines of the log to presize the storage.
+ * Each sampled line adds at most one key to each array. */
+typedef struct GSample_
+{
+  GSampleKey *keys[TOTAL_MODULES];      /* data keys of each module */
+  GSampleKey *uniqs[TOTAL_MODULES];     /* visitor/data key pairs */
+  GSampleKey *visitors;         /* unique visitor keys */
+  uint32_t nkeys[TOTAL_MODULES];
+  uint32_t nuniqs[TOTAL_MODULES];
+  uint32_t nvisitors;
+  uint32_t max;                 /* max num of lines sampled */
+  uint64_t bytes;               /* num of bytes sampled */
+} GSample;
+
+/* How far a log file was read, kept along the storage (keyed by device
+ * and inode) so a later run only reads what was appended since then */
+typedef struct GLastParse_
+{
+  uint64_t offset;              /* file offset past the last full line */
+  uint32_t head;                /* hash of the first bytes of the log */
+  uint32_t tail;                /* hash of the bytes before the offset */
+} GLastParse;
+
+/* A batch of log lines handled by a single parsing thread */
+typedef struct GJob_
+{
+  pthread_t thread;
+  GArena *arena;                /* log items of the batch */
+  GDateCache dcache;
+  GJobLine *lines;
+  int cnt;                      /* number of lines in the batch */
+  int dry_run;
+
+  /* lines of the batch, stored contiguously */
+  char *buf;
+  size_t buf_size;
+  size_t buf_len;
+} GJob;
+
+/* A log parsed into a storage of its own by a child process, and
+ * persisted into a snapshot to be merged once its turn comes */
+typedef struct GShard_
+{
+  pid_t pid;                    /* 0 if parsed right away */
+  char *path;                   /* snapshot of the shard */
+} GShard;
+
+/* A closed segment of the time window, persisted into a snapshot */
+typedef struct GSegment_
+{
+  int64_t start;                /* minutes since the epoch */
+  char *path;                   /* snapshot of the segment */
+} GSegment;
+
+/* The time window kept by the storage, see --time-window. Lines are
+ * added to the storage in use and to the segment being filled on the
+ * side. Once the oldest segments fall out of the window, the storage
+ * is built again out of the ones left. */
+typedef struct GWindow_
+{
+  struct GKHashState_ *state;   /* storage of the segment being filled */
+  int64_t start;                /* minutes since the epoch */
+  int64_t seg_len;              /* minutes per segment */
+  GLog base;                    /* overall counters as the segment began */
+
+  GSegment segs[WINDOW_SEGMENTS];       /* closed segments, oldest first */
+  int len;
+} GWindow;
+
+/* A virtual host parsed into a report of its own, see --split-by-vhost.
+ * Its lines are added to the storage in use and to its own storage on
+ * the side. */
+typedef struct GVhostSplit_
+{
+  char *vhost;
+  struct GKHashState_ *state;   /* storage of the virtual host */
+  GLog counters;                /* overall counters of its lines */
+} GVhostSplit;
+
 char **test_format (GLog * glog, int *len);
 GLog *init_log (void);
+GVhostSplit *get_vhost_splits (int *len);
 GLogItem *init_log_item (GLog * glog);
 GRawDataItem *new_grawdata_item (unsigned int size);
 GRawData *new_grawdata (void);
+void init_datamap_kernels (void);
+void init_needed_fields (void);
+void init_static_files (void);
+int parse_format_line (char *line);
 int parse_log (GLog ** glog, char *tail, int dry_run);
+void parse_tail (GLog ** glog, GFile * file, pthread_mutex_t * mutex);
+void free_log_format_prog (void);
+void free_static_files (void);
+void free_time_window (void);
+void free_vhost_splits (void);
+void free_parse_arena (void);
 void free_logerrors (GLog * glog);
 void free_raw_data (GRawData * raw_data);
 void output_logerrors (GLog * glog);
 void reset_struct (GLog * glog);
+void set_last_parse (GFile * file);
 
 #endif
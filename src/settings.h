@@ -41,8 +41,18 @@
 #define MAX_IGNORE_STATUS      64
 #define MAX_OUTFORMATS          3
 #define MAX_FILENAMES         512
+#define MAX_JOBS               64
+#define MAX_RESOLVER_THREADS   64
 #define NO_CONFIG_FILE "No config file used"
 
+/* --csv-stream formats */
+#define CSV_STREAM              1
+#define TSV_STREAM              2
+
+/* --html-lazy-panels formats */
+#define LAZY_PANELS_JSON        1
+#define LAZY_PANELS_GZIP        2
+
 typedef enum LOGTYPE
 {
   COMBINED,
@@ -98,8 +108,10 @@ typedef struct GConf_
   const char *enable_panels[TOTAL_MODULES];     /* array of panels to enable */
   const char *filenames[MAX_FILENAMES];         /* log files */
   const char *hide_referers[MAX_IGNORE_REF];    /* hide referrers from report */
+  const char *hitter_panels[TOTAL_MODULES];     /* heavy hitters panels */
   const char *ignore_ips[MAX_IGNORE_IPS];       /* array of ips to ignore */
   const char *ignore_panels[TOTAL_MODULES];     /* array of panels to ignore */
+  const char *merge_snapshots[MAX_FILENAMES];   /* snapshots to merge */
   const char *ignore_referers[MAX_IGNORE_REF];  /* referrers to ignore */
   const char *ignore_status[MAX_IGNORE_STATUS]; /* status to ignore */
   const char *output_formats[MAX_OUTFORMATS];   /* output format, e.g. , HTML */
@@ -118,12 +130,17 @@ typedef struct GConf_
 
   const char *debug_log;            /* debug log path */
   const char *geoip_database;       /* geoip db path */
+  const char *html_assets_dir;      /* shared CSS/JS assets dir */
+  const char *html_assets_url;      /* URL of the shared assets */
   const char *html_custom_css;      /* custom CSS */
   const char *html_custom_js;       /* custom JS */
   const char *html_prefs;           /* default HTML JSON preferences */
   const char *html_report_title;    /* report title */
   const char *invalid_requests_log; /* invalid lines log path */
+  const char *persist_snapshot;     /* snapshot path to persist into */
   const char *pidfile;              /* daemonize pid file path */
+  const char *restore_snapshot;     /* snapshot path to restore from */
+  const char *split_vhost_dir;      /* dir of the reports per vhost */
   const char *browsers_file;        /* browser's file path */
 
   /* HTML real-time */
@@ -142,15 +159,23 @@ typedef struct GConf_
   int anonymize_ip;                 /* anonymize ip addresses */
   int append_method;                /* append method to the req key */
   int append_protocol;              /* append protocol to the req key */
+  int approx_visitors;              /* estimate unique visitors */
+  int bench_agents;                 /* distinct agents to benchmark */
+  int bench_hosts;                  /* distinct hosts to benchmark */
+  int bench_urls;                   /* distinct URLs to benchmark */
   int client_err_to_unique_count;   /* count 400s as visitors */
   int code444_as_404;               /* 444 as 404s? */
   int color_scheme;                 /* color scheme */
   int crawlers_only ;               /* crawlers only */
+  int csv_stream;                   /* stream the CSV output as CSV/TSV */
   int daemonize;                    /* run program as a Unix daemon */
   int double_decode;                /* need to double decode */
   int enable_html_resolver;         /* html/json/csv resolver */
   int geo_db;                       /* legacy geoip db */
+  int html_lazy_panels;             /* panel data left out of the HTML */
+  int hash_visitor_keys;            /* store hashed unique visitor keys */
   int hl_header;                    /* highlight header on term */
+  int jobs;                         /* number of parsing threads */
   int ignore_crawlers;              /* ignore crawlers */
   int ignore_qstr;                  /* ignore query string */
   int ignore_statics;               /* ignore static files */
@@ -159,6 +184,7 @@ typedef struct GConf_
   int load_conf_dlg;                /* load curses config dialog */
   int load_global_config;           /* use global config file */
   int max_items;                    /* max number of items to output */
+  int memory_stats;                 /* output the memory usage */
   int mouse_support;                /* add curses mouse support */
   int no_color;                     /* no terminal colors */
   int no_column_names;              /* don't show col names on termnal */
@@ -168,12 +194,20 @@ typedef struct GConf_
   int no_progress;                  /* disable progress metrics */
   int no_tab_scroll;                /* don't scroll dashboard on tab */
   int output_stdout;                /* outputting to stdout */
+  int presize_tables;               /* presize hash tables from a sample */
   int process_and_exit;             /* parse and exit without outputting */
+  int processing_stats;             /* time each processing stage */
   int real_os;                      /* show real OSs */
   int real_time_html;               /* enable real-time HTML output */
+  int resolver_threads;             /* number of reverse DNS threads */
+  int shards;                       /* max logs parsed at once on shards */
   int skip_term_resolver;           /* no terminal resolver */
+  int time_window;                  /* minutes of data kept, if any */
+  uint32_t bench_lines;             /* synthetic lines to benchmark */
+  uint32_t bench_ops;               /* ops of each micro-benchmark */
   uint32_t num_tests;               /* number of lines to test */
   uint64_t log_size;                /* log size override */
+  uint64_t memory_limit;            /* storage bytes kept on the heap */
 
   /* Internal flags */
   int bandwidth;                    /* is there bandwidth within the req line */
@@ -191,10 +225,12 @@ typedef struct GConf_
   int enable_panel_idx;             /* enable panels index */
   int filenames_idx;                /* filenames index */
   int hide_referer_idx;             /* hide referrers index */
+  int hitter_panel_idx;             /* heavy hitters panels index */
   int ignore_ip_idx;                /* ignored ips index */
   int ignore_panel_idx;             /* ignored panels index */
   int ignore_referer_idx;           /* ignored referrers index */
   int ignore_status_idx;            /* ignore status index */
+  int merge_snapshot_idx;           /* snapshots to merge index */
   int output_format_idx;            /* output format index */
   int sort_panel_idx;               /* sort panel index */
   int static_file_idx;              /* static extensions index */
@@ -208,11 +244,13 @@ typedef struct GConf_
   int cache_lcnum;                  /* max num of leaf nodes to cache */
   int cache_ncnum;                  /* max num of non-leaf nodes to cache */
   int compression;                  /* deflate or BZIP2 */
+  int db_flush_interval;            /* num of updates per transaction */
   int keep_db_files;                /* persist parsed data into disk */
   int load_from_disk;               /* load stored data */
   int tune_bnum;                    /* num of elems of the bucket array */
   int tune_lmemb;                   /* num of memb in each leaf page */
   int tune_nmemb;                   /* num of memb in each non-leaf page */
+  int tune_auto;                    /* tune each db from a sample */
 } GConf;
 /* *INDENT-ON* */
 
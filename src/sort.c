@@ -39,8 +39,10 @@
 #include <errno.h>
 
 #include "error.h"
+#include "gstats.h"
 #include "settings.h"
 #include "util.h"
+#include "xmalloc.h"
 
 #include "sort.h"
 
@@ -195,7 +197,8 @@ cmp_vis_asc (const void *a, const void *b)
   return (va > vb) - (va < vb);
 }
 
-/* Sort GRawDataItem value descending */
+/* Sort GRawDataItem value descending. Ties are sorted by key
+ * ascending, i.e., in the order they were first seen. */
 static int
 cmp_raw_num_desc (const void *a, const void *b)
 {
@@ -205,17 +208,23 @@ cmp_raw_num_desc (const void *a, const void *b)
   int va = ia->value.ivalue;
   int vb = ib->value.ivalue;
 
-  return (va < vb) - (va > vb);
+  if (va != vb)
+    return (va < vb) - (va > vb);
+  return (ia->key > ib->key) - (ia->key < ib->key);
 }
 
-/* Sort GRawDataItem value descending */
+/* Sort GRawDataItem value descending. Ties are sorted by key
+ * ascending. */
 static int
 cmp_raw_str_desc (const void *a, const void *b)
 {
   const GRawDataItem *ia = a;
   const GRawDataItem *ib = b;
+  int cmp = strcmp (ib->value.svalue, ia->value.svalue);
 
-  return strcmp (ib->value.svalue, ia->value.svalue);
+  if (cmp != 0)
+    return cmp;
+  return (ia->key > ib->key) - (ia->key < ib->key);
 }
 
 /* Sort 'bandwidth' metric descending */
@@ -488,10 +497,164 @@ parse_initial_sort (void)
   }
 }
 
-/* Apply user defined sort */
-void
-sort_holder_items (GHolderItem * items, int size, GSort sort)
+/* Get the radix sort key of the given holder item for the given metric.
+ *
+ * Signed metrics get their sign bit flipped so they sort as unsigned.
+ * Strings are keyed by their first 8 bytes, in big-endian order. */
+static uint64_t
+get_sort_key (GHolderItem * item, GSortField field)
+{
+  const unsigned char *str = NULL;
+  uint64_t key = 0;
+  int i;
+
+  switch (field) {
+  case SORT_BY_HITS:
+    return (uint64_t) (int64_t) item->metrics->hits ^ (1ULL << 63);
+  case SORT_BY_VISITORS:
+    return (uint64_t) (int64_t) item->metrics->visitors ^ (1ULL << 63);
+  case SORT_BY_BW:
+    return item->metrics->bw.nbw;
+  case SORT_BY_AVGTS:
+    return item->metrics->avgts.nts;
+  case SORT_BY_CUMTS:
+    return item->metrics->cumts.nts;
+  case SORT_BY_MAXTS:
+    return item->metrics->maxts.nts;
+  case SORT_BY_DATA:
+    str = (const unsigned char *) item->metrics->data;
+    for (i = 0; i < 8; i++) {
+      key = key << 8;
+      if (*str != '\0')
+        key |= *str++;
+    }
+    return key;
+  default:
+    return 0;
+  }
+}
+
+/* Sort keys of the same data prefix ascending, keeping the original
+ * order of equal strings. */
+static int
+cmp_key_data_asc (const void *a, const void *b)
 {
+  const GSortKey *ka = a;
+  const GSortKey *kb = b;
+  int ret = strcmp (ka->str, kb->str);
+
+  return ret != 0 ? ret : ka->idx - kb->idx;
+}
+
+/* Sort keys of the same data prefix descending, keeping the original
+ * order of equal strings. */
+static int
+cmp_key_data_desc (const void *a, const void *b)
+{
+  const GSortKey *ka = a;
+  const GSortKey *kb = b;
+  int ret = strcmp (kb->str, ka->str);
+
+  return ret != 0 ? ret : ka->idx - kb->idx;
+}
+
+/* Stable LSD radix sort of the given keys, a byte at a time.
+ *
+ * All digit histograms are built in a single pass over the keys and
+ * passes in which all keys share the same digit are skipped. */
+static void
+radix_sort_keys (GSortKey * keys, GSortKey * tmp, int size)
+{
+  int count[8][256];
+  GSortKey *src = keys, *dst = tmp, *swp = NULL;
+  int pass, i, sum, cnt;
+
+  memset (count, 0, sizeof (count));
+  for (i = 0; i < size; i++)
+    for (pass = 0; pass < 8; pass++)
+      count[pass][(keys[i].key >> (pass * 8)) & 0xFF]++;
+
+  for (pass = 0; pass < 8; pass++) {
+    if (count[pass][(keys[0].key >> (pass * 8)) & 0xFF] == size)
+      continue;
+
+    for (i = 0, sum = 0; i < 256; i++) {
+      cnt = count[pass][i];
+      count[pass][i] = sum;
+      sum += cnt;
+    }
+    for (i = 0; i < size; i++)
+      dst[count[pass][(src[i].key >> (pass * 8)) & 0xFF]++] = src[i];
+
+    swp = src;
+    src = dst;
+    dst = swp;
+  }
+
+  if (src != keys)
+    memcpy (keys, src, size * sizeof (GSortKey));
+}
+
+/* Sort the given holder items by a radix sort on their numeric metric,
+ * or on the prefix of their data. Runs of the same data prefix are then
+ * sorted by comparison.
+ *
+ * The sort is stable, so items are left in the same order as they would
+ * by the comparison sort. */
+static void
+radix_sort_holder_items (GHolderItem * items, int size, GSort sort)
+{
+  GHolderItem *sorted = NULL;
+  GSortKey *keys = NULL, *tmp = NULL;
+  int (*cmp) (const void *, const void *) = cmp_key_data_asc;
+  uint64_t nul = 0;
+  int i, j;
+
+  keys = xmalloc (size * sizeof (GSortKey));
+  tmp = xmalloc (size * sizeof (GSortKey));
+
+  for (i = 0; i < size; i++) {
+    keys[i].key = get_sort_key (&items[i], sort.field);
+    if (sort.sort == SORT_DESC)
+      keys[i].key = ~keys[i].key;
+    keys[i].str = items[i].metrics->data;
+    keys[i].idx = i;
+  }
+  radix_sort_keys (keys, tmp, size);
+
+  if (sort.sort == SORT_DESC) {
+    cmp = cmp_key_data_desc;
+    nul = 0xFF;
+  }
+
+  /* a prefix of less than 8 bytes holds the whole string, so there's
+   * nothing left to sort within its run */
+  for (i = 0; sort.field == SORT_BY_DATA && i < size; i = j) {
+    for (j = i + 1; j < size && keys[j].key == keys[i].key; j++);
+    if (j - i > 1 && (keys[i].key & 0xFF) != nul)
+      qsort (keys + i, j - i, sizeof (GSortKey), cmp);
+  }
+
+  sorted = xmalloc (size * sizeof (GHolderItem));
+  for (i = 0; i < size; i++)
+    sorted[i] = items[keys[i].idx];
+  memcpy (items, sorted, size * sizeof (GHolderItem));
+
+  free (sorted);
+  free (tmp);
+  free (keys);
+}
+
+/* Sort the given items by the given field and order. */
+static void
+sort_items (GHolderItem * items, int size, GSort sort)
+{
+  if (size >= SORT_RADIX_MIN && sort.field != SORT_BY_PROT &&
+      sort.field != SORT_BY_MTHD) {
+    radix_sort_holder_items (items, size, sort);
+    return;
+  }
+
   switch (sort.field) {
   case SORT_BY_HITS:
     if (sort.sort == SORT_DESC)
@@ -550,6 +713,80 @@ sort_holder_items (GHolderItem * items, int size, GSort sort)
   }
 }
 
+/* Apply user defined sort */
+void
+sort_holder_items (GHolderItem * items, int size, GSort sort)
+{
+  uint64_t ts = stats_begin ();
+
+  sort_items (items, size, sort);
+  stats_end (STATS_SORT, ts);
+}
+
+/* Restore the heap property of the given bounded heap from its root
+ * down. The root is the item that sorts last. */
+static void
+sift_raw_data (GRawDataItem * items, int size, int idx,
+               int (*cmp) (const void *, const void *))
+{
+  GRawDataItem tmp;
+  int child;
+
+  while ((child = 2 * idx + 1) < size) {
+    if (child + 1 < size && cmp (&items[child + 1], &items[child]) > 0)
+      child++;
+    if (cmp (&items[child], &items[idx]) <= 0)
+      break;
+
+    tmp = items[idx];
+    items[idx] = items[child];
+    items[child] = tmp;
+    idx = child;
+  }
+}
+
+/* Move the max items that sort first to the front of the given items,
+ * in no particular order, using a bounded heap of max items. That's
+ * O(n log max) instead of sorting them all. */
+static void
+select_raw_data (GRawDataItem * items, int size, int max,
+                 int (*cmp) (const void *, const void *))
+{
+  GRawDataItem tmp;
+  int i;
+
+  for (i = max / 2 - 1; i >= 0; i--)
+    sift_raw_data (items, max, i, cmp);
+
+  for (i = max; i < size; i++) {
+    /* doesn't make it to the top */
+    if (cmp (&items[i], &items[0]) >= 0)
+      continue;
+
+    tmp = items[0];
+    items[0] = items[i];
+    items[i] = tmp;
+    sift_raw_data (items, max, 0, cmp);
+  }
+}
+
+/* Sort the given raw data items. Only the items that are going to be
+ * loaded into the holder, see get_max_choices(), are sorted, and
+ * these are selected first. The remaining items are left unordered. */
+static void
+sort_raw_data (GRawData * raw_data, int ht_size,
+               int (*cmp) (const void *, const void *))
+{
+  int max = get_max_choices ();
+
+  if (max > 0 && ht_size > max) {
+    select_raw_data (raw_data->items, ht_size, max, cmp);
+    ht_size = max;
+  }
+
+  qsort (raw_data->items, ht_size, sizeof *(raw_data->items), cmp);
+}
+
 /* Sort raw numeric data in a descending order for the first run
  * (default sort)
  *
@@ -557,7 +794,7 @@ sort_holder_items (GHolderItem * items, int size, GSort sort)
 GRawData *
 sort_raw_num_data (GRawData * raw_data, int ht_size)
 {
-  qsort (raw_data->items, ht_size, sizeof *(raw_data->items), cmp_raw_num_desc);
+  sort_raw_data (raw_data, ht_size, cmp_raw_num_desc);
   return raw_data;
 }
 
@@ -567,6 +804,6 @@ sort_raw_num_data (GRawData * raw_data, int ht_size)
 GRawData *
 sort_raw_str_data (GRawData * raw_data, int ht_size)
 {
-  qsort (raw_data->items, ht_size, sizeof *(raw_data->items), cmp_raw_str_desc);
+  sort_raw_data (raw_data, ht_size, cmp_raw_str_desc);
   return raw_data;
 }
@@ -44,6 +44,9 @@
 #define SORT_MODULE_LEN 15 + 1  /* longest module name */
 #define SORT_ORDER_LEN   4 + 1  /* length of ASC or DESC */
 
+/* below this num of items, holders are sorted by comparison */
+#define SORT_RADIX_MIN  64
+
 /* Enumerated sorting metrics */
 typedef enum GSortField_
 {
@@ -73,6 +76,14 @@ typedef struct GSort_
   GSortOrder sort;
 } GSort;
 
+/* Sort key of a holder item, see sort_holder_items() */
+typedef struct GSortKey_
+{
+  uint64_t key;                 /* metric value, or data prefix */
+  const char *str;              /* data, if sorting by data */
+  int idx;                      /* index of the item on the holder */
+} GSortKey;
+
 extern GSort module_sort[TOTAL_MODULES];
 extern const int sort_choices[][SORT_MAX_OPTS];;
 
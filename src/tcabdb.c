@@ -43,10 +43,47 @@
 #endif
 
 #include "error.h"
+#include "ghll.h"
 #include "sort.h"
 #include "util.h"
 #include "xmalloc.h"
 
+#ifdef TCB_BTREE
+#include "khash.h"
+
+/* *INDENT-OFF* */
+KHASH_MAP_INIT_INT (tci32, int);
+KHASH_MAP_INIT_INT (tcu64, uint64_t);
+KHASH_MAP_INIT_STR (tcsu64, uint64_t);
+/* *INDENT-ON* */
+
+/* Updates to the on-disk counters of a module, buffered in memory and
+ * written back all at once, see --db-flush-interval */
+typedef struct GTCDelta_
+{
+  khash_t (tci32) * hits;       /* increments */
+  khash_t (tci32) * visitors;   /* increments */
+  khash_t (tcu64) * bw;         /* increments */
+  khash_t (tcu64) * cumts;      /* increments */
+  khash_t (tcu64) * maxts;      /* maximum values */
+  khash_t (tcsu64) * metadata;  /* increments */
+} GTCDelta;
+
+/* A buffered update, sorted before being written back */
+typedef struct GTCDeltaItem_
+{
+  int key;                      /* first, see cmp_delta_key() */
+  uint64_t value;
+} GTCDeltaItem;
+
+/* Buffered updates per module */
+static GTCDelta *tc_deltas = NULL;
+/* Number of updates buffered so far */
+static int tc_pending = 0;
+
+static void flush_deltas (void);
+#endif
+
 /* Hash tables storage */
 static GTCStorage *tc_storage;
 
@@ -57,6 +94,12 @@ static TCADB *ht_general_stats = NULL;
 static TCADB *ht_hostnames = NULL;
 static TCADB *ht_unique_keys = NULL;
 
+/* estimated number of records per module, filled by ht_presize_module() */
+static uint32_t tc_est_keys[TOTAL_MODULES];
+static uint32_t tc_est_uniqs[TOTAL_MODULES];
+/* estimated number of visitors, filled by ht_presize_storage() */
+static uint32_t tc_est_visitors = 0;
+
 /* db paths for whole app hashes */
 static char *dbpath_agent_keys = NULL;
 static char *dbpath_agent_vals = NULL;
@@ -106,18 +149,20 @@ tc_db_close (TCADB * adb, char *dbname)
   return 0;
 }
 
-/* Setup a database given the file path and open it up */
+/* Setup a database given the file path and the number of records it is
+ * expected to hold, 0 if unknown, and open it up */
 static TCADB *
-tc_adb_create (char *path)
+tc_adb_create (char *path, uint32_t records)
 {
   char params[DB_PARAMS] = "";
   TCADB *adb = tcadbnew ();
 
 #ifdef TCB_MEMHASH
+  (void) records;
   xstrncpy (params, path, DB_PARAMS);
 #endif
 #ifdef TCB_BTREE
-  tc_db_get_params (params, path);
+  tc_db_get_params (params, path, records);
 #endif
 
   if (tc_adb_open (adb, params)) {
@@ -151,11 +196,13 @@ get_dbname (const char *dbname, int module)
 static void
 create_prog_tables (void)
 {
-  ht_agent_keys = tc_adb_create (dbpath_agent_keys);
-  ht_agent_vals = tc_adb_create (dbpath_agent_vals);
-  ht_general_stats = tc_adb_create (dbpath_general_stats);
-  ht_hostnames = tc_adb_create (dbpath_hostnames);
-  ht_unique_keys = tc_adb_create (dbpath_unique_keys);
+  uint32_t visitors = tc_est_visitors;
+
+  ht_agent_keys = tc_adb_create (dbpath_agent_keys, visitors);
+  ht_agent_vals = tc_adb_create (dbpath_agent_vals, visitors);
+  ht_general_stats = tc_adb_create (dbpath_general_stats, visitors ? 1 : 0);
+  ht_hostnames = tc_adb_create (dbpath_hostnames, visitors);
+  ht_unique_keys = tc_adb_create (dbpath_unique_keys, visitors);
 }
 
 /* Set db paths for hashes used across the whole app (not per module) */
@@ -180,11 +227,36 @@ free_prog_tables (void)
   tc_db_close (ht_unique_keys, dbpath_unique_keys);
 }
 
+/* Get the number of records the given metric table of a module is
+ * expected to hold.
+ *
+ * If no estimate was made, 0 is returned.
+ * On success, the estimated number of records is returned. */
+static uint32_t
+get_table_records (GModule module, GSMetric metric)
+{
+  uint32_t keys = tc_est_keys[module];
+
+  switch (metric) {
+  case MTRC_UNIQMAP:
+  case MTRC_AGENTS:
+    return tc_est_uniqs[module];
+  case MTRC_METADATA:
+    /* a handful of counters per module */
+    return keys ? 1 : 0;
+  default:
+    return keys;
+  }
+}
+
 /* Initialize map & metric hashes */
 static void
 init_tables (GModule module)
 {
   GTCStorageMetric mtrc;
+#ifdef TCB_BTREE
+  uint32_t records = 0;
+#endif
   int n = 0, i;
 
   /* *INDENT-OFF* */
@@ -193,6 +265,7 @@ init_tables (GModule module)
     {MTRC_ROOTMAP   , DB_ROOTMAP   , NULL, NULL} ,
     {MTRC_DATAMAP   , DB_DATAMAP   , NULL, NULL} ,
     {MTRC_UNIQMAP   , DB_UNIQMAP   , NULL, NULL} ,
+    {MTRC_UNIQHLL   , DB_UNIQHLL   , NULL, NULL} ,
     {MTRC_ROOT      , DB_ROOT      , NULL, NULL} ,
     {MTRC_HITS      , DB_HITS      , NULL, NULL} ,
     {MTRC_VISITORS  , DB_VISITORS  , NULL, NULL} ,
@@ -211,22 +284,68 @@ init_tables (GModule module)
     mtrc = metrics[i];
 #ifdef TCB_MEMHASH
     mtrc.dbpath = get_dbname (mtrc.dbname, module);
-    mtrc.store = tc_adb_create (mtrc.dbpath);
+    mtrc.store = tc_adb_create (mtrc.dbpath, 0);
 #endif
 #ifdef TCB_BTREE
+    records = get_table_records (module, mtrc.metric);
     /* allow for duplicate keys */
     if (mtrc.metric == MTRC_AGENTS) {
       mtrc.dbpath = tc_db_set_path (DB_AGENTS, module);
-      mtrc.store = tc_bdb_create (mtrc.dbpath);
+      mtrc.store = tc_bdb_create (mtrc.dbpath, records);
     } else {
       mtrc.dbpath = get_dbname (mtrc.dbname, module);
-      mtrc.store = tc_adb_create (mtrc.dbpath);
+      mtrc.store = tc_adb_create (mtrc.dbpath, records);
     }
 #endif
     tc_storage[module].metrics[i] = mtrc;
   }
 }
 
+#ifdef TCB_BTREE
+/* Allocate the buffered updates of every module. */
+static void
+init_deltas (void)
+{
+  GModule module;
+  size_t idx = 0;
+
+  tc_deltas = xcalloc (TOTAL_MODULES, sizeof (GTCDelta));
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    tc_deltas[module].hits = kh_init (tci32);
+    tc_deltas[module].visitors = kh_init (tci32);
+    tc_deltas[module].bw = kh_init (tcu64);
+    tc_deltas[module].cumts = kh_init (tcu64);
+    tc_deltas[module].maxts = kh_init (tcu64);
+    tc_deltas[module].metadata = kh_init (tcsu64);
+  }
+}
+
+/* Free the buffered updates of every module. They must have been
+ * written back already. */
+static void
+free_deltas (void)
+{
+  GModule module;
+  size_t idx = 0;
+
+  if (!tc_deltas)
+    return;
+
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    kh_destroy (tci32, tc_deltas[module].hits);
+    kh_destroy (tci32, tc_deltas[module].visitors);
+    kh_destroy (tcu64, tc_deltas[module].bw);
+    kh_destroy (tcu64, tc_deltas[module].cumts);
+    kh_destroy (tcu64, tc_deltas[module].maxts);
+    kh_destroy (tcsu64, tc_deltas[module].metadata);
+  }
+  free (tc_deltas);
+  tc_deltas = NULL;
+}
+#endif
+
 /* Initialize hash tables */
 void
 init_storage (void)
@@ -245,6 +364,10 @@ init_storage (void)
     tc_storage[module].module = module;
     init_tables (module);
   }
+
+#ifdef TCB_BTREE
+  init_deltas ();
+#endif
 }
 
 /* Destroys the hash structure allocated metrics */
@@ -277,6 +400,12 @@ free_storage (void)
   if (!tc_storage)
     return;
 
+#ifdef TCB_BTREE
+  /* write back whatever is still buffered */
+  flush_deltas ();
+  free_deltas ();
+#endif
+
   free_prog_tables ();
   FOREACH_MODULE (idx, module_list) {
     free_metrics (module_list[idx]);
@@ -289,6 +418,93 @@ free_storage (void)
 
 }
 
+#ifdef TCB_BTREE
+/* Close the given database without removing it and open it up again
+ * out of the tuning for the given number of records. */
+static TCADB *
+tc_adb_retune (TCADB * adb, char *path, uint32_t records)
+{
+  if (!tcadbclose (adb))
+    FATAL ("Unable to close DB: %s", path);
+  tcadbdel (adb);
+
+  return tc_adb_create (path, records);
+}
+
+/* Determine if the databases can be reopened with a tuning of their
+ * own, i.e., --tune-auto is enabled, and they are still empty as they
+ * are not loaded from disk. */
+static int
+can_retune (void)
+{
+  return conf.tune_auto && !conf.load_from_disk && tc_storage != NULL;
+}
+#endif
+
+/* Presize the tables of the given module. Tokyo Cabinet tables are
+ * tuned when they are opened instead, so under --tune-auto, the
+ * estimates are kept and the still empty tables of the module are
+ * reopened with parameters of their own. */
+void
+ht_presize_module (GModule module, uint32_t keys, uint32_t uniq)
+{
+#ifdef TCB_BTREE
+  GTCStorageMetric *mtrc;
+  uint32_t records;
+  int i;
+
+  tc_est_keys[module] = keys;
+  tc_est_uniqs[module] = uniq;
+  if (!can_retune ())
+    return;
+
+  /* write back whatever is buffered before closing anything */
+  flush_deltas ();
+  for (i = 0; i < GSMTRC_TOTAL; i++) {
+    mtrc = &tc_storage[module].metrics[i];
+    records = get_table_records (module, mtrc->metric);
+    LOG_DEBUG (("Tuning %s of module %d\n", mtrc->dbname, module));
+    if (mtrc->metric == MTRC_AGENTS) {
+      if (!tcbdbclose (mtrc->store))
+        FATAL ("Unable to close DB: %s", mtrc->dbpath);
+      tcbdbdel (mtrc->store);
+      mtrc->store = tc_bdb_create (mtrc->dbpath, records);
+    } else {
+      mtrc->store = tc_adb_retune (mtrc->store, mtrc->dbpath, records);
+    }
+  }
+#else
+  (void) module;
+  (void) keys;
+  (void) uniq;
+#endif
+}
+
+/* Presize the tables used across the whole app. Tokyo Cabinet tables
+ * are tuned when they are opened instead, so under --tune-auto, the
+ * estimate is kept and the still empty tables are reopened with
+ * parameters of their own. */
+void
+ht_presize_storage (uint32_t visitors, uint32_t strings)
+{
+  (void) strings;
+#ifdef TCB_BTREE
+  tc_est_visitors = visitors;
+  if (!can_retune ())
+    return;
+
+  LOG_DEBUG (("Tuning tables used across the whole app\n"));
+  ht_agent_keys = tc_adb_retune (ht_agent_keys, dbpath_agent_keys, visitors);
+  ht_agent_vals = tc_adb_retune (ht_agent_vals, dbpath_agent_vals, visitors);
+  ht_general_stats = tc_adb_retune (ht_general_stats, dbpath_general_stats, 1);
+  ht_hostnames = tc_adb_retune (ht_hostnames, dbpath_hostnames, visitors);
+  ht_unique_keys = tc_adb_retune (ht_unique_keys, dbpath_unique_keys,
+                                  visitors);
+#else
+  (void) visitors;
+#endif
+}
+
 static uint32_t
 ht_get_size (TCADB * adb)
 {
@@ -528,48 +744,88 @@ ins_si32_ai (void *hash, const char *key)
   return value;
 }
 
-#ifdef TCB_MEMHASH
-
-/* Compare if the given needle is in the haystack
+/* Insert a uint64_t key and auto increment int value.
  *
- * if equal, 1 is returned, else 0 */
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
 static int
-find_int_key_in_list (void *data, void *needle)
+ins_u64i32_ai (void *hash, uint64_t key)
 {
-  return (*(int *) data) == (*(int *) needle) ? 1 : 0;
+  int size = 0, value = 0;
+
+  if (!hash)
+    return -1;
+
+  size = ht_get_size (hash);
+  /* the auto increment value starts at SIZE (hash table) + 1 */
+  value = size > 0 ? size + 1 : 1;
+
+  /* if key exists in the database, it is overwritten */
+  if (!tcadbput (hash, &key, sizeof (uint64_t), &value, sizeof (int)))
+    LOG_DEBUG (("Unable to tcadbput\n"));
+
+  return value;
 }
 
-/* Insert an int key and the corresponding GSLList (Single linked-list) value.
- * Note: If the key exists within the list, the value is not appended.
+#ifdef TCB_MEMHASH
+
+/* Insert an int key and an int value into its set of values. Values
+ * are kept packed into a single record per key, in the order they were
+ * inserted. Each key/value pair is also stored on its own, so a value
+ * already in the set is found without reading the whole set.
+ * Note: If the value exists within the set, the value is not appended.
  *
  * On error, -1 is returned.
  * On success 0 is returned */
 static int
-ins_igsl (void *hash, int key, int value)
+ins_iags (void *hash, int key, int value)
 {
-  GSLList *list, *match;
-  int sp;
+  char pair[2 * sizeof (int)];
 
   if (!hash)
     return -1;
 
-  /* key found, check if key exists within the list */
-  if ((list = tcadbget (hash, &key, sizeof (int), &sp)) != NULL) {
-    if ((match = list_find (list, find_int_key_in_list, &value)))
-      goto out;
-    list = list_insert_prepend (list, int2ptr (value));
-  } else {
-    list = list_create (int2ptr (value));
-  }
+  memcpy (pair, &key, sizeof (int));
+  memcpy (pair + sizeof (int), &value, sizeof (int));
+  /* already in the set, or unable to store it */
+  if (!tcadbputkeep (hash, pair, sizeof (pair), "", 0))
+    return 0;
 
-  if (!tcadbput (hash, &key, sizeof (int), list, sizeof (GSLList)))
-    LOG_DEBUG (("Unable to tcadbput\n"));
-out:
-  free (list);
+  if (!tcadbputcat (hash, &key, sizeof (int), &value, sizeof (int)))
+    LOG_DEBUG (("Unable to tcadbputcat\n"));
 
   return 0;
 }
 
+/* Get a copy of the set of values of a given int key, the last one
+ * inserted first.
+ *
+ * On error, or if key is not found, NULL is returned.
+ * On success the values are returned and len is set to their number. */
+static int *
+get_iags (void *hash, int key, int *len)
+{
+  int *keys = NULL, tmp;
+  int i, n, sp = 0;
+
+  if (!hash || (keys = tcadbget (hash, &key, sizeof (int), &sp)) == NULL)
+    return NULL;
+
+  if ((n = sp / sizeof (int)) == 0) {
+    free (keys);
+    return NULL;
+  }
+
+  for (i = 0; i < n / 2; ++i) {
+    tmp = keys[i];
+    keys[i] = keys[n - i - 1];
+    keys[n - i - 1] = tmp;
+  }
+  *len = n;
+
+  return keys;
+}
+
 #endif
 
 /* Get the int value of a given string key.
@@ -595,6 +851,29 @@ get_si32 (void *hash, const char *key)
   return -1;
 }
 
+/* Get the int value of a given uint64_t key.
+ *
+ * On error, or if key is not found, -1 is returned.
+ * On success the int value for the given key is returned */
+static int
+get_u64i32 (void *hash, uint64_t key)
+{
+  int ret = 0, sp;
+  void *ptr;
+
+  if (!hash)
+    return -1;
+
+  /* key found, return current value */
+  if ((ptr = tcadbget (hash, &key, sizeof (uint64_t), &sp)) != NULL) {
+    ret = (*(int *) ptr);
+    free (ptr);
+    return ret;
+  }
+
+  return -1;
+}
+
 /* Get the unsigned int value of a given string key.
  *
  * On error, or if key is not found, 0 is returned.
@@ -794,45 +1073,239 @@ get_iu64 (void *hash, int key)
   return 0;
 }
 
-/* Get the GSLList value of a given int key.
+#ifdef TCB_BTREE
+/* Compare two buffered updates by key, the way the B+ tree orders
+ * them, i.e., by the bytes of the key, so they are written back in a
+ * single pass over the pages. */
+static int
+cmp_delta_key (const void *a, const void *b)
+{
+  return memcmp (a, b, sizeof (int));
+}
+
+/* Begin a transaction on the given database. If it can't be done,
+ * updates are just written out of it.
  *
- * On error, or if key is not found, NULL is returned.
- * On success the GSLList value for the given key is returned */
-static GSLList *
-get_igsl (void *hash, int key)
+ * On error, 0 is returned.
+ * On success, 1 is returned. */
+static int
+tc_db_tranbegin (TCADB * adb)
 {
-  int sp;
-  GSLList *list = NULL;
+  if (tcadbtranbegin (adb))
+    return 1;
 
-  if (!hash)
-    return NULL;
+  LOG_DEBUG (("Unable to begin transaction\n"));
+  return 0;
+}
 
-  /* key found, return current value */
-  if ((list = tcadbget (hash, &key, sizeof (int), &sp)) != NULL)
-    return list;
+/* Commit a transaction begun with tc_db_tranbegin() */
+static void
+tc_db_trancommit (TCADB * adb, int tran)
+{
+  if (tran && !tcadbtrancommit (adb))
+    LOG_DEBUG (("Unable to commit transaction\n"));
+}
 
-  return NULL;
+/* Copy out the buffered updates of an int keyed table and sort them by
+ * key.
+ *
+ * On success, the number of updates is returned. */
+static int
+sort_delta_items (khash_t (tcu64) * h, khash_t (tci32) * h32,
+                  GTCDeltaItem ** items)
+{
+  khint_t k;
+  int n = 0;
+
+  *items = xmalloc (sizeof (GTCDeltaItem) * (h ? kh_size (h) : kh_size (h32)));
+  if (h) {
+    for (k = kh_begin (h); k != kh_end (h); ++k) {
+      if (!kh_exist (h, k))
+        continue;
+      (*items)[n].key = kh_key (h, k);
+      (*items)[n++].value = kh_val (h, k);
+    }
+  } else {
+    for (k = kh_begin (h32); k != kh_end (h32); ++k) {
+      if (!kh_exist (h32, k))
+        continue;
+      (*items)[n].key = kh_key (h32, k);
+      (*items)[n++].value = (uint64_t) kh_val (h32, k);
+    }
+  }
+  qsort (*items, n, sizeof (GTCDeltaItem), cmp_delta_key);
+
+  return n;
 }
 
-/* Get the TCLIST value of a given int key.
+/* Write back the buffered int increments of a table. */
+static void
+flush_delta_i32 (void *hash, khash_t (tci32) * h)
+{
+  GTCDeltaItem *items = NULL;
+  int i, n = 0, tran = 0;
+
+  if (!hash || kh_size (h) == 0)
+    return;
+
+  n = sort_delta_items (NULL, h, &items);
+  tran = tc_db_tranbegin (hash);
+  for (i = 0; i < n; ++i)
+    inc_ii32 (hash, items[i].key, (int) items[i].value);
+  tc_db_trancommit (hash, tran);
+
+  free (items);
+  kh_clear (tci32, h);
+}
+
+/* Write back the buffered uint64_t increments, or maximum values, of a
+ * table. */
+static void
+flush_delta_u64 (void *hash, khash_t (tcu64) * h, int max)
+{
+  GTCDeltaItem *items = NULL;
+  int i, n = 0, tran = 0;
+
+  if (!hash || kh_size (h) == 0)
+    return;
+
+  n = sort_delta_items (h, NULL, &items);
+  tran = tc_db_tranbegin (hash);
+  for (i = 0; i < n; ++i) {
+    if (!max)
+      inc_iu64 (hash, items[i].key, items[i].value);
+    else if (get_iu64 (hash, items[i].key) < items[i].value)
+      ins_iu64 (hash, items[i].key, items[i].value);
+  }
+  tc_db_trancommit (hash, tran);
+
+  free (items);
+  kh_clear (tcu64, h);
+}
+
+/* Write back the buffered uint64_t increments of a string keyed
+ * table. There's only a handful of keys. */
+static void
+flush_delta_su64 (void *hash, khash_t (tcsu64) * h)
+{
+  khint_t k;
+  int tran = 0;
+
+  if (!hash || kh_size (h) == 0)
+    return;
+
+  tran = tc_db_tranbegin (hash);
+  for (k = kh_begin (h); k != kh_end (h); ++k) {
+    if (!kh_exist (h, k))
+      continue;
+    inc_su64 (hash, kh_key (h, k), kh_val (h, k));
+    free ((char *) kh_key (h, k));
+  }
+  tc_db_trancommit (hash, tran);
+
+  kh_clear (tcsu64, h);
+}
+
+/* Write back all the buffered updates to the databases, one sorted
+ * batch per table, each within a transaction. */
+static void
+flush_deltas (void)
+{
+  GModule module;
+  GTCDelta *delta = NULL;
+  size_t idx = 0;
+
+  if (!tc_deltas || tc_pending == 0)
+    return;
+
+  FOREACH_MODULE (idx, module_list) {
+    module = module_list[idx];
+    delta = &tc_deltas[module];
+
+    flush_delta_i32 (get_hash (module, MTRC_HITS), delta->hits);
+    flush_delta_i32 (get_hash (module, MTRC_VISITORS), delta->visitors);
+    flush_delta_u64 (get_hash (module, MTRC_BW), delta->bw, 0);
+    flush_delta_u64 (get_hash (module, MTRC_CUMTS), delta->cumts, 0);
+    flush_delta_u64 (get_hash (module, MTRC_MAXTS), delta->maxts, 1);
+    flush_delta_su64 (get_hash (module, MTRC_METADATA), delta->metadata);
+  }
+  tc_pending = 0;
+}
+
+/* Account for a new buffered update, and write them all back once
+ * there are enough of them. */
+static void
+add_pending_delta (void)
+{
+  int interval = conf.db_flush_interval > 0 ? conf.db_flush_interval : TC_FLUSH;
+
+  if (++tc_pending >= interval)
+    flush_deltas ();
+}
+
+/* Buffer an int increment.
  *
- * On error, or if key is not found, NULL is returned.
- * On success the GSLList value for the given key is returned */
-static TCLIST *
-get_itcli (void *hash, int key)
+ * On success 0 is returned */
+static int
+delta_inc_i32 (khash_t (tci32) * h, int key, int inc)
 {
-  TCLIST *list = NULL;
+  khint_t k;
+  int ret;
 
-  if (!hash)
-    return NULL;
+  k = kh_put (tci32, h, key, &ret);
+  kh_val (h, k) = ret ? inc : kh_val (h, k) + inc;
+  add_pending_delta ();
 
-  /* key found, return current value */
-  if ((list = tcbdbget4 (hash, &key, sizeof (int))) != NULL)
-    return list;
+  return 0;
+}
 
-  return NULL;
+/* Buffer a uint64_t increment, or maximum value.
+ *
+ * On success 0 is returned */
+static int
+delta_inc_u64 (khash_t (tcu64) * h, int key, uint64_t inc, int max)
+{
+  khint_t k;
+  int ret;
+
+  k = kh_put (tcu64, h, key, &ret);
+  if (ret)
+    kh_val (h, k) = inc;
+  else if (!max)
+    kh_val (h, k) += inc;
+  else if (kh_val (h, k) < inc)
+    kh_val (h, k) = inc;
+  add_pending_delta ();
+
+  return 0;
 }
 
+/* Buffer a uint64_t increment given a string key.
+ *
+ * On success 0 is returned */
+static int
+delta_inc_su64 (khash_t (tcsu64) * h, const char *key, uint64_t inc)
+{
+  khint_t k;
+  int ret;
+
+  if ((k = kh_get (tcsu64, h, key)) == kh_end (h)) {
+    k = kh_put (tcsu64, h, xstrdup (key), &ret);
+    kh_val (h, k) = 0;
+  }
+  kh_val (h, k) += inc;
+  add_pending_delta ();
+
+  return 0;
+}
+
+/* Make sure the buffered updates are on the databases before reading
+ * from them. */
+#define SYNC_DELTAS() flush_deltas ()
+#else
+#define SYNC_DELTAS()
+#endif
+
 /* Insert a unique visitor key string (IP/DATE/UA), mapped to an auto
  * incremented value.
  *
@@ -864,6 +1337,7 @@ ht_get_hits_min_max (GModule module, int *min, int *max)
 {
   void *hash = get_hash (module, MTRC_HITS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return;
 
@@ -880,6 +1354,7 @@ ht_get_visitors_min_max (GModule module, int *min, int *max)
 {
   void *hash = get_hash (module, MTRC_VISITORS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return;
 
@@ -896,6 +1371,7 @@ ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max)
 {
   void *hash = get_hash (module, MTRC_BW);
 
+  SYNC_DELTAS ();
   if (!hash)
     return;
 
@@ -912,6 +1388,7 @@ ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max)
 {
   void *hash = get_hash (module, MTRC_CUMTS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return;
 
@@ -928,12 +1405,82 @@ ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max)
 {
   void *hash = get_hash (module, MTRC_MAXTS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return;
 
   get_iu64_min_max (hash, min, max);
 }
 
+/* Set the memory taken by the given metric of a module, i.e., the size
+ * of its database, in memory or on disk. Strings are stored within the
+ * database, so none are owned on their own.
+ *
+ * On success the memory usage is set. */
+void
+ht_get_mem_usage (GModule module, GSMetric metric, GSMemUsage * mem)
+{
+  void *hash = get_hash (module, metric);
+
+  memset (mem, 0, sizeof (GSMemUsage));
+  if (!hash)
+    return;
+
+  mem->buckets = tcadbsize (hash);
+}
+
+/* Set the memory taken by the databases used across the whole app.
+ *
+ * On success the memory usage is set. */
+void
+ht_get_mem_shared (GSMemUsage * mem)
+{
+  TCADB *dbs[] = {
+    ht_agent_keys, ht_agent_vals, ht_general_stats, ht_hostnames,
+    ht_unique_keys
+  };
+  size_t i;
+
+  memset (mem, 0, sizeof (GSMemUsage));
+  for (i = 0; i < ARRAY_SIZE (dbs); i++) {
+    if (dbs[i])
+      mem->buckets += tcadbsize (dbs[i]);
+  }
+}
+
+/* Insert a hashed unique visitor key (IP/DATE/UA), mapped to an auto
+ * incremented value. Hashed keys are stored as 16-byte binary keys
+ * within the same table as the unique visitor key strings.
+ *
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_unique_hkey (const uint64_t hkey[2])
+{
+  int size = 0, value = -1, sp;
+  void *hash = ht_unique_keys, *ptr;
+
+  if (!hash)
+    return -1;
+
+  /* key found, return current value */
+  if ((ptr = tcadbget (hash, hkey, 2 * sizeof (uint64_t), &sp)) != NULL) {
+    value = (*(int *) ptr);
+    free (ptr);
+    return value;
+  }
+
+  size = ht_get_size (hash);
+  /* the auto increment value starts at SIZE (hash table) + 1 */
+  value = size > 0 ? size + 1 : 1;
+
+  if (!tcadbput (hash, hkey, 2 * sizeof (uint64_t), &value, sizeof (int)))
+    LOG_DEBUG (("Unable to tcadbput\n"));
+
+  return value;
+}
+
 /* Insert a user agent key string, mapped to an auto incremented value.
  *
  * If the given key exists, its value is returned.
@@ -969,6 +1516,18 @@ ht_insert_agent_value (int key, const char *value)
   return ins_is32 (hash, key, value);
 }
 
+/* Insert a data keymap string key. All data keys are kept on disk,
+ * i.e., --heavy-hitters applies to the in-memory storage only.
+ *
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_data_keymap (GModule module, const char *key)
+{
+  return ht_insert_keymap (module, key);
+}
+
 /* Insert a keymap string key.
  *
  * If the given key exists, its value is returned.
@@ -989,6 +1548,21 @@ ht_insert_keymap (GModule module, const char *key)
   return ins_si32_ai (hash, key);
 }
 
+/* Insert a keymap string key out of a bounded domain, e.g., status
+ * codes, given its code. On-disk keys are looked up as any other one.
+ *
+ * If the given key exists, its value is returned.
+ * On error, -1 is returned.
+ * On success the value of the key inserted is returned */
+int
+ht_insert_code_keymap (GModule module, int code, const char *key, int data)
+{
+  (void) code;
+  if (data)
+    return ht_insert_data_keymap (module, key);
+  return ht_insert_keymap (module, key);
+}
+
 /* Insert a datamap int key and string value.
  *
  * On error, -1 is returned.
@@ -1019,13 +1593,13 @@ ht_insert_rootmap (GModule module, int key, const char *value)
   return ins_is32 (hash, key, value);
 }
 
-/* Insert a uniqmap string key.
+/* Insert a uniqmap uint64_t key.
  *
  * If the given key exists, 0 is returned.
  * On error, -1 is returned.
  * On success the value of the key inserted is returned */
 int
-ht_insert_uniqmap (GModule module, const char *key)
+ht_insert_uniqmap (GModule module, uint64_t key)
 {
   int value = -1;
   void *hash = get_hash (module, MTRC_UNIQMAP);
@@ -1033,10 +1607,45 @@ ht_insert_uniqmap (GModule module, const char *key)
   if (!hash)
     return -1;
 
-  if ((value = get_si32 (hash, key)) != -1)
+  if ((value = get_u64i32 (hash, key)) != -1)
     return 0;
 
-  return ins_si32_ai (hash, key);
+  return ins_u64i32_ai (hash, key);
+}
+
+/* Add the hash of a unique visitor to the sketch of an int key. The
+ * sketch is stored packed, see hll_pack().
+ *
+ * On error, -1 is returned.
+ * On success the growth of the estimated unique visitors is returned */
+int
+ht_insert_uniq_hll (GModule module, int key, uint64_t hash)
+{
+  GHLL hll;
+  int sp = 0;
+  size_t size = 0;
+  uint32_t inc = 0;
+  void *ptr = NULL, *ht = get_hash (module, MTRC_UNIQHLL);
+
+  if (!ht)
+    return -1;
+
+  memset (&hll, 0, sizeof (GHLL));
+  if ((ptr = tcadbget (ht, &key, sizeof (int), &sp)) != NULL) {
+    hll_unpack (&hll, ptr, sp);
+    free (ptr);
+  }
+
+  if (hll_add (&hll, hash)) {
+    inc = hll_report (&hll);
+    ptr = hll_pack (&hll, &size);
+    if (!tcadbput (ht, &key, sizeof (int), ptr, size))
+      LOG_DEBUG (("Unable to tcadbput\n"));
+    free (ptr);
+  }
+  free_hll (&hll);
+
+  return inc;
 }
 
 /* Insert a data int key mapped to the corresponding int root key.
@@ -1066,7 +1675,11 @@ ht_insert_hits (GModule module, int key, int inc)
   if (!hash)
     return -1;
 
+#ifdef TCB_BTREE
+  return delta_inc_i32 (tc_deltas[module].hits, key, inc);
+#else
   return inc_ii32 (hash, key, inc);
+#endif
 }
 
 /* Increases visitors counter from an int key.
@@ -1081,7 +1694,11 @@ ht_insert_visitor (GModule module, int key, int inc)
   if (!hash)
     return -1;
 
+#ifdef TCB_BTREE
+  return delta_inc_i32 (tc_deltas[module].visitors, key, inc);
+#else
   return inc_ii32 (hash, key, inc);
+#endif
 }
 
 /* Increases bandwidth counter from an int key.
@@ -1096,7 +1713,11 @@ ht_insert_bw (GModule module, int key, uint64_t inc)
   if (!hash)
     return -1;
 
+#ifdef TCB_BTREE
+  return delta_inc_u64 (tc_deltas[module].bw, key, inc, 0);
+#else
   return inc_iu64 (hash, key, inc);
+#endif
 }
 
 /* Increases cumulative time served counter from an int key.
@@ -1111,7 +1732,11 @@ ht_insert_cumts (GModule module, int key, uint64_t inc)
   if (!hash)
     return -1;
 
+#ifdef TCB_BTREE
+  return delta_inc_u64 (tc_deltas[module].cumts, key, inc, 0);
+#else
   return inc_iu64 (hash, key, inc);
+#endif
 }
 
 /* Insert the maximum time served counter from an int key.
@@ -1122,16 +1747,48 @@ ht_insert_cumts (GModule module, int key, uint64_t inc)
 int
 ht_insert_maxts (GModule module, int key, uint64_t value)
 {
-  uint64_t curvalue = 0;
   void *hash = get_hash (module, MTRC_MAXTS);
 
   if (!hash)
     return -1;
 
-  if ((curvalue = get_iu64 (hash, key)) < value)
+#ifdef TCB_BTREE
+  return delta_inc_u64 (tc_deltas[module].maxts, key, value, 1);
+#else
+  if (get_iu64 (hash, key) < value)
     ins_iu64 (hash, key, value);
 
   return 0;
+#endif
+}
+
+/* Increase at once the hits, visitors, bandwidth and time served
+ * metrics a log line adds to the given data key, along with the totals
+ * of the module. Visitors are only counted if visitor is set.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_metrics (GModule module, int key, int visitor, uint64_t bw,
+                   uint64_t ts)
+{
+  int ret = 0;
+
+  ht_insert_meta_data (module, "hits", 1);
+  if (ht_insert_hits (module, key, 1) == -1)
+    ret = -1;
+  if (visitor) {
+    ht_insert_meta_data (module, "visitors", 1);
+    ht_insert_visitor (module, key, 1);
+  }
+  ht_insert_meta_data (module, "bytes", bw);
+  ht_insert_bw (module, key, bw);
+  ht_insert_meta_data (module, "cumts", ts);
+  ht_insert_cumts (module, key, ts);
+  ht_insert_meta_data (module, "maxts", ts);
+  ht_insert_maxts (module, key, ts);
+
+  return ret;
 }
 
 /* Insert a method given an int key and string value.
@@ -1176,7 +1833,7 @@ ht_insert_agent (GModule module, int key, int value)
   if (!hash)
     return -1;
 
-  return ins_igsl (hash, key, value);
+  return ins_iags (hash, key, value);
 }
 
 /* Insert an IP hostname mapped to the corresponding hostname.
@@ -1194,6 +1851,28 @@ ht_insert_hostname (const char *ip, const char *host)
   return ins_ss32 (hash, ip, host);
 }
 
+/* Insert or replace the high-water mark of the log file identified by
+ * the given key. Marks are kept within the general stats database.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_last_parse (const char *key, const GLastParse * lp)
+{
+  void *hash = ht_general_stats;
+  char dbkey[LAST_PARSE_LEN + 16];
+
+  if (!hash)
+    return -1;
+
+  snprintf (dbkey, sizeof (dbkey), "last_parse:%s", key);
+  /* if key exists in the database, it is overwritten */
+  if (!tcadbput (hash, dbkey, strlen (dbkey), lp, sizeof (GLastParse)))
+    LOG_DEBUG (("Unable to tcadbput\n"));
+
+  return 0;
+}
+
 /* Increases a general stats counter int from a string key.
  *
  * On error, -1 is returned.
@@ -1266,7 +1945,11 @@ ht_insert_meta_data (GModule module, const char *key, uint64_t value)
   if (!hash)
     return -1;
 
+#ifdef TCB_BTREE
+  return delta_inc_su64 (tc_deltas[module].metadata, key, value);
+#else
   return inc_su64 (hash, key, value);
+#endif
 }
 
 
@@ -1329,19 +2012,43 @@ ht_get_keymap (GModule module, const char *key)
   return get_si32 (hash, key);
 }
 
-/* Get the int value from MTRC_UNIQMAP given a string key.
+/* Get the int value from MTRC_UNIQMAP given a uint64_t key.
  *
  * On error, -1 is returned.
  * On success the int value for the given key is returned */
 int
-ht_get_uniqmap (GModule module, const char *key)
+ht_get_uniqmap (GModule module, uint64_t key)
 {
   void *hash = get_hash (module, MTRC_UNIQMAP);
 
   if (!hash)
     return -1;
 
-  return get_si32 (hash, key);
+  return get_u64i32 (hash, key);
+}
+
+/* Get the high-water mark of the log file identified by the given key.
+ *
+ * On error, or if key is not found, 1 is returned.
+ * On success, 0 is returned and the mark is copied into lp. */
+int
+ht_get_last_parse (const char *key, GLastParse * lp)
+{
+  void *hash = ht_general_stats, *ptr;
+  char dbkey[LAST_PARSE_LEN + 16];
+  int sp = 0;
+
+  if (!hash)
+    return 1;
+
+  snprintf (dbkey, sizeof (dbkey), "last_parse:%s", key);
+  if ((ptr = tcadbget (hash, dbkey, strlen (dbkey), &sp)) == NULL)
+    return 1;
+  if (sp == sizeof (GLastParse))
+    memcpy (lp, ptr, sizeof (GLastParse));
+  free (ptr);
+
+  return sp == sizeof (GLastParse) ? 0 : 1;
 }
 
 /* Get the uint32_t value from ht_general_stats given a string key.
@@ -1395,6 +2102,36 @@ ht_get_root (GModule module, int key)
   return get_is32 (hashrootmap, root_key);
 }
 
+/* Get the root key from MTRC_ROOT given an int data key, i.e., the key
+ * of its root on the keymap.
+ *
+ * If the key has no root, 0 is returned.
+ * On success the root key is returned. */
+int
+ht_get_root_key (GModule module, int key)
+{
+  void *hashroot = get_hash (module, MTRC_ROOT);
+  int root_key = 0;
+
+  if (!hashroot)
+    return 0;
+
+  root_key = get_ii32 (hashroot, key);
+
+  return root_key > 0 ? root_key : 0;
+}
+
+/* Get the max overestimation of the hits of any data key. All data
+ * keys are kept on disk, so hits are exact.
+ *
+ * On success 0 is returned */
+int
+ht_get_hitters_error (GModule module)
+{
+  (void) module;
+  return 0;
+}
+
 /* Get the int visitors value from MTRC_HITS given an int key.
  *
  * If key is not found, 0 is returned.
@@ -1405,6 +2142,7 @@ ht_get_hits (GModule module, int key)
 {
   void *hash = get_hash (module, MTRC_HITS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return -1;
 
@@ -1421,6 +2159,7 @@ ht_get_visitors (GModule module, int key)
 {
   void *hash = get_hash (module, MTRC_VISITORS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return -1;
 
@@ -1436,6 +2175,7 @@ ht_get_bw (GModule module, int key)
 {
   void *hash = get_hash (module, MTRC_BW);
 
+  SYNC_DELTAS ();
   if (!hash)
     return 0;
 
@@ -1451,6 +2191,7 @@ ht_get_cumts (GModule module, int key)
 {
   void *hash = get_hash (module, MTRC_CUMTS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return 0;
 
@@ -1466,6 +2207,7 @@ ht_get_maxts (GModule module, int key)
 {
   void *hash = get_hash (module, MTRC_MAXTS);
 
+  SYNC_DELTAS ();
   if (!hash)
     return 0;
 
@@ -1528,19 +2270,18 @@ ht_get_host_agent_val (int key)
   return get_is32 (hash, key);
 }
 
-/* Get the list value from MTRC_AGENTS given an int key.
+/* Get the user agent keys from MTRC_AGENTS given an int key, the last
+ * one seen first.
  *
  * On error, or if key is not found, NULL is returned.
- * On success the GSLList value for the given key is returned */
-GSLList *
-ht_get_host_agent_list (GModule module, int key)
+ * On success the agent keys are returned and len is set to their
+ * number. The caller is responsible for freeing them. */
+int *
+ht_get_host_agents (GModule module, int key, int *len)
 {
   void *hash = get_hash (module, MTRC_AGENTS);
-  GSLList *list;
 
-  if ((list = get_igsl (hash, key)))
-    return list;
-  return NULL;
+  return get_iags (hash, key, len);
 }
 
 /* Get the meta data uint64_t from MTRC_METADATA given a string key.
@@ -1551,48 +2292,13 @@ uint64_t
 ht_get_meta_data (GModule module, const char *key)
 {
   void *hash = get_hash (module, MTRC_METADATA);
+  SYNC_DELTAS ();
   if (!hash)
     return 0;
 
   return get_su64 (hash, key);
 }
 
-/* Get the list value from MTRC_AGENTS given an int key.
- *
- * On error, or if key is not found, NULL is returned.
- * On success the TCLIST value for the given key is returned */
-TCLIST *
-ht_get_host_agent_tclist (GModule module, int key)
-{
-  void *hash = get_hash (module, MTRC_AGENTS);
-  TCLIST *list;
-
-  if ((list = get_itcli (hash, key)))
-    return list;
-  return NULL;
-}
-
-/* Insert the values from a TCLIST into a GSLList.
- *
- * On success the GSLList is returned */
-GSLList *
-tclist_to_gsllist (TCLIST * tclist)
-{
-  GSLList *list = NULL;
-  int i, sz;
-  int *val;
-
-  for (i = 0; i < tclistnum (tclist); ++i) {
-    val = (int *) tclistval (tclist, i, &sz);
-    if (list == NULL)
-      list = list_create (int2ptr (*val));
-    else
-      list = list_insert_prepend (list, int2ptr (*val));
-  }
-
-  return list;
-}
-
 /* Calls the given function for each of the key/value pairs */
 static void
 tc_db_foreach (void *db, void (*fp) (TCADB * m, void *k, int s, void *u),
@@ -1609,30 +2315,6 @@ tc_db_foreach (void *db, void (*fp) (TCADB * m, void *k, int s, void *u),
   }
 }
 
-/* Free the key/value pair */
-static void
-free_agent_values (TCADB * adb, void *key, int ksize, GO_UNUSED void *user_data)
-{
-  void *list;
-  int sp = 0;
-
-  list = tcadbget (adb, key, ksize, &sp);
-  if (list)
-    list_remove_nodes (list);
-}
-
-/* Iterate over the each key/value pair under MTRC_AGENTS and free the and the
- * list of values */
-void
-free_agent_list (void)
-{
-  void *hash = get_hash (HOSTS, MTRC_AGENTS);
-  if (!hash)
-    return;
-
-  tc_db_foreach (hash, free_agent_values, NULL);
-}
-
 /* A wrapper to initialize a raw data structure.
  *
  * On success a GRawData structure is returned. */
@@ -1679,19 +2361,59 @@ data_iter_generic (TCADB * adb, void *key, int ksize, void *user_data)
   }
 }
 
-/* Entry point to load the raw data from the data store into our
- * GRawData structure.
+/* Load the raw data of the given data keys only, e.g., the ones that
+ * changed since the holder was loaded, into our GRawData structure.
+ * Unused keys are skipped, items are left unsorted.
  *
  * On error, NULL is returned.
- * On success the GRawData sorted is returned */
+ * On success the GRawData is returned, its size is the one of the
+ * whole store, as given by parse_raw_data(). */
 GRawData *
-parse_raw_data (GModule module)
+parse_raw_keys_data (GModule module, const int *keys, int len)
+{
+  GRawData *raw_data;
+  void *hash = NULL;
+  char *data = NULL;
+  int i, hits = 0;
+
+  SYNC_DELTAS ();
+  if (!(hash = get_hash (module, MTRC_HITS)))
+    return NULL;
+
+  raw_data = init_new_raw_data (module, len);
+  raw_data->type = module == VISITORS ? STRING : INTEGER;
+  if (module == VISITORS)
+    raw_data->size = ht_get_size_datamap (module);
+  else
+    raw_data->size = ht_get_size (hash);
+
+  for (i = 0; i < len; ++i) {
+    if (raw_data->type == STRING && (data = ht_get_datamap (module, keys[i])))
+      raw_data->items[raw_data->idx].value.svalue = data;
+    else if (raw_data->type == INTEGER && (hits = get_ii32 (hash, keys[i])))
+      raw_data->items[raw_data->idx].value.ivalue = hits;
+    else
+      continue;
+    raw_data->items[raw_data->idx++].key = keys[i];
+  }
+
+  return raw_data;
+}
+
+/* Load the raw data from the data store into our GRawData structure,
+ * sorting it if requested.
+ *
+ * On error, NULL is returned.
+ * On success the GRawData is returned */
+static GRawData *
+load_raw_data (GModule module, int sort)
 {
   GRawData *raw_data;
   GRawDataType type;
   uint32_t ht_size = 0;
   void *hash = NULL;
 
+  SYNC_DELTAS ();
   switch (module) {
   case VISITORS:
     hash = get_hash (module, MTRC_DATAMAP);
@@ -1710,6 +2432,9 @@ parse_raw_data (GModule module)
   raw_data->type = type;
 
   tc_db_foreach (hash, data_iter_generic, raw_data);
+  if (!sort)
+    return raw_data;
+
   if (raw_data->type == STRING) {
     sort_raw_str_data (raw_data, raw_data->idx);
   } else {
@@ -1718,3 +2443,25 @@ parse_raw_data (GModule module)
 
   return raw_data;
 }
+
+/* Entry point to load the raw data from the data store into our
+ * GRawData structure.
+ *
+ * On error, NULL is returned.
+ * On success the GRawData sorted is returned */
+GRawData *
+parse_raw_data (GModule module)
+{
+  return load_raw_data (module, 1);
+}
+
+/* Load all the raw data from the data store into our GRawData
+ * structure in storage order, e.g., to stream it out as it is.
+ *
+ * On error, NULL is returned.
+ * On success the unsorted GRawData is returned */
+GRawData *
+parse_raw_data_unsorted (GModule module)
+{
+  return load_raw_data (module, 0);
+}
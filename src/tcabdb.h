@@ -36,7 +36,6 @@
 
 #include <tcadb.h>
 
-#include "gslist.h"
 #include "gstorage.h"
 #include "parser.h"
 
@@ -80,14 +79,14 @@
  */
 /* MTRC_DATAMAP */
 
-/* Maps a string key made from the integer key of the
- * IP/date/UA and the integer key from the data field of
- * each module to numeric autoincremented values. e.g., "1|4"
- * => 1 -> unique visitor key (concatenated) with 4 -> data
- * key.
+/* Maps a 64-bit key made from the integer key of the
+ * IP/date/UA (upper 32 bits) and the integer key from the data
+ * field of each module (lower 32 bits) to numeric autoincremented
+ * values. e.g., (1 << 32 | 4) => 1 -> unique visitor key
+ * (concatenated) with 4 -> data key.
  *
- * "1|4" -> 1
- * "1|5" -> 2
+ * (1 << 32 | 4) -> 1
+ * (1 << 32 | 5) -> 2
  */
 /* MTRC_UNIQMAP */
 
@@ -139,10 +138,10 @@
  */
 /* MTRC_PROTOCOLS */
 
-/* Maps numeric unique user-agent keys to the
- * corresponding numeric value.
- * 1 -> 3
- * 2 -> 4
+/* Maps numeric host keys to the packed set of numeric user-agent keys
+ * seen from them, plus each host/user-agent pair on its own.
+ * 1 -> {3, 4}
+ * 2 -> {4}
  */
 /* MTRC_AGENTS */
 
@@ -162,16 +161,21 @@ typedef struct GTCStorage_
   GTCStorageMetric metrics[GSMTRC_TOTAL];
 } GTCStorage;
 
-void free_agent_list (void);
 void free_storage (void);
 void init_storage (void);
+void ht_presize_module (GModule module, uint32_t keys, uint32_t uniq);
+void ht_presize_storage (uint32_t visitors, uint32_t strings);
 
 int ht_insert_agent_key (const char *key);
 int ht_insert_agent_value (int key, const char *value);
+int ht_insert_unique_hkey (const uint64_t hkey[2]);
 int ht_insert_unique_key (const char *key);
 
 int ht_insert_agent (GModule module, int key, int value);
 int ht_insert_bw (GModule module, int key, uint64_t inc);
+int ht_insert_code_keymap (GModule module, int code, const char *key,
+                           int data);
+int ht_insert_data_keymap (GModule module, const char *key);
 int ht_insert_cumts (GModule module, int key, uint64_t inc);
 int ht_insert_datamap (GModule module, int key, const char *value);
 int ht_insert_genstats_accumulated_time (time_t elapsed);
@@ -180,13 +184,17 @@ int ht_insert_genstats (const char *key, int inc);
 int ht_insert_hits (GModule module, int key, int inc);
 int ht_insert_hostname (const char *ip, const char *host);
 int ht_insert_keymap (GModule module, const char *key);
+int ht_insert_last_parse (const char *key, const GLastParse * lp);
 int ht_insert_maxts (GModule module, int key, uint64_t value);
 int ht_insert_meta_data (GModule module, const char *key, uint64_t value);
+int ht_insert_metrics (GModule module, int key, int visitor, uint64_t bw,
+                       uint64_t ts);
 int ht_insert_method (GModule module, int key, const char *value);
 int ht_insert_protocol (GModule module, int key, const char *value);
 int ht_insert_root (GModule module, int key, int value);
 int ht_insert_rootmap (GModule module, int key, const char *value);
-int ht_insert_uniqmap (GModule module, const char *key);
+int ht_insert_uniq_hll (GModule module, int key, uint64_t hash);
+int ht_insert_uniqmap (GModule module, uint64_t key);
 int ht_insert_visitor (GModule module, int key, int inc);
 int ht_replace_genstats (const char *key, int value);
 
@@ -200,8 +208,11 @@ char *ht_get_method (GModule module, int key);
 char *ht_get_protocol (GModule module, int key);
 char *ht_get_root (GModule module, int key);
 int ht_get_hits (GModule module, int key);
+int ht_get_last_parse (const char *key, GLastParse * lp);
+int ht_get_hitters_error (GModule module);
 int ht_get_keymap (GModule module, const char *key);
-int ht_get_uniqmap (GModule module, const char *key);
+int ht_get_root_key (GModule module, int key);
+int ht_get_uniqmap (GModule module, uint64_t key);
 int ht_get_visitors (GModule module, int key);
 uint32_t ht_get_genstats (const char *key);
 uint64_t ht_get_bw (GModule module, int key);
@@ -213,13 +224,15 @@ void ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max);
 void ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max);
 void ht_get_hits_min_max (GModule module, int *min, int *max);
 void ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max);
+void ht_get_mem_shared (GSMemUsage * mem);
+void ht_get_mem_usage (GModule module, GSMetric metric, GSMemUsage * mem);
 void ht_get_visitors_min_max (GModule module, int *min, int *max);
 
-GSLList *tclist_to_gsllist (TCLIST * tclist);
-GSLList *ht_get_host_agent_list (GModule module, int key);
-TCLIST *ht_get_host_agent_tclist (GModule module, int key);
+int *ht_get_host_agents (GModule module, int key, int *len);
 
 GRawData *parse_raw_data (GModule module);
+GRawData *parse_raw_data_unsorted (GModule module);
+GRawData *parse_raw_keys_data (GModule module, const int *keys, int len);
 
 /* *INDENT-ON* */
 
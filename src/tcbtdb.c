@@ -135,36 +135,89 @@ set_dbparam (char *params, int len, const char *fmt, ...)
   return n;
 }
 
-/* Set the on-disk database parameters from enabled options in the config file. */
+/* Clamp the given value between the given bounds. */
+static uint32_t
+clamp_tune (uint64_t value, uint32_t min, uint32_t max)
+{
+  if (value < min)
+    return min;
+  if (value > max)
+    return max;
+  return value;
+}
+
+/* Set the tuning parameters of a database expected to hold the given
+ * number of records, 0 if unknown.
+ *
+ * Parameters given through the config file take precedence. Other
+ * ones take their default value unless --tune-auto is enabled, in
+ * which case they are computed out of the number of records: enough
+ * buckets and cached nodes to hold every page, and larger pages for
+ * tables that would not fit in the cache otherwise. */
+void
+tc_db_get_tune (GTCTune * tune, uint32_t records)
+{
+  uint64_t pages = 0;
+
+  tune->lcnum = conf.cache_lcnum > 0 ? conf.cache_lcnum : TC_LCNUM;
+  tune->ncnum = conf.cache_ncnum > 0 ? conf.cache_ncnum : TC_NCNUM;
+  tune->lmemb = conf.tune_lmemb > 0 ? conf.tune_lmemb : TC_LMEMB;
+  tune->nmemb = conf.tune_nmemb > 0 ? conf.tune_nmemb : TC_NMEMB;
+  tune->bnum = conf.tune_bnum > 0 ? conf.tune_bnum : TC_BNUM;
+  tune->xmmap = conf.xmmap;
+
+  if (!conf.tune_auto || records == 0)
+    return;
+
+  if (conf.tune_lmemb <= 0 && records / tune->lmemb > TC_MAX_LCNUM)
+    tune->lmemb *= 2;
+  if (conf.tune_nmemb <= 0 && records / tune->lmemb > TC_MAX_LCNUM)
+    tune->nmemb *= 2;
+
+  /* leaf pages, then bucket array about twice as large */
+  pages = records / tune->lmemb + 1;
+  if (conf.tune_bnum <= 0)
+    tune->bnum = clamp_tune (pages * 2, TC_MIN_BNUM, INT32_MAX);
+  if (conf.cache_lcnum <= 0)
+    tune->lcnum = clamp_tune (pages, TC_MIN_CACHE, TC_MAX_LCNUM);
+  if (conf.cache_ncnum <= 0)
+    tune->ncnum = clamp_tune (pages / tune->nmemb + 1, TC_MIN_CACHE,
+                              TC_MAX_NCNUM);
+  if (conf.xmmap <= 0)
+    tune->xmmap = clamp_tune ((uint64_t) records * TC_REC_SIZE, 0,
+                              TC_MAX_XMMAP);
+
+  LOG_DEBUG (("Tuned for %u records: lcnum=%u ncnum=%u lmemb=%u nmemb=%u "
+              "bnum=%u xmsiz=%lld\n", records, tune->lcnum, tune->ncnum,
+              tune->lmemb, tune->nmemb, tune->bnum,
+              (long long) tune->xmmap));
+}
+
+/* Set the on-disk database parameters from enabled options in the config
+ * file, for a database expected to hold the given number of records. */
 void
-tc_db_get_params (char *params, const char *path)
+tc_db_get_params (char *params, const char *path, uint32_t records)
 {
+  GTCTune tune;
   int len = 0;
-  long xmmap = conf.xmmap;
-  uint32_t lcnum, ncnum, lmemb, nmemb, bnum;
+
+  tc_db_get_tune (&tune, records);
 
   /* copy path name to buffer */
   len += set_dbparam (params, len, "%s", path);
 
   /* caching parameters of a B+ tree database object */
-  lcnum = conf.cache_lcnum > 0 ? conf.cache_lcnum : TC_LCNUM;
-  len += set_dbparam (params, len, "#%s=%d", "lcnum", lcnum);
-
-  ncnum = conf.cache_ncnum > 0 ? conf.cache_ncnum : TC_NCNUM;
-  len += set_dbparam (params, len, "#%s=%d", "ncnum", ncnum);
+  len += set_dbparam (params, len, "#%s=%u", "lcnum", tune.lcnum);
+  len += set_dbparam (params, len, "#%s=%u", "ncnum", tune.ncnum);
 
   /* set the size of the extra mapped memory */
-  if (xmmap > 0)
-    len += set_dbparam (params, len, "#%s=%ld", "xmsiz", xmmap);
-
-  lmemb = conf.tune_lmemb > 0 ? conf.tune_lmemb : TC_LMEMB;
-  len += set_dbparam (params, len, "#%s=%d", "lmemb", lmemb);
-
-  nmemb = conf.tune_nmemb > 0 ? conf.tune_nmemb : TC_NMEMB;
-  len += set_dbparam (params, len, "#%s=%d", "nmemb", nmemb);
+  if (tune.xmmap > 0)
+    len += set_dbparam (params, len, "#%s=%lld", "xmsiz",
+                        (long long) tune.xmmap);
 
-  bnum = conf.tune_bnum > 0 ? conf.tune_bnum : TC_BNUM;
-  len += set_dbparam (params, len, "#%s=%d", "bnum", bnum);
+  len += set_dbparam (params, len, "#%s=%u", "lmemb", tune.lmemb);
+  len += set_dbparam (params, len, "#%s=%u", "nmemb", tune.nmemb);
+  len += set_dbparam (params, len, "#%s=%u", "bnum", tune.bnum);
 
   /* compression */
   len += set_dbparam (params, len, "#%s=%c", "opts", 'l');
@@ -190,33 +243,28 @@ tc_db_get_params (char *params, const char *path)
  * On error, the program will exit.
  * On success, the opened on-disk database is returned. */
 TCBDB *
-tc_bdb_create (char *dbpath)
+tc_bdb_create (char *dbpath, uint32_t records)
 {
   TCBDB *bdb;
+  GTCTune tune;
   int ecode;
-  uint32_t lcnum, ncnum, lmemb, nmemb, bnum, flags;
+  uint32_t flags;
 
   bdb = tcbdbnew ();
-
-  lcnum = conf.cache_lcnum > 0 ? conf.cache_lcnum : TC_LCNUM;
-  ncnum = conf.cache_ncnum > 0 ? conf.cache_ncnum : TC_NCNUM;
+  tc_db_get_tune (&tune, records);
 
   /* set the caching parameters of a B+ tree database object */
-  if (!tcbdbsetcache (bdb, lcnum, ncnum)) {
+  if (!tcbdbsetcache (bdb, tune.lcnum, tune.ncnum)) {
     free (dbpath);
     FATAL ("Unable to set TCB cache");
   }
 
   /* set the size of the extra mapped memory */
-  if (conf.xmmap > 0 && !tcbdbsetxmsiz (bdb, conf.xmmap)) {
+  if (tune.xmmap > 0 && !tcbdbsetxmsiz (bdb, tune.xmmap)) {
     free (dbpath);
     FATAL ("Unable to set TCB xmmap.");
   }
 
-  lmemb = conf.tune_lmemb > 0 ? conf.tune_lmemb : TC_LMEMB;
-  nmemb = conf.tune_nmemb > 0 ? conf.tune_nmemb : TC_NMEMB;
-  bnum = conf.tune_bnum > 0 ? conf.tune_bnum : TC_BNUM;
-
   /* compression */
   flags = BDBTLARGE;
   if (conf.compression == TC_BZ2) {
@@ -226,7 +274,7 @@ tc_bdb_create (char *dbpath)
   }
 
   /* set the tuning parameters */
-  tcbdbtune (bdb, lmemb, nmemb, bnum, 8, 10, flags);
+  tcbdbtune (bdb, tune.lmemb, tune.nmemb, tune.bnum, 8, 10, flags);
 
   /* open flags */
   flags = BDBOWRITER | BDBOCREAT;
@@ -273,61 +321,65 @@ tc_bdb_close (void *db, char *dbname)
   return 0;
 }
 
-/* Compare the given integer value with one in the list object.
+/* Insert an int key and an int value into its set of values. Values
+ * are kept packed into a single record per key, in the order they were
+ * inserted. Each key/value pair is also stored on its own, so a value
+ * already in the set is found without reading the whole set.
+ * Note: If the value exists within the set, the value is not appended.
  *
- * If values are the equal, 1 is returned else 0 is returned. */
-static int
-find_int_key_in_list (void *data, void *needle)
+ * On error, -1 is returned.
+ * On success 0 is returned. */
+int
+ins_iags (void *hash, int key, int value)
 {
-  return (*(int *) data) == (*(int *) needle) ? 1 : 0;
-}
+  char pair[2 * sizeof (int)];
 
-/* Iterate over the list object and compare the current value with the given
- * value.
- *
- * If the value exists, 1 is returned else 0 is returned. */
-static int
-is_value_in_tclist (TCLIST * tclist, void *value)
-{
-  int i, sz;
-  int *val;
+  if (!hash)
+    return -1;
 
-  if (!tclist)
+  memcpy (pair, &key, sizeof (int));
+  memcpy (pair + sizeof (int), &value, sizeof (int));
+  /* already in the set, or unable to store it */
+  if (!tcbdbputkeep (hash, pair, sizeof (pair), "", 0))
     return 0;
 
-  for (i = 0; i < tclistnum (tclist); ++i) {
-    val = (int *) tclistval (tclist, i, &sz);
-    if (find_int_key_in_list (value, val))
-      return 1;
-  }
+  if (!tcbdbputcat (hash, &key, sizeof (int), &value, sizeof (int)))
+    return -1;
 
   return 0;
 }
 
-/* Insert a string key and the corresponding string value.
- * Note: If the key exists, the value is not replaced.
+/* Get a copy of the set of values of a given int key, the last one
+ * inserted first. Sets stored as one record per value are read as
+ * well.
  *
- * On error, or if found, 1 is returned.
- * On success, or if not in the list, 0 is returned. */
-int
-ins_igsl (void *hash, int key, int value)
+ * On error, or if key is not found, NULL is returned.
+ * On success the values are returned and len is set to their number. */
+int *
+get_iags (void *hash, int key, int *len)
 {
   TCLIST *list;
-  int in_list = 0;
+  const char *val;
+  int *keys = NULL;
+  int i, j, n = 0, sz = 0;
 
-  if (!hash)
-    return -1;
+  if (!hash || (list = tcbdbget4 (hash, &key, sizeof (int))) == NULL)
+    return NULL;
 
-  /* key found, check if key exists within the list */
-  if ((list = tcbdbget4 (hash, &key, sizeof (int))) != NULL) {
-    if (is_value_in_tclist (list, &value))
-      in_list = 1;
-    tclistdel (list);
+  for (i = 0; i < tclistnum (list); ++i) {
+    tclistval (list, i, &sz);
+    n += sz / sizeof (int);
   }
-  /* if not on the list, add it */
-  if (!in_list && tcbdbputdup (hash, &key, sizeof (int), &value, sizeof (int)))
-    return 0;
+  if (n > 0)
+    keys = xmalloc (n * sizeof (int));
+
+  for (i = 0, *len = n; i < tclistnum (list); ++i) {
+    val = tclistval (list, i, &sz);
+    for (j = 0; j < sz / (int) sizeof (int); ++j)
+      memcpy (&keys[--n], val + j * sizeof (int), sizeof (int));
+  }
+  tclistdel (list);
 
-  return -1;
+  return keys;
 }
 #endif
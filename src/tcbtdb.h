@@ -46,6 +46,15 @@
 #define TC_LMEMB 128
 #define TC_NMEMB 256
 #define TC_BNUM  32749
+/* bounds of the parameters computed by --tune-auto */
+#define TC_MIN_CACHE 64
+#define TC_MAX_LCNUM 16384
+#define TC_MAX_NCNUM 8192
+#define TC_MIN_BNUM  1021
+#define TC_MAX_XMMAP 268435456
+/* approximate size in bytes of a record on disk */
+#define TC_REC_SIZE  48
+#define TC_FLUSH 65536
 #define TC_DBPATH "/tmp/goaccess"
 #define TC_DBPMODE 0755
 #define TC_ZLIB 1
@@ -64,6 +73,7 @@
 #define DB_DATAMAP   "db_datamap.tcb"
 #define DB_ROOTMAP   "db_rootmap.tcb"
 #define DB_UNIQMAP   "db_uniqmap.tcb"
+#define DB_UNIQHLL   "db_uniqhll.tcb"
 #define DB_VISITORS  "db_visitors.tcb"
 #define DB_ROOT      "db_root.tcb"
 #define DB_HITS      "db_hits.tcb"
@@ -75,16 +85,29 @@
 #define DB_AGENTS    "db_agents.tcb"
 #define DB_METADATA  "db_metadata.tcb"
 
+/* Tuning parameters of an on-disk database */
+typedef struct GTCTune_
+{
+  uint32_t lcnum;               /* max num of leaf nodes to cache */
+  uint32_t ncnum;               /* max num of non-leaf nodes to cache */
+  uint32_t lmemb;               /* num of memb in each leaf page */
+  uint32_t nmemb;               /* num of memb in each non-leaf page */
+  uint32_t bnum;                /* num of elems of the bucket array */
+  int64_t xmmap;                /* size of the extra mapped memory */
+} GTCTune;
+
 /* *INDENT-OFF* */
-TCBDB *tc_bdb_create (char *dbpath);
+TCBDB *tc_bdb_create (char *dbpath, uint32_t records);
 
 char *tc_db_set_path (const char *dbname, int module);
 void tc_db_rmdir(void);
 int tc_bdb_close (void *db, char *dbname);
-void tc_db_get_params (char *params, const char *path);
+void tc_db_get_params (char *params, const char *path, uint32_t records);
+void tc_db_get_tune (GTCTune * tune, uint32_t records);
 
 #ifdef TCB_BTREE
-int ins_igsl (void *hash, int key, int value);
+int *get_iags (void *hash, int key, int *len);
+int ins_iags (void *hash, int key, int value);
 #endif
 /* *INDENT-ON* */
 
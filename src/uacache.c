@@ -0,0 +1,330 @@
+/**
+ * uacache.c -- Cache of user agent classifications
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uacache.h"
+
+#include "error.h"
+#include "gstats.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static GUACache ua_cache;
+
+/* Initialize the user agent cache. */
+void
+init_ua_cache (void)
+{
+  memset (&ua_cache, 0, sizeof (ua_cache));
+  pthread_mutex_init (&ua_cache.mutex, NULL);
+}
+
+/* Free a cache entry and all its members. */
+static void
+free_ua_entry (GUAEntry * entry)
+{
+  free (entry->agent);
+  free (entry->browser);
+  free (entry->os);
+  free (entry);
+}
+
+/* Free all the cached user agents. */
+void
+free_ua_cache (void)
+{
+  GUAEntry *entry = NULL, *next = NULL;
+
+  LOG_DEBUG (("UA cache: %llu hits, %llu misses, %d entries\n",
+              (unsigned long long) ua_cache.hits,
+              (unsigned long long) ua_cache.misses, ua_cache.size));
+
+  for (entry = ua_cache.head; entry; entry = next) {
+    next = entry->next;
+    free_ua_entry (entry);
+  }
+  pthread_mutex_destroy (&ua_cache.mutex);
+  memset (&ua_cache, 0, sizeof (ua_cache));
+}
+
+/* Hash the given user agent.
+ *
+ * On success, the 64-bit hash is returned. */
+static uint64_t
+hash_agent (const char *agent)
+{
+  uint64_t h[2];
+
+  hash128 (agent, strlen (agent), h);
+
+  return h[0];
+}
+
+/* Unlink the given entry from the LRU list. */
+static void
+lru_unlink (GUAEntry * entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    ua_cache.head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    ua_cache.tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+/* Set the given entry as the most recently used. */
+static void
+lru_push (GUAEntry * entry)
+{
+  entry->prev = NULL;
+  entry->next = ua_cache.head;
+  if (ua_cache.head)
+    ua_cache.head->prev = entry;
+  ua_cache.head = entry;
+  if (ua_cache.tail == NULL)
+    ua_cache.tail = entry;
+}
+
+/* Evict the least recently used entry. */
+static void
+evict_ua_entry (void)
+{
+  GUAEntry *entry = ua_cache.tail, **ptr = NULL;
+
+  if (entry == NULL)
+    return;
+
+  ptr = &ua_cache.buckets[entry->hash & (UA_CACHE_BUCKETS - 1)];
+  while (*ptr && *ptr != entry)
+    ptr = &(*ptr)->chain;
+  if (*ptr)
+    *ptr = entry->chain;
+
+  lru_unlink (entry);
+  free_ua_entry (entry);
+  ua_cache.size--;
+}
+
+/* Find the given user agent within the cache. Note: the cache mutex
+ * has to be held.
+ *
+ * If not found, NULL is returned.
+ * On success, the cache entry is returned and set as the most recently
+ * used. */
+static GUAEntry *
+find_ua_entry (const char *agent, uint64_t hash)
+{
+  GUAEntry *entry = ua_cache.buckets[hash & (UA_CACHE_BUCKETS - 1)];
+
+  for (; entry; entry = entry->chain) {
+    if (entry->hash == hash && strcmp (entry->agent, agent) == 0)
+      break;
+  }
+  if (entry && entry != ua_cache.head) {
+    lru_unlink (entry);
+    lru_push (entry);
+  }
+
+  return entry;
+}
+
+/* Find the given user agent within the cache, adding it if not found,
+ * evicting the least recently used entry if the cache is full. Note:
+ * the cache mutex has to be held.
+ *
+ * On success, the cache entry is returned. */
+static GUAEntry *
+get_ua_entry (const char *agent, uint64_t hash)
+{
+  GUAEntry *entry = NULL, **bucket = NULL;
+
+  if ((entry = find_ua_entry (agent, hash)))
+    return entry;
+
+  if (ua_cache.size >= UA_CACHE_SIZE)
+    evict_ua_entry ();
+
+  entry = xcalloc (1, sizeof (GUAEntry));
+  entry->agent = xstrdup (agent);
+  entry->hash = hash;
+
+  bucket = &ua_cache.buckets[hash & (UA_CACHE_BUCKETS - 1)];
+  entry->chain = *bucket;
+  *bucket = entry;
+  lru_push (entry);
+  ua_cache.size++;
+
+  return entry;
+}
+
+/* Classify the given user agent, either its browser or its operating
+ * system. verify_browser() and verify_os() modify the string they are
+ * given, hence the copy.
+ *
+ * On success, a malloc'd string containing the browser or the OS is
+ * returned. */
+static char *
+classify_agent (const char *agent, GUAClass cls, char *type)
+{
+  char *a = xstrdup (agent), *value = NULL;
+  uint64_t ts = stats_begin ();
+
+  if (cls == UA_CLASS_BROWSER)
+    value = verify_browser (a, type);
+  else
+    value = verify_os (a, type);
+  free (a);
+  stats_end (cls == UA_CLASS_BROWSER ? STATS_BROWSER : STATS_OS, ts);
+
+  return value;
+}
+
+/* Get the classified value and type members of a cache entry.
+ *
+ * On success, a pointer to the value member is returned, type and tlen
+ * are set to the type member and its size. */
+static char **
+entry_class (GUAEntry * entry, GUAClass cls, char **type, size_t * tlen)
+{
+  if (cls == UA_CLASS_BROWSER) {
+    *type = entry->browser_type;
+    *tlen = BROWSER_TYPE_LEN;
+    return &entry->browser;
+  }
+  *type = entry->os_type;
+  *tlen = OPESYS_TYPE_LEN;
+  return &entry->os;
+}
+
+/* Get the classification of the given user agent from the cache, or
+ * classify it and add it to the cache. Classifying is done without
+ * holding the cache lock, so parsing threads don't wait on each other.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned, its type is copied into type and, if an
+ * arena is given, its value is copied out of it into out. */
+static int
+lookup_agent (GArena * arena, const char *agent, GUAClass cls, char **out,
+              char *type)
+{
+  GUAEntry *entry = NULL;
+  uint64_t hash = 0;
+  char *value = NULL, **evalue = NULL, *etype = NULL;
+  char vtype[UA_TYPE_LEN] = "";
+  size_t tlen = 0;
+
+  if (agent == NULL || *agent == '\0')
+    return 1;
+
+  hash = hash_agent (agent);
+
+  pthread_mutex_lock (&ua_cache.mutex);
+  if ((entry = find_ua_entry (agent, hash)) &&
+      *(evalue = entry_class (entry, cls, &etype, &tlen)) != NULL) {
+    ua_cache.hits++;
+    goto out;
+  }
+  ua_cache.misses++;
+  pthread_mutex_unlock (&ua_cache.mutex);
+
+  if ((value = classify_agent (agent, cls, vtype)) == NULL)
+    return 1;
+
+  pthread_mutex_lock (&ua_cache.mutex);
+  entry = get_ua_entry (agent, hash);
+  evalue = entry_class (entry, cls, &etype, &tlen);
+  /* another thread may have classified it meanwhile */
+  if (*evalue == NULL) {
+    *evalue = value;
+    xstrncpy (etype, vtype, tlen);
+    value = NULL;
+  }
+
+out:
+  xstrncpy (type, etype, tlen);
+  if (arena)
+    *out = arena_strdup (arena, *evalue);
+  pthread_mutex_unlock (&ua_cache.mutex);
+  free (value);
+
+  return 0;
+}
+
+/* Get the browser of the given user agent.
+ *
+ * On error, NULL is returned.
+ * On success, the browser, allocated out of the given arena, is
+ * returned and its type is copied into type. */
+char *
+ua_cache_browser (GArena * arena, const char *agent, char *type)
+{
+  char *browser = NULL;
+
+  if (lookup_agent (arena, agent, UA_CLASS_BROWSER, &browser, type))
+    return NULL;
+
+  return browser;
+}
+
+/* Get the operating system of the given user agent.
+ *
+ * On error, NULL is returned.
+ * On success, the OS, allocated out of the given arena, is returned
+ * and its type is copied into type. */
+char *
+ua_cache_os (GArena * arena, const char *agent, char *type)
+{
+  char *os = NULL;
+
+  if (lookup_agent (arena, agent, UA_CLASS_OS, &os, type))
+    return NULL;
+
+  return os;
+}
+
+/* Determine if the user agent is a crawler.
+ *
+ * On error or is not a crawler, 0 is returned.
+ * If it is a crawler, 1 is returned. */
+int
+ua_cache_crawler (const char *agent)
+{
+  char type[BROWSER_TYPE_LEN] = "";
+
+  if (lookup_agent (NULL, agent, UA_CLASS_BROWSER, NULL, type))
+    return 0;
+
+  return strcmp (type, "Crawlers") == 0 ? 1 : 0;
+}
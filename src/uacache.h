@@ -0,0 +1,89 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2016 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UACACHE_H_INCLUDED
+#define UACACHE_H_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "browsers.h"
+#include "garena.h"
+#include "opesys.h"
+
+#define UA_CACHE_SIZE   4096    /* max number of user agents cached */
+#define UA_CACHE_BUCKETS  8192  /* power of two */
+/* size of the largest type, i.e., browser or OS type */
+#define UA_TYPE_LEN     (BROWSER_TYPE_LEN > OPESYS_TYPE_LEN ? \
+                         BROWSER_TYPE_LEN : OPESYS_TYPE_LEN)
+
+/* What a user agent is classified by */
+typedef enum GUAClass_
+{
+  UA_CLASS_BROWSER,
+  UA_CLASS_OS,
+} GUAClass;
+
+/* Classification of a single user agent */
+typedef struct GUAEntry_
+{
+  char *agent;
+  uint64_t hash;
+
+  char *browser;                /* NULL until classified */
+  char browser_type[BROWSER_TYPE_LEN];
+  char *os;                     /* NULL until classified */
+  char os_type[OPESYS_TYPE_LEN];
+
+  struct GUAEntry_ *chain;      /* next entry within the same bucket */
+  struct GUAEntry_ *prev;       /* more recently used */
+  struct GUAEntry_ *next;       /* less recently used */
+} GUAEntry;
+
+/* Bounded (LRU) cache of user agent classifications, shared across
+ * parsing threads */
+typedef struct GUACache_
+{
+  GUAEntry *buckets[UA_CACHE_BUCKETS];
+  GUAEntry *head;               /* most recently used */
+  GUAEntry *tail;               /* least recently used */
+  int size;
+
+  uint64_t hits;
+  uint64_t misses;
+  pthread_mutex_t mutex;
+} GUACache;
+
+char *ua_cache_browser (GArena * arena, const char *agent, char *type);
+char *ua_cache_os (GArena * arena, const char *agent, char *type);
+int ua_cache_crawler (const char *agent);
+void free_ua_cache (void);
+void init_ua_cache (void);
+
+#endif // for #ifndef UACACHE_H
@@ -68,6 +68,7 @@
 #include "error.h"
 #include "gmenu.h"
 #include "goaccess.h"
+#include "gstats.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -196,13 +197,23 @@ set_wbkgd (WINDOW * main_win, WINDOW * header_win)
   wrefresh (main_win);
 }
 
+/* Determine the height of the header window, including its bottom
+ * padding line. The processing stats take an extra line.
+ *
+ * Returns the header height. */
+int
+get_header_height (void)
+{
+  return MAX_HEIGHT_HEADER + (conf.processing_stats ? 1 : 0);
+}
+
 /* Creates and the new terminal windows and set basic properties to
  * each of them. e.g., background color, enable the reading of
  * function keys. */
 void
 init_windows (WINDOW ** header_win, WINDOW ** main_win)
 {
-  int row = 0, col = 0;
+  int row = 0, col = 0, head = get_header_height ();
 
   /* init standard screen */
   getmaxyx (stdscr, row, col);
@@ -210,13 +221,13 @@ init_windows (WINDOW ** header_win, WINDOW ** main_win)
     FATAL ("Minimum screen size - 0 columns by 7 lines");
 
   /* init header screen */
-  *header_win = newwin (6, col, 0, 0);
+  *header_win = newwin (head - 1, col, 0, 0);
   keypad (*header_win, TRUE);
   if (*header_win == NULL)
     FATAL ("Unable to allocate memory for header_win.");
 
   /* init main screen */
-  *main_win = newwin (row - 8, col, 7, 0);
+  *main_win = newwin (row - head - MAX_HEIGHT_FOOTER, col, head, 0);
   keypad (*main_win, TRUE);
   if (*main_win == NULL)
     FATAL ("Unable to allocate memory for main_win.");
@@ -253,7 +264,7 @@ term_size (WINDOW * main_win, int *main_win_height)
 
   getmaxyx (stdscr, term_h, term_w);
 
-  *main_win_height = term_h - (MAX_HEIGHT_HEADER + MAX_HEIGHT_FOOTER);
+  *main_win_height = term_h - (get_header_height () + MAX_HEIGHT_FOOTER);
   wresize (main_win, *main_win_height, term_w);
   wmove (main_win, *main_win_height, 0);
 }
@@ -499,7 +510,7 @@ get_str_static_reqs (void)
 static char *
 get_str_visitors (void)
 {
-  return int2str (ht_get_size_uniqmap (VISITORS), 0);
+  return int2str (get_overall_visitors (), 0);
 }
 
 /* Convert the time taken to process the log to a string.
@@ -704,7 +715,8 @@ display_general (WINDOW * win, GLog * glog, GHolder * h)
     {T_EXCLUDE_IP      , get_str_excluded_ips (glog)  , colorlbl, colorval, 0},
     {T_UNIQUE404       , get_str_notfound_reqs ()     , colorlbl, colorval, 0},
     {T_BW              , get_str_bandwidth (glog)     , colorlbl, colorval, 0},
-    {T_LOG_PATH        , get_str_logfile ()           , colorlbl, colorpth, 1}
+    {T_LOG_PATH        , get_str_logfile ()           , colorlbl, colorpth, 1},
+    {T_PROC_STATS      , get_str_proc_stats ()        , colorlbl, colorpth, 1}
   };
   /* *INDENT-ON* */
 
@@ -712,7 +724,8 @@ display_general (WINDOW * win, GLog * glog, GHolder * h)
   render_overall_header (win, h);
 
   n = ARRAY_SIZE (fields);
-  render_overall_statistics (win, fields, n);
+  /* processing stats take the last line of the header, if enabled */
+  render_overall_statistics (win, fields, conf.processing_stats ? n : n - 1);
 
   for (i = 0; i < n; i++) {
     free (fields[i].value);
@@ -882,90 +895,44 @@ fill_host_agents_gmenu (void *val, void *user_data)
   return 0;
 }
 
-/* Iterate over the linked-list of user agents for the given host and
- * load its data into the given menu. */
+/* Iterate over the user agent keys for the given host and load its
+ * data into the given menu. */
 static void
 load_host_agents_gmenu (void *list, void *user_data, int count)
 {
-  GSLList *lst = list;
+  int *keys = list, i;
   GMenu *menu = user_data;
 
   menu->items = (GItem *) xcalloc (count, sizeof (GItem));
-  list_foreach (lst, fill_host_agents_gmenu, menu);
+  for (i = 0; i < count; ++i)
+    fill_host_agents_gmenu (&keys[i], menu);
 }
 
-/* Set host data from a linked-list and load its data into a GMenu
- * structure.
+/* Set host data from its user agent keys and load its data into a
+ * GMenu structure.
  *
  * On error, the 1 is returned.
  * On success, 0 is returned. */
-#ifdef TCB_BTREE
 int
 set_host_agents (const char *addr, void (*func) (void *, void *, int),
                  void *arr)
 {
-  TCLIST *tclist;
-  GSLList *list;
-  int key, count = 0;
-
-  key = ht_get_keymap (HOSTS, addr);
-  if (key == 0)
-    return 1;
-
-  tclist = ht_get_host_agent_tclist (HOSTS, key);
-  if (!tclist)
-    return 1;
-
-  list = tclist_to_gsllist (tclist);
-  if ((count = list_count (list)) == 0) {
-    free (list);
-    return 1;
-  }
-
-  func (list, arr, count);
-
-  list_remove_nodes (list);
-  tclistdel (tclist);
-
-  return 0;
-}
-#endif
-
-/* Set host data from a linked-list and load its data into a GMenu
- * structure.
- *
- * On error, the 1 is returned.
- * On success, 0 is returned. */
-#ifndef TCB_BTREE
-int
-set_host_agents (const char *addr, void (*func) (void *, void *, int),
-                 void *arr)
-{
-  GSLList *list;
+  int *keys = NULL;
   int data_nkey, count = 0;
 
   data_nkey = ht_get_keymap (HOSTS, addr);
   if (data_nkey == 0)
     return 1;
 
-  list = ht_get_host_agent_list (HOSTS, data_nkey);
-  if (!list)
-    return 1;
-
-  if ((count = list_count (list)) == 0) {
-    free (list);
+  keys = ht_get_host_agents (HOSTS, data_nkey, &count);
+  if (!keys)
     return 1;
-  }
-
-  func (list, arr, count);
 
-#ifdef TCB_MEMHASH
-  free (list);
-#endif
+  func (keys, arr, count);
+  free (keys);
 
   return 0;
 }
-#endif
 
 /* Render a list of agents if available for the selected host/IP. */
 void
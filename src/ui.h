@@ -94,6 +94,8 @@
 #define OVERALL_LOGSIZE   "log_size"
 #define OVERALL_BANDWIDTH "bandwidth"
 #define OVERALL_LOG       "log_path"
+#define OVERALL_PROCSTATS "processing_stats"
+#define OVERALL_MEMUSAGE  "memory_usage"
 
 /* CONFIG DIALOG */
 #define CONF_MENU_H       6
@@ -240,6 +242,7 @@ void draw_header (WINDOW * win, const char *s, const char *fmt, int y, int x, in
 void end_spinner (void);
 void generate_time (void);
 void init_colors (int force);
+int get_header_height (void);
 void init_windows (WINDOW ** header_win, WINDOW ** main_win);
 void load_agent_list (WINDOW * main_win, char *addr);
 void load_help_popup (WINDOW * main_win);
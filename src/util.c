@@ -42,6 +42,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <time.h>
 
@@ -57,79 +58,84 @@
 #include "labels.h"
 #include "xmalloc.h"
 
-/* HTTP status codes categories */
-static const char *code_type[][2] = {
-  {"1", STATUS_CODE_1XX},
-  {"2", STATUS_CODE_2XX},
-  {"3", STATUS_CODE_3XX},
-  {"4", STATUS_CODE_4XX},
-  {"5", STATUS_CODE_5XX},
+/* HTTP status codes categories, indexed by the hundreds of the code */
+static const char *code_type[] = {
+  NULL,
+  STATUS_CODE_1XX,
+  STATUS_CODE_2XX,
+  STATUS_CODE_3XX,
+  STATUS_CODE_4XX,
+  STATUS_CODE_5XX,
 };
 
-/* HTTP status codes */
-static const char *codes[][2] = {
-  {"100", STATUS_CODE_100},
-  {"101", STATUS_CODE_101},
-  {"200", STATUS_CODE_200},
-  {"201", STATUS_CODE_201},
-  {"202", STATUS_CODE_202},
-  {"203", STATUS_CODE_203},
-  {"204", STATUS_CODE_204},
-  {"205", STATUS_CODE_205},
-  {"206", STATUS_CODE_206},
-  {"207", STATUS_CODE_207},
-  {"208", STATUS_CODE_208},
-  {"300", STATUS_CODE_300},
-  {"301", STATUS_CODE_301},
-  {"302", STATUS_CODE_302},
-  {"303", STATUS_CODE_303},
-  {"304", STATUS_CODE_304},
-  {"305", STATUS_CODE_305},
-  {"307", STATUS_CODE_307},
-  {"400", STATUS_CODE_400},
-  {"401", STATUS_CODE_401},
-  {"402", STATUS_CODE_402},
-  {"403", STATUS_CODE_403},
-  {"404", STATUS_CODE_404},
-  {"405", STATUS_CODE_405},
-  {"406", STATUS_CODE_406},
-  {"407", STATUS_CODE_407},
-  {"408", STATUS_CODE_408},
-  {"409", STATUS_CODE_409},
-  {"410", STATUS_CODE_410},
-  {"411", STATUS_CODE_411},
-  {"412", STATUS_CODE_412},
-  {"413", STATUS_CODE_413},
-  {"414", STATUS_CODE_414},
-  {"415", STATUS_CODE_415},
-  {"416", STATUS_CODE_416},
-  {"417", STATUS_CODE_417},
-  {"421", STATUS_CODE_421},
-  {"422", STATUS_CODE_422},
-  {"423", STATUS_CODE_423},
-  {"424", STATUS_CODE_424},
-  {"426", STATUS_CODE_426},
-  {"428", STATUS_CODE_428},
-  {"429", STATUS_CODE_429},
-  {"431", STATUS_CODE_431},
-  {"444", STATUS_CODE_444},
-  {"451", STATUS_CODE_451},
-  {"494", STATUS_CODE_494},
-  {"495", STATUS_CODE_495},
-  {"496", STATUS_CODE_496},
-  {"497", STATUS_CODE_497},
-  {"499", STATUS_CODE_499},
-  {"500", STATUS_CODE_500},
-  {"501", STATUS_CODE_501},
-  {"502", STATUS_CODE_502},
-  {"503", STATUS_CODE_503},
-  {"504", STATUS_CODE_504},
-  {"505", STATUS_CODE_505},
-  {"520", STATUS_CODE_520},
-  {"521", STATUS_CODE_521},
-  {"522", STATUS_CODE_522},
-  {"523", STATUS_CODE_523},
-  {"524", STATUS_CODE_524}
+/* HTTP status codes, sorted by code */
+static const struct
+{
+  int code;
+  const char *desc;
+} codes[] = {
+  {100, STATUS_CODE_100},
+  {101, STATUS_CODE_101},
+  {200, STATUS_CODE_200},
+  {201, STATUS_CODE_201},
+  {202, STATUS_CODE_202},
+  {203, STATUS_CODE_203},
+  {204, STATUS_CODE_204},
+  {205, STATUS_CODE_205},
+  {206, STATUS_CODE_206},
+  {207, STATUS_CODE_207},
+  {208, STATUS_CODE_208},
+  {300, STATUS_CODE_300},
+  {301, STATUS_CODE_301},
+  {302, STATUS_CODE_302},
+  {303, STATUS_CODE_303},
+  {304, STATUS_CODE_304},
+  {305, STATUS_CODE_305},
+  {307, STATUS_CODE_307},
+  {400, STATUS_CODE_400},
+  {401, STATUS_CODE_401},
+  {402, STATUS_CODE_402},
+  {403, STATUS_CODE_403},
+  {404, STATUS_CODE_404},
+  {405, STATUS_CODE_405},
+  {406, STATUS_CODE_406},
+  {407, STATUS_CODE_407},
+  {408, STATUS_CODE_408},
+  {409, STATUS_CODE_409},
+  {410, STATUS_CODE_410},
+  {411, STATUS_CODE_411},
+  {412, STATUS_CODE_412},
+  {413, STATUS_CODE_413},
+  {414, STATUS_CODE_414},
+  {415, STATUS_CODE_415},
+  {416, STATUS_CODE_416},
+  {417, STATUS_CODE_417},
+  {421, STATUS_CODE_421},
+  {422, STATUS_CODE_422},
+  {423, STATUS_CODE_423},
+  {424, STATUS_CODE_424},
+  {426, STATUS_CODE_426},
+  {428, STATUS_CODE_428},
+  {429, STATUS_CODE_429},
+  {431, STATUS_CODE_431},
+  {444, STATUS_CODE_444},
+  {451, STATUS_CODE_451},
+  {494, STATUS_CODE_494},
+  {495, STATUS_CODE_495},
+  {496, STATUS_CODE_496},
+  {497, STATUS_CODE_497},
+  {499, STATUS_CODE_499},
+  {500, STATUS_CODE_500},
+  {501, STATUS_CODE_501},
+  {502, STATUS_CODE_502},
+  {503, STATUS_CODE_503},
+  {504, STATUS_CODE_504},
+  {505, STATUS_CODE_505},
+  {520, STATUS_CODE_520},
+  {521, STATUS_CODE_521},
+  {522, STATUS_CODE_522},
+  {523, STATUS_CODE_523},
+  {524, STATUS_CODE_524}
 };
 
 /* Return part of a string
@@ -216,7 +222,7 @@ count_matches (const char *s1, char c)
  * If no match found, 1 is returned.
  * If match found, 0 is returned. */
 static int
-wc_match (const char *wc, char *str)
+wc_match (const char *wc, const char *str)
 {
   while (*wc && *str) {
     if (*wc == '*') {
@@ -239,36 +245,131 @@ wc_match (const char *wc, char *str)
   return 0;
 }
 
-/* Determine if the given host needs to be ignored given the list of
- * referrers to ignore.
+/* Compiled --ignore-referer and --hide-referer patterns. */
+static GRefMatcher ignore_refs;
+static GRefMatcher hide_refs;
+
+/* Find the slot of the given string within the given open addressing
+ * set of referrers.
  *
- * On error, or the referrer is not found, 0 is returned
- * On success, or if the host needs to be ignored, 1 is returned */
-int
-ignore_referer (const char *host)
+ * If the string is not in the set, the first empty slot is returned.
+ * If the string is in the set, its slot is returned. */
+static uint32_t
+find_ref_slot (const char *const *set, const char *str)
 {
-  char *needle = NULL;
-  int i, ignore = 0;
+  const unsigned char *p = (const unsigned char *) str;
+  uint32_t h = 2166136261u;
+  const char *slot = NULL;
+
+  for (; *p; ++p) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+
+  h &= REF_MATCH_SLOTS - 1;
+  while ((slot = set[h]) != NULL && strcmp (slot, str) != 0)
+    h = (h + 1) & (REF_MATCH_SLOTS - 1);
+
+  return h;
+}
+
+/* Add the given string to the given open addressing set of referrers. */
+static void
+add_ref_slot (const char **set, const char *str)
+{
+  set[find_ref_slot (set, str)] = str;
+}
+
+/* Compile the given list of referrer patterns into the given matcher.
+ *
+ * A '*' matches up to the first occurrence of the character that
+ * follows it, thus '*' followed by a literal only matches a host whose
+ * tail, from the first occurrence of the literal's first character,
+ * equals the literal. */
+static void
+compile_referers (GRefMatcher * m, const char *const *refs, int len)
+{
+  const char *ref = NULL, *lit = NULL;
+  int i, j;
+
+  memset (m, 0, sizeof (GRefMatcher));
+  for (i = 0; i < len; ++i) {
+    ref = refs[i];
+    if (ref == NULL || *ref == '\0')
+      continue;
+
+    for (lit = ref; *lit == '*'; ++lit);
+    if (*lit == '\0') {
+      m->any = 1;
+    } else if (strpbrk (lit, "*?") != NULL) {
+      m->wild[m->wild_len++] = ref;
+    } else if (lit == ref) {
+      add_ref_slot (m->exact, ref);
+    } else {
+      add_ref_slot (m->suffix, lit);
+      for (j = 0; j < m->firsts_len && m->firsts[j] != *lit; ++j);
+      if (j == m->firsts_len)
+        m->firsts[m->firsts_len++] = *lit;
+    }
+  }
+}
+
+/* Compile the referrers to ignore and to hide once, so a log line does
+ * not need to go through each pattern. This needs to be called before
+ * parsing the log. */
+void
+init_referer_matchers (void)
+{
+  compile_referers (&ignore_refs, conf.ignore_referers,
+                    conf.ignore_referer_idx);
+  compile_referers (&hide_refs, conf.hide_referers, conf.hide_referer_idx);
+}
+
+/* Determine if the given host matches one of the compiled referrer
+ * patterns.
+ *
+ * If no pattern matches, 0 is returned
+ * If a pattern matches, 1 is returned */
+static int
+match_referer (const GRefMatcher * m, const char *host)
+{
+  const char *p = NULL;
+  int i;
 
-  if (conf.ignore_referer_idx == 0)
-    return 0;
   if (host == NULL || *host == '\0')
     return 0;
+  if (m->any)
+    return 1;
 
-  needle = xstrdup (host);
-  for (i = 0; i < conf.ignore_referer_idx; ++i) {
-    if (conf.ignore_referers[i] == NULL || *conf.ignore_referers[i] == '\0')
+  if (m->exact[find_ref_slot (m->exact, host)] != NULL)
+    return 1;
+
+  for (i = 0; i < m->firsts_len; ++i) {
+    if ((p = strchr (host, m->firsts[i])) == NULL)
       continue;
+    if (m->suffix[find_ref_slot (m->suffix, p)] != NULL)
+      return 1;
+  }
 
-    if (wc_match (conf.ignore_referers[i], needle)) {
-      ignore = 1;
-      goto out;
-    }
+  for (i = 0; i < m->wild_len; ++i) {
+    if (wc_match (m->wild[i], host))
+      return 1;
   }
-out:
-  free (needle);
 
-  return ignore;
+  return 0;
+}
+
+/* Determine if the given host needs to be ignored given the list of
+ * referrers to ignore.
+ *
+ * On error, or the referrer is not found, 0 is returned
+ * On success, or if the host needs to be ignored, 1 is returned */
+int
+ignore_referer (const char *host)
+{
+  if (conf.ignore_referer_idx == 0)
+    return 0;
+  return match_referer (&ignore_refs, host);
 }
 
 /* Determine if the given host needs to be hidden given the list of
@@ -279,69 +380,232 @@ out:
 int
 hide_referer (const char *host)
 {
-  char *needle = NULL;
-  int i, ignore = 0;
-
   if (conf.hide_referer_idx == 0)
     return 0;
-  if (host == NULL || *host == '\0')
-    return 0;
+  return match_referer (&hide_refs, host);
+}
 
-  needle = xstrdup (host);
-  for (i = 0; i < conf.hide_referer_idx; ++i) {
-    if (conf.hide_referers[i] == NULL || *conf.hide_referers[i] == '\0')
-      continue;
+/* Parsed --exclude-ip entries. IPv4 and IPv6 ranges are kept apart,
+ * sorted and merged so a lookup is a binary search. */
+static GIPRange *ip4_ranges = NULL;
+static GIPRange *ip6_ranges = NULL;
+static int ip4_ranges_len = 0;
+static int ip6_ranges_len = 0;
+/* entries that are not an IP, matched as given */
+static const char **ip_strs = NULL;
+static int ip_strs_len = 0;
+
+/* Convert the given IPv4 or IPv6 address into its binary form. IPv4
+ * addresses are stored in the lower 32 bits.
+ *
+ * On error, 0 is returned.
+ * On success, the address is set and AF_INET or AF_INET6 is returned. */
+static int
+ip_to_addr (const char *ip, GIPAddr * addr)
+{
+  struct in6_addr addr6;
+  struct in_addr addr4;
+  const unsigned char *b = NULL;
+  int i;
 
-    if (wc_match (conf.hide_referers[i], needle)) {
-      ignore = 1;
+  if (1 == inet_pton (AF_INET, ip, &addr4)) {
+    addr->hi = 0;
+    addr->lo = ntohl (addr4.s_addr);
+    return AF_INET;
+  }
+  if (1 == inet_pton (AF_INET6, ip, &addr6)) {
+    b = addr6.s6_addr;
+    addr->hi = addr->lo = 0;
+    for (i = 0; i < 8; ++i) {
+      addr->hi = (addr->hi << 8) | b[i];
+      addr->lo = (addr->lo << 8) | b[i + 8];
+    }
+    return AF_INET6;
+  }
+
+  return 0;
+}
+
+/* Compare two binary IP addresses. */
+static int
+cmp_ip_addr (const GIPAddr * a, const GIPAddr * b)
+{
+  if (a->hi != b->hi)
+    return a->hi < b->hi ? -1 : 1;
+  if (a->lo != b->lo)
+    return a->lo < b->lo ? -1 : 1;
+  return 0;
+}
+
+/* Compare two IP ranges by their start address, used by qsort. */
+static int
+cmp_ip_range (const void *a, const void *b)
+{
+  return cmp_ip_addr (&((const GIPRange *) a)->start,
+                      &((const GIPRange *) b)->start);
+}
+
+/* Set the last address of the network given its first address and
+ * the length of its prefix. */
+static void
+set_cidr_range (GIPRange * range, int family, int prefix)
+{
+  int host = (family == AF_INET ? 32 : 128) - prefix;
+  uint64_t lomask = 0, himask = 0;
+
+  if (host >= 64) {
+    lomask = ~0ULL;
+    himask = host == 128 ? ~0ULL : (1ULL << (host - 64)) - 1;
+  } else if (host > 0) {
+    lomask = (1ULL << host) - 1;
+  }
+
+  range->start.hi &= ~himask;
+  range->start.lo &= ~lomask;
+  range->end.hi = range->start.hi | himask;
+  range->end.lo = range->start.lo | lomask;
+}
+
+/* Parse a single IP, an IP range (start-end) or a network in CIDR
+ * notation (ip/prefix) into a binary range.
+ *
+ * On error, 0 is returned.
+ * On success, the range is set and AF_INET or AF_INET6 is returned. */
+static int
+parse_ip_range (const char *str, GIPRange * range)
+{
+  char *start = NULL, *end = NULL, *sep = NULL;
+  char *endptr = NULL, delim = 0;
+  int family = 0;
+  long n = 0;
+
+  start = xstrdup (str);
+  if ((sep = strpbrk (start, "-/")) != NULL) {
+    delim = *sep;
+    end = sep + 1;
+    *sep = '\0';
+  }
+
+  if ((family = ip_to_addr (start, &range->start)) == 0)
+    goto out;
+  range->end = range->start;
+
+  /* start-end */
+  if (delim == '-') {
+    if (ip_to_addr (end, &range->end) != family ||
+        cmp_ip_addr (&range->start, &range->end) > 0)
+      family = 0;
+  }
+  /* ip/prefix */
+  else if (delim == '/') {
+    errno = 0;
+    n = strtol (end, &endptr, 10);
+    if (errno || *end == '\0' || *endptr != '\0' || n < 0 ||
+        n > (family == AF_INET ? 32 : 128)) {
+      family = 0;
       goto out;
     }
+    set_cidr_range (range, family, (int) n);
   }
-out:
-  free (needle);
 
-  return ignore;
+out:
+  free (start);
+  return family;
 }
 
-/* Determine if the given ip is within a range of IPs.
+/* Sort the given ranges and merge the ones that overlap.
  *
- * On error, or not within the range, 0 is returned
- * On success, or if within the range, 1 is returned */
+ * On success, the new number of ranges is returned. */
 static int
-within_range (const char *ip, const char *start, const char *end)
+merge_ip_ranges (GIPRange * ranges, int len)
 {
-  struct in6_addr addr6, start6, end6;
-  struct in_addr addr4, start4, end4;
+  int i, j = 0;
 
-  if (start == NULL || *start == '\0')
-    return 0;
-  if (end == NULL || *end == '\0')
-    return 0;
-  if (ip == NULL || *ip == '\0')
+  if (len == 0)
     return 0;
 
-  /* IPv4 */
-  if (1 == inet_pton (AF_INET, ip, &addr4)) {
-    if (1 != inet_pton (AF_INET, start, &start4))
-      return 0;
-    if (1 != inet_pton (AF_INET, end, &end4))
-      return 0;
-    if (memcmp (&addr4, &start4, sizeof (addr4)) >= 0 &&
-        memcmp (&addr4, &end4, sizeof (addr4)) <= 0)
-      return 1;
+  qsort (ranges, len, sizeof (GIPRange), cmp_ip_range);
+  for (i = 1; i < len; ++i) {
+    if (cmp_ip_addr (&ranges[i].start, &ranges[j].end) <= 0) {
+      if (cmp_ip_addr (&ranges[i].end, &ranges[j].end) > 0)
+        ranges[j].end = ranges[i].end;
+      continue;
+    }
+    ranges[++j] = ranges[i];
   }
-  /* IPv6 */
-  else if (1 == inet_pton (AF_INET6, ip, &addr6)) {
-    if (1 != inet_pton (AF_INET6, start, &start6))
-      return 0;
-    if (1 != inet_pton (AF_INET6, end, &end6))
-      return 0;
-    if (memcmp (&addr6, &start6, sizeof (addr6)) >= 0 &&
-        memcmp (&addr6, &end6, sizeof (addr6)) <= 0)
-      return 1;
+
+  return j + 1;
+}
+
+/* Free the parsed list of IPs to exclude. */
+void
+free_ip_ranges (void)
+{
+  free (ip4_ranges);
+  free (ip6_ranges);
+  free (ip_strs);
+  ip4_ranges = ip6_ranges = NULL;
+  ip_strs = NULL;
+  ip4_ranges_len = ip6_ranges_len = ip_strs_len = 0;
+}
+
+/* Parse the list of IPs to exclude (--exclude-ip) once, so a log line
+ * only needs to convert its own IP. This needs to be called before
+ * parsing the log. */
+void
+init_ip_ranges (void)
+{
+  GIPRange range;
+  const char *ip = NULL;
+  int i, family;
+
+  free_ip_ranges ();
+  if (conf.ignore_ip_idx == 0)
+    return;
+
+  ip4_ranges = xcalloc (conf.ignore_ip_idx, sizeof (GIPRange));
+  ip6_ranges = xcalloc (conf.ignore_ip_idx, sizeof (GIPRange));
+  ip_strs = xcalloc (conf.ignore_ip_idx, sizeof (char *));
+
+  for (i = 0; i < conf.ignore_ip_idx; ++i) {
+    ip = conf.ignore_ips[i];
+    if (ip == NULL || *ip == '\0')
+      continue;
+
+    family = parse_ip_range (ip, &range);
+    if (family == AF_INET)
+      ip4_ranges[ip4_ranges_len++] = range;
+    else if (family == AF_INET6)
+      ip6_ranges[ip6_ranges_len++] = range;
+    /* not an IP, e.g., a hostname, match it as a string */
+    else if (strpbrk (ip, "-/") == NULL)
+      ip_strs[ip_strs_len++] = ip;
   }
 
-  return 0;
+  ip4_ranges_len = merge_ip_ranges (ip4_ranges, ip4_ranges_len);
+  ip6_ranges_len = merge_ip_ranges (ip6_ranges, ip6_ranges_len);
+}
+
+/* Determine if the given binary IP is within one of the given sorted
+ * and non-overlapping ranges.
+ *
+ * If not within any range, 0 is returned
+ * If within a range, 1 is returned */
+static int
+within_ranges (const GIPRange * ranges, int len, const GIPAddr * addr)
+{
+  int lo = 0, hi = len - 1, mid;
+
+  /* find the last range starting at or before the given IP */
+  while (lo <= hi) {
+    mid = lo + (hi - lo) / 2;
+    if (cmp_ip_addr (&ranges[mid].start, addr) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return hi >= 0 && cmp_ip_addr (addr, &ranges[hi].end) <= 0;
 }
 
 /* Determine if the given IP needs to be ignored given the list of IPs
@@ -352,36 +616,22 @@ within_range (const char *ip, const char *start, const char *end)
 int
 ip_in_range (const char *ip)
 {
-  char *start = NULL, *end, *dash;
+  GIPAddr addr;
   int i;
 
-  for (i = 0; i < conf.ignore_ip_idx; ++i) {
-    end = NULL;
-    if (conf.ignore_ips[i] == NULL || *conf.ignore_ips[i] == '\0')
-      continue;
+  if (ip == NULL || *ip == '\0')
+    return 0;
 
-    start = xstrdup (conf.ignore_ips[i]);
-    /* split range */
-    if ((dash = strchr (start, '-')) != NULL) {
-      *dash = '\0';
-      end = dash + 1;
-    }
+  switch (ip_to_addr (ip, &addr)) {
+  case AF_INET:
+    return within_ranges (ip4_ranges, ip4_ranges_len, &addr);
+  case AF_INET6:
+    return within_ranges (ip6_ranges, ip6_ranges_len, &addr);
+  }
 
-    /* matches single IP */
-    if (end == NULL && start) {
-      if (strcmp (ip, start) == 0) {
-        free (start);
-        return 1;
-      }
-    }
-    /* within range */
-    else if (start && end) {
-      if (within_range (ip, start, end)) {
-        free (start);
-        return 1;
-      }
-    }
-    free (start);
+  for (i = 0; i < ip_strs_len; ++i) {
+    if (strcmp (ip, ip_strs[i]) == 0)
+      return 1;
   }
 
   return 0;
@@ -418,6 +668,7 @@ find_output_type (char **filename, const char *ext, int alloc)
  * 1) .csv
  * 2) .json
  * 3) .html
+ * 4) .arrow
  *
  * Return Value
  * 1: valid
@@ -434,9 +685,9 @@ valid_output_type (const char *filename)
     return -1;
 
   ext++;
-  /* Is extension 3<=len<=4? */
+  /* Is extension 3<=len<=5? */
   sl = strlen (ext);
-  if (sl < 3 || sl > 4)
+  if (sl < 3 || sl > 5)
     return 0;
 
   if (strcmp ("html", ext) == 0)
@@ -448,6 +699,9 @@ valid_output_type (const char *filename)
   if (strcmp ("csv", ext) == 0)
     return 1;
 
+  if (strcmp ("arrow", ext) == 0)
+    return 1;
+
   return 0;
 }
 
@@ -471,6 +725,32 @@ get_home (void)
   return path;
 }
 
+/* Reserve a temporary path for a file of the given kind, e.g., a
+ * shard, a segment of the time window or a synthetic log.
+ *
+ * On error, NULL is returned.
+ * On success the newly allocated path is returned. */
+char *
+new_tmp_path (const char *kind)
+{
+  const char *dir = getenv ("TMPDIR");
+  char *path = NULL;
+  int fd;
+
+  if (!dir || *dir == '\0')
+    dir = "/tmp";
+
+  path = xmalloc (snprintf (NULL, 0, "%s/goaccess-%s-XXXXXX", dir, kind) + 1);
+  sprintf (path, "%s/goaccess-%s-XXXXXX", dir, kind);
+  if ((fd = mkstemp (path)) == -1) {
+    free (path);
+    return NULL;
+  }
+  close (fd);
+
+  return path;
+}
+
 /* Get the path to the global config file.
  *
  * On success, the path of the global config file is returned. */
@@ -503,6 +783,152 @@ get_visitors_date (const char *odate, const char *from, const char *to)
   return xstrdup ("---");
 }
 
+/* Parse exactly len digits from the given string.
+ *
+ * If not all of them are digits, -1 is returned.
+ * On success, the numeric value is returned. */
+static int
+parse_digits (const char **str, int len)
+{
+  const char *s = *str;
+  int i, val = 0;
+
+  for (i = 0; i < len; ++i) {
+    if (s[i] < '0' || s[i] > '9')
+      return -1;
+    val = val * 10 + (s[i] - '0');
+  }
+  *str += len;
+
+  return val;
+}
+
+/* Parse an English abbreviated month name, e.g., Oct.
+ *
+ * If not a valid month, -1 is returned.
+ * On success, the month index (0-11) is returned. */
+static int
+parse_month_abbr (const char **str)
+{
+  static const char *months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+  int i;
+
+  for (i = 0; i < 12; ++i) {
+    if (strncasecmp (*str, months[i], 3) == 0) {
+      *str += 3;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* Set the day of the week and the day of the year the same way
+ * strptime(3) does it once the date is known. */
+static void
+set_week_year_day (struct tm *tm)
+{
+  static const int mon_yday[2][13] = {
+    {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
+    {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366},
+  };
+  int year = 1900 + tm->tm_year;
+  int leap = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+  int corr_year = year - (tm->tm_mon < 2);
+  int wday = (-473 + (365 * (tm->tm_year - 70)) + (corr_year / 4)
+              - ((corr_year / 4) / 25) + ((corr_year / 4) % 25 < 0)
+              + (((corr_year / 4) / 25) / 4)
+              + mon_yday[0][tm->tm_mon] + tm->tm_mday - 1);
+
+  tm->tm_wday = ((wday % 7) + 7) % 7;
+  tm->tm_yday = mon_yday[leap][tm->tm_mon] + tm->tm_mday - 1;
+}
+
+/* Fast path for the most common date/time formats, i.e., %d/%b/%Y,
+ * %Y-%m-%d, %H:%M:%S, %T or ISO 8601 combinations of them. Only strictly
+ * formed fields are handled here (zero-padded numbers, no spaces), so
+ * anything else is left to strptime(3).
+ *
+ * If the format or the string is not handled, -1 is returned.
+ * On success, 0 is returned. */
+static int
+fast_str_to_time (const char *str, const char *fmt, struct tm *tm)
+{
+  const char *f = NULL;
+  int val = 0, has_date = 0;
+
+  for (f = fmt; *f; ++f) {
+    if (*f != '%') {
+      if (isspace ((unsigned char) *f) || *str++ != *f)
+        return -1;
+      continue;
+    }
+
+    switch (*++f) {
+    case 'd':
+      if ((val = parse_digits (&str, 2)) < 1 || val > 31)
+        return -1;
+      tm->tm_mday = val;
+      has_date = 1;
+      break;
+    case 'm':
+      if ((val = parse_digits (&str, 2)) < 1 || val > 12)
+        return -1;
+      tm->tm_mon = val - 1;
+      has_date = 1;
+      break;
+    case 'b':
+      if ((val = parse_month_abbr (&str)) == -1)
+        return -1;
+      tm->tm_mon = val;
+      has_date = 1;
+      break;
+    case 'Y':
+      if ((val = parse_digits (&str, 4)) == -1)
+        return -1;
+      tm->tm_year = val - 1900;
+      has_date = 1;
+      break;
+    case 'T':
+    case 'H':
+      if ((val = parse_digits (&str, 2)) == -1 || val > 23)
+        return -1;
+      tm->tm_hour = val;
+      if (*f == 'H')
+        break;
+      if (*str++ != ':' || (val = parse_digits (&str, 2)) == -1 || val > 59)
+        return -1;
+      tm->tm_min = val;
+      if (*str++ != ':' || (val = parse_digits (&str, 2)) == -1 || val > 61)
+        return -1;
+      tm->tm_sec = val;
+      break;
+    case 'M':
+      if ((val = parse_digits (&str, 2)) == -1 || val > 59)
+        return -1;
+      tm->tm_min = val;
+      break;
+    case 'S':
+      if ((val = parse_digits (&str, 2)) == -1 || val > 61)
+        return -1;
+      tm->tm_sec = val;
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  if (*str != '\0')
+    return -1;
+  if (has_date)
+    set_week_year_day (tm);
+
+  return 0;
+}
+
 /* Format the given date/time according the given format.
  *
  * On error, 1 is returned.
@@ -535,6 +961,9 @@ str_to_time (const char *str, const char *fmt, struct tm *tm)
     return 0;
   }
 
+  if (fast_str_to_time (str, fmt, tm) == 0)
+    return 0;
+
   end = strptime (str, fmt, tm);
   if (end == NULL || *end != '\0')
     return 1;
@@ -601,6 +1030,39 @@ invalid_ipaddr (char *str, int *ipvx)
   return 1;
 }
 
+/* Mask the given IPv4 address to its /24 network, or the given IPv6
+ * address to its /64 network, e.g., to anonymize it. The given buffer
+ * has to be at least INET6_ADDRSTRLEN bytes long.
+ *
+ * On error, i.e., not a valid IP address, 1 is returned.
+ * On success, the masked address is set into buf and 0 is returned. */
+int
+anonymize_ip (const char *ip, char *buf)
+{
+  struct in6_addr addr6, mask6, nwork6;
+  struct in_addr addr4, mask4, nwork4;
+
+  const char *m4 = "255.255.255.0";
+  const char *m6 = "ffff:ffff:ffff:ffff:0000:0000:0000:0000";
+  unsigned i;
+
+  if (1 == inet_pton (AF_INET, ip, &addr4)) {
+    if (1 != inet_pton (AF_INET, m4, &mask4))
+      return 1;
+    nwork4.s_addr = addr4.s_addr & mask4.s_addr;
+    return inet_ntop (AF_INET, &nwork4, buf, INET_ADDRSTRLEN) == NULL;
+  } else if (1 == inet_pton (AF_INET6, ip, &addr6)) {
+    if (1 != inet_pton (AF_INET6, m6, &mask6))
+      return 1;
+    for (i = 0; i < 16; i++) {
+      nwork6.s6_addr[i] = addr6.s6_addr[i] & mask6.s6_addr[i];
+    }
+    return inet_ntop (AF_INET6, &nwork6, buf, INET6_ADDRSTRLEN) == NULL;
+  }
+
+  return 1;
+}
+
 /* Get information about the filename.
  *
  * On error, -1 is returned.
@@ -618,18 +1080,17 @@ file_size (const char *filename)
   return -1;
 }
 
-/* Determine if the given status code is within the list of status
- * codes and find out the status type/category.
+/* Find out the status type/category of the given status code.
  *
  * If not found, "Unknown" is returned.
  * On success, the status code type/category is returned. */
 const char *
-verify_status_code_type (const char *str)
+verify_status_code_type (int code)
 {
-  size_t i;
-  for (i = 0; i < ARRAY_SIZE (code_type); i++)
-    if (strchr (code_type[i][0], str[0]) != NULL)
-      return _(code_type[i][1]);
+  int type = code / 100;
+
+  if (code > 0 && type < (int) ARRAY_SIZE (code_type) && code_type[type])
+    return _(code_type[type]);
 
   return "Unknown";
 }
@@ -640,12 +1101,19 @@ verify_status_code_type (const char *str)
  * If not found, "Unknown" is returned.
  * On success, the status code is returned. */
 const char *
-verify_status_code (char *str)
+verify_status_code (int code)
 {
-  size_t i;
-  for (i = 0; i < ARRAY_SIZE (codes); i++)
-    if (strstr (str, codes[i][0]) != NULL)
-      return _(codes[i][1]);
+  size_t lo = 0, hi = ARRAY_SIZE (codes), mid = 0;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (codes[mid].code == code)
+      return _(codes[mid].desc);
+    if (codes[mid].code < code)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
   return "Unknown";
 }
@@ -706,26 +1174,43 @@ trim_str (char *str)
   return rtrim (ltrim (str));
 }
 
-/* Convert the file size in bytes to a human readable format.
+/* Write the file size in bytes in a human readable format into the
+ * given buffer of at least FILESIZE_LEN bytes.
  *
- * On error, the original size of the string in bytes is returned.
- * On success, the file size in a human readable format is returned. */
-char *
-filesize_str (unsigned long long log_size)
+ * On success, the length of the formatted size is returned. */
+int
+filesize_fmt (char *size, unsigned long long log_size)
 {
-  char *size = xmalloc (sizeof (char) * 12);
   if (log_size >= (1ULL << 50))
-    snprintf (size, 12, "%.2f PiB", (double) (log_size) / PIB (1ULL));
+    snprintf (size, FILESIZE_LEN, "%.2f PiB",
+              (double) (log_size) / PIB (1ULL));
   else if (log_size >= (1ULL << 40))
-    snprintf (size, 12, "%.2f TiB", (double) (log_size) / TIB (1ULL));
+    snprintf (size, FILESIZE_LEN, "%.2f TiB",
+              (double) (log_size) / TIB (1ULL));
   else if (log_size >= (1ULL << 30))
-    snprintf (size, 12, "%.2f GiB", (double) (log_size) / GIB (1ULL));
+    snprintf (size, FILESIZE_LEN, "%.2f GiB",
+              (double) (log_size) / GIB (1ULL));
   else if (log_size >= (1ULL << 20))
-    snprintf (size, 12, "%.2f MiB", (double) (log_size) / MIB (1ULL));
+    snprintf (size, FILESIZE_LEN, "%.2f MiB",
+              (double) (log_size) / MIB (1ULL));
   else if (log_size >= (1ULL << 10))
-    snprintf (size, 12, "%.2f KiB", (double) (log_size) / KIB (1ULL));
+    snprintf (size, FILESIZE_LEN, "%.2f KiB",
+              (double) (log_size) / KIB (1ULL));
   else
-    snprintf (size, 12, "%.1f   B", (double) (log_size));
+    snprintf (size, FILESIZE_LEN, "%.1f   B", (double) (log_size));
+
+  return strlen (size);
+}
+
+/* Convert the file size in bytes to a human readable format.
+ *
+ * On error, the original size of the string in bytes is returned.
+ * On success, the file size in a human readable format is returned. */
+char *
+filesize_str (unsigned long long log_size)
+{
+  char *size = xmalloc (sizeof (char) * FILESIZE_LEN);
+  filesize_fmt (size, log_size);
 
   return size;
 }
@@ -834,6 +1319,9 @@ void
 strip_newlines (char *str)
 {
   char *src, *dst;
+
+  /* nothing to strip before the first new line, if any */
+  str += strcspn (str, "\r\n");
   for (src = dst = str; *src != '\0'; src++) {
     *dst = *src;
     if (*dst != '\r' && *dst != '\n')
@@ -1004,3 +1492,102 @@ out:
 
   return dest;
 }
+
+/* 64-bit finalization mix of MurmurHash3. */
+static uint64_t
+fmix64 (uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+
+  return k;
+}
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Read a little-endian 64-bit block regardless of alignment. */
+static uint64_t
+get_block64 (const unsigned char *p)
+{
+  return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+    (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 |
+    (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+/* Compute the 128-bit MurmurHash3 (x64 variant) of the given buffer.
+ * Given n keys, the probability of a collision is roughly n^2 / 2^129,
+ * e.g., about 1.5e-21 for a billion keys.
+ *
+ * On success, the hash is set into out. */
+void
+hash128 (const void *key, size_t len, uint64_t out[2])
+{
+  const unsigned char *data = key, *tail = NULL;
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  uint64_t h1 = 0, h2 = 0, k1 = 0, k2 = 0;
+  size_t i, nblocks = len / 16;
+
+  for (i = 0; i < nblocks; i++) {
+    k1 = get_block64 (data + i * 16);
+    k2 = get_block64 (data + i * 16 + 8);
+
+    k1 *= c1;
+    k1 = ROTL64 (k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = ROTL64 (h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2;
+    k2 = ROTL64 (k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = ROTL64 (h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  tail = data + nblocks * 16;
+  k1 = k2 = 0;
+  /* *INDENT-OFF* */
+  switch (len & 15) {
+  case 15: k2 ^= (uint64_t) tail[14] << 48; /* fall through */
+  case 14: k2 ^= (uint64_t) tail[13] << 40; /* fall through */
+  case 13: k2 ^= (uint64_t) tail[12] << 32; /* fall through */
+  case 12: k2 ^= (uint64_t) tail[11] << 24; /* fall through */
+  case 11: k2 ^= (uint64_t) tail[10] << 16; /* fall through */
+  case 10: k2 ^= (uint64_t) tail[9] << 8;   /* fall through */
+  case 9:  k2 ^= (uint64_t) tail[8];
+    k2 *= c2; k2 = ROTL64 (k2, 33); k2 *= c1; h2 ^= k2;
+    /* fall through */
+  case 8:  k1 ^= (uint64_t) tail[7] << 56;  /* fall through */
+  case 7:  k1 ^= (uint64_t) tail[6] << 48;  /* fall through */
+  case 6:  k1 ^= (uint64_t) tail[5] << 40;  /* fall through */
+  case 5:  k1 ^= (uint64_t) tail[4] << 32;  /* fall through */
+  case 4:  k1 ^= (uint64_t) tail[3] << 24;  /* fall through */
+  case 3:  k1 ^= (uint64_t) tail[2] << 16;  /* fall through */
+  case 2:  k1 ^= (uint64_t) tail[1] << 8;   /* fall through */
+  case 1:  k1 ^= (uint64_t) tail[0];
+    k1 *= c1; k1 = ROTL64 (k1, 31); k1 *= c2; h1 ^= k1;
+  }
+  /* *INDENT-ON* */
+
+  h1 ^= (uint64_t) len;
+  h2 ^= (uint64_t) len;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix64 (h1);
+  h2 = fmix64 (h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  out[0] = h1;
+  out[1] = h2;
+}
@@ -40,6 +40,11 @@
 #define TIB(n) (n << 40)
 #define PIB(n) (n << 50)
 
+#define FILESIZE_LEN 12 /* buffer size of a formatted file size */
+
+/* slots of a compiled set of referrers, at least twice MAX_IGNORE_REF */
+#define REF_MATCH_SLOTS 128
+
 #define MILS 1000ULL
 #define SECS 1000000ULL
 #define MINS 60000000ULL
@@ -51,6 +56,38 @@
 #include <sys/types.h>
 #include <time.h>
 
+/* A binary IPv4 or IPv6 address, IPv4 uses the lower 32 bits only */
+typedef struct GIPAddr_
+{
+  uint64_t hi;
+  uint64_t lo;
+} GIPAddr;
+
+/* An inclusive range of IP addresses */
+typedef struct GIPRange_
+{
+  GIPAddr start;
+  GIPAddr end;
+} GIPRange;
+
+/* A compiled list of referrer patterns (--ignore-referer and
+ * --hide-referer). Entries point to the given patterns. */
+typedef struct GRefMatcher_
+{
+  /* patterns without wildcards, an open addressing set */
+  const char *exact[REF_MATCH_SLOTS];
+  /* patterns made of '*' followed by a literal, keyed by the literal */
+  const char *suffix[REF_MATCH_SLOTS];
+  /* distinct first characters of the suffix literals */
+  char firsts[REF_MATCH_SLOTS];
+  int firsts_len;
+  /* any other pattern, matched against the host one by one */
+  const char *wild[REF_MATCH_SLOTS];
+  int wild_len;
+  /* a pattern made only of '*' */
+  int any;
+} GRefMatcher;
+
 char *alloc_string (const char *str);
 char *char_repeat (int n, char c);
 char *char_replace (char *str, char o, char n);
@@ -64,6 +101,7 @@ char *get_visitors_date (const char *odate, const char *from, const char *to);
 char *int2str (int d, int width);
 char *left_pad_str (const char *s, int indent);
 char *ltrim (char *s);
+char *new_tmp_path (const char *kind);
 char *replace_str (const char *str, const char *old, const char *new);
 char *rtrim (char *s);
 char *secs_to_str (int secs);
@@ -72,10 +110,12 @@ char *substring (const char *str, int begin, int len);
 char *trim_str (char *str);
 char *unescape_str (const char *src);
 char *usecs_to_str (unsigned long long usec);
-const char *verify_status_code (char *str);
-const char *verify_status_code_type (const char *str);
+const char *verify_status_code (int code);
+const char *verify_status_code_type (int code);
+int anonymize_ip (const char *ip, char *buf);
 int convert_date (char *res, const char *data, const char *from, const char *to, int size);
 int count_matches (const char *s1, char c);
+int filesize_fmt (char *size, unsigned long long log_size);
 int find_output_type (char **filename, const char *ext, int alloc);
 int hide_referer (const char *ref);
 int ignore_referer (const char *ref);
@@ -88,7 +128,11 @@ int valid_output_type (const char *filename);
 off_t file_size (const char *filename);
 uint32_t ip_to_binary (const char *ip);
 void append_str (char **dest, const char *src);
+void free_ip_ranges (void);
 void genstr(char *dest, size_t len);
+void hash128 (const void *key, size_t len, uint64_t out[2]);
+void init_ip_ranges (void);
+void init_referer_matchers (void);
 void strip_newlines (char *str);
 void xstrncpy (char *dest, const char *source, const size_t dest_size);
 
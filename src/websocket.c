@@ -35,6 +35,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdarg.h>
@@ -42,6 +43,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
@@ -50,6 +52,16 @@
 #include <config.h>
 #endif
 
+#if defined(HAVE_EPOLL_CTL)
+#include <sys/epoll.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #include "websocket.h"
 
 #include "base64.h"
@@ -83,13 +95,27 @@ static const uint8_t utf8d[] = {
 };
 /* *INDENT-ON* */
 
-static int max_file_fd = 0;
+#if defined(HAVE_EPOLL_CTL) || defined(HAVE_KQUEUE)
+static int evfd = -1;           /* epoll/kqueue instance */
+#else
 static WSEState fdstate;
+#endif
 static WSConfig wsconfig = { 0 };
 
+#ifdef HAVE_LIBZ
+/* permessage-deflate contexts, reset for every message since there's
+ * no context takeover. Shared by all clients. */
+static z_stream deflater;
+static z_stream inflater;
+static int deflater_init = 0;
+static int inflater_init = 0;
+#endif
+
 static void handle_read_close (int conn, WSClient * client, WSServer * server);
 static void handle_reads (int conn, WSServer * server);
 static void handle_writes (int conn, WSServer * server);
+static void ws_evt_close (void);
+static WSBuffer *ws_new_frame (WSOpcode opcode, char *p, int sz);
 #ifdef HAVE_LIBSSL
 static int shutdown_ssl (WSClient * client);
 #endif
@@ -188,6 +214,7 @@ new_wsclient (void)
 {
   WSClient *client = xcalloc (1, sizeof (WSClient));
   client->status = WS_OK;
+  client->stats.rtt = -1;
 
   return client;
 }
@@ -243,6 +270,34 @@ new_wspipein (void)
   return pipein;
 }
 
+/* Allocate memory for an outgoing buffer. It takes ownership of the
+ * given data and holds a single reference.
+ *
+ * On success, the newly allocated WSBuffer is returned. */
+static WSBuffer *
+new_wsbuffer (char *data, int len)
+{
+  WSBuffer *buf = xcalloc (1, sizeof (WSBuffer));
+  buf->data = data;
+  buf->len = len;
+  buf->refs = 1;
+
+  return buf;
+}
+
+/* Drop a reference to the given buffer, freeing it if it was the
+ * last one. */
+static void
+ws_unref_buffer (WSBuffer * buf)
+{
+  if (buf == NULL || --buf->refs > 0)
+    return;
+
+  ws_unref_buffer (buf->deflated);
+  free (buf->data);
+  free (buf);
+}
+
 /* Escapes the special characters, e.g., '\n', '\r', '\t', '\'
  * in the string source by inserting a '\' before them.
  *
@@ -315,22 +370,6 @@ strtoupper (char *str)
   return str;
 }
 
-/* Chop n characters from the beginning of the supplied buffer.
- *
- * The new length of the string is returned. */
-static size_t
-chop_nchars (char *str, size_t n, size_t len)
-{
-  if (n == 0 || str == 0)
-    return 0;
-
-  if (n > len)
-    n = len;
-  memmove (str, str + n, len - n);
-
-  return (len - n);
-}
-
 /* Match a client given a socket id and an item from the list.
  *
  * On match, 1 is returned, else 0. */
@@ -360,14 +399,27 @@ ws_get_list_node_from_list (int listener, GSLList ** colist)
  *
  * On success, an instance of a WSClient is returned, else NULL. */
 static WSClient *
-ws_get_client_from_list (int listener, GSLList ** colist)
+ws_get_client (int listener, WSServer * server)
 {
-  GSLList *match = NULL;
-
-  /* Find the client data for the socket in use */
-  if (!(match = list_find (*colist, ws_find_client_sock_in_list, &listener)))
+  if (listener < 0 || listener >= server->clients_len)
     return NULL;
-  return (WSClient *) match->data;
+  return server->clients[listener];
+}
+
+/* Keep track of the given client, indexed by its socket id. */
+static void
+ws_set_client (WSClient * client, WSServer * server)
+{
+  int fd = client->listener, len = server->clients_len;
+
+  if (fd >= len) {
+    len = MAX (len * 2, fd + 1);
+    server->clients = xrealloc (server->clients, len * sizeof (WSClient *));
+    memset (server->clients + server->clients_len, 0,
+            (len - server->clients_len) * sizeof (WSClient *));
+    server->clients_len = len;
+  }
+  server->clients[fd] = client;
 }
 
 /* Free a frame structure and its data for the given client. */
@@ -420,28 +472,38 @@ ws_free_header_fields (WSHeaders * headers)
     free (headers->ws_resp);
   if (headers->ws_sock_ver)
     free (headers->ws_sock_ver);
+  if (headers->ws_extensions)
+    free (headers->ws_extensions);
   if (headers->referer)
     free (headers->referer);
 }
 
+/* Remove the first buffer from the client's sent queue. */
+static void
+ws_pop_queue (WSClient * client)
+{
+  WSSendQueue *node = client->sockqueue;
+
+  client->qlen -= node->buf->hlen + node->buf->len - node->offset;
+  client->sockqueue = node->next;
+  if (client->sockqueue == NULL)
+    client->socktail = NULL;
+
+  ws_unref_buffer (node->buf);
+  free (node);
+}
+
 /* Clear the client's sent queue and its data. */
 static void
 ws_clear_queue (WSClient * client)
 {
-  WSQueue **queue = &client->sockqueue;
-  if (!(*queue))
+  if (!client->sockqueue)
     return;
 
-  if ((*queue)->queued)
-    free ((*queue)->queued);
-  (*queue)->queued = NULL;
-  (*queue)->qlen = 0;
-
-  free ((*queue));
-  (*queue) = NULL;
+  while (client->sockqueue)
+    ws_pop_queue (client);
+  client->qlen = 0;
 
-  /* done sending the whole queue, stop throttling */
-  client->status &= ~WS_THROTTLING;
   /* done sending, close connection if set to close */
   if ((client->status & WS_CLOSE) && (client->status & WS_SENDING))
     client->status = WS_CLOSE;
@@ -465,6 +527,8 @@ ws_remove_client_from_list (WSClient * client, WSServer * server)
   if (!(node = ws_get_list_node_from_list (client->listener, &server->colist)))
     return;
 
+  if (ws_get_client (client->listener, server) == client)
+    server->clients[client->listener] = NULL;
   if (client->headers)
     ws_clear_handshake_headers (client->headers);
   list_remove_node (&server->colist, node);
@@ -567,6 +631,7 @@ ws_clear_pipeout (WSPipeOut * pipeout)
   if (pipeout->fd != -1)
     close (pipeout->fd);
 
+  ws_fifo_clear (&pipeout->fifoqueue);
   free (pipeout);
 
   if (wsconfig.pipeout && access (wsconfig.pipeout, F_OK) != -1)
@@ -593,11 +658,21 @@ ws_stop (WSServer * server)
 
   if (server->colist)
     list_remove_nodes (server->colist);
+  free (server->clients);
+
+#ifdef HAVE_LIBZ
+  if (deflater_init)
+    deflateEnd (&deflater);
+  if (inflater_init)
+    inflateEnd (&inflater);
+  deflater_init = inflater_init = 0;
+#endif
 
 #ifdef HAVE_LIBSSL
   ws_ssl_cleanup (server);
 #endif
 
+  ws_evt_close ();
   free (server);
 }
 
@@ -608,6 +683,206 @@ ws_close (int listener)
   close (listener);
 }
 
+/* Create the event notification instance (epoll, kqueue or a select(2)
+ * descriptor set, in that order of preference) used by the event loop. */
+static void
+ws_evt_init (void)
+{
+#if defined(HAVE_EPOLL_CTL)
+  if ((evfd = epoll_create (WS_MAX_EVENTS)) == -1)
+    FATAL ("Unable to create epoll: %s.", strerror (errno));
+#elif defined(HAVE_KQUEUE)
+  if ((evfd = kqueue ()) == -1)
+    FATAL ("Unable to create kqueue: %s.", strerror (errno));
+#else
+  memset (&fdstate, 0, sizeof fdstate);
+  FD_ZERO (&fdstate.rmaster);
+  FD_ZERO (&fdstate.wmaster);
+  fdstate.maxfd = -1;
+#endif
+}
+
+/* Release the event notification instance. */
+static void
+ws_evt_close (void)
+{
+#if defined(HAVE_EPOLL_CTL) || defined(HAVE_KQUEUE)
+  if (evfd != -1)
+    close (evfd);
+  evfd = -1;
+#endif
+}
+
+/* Change the events (WS_EVT_READ/WS_EVT_WRITE) monitored on the given
+ * file descriptor from the old set to the new one. An empty new set
+ * stops monitoring the file descriptor. */
+static void
+ws_evt_set (int fd, int old, int new)
+{
+#if defined(HAVE_EPOLL_CTL)
+  struct epoll_event ev;
+  int op = EPOLL_CTL_MOD;
+
+  if (old == new)
+    return;
+
+  memset (&ev, 0, sizeof ev);
+  ev.data.fd = fd;
+  ev.events = ((new & WS_EVT_READ) ? EPOLLIN : 0) |
+    ((new & WS_EVT_WRITE) ? EPOLLOUT : 0);
+
+  if (old == 0)
+    op = EPOLL_CTL_ADD;
+  else if (new == 0)
+    op = EPOLL_CTL_DEL;
+
+  if (epoll_ctl (evfd, op, fd, &ev) == 0)
+    return;
+  /* the fd could have been closed and reopened behind our back */
+  if (op == EPOLL_CTL_MOD && errno == ENOENT &&
+      epoll_ctl (evfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    return;
+  LOG (("Unable to epoll_ctl %d: %s.\n", fd, strerror (errno)));
+#elif defined(HAVE_KQUEUE)
+  struct kevent ev[2];
+  int n = 0;
+
+  if ((old & WS_EVT_READ) != (new & WS_EVT_READ))
+    EV_SET (&ev[n++], fd, EVFILT_READ,
+            (new & WS_EVT_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+  if ((old & WS_EVT_WRITE) != (new & WS_EVT_WRITE))
+    EV_SET (&ev[n++], fd, EVFILT_WRITE,
+            (new & WS_EVT_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+
+  if (n > 0 && kevent (evfd, ev, n, NULL, 0, NULL) == -1)
+    LOG (("Unable to kevent %d: %s.\n", fd, strerror (errno)));
+#else
+  if (old == new)
+    return;
+
+  if (new & WS_EVT_READ)
+    FD_SET (fd, &fdstate.rmaster);
+  else
+    FD_CLR (fd, &fdstate.rmaster);
+  if (new & WS_EVT_WRITE)
+    FD_SET (fd, &fdstate.wmaster);
+  else
+    FD_CLR (fd, &fdstate.wmaster);
+
+  if (new && fd > fdstate.maxfd)
+    fdstate.maxfd = fd;
+  while (fdstate.maxfd >= 0 && !FD_ISSET (fdstate.maxfd, &fdstate.rmaster) &&
+         !FD_ISSET (fdstate.maxfd, &fdstate.wmaster))
+    fdstate.maxfd--;
+#endif
+}
+
+/* Wait until at least one of the monitored file descriptors is ready
+ * and set up to max ready descriptors into the given array.
+ *
+ * If interrupted by a signal, 0 is returned.
+ * On success, the number of ready file descriptors is returned. */
+static int
+ws_evt_wait (WSEvent * evs, int max)
+{
+#if defined(HAVE_EPOLL_CTL)
+  struct epoll_event ev[WS_MAX_EVENTS];
+  int i, n;
+
+  if (max > WS_MAX_EVENTS)
+    max = WS_MAX_EVENTS;
+  if ((n = epoll_wait (evfd, ev, max, -1)) == -1) {
+    if (errno != EINTR)
+      FATAL ("Unable to epoll_wait: %s.", strerror (errno));
+    LOG (("A signal was caught on epoll_wait(2)\n"));
+    return 0;
+  }
+
+  for (i = 0; i < n; ++i) {
+    evs[i].fd = ev[i].data.fd;
+    evs[i].events = 0;
+    if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+      evs[i].events |= WS_EVT_READ;
+    if (ev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+      evs[i].events |= WS_EVT_WRITE;
+  }
+
+  return n;
+#elif defined(HAVE_KQUEUE)
+  struct kevent ev[WS_MAX_EVENTS];
+  int i, n;
+
+  if (max > WS_MAX_EVENTS)
+    max = WS_MAX_EVENTS;
+  if ((n = kevent (evfd, NULL, 0, ev, max, NULL)) == -1) {
+    if (errno != EINTR)
+      FATAL ("Unable to kevent: %s.", strerror (errno));
+    LOG (("A signal was caught on kevent(2)\n"));
+    return 0;
+  }
+
+  for (i = 0; i < n; ++i) {
+    evs[i].fd = (int) ev[i].ident;
+    evs[i].events = ev[i].filter == EVFILT_WRITE ? WS_EVT_WRITE : WS_EVT_READ;
+  }
+
+  return n;
+#else
+  int fd, n = 0;
+
+  fdstate.rfds = fdstate.rmaster;
+  fdstate.wfds = fdstate.wmaster;
+  if (select (fdstate.maxfd + 1, &fdstate.rfds, &fdstate.wfds, NULL, NULL) ==
+      -1) {
+    if (errno != EINTR)
+      FATAL ("Unable to select: %s.", strerror (errno));
+    LOG (("A signal was caught on select(2)\n"));
+    return 0;
+  }
+
+  for (fd = 0; fd <= fdstate.maxfd && n < max; ++fd) {
+    evs[n].fd = fd;
+    evs[n].events = 0;
+    if (FD_ISSET (fd, &fdstate.rfds))
+      evs[n].events |= WS_EVT_READ;
+    if (FD_ISSET (fd, &fdstate.wfds))
+      evs[n].events |= WS_EVT_WRITE;
+    if (evs[n].events)
+      n++;
+  }
+
+  return n;
+#endif
+}
+
+/* Stop monitoring the given named pipe (FIFO) and close it. */
+static void
+ws_close_fifo (int fd, int *events)
+{
+  ws_evt_set (fd, *events, 0);
+  *events = 0;
+  close (fd);
+}
+
+/* Monitor the given client for the events it currently needs.
+ *
+ * As long as we are not closing a connection while still sending data,
+ * we always check a client for reading, and for writing only if we
+ * have data to send the client. */
+static void
+ws_set_events (WSClient * client)
+{
+  int events = 0;
+
+  if (!(client->status & WS_CLOSE) || !(client->status & WS_SENDING))
+    events |= WS_EVT_READ;
+  if (client->status & WS_SENDING)
+    events |= WS_EVT_WRITE;
+
+  ws_evt_set (client->listener, client->events, events);
+  client->events = events;
+}
+
 /* Set the connection status for the given client and return the given
  * bytes.
  *
@@ -619,6 +894,19 @@ ws_set_status (WSClient * client, WSStatus status, int bytes)
   return bytes;
 }
 
+/* Get the number of milliseconds elapsed since the given time.
+ *
+ * On success, the elapsed time in milliseconds is returned. */
+static int
+ws_elapsed_ms (const struct timeval *since)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - since->tv_sec) * 1000 +
+    (now.tv_usec - since->tv_usec) / 1000;
+}
+
 /* Append the source string to destination and reallocates and
  * updating the destination buffer appropriately. */
 static void
@@ -979,7 +1267,7 @@ set_nonblocking (int sock)
  *
  * The newly assigned socket is returned. */
 static int
-accept_client (int listener, GSLList ** colist)
+accept_client (int listener, WSServer * server)
 {
   WSClient *client;
   struct sockaddr_storage raddr;
@@ -1003,10 +1291,11 @@ accept_client (int listener, GSLList ** colist)
   inet_ntop (raddr.ss_family, src, client->remote_ip, INET6_ADDRSTRLEN);
 
   /* add up our new client to keep track of */
-  if (*colist == NULL)
-    *colist = list_create (client);
+  if (server->colist == NULL)
+    server->colist = list_create (client);
   else
-    *colist = list_insert_prepend (*colist, client);
+    server->colist = list_insert_prepend (server->colist, client);
+  ws_set_client (client, server);
 
   /* make the socket non-blocking */
   set_nonblocking (client->listener);
@@ -1083,6 +1372,15 @@ ws_set_header_key_value (WSHeaders * headers, char *key, char *value)
     headers->ws_key = xstrdup (value);
   else if (strcasecmp ("Sec-WebSocket-Version", key) == 0)
     headers->ws_sock_ver = xstrdup (value);
+  else if (strcasecmp ("Sec-WebSocket-Extensions", key) == 0) {
+    /* the header may be repeated */
+    if (headers->ws_extensions) {
+      ws_append_str (&headers->ws_extensions, ", ");
+      ws_append_str (&headers->ws_extensions, value);
+    } else {
+      headers->ws_extensions = xstrdup (value);
+    }
+  }
   else if (strcasecmp ("User-Agent", key) == 0)
     headers->agent = xstrdup (value);
   else if (strcasecmp ("Referer", key) == 0)
@@ -1204,19 +1502,27 @@ parse_headers (WSHeaders * headers)
   return 0;
 }
 
-/* Set into a queue the data that couldn't be sent. */
+/* Set into a queue the part of the buffer that couldn't be sent. The
+ * queue holds a reference to it instead of a copy. */
 static void
-ws_queue_sockbuf (WSClient * client, const char *buffer, int len, int bytes)
+ws_queue_sockbuf (WSClient * client, WSBuffer * buf, int bytes)
 {
-  WSQueue *queue = xcalloc (1, sizeof (WSQueue));
+  WSSendQueue *node = xcalloc (1, sizeof (WSSendQueue));
 
   if (bytes < 1)
     bytes = 0;
 
-  queue->queued = xcalloc (len - bytes, sizeof (char));
-  memcpy (queue->queued, buffer + bytes, len - bytes);
-  queue->qlen = len - bytes;
-  client->sockqueue = queue;
+  buf->refs++;
+  node->buf = buf;
+  node->offset = bytes;
+  if (client->socktail)
+    client->socktail->next = node;
+  else
+    client->sockqueue = node;
+  client->socktail = node;
+  client->qlen += buf->hlen + buf->len - bytes;
+  if (client->qlen > client->stats.max_qlen)
+    client->stats.max_qlen = client->qlen;
 
   client->status |= WS_SENDING;
 }
@@ -1259,23 +1565,78 @@ read_socket (WSClient * client, char *buffer, int size)
 #endif
 }
 
+/* Send the given buffer, from the given offset, through a plain
+ * socket. The header and the payload go out in a single call.
+ *
+ * On error, -1 is returned.
+ * On success, the number of bytes sent is returned. */
+static int
+send_plain_buffer (WSClient * client, const WSBuffer * buf, int offset)
+{
+  struct iovec iov[2];
+  int n = 0;
+
+  if (offset < buf->hlen) {
+    iov[n].iov_base = (char *) buf->hdr + offset;
+    iov[n++].iov_len = buf->hlen - offset;
+    offset = 0;
+  } else {
+    offset -= buf->hlen;
+  }
+  if (buf->len - offset > 0) {
+    iov[n].iov_base = buf->data + offset;
+    iov[n++].iov_len = buf->len - offset;
+  }
+
+  return writev (client->listener, iov, n);
+}
+
+#ifdef HAVE_LIBSSL
+/* Send the given buffer, from the given offset, through a TLS/SSL
+ * connection.
+ *
+ * On error or if no write is performed <=0 is returned.
+ * On success, the number of bytes sent is returned. */
 static int
-send_plain_buffer (WSClient * client, const char *buffer, int len)
+send_ssl_buffers (WSClient * client, const WSBuffer * buf, int offset)
 {
-  return send (client->listener, buffer, len, 0);
+  int bytes = 0, total = 0;
+
+  if (offset < buf->hlen) {
+    bytes = send_ssl_buffer (client, buf->hdr + offset, buf->hlen - offset);
+    if (bytes < buf->hlen - offset)
+      return bytes;
+    total = bytes;
+    offset = 0;
+  } else {
+    offset -= buf->hlen;
+  }
+  if (buf->len - offset <= 0)
+    return total;
+
+  bytes = send_ssl_buffer (client, buf->data + offset, buf->len - offset);
+
+  return bytes > 0 ? total + bytes : (total ? total : bytes);
 }
+#endif
 
 static int
-send_buffer (WSClient * client, const char *buffer, int len)
+send_buffer (WSClient * client, const WSBuffer * buf, int offset)
 {
+  int bytes = 0;
+
 #ifdef HAVE_LIBSSL
   if (wsconfig.use_ssl)
-    return send_ssl_buffer (client, buffer, len);
+    bytes = send_ssl_buffers (client, buf, offset);
   else
-    return send_plain_buffer (client, buffer, len);
+    bytes = send_plain_buffer (client, buf, offset);
 #else
-  return send_plain_buffer (client, buffer, len);
+  bytes = send_plain_buffer (client, buf, offset);
 #endif
+  if (bytes > 0)
+    client->stats.sent += bytes;
+
+  return bytes;
 }
 
 /* Attmpt to send the given buffer to the given socket.
@@ -1283,17 +1644,17 @@ send_buffer (WSClient * client, const char *buffer, int len)
  * On error, -1 is returned and the connection status is set.
  * On success, the number of bytes sent is returned. */
 static int
-ws_respond_data (WSClient * client, const char *buffer, int len)
+ws_respond_data (WSClient * client, WSBuffer * buf)
 {
-  int bytes = 0;
+  int bytes = 0, len = buf->hlen + buf->len;
 
-  bytes = send_buffer (client, buffer, len);
+  bytes = send_buffer (client, buf, 0);
   if (bytes == -1 && errno == EPIPE)
     return ws_set_status (client, WS_ERR | WS_CLOSE, bytes);
 
   /* did not send all of it... buffer it for a later attempt */
   if (bytes < len || (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))
-    ws_queue_sockbuf (client, buffer, len, bytes);
+    ws_queue_sockbuf (client, buf, bytes);
 
   return bytes;
 }
@@ -1305,89 +1666,287 @@ ws_respond_data (WSClient * client, const char *buffer, int len)
 static int
 ws_respond_cache (WSClient * client)
 {
-  WSQueue *queue = client->sockqueue;
-  int bytes = 0;
+  WSSendQueue *node = NULL;
+  int bytes = 0, left = 0, total = 0;
 
-  bytes = send_buffer (client, queue->queued, queue->qlen);
-  if (bytes == -1 && errno == EPIPE)
-    return ws_set_status (client, WS_ERR | WS_CLOSE, bytes);
+  while ((node = client->sockqueue) != NULL) {
+    left = node->buf->hlen + node->buf->len - node->offset;
 
-  if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
-    return bytes;
+    bytes = send_buffer (client, node->buf, node->offset);
+    if (bytes == -1 && errno == EPIPE)
+      return ws_set_status (client, WS_ERR | WS_CLOSE, bytes);
 
-  if (chop_nchars (queue->queued, bytes, queue->qlen) == 0)
-    ws_clear_queue (client);
-  else
-    queue->qlen -= bytes;
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return total ? total : bytes;
+    if (bytes <= 0)
+      break;
 
-  return bytes;
+    total += bytes;
+    /* not all of it went out, try again on the next write */
+    if (bytes < left) {
+      node->offset += bytes;
+      client->qlen -= bytes;
+      break;
+    }
+    /* done sending the whole queue */
+    if (node->next == NULL) {
+      ws_clear_queue (client);
+      break;
+    }
+    ws_pop_queue (client);
+  }
+
+  return total;
 }
 
-/* Attempt to realloc the current sent queue.
+#ifdef HAVE_LIBZ
+/* Compress the given frame's payload as a permessage-deflate message.
+ * The compressed frame is kept along with the given one, so a frame
+ * broadcast to all clients is compressed only once.
  *
- * On error, 1 is returned and the connection status is set.
- * On success, 0 is returned. */
+ * If it can't be compressed or it's not worth it, NULL is returned.
+ * On success, the compressed frame is returned. */
+static WSBuffer *
+ws_deflate_frame (WSBuffer * frm)
+{
+  WSBuffer *dfrm = NULL;
+  char *out = NULL;
+  int size = 0, outlen = 0, ret = 0;
+
+  if (frm->deflated)
+    return frm->deflated;
+
+  if (!deflater_init) {
+    memset (&deflater, 0, sizeof (deflater));
+    if (deflateInit2 (&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                      -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      goto fail;
+    deflater_init = 1;
+  }
+  deflateReset (&deflater);
+
+  /* room for the empty block ending a sync flush */
+  size = deflateBound (&deflater, frm->len) + 8;
+  out = xmalloc (size);
+
+  deflater.next_in = (Bytef *) frm->data;
+  deflater.avail_in = frm->len;
+  deflater.next_out = (Bytef *) out;
+  deflater.avail_out = size;
+
+  ret = deflate (&deflater, Z_SYNC_FLUSH);
+  outlen = size - deflater.avail_out;
+  if (ret != Z_OK || deflater.avail_in > 0 || outlen - 4 >= frm->len) {
+    free (out);
+    goto fail;
+  }
+
+  /* drop the trailing 0x00 0x00 0xff 0xff, see RFC 7692 */
+  dfrm = ws_new_frame (WS_FRM_OPCODE (frm->hdr[0]), out, outlen - 4);
+  dfrm->hdr[0] |= 0x40; /* RSV1 */
+  dfrm->compress = 0;
+  frm->deflated = dfrm;
+
+  return dfrm;
+
+fail:
+  frm->compress = 0;
+  return NULL;
+}
+
+/* Decompress the current permessage-deflate message of the given
+ * client.
+ *
+ * On error, the close status code is returned.
+ * On success, the message's payload is replaced and 0 is returned. */
 static int
-ws_realloc_send_buf (WSClient * client, const char *buf, int len)
+ws_inflate_message (WSClient * client)
 {
-  WSQueue *queue = client->sockqueue;
-  char *tmp = NULL;
-  int newlen = 0;
+  static const char tail[] = { 0x00, 0x00, (char) 0xff, (char) 0xff };
+  WSMessage *msg = client->message;
+  char *out = NULL;
+  int size = 0, outlen = 0, ret = 0, tailed = 0;
 
-  newlen = queue->qlen + len;
-  tmp = realloc (queue->queued, newlen);
-  if (tmp == NULL && newlen > 0) {
-    ws_clear_queue (client);
-    return ws_set_status (client, WS_ERR | WS_CLOSE, 1);
+  if (!inflater_init) {
+    memset (&inflater, 0, sizeof (inflater));
+    if (inflateInit2 (&inflater, -MAX_WBITS) != Z_OK)
+      return WS_CLOSE_UNEXPECTED;
+    inflater_init = 1;
+  }
+  inflateReset (&inflater);
+
+  size = MAX (msg->payloadsz * 4, 1024);
+  out = xmalloc (size);
+
+  inflater.next_in = (Bytef *) msg->payload;
+  inflater.avail_in = msg->payloadsz;
+  while (1) {
+    if (outlen == size) {
+      size *= 2;
+      out = xrealloc (out, size);
+    }
+    inflater.next_out = (Bytef *) out + outlen;
+    inflater.avail_out = size - outlen;
+
+    ret = inflate (&inflater, Z_SYNC_FLUSH);
+    outlen = size - inflater.avail_out;
+    if (ret == Z_STREAM_END)
+      break;
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+      goto err;
+    if (outlen > wsconfig.max_frm_size) {
+      free (out);
+      return WS_CLOSE_TOO_LARGE;
+    }
+    if (inflater.avail_in > 0 || inflater.avail_out == 0)
+      continue;
+    if (tailed)
+      break;
+
+    /* add back the trailing bytes stripped by the client */
+    inflater.next_in = (Bytef *) tail;
+    inflater.avail_in = sizeof (tail);
+    tailed = 1;
   }
-  queue->queued = tmp;
-  memcpy (queue->queued + queue->qlen, buf, len);
-  queue->qlen += len;
 
-  /* client probably  too slow, so stop queueing until everything is
-   * sent */
-  if (queue->qlen >= WS_THROTTLE_THLD)
-    client->status |= WS_THROTTLING;
+  free (msg->payload);
+  msg->payload = out;
+  msg->payloadsz = outlen;
 
   return 0;
+
+err:
+  free (out);
+  return WS_CLOSE_INVALID_DATA;
 }
 
-/* An entry point to attempt to send the client's data.
+/* Skip leading and trailing spaces of the given string.
+ *
+ * On success, the trimmed string is returned. */
+static char *
+ws_trim_str (char *str)
+{
+  char *end = NULL;
+
+  while (isspace ((unsigned char) *str))
+    str++;
+  end = str + strlen (str);
+  while (end > str && isspace ((unsigned char) *(end - 1)))
+    *--end = '\0';
+
+  return str;
+}
+
+/* Determine if one of the given extension offers is a permessage-deflate
+ * offer we can accept. The server window can't be limited since the
+ * compressed messages are shared by all clients.
+ *
+ * If no offer can be accepted, 0 is returned.
+ * On success, 1 is returned. */
+static int
+ws_accept_deflate (const char *exts)
+{
+  char *dup = NULL, *offer = NULL, *param = NULL, *val = NULL;
+  char *optr = NULL, *pptr = NULL;
+  int accept = 0;
+
+  if (exts == NULL)
+    return 0;
+
+  dup = xstrdup (exts);
+  offer = strtok_r (dup, ",", &optr);
+  for (; offer != NULL && !accept; offer = strtok_r (NULL, ",", &optr)) {
+    param = strtok_r (offer, ";", &pptr);
+    if (param == NULL || strcmp (ws_trim_str (param), WS_DEFLATE_EXT) != 0)
+      continue;
+
+    accept = 1;
+    while (accept && (param = strtok_r (NULL, ";", &pptr)) != NULL) {
+      if ((val = strchr (param, '=')) != NULL)
+        *val++ = '\0';
+      param = ws_trim_str (param);
+      val = val ? ws_trim_str (val) : NULL;
+      if (val && *val == '"')
+        val++;
+
+      if (!strcmp (param, "server_no_context_takeover") ||
+          !strcmp (param, "client_no_context_takeover") ||
+          !strcmp (param, "client_max_window_bits"))
+        continue;
+      if (!strcmp (param, "server_max_window_bits") && val &&
+          atoi (val) == MAX_WBITS)
+        continue;
+      accept = 0;
+    }
+  }
+  free (dup);
+
+  return accept;
+}
+#endif
+
+/* An entry point to attempt to send the given buffer (or the buffered
+ * data if NULL) to the client.
  *
  * On error, 1 is returned and the connection status is set.
  * On success, the number of bytes sent is returned. */
 static int
-ws_respond (WSClient * client, const char *buffer, int len)
+ws_respond_buffer (WSClient * client, WSBuffer * buf)
 {
   int bytes = 0;
 
+#ifdef HAVE_LIBZ
+  if (buf != NULL && buf->compress && client->deflate &&
+      ws_deflate_frame (buf) != NULL)
+    buf = buf->deflated;
+#endif
+
   /* attempt to send the whole buffer buffer */
-  if (client->sockqueue == NULL)
-    bytes = ws_respond_data (client, buffer, len);
-  /* buffer not empty, just append new data iff we're not throttling the
-   * client */
-  else if (client->sockqueue != NULL && buffer != NULL &&
-           !(client->status & WS_THROTTLING)) {
-    if (ws_realloc_send_buf (client, buffer, len) == 1)
-      return bytes;
-  }
+  if (client->sockqueue == NULL && buf != NULL)
+    bytes = ws_respond_data (client, buf);
+  /* buffer not empty, just append new data, see ws_schedule_update() */
+  else if (client->sockqueue != NULL && buf != NULL)
+    ws_queue_sockbuf (client, buf, 0);
   /* send from cache buffer */
-  else {
+  else if (client->sockqueue != NULL) {
     bytes = ws_respond_cache (client);
   }
 
   return bytes;
 }
 
-/* Encode a websocket frame (header/message) and attempt to send it
- * through the client's socket.
+/* Attempt to send the given data to the client.
  *
- * On success, 0 is returned. */
+ * On error, 1 is returned and the connection status is set.
+ * On success, the number of bytes sent is returned. */
 static int
-ws_send_frame (WSClient * client, WSOpcode opcode, const char *p, int sz)
+ws_respond (WSClient * client, const char *buffer, int len)
+{
+  WSBuffer *buf = NULL;
+  char *data = NULL;
+  int bytes = 0;
+
+  if (buffer == NULL)
+    return ws_respond_buffer (client, NULL);
+
+  data = xmalloc (len);
+  memcpy (data, buffer, len);
+  buf = new_wsbuffer (data, len);
+  bytes = ws_respond_buffer (client, buf);
+  ws_unref_buffer (buf);
+
+  return bytes;
+}
+
+/* Encode a websocket frame header for the given payload. The frame
+ * takes ownership of the payload, so it can be shared among clients.
+ *
+ * On success, the newly allocated WSBuffer is returned. */
+static WSBuffer *
+ws_new_frame (WSOpcode opcode, char *p, int sz)
 {
+  WSBuffer *frm = NULL;
   unsigned char buf[32] = { 0 };
-  char *frm = NULL;
   uint64_t payloadlen = 0, u64;
   int hsize = 2;
 
@@ -1416,13 +1975,33 @@ ws_send_frame (WSClient * client, WSOpcode opcode, const char *p, int sz)
   default:
     buf[1] = (sz & 0xff);
   }
-  frm = xcalloc (hsize + sz, sizeof (unsigned char));
-  memcpy (frm, buf, hsize);
-  if (p != NULL && sz > 0)
-    memcpy (frm + hsize, p, sz);
+  frm = new_wsbuffer (p, p != NULL ? sz : 0);
+  memcpy (frm->hdr, buf, hsize);
+  frm->hlen = hsize;
+  frm->compress = (opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BIN) &&
+    frm->len >= WS_DEFLATE_MIN;
+
+  return frm;
+}
+
+/* Encode a websocket frame (header/message) and attempt to send it
+ * through the client's socket.
+ *
+ * On success, 0 is returned. */
+static int
+ws_send_frame (WSClient * client, WSOpcode opcode, const char *p, int sz)
+{
+  WSBuffer *frm = NULL;
+  char *data = NULL;
+
+  if (p != NULL && sz > 0) {
+    data = xmalloc (sz);
+    memcpy (data, p, sz);
+  }
 
-  ws_respond (client, frm, hsize + sz);
-  free (frm);
+  frm = ws_new_frame (opcode, data, data != NULL ? sz : 0);
+  ws_respond_buffer (client, frm);
+  ws_unref_buffer (frm);
 
   return 0;
 }
@@ -1566,7 +2145,14 @@ ws_send_handshake_headers (WSClient * client, WSHeaders * headers)
 
   ws_append_str (&str, "Sec-WebSocket-Accept: ");
   ws_append_str (&str, headers->ws_accept);
-  ws_append_str (&str, CRLF CRLF);
+  ws_append_str (&str, CRLF);
+
+  if (client->deflate) {
+    ws_append_str (&str, "Sec-WebSocket-Extensions: ");
+    ws_append_str (&str, WS_DEFLATE_RESP);
+    ws_append_str (&str, CRLF);
+  }
+  ws_append_str (&str, CRLF);
 
   bytes = ws_respond (client, str, strlen (str));
   free (str);
@@ -1621,6 +2207,9 @@ ws_get_handshake (WSClient * client, WSServer * server)
   }
 
   ws_set_handshake_headers (client->headers);
+#ifdef HAVE_LIBZ
+  client->deflate = ws_accept_deflate (client->headers->ws_extensions);
+#endif
 
   /* handshake response */
   ws_send_handshake_headers (client, client->headers);
@@ -1645,11 +2234,11 @@ ws_get_handshake (WSClient * client, WSServer * server)
 int
 ws_send_data (WSClient * client, WSOpcode opcode, const char *p, int sz)
 {
-  char *buf = NULL;
+  WSBuffer *frm = NULL;
 
-  buf = sanitize_utf8 (p, sz);
-  ws_send_frame (client, opcode, buf, sz);
-  free (buf);
+  frm = ws_new_frame (opcode, sanitize_utf8 (p, sz), sz);
+  ws_respond_buffer (client, frm);
+  ws_unref_buffer (frm);
 
   return 0;
 }
@@ -1710,6 +2299,14 @@ ws_set_front_header_fields (WSClient * client)
   (*frm)->opcode = WS_FRM_OPCODE (*(buf));
   (*frm)->res = WS_FRM_R1 (*(buf)) || WS_FRM_R2 (*(buf)) || WS_FRM_R3 (*(buf));
 
+  /* RSV1 flags the first frame of a compressed data message */
+  if (client->deflate && WS_FRM_R1 (*(buf)) && !WS_FRM_R2 (*(buf)) &&
+      !WS_FRM_R3 (*(buf)) && ((*frm)->opcode == WS_OPCODE_TEXT ||
+                              (*frm)->opcode == WS_OPCODE_BIN)) {
+    (*frm)->compressed = 1;
+    (*frm)->res = 0;
+  }
+
   /* should be masked and can't be using RESVd  bits */
   if (!(*frm)->masking || (*frm)->res)
     return ws_set_status (client, WS_ERR | WS_CLOSE, 1);
@@ -1759,6 +2356,17 @@ ws_handle_pong (WSClient * client)
     return;
   }
   ws_free_message (client);
+
+  /* unsolicited pongs are fine, only the one answering our ping counts */
+  if (client->ping.tv_sec == 0)
+    return;
+
+  client->stats.rtt = ws_elapsed_ms (&client->ping);
+  if (client->stats.srtt == 0)
+    client->stats.srtt = client->stats.rtt;
+  else
+    client->stats.srtt = (7 * client->stats.srtt + client->stats.rtt) / 8;
+  client->ping.tv_sec = 0;
 }
 
 /* Handle a websocket ping from the client and it attempts to send
@@ -1852,6 +2460,9 @@ ws_handle_text_bin (WSClient * client, WSServer * server)
   WSFrame **frm = &client->frame;
   WSMessage **msg = &client->message;
   int offset = (*msg)->mask_offset;
+#ifdef HAVE_LIBZ
+  int code = 0;
+#endif
 
   /* All data frames after the initial data frame must have opcode 0 */
   if ((*msg)->fragmented && (*frm)->opcode != WS_OPCODE_CONTINUATION) {
@@ -1870,6 +2481,13 @@ ws_handle_text_bin (WSClient * client, WSServer * server)
   if (!(*frm)->fin)
     return;
 
+#ifdef HAVE_LIBZ
+  if ((*msg)->compressed && (code = ws_inflate_message (client)) != 0) {
+    ws_handle_err (client, code, WS_ERR | WS_CLOSE, NULL);
+    return;
+  }
+#endif
+
   /* validate text data encoded as UTF-8 */
   if ((*msg)->opcode == WS_OPCODE_TEXT) {
     if (ws_validate_string ((*msg)->payload, (*msg)->payloadsz) != 0) {
@@ -1912,6 +2530,7 @@ ws_manage_payload_opcode (WSClient * client, WSServer * server)
   case WS_OPCODE_BIN:
     LOG (("TEXT\n"));
     client->message->opcode = (*frm)->opcode;
+    client->message->compressed = (*frm)->compressed;
     ws_handle_text_bin (client, server);
     break;
   case WS_OPCODE_PONG:
@@ -2173,6 +2792,11 @@ handle_tcp_close (int conn, WSClient * client, WSServer * server)
   gettimeofday (&client->end_proc, NULL);
   if (wsconfig.accesslog)
     access_log (client, 200);
+  LOG (("Client %d sent: %llu, max qlen: %d, updates: %d, skipped: %d, "
+        "resyncs: %d, srtt: %d\n", client->listener,
+        (unsigned long long) client->stats.sent, client->stats.max_qlen,
+        client->stats.updates, client->stats.skipped, client->stats.resyncs,
+        client->stats.srtt));
 
   /* errored out while parsing a frame or a message */
   if (client->status & WS_ERR) {
@@ -2181,7 +2805,8 @@ handle_tcp_close (int conn, WSClient * client, WSServer * server)
     ws_free_message (client);
   }
 
-  server->closing = 0;
+  ws_evt_set (conn, client->events, 0);
+  client->events = 0;
   ws_close (conn);
 
 #ifdef HAVE_LIBSSL
@@ -2199,10 +2824,8 @@ handle_tcp_close (int conn, WSClient * client, WSServer * server)
 static void
 handle_read_close (int conn, WSClient * client, WSServer * server)
 {
-  if (client->status & WS_SENDING) {
-    server->closing = 1;
+  if (client->status & WS_SENDING)
     return;
-  }
   handle_tcp_close (conn, client, server);
 }
 
@@ -2213,23 +2836,28 @@ handle_accept (int listener, WSServer * server)
   WSClient *client = NULL;
   int newfd;
 
-  newfd = accept_client (listener, &server->colist);
+  newfd = accept_client (listener, server);
   if (newfd == -1)
     return;
 
-  client = ws_get_client_from_list (newfd, &server->colist);
+  client = ws_get_client (newfd, server);
+#if !defined(HAVE_EPOLL_CTL) && !defined(HAVE_KQUEUE)
+  /* select(2) can't monitor it, so there's no point on waiting to send
+   * the rest of the response */
   if (newfd > FD_SETSIZE - 1) {
     LOG (("Too busy: %d %s.\n", newfd, client->remote_ip));
 
     http_error (client, WS_TOO_BUSY_STR);
-    handle_read_close (newfd, client, server);
+    handle_tcp_close (newfd, client, server);
     return;
   }
+#endif
 #ifdef HAVE_LIBSSL
   /* set flag to do TLS handshake */
   if (wsconfig.use_ssl)
     client->sslstatus |= WS_TLS_ACCEPTING;
 #endif
+  ws_set_events (client);
 
   LOG (("Accepted: %d %s\n", newfd, client->remote_ip));
 }
@@ -2240,7 +2868,7 @@ handle_reads (int conn, WSServer * server)
 {
   WSClient *client = NULL;
 
-  if (!(client = ws_get_client_from_list (conn, &server->colist)))
+  if (!(client = ws_get_client (conn, server)))
     return;
 
 #ifdef HAVE_LIBSSL
@@ -2272,7 +2900,7 @@ handle_writes (int conn, WSServer * server)
 {
   WSClient *client = NULL;
 
-  if (!(client = ws_get_client_from_list (conn, &server->colist)))
+  if (!(client = ws_get_client (conn, server)))
     return;
 
 #ifdef HAVE_LIBSSL
@@ -2294,17 +2922,30 @@ handle_writes (int conn, WSServer * server)
 
 /* Handle reads/writes on a TCP connection. */
 static void
-ws_listen (int listener, int conn, WSServer * server)
+ws_listen (int listener, WSEvent * ev, WSServer * server)
 {
+  WSClient *client = NULL;
+  int conn = ev->fd;
+
   /* handle new connections */
-  if (FD_ISSET (conn, &fdstate.rfds) && conn == listener)
+  if ((ev->events & WS_EVT_READ) && conn == listener) {
     handle_accept (listener, server);
+    return;
+  }
+
+  if (!(client = ws_get_client (conn, server)))
+    return;
+
   /* handle data from a client */
-  else if (FD_ISSET (conn, &fdstate.rfds) && conn != listener)
+  if ((ev->events & WS_EVT_READ) && (client->events & WS_EVT_READ))
     handle_reads (conn, server);
   /* handle sending data to a client */
-  else if (FD_ISSET (conn, &fdstate.wfds) && conn != listener)
+  else if ((ev->events & WS_EVT_WRITE) && (client->events & WS_EVT_WRITE))
     handle_writes (conn, server);
+
+  /* the client may be gone by now */
+  if (ws_get_client (conn, server) == client)
+    ws_set_events (client);
 }
 
 /* Create named pipe (FIFO) with the given pipe name.
@@ -2358,9 +2999,6 @@ ws_openfifo_out (WSPipeOut * pipeout)
     FATAL ("Unable to open fifo out: %s.", strerror (errno));
   pipeout->fd = status;
 
-  if (status != -1 && status > max_file_fd)
-    max_file_fd = status;
-
   return status;
 }
 
@@ -2376,154 +3014,183 @@ ws_fifo (WSServer * server)
   ws_openfifo_out (server->pipeout);
 }
 
-/* Clear the queue for an outgoing named pipe. */
-static void
-clear_fifo_queue (WSPipeOut * pipeout)
+/* Free all the packets queued up for a named pipe. The sequence
+ * number carries on. */
+void
+ws_fifo_clear (WSFifoQueue * queue)
 {
-  WSQueue **queue = &pipeout->fifoqueue;
-  if (!(*queue))
-    return;
-
-  if ((*queue)->queued)
-    free ((*queue)->queued);
-  (*queue)->queued = NULL;
-  (*queue)->qlen = 0;
+  WSFifoPacket *pkt = NULL;
 
-  free ((*queue));
-  (*queue) = NULL;
+  while ((pkt = queue->head) != NULL) {
+    queue->head = pkt->next;
+    free (pkt->data);
+    free (pkt);
+  }
+  queue->tail = NULL;
+  queue->qlen = 0;
 }
 
-/* Attempt to realloc the current sent queue for an outgoing named pip
- * (FIFO).
+/* Append the given packet to a named pipe queue.
  *
- * On error, 1 is returned and the connection status is closed and
- * reopened.
- * On success, 0 is returned. */
-static int
-ws_realloc_fifobuf (WSPipeOut * pipeout, const char *buf, int len)
-{
-  WSQueue *queue = pipeout->fifoqueue;
-  char *tmp = NULL;
-  int newlen = 0;
-
-  newlen = queue->qlen + len;
-  tmp = realloc (queue->queued, newlen);
-  if (tmp == NULL && newlen > 0) {
-    close (pipeout->fd);
-    clear_fifo_queue (pipeout);
-    ws_openfifo_out (pipeout);
-    return 1;
+ * Snapshots queued up for the same listener are dropped if the new
+ * packet is a snapshot as well, and if the queue goes over its budget,
+ * the oldest packets are dropped. A packet partially written always
+ * goes through, else the reader would get out of sync. */
+static void
+ws_fifo_append (WSFifoQueue * queue, WSFifoPacket * pkt)
+{
+  WSFifoPacket **cur = &queue->head, *drop = NULL;
+  int stale = 0;
+
+  queue->tail = NULL;
+  while (*cur != NULL) {
+    stale = (pkt->flags & WS_FIFO_SNAPSHOT) &&
+      ((*cur)->flags & WS_FIFO_SNAPSHOT) && (*cur)->listener == pkt->listener;
+    if ((*cur)->offset == 0 &&
+        (stale || queue->qlen + pkt->len > WS_FIFO_QUEUE_MAX)) {
+      LOG (("Dropping %s FIFO packet\n", stale ? "stale" : "queued"));
+      drop = *cur;
+      *cur = drop->next;
+      queue->qlen -= drop->len;
+      free (drop->data);
+      free (drop);
+      continue;
+    }
+    queue->tail = *cur;
+    cur = &(*cur)->next;
   }
 
-  queue->queued = tmp;
-  memcpy (queue->queued + queue->qlen, buf, len);
-  queue->qlen += len;
-
-  return 0;
+  *cur = pkt;
+  queue->tail = pkt;
+  queue->qlen += pkt->len;
 }
 
-/* Set into a queue the data that couldn't be sent in the outgoing
- * FIFO. */
-static void
-ws_queue_fifobuf (WSPipeOut * pipeout, const char *buffer, int len, int bytes)
+/* Frame the given payload and append it to a named pipe queue. */
+void
+ws_fifo_push (WSFifoQueue * queue, uint32_t listener, uint32_t type,
+              uint32_t flags, const char *data, int len)
 {
-  WSQueue **queue = &pipeout->fifoqueue;
+  WSFifoPacket *pkt = xcalloc (1, sizeof (WSFifoPacket));
+  char *ptr = NULL;
 
-  if (bytes < 1)
-    bytes = 0;
+  /* 0 is never used, so a reader knows nothing came through yet */
+  if (++queue->seq == 0)
+    queue->seq = 1;
+
+  pkt->listener = listener;
+  pkt->flags = flags;
+  pkt->len = HDR_SIZE + len;
+  pkt->data = xmalloc (pkt->len);
 
-  (*queue) = xcalloc (1, sizeof (WSQueue));
-  (*queue)->queued = xcalloc (len - bytes, sizeof (char));
-  memcpy ((*queue)->queued, buffer + bytes, len - bytes);
-  (*queue)->qlen = len - bytes;
+  ptr = pkt->data;
+  ptr += pack_uint32 (ptr, listener);
+  ptr += pack_uint32 (ptr, type);
+  ptr += pack_uint32 (ptr, flags);
+  ptr += pack_uint32 (ptr, queue->seq);
+  ptr += pack_uint32 (ptr, len);
+  memcpy (ptr, data, len);
 
-  pipeout->status |= WS_SENDING;
+  ws_fifo_append (queue, pkt);
 }
 
-/* Attmpt to send the given buffer to the given outgoing FIFO.
+/* Write as many queued up packets as possible to the given named pipe.
  *
- * On error, the data is queued up.
- * On success, the number of bytes sent is returned. */
-static int
-ws_write_fifo_data (WSPipeOut * pipeout, char *buffer, int len)
+ * On error, -1 is returned.
+ * On success, the number of bytes still queued up is returned. */
+int
+ws_fifo_flush (WSFifoQueue * queue, int fd)
 {
+  WSFifoPacket *pkt = NULL;
   int bytes = 0;
 
-  bytes = write (pipeout->fd, buffer, len);
+  while ((pkt = queue->head) != NULL) {
+    bytes = write (fd, pkt->data + pkt->offset, pkt->len - pkt->offset);
+    if (bytes == -1 && errno == EINTR)
+      continue;
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (bytes == -1)
+      return -1;
 
-  /* At this point, the reader probably closed the pipe, so a cheap *hack* for
-   * this is to close the pipe on our end and attempt to reopen it. If unable to
-   * do so, then let it be -1 and try on the next attempt to write. */
-  if (bytes == -1 && errno == EPIPE) {
-    close (pipeout->fd);
-    ws_openfifo_out (pipeout);
-    return bytes;
+    pkt->offset += bytes;
+    queue->qlen -= bytes;
+    /* the pipe is full */
+    if (pkt->offset < pkt->len)
+      break;
+
+    queue->head = pkt->next;
+    if (queue->head == NULL)
+      queue->tail = NULL;
+    free (pkt->data);
+    free (pkt);
   }
-  if (bytes < len || (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))
-    ws_queue_fifobuf (pipeout, buffer, len, bytes);
 
-  return bytes;
+  return queue->qlen;
 }
 
-/* Attempt to send the queued up client's data through the outgoing
- * named pipe (FIFO) .
+/* Attempt to send the queued up data through the outgoing named pipe
+ * (FIFO).
  *
- * On error, 1 is returned and the connection status is set.
- * On success, the number of bytes sent is returned. */
+ * On success, the number of bytes still queued up is returned. */
 static int
-ws_write_fifo_cache (WSPipeOut * pipeout)
+ws_flush_fifo_out (WSPipeOut * pipeout)
 {
-  WSQueue *queue = pipeout->fifoqueue;
-  int bytes = 0;
+  int ret = 0;
 
-  bytes = write (pipeout->fd, queue->queued, queue->qlen);
+  /* no reader yet, keep it queued up until there's one */
+  if (pipeout->fd == -1 && ws_openfifo_out (pipeout) == -1)
+    return pipeout->fifoqueue.qlen;
 
   /* At this point, the reader probably closed the pipe, so a cheap *hack* for
    * this is to close the pipe on our end and attempt to reopen it. If unable to
-   * do so, then let it be -1 and try on the next attempt to write. */
-  if (bytes == -1 && errno == EPIPE) {
-    close (pipeout->fd);
+   * do so, then let it be -1 and try on the next attempt to write. Whatever
+   * was queued up was meant for the previous reader. */
+  if ((ret = ws_fifo_flush (&pipeout->fifoqueue, pipeout->fd)) == -1) {
+    ws_close_fifo (pipeout->fd, &pipeout->events);
+    ws_fifo_clear (&pipeout->fifoqueue);
     ws_openfifo_out (pipeout);
-    return bytes;
+    ret = 0;
   }
 
-  if (chop_nchars (queue->queued, bytes, queue->qlen) == 0)
-    clear_fifo_queue (pipeout);
+  if (ret > 0)
+    pipeout->status |= WS_SENDING;
   else
-    queue->qlen -= bytes;
+    pipeout->status &= ~WS_SENDING;
 
-  return bytes;
+  return ret;
 }
 
-/* An entry point to attempt to send the client's data into an
- * outgoing named pipe (FIFO).
+/* An entry point to attempt to send the client's data as is into an
+ * outgoing named pipe (FIFO). If NULL, the queued up data is sent.
  *
- * On success, the number of bytes sent is returned. */
+ * On success, the number of bytes still queued up is returned. */
 int
 ws_write_fifo (WSPipeOut * pipeout, char *buffer, int len)
 {
-  int bytes = 0;
+  WSFifoPacket *pkt = NULL;
 
-  if (pipeout->fd == -1 && ws_openfifo_out (pipeout) == -1)
-    return bytes;
-
-  /* attempt to send the whole buffer buffer */
-  if (pipeout->fifoqueue == NULL)
-    bytes = ws_write_fifo_data (pipeout, buffer, len);
-  /* buffer not empty, just append new data */
-  else if (pipeout->fifoqueue != NULL && buffer != NULL) {
-    if (ws_realloc_fifobuf (pipeout, buffer, len) == 1)
-      return bytes;
-  }
-  /* send from cache buffer */
-  else {
-    bytes = ws_write_fifo_cache (pipeout);
+  if (buffer != NULL) {
+    pkt = xcalloc (1, sizeof (WSFifoPacket));
+    pkt->data = xmalloc (len);
+    pkt->len = len;
+    memcpy (pkt->data, buffer, len);
+    ws_fifo_append (&pipeout->fifoqueue, pkt);
   }
 
-  if (pipeout->fifoqueue == NULL)
-    pipeout->status &= ~WS_SENDING;
+  return ws_flush_fifo_out (pipeout);
+}
 
-  return bytes;
+/* An entry point to attempt to send a framed packet into an outgoing
+ * named pipe (FIFO), see ws_fifo_push().
+ *
+ * On success, the number of bytes still queued up is returned. */
+int
+ws_write_fifo_packet (WSPipeOut * pipeout, uint32_t listener, uint32_t type,
+                      uint32_t flags, const char *data, int len)
+{
+  ws_fifo_push (&pipeout->fifoqueue, listener, type, flags, data, len);
+
+  return ws_flush_fifo_out (pipeout);
 }
 
 /* Clear an incoming FIFO packet and header data. */
@@ -2542,12 +3209,104 @@ clear_fifo_packet (WSPipeIn * pipein)
   pipein->packet = NULL;
 }
 
-/* Broadcast to all connected clients the given message. */
+/* Determine if a full snapshot can be requested for a client, i.e.,
+ * the other end of the named pipes fast-forwards a client as soon as
+ * its connection is opened.
+ *
+ * If it can't, 0 is returned.
+ * If it can, 1 is returned. */
+static int
+ws_can_resync (WSServer * server)
+{
+  return server->onopen && wsconfig.strict && !wsconfig.echomode;
+}
+
+/* Drop the updates queued up for the given client that didn't start
+ * going out yet.
+ *
+ * On success, the number of dropped updates is returned. */
+static int
+ws_drop_updates (WSClient * client)
+{
+  WSSendQueue **cur = &client->sockqueue, *node = NULL;
+  int dropped = 0;
+
+  client->socktail = NULL;
+  while ((node = *cur) != NULL) {
+    if (!node->update || node->offset > 0) {
+      client->socktail = node;
+      cur = &node->next;
+      continue;
+    }
+    *cur = node->next;
+    client->qlen -= node->buf->hlen + node->buf->len;
+    ws_unref_buffer (node->buf);
+    free (node);
+    dropped++;
+  }
+  if (client->sockqueue == NULL)
+    client->status &= ~WS_SENDING;
+
+  return dropped;
+}
+
+/* Queue up the given update frame for a client, coalescing updates for
+ * clients that can't keep up with them.
+ *
+ * Broadcast updates only carry what changed, so a client still waiting
+ * on a previous one drops whatever didn't start going out and asks for
+ * a full snapshot instead, skipping updates until it comes through. A
+ * client that still goes over WS_QUEUE_MAX is disconnected. A ping is
+ * sent along each update to track the client's round-trip time. */
+static void
+ws_schedule_update (WSServer * server, WSClient * client, WSBuffer * frm,
+                    int snapshot)
+{
+  int dropped = 0;
+
+  if (!snapshot && client->resync) {
+    client->stats.skipped++;
+    return;
+  }
+
+  dropped = ws_drop_updates (client);
+  client->stats.skipped += dropped;
+  if (dropped > 0 && !snapshot && ws_can_resync (server)) {
+    LOG (("Coalescing updates of %d, qlen: %d\n", client->listener,
+          client->qlen));
+    client->stats.skipped++;
+    client->stats.resyncs++;
+    client->resync = 1;
+    server->onopen (server->pipeout, client);
+    return;
+  }
+  client->resync = 0;
+
+  ws_respond_buffer (client, frm);
+  if (client->socktail != NULL && client->socktail->offset == 0)
+    client->socktail->update = 1;
+  client->stats.updates++;
+
+  if (client->qlen > WS_QUEUE_MAX) {
+    LOG (("Too slow client %d, qlen: %d\n", client->listener, client->qlen));
+    ws_clear_queue (client);
+    ws_handle_err (client, WS_CLOSE_POLICY, WS_ERR | WS_CLOSE,
+                   "Too slow to keep up");
+    return;
+  }
+
+  if (client->ping.tv_sec == 0) {
+    ws_send_frame (client, WS_OPCODE_PING, NULL, 0);
+    gettimeofday (&client->ping, NULL);
+  }
+}
+
+/* Broadcast to all connected clients the given frame. */
 static int
 ws_broadcast_fifo (void *value, void *user_data)
 {
+  WSBroadcast *bcast = user_data;
   WSClient *client = value;
-  WSPacket *packet = user_data;
 
   if (client == NULL || user_data == NULL)
     return 1;
@@ -2555,24 +3314,51 @@ ws_broadcast_fifo (void *value, void *user_data)
   if (client->headers == NULL || client->headers->ws_accept == NULL)
     return 1;
 
-  ws_send_data (client, packet->type, packet->data, packet->size);
+  ws_schedule_update (bcast->server, client, bcast->frm, 0);
+  ws_set_events (client);
 
   return 0;
 }
 
+/* Encode the given message once and broadcast it to all connected
+ * clients. */
+static void
+ws_broadcast_packet (WSServer * server, WSPacket * pa)
+{
+  WSBroadcast bcast;
+
+  bcast.server = server;
+  bcast.frm =
+    ws_new_frame (pa->type, sanitize_utf8 (pa->data, pa->size), pa->size);
+  list_foreach (server->colist, ws_broadcast_fifo, &bcast);
+  ws_unref_buffer (bcast.frm);
+}
+
 /* Send a message from the incoming named pipe to specific client
- * given the socket id. */
+ * given the socket id. A snapshot supersedes any update queued up for
+ * the client, see ws_schedule_update(). */
 static void
-ws_send_strict_fifo_to_client (WSServer * server, int listener, WSPacket * pa)
+ws_send_strict_fifo_to_client (WSServer * server, int listener, WSPacket * pa,
+                               uint32_t flags)
 {
   WSClient *client = NULL;
+  WSBuffer *frm = NULL;
 
-  if (!(client = ws_get_client_from_list (listener, &server->colist)))
+  if (!(client = ws_get_client (listener, server)))
     return;
   /* no handshake for this client */
   if (client->headers == NULL || client->headers->ws_accept == NULL)
     return;
-  ws_send_data (client, pa->type, pa->data, pa->len);
+
+  if (flags & WS_FIFO_SNAPSHOT) {
+    frm = ws_new_frame (pa->type, sanitize_utf8 (pa->data, pa->len), pa->len);
+    ws_schedule_update (server, client, frm, 1);
+    ws_unref_buffer (frm);
+  } else {
+    client->resync = 0;
+    ws_send_data (client, pa->type, pa->data, pa->len);
+  }
+  ws_set_events (client);
 }
 
 /* Attempt to read message from a named pipe (FIFO).
@@ -2619,24 +3405,55 @@ unpack_uint32 (const void *buf, uint32_t * val)
   return sizeof (uint32_t);
 }
 
+/* Unpack a FIFO packet header into a host byte order. */
+void
+ws_unpack_fifo_hdr (const char *buf, WSFifoHdr * hdr)
+{
+  buf += unpack_uint32 (buf, &hdr->listener);
+  buf += unpack_uint32 (buf, &hdr->type);
+  buf += unpack_uint32 (buf, &hdr->flags);
+  buf += unpack_uint32 (buf, &hdr->seq);
+  unpack_uint32 (buf, &hdr->size);
+}
+
+/* Determine if a packet came out of order, given its sequence number
+ * and the last one seen (0 if none).
+ *
+ * If it's stale, 1 is returned.
+ * Otherwise, the last sequence number is updated and 0 is returned. */
+int
+ws_fifo_stale (uint32_t * last, uint32_t seq)
+{
+  if (*last != 0 && (int32_t) (seq - *last) <= 0)
+    return 1;
+  *last = seq;
+
+  return 0;
+}
+
 /* Ensure the fields coming from the named pipe are valid.
  *
  * On error, 1 is returned.
  * On success, 0 is returned. */
 static int
-validate_fifo_packet (uint32_t listener, uint32_t type, int size)
+validate_fifo_packet (WSFifoHdr * hdr)
 {
-  if (listener > FD_SETSIZE) {
+  if (hdr->listener > INT_MAX) {
     LOG (("Invalid listener\n"));
     return 1;
   }
 
-  if (type != WS_OPCODE_TEXT && type != WS_OPCODE_BIN) {
+  if (hdr->type != WS_OPCODE_TEXT && hdr->type != WS_OPCODE_BIN) {
     LOG (("Invalid fifo packet type\n"));
     return 1;
   }
 
-  if (size > wsconfig.max_frm_size) {
+  if (hdr->flags & ~WS_FIFO_FLAGS) {
+    LOG (("Invalid fifo packet flags\n"));
+    return 1;
+  }
+
+  if (hdr->size > (uint32_t) wsconfig.max_frm_size) {
     LOG (("Invalid fifo packet size\n"));
     return 1;
   }
@@ -2651,11 +3468,9 @@ handle_strict_fifo (WSServer * server)
 {
   WSPipeIn *pi = server->pipein;
   WSPacket **pa = &pi->packet;
+  WSFifoHdr hdr;
   int bytes = 0, readh = 0, need = 0;
 
-  char *ptr = NULL;
-  uint32_t listener = 0, type = 0, size = 0;
-
   readh = pi->hlen;     /* read from header so far */
   need = HDR_SIZE - readh;      /* need to read */
   if (need > 0) {
@@ -2665,14 +3480,9 @@ handle_strict_fifo (WSServer * server)
       return;
   }
 
-  /* unpack size, and type */
-  ptr = pi->hdr;
-  ptr += unpack_uint32 (ptr, &listener);
-  ptr += unpack_uint32 (ptr, &type);
-  ptr += unpack_uint32 (ptr, &size);
-
-  if (validate_fifo_packet (listener, type, size) == 1) {
-    close (pi->fd);
+  ws_unpack_fifo_hdr (pi->hdr, &hdr);
+  if (validate_fifo_packet (&hdr) == 1) {
+    ws_close_fifo (pi->fd, &pi->events);
     clear_fifo_packet (pi);
     ws_openfifo_in (pi);
     return;
@@ -2680,9 +3490,9 @@ handle_strict_fifo (WSServer * server)
 
   if ((*pa) == NULL) {
     (*pa) = xcalloc (1, sizeof (WSPacket));
-    (*pa)->type = type;
-    (*pa)->size = size;
-    (*pa)->data = xcalloc (size, sizeof (char));
+    (*pa)->type = hdr.type;
+    (*pa)->size = hdr.size;
+    (*pa)->data = xcalloc (hdr.size, sizeof (char));
   }
 
   readh = (*pa)->len;   /* read from payload so far */
@@ -2695,18 +3505,25 @@ handle_strict_fifo (WSServer * server)
       return;
   }
 
+  /* out of order or replayed, never deliver outdated data */
+  if (ws_fifo_stale (&pi->seq, hdr.seq)) {
+    LOG (("Stale fifo packet %u\n", hdr.seq));
+    clear_fifo_packet (pi);
+    return;
+  }
+
   /* no clients to send data to */
-  if (list_count (server->colist) == 0) {
+  if (server->colist == NULL) {
     clear_fifo_packet (pi);
     return;
   }
 
   /* Either send it to a specific client or brodcast message to all
    * clients */
-  if (listener != 0)
-    ws_send_strict_fifo_to_client (server, listener, *pa);
+  if (hdr.listener != 0)
+    ws_send_strict_fifo_to_client (server, hdr.listener, *pa, hdr.flags);
   else
-    list_foreach (server->colist, ws_broadcast_fifo, *pa);
+    ws_broadcast_packet (server, *pa);
   clear_fifo_packet (pi);
 }
 
@@ -2734,13 +3551,13 @@ handle_fixed_fifo (WSServer * server)
   (*pa)->data = xstrdup (buf);
 
   /* no clients to send data to */
-  if (list_count (server->colist) == 0) {
+  if (server->colist == NULL) {
     clear_fifo_packet (pi);
     return;
   }
 
   /* brodcast message to all clients */
-  list_foreach (server->colist, ws_broadcast_fifo, *pa);
+  ws_broadcast_packet (server, *pa);
   clear_fifo_packet (pi);
 }
 
@@ -2787,62 +3604,25 @@ ws_socket (int *listener)
     FATAL ("Unable to listen: %s.", strerror (errno));
 }
 
-/* Handle incoming messages through a pipe (let gwsocket be the
- * reader) and outgoing messages through the pipe (writer). */
+/* Monitor the named pipes for the events they currently need. The
+ * outgoing pipe is only checked for writing if we have data to send. */
 static void
-ws_fifos (WSServer * server, WSPipeIn * pi, WSPipeOut * po)
+ws_set_fifo_events (WSPipeIn * pi, WSPipeOut * po)
 {
-  /* handle data via fifo */
-  if (pi->fd != -1 && FD_ISSET (pi->fd, &fdstate.rfds))
-    handle_fifo (server);
-  /* handle data via fifo */
-  if (po->fd != -1 && FD_ISSET (po->fd, &fdstate.wfds))
-    ws_write_fifo (po, NULL, 0);
-}
+  int events = 0;
 
-/* Check each client to determine if:
- * 1. We want to see if it has data for reading
- * 2. We want to write data to it.
- * If so, set the client's socket descriptor in the descriptor set. */
-static void
-set_rfds_wfds (int listener, WSServer * server, WSPipeIn * pi, WSPipeOut * po)
-{
-  WSClient *client = NULL;
-  int conn;
+  /* pipe in */
+  if (pi->fd != -1) {
+    events = WS_EVT_READ;
+    ws_evt_set (pi->fd, pi->events, events);
+    pi->events = events;
+  }
 
   /* pipe out */
   if (po->fd != -1) {
-    if (po->status & WS_SENDING)
-      FD_SET (po->fd, &fdstate.wfds);
-  }
-  /* pipe in */
-  if (pi->fd != -1)
-    FD_SET (pi->fd, &fdstate.rfds);
-
-  /* self-pipe trick to stop the event loop */
-  FD_SET (server->self_pipe[0], &fdstate.rfds);
-  /* server socket, ready for accept() */
-  FD_SET (listener, &fdstate.rfds);
-
-  for (conn = 0; conn < FD_SETSIZE; ++conn) {
-    if (conn == pi->fd || conn == po->fd)
-      continue;
-    if (!(client = ws_get_client_from_list (conn, &server->colist)))
-      continue;
-
-    /* As long as we are not closing a connection, we assume we always
-     * check a client for reading */
-    if (!server->closing) {
-      FD_SET (conn, &fdstate.rfds);
-      if (conn > max_file_fd)
-        max_file_fd = conn;
-    }
-    /* Only if we have data to send the client */
-    if (client->status & WS_SENDING) {
-      FD_SET (conn, &fdstate.wfds);
-      if (conn > max_file_fd)
-        max_file_fd = conn;
-    }
+    events = (po->status & WS_SENDING) ? WS_EVT_WRITE : 0;
+    ws_evt_set (po->fd, po->events, events);
+    po->events = events;
   }
 }
 
@@ -2853,7 +3633,8 @@ ws_start (WSServer * server)
 {
   WSPipeIn *pipein = server->pipein;
   WSPipeOut *pipeout = server->pipeout;
-  int listener = 0, conn = 0;
+  WSEvent evs[WS_MAX_EVENTS];
+  int listener = 0, i = 0, n = 0, rpipe = 0, wpipe = 0;
 
 #ifdef HAVE_LIBSSL
   if (wsconfig.sslcert && wsconfig.sslkey) {
@@ -2866,46 +3647,47 @@ ws_start (WSServer * server)
   }
 #endif
 
-  memset (&fdstate, 0, sizeof fdstate);
+  ws_evt_init ();
   ws_socket (&listener);
 
-  while (1) {
-    /* If the pipeout file descriptor was opened after the server socket
-     * was opened, then it's possible the max file descriptor would be the
-     * pipeout fd, in any case we check this here */
-    max_file_fd = MAX (listener, pipeout->fd);
-    /* Clear out the fd sets for this iteration. */
-    FD_ZERO (&fdstate.rfds);
-    FD_ZERO (&fdstate.wfds);
+  /* self-pipe trick to stop the event loop */
+  ws_evt_set (server->self_pipe[0], 0, WS_EVT_READ);
+  /* server socket, ready for accept() */
+  ws_evt_set (listener, 0, WS_EVT_READ);
 
-    set_rfds_wfds (listener, server, pipein, pipeout);
-    max_file_fd += 1;
+  while (1) {
+    ws_set_fifo_events (pipein, pipeout);
 
     /* yep, wait patiently */
-    /* should it be using epoll/kqueue? will see... */
-    if (select (max_file_fd, &fdstate.rfds, &fdstate.wfds, NULL, NULL) == -1) {
-      switch (errno) {
-      case EINTR:
-        LOG (("A signal was caught on select(2)\n"));
+    n = ws_evt_wait (evs, WS_MAX_EVENTS);
+
+    /* handle self-pipe trick */
+    for (i = 0; i < n; ++i) {
+      if (evs[i].fd == server->self_pipe[0])
         break;
-      default:
-        FATAL ("Unable to select: %s.", strerror (errno));
-      }
     }
-    /* handle self-pipe trick */
-    if (FD_ISSET (server->self_pipe[0], &fdstate.rfds)) {
+    if (i < n) {
       LOG (("Handled self-pipe to close event loop.\n"));
       break;
     }
 
-    /* iterate over existing connections */
-    for (conn = 0; conn < max_file_fd; ++conn) {
-      if (conn != pipein->fd && conn != pipeout->fd) {
-        ws_listen (listener, conn, server);
-      }
+    /* iterate over the ready connections only */
+    rpipe = wpipe = 0;
+    for (i = 0; i < n; ++i) {
+      if (evs[i].fd == pipein->fd && pipein->fd != -1)
+        rpipe = evs[i].events & WS_EVT_READ;
+      else if (evs[i].fd == pipeout->fd && pipeout->fd != -1)
+        wpipe = evs[i].events & WS_EVT_WRITE;
+      else
+        ws_listen (listener, &evs[i], server);
     }
-    /* handle FIFOs */
-    ws_fifos (server, pipein, pipeout);
+
+    /* handle data via fifo */
+    if (rpipe && pipein->fd != -1)
+      handle_fifo (server);
+    /* handle data via fifo, unless it was reopened meanwhile */
+    if (wpipe && (pipeout->events & WS_EVT_WRITE))
+      ws_write_fifo (pipeout, NULL, 0);
   }
 }
 
@@ -100,17 +100,34 @@
 #define CRLF "\r\n"
 #define SHA_DIGEST_LENGTH     20
 
-/* packet header is 3 unit32_t : type, size, listener */
-#define HDR_SIZE              3 * 4
+/* packet header is 5 unit32_t : listener, type, flags, seq, size */
+#define HDR_SIZE              5 * 4
 #define WS_MAX_FRM_SZ         1048576   /* 1 MiB max frame size */
-#define WS_THROTTLE_THLD      2097152   /* 2 MiB throttle threshold */
+#define WS_QUEUE_MAX          8388608   /* 8 MiB max queued up client data */
+#define WS_FIFO_QUEUE_MAX     4194304   /* 4 MiB max queued up FIFO data */
+
+/* FIFO packet flags */
+#define WS_FIFO_SNAPSHOT      0x01      /* supersedes earlier ones for the
+                                         * same listener */
+#define WS_FIFO_FLAGS         (WS_FIFO_SNAPSHOT)
 
 #define WS_MAGIC_STR "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* permessage-deflate, every message is compressed on its own */
+#define WS_DEFLATE_EXT "permessage-deflate"
+#define WS_DEFLATE_RESP WS_DEFLATE_EXT \
+  "; server_no_context_takeover; client_no_context_takeover"
+#define WS_DEFLATE_MIN        128       /* don't compress smaller payloads */
 #define WS_PAYLOAD_EXT16      126
 #define WS_PAYLOAD_EXT64      127
 #define WS_PAYLOAD_FULL       125
 #define WS_FRM_HEAD_SZ         16       /* frame header size */
 
+/* I/O events the event loop waits for */
+#define WS_EVT_READ           0x1
+#define WS_EVT_WRITE          0x2
+#define WS_MAX_EVENTS         256       /* ready events per wakeup */
+
 #define WS_FRM_FIN(x)         (((x) >> 7) & 0x01)
 #define WS_FRM_MASK(x)        (((x) >> 7) & 0x01)
 #define WS_FRM_R1(x)          (((x) >> 6) & 0x01)
@@ -122,7 +139,9 @@
 #define WS_CLOSE_NORMAL       1000
 #define WS_CLOSE_GOING_AWAY   1001
 #define WS_CLOSE_PROTO_ERR    1002
+#define WS_CLOSE_INVALID_DATA 1003
 #define WS_CLOSE_INVALID_UTF8 1007
+#define WS_CLOSE_POLICY       1008
 #define WS_CLOSE_TOO_LARGE    1009
 #define WS_CLOSE_UNEXPECTED   1011
 
@@ -133,11 +152,10 @@ typedef enum WSSTATUS
   WS_CLOSE = (1 << 1),
   WS_READING = (1 << 2),
   WS_SENDING = (1 << 3),
-  WS_THROTTLING = (1 << 4),
-  WS_TLS_ACCEPTING = (1 << 5),
-  WS_TLS_READING = (1 << 6),
-  WS_TLS_WRITING = (1 << 7),
-  WS_TLS_SHUTTING = (1 << 8),
+  WS_TLS_ACCEPTING = (1 << 4),
+  WS_TLS_READING = (1 << 5),
+  WS_TLS_WRITING = (1 << 6),
+  WS_TLS_SHUTTING = (1 << 7),
 } WSStatus;
 
 typedef enum WSOPCODE
@@ -151,11 +169,59 @@ typedef enum WSOPCODE
   WS_OPCODE_PONG = 0x0A,
 } WSOpcode;
 
-typedef struct WSQueue_
+/* An outgoing buffer, e.g., an encoded frame. It's reference counted,
+ * so a broadcast frame is encoded once and shared by all clients. */
+typedef struct WSBuffer_
 {
-  char *queued;                 /* queue data */
-  int qlen;                     /* queue length */
-} WSQueue;
+  char hdr[WS_FRM_HEAD_SZ];     /* frame header */
+  int hlen;                     /* frame header length */
+  char *data;                   /* payload */
+  int len;                      /* payload length */
+  int refs;                     /* number of references */
+
+  int compress;                 /* data frame worth compressing */
+  struct WSBuffer_ *deflated;   /* compressed frame (if any) */
+} WSBuffer;
+
+/* A buffer queued up to be sent to a client */
+typedef struct WSSendQueue_
+{
+  WSBuffer *buf;
+  int offset;                   /* bytes of it sent so far */
+  int update;                   /* an update that can be coalesced */
+  struct WSSendQueue_ *next;
+} WSSendQueue;
+
+/* A packet queued up to be written to a named pipe */
+typedef struct WSFifoPacket_
+{
+  uint32_t listener;            /* client it's meant for, 0 for all */
+  uint32_t flags;               /* WS_FIFO_* flags */
+  char *data;                   /* header + payload */
+  int len;                      /* data length */
+  int offset;                   /* bytes of it written so far */
+  struct WSFifoPacket_ *next;
+} WSFifoPacket;
+
+/* Packets waiting for a named pipe to become writable. Its size is
+ * bounded, stale snapshots are dropped as newer ones get queued. */
+typedef struct WSFifoQueue_
+{
+  WSFifoPacket *head;
+  WSFifoPacket *tail;
+  int qlen;                     /* bytes queued up */
+  uint32_t seq;                 /* last packet sequence number */
+} WSFifoQueue;
+
+/* A FIFO packet header */
+typedef struct WSFifoHdr_
+{
+  uint32_t listener;            /* client socket, 0 for all */
+  uint32_t type;                /* packet type, i.e., the opcode */
+  uint32_t flags;               /* WS_FIFO_* flags */
+  uint32_t seq;                 /* packet sequence number */
+  uint32_t size;                /* payload size in bytes */
+} WSFifoHdr;
 
 typedef struct WSPacket_
 {
@@ -184,6 +250,7 @@ typedef struct WSHeaders_
   char *ws_protocol;
   char *ws_key;
   char *ws_sock_ver;
+  char *ws_extensions;
 
   char *ws_accept;
   char *ws_resp;
@@ -197,6 +264,7 @@ typedef struct WSFrame_
   unsigned char fin;            /* frame fin flag */
   unsigned char mask[4];        /* mask key */
   uint8_t res;                  /* extensions */
+  int compressed;               /* RSV1 set, see permessage-deflate */
   int payload_offset;           /* end of header/start of payload */
   int payloadlen;               /* payload length (for each frame) */
 
@@ -214,20 +282,42 @@ typedef struct WSMessage_
   WSOpcode opcode;              /* frame opcode */
   int fragmented;               /* reading a fragmented frame */
   int mask_offset;              /* for fragmented frames */
+  int compressed;               /* permessage-deflate compressed */
 
   char *payload;                /* payload message */
   int payloadsz;                /* total payload size (whole message) */
   int buflen;                   /* recv'd buf length so far (for each frame) */
 } WSMessage;
 
-/* FD event states */
+/* FD event states, used when neither epoll nor kqueue are available */
 typedef struct WSEState_
 {
-  fd_set master;
+  fd_set rmaster;               /* monitored for reading */
+  fd_set wmaster;               /* monitored for writing */
   fd_set rfds;
   fd_set wfds;
+  int maxfd;
 } WSEState;
 
+/* A ready file descriptor and its WS_EVT_* events */
+typedef struct WSEvent_
+{
+  int fd;
+  int events;
+} WSEvent;
+
+/* Delivery metrics of a client, see ws_schedule_update() */
+typedef struct WSClientStats_
+{
+  uint64_t sent;                /* bytes sent */
+  int max_qlen;                 /* highest number of bytes queued up */
+  int updates;                  /* updates queued up */
+  int skipped;                  /* updates coalesced into a later one */
+  int resyncs;                  /* full snapshots requested */
+  int rtt;                      /* last round-trip time in ms, -1 if none */
+  int srtt;                     /* smoothed round-trip time in ms */
+} WSClientStats;
+
 /* A WebSocket Client */
 typedef struct WSClient_
 {
@@ -235,12 +325,19 @@ typedef struct WSClient_
   int listener;                 /* socket */
   char remote_ip[INET6_ADDRSTRLEN];     /* client IP */
 
-  WSQueue *sockqueue;           /* sending buffer */
+  WSSendQueue *sockqueue;       /* sending buffers */
+  WSSendQueue *socktail;        /* last sending buffer */
+  int qlen;                     /* bytes left to send */
   WSEState *state;              /* FDs states */
   WSHeaders *headers;           /* HTTP headers */
   WSFrame *frame;               /* frame headers */
   WSMessage *message;           /* message */
   WSStatus status;              /* connection status */
+  int events;                   /* monitored WS_EVT_* events */
+  int deflate;                  /* permessage-deflate negotiated */
+  int resync;                   /* updates skipped until a full snapshot */
+  struct timeval ping;          /* when the pending ping was sent, if any */
+  WSClientStats stats;          /* delivery metrics */
 
   struct timeval start_proc;
   struct timeval end_proc;
@@ -255,20 +352,23 @@ typedef struct WSClient_
 typedef struct WSPipeIn_
 {
   int fd;                       /* named pipe FD */
+  int events;                   /* monitored WS_EVT_* events */
 
   WSPacket *packet;             /* FIFO data's buffer */
   WSEState *state;              /* FDs states */
 
   char hdr[HDR_SIZE];           /* FIFO header's buffer */
   int hlen;
+  uint32_t seq;                 /* last packet sequence number read */
 } WSPipeIn;
 
 /* Pipe Out */
 typedef struct WSPipeOut_
 {
   int fd;                       /* named pipe FD */
+  int events;                   /* monitored WS_EVT_* events */
   WSEState *state;              /* FDs states */
-  WSQueue *fifoqueue;           /* FIFO out queue */
+  WSFifoQueue fifoqueue;        /* FIFO out queue */
   WSStatus status;              /* connection status */
 } WSPipeOut;
 
@@ -293,9 +393,6 @@ typedef struct WSConfig_
 /* A WebSocket Instance */
 typedef struct WSServer_
 {
-  /* Server Status */
-  int closing;
-
   /* Callbacks */
   int (*onclose) (WSPipeOut * pipeout, WSClient * client);
   int (*onmessage) (WSPipeOut * pipeout, WSClient * client);
@@ -309,20 +406,39 @@ typedef struct WSServer_
   WSPipeOut *pipeout;
   /* Connected Clients */
   GSLList *colist;
+  /* Connected Clients, indexed by socket */
+  WSClient **clients;
+  int clients_len;
 
 #ifdef HAVE_LIBSSL
   SSL_CTX *ctx;
 #endif
 } WSServer;
 
+/* A frame being broadcast to all clients */
+typedef struct WSBroadcast_
+{
+  WSServer *server;
+  WSBuffer *frm;
+} WSBroadcast;
+
 int ws_read_fifo (int fd, char *buf, int *buflen, int pos, int need);
 int ws_send_data (WSClient * client, WSOpcode opcode, const char *p, int sz);
 int ws_setfifo (const char *pipename);
 int ws_validate_string (const char *str, int len);
+int ws_fifo_flush (WSFifoQueue * queue, int fd);
+int ws_fifo_stale (uint32_t * last, uint32_t seq);
 int ws_write_fifo (WSPipeOut * pipeout, char *buffer, int len);
+int ws_write_fifo_packet (WSPipeOut * pipeout, uint32_t listener,
+                          uint32_t type, uint32_t flags, const char *data,
+                          int len);
 size_t pack_uint32 (void *buf, uint32_t val);
 size_t unpack_uint32 (const void *buf, uint32_t * val);
 void set_nonblocking (int listener);
+void ws_fifo_clear (WSFifoQueue * queue);
+void ws_fifo_push (WSFifoQueue * queue, uint32_t listener, uint32_t type,
+                   uint32_t flags, const char *data, int len);
+void ws_unpack_fifo_hdr (const char *buf, WSFifoHdr * hdr);
 void ws_set_config_accesslog (const char *accesslog);
 void ws_set_config_echomode (int echomode);
 void ws_set_config_frame_size (int max_frm_size);
@@ -38,6 +38,33 @@
 #include "error.h"
 #include "xmalloc.h"
 
+/* allocations are counted only while benchmarking */
+static int xalloc_counting = 0;
+static uint64_t xalloc_allocs = 0;
+
+/* Count the allocations made from now on if enable is set, see
+ * --benchmark-micro. */
+void
+xalloc_count_enable (int enable)
+{
+  xalloc_counting = enable;
+}
+
+/* Count an allocation, if allocations are being counted. */
+void
+xalloc_count_inc (void)
+{
+  if (xalloc_counting)
+    __atomic_add_fetch (&xalloc_allocs, 1, __ATOMIC_RELAXED);
+}
+
+/* Get the number of allocations counted so far. */
+uint64_t
+xalloc_count (void)
+{
+  return __atomic_load_n (&xalloc_allocs, __ATOMIC_RELAXED);
+}
+
 /* Self-checking wrapper to malloc() */
 void *
 xmalloc (size_t size)
@@ -46,6 +73,7 @@ xmalloc (size_t size)
 
   if ((ptr = malloc (size)) == NULL)
     FATAL ("Unable to allocate memory - failed.");
+  xalloc_count_inc ();
 
   return (ptr);
 }
@@ -71,6 +99,7 @@ xcalloc (size_t nmemb, size_t size)
 
   if ((ptr = calloc (nmemb, size)) == NULL)
     FATAL ("Unable to calloc memory - failed.");
+  xalloc_count_inc ();
 
   return (ptr);
 }
@@ -83,6 +112,7 @@ xrealloc (void *oldptr, size_t size)
 
   if ((newptr = realloc (oldptr, size)) == NULL)
     FATAL ("Unable to reallocate memory - failed");
+  xalloc_count_inc ();
 
   return (newptr);
 }
@@ -30,9 +30,15 @@
 #ifndef XMALLOC_H_INCLUDED
 #define XMALLOC_H_INCLUDED
 
+#include <stdint.h>
+
 char *xstrdup (const char *s);
 void *xcalloc (size_t nmemb, size_t size);
 void *xmalloc (size_t size);
 void *xrealloc (void *oldptr, size_t size);
 
+uint64_t xalloc_count (void);
+void xalloc_count_enable (int enable);
+void xalloc_count_inc (void);
+
 #endif